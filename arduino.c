@@ -36,8 +36,13 @@
 #include "stk500_private.h"
 #include "stk500.h"
 #include "serial.h"
+#include "stats.h"
 #include "arduino.h"
 
+#define ARDUINO_RESET_HOLD  50  /* ms DTR/RTS are held low before reset */
+#define ARDUINO_SYNC_POLL   10  /* ms between sync requests after reset */
+#define ARDUINO_SYNC_WINDOW 300 /* ms to poll before the plain getsync */
+
 /* read signature bytes - arduino version */
 static int arduino_read_sig_bytes(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
 {
@@ -83,6 +88,50 @@ static int arduino_read_sig_bytes(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
   return 3;
 }
 
+/*
+ * Ask for sync every few milliseconds from the moment reset is
+ * released, so a bootloader that comes up quickly is talked to at
+ * once.  Answers to requests sent while it was still busy are drained
+ * afterwards.  Returns -1 if nothing answered within the window.
+ */
+static int arduino_sync(PROGRAMMER * pgm)
+{
+  unsigned char buf[2], c;
+  long otimeout = serial_recv_timeout;
+  double start = stats_time(), now;
+  int insync = 0;
+
+  buf[0] = Cmnd_STK_GET_SYNC;
+  buf[1] = Sync_CRC_EOP;
+
+  serial_recv_timeout = ARDUINO_SYNC_POLL;
+  do {
+    if (serial_send(&pgm->fd, buf, 2) < 0)
+      break;
+    while (serial_recv(&pgm->fd, &c, 1) >= 0) {
+      if (c == Resp_STK_INSYNC && serial_recv(&pgm->fd, &c, 1) >= 0 &&
+          c == Resp_STK_OK) {
+        insync = 1;
+        break;
+      }
+      if ((stats_time() - start) * 1000 >= ARDUINO_SYNC_WINDOW)
+        break;
+    }
+    now = stats_time();
+  } while (!insync && (now - start) * 1000 < ARDUINO_SYNC_WINDOW);
+  serial_recv_timeout = otimeout;
+
+  if (!insync)
+    return -1;
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: bootloader in sync %.0f ms after reset\n",
+            progname, (now - start) * 1000);
+  stk500_drain(pgm, 0);
+
+  return 0;
+}
+
 static int arduino_open(PROGRAMMER * pgm, char * port)
 {
   union pinfo pinfo;
@@ -95,10 +144,12 @@ static int arduino_open(PROGRAMMER * pgm, char * port)
   /* Clear DTR and RTS to unload the RESET capacitor 
    * (for example in Arduino) */
   serial_set_dtr_rts(&pgm->fd, 0);
-  usleep(250*1000);
+  usleep(ARDUINO_RESET_HOLD*1000);
   /* Set DTR and RTS back to high */
   serial_set_dtr_rts(&pgm->fd, 1);
-  usleep(50*1000);
+
+  if (arduino_sync(pgm) == 0)
+    return 0;
 
   /*
    * drain any extraneous input
@@ -132,4 +183,6 @@ void arduino_initpgm(PROGRAMMER * pgm)
   pgm->read_sig_bytes = arduino_read_sig_bytes;
   pgm->open = arduino_open;
   pgm->close = arduino_close;
+  /* STK_PROG_PAGE erases the page first */
+  pgm->page_write_erases = 1;
 }
@@ -0,0 +1,123 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Bump allocator for the objects built from the configuration files.
+ * They live until cleanup_config(), so they are carved out of a few
+ * large chunks, and freeing them one by one is a no-op; the chunks go
+ * away together in arena_release().
+ */
+
+#include "ac_cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* first chunk size; each further chunk is twice as large */
+#define ARENA_CHUNK 65536
+
+/* alignment of the returned memory */
+#define ARENA_ALIGN sizeof(union { long l; double d; void * p; })
+
+struct arena_chunk {
+  struct arena_chunk * next;
+  char *               end;
+  char                 data[];
+};
+
+static struct arena_chunk * chunks;
+static size_t chunk_size = ARENA_CHUNK;
+static char * arena_ptr;
+static int    arena_on;
+
+
+void arena_enable(int on)
+{
+  arena_on = on;
+}
+
+void * arena_alloc(size_t size)
+{
+  struct arena_chunk * c;
+  void * p;
+
+  if (!arena_on)
+    return calloc(1, size > 0? size: 1);
+
+  size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if (chunks == NULL || (size_t)(chunks->end - arena_ptr) < size) {
+    while (chunk_size < size)
+      chunk_size *= 2;
+    c = (struct arena_chunk *)calloc(1, sizeof(*c) + chunk_size);
+    if (c == NULL)
+      return NULL;
+    c->end = c->data + chunk_size;
+    c->next = chunks;
+    chunks = c;
+    arena_ptr = c->data;
+    chunk_size *= 2;
+  }
+
+  p = arena_ptr;
+  arena_ptr += size;
+
+  return p;
+}
+
+char * arena_strdup(const char * s)
+{
+  char * d;
+
+  if ((d = arena_alloc(strlen(s) + 1)) != NULL)
+    strcpy(d, s);
+
+  return d;
+}
+
+static int arena_owns(const void * p)
+{
+  struct arena_chunk * c;
+
+  for (c = chunks; c != NULL; c = c->next)
+    if ((const char *)p >= c->data && (const char *)p < c->end)
+      return 1;
+
+  return 0;
+}
+
+void arena_free(void * p)
+{
+  if (p != NULL && !arena_owns(p))
+    free(p);
+}
+
+void arena_release(void)
+{
+  struct arena_chunk * c;
+
+  while ((c = chunks) != NULL) {
+    chunks = c->next;
+    free(c);
+  }
+  chunk_size = ARENA_CHUNK;
+  arena_ptr = NULL;
+}
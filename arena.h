@@ -0,0 +1,49 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef arena_h
+#define arena_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * While enabled, arena_alloc() hands out memory from the arena, else
+ * from calloc().  Either way the memory is zeroed; NULL means out of
+ * memory.
+ */
+void   arena_enable(int on);
+void * arena_alloc(size_t size);
+char * arena_strdup(const char * s);
+
+/* free p unless it belongs to the arena */
+void   arena_free(void * p);
+
+/* free the whole arena; nothing allocated from it may be used after */
+void   arena_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
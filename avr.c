@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -35,11 +36,28 @@
 #include "pindefs.h"
 #include "ppi.h"
 #include "safemode.h"
+#include "stats.h"
 #include "update.h"
 #include "tpi.h"
 
 FP_UpdateProgress update_progress;
 
+/* stop reading flash where the rest of it is blank (-z) */
+int read_stop_blank;
+
+/* read EEPROM pages before writing them, to leave out the same (-W) */
+int eeprom_skip_same;
+
+/* told about the bytes read so far by avr_read_stream() */
+static avr_read_cb read_cb;
+static void * read_ctx;
+
+/* how much of the memory the last read has fetched, at most */
+static unsigned long read_end;
+
+/* set once anything may have written a fuse in this session */
+static int fuses_written;
+
 #define DEBUG 0
 
 /* TPI: returns 1 if NVM controller busy, 0 if free */
@@ -53,6 +71,97 @@ int avr_tpi_poll_nvmbsy(PROGRAMMER *pgm)
   return (res & TPI_IOREG_NVMCSR_NVMBSY);
 }
 
+/*
+ * TPI: run count commands of cmd_len bytes, each answered by res_len
+ * bytes, as one stream if the programmer can do so
+ */
+static int avr_tpi_cmd_seq(PROGRAMMER * pgm, const unsigned char * cmd,
+                           int cmd_len, unsigned char * res, int res_len,
+                           int count)
+{
+  int i;
+
+  if (pgm->cmd_tpi_seq != NULL)
+    return pgm->cmd_tpi_seq(pgm, cmd, cmd_len, res, res_len, count);
+
+  for (i = 0; i < count; i++)
+    if (pgm->cmd_tpi(pgm, cmd + i * cmd_len, cmd_len,
+                     res + i * res_len, res_len) < 0)
+      return -1;
+
+  return 0;
+}
+
+/* busy polls that go out together while waiting for the NVM controller */
+#define AVR_TPI_POLLS 8
+
+/*
+ * TPI: wait until the NVM controller is free; programmers that stream
+ * commands get AVR_TPI_POLLS polls per round trip instead of one
+ */
+static int avr_tpi_wait_nvm(PROGRAMMER * pgm)
+{
+  unsigned char cmd[AVR_TPI_POLLS], res[AVR_TPI_POLLS];
+  int i;
+
+  if (pgm->cmd_tpi_seq == NULL) {
+    while (avr_tpi_poll_nvmbsy(pgm));
+    return 0;
+  }
+
+  memset(cmd, TPI_CMD_SIN | TPI_SIO_ADDR(TPI_IOREG_NVMCSR), sizeof(cmd));
+  for (;;) {
+    if (pgm->cmd_tpi_seq(pgm, cmd, 1, res, 1, AVR_TPI_POLLS) < 0)
+      return -1;
+    for (i = 0; i < AVR_TPI_POLLS; i++)
+      if (!(res[i] & TPI_IOREG_NVMCSR_NVMBSY))
+        return 0;
+  }
+}
+
+/*
+ * TPI: put the commands setting the NVMCMD register and the pointer
+ * register (PR) into cmd, returns their length
+ */
+static int avr_tpi_put_setup(unsigned char * cmd, AVRMEM * mem,
+                             unsigned long addr, unsigned char nvmcmd)
+{
+  cmd[0] = TPI_CMD_SOUT | TPI_SIO_ADDR(TPI_IOREG_NVMCMD);
+  cmd[1] = nvmcmd;
+  cmd[2] = TPI_CMD_SSTPR | 0;
+  cmd[3] = (mem->offset + addr) & 0xFF;
+  cmd[4] = TPI_CMD_SSTPR | 1;
+  cmd[5] = ((mem->offset + addr) >> 8) & 0xFF;
+
+  return 6;
+}
+
+/*
+ * TPI: write the two bytes of data through SST *PR+ and wait for the
+ * NVM controller; the setup_len bytes of setup commands, if any, and
+ * the first busy poll go out with the data
+ */
+static int avr_tpi_write_word(PROGRAMMER * pgm, const unsigned char * setup,
+                              int setup_len, const unsigned char * data)
+{
+  unsigned char cmd[6 + 5];
+  unsigned char res;
+
+  memcpy(cmd, setup, setup_len);
+  cmd[setup_len + 0] = TPI_CMD_SST_PI;
+  cmd[setup_len + 1] = data[0];
+  cmd[setup_len + 2] = TPI_CMD_SST_PI;
+  cmd[setup_len + 3] = data[1];
+  cmd[setup_len + 4] = TPI_CMD_SIN | TPI_SIO_ADDR(TPI_IOREG_NVMCSR);
+  if (pgm->cmd_tpi(pgm, cmd, setup_len + 5, &res, 1) < 0)
+    return -1;
+
+  if (res & TPI_IOREG_NVMCSR_NVMBSY)
+    return avr_tpi_wait_nvm(pgm);
+
+  return 0;
+}
+
 /* TPI chip erase sequence */
 int avr_tpi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
@@ -85,13 +194,13 @@ int avr_tpi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 			0xFF
 		};
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
 		err = pgm->cmd_tpi(pgm, cmd, sizeof(cmd), NULL, 0);
 		if(err)
 			return err;
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
     pgm->pgm_led(pgm, OFF);
 
@@ -156,32 +265,41 @@ int avr_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p, unsigned char guard_ti
 static int avr_tpi_setup_rw(PROGRAMMER * pgm, AVRMEM * mem,
 			    unsigned long addr, unsigned char nvmcmd)
 {
-  unsigned char cmd[4];
+  unsigned char cmd[6];
   int rc;
 
-  /* set NVMCMD register */
-  cmd[0] = TPI_CMD_SOUT | TPI_SIO_ADDR(TPI_IOREG_NVMCMD);
-  cmd[1] = nvmcmd;
-  rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
+  /* all three commands in one transfer */
+  rc = pgm->cmd_tpi(pgm, cmd, avr_tpi_put_setup(cmd, mem, addr, nvmcmd),
+                    NULL, 0);
   if (rc == -1)
     return -1;
 
-  /* set Pointer Register (PR) */
-  cmd[0] = TPI_CMD_SSTPR | 0;
-  cmd[1] = (mem->offset + addr) & 0xFF;
-  rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
-  if (rc == -1)
-    return -1;
+  return 0;
+}
 
-  cmd[0] = TPI_CMD_SSTPR | 1;
-  cmd[1] = ((mem->offset + addr) >> 8) & 0xFF;
-  rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
-  if (rc == -1)
-    return -1;
+/*
+ * Return the read opcode for the byte at addr, and turn addr into the
+ * address the opcode takes.
+ */
+static OPCODE * avr_read_op(AVRMEM * mem, unsigned long * addr)
+{
+  OPCODE * readop;
 
-  return 0;
+  if (mem->op[AVR_OP_READ_LO]) {
+    if (*addr & 0x00000001)
+      readop = mem->op[AVR_OP_READ_HI];
+    else
+      readop = mem->op[AVR_OP_READ_LO];
+    *addr = *addr / 2;
+  }
+  else {
+    readop = mem->op[AVR_OP_READ];
+  }
+
+  return readop;
 }
 
+
 int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, 
                           unsigned long addr, unsigned char * value)
 {
@@ -209,7 +327,7 @@ int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       return -1;
     }
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
     /* setup for read */
     avr_tpi_setup_rw(pgm, mem, addr, TPI_NVMCMD_NO_OPERATION);
@@ -226,16 +344,7 @@ int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   /*
    * figure out what opcode to use
    */
-  if (mem->op[AVR_OP_READ_LO]) {
-    if (addr & 0x00000001)
-      readop = mem->op[AVR_OP_READ_HI];
-    else
-      readop = mem->op[AVR_OP_READ_LO];
-    addr = addr / 2;
-  }
-  else {
-    readop = mem->op[AVR_OP_READ];
-  }
+  readop = avr_read_op(mem, &addr);
 
   if (readop == NULL) {
 #if DEBUG
@@ -278,6 +387,175 @@ int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 }
 
 
+int avr_cmd_batch(PROGRAMMER * pgm, const unsigned char * cmd,
+                  unsigned char * res, int n)
+{
+  int i;
+
+  if (pgm->spi != NULL)
+    return pgm->spi(pgm, cmd, res, 4 * n) < 0? -1: 0;
+
+  for (i = 0; i < n; i++)
+    if (pgm->cmd(pgm, cmd + 4 * i, res + 4 * i) < 0)
+      return -1;
+
+  return 0;
+}
+
+
+int avr_read_bytes_batch(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                         unsigned long addr, int n, unsigned char * buf)
+{
+  unsigned char cmd[4 * (AVR_CMD_BATCH + 1)], res[4 * (AVR_CMD_BATCH + 1)];
+  unsigned long caddr, ext;
+  OPCODE * readop, * lext;
+  int i, k, ncmd, start;
+
+  if (pgm->cmd == NULL || (p->flags & AVRPART_HAS_TPI))
+    return -1;
+
+  lext = mem->op[AVR_OP_LOAD_EXT_ADDR];
+  ext = (unsigned long)-1L;
+
+  pgm->pgm_led(pgm, ON);
+  pgm->err_led(pgm, OFF);
+
+  for (i = 0; i < n; ) {
+    /* one batch, preceded by a load extended address command if needed */
+    memset(cmd, 0, sizeof(cmd));
+    ncmd = 0;
+    start = i;
+    for (; i < n && i - start < AVR_CMD_BATCH; i++) {
+      caddr = addr + i;
+      if ((readop = avr_read_op(mem, &caddr)) == NULL)
+        return -1;
+      if (lext != NULL && (caddr >> 16) != ext) {
+        if (ncmd > 0)
+          break;
+        avr_set_bits(lext, cmd);
+        avr_set_addr(lext, cmd, caddr);
+        ext = caddr >> 16;
+        ncmd++;
+      }
+      avr_set_bits(readop, cmd + 4 * ncmd);
+      avr_set_addr(readop, cmd + 4 * ncmd, caddr);
+      ncmd++;
+    }
+
+    if (avr_cmd_batch(pgm, cmd, res, ncmd) < 0)
+      return -1;
+
+    for (k = start; k < i; k++) {
+      caddr = addr + k;
+      readop = avr_read_op(mem, &caddr);
+      buf[k] = 0;
+      avr_get_output(readop, res + 4 * (ncmd - (i - k)), buf + k);
+    }
+  }
+
+  pgm->pgm_led(pgm, OFF);
+
+  return 0;
+}
+
+
+int avr_config_cmds(AVRMEM * mems[], const unsigned long addrs[],
+                    int n, unsigned char * cmd)
+{
+  OPCODE * readop;
+  int i;
+
+  memset(cmd, 0, 4 * n);
+  for (i = 0; i < n; i++) {
+    readop = mems[i]->op[AVR_OP_READ];
+    if (readop == NULL || mems[i]->op[AVR_OP_LOAD_EXT_ADDR] != NULL)
+      return -1;
+    avr_set_bits(readop, cmd + 4 * i);
+    avr_set_addr(readop, cmd + 4 * i, addrs[i]);
+  }
+
+  return 0;
+}
+
+
+void avr_config_values(AVRMEM * mems[], unsigned char * res,
+                       unsigned char * values, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    values[i] = 0;
+    avr_get_output(mems[i]->op[AVR_OP_READ], res + 4 * i, values + i);
+  }
+}
+
+
+int avr_read_config_bytes_default(PROGRAMMER * pgm, AVRPART * p,
+                                  AVRMEM * mems[], const unsigned long addrs[],
+                                  unsigned char * values, int n)
+{
+  unsigned char cmd[4 * AVR_CMD_BATCH], res[4 * AVR_CMD_BATCH];
+  int i;
+
+  /* plain ISP read commands can go out back to back in one transfer */
+  if (pgm->spi != NULL && pgm->read_byte == avr_read_byte_default &&
+      !(p->flags & AVRPART_HAS_TPI) && n <= AVR_CMD_BATCH &&
+      avr_config_cmds(mems, addrs, n, cmd) == 0) {
+    pgm->pgm_led(pgm, ON);
+    pgm->err_led(pgm, OFF);
+    if (avr_cmd_batch(pgm, cmd, res, n) < 0)
+      return -1;
+    avr_config_values(mems, res, values, n);
+    pgm->pgm_led(pgm, OFF);
+    return 0;
+  }
+
+  for (i = 0; i < n; i++)
+    if (pgm->read_byte(pgm, p, mems[i], addrs[i], values + i) != 0)
+      return -1;
+
+  return 0;
+}
+
+
+int avr_read_config_bytes(PROGRAMMER * pgm, AVRPART * p,
+                          AVRMEM * mems[], const unsigned long addrs[],
+                          unsigned char * values, int n)
+{
+  if (n <= 0)
+    return 0;
+
+  if (pgm->read_config_bytes != NULL)
+    return pgm->read_config_bytes(pgm, p, mems, addrs, values, n);
+
+  return avr_read_config_bytes_default(pgm, p, mems, addrs, values, n);
+}
+
+
+/*
+ * The bulk buffer scans below look at VSCAN_BYTES bytes per step, as
+ * two 64-bit words, and only drop to the bytewise code for a step
+ * where something has been found.
+ */
+#define VSCAN_BYTES 16
+
+static int avr_vscan_equal(const unsigned char * a, const unsigned char * b)
+{
+  uint64_t wa[2], wb[2];
+
+  memcpy(wa, a, VSCAN_BYTES);
+  memcpy(wb, b, VSCAN_BYTES);
+  return ((wa[0] ^ wb[0]) | (wa[1] ^ wb[1])) == 0;
+}
+
+static int avr_vscan_erased(const unsigned char * a)
+{
+  uint64_t w[2];
+
+  memcpy(w, a, VSCAN_BYTES);
+  return (w[0] & w[1]) == ~(uint64_t)0;
+}
+
 /*
  * Return the number of "interesting" bytes in a memory buffer,
  * "interesting" being defined as up to the last non-0xff data
@@ -291,7 +569,11 @@ int avr_mem_hiaddr(AVRMEM * mem)
 
   /* return the highest non-0xff address regardless of how much
      memory was read */
-  for (i=mem->size-1; i>0; i--) {
+  i = mem->size - 1;
+  /* skip erased blocks ending at i; byte 0 is never part of one */
+  while (i >= VSCAN_BYTES && avr_vscan_erased(mem->buf + i - VSCAN_BYTES + 1))
+    i -= VSCAN_BYTES;
+  for (; i>0; i--) {
     if (mem->buf[i] != 0xff) {
       n = i+1;
       if (n & 0x01)
@@ -309,17 +591,14 @@ int avr_mem_hiaddr(AVRMEM * mem)
  * Read the entirety of the specified memory type into the
  * corresponding buffer of the avrpart pointed to by 'p'.
  * If v is non-NULL, verify against v's memory area, only
- * those cells that are tagged TAG_ALLOCATED are verified.
+ * those cells that are tagged as allocated are verified.
  *
  * Return the number of bytes read, or < 0 if an error occurs.  
  */
 int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
              AVRPART * v)
 {
-  unsigned long    i, lastaddr;
-  unsigned char    cmd[4];
   AVRMEM * mem, * vmem = NULL;
-  int rc;
 
   mem = avr_locate_mem(p, memtype);
   if (v != NULL)
@@ -330,40 +609,157 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     return -1;
   }
 
+  return avr_read_mem(pgm, p, mem, vmem);
+}
+
+/*
+ * Same as avr_read() without verifying, calling cb whenever more of
+ * the memory has been read, so the data can be used before all of it
+ * is there.
+ */
+int avr_read_stream(PROGRAMMER * pgm, AVRPART * p, char * memtype,
+                    avr_read_cb cb, void * ctx)
+{
+  int rc;
+
+  read_cb = cb;
+  read_ctx = ctx;
+  rc = avr_read(pgm, p, memtype, NULL);
+  read_cb = NULL;
+  read_ctx = NULL;
+
+  return rc;
+}
+
+static void avr_read_done(AVRMEM * mem, unsigned long n)
+{
+  if (read_cb != NULL)
+    read_cb(read_ctx, mem, n);
+}
+
+static int avr_flash_mem(AVRMEM * mem)
+{
+  return strcasecmp(mem->desc, "flash") == 0 ||
+    strcasecmp(mem->desc, "application") == 0 ||
+    strcasecmp(mem->desc, "apptable") == 0 ||
+    strcasecmp(mem->desc, "boot") == 0;
+}
+
+/*
+ * Whether len bytes of mem from addr are blank on the device, as far
+ * as the programmer can tell without reading them: 1 if so, 0 if
+ * not, -1 if unknown.  A device CRC compare against the buffer, still
+ * all 0xff there, does as well as a blank check.
+ */
+static int avr_blank_range(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                           unsigned long addr, unsigned long len)
+{
+  int rc;
+
+  if (pgm->blank_check != NULL)
+    return pgm->blank_check(pgm, p, mem, addr, len);
+  if (pgm->verify_range == NULL)
+    return -1;
+  rc = pgm->verify_range(pgm, p, mem, addr, len);
+  return rc < 0? -1: rc == 0;
+}
+
+/*
+ * Where a read of flash memory mem can stop, the rest of it being
+ * blank: what a chip erase in this run has left alone, narrowed down
+ * by bisecting on page boundaries with the programmer's blank check.
+ */
+static unsigned long avr_read_end(PROGRAMMER * pgm, AVRPART * p,
+                                  AVRMEM * mem)
+{
+  unsigned long unit, lo, hi, mid, end;
+  int rc;
+
+  unit = mem->page_size > 0? mem->page_size: 1;
+  end = mem->size - mem->known_blank;
+  /* everything from page hi on is blank */
+  hi = (end + unit - 1) / unit;
+  if (pgm->blank_check != NULL || pgm->verify_range != NULL)
+    for (lo = 0; lo < hi; ) {
+      mid = lo + (hi - lo) / 2;
+      end = hi * unit < mem->size? hi * unit: mem->size;
+      rc = avr_blank_range(pgm, p, mem, mid * unit, end - mid * unit);
+      if (rc < 0)
+        break;
+      if (rc)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  end = hi * unit < mem->size? hi * unit: mem->size;
+  if (verbose >= 2 && end < mem->size)
+    fprintf(stderr, "%s: avr_read(): %s memory is blank from 0x%05lx on\n",
+            progname, mem->desc, end);
+  return end;
+}
+
+/*
+ * Same as avr_read(), for a memory that has already been located.  If
+ * vmem is non-NULL, only the cells it tags are read, and those already
+ * in the read-back cache of mem are taken from there instead of being
+ * fetched from the device again.
+ */
+static int avr_read_mem_all(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                           AVRMEM * vmem)
+{
+  unsigned long    i, lastaddr, end;
+  unsigned char    tpi_cmd[AVR_CMD_BATCH];
+  int rc, batch, n;
+
   /*
    * start with all 0xff
    */
+  avr_mem_unshare(mem, 0);
   memset(mem->buf, 0xff, mem->size);
 
+  /* what is not read is still 0xff in the buffer */
+  end = mem->size;
+  if (read_stop_blank && vmem == NULL && avr_flash_mem(mem))
+    end = avr_read_end(pgm, p, mem);
+  read_end = end;
+
   /* supports "paged load" thru post-increment */
   if ((p->flags & AVRPART_HAS_TPI) && mem->page_size != 0 &&
       pgm->cmd_tpi != NULL) {
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
     /* setup for read (NOOP) */
     avr_tpi_setup_rw(pgm, mem, 0, TPI_NVMCMD_NO_OPERATION);
 
-    /* load bytes */
-    for (lastaddr = i = 0; i < mem->size; i++) {
-      if (vmem == NULL ||
-          (vmem->tags[i] & TAG_ALLOCATED) != 0)
-      {
-        if (lastaddr != i) {
-          /* need to setup new address */
-          avr_tpi_setup_rw(pgm, mem, i, TPI_NVMCMD_NO_OPERATION);
-          lastaddr = i;
-        }
-        cmd[0] = TPI_CMD_SLD_PI;
-        rc = pgm->cmd_tpi(pgm, cmd, 1, mem->buf + i, 1);
-        lastaddr++;
-        if (rc == -1) {
-          fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
-          return -1;
-        }
+    /* load runs of bytes, up to AVR_CMD_BATCH at a time */
+    memset(tpi_cmd, TPI_CMD_SLD_PI, sizeof(tpi_cmd));
+    for (lastaddr = i = 0; i < end; ) {
+      if (vmem != NULL && !avr_mem_tagged(vmem, i)) {
+        i++;
+        continue;
+      }
+      for (n = 1; n < AVR_CMD_BATCH && i + n < end &&
+             (vmem == NULL || avr_mem_tagged(vmem, i + n));
+           n++)
+        ;
+      if (lastaddr != i) {
+        /* need to setup new address */
+        avr_tpi_setup_rw(pgm, mem, i, TPI_NVMCMD_NO_OPERATION);
+        lastaddr = i;
       }
-      report_progress(i, mem->size, NULL);
+      rc = avr_tpi_cmd_seq(pgm, tpi_cmd, 1, mem->buf + i, 1, n);
+      if (rc == -1) {
+        fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
+        return -1;
+      }
+      i += n;
+      lastaddr += n;
+      avr_read_done(mem, i);
+      report_progress(i, end, NULL);
     }
+    avr_read_done(mem, mem->size);
     return avr_mem_hiaddr(mem);
   }
 
@@ -371,62 +767,62 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     /*
      * the programmer supports a paged mode read
      */
-    int need_read, failure;
+    int failure, next;
     unsigned int pageaddr;
     unsigned int npages, nread;
 
-    /* quickly scan number of pages to be written to first */
-    for (pageaddr = 0, npages = 0;
-         pageaddr < mem->size;
-         pageaddr += mem->page_size) {
-      /* check whether this page must be read */
-      for (i = pageaddr;
-           i < pageaddr + mem->page_size;
-           i++)
-        if (vmem == NULL /* no verify, read everything */ ||
-            (mem->tags[i] & TAG_ALLOCATED) != 0 /* verify, do only
-                                                    read pages that
-                                                    are needed in
-                                                    input file */) {
-          npages++;
-          break;
-        }
-    }
+    /*
+     * Without verify, read everything; with verify, only read the
+     * pages that are needed in the input file.
+     */
+    if (vmem == NULL)
+      npages = (end + mem->page_size - 1) / mem->page_size;
+    else
+      npages = avr_mem_count_dirty(vmem, mem->size);
 
     for (pageaddr = 0, failure = 0, nread = 0;
-         !failure && pageaddr < mem->size;
+         !failure && pageaddr < end;
          pageaddr += mem->page_size) {
-      /* check whether this page must be read */
-      for (i = pageaddr, need_read = 0;
-           i < pageaddr + mem->page_size;
-           i++)
-        if (vmem == NULL /* no verify, read everything */ ||
-            (vmem->tags[i] & TAG_ALLOCATED) != 0 /* verify, do only
-                                                    read pages that
-                                                    are needed in
-                                                    input file */) {
-          need_read = 1;
+      if (vmem != NULL) {
+        next = avr_mem_next_dirty(vmem, pageaddr, mem->size);
+        if (verbose >= 3 && (next < 0 || next > pageaddr))
+          fprintf(stderr,
+                  "%s: avr_read(): skipping pages %u to %u: no interesting data\n",
+                  progname, pageaddr / mem->page_size,
+                  (next < 0? mem->size: next) / mem->page_size - 1);
+        if (next < 0)
           break;
-        }
-      if (need_read) {
+        pageaddr = next;
+      }
+      if (vmem != NULL &&
+          avr_mem_cache_covers(mem, vmem, pageaddr, mem->page_size)) {
+        if (verbose >= 3)
+          fprintf(stderr,
+                  "%s: avr_read(): page %u already read back\n",
+                  progname, pageaddr / mem->page_size);
+        avr_mem_cache_fetch(mem, pageaddr, mem->page_size);
+        rc = 0;
+      } else {
+        stats_page(mem->desc, STATS_READ);
         rc = pgm->paged_load(pgm, p, mem, mem->page_size,
-                            pageaddr, mem->page_size);
-        if (rc < 0)
-          /* paged load failed, fall back to byte-at-a-time read below */
-          failure = 1;
-      } else if (verbose >= 3) {
-        fprintf(stderr,
-                "%s: avr_read(): skipping page %u: no interesting data\n",
-                progname, pageaddr / mem->page_size);
+                             pageaddr, mem->page_size);
+        if (rc >= 0)
+          avr_mem_cache_store(mem, pageaddr, mem->buf + pageaddr,
+                              pageaddr + mem->page_size <= mem->size?
+                              mem->page_size: mem->size - pageaddr);
       }
+      if (rc >= 0)
+        avr_read_done(mem, pageaddr + mem->page_size <= mem->size?
+                      pageaddr + mem->page_size: mem->size);
+      if (rc < 0)
+        /* paged load failed, fall back to byte-at-a-time read below */
+        failure = 1;
       nread++;
-      report_progress(nread, npages, NULL);
+      report_progress(nread * mem->page_size, npages * mem->page_size, NULL);
     }
     if (!failure) {
-      if (strcasecmp(mem->desc, "flash") == 0 ||
-          strcasecmp(mem->desc, "application") == 0 ||
-          strcasecmp(mem->desc, "apptable") == 0 ||
-          strcasecmp(mem->desc, "boot") == 0)
+      avr_read_done(mem, mem->size);
+      if (avr_flash_mem(mem))
         return avr_mem_hiaddr(mem);
       else
         return mem->size;
@@ -440,33 +836,163 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
     }
   }
 
-  for (i=0; i < mem->size; i++) {
-    if (vmem == NULL ||
-	(vmem->tags[i] & TAG_ALLOCATED) != 0)
+  /*
+   * Programmers that can send many SPI commands at once read runs of
+   * bytes in batches.
+   */
+  batch = pgm->read_byte == avr_read_byte_default && pgm->spi != NULL &&
+          (p->flags & AVRPART_HAS_TPI) == 0;
+
+  for (i=0; i < end; i++) {
+    if (vmem == NULL || avr_mem_tagged(vmem, i))
     {
-      rc = pgm->read_byte(pgm, p, mem, i, mem->buf + i);
-      if (rc != 0) {
-	fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
-	if (rc == -1) 
-	  fprintf(stderr, 
-		  "    read operation not supported for memory \"%s\"\n",
-		  memtype);
-	return -2;
+      if (vmem != NULL && avr_mem_cache_covers(mem, NULL, i, 1))
+        avr_mem_cache_fetch(mem, i, 1);
+      else if (batch) {
+        for (n = 1; n < AVR_CMD_BATCH && i + n < end; n++)
+          if ((vmem != NULL && !avr_mem_tagged(vmem, i + n)) ||
+              (vmem != NULL && avr_mem_cache_covers(mem, NULL, i + n, 1)))
+            break;
+        if (avr_read_bytes_batch(pgm, p, mem, i, n, mem->buf + i) < 0) {
+          fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
+          return -2;
+        }
+        avr_mem_cache_store(mem, i, mem->buf + i, n);
+        i += n - 1;
       }
+      else {
+        rc = pgm->read_byte(pgm, p, mem, i, mem->buf + i);
+        if (rc != 0) {
+          fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
+          if (rc == -1)
+            fprintf(stderr,
+                    "    read operation not supported for memory \"%s\"\n",
+                    mem->desc);
+          return -2;
+        }
+        avr_mem_cache_store(mem, i, mem->buf + i, 1);
+      }
+      avr_read_done(mem, i + 1);
     }
-    report_progress(i, mem->size, NULL);
+    report_progress(i, end, NULL);
   }
 
-  if (strcasecmp(mem->desc, "flash") == 0 ||
-      strcasecmp(mem->desc, "application") == 0 ||
-      strcasecmp(mem->desc, "apptable") == 0 ||
-      strcasecmp(mem->desc, "boot") == 0)
+  if (avr_flash_mem(mem)) {
+    avr_read_done(mem, mem->size);
     return avr_mem_hiaddr(mem);
+  }
   else
     return i;
 }
 
 
+/*
+ * The small memories that describe the device rather than hold the
+ * application: signature, fuses, lock and calibration bytes.  They
+ * are read by the signature check, safemode, the terminal and -U alike,
+ * so once all of such a memory is in its read-back cache, avr_read()
+ * takes it from there until something writes to it.
+ */
+static int avr_config_mem(AVRMEM * mem)
+{
+  return strcmp(mem->desc, "signature") == 0 ||
+         strcmp(mem->desc, "lock") == 0 ||
+         strcmp(mem->desc, "calibration") == 0 ||
+         strstr(mem->desc, "fuse") != NULL;
+}
+
+/*
+ * Forget the config memories read so far, after the device has been
+ * sent something avrdude cannot tell the effect of, e.g. a raw command
+ * in terminal mode.
+ */
+void avr_config_forget(AVRPART * p)
+{
+  LNODEID ln;
+  AVRMEM * m;
+
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    if (avr_config_mem(m))
+      avr_mem_cache_invalidate(m, 0, m->size);
+  }
+  fuses_written = 1;
+}
+
+/* whether a fuse may have been written in this session */
+int avr_fuses_written(void)
+{
+  return fuses_written;
+}
+
+int avr_read_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem)
+{
+  double start = stats_time();
+  int rc;
+
+  if (vmem == NULL && avr_config_mem(mem) &&
+      avr_mem_cache_covers(mem, NULL, 0, mem->size)) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: avr_read(): %s memory already read\n",
+              progname, mem->desc);
+    avr_mem_cache_fetch(mem, 0, mem->size);
+    avr_read_done(mem, mem->size);
+    return mem->size;
+  }
+
+  rc = avr_read_mem_all(pgm, p, mem, vmem);
+  if (rc >= 0 && vmem == NULL && avr_config_mem(mem))
+    avr_mem_cache_store(mem, 0, mem->buf, mem->size);
+  /* without vmem all of mem is read, up to where the rest is blank with
+     -z; rc only tells where the data ends */
+  stats_mem(mem->desc, STATS_READ, rc >= 0 && vmem == NULL? (long)read_end: rc,
+            start);
+
+  return rc;
+}
+
+
+/*
+ * Wait for the device to finish an erase or write that takes at most
+ * delay microseconds.  Parts with the "Poll RDY/BSY" instruction
+ * (pollmethod = 1 in the config file) are asked through pgm->cmd()
+ * until they are no longer busy; everything else, and the case
+ * where the answer never says ready, gets the full delay.
+ */
+void avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, unsigned int delay)
+{
+  unsigned char cmd[4];
+  unsigned char res[4];
+  unsigned long start_time, now;
+  struct timeval tv;
+
+  if (pgm->cmd == NULL || p->pollmethod != 1 ||
+      (p->flags & (AVRPART_HAS_TPI | AVRPART_HAS_PDI))) {
+    usleep(delay);
+    return;
+  }
+
+  gettimeofday(&tv, NULL);
+  start_time = (tv.tv_sec * 1000000) + tv.tv_usec;
+  do {
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0] = 0xf0;                      /* Poll RDY/BSY */
+    if (pgm->cmd(pgm, cmd, res) < 0)
+      break;
+    if ((res[3] & 0x01) == 0)
+      return;
+    gettimeofday(&tv, NULL);
+    now = (tv.tv_sec * 1000000) + tv.tv_usec;
+  } while (now - start_time < delay);
+
+  /* not ready yet, or no answer: make sure the full delay has passed */
+  gettimeofday(&tv, NULL);
+  now = (tv.tv_sec * 1000000) + tv.tv_usec;
+  if (now - start_time < delay)
+    usleep(delay - (now - start_time));
+}
+
+
 /*
  * write a page data at the specified address
  */
@@ -523,9 +1049,10 @@ int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
   /*
    * since we don't know what voltage the target AVR is powered by, be
-   * conservative and delay the max amount the spec says to wait
+   * conservative and delay the max amount the spec says to wait,
+   * unless the part can tell when it is done
    */
-  usleep(mem->max_write_delay);
+  avr_wait_ready(pgm, p, mem->max_write_delay);
 
   pgm->pgm_led(pgm, OFF);
   return 0;
@@ -537,6 +1064,7 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 {
   unsigned char cmd[4];
   unsigned char res[4];
+  unsigned char setup[6], word[2];
   unsigned char r;
   int ready;
   int tries;
@@ -572,7 +1100,7 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       return -1;
     }
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
     /* must erase fuse first */
     if (strcmp(mem->desc, "fuse") == 0) {
@@ -584,21 +1112,17 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       cmd[1] = 0xFF;
       rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
 
-      while (avr_tpi_poll_nvmbsy(pgm));
+      avr_tpi_wait_nvm(pgm);
     }
 
-    /* setup for WORD_WRITE */
-    avr_tpi_setup_rw(pgm, mem, addr, TPI_NVMCMD_WORD_WRITE);
-
-    cmd[0] = TPI_CMD_SST_PI;
-    cmd[1] = data;
-    rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
-    /* dummy high byte to start WORD_WRITE */
-    cmd[0] = TPI_CMD_SST_PI;
-    cmd[1] = data;
-    rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
-
-    while (avr_tpi_poll_nvmbsy(pgm));
+    /* setup for WORD_WRITE, the byte and a dummy high byte to start it */
+    word[0] = word[1] = data;
+    rc = avr_tpi_write_word(pgm, setup,
+                            avr_tpi_put_setup(setup, mem, addr,
+                                              TPI_NVMCMD_WORD_WRITE),
+                            word);
+    if (rc < 0)
+      return -1;
 
     return 0;
   }
@@ -627,6 +1151,7 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     else {
       readok = 1;
       if (b == data) {
+        avr_mem_cache_store(mem, addr, &b, 1);
         return 0;
       }
     }
@@ -689,7 +1214,7 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
      * read operation not supported for this memory type, just wait
      * the max programming time and then return 
      */
-    usleep(mem->max_write_delay); /* maximum write delay */
+    avr_wait_ready(pgm, p, mem->max_write_delay);
     pgm->pgm_led(pgm, OFF);
     return 0;
   }
@@ -790,6 +1315,9 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     }
   }
 
+  /* the polling above has read the new value back */
+  avr_mem_cache_store(mem, addr, &data, 1);
+
   pgm->pgm_led(pgm, OFF);
   return 0;
 }
@@ -825,10 +1353,62 @@ int avr_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   
   safemode_memfuses(1, &safemode_lfuse, &safemode_hfuse, &safemode_efuse, &safemode_fuse);
 
+  if (strstr(mem->desc, "fuse") != NULL)
+    fuses_written = 1;
+  avr_mem_cache_invalidate(mem, addr, 1);
+  mem->erased = 0;
+  avr_mem_unshare(mem, 1);
+
   return pgm->write_byte(pgm, p, mem, addr, data);
 }
 
 
+/*
+ * Send the n page load commands collected in cmd in one batch.
+ */
+static int avr_load_page_bulk(PROGRAMMER * pgm, unsigned char * cmd,
+                              unsigned char * res, int n)
+{
+  int rc;
+
+  if (n == 0)
+    return 0;
+
+  pgm->pgm_led(pgm, ON);
+  pgm->err_led(pgm, OFF);
+  rc = avr_cmd_batch(pgm, cmd, res, n);
+  pgm->pgm_led(pgm, OFF);
+
+  return rc;
+}
+
+
+/*
+ * Whether the allocated bytes of the page of m at pageaddr already
+ * hold their values on the device; the page is read into cur.  Some
+ * backends only set the bits they read (see avr_get_output()), so the
+ * page is cleared first rather than left holding the new image.  The
+ * read-back cache does not get the page, as a backend that leaves
+ * part of it alone would have it cached wrong.
+ */
+static int avr_page_unchanged(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                              AVRMEM * cur, unsigned int pageaddr)
+{
+  unsigned int i, len;
+
+  len = pageaddr + m->page_size <= m->size? m->page_size: m->size - pageaddr;
+  memset(cur->buf + pageaddr, 0, len);
+  stats_page(m->desc, STATS_READ);
+  if (pgm->paged_load(pgm, p, cur, m->page_size, pageaddr, m->page_size) < 0)
+    return 0;
+  for (i = pageaddr; i < pageaddr + len; i++)
+    if (avr_mem_tagged(m, i) && cur->buf[i] != m->buf[i])
+      return 0;
+
+  return 1;
+}
+
+
 /*
  * Write the whole memory region of the specified memory from the
  * corresponding buffer of the avrpart pointed to by 'p'.  Write up to
@@ -836,10 +1416,14 @@ int avr_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
  * value is different from the existing data value.  Data beyond
  * 'size' bytes is not affected.
  *
- * Return the number of bytes written, or -1 if an error occurs.
+ * Return the number of bytes written, or -1 if an error occurs.  If
+ * verified is not NULL and the programmer can read pages back as it
+ * writes them, each page is checked right after it is written, and
+ * *verified is set to 1 if all of them were, -1 on a mismatch, and 0
+ * if the write could not be checked.
  */
-int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size, 
-              int auto_erase)
+static int avr_write_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                         int size, int auto_erase, int * verified)
 {
   int              rc;
   int              newpage, page_tainted, flush_page, do_write;
@@ -847,8 +1431,14 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
   unsigned int     i, lastaddr;
   unsigned char    data;
   int              werror;
-  unsigned char    cmd[4];
-  AVRMEM         * m;
+  unsigned char    loadcmd[4 * AVR_CMD_BATCH], loadres[4 * AVR_CMD_BATCH];
+  int              nload, bulk, erased, skip_ff;
+  unsigned char    old[AVR_CMD_BATCH];
+  unsigned char    setup[6];
+  int              setup_len;
+  unsigned int     old_start, old_end;
+  int              precheck;
+  OPCODE         * loadop;
 
   if (verbose >= 3) {
     fprintf(stderr,
@@ -856,16 +1446,18 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
             size);
   }
 
-  m = avr_locate_mem(p, memtype);
-  if (m == NULL) {
-    fprintf(stderr, "No \"%s\" memory for part %s\n",
-            memtype, p->desc);
-    return -1;
-  }
-
   pgm->err_led(pgm, OFF);
 
   werror  = 0;
+  if (verified != NULL)
+    *verified = 0;
+
+  /* the paged and TPI paths below don't go through avr_write_byte() */
+  if (avr_config_mem(m)) {
+    avr_mem_cache_invalidate(m, 0, m->size);
+    if (strstr(m->desc, "fuse") != NULL)
+      fuses_written = 1;
+  }
 
   wsize = m->size;
   if (size < wsize) {
@@ -880,11 +1472,19 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
             progbuf, wsize);
   }
 
+  /* whatever has been read back before is about to change */
+  avr_mem_cache_invalidate(m, 0, m->page_size > 0?
+                           (wsize + m->page_size - 1) / m->page_size *
+                           m->page_size: wsize);
+  erased = m->erased;
+  m->erased = 0;
+  /* programmers may use the buffer to assemble pages */
+  avr_mem_unshare(m, 1);
 
   if ((p->flags & AVRPART_HAS_TPI) && m->page_size != 0 &&
       pgm->cmd_tpi != NULL) {
 
-    while (avr_tpi_poll_nvmbsy(pgm));
+    avr_tpi_wait_nvm(pgm);
 
     /* setup for WORD_WRITE */
     avr_tpi_setup_rw(pgm, m, 0, TPI_NVMCMD_WORD_WRITE);
@@ -896,25 +1496,22 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
 
     /* write words, low byte first */
     for (lastaddr = i = 0; i < wsize; i += 2) {
-      if ((m->tags[i] & TAG_ALLOCATED) != 0 ||
-          (m->tags[i + 1] & TAG_ALLOCATED) != 0) {
+      if (avr_mem_tagged(m, i) || avr_mem_tagged(m, i + 1)) {
 
+        setup_len = 0;
         if (lastaddr != i) {
-          /* need to setup new address */
-          avr_tpi_setup_rw(pgm, m, i, TPI_NVMCMD_WORD_WRITE);
+          /* need to setup new address, goes out with the word */
+          setup_len = avr_tpi_put_setup(setup, m, i, TPI_NVMCMD_WORD_WRITE);
           lastaddr = i;
         }
 
-        cmd[0] = TPI_CMD_SST_PI;
-        cmd[1] = m->buf[i];
-        rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
-
-        cmd[1] = m->buf[i + 1];
-        rc = pgm->cmd_tpi(pgm, cmd, 2, NULL, 0);
+        rc = avr_tpi_write_word(pgm, setup, setup_len, m->buf + i);
+        if (rc < 0) {
+          fprintf(stderr, "avr_write(): error writing address 0x%04x\n", i);
+          return -1;
+        }
 
         lastaddr += 2;
-
-        while (avr_tpi_poll_nvmbsy(pgm));
       }
       report_progress(i, wsize, NULL);
     }
@@ -925,59 +1522,140 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     /*
      * the programmer supports a paged mode write
      */
-    int need_write, failure;
+    int failure, next;
     unsigned int pageaddr;
     unsigned int npages, nwritten;
+    int async, outstanding;
+    int fused, checking, mismatch;
+    AVRMEM * cur;
+    unsigned int nsame;
+
+    async = pgm->paged_write_submit != NULL &&
+            pgm->paged_write_complete != NULL;
+    outstanding = 0;
+    /* pages read back for verification, still possibly in flight */
+    fused = verified != NULL && !async && pgm->paged_verify != NULL &&
+            pgm->paged_verify_done != NULL;
+    checking = 0;
+    mismatch = 0;
 
-    /* quickly scan number of pages to be written to first */
-    for (pageaddr = 0, npages = 0;
-         pageaddr < wsize;
-         pageaddr += m->page_size) {
-      /* check whether this page must be written to */
-      for (i = pageaddr;
-           i < pageaddr + m->page_size;
-           i++)
-        if ((m->tags[i] & TAG_ALLOCATED) != 0) {
-          npages++;
-          break;
-        }
+    /*
+     * EEPROM is slow to write and wears out: with -W, read each page
+     * first, and leave out those that already hold the data.
+     */
+    cur = NULL;
+    nsame = 0;
+    if (eeprom_skip_same && strcmp(m->desc, "eeprom") == 0 &&
+        pgm->paged_load != NULL && !async) {
+      cur = avr_dup_mem(m);
+      avr_mem_unshare(cur, 0);
     }
 
+    npages = avr_mem_count_dirty(m, wsize);
+
     for (pageaddr = 0, failure = 0, nwritten = 0;
          !failure && pageaddr < wsize;
          pageaddr += m->page_size) {
-      /* check whether this page must be written to */
-      for (i = pageaddr, need_write = 0;
-           i < pageaddr + m->page_size;
-           i++)
-        if ((m->tags[i] & TAG_ALLOCATED) != 0) {
-          need_write = 1;
-          break;
+      /* go straight to the next page that must be written to */
+      next = avr_mem_next_dirty(m, pageaddr, wsize);
+      if (verbose >= 3 && (next < 0 || next > pageaddr))
+        fprintf(stderr,
+                "%s: avr_write(): skipping pages %u to %u: no interesting data\n",
+                progname, pageaddr / m->page_size,
+                (next < 0? (wsize + m->page_size - 1): next) / m->page_size - 1);
+      if (next < 0)
+        break;
+      pageaddr = next;
+
+      if (cur != NULL && checking) {
+        /* reads still in flight refer to m, not cur */
+        if (pgm->paged_verify_done(pgm, p, m) < 0)
+          mismatch = 1;
+        checking = 0;
+      }
+      if (cur != NULL && avr_page_unchanged(pgm, p, m, cur, pageaddr)) {
+        nsame++;
+        nwritten++;
+        report_progress(nwritten * m->page_size, npages * m->page_size, NULL);
+        continue;
+      }
+
+      rc = 0;
+      if (auto_erase) {
+        /* the erase is synchronous, so nothing may still be in flight,
+           unless the programmer queues it ahead of the page's write */
+        while (!pgm->page_erase_queued && rc >= 0 && outstanding > 0) {
+          rc = pgm->paged_write_complete(pgm, p, m);
+          outstanding--;
+        }
+        if (checking) {
+          if (pgm->paged_verify_done(pgm, p, m) < 0)
+            mismatch = 1;
+          checking = 0;
         }
-      if (need_write) {
-        rc = 0;
-        if (auto_erase)
-          rc = pgm->page_erase(pgm, p, m, pageaddr);
         if (rc >= 0)
-          rc = pgm->paged_write(pgm, p, m, m->page_size, pageaddr, m->page_size);
-        if (verbose >= 3) {
-          fprintf(stderr,
-            "avr_write(): paged write returned %d\n",
-            rc);
+          rc = pgm->page_erase(pgm, p, m, pageaddr);
+      }
+      if (rc >= 0 && async) {
+        if (outstanding == PAGED_WRITE_DEPTH) {
+          rc = pgm->paged_write_complete(pgm, p, m);
+          outstanding--;
+        }
+        if (rc >= 0) {
+          stats_page(m->desc, STATS_WRITE);
+          rc = pgm->paged_write_submit(pgm, p, m, m->page_size,
+                                       pageaddr, m->page_size);
+          if (rc >= 0)
+            outstanding++;
         }
-        if (rc < 0)
-          /* paged write failed, fall back to byte-at-a-time write below */
-          failure = 1;
-      } else if (verbose >= 3) {
+      } else if (rc >= 0) {
+        stats_page(m->desc, STATS_WRITE);
+        rc = pgm->paged_write(pgm, p, m, m->page_size, pageaddr, m->page_size);
+        if (rc >= 0 && fused && !mismatch) {
+          switch (pgm->paged_verify(pgm, p, m, m->page_size,
+                                    pageaddr, m->page_size)) {
+          case -2:
+            fused = 0;
+            break;
+          case -1:
+            mismatch = 1;
+            break;
+          default:
+            checking = 1;
+            break;
+          }
+        }
+      }
+      if (verbose >= 3) {
         fprintf(stderr,
-                "%s: avr_write(): skipping page %u: no interesting data\n",
-                progname, pageaddr / m->page_size);
+          "avr_write(): paged write returned %d\n",
+          rc);
       }
+      if (rc < 0)
+        /* paged write failed, fall back to byte-at-a-time write below */
+        failure = 1;
       nwritten++;
-      report_progress(nwritten, npages, NULL);
+      report_progress(nwritten * m->page_size, npages * m->page_size, NULL);
     }
-    if (!failure)
+    /* wait for the pages still in flight, even after a failure */
+    while (outstanding > 0) {
+      if (pgm->paged_write_complete(pgm, p, m) < 0)
+        failure = 1;
+      outstanding--;
+    }
+    if (checking && pgm->paged_verify_done(pgm, p, m) < 0)
+      mismatch = 1;
+    if (cur != NULL) {
+      avr_free_mem(cur);
+      if (verbose >= 2 && nsame > 0)
+        fprintf(stderr, "%s: avr_write(): %u of %u pages already up to date\n",
+                progname, nsame, npages);
+    }
+    if (!failure) {
+      if (verified != NULL)
+        *verified = mismatch? -1: fused? 1: 0;
       return wsize;
+    }
     /* else: fall back to byte-at-a-time write, for historical reasons */
   }
 
@@ -985,6 +1663,34 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
       pgm->write_setup(pgm, p, m);
   }
 
+  /*
+   * A page write leaves bytes that were not loaded at 0xff, so on
+   * erased flash loading 0xff bytes is a waste of time.  If the
+   * programmer can send several SPI commands at once, the page loads
+   * that avr_write_byte_default() would issue one by one are sent in
+   * bulk.
+   */
+  skip_ff = m->paged && erased;
+  bulk = m->paged && pgm->spi != NULL &&
+         pgm->write_byte == avr_write_byte_default &&
+         (p->flags & AVRPART_HAS_TPI) == 0 &&
+         m->op[AVR_OP_WRITE_LO] == NULL &&
+         m->op[AVR_OP_LOADPAGE_LO] != NULL &&
+         m->op[AVR_OP_LOADPAGE_HI] != NULL;
+  nload = 0;
+
+  /*
+   * Non-paged memories are only written where the contents change.
+   * avr_write_byte_default() reads every byte before writing it;
+   * read ahead in batches instead, so unchanged bytes cost a fraction
+   * of a transfer.
+   */
+  precheck = !m->paged && pgm->spi != NULL &&
+             pgm->read_byte == avr_read_byte_default &&
+             pgm->write_byte == avr_write_byte_default &&
+             (p->flags & (AVRPART_HAS_TPI | AVRPART_IS_AT90S1200)) == 0;
+  old_start = old_end = 0;
+
   newpage = 1;
   page_tainted = 0;
   flush_page = 0;
@@ -997,16 +1703,17 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
      * Find out whether the write action must be invoked for this
      * byte.
      *
-     * For non-paged memory, this only happens if TAG_ALLOCATED is
-     * set for the byte.
+     * For non-paged memory, this only happens if the byte is tagged
+     * as allocated.
      *
-     * For paged memory, TAG_ALLOCATED also invokes the write
+     * For paged memory, an allocated byte also invokes the write
      * operation, which is actually a page buffer fill only.  This
      * "taints" the page, and upon encountering the last byte of each
      * tainted page, the write operation must also be invoked in order
      * to actually write the page buffer to memory.
      */
-    do_write = (m->tags[i] & TAG_ALLOCATED) != 0;
+    do_write = avr_mem_tagged(m, i) &&
+               !(skip_ff && data == 0xff);
     if (m->paged) {
       if (newpage) {
         page_tainted = do_write;
@@ -1023,18 +1730,42 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
       }
     }
 
+    if (do_write && precheck) {
+      if (i >= old_end) {
+        old_start = i;
+        old_end = i + (wsize - i < AVR_CMD_BATCH? wsize - i: AVR_CMD_BATCH);
+        if (avr_read_bytes_batch(pgm, p, m, old_start, old_end - old_start,
+                                 old) < 0)
+          precheck = 0;
+      }
+      if (precheck && old[i - old_start] == data)
+        do_write = 0;
+    }
+
     if (!do_write && !flush_page) {
       continue;
     }
 
-    if (do_write) {
-      rc = avr_write_byte(pgm, p, m, i, data);
-      if (rc) {
-        fprintf(stderr, " ***failed;  ");
-        fprintf(stderr, "\n");
-        pgm->err_led(pgm, ON);
-        werror = 1;
+    rc = 0;
+    if (do_write && bulk) {
+      loadop = m->op[(i & 0x01)? AVR_OP_LOADPAGE_HI: AVR_OP_LOADPAGE_LO];
+      memset(loadcmd + 4 * nload, 0, 4);
+      avr_set_bits(loadop, loadcmd + 4 * nload);
+      avr_set_addr(loadop, loadcmd + 4 * nload, i / 2);
+      avr_set_input(loadop, loadcmd + 4 * nload, data);
+      nload++;
+      if (nload == AVR_CMD_BATCH) {
+        rc = avr_load_page_bulk(pgm, loadcmd, loadres, nload);
+        nload = 0;
       }
+    } else if (do_write) {
+      rc = avr_write_byte(pgm, p, m, i, data);
+    }
+    if (do_write && rc) {
+      fprintf(stderr, " ***failed;  ");
+      fprintf(stderr, "\n");
+      pgm->err_led(pgm, ON);
+      werror = 1;
     }
 
     /*
@@ -1042,6 +1773,13 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
      * write
      */
     if (flush_page) {
+      if (avr_load_page_bulk(pgm, loadcmd, loadres, nload) < 0) {
+        fprintf(stderr, " ***failed;  ");
+        fprintf(stderr, "\n");
+        werror = 1;
+      }
+      nload = 0;
+      stats_page(m->desc, STATS_WRITE);
       rc = avr_write_page(pgm, p, m, i);
       if (rc) {
         fprintf(stderr,
@@ -1068,6 +1806,51 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
 }
 
 
+int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
+              int auto_erase)
+{
+  AVRMEM * m;
+  double start;
+  int rc;
+
+  m = avr_locate_mem(p, memtype);
+  if (m == NULL) {
+    fprintf(stderr, "No \"%s\" memory for part %s\n",
+            memtype, p->desc);
+    return -1;
+  }
+
+  start = stats_time();
+  rc = avr_write_mem(pgm, p, m, size, auto_erase, NULL);
+  stats_mem(m->desc, STATS_WRITE, rc, start);
+
+  return rc;
+}
+
+
+int avr_write_verify(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
+                     int auto_erase, int * verified)
+{
+  AVRMEM * m;
+  double start;
+  int rc;
+
+  *verified = 0;
+  m = avr_locate_mem(p, memtype);
+  if (m == NULL) {
+    fprintf(stderr, "No \"%s\" memory for part %s\n",
+            memtype, p->desc);
+    return -1;
+  }
+
+  start = stats_time();
+  rc = avr_write_mem(pgm, p, m, size, auto_erase, verified);
+  stats_mem(m->desc, STATS_WRITE, rc, start);
+
+  return rc;
+}
+
+
 
 /*
  * read the AVR device's signature bytes
@@ -1099,9 +1882,6 @@ int avr_signature(PROGRAMMER * pgm, AVRPART * p)
  */
 int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
 {
-  int i;
-  unsigned char * buf1, * buf2;
-  int vsize;
   AVRMEM * a, * b;
 
   a = avr_locate_mem(p, memtype);
@@ -1120,6 +1900,19 @@ int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
     return -1;
   }
 
+  return avr_verify_mem(a, b, size);
+}
+
+/*
+ * Same as avr_verify(), comparing the device contents read into a
+ * against the reference data of b.
+ */
+int avr_verify_mem(AVRMEM * a, AVRMEM * b, int size)
+{
+  int i, end;
+  unsigned char * buf1, * buf2;
+  int vsize;
+
   buf1  = a->buf;
   buf2  = b->buf;
   vsize = a->size;
@@ -1130,20 +1923,27 @@ int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size)
             "%s%s memory region only contains %d bytes\n"
             "%sOnly %d bytes will be verified.\n",
             progname, size,
-            progbuf, memtype, vsize,
+            progbuf, a->desc, vsize,
             progbuf, vsize);
     size = vsize;
   }
 
-  for (i=0; i<size; i++) {
-    if ((b->tags[i] & TAG_ALLOCATED) != 0 &&
-        buf1[i] != buf2[i]) {
-      fprintf(stderr, 
-              "%s: verification error, first mismatch at byte 0x%04x\n"
-              "%s0x%02x != 0x%02x\n",
-              progname, i, 
-              progbuf, buf1[i], buf2[i]);
-      return -1;
+  for (i=0; i<size; ) {
+    /* blocks that are equal cannot hold a mismatch */
+    if (size - i >= VSCAN_BYTES && avr_vscan_equal(buf1 + i, buf2 + i)) {
+      i += VSCAN_BYTES;
+      continue;
+    }
+    end = size - i >= VSCAN_BYTES? i + VSCAN_BYTES: size;
+    for (; i<end; i++) {
+      if (avr_mem_tagged(b, i) && buf1[i] != buf2[i]) {
+        fprintf(stderr, 
+                "%s: verification error, first mismatch at byte 0x%04x\n"
+                "%s0x%02x != 0x%02x\n",
+                progname, i, 
+                progbuf, buf1[i], buf2[i]);
+        return -1;
+      }
     }
   }
 
@@ -1219,10 +2019,39 @@ int avr_put_cycle_count(PROGRAMMER * pgm, AVRPART * p, int cycles)
 
 int avr_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
-  int rc;
+  int rc, nflash;
+  LNODEID ln;
+  AVRMEM * m;
+
+  /* nothing read back before the erase is valid anymore */
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    avr_mem_cache_invalidate(m, 0, m->size);
+  }
 
   rc = pgm->chip_erase(pgm, p);
 
+  /* the eeprom may be preserved, but the flash is erased for sure */
+  for (ln = lfirst(p->mem), nflash = 0; ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    m->erased = rc == 0 &&
+      (strcasecmp(m->desc, "flash") == 0 ||
+       strcasecmp(m->desc, "application") == 0 ||
+       strcasecmp(m->desc, "apptable") == 0 ||
+       strcasecmp(m->desc, "boot") == 0);
+    nflash += m->erased;
+  }
+
+  /*
+   * Writing one of several overlapping flash memories (application
+   * and flash on XMEGA) leaves the others alone, so only a part with
+   * a single one can tell how far it is still blank.
+   */
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    m->known_blank = m->erased && nflash == 1? m->size: 0;
+  }
+
   return rc;
 }
 
@@ -1244,36 +2073,56 @@ int avr_chip_erase(PROGRAMMER * pgm, AVRPART * p)
  * It would be nice if we could reduce the usage to one and only one
  * call for each of start, during and end cases. As things stand now,
  * that is not possible and makes maintenance a bit more work.
+ *
+ * While an operation is progressing, completed and total count bytes,
+ * for the transfer rate.  This is called for every byte of some
+ * loops, so between two 4% steps a call does no more than compare
+ * completed with where the next step is.
  */
 void report_progress (int completed, int total, char *hdr)
 {
   static int last = 0;
   static double start_time;
-  int percent = (completed * 100) / total;
+  static int cur_total, next;
+  static long bytes;
+  int percent;
   struct timeval tv;
   double t;
 
   if (update_progress == NULL)
     return;
 
+  if (hdr == NULL && total == cur_total && completed < next &&
+      completed < total)
+    return;
+
+  percent = (int)((long long)completed * 100 / total);
   gettimeofday(&tv, NULL);
   t = tv.tv_sec + ((double)tv.tv_usec)/1000000;
 
   if (hdr) {
     last = 0;
     start_time = t;
-    update_progress (percent, t - start_time, hdr);
+    bytes = 0;
+    update_progress (percent, t - start_time, hdr, bytes);
   }
+  /* the final report_progress (1, 1, NULL) keeps the count */
+  if (total > 1)
+    bytes = completed;
 
   if (percent > 100)
     percent = 100;
 
-  /* update every 4% */
-  if (percent > last + 3) {
+  /* update every 4%, and always once complete */
+  if (percent > last + 3 || completed >= total) {
     last = percent;
-    update_progress (percent, t - start_time, hdr);
+    update_progress (percent, t - start_time, hdr, bytes);
   }
 
   if (percent == 100)
     last = 0;                   /* Get ready for next time. */
+
+  /* the least completed count showing percent last + 4 */
+  cur_total = total;
+  next = (int)(((long long)(last + 4) * total + 99) / 100);
 }
@@ -26,11 +26,18 @@
 #include "avrpart.h"
 #include "pgm.h"
 
-typedef void (*FP_UpdateProgress)(int percent, double etime, char *hdr);
+/* bytes is how much has been transferred so far, 0 if not known */
+typedef void (*FP_UpdateProgress)(int percent, double etime, char *hdr,
+                                  long bytes);
+
+/* the bytes of mem below n have been read and will not change any more */
+typedef void (*avr_read_cb)(void * ctx, AVRMEM * mem, unsigned long n);
 
 extern struct avrpart parts[];
 
 extern FP_UpdateProgress update_progress;
+extern int read_stop_blank;
+extern int eeprom_skip_same;
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,7 +49,56 @@ int avr_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p, unsigned char guard_ti
 int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 			  unsigned long addr, unsigned char * value);
 
+/*
+ * Run the n 4-byte commands in cmd and store their results in res, in
+ * a single pgm->spi() transfer if the programmer has one, else one
+ * pgm->cmd() at a time.
+ */
+#define AVR_CMD_BATCH 64                /* commands per batch */
+int avr_cmd_batch(PROGRAMMER * pgm, const unsigned char * cmd,
+                  unsigned char * res, int n);
+
+/*
+ * Read n bytes from addr into buf with batched read commands, as
+ * avr_read_byte_default() would read them one by one.
+ */
+int avr_read_bytes_batch(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                         unsigned long addr, int n, unsigned char * buf);
+
+/*
+ * Read the bytes at addrs[i] of the n memories mems[i] (fuses, lock,
+ * signature) into values[i], in a single programmer transaction where
+ * the programmer can do that.  Programmers without a
+ * read_config_bytes() method get avr_read_config_bytes_default(),
+ * which batches plain ISP commands over pgm->spi() and else calls
+ * pgm->read_byte() for each byte.
+ */
+int avr_read_config_bytes(PROGRAMMER * pgm, AVRPART * p,
+                          AVRMEM * mems[], const unsigned long addrs[],
+                          unsigned char * values, int n);
+int avr_read_config_bytes_default(PROGRAMMER * pgm, AVRPART * p,
+                                  AVRMEM * mems[], const unsigned long addrs[],
+                                  unsigned char * values, int n);
+
+/*
+ * Build the n ISP read commands for avr_read_config_bytes() in cmd
+ * (4 * n bytes); returns -1 if a memory has no single read command.
+ * avr_config_values() picks the values out of the n results.
+ */
+int avr_config_cmds(AVRMEM * mems[], const unsigned long addrs[],
+                    int n, unsigned char * cmd);
+void avr_config_values(AVRMEM * mems[], unsigned char * res,
+                       unsigned char * values, int n);
+
 int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype, AVRPART * v);
+int avr_read_mem(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, AVRMEM * vmem);
+int avr_read_stream(PROGRAMMER * pgm, AVRPART * p, char * memtype,
+                    avr_read_cb cb, void * ctx);
+
+void avr_config_forget(AVRPART * p);
+int avr_fuses_written(void);
+
+void avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, unsigned int delay);
 
 int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                    unsigned long addr);
@@ -56,9 +112,14 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
               int auto_erase);
 
+/* avr_write(), checking pages as they are written where it can */
+int avr_write_verify(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
+                     int auto_erase, int * verified);
+
 int avr_signature(PROGRAMMER * pgm, AVRPART * p);
 
 int avr_verify(AVRPART * p, AVRPART * v, char * memtype, int size);
+int avr_verify_mem(AVRMEM * a, AVRMEM * b, int size);
 
 int avr_get_cycle_count(PROGRAMMER * pgm, AVRPART * p, int * cycles);
 
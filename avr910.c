@@ -123,7 +123,8 @@ static int avr910_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   avr910_vfy_cmd_sent(pgm, "chip erase");
 
   /*
-   * avr910 firmware may not delay long enough
+   * avr910 firmware may not delay long enough; a fixed delay, as many
+   * firmwares lack the '.' command avr_wait_ready() would poll with
    */
   usleep (p->chip_erase_delay);
 
@@ -619,8 +620,11 @@ static int avr910_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     if (strcmp(m->desc, "flash") && strcmp(m->desc, "eeprom"))
       return -2;
 
+    /*
+     * The programmer waits for each eeprom byte to complete before
+     * it acknowledges the block, so no delay is needed here.
+     */
     if (m->desc[0] == 'e') {
-      blocksize = 1;		/* Write to eeprom single bytes only */
       wr_size = 1;
     } else {
       wr_size = 2;
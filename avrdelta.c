@@ -0,0 +1,197 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * avrdelta: write the delta file (see fileio.h) that takes a device
+ * from the raw binary image base to the raw binary image new, for
+ * avrdude -U flash:w:file:D.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "fileio.h"
+
+static char * progname;
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "Usage: %s [-b] [-p pagesize] base.bin new.bin delta\n"
+          "  -b           Include the base, to check it by CRC where the\n"
+          "               programmer cannot read memory back.\n"
+          "  -p pagesize  Page size of the memory in bytes, default 128.\n",
+          progname);
+}
+
+static long load(const char * file, unsigned char ** buf)
+{
+  long size = 0, alloced = 0;
+  size_t n;
+  FILE * f;
+
+  if ((f = fopen(file, "rb")) == NULL) {
+    fprintf(stderr, "%s: can't open \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+  for (*buf = NULL; ; size += n) {
+    if (size == alloced) {
+      alloced = alloced? 2 * alloced: 64 * 1024;
+      if ((*buf = realloc(*buf, alloced)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+    }
+    if ((n = fread(*buf + size, 1, alloced - size, f)) == 0)
+      break;
+  }
+  if (ferror(f)) {
+    fprintf(stderr, "%s: can't read \"%s\": %s\n",
+            progname, file, strerror(errno));
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  return size;
+}
+
+static void put32(unsigned char * b, unsigned long v)
+{
+  int i;
+
+  for (i = 0; i < 4; i++, v >>= 8)
+    b[i] = v & 0xff;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned char hdr[FIO_DELTA_HDRLEN], rec[FIO_DELTA_RECLEN];
+  unsigned char * base, * new;
+  long bsize, nsize, size, psize = 128, addr, end;
+  unsigned long npages = 0;
+  uint64_t h;
+  int ch, i, withbase = 0;
+  char * e;
+  FILE * f;
+
+  progname = strrchr(argv[0], '/');
+  progname = progname? progname + 1: argv[0];
+
+  while ((ch = getopt(argc, argv, "bp:")) != -1) {
+    switch (ch) {
+      case 'b':
+        withbase = 1;
+        break;
+
+      case 'p':
+        psize = strtol(optarg, &e, 0);
+        if (*e != 0 || e == optarg || psize <= 0) {
+          fprintf(stderr, "%s: invalid page size \"%s\"\n", progname, optarg);
+          return 1;
+        }
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (optind != argc - 3) {
+    usage();
+    return 1;
+  }
+
+  if ((bsize = load(argv[optind], &base)) < 0 ||
+      (nsize = load(argv[optind + 1], &new)) < 0)
+    return 1;
+
+  /* both as they are in a memory erased to 0xff, in whole pages */
+  size = bsize > nsize? bsize: nsize;
+  size = (size + psize - 1) / psize * psize;
+  if ((base = realloc(base, size + 1)) == NULL ||
+      (new = realloc(new, size + 1)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    return 1;
+  }
+  memset(base + bsize, 0xff, size - bsize);
+  memset(new + nsize, 0xff, size - nsize);
+
+  h = 14695981039346656037ULL;
+  for (addr = 0; addr < size; addr++) {
+    h ^= base[addr];
+    h *= 1099511628211ULL;
+  }
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(hdr, FIO_DELTA_MAGIC, 8);
+  hdr[8] = FIO_DELTA_VERSION;
+  if (withbase)
+    hdr[9] = FIO_DELTA_HAS_BASE;
+  put32(hdr + 12, size);
+  for (i = 16; i < 24; i++, h >>= 8)
+    hdr[i] = h & 0xff;
+
+  if ((f = fopen(argv[optind + 2], "wb")) == NULL) {
+    fprintf(stderr, "%s: can't open \"%s\": %s\n",
+            progname, argv[optind + 2], strerror(errno));
+    return 1;
+  }
+  fwrite(hdr, 1, sizeof(hdr), f);
+  if (withbase)
+    fwrite(base, 1, size, f);
+
+  /* one record per run of changed pages */
+  for (addr = 0; addr < size; addr = end) {
+    if (memcmp(base + addr, new + addr, psize) == 0) {
+      end = addr + psize;
+      continue;
+    }
+    for (end = addr + psize;
+         end < size && memcmp(base + end, new + end, psize) != 0;
+         end += psize)
+      ;
+    npages += (end - addr) / psize;
+    put32(rec, addr);
+    put32(rec + 4, end - addr);
+    fwrite(rec, 1, sizeof(rec), f);
+    fwrite(new + addr, 1, end - addr, f);
+  }
+
+  if (fclose(f) != 0) {
+    fprintf(stderr, "%s: error writing \"%s\": %s\n",
+            progname, argv[optind + 2], strerror(errno));
+    remove(argv[optind + 2]);
+    return 1;
+  }
+  fprintf(stderr, "%s: %lu of %ld pages changed\n",
+          progname, npages, size / psize);
+
+  free(base);
+  free(new);
+
+  return 0;
+}
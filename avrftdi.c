@@ -73,6 +73,16 @@ enum { FTDI_SCK = 0, FTDI_MOSI, FTDI_MISO, FTDI_RESET };
 
 static int write_flush(avrftdi_t *);
 
+/* send the same commands to every channel */
+static int write_all(avrftdi_t* pdata, unsigned char *buf, int len)
+{
+	int c;
+
+	for(c = 0; c < pdata->nchan; c++)
+		E(ftdi_write_data(pdata->chan[c], buf, len) != len, pdata->chan[c]);
+	return 0;
+}
+
 /*
  * returns a human-readable name for a pin number. the name should match with
  * the pin names used in FTDI datasheets.
@@ -217,9 +227,7 @@ static int set_frequency(avrftdi_t* ftdi, uint32_t freq)
 	buf[1] = (uint8_t)(divisor & 0xff);
 	buf[2] = (uint8_t)((divisor >> 8) & 0xff);
 
-	E(ftdi_write_data(ftdi->ftdic, buf, 3) < 0, ftdi->ftdic);
-
-	return 0;
+	return write_all(ftdi, buf, 3);
 }
 
 /*
@@ -351,23 +359,27 @@ static int avrftdi_transmit_bb(PROGRAMMER * pgm, unsigned char mode, const unsig
 	size_t remaining = buf_size;
 	size_t written = 0;
 	avrftdi_t* pdata = to_pdata(pgm);
-	size_t blocksize = pdata->rx_buffer_size/2; // we are reading 2 bytes per data byte
 
-	// determine a maximum size of data block
-	size_t max_size = MIN(pdata->ftdic->max_packet_size,pdata->tx_buffer_size);
-	// select block size so that resulting commands does not exceed max_size if possible
-	blocksize = MAX(1,(max_size-7)/((8*2*6)+(8*1*2)));
-	//fprintf(stderr,"blocksize %d \n",blocksize);
+	/* (8*2) outputs per data byte, 6 transmit bytes per output (SET_BITS_LOW/HIGH),
+	 * (8*1) inputs per data byte,  2 transmit bytes per input  (GET_BITS_LOW/HIGH),
+	 * and 2 bytes read back per input */
+	const size_t out_size = (8*2*6) + (8*1*2);
+	const size_t in_size = 8*1*2;
+
+	/* All commands of a block go out in one write and all their
+	 * answers come back in one read.  The answers must fit into the
+	 * receive buffer of the chip though, or it stops taking commands
+	 * while ftdi_write_data() is still sending. */
+	size_t blocksize = MAX(1, pdata->rx_buffer_size / in_size);
+
+	if (blocksize > remaining)
+		blocksize = remaining;
+	/* and the final SCK edge and SEND_IMMEDIATE */
+	unsigned char send_buffer[out_size*blocksize + 7];
 
 	while(remaining)
 	{
-
 		size_t transfer_size = (remaining > blocksize) ? blocksize : remaining;
-
-		// (8*2) outputs per data byte, 6 transmit bytes per output (SET_BITS_LOW/HIGH),
-		// (8*1) inputs per data byte,  2 transmit bytes per input  (GET_BITS_LOW/HIGH),
-		// 1x SEND_IMMEDIATE
-		unsigned char send_buffer[(8*2*6)*transfer_size+(8*1*2)*transfer_size+7];
 		int len = 0;
 		int i;
 		
@@ -387,14 +399,14 @@ static int avrftdi_transmit_bb(PROGRAMMER * pgm, unsigned char mode, const unsig
 
 		E(ftdi_write_data(pdata->ftdic, send_buffer, len) != len, pdata->ftdic);
 		if (mode & MPSSE_DO_READ) {
-		    unsigned char recv_buffer[2*16*transfer_size];
+			unsigned char recv_buffer[in_size*transfer_size];
 			int n;
 			int k = 0;
 			do {
-				n = ftdi_read_data(pdata->ftdic, &recv_buffer[k], 2*16*transfer_size - k);
+				n = ftdi_read_data(pdata->ftdic, &recv_buffer[k], in_size*transfer_size - k);
 				E(n < 0, pdata->ftdic);
 				k += n;
-			} while (k < transfer_size);
+			} while (k < in_size*transfer_size);
 
 			for(i = 0 ; i< transfer_size; i++) {
 			    data[written + i] = extract_data(pgm, recv_buffer, i);
@@ -419,13 +431,19 @@ static int avrftdi_transmit_mpsse(avrftdi_t* pdata, unsigned char mode, const un
 	size_t blocksize;
 	size_t remaining = buf_size;
 	size_t written = 0;
-	
-	unsigned char cmd[3];
-//	unsigned char si = SEND_IMMEDIATE;
-
-	cmd[0] = mode | MPSSE_WRITE_NEG;
-	cmd[1] = ((buf_size - 1) & 0xff);
-	cmd[2] = (((buf_size - 1) >> 8) & 0xff);
+	int c;
+
+	if((mode & MPSSE_DO_READ) && pdata->nchan > 1 &&
+	   pdata->chan_rx_size < buf_size) {
+		for(c = 1; c < pdata->nchan; c++) {
+			pdata->chan_rx[c] = realloc(pdata->chan_rx[c], buf_size);
+			if(!pdata->chan_rx[c]) {
+				log_err("Error allocating memory.\n");
+				exit(-ENOMEM);
+			}
+		}
+		pdata->chan_rx_size = buf_size;
+	}
 
 	//if we are not reading back, we can just write the data out
 	if(!(mode & MPSSE_DO_READ))
@@ -433,40 +451,69 @@ static int avrftdi_transmit_mpsse(avrftdi_t* pdata, unsigned char mode, const un
 	else
 		blocksize = pdata->rx_buffer_size;
 
-	E(ftdi_write_data(pdata->ftdic, cmd, sizeof(cmd)) != sizeof(cmd), pdata->ftdic);
+	/* command header, one block of data and SEND_IMMEDIATE */
+	unsigned char send[3 + blocksize + 1];
 
 	while(remaining)
 	{
 		size_t transfer_size = (remaining > blocksize) ? blocksize : remaining;
-
-		E(ftdi_write_data(pdata->ftdic, &buf[written], transfer_size) != transfer_size, pdata->ftdic);
-#if 0
-		if(remaining < blocksize)
-			E(ftdi_write_data(pdata->ftdic, &si, sizeof(si)) != sizeof(si), pdata->ftdic);
-#endif
+		size_t len = 0;
+
+		/* the header goes in front of the first block, the command
+		 * covers all of them */
+		if(written == 0) {
+			send[len++] = mode | MPSSE_WRITE_NEG;
+			send[len++] = ((buf_size - 1) & 0xff);
+			send[len++] = (((buf_size - 1) >> 8) & 0xff);
+		}
+		memcpy(&send[len], &buf[written], transfer_size);
+		len += transfer_size;
+		/* don't wait for the latency timer to get the last bytes */
+		if((mode & MPSSE_DO_READ) && transfer_size == remaining)
+			send[len++] = SEND_IMMEDIATE;
+
+		/* all channels work on the block before any is read back */
+		if (0 > write_all(pdata, send, len))
+			return -1;
 
 		if (mode & MPSSE_DO_READ) {
-			int n;
-			int k = 0;
-			do {
-				n = ftdi_read_data(pdata->ftdic, &data[written + k], transfer_size - k);
-				E(n < 0, pdata->ftdic);
-				k += n;
-			} while (k < transfer_size);
-
+			for(c = 0; c < pdata->nchan; c++) {
+				unsigned char *rx = c? &pdata->chan_rx[c][written]: &data[written];
+				int n;
+				int k = 0;
+				do {
+					n = ftdi_read_data(pdata->chan[c], &rx[k], transfer_size - k);
+					E(n < 0, pdata->chan[c]);
+					k += n;
+				} while (k < transfer_size);
+			}
 		}
 		
 		written += transfer_size;
 		remaining -= transfer_size;
 	}
+
+	if((mode & MPSSE_DO_READ) && pdata->chan_check)
+		for(c = 1; c < pdata->nchan; c++)
+			if(memcmp(pdata->chan_rx[c], data, buf_size) != 0) {
+				log_err("Target on channel %c does not answer like the one on %c\n",
+				        pdata->channels[c], pdata->channels[0]);
+				return -1;
+			}
 	
 	return written;
 }
 
+static int avrftdi_flush_deferred(PROGRAMMER * pgm);
+
 static inline int avrftdi_transmit(PROGRAMMER * pgm, unsigned char mode, const unsigned char *buf,
 			    unsigned char *data, int buf_size)
 {
 	avrftdi_t* pdata = to_pdata(pgm);
+
+	/* keep the order of the commands */
+	if (pdata->defer_count && 0 > avrftdi_flush_deferred(pgm))
+		return -1;
 	if (pdata->use_bitbanging)
 		return avrftdi_transmit_bb(pgm, mode, buf, data, buf_size);
 	else
@@ -487,7 +534,8 @@ static int write_flush(avrftdi_t* pdata)
 	buf[4] = ((pdata->pin_value) >> 8) & 0xff;
 	buf[5] = ((pdata->pin_direction) >> 8) & 0xff;
 
-	E(ftdi_write_data(pdata->ftdic, buf, 6) != 6, pdata->ftdic);
+	if (0 > write_all(pdata, buf, 6))
+		return -1;
 
 	log_trace("Set pins command: %02x %02x %02x %02x %02x %02x\n",
 	          buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
@@ -504,19 +552,23 @@ static int write_flush(avrftdi_t* pdata)
 	//E(ftdi_usb_purge_buffers(pdata->ftdic), pdata->ftdic);
 
 	unsigned char cmd[] = { GET_BITS_LOW, SEND_IMMEDIATE };
-	E(ftdi_write_data(pdata->ftdic, cmd, sizeof(cmd)) != sizeof(cmd), pdata->ftdic);
+	if (0 > write_all(pdata, cmd, sizeof(cmd)))
+		return -1;
 	
-	int num = 0;
-	do
-	{
-		int n = ftdi_read_data(pdata->ftdic, buf, sizeof(buf));
-		if(n > 0)
-			num += n;
-		E(n < 0, pdata->ftdic);
-	} while(num < 1);
+	int c;
+	for(c = 0; c < pdata->nchan; c++) {
+		int num = 0;
+		do
+		{
+			int n = ftdi_read_data(pdata->chan[c], buf, sizeof(buf));
+			if(n > 0)
+				num += n;
+			E(n < 0, pdata->chan[c]);
+		} while(num < 1);
 	
-	if(num > 1)
-		log_warn("Read %d extra bytes\n", num-1);
+		if(num > 1)
+			log_warn("Read %d extra bytes\n", num-1);
+	}
 
 	return 0;
 
@@ -652,7 +704,7 @@ static int avrftdi_pin_setup(PROGRAMMER * pgm)
 
 static int avrftdi_open(PROGRAMMER * pgm, char *port)
 {
-	int vid, pid, interface, index, err;
+	int vid, pid, interface, index, err, c;
 	char * serial, *desc;
 	
 	avrftdi_t* pdata = to_pdata(pgm);
@@ -690,41 +742,62 @@ static int avrftdi_open(PROGRAMMER * pgm, char *port)
 	desc = NULL;
 	index = 0;
 
-	if (pgm->usbdev[0] == 'a' || pgm->usbdev[0] == 'A')
-		interface = INTERFACE_A;
-	else if (pgm->usbdev[0] == 'b' || pgm->usbdev[0] == 'B')
-		interface = INTERFACE_B;
-	else {
-		log_warn("Invalid interface '%s'. Setting to Interface A\n", pgm->usbdev);
-		interface = INTERFACE_A;
+	/* the interfaces given by -x channels, else the usbdev one */
+	if (pdata->channels[0] == 0) {
+		if (pgm->usbdev[0] == 'a' || pgm->usbdev[0] == 'A')
+			pdata->channels[0] = 'A';
+		else if (pgm->usbdev[0] == 'b' || pgm->usbdev[0] == 'B')
+			pdata->channels[0] = 'B';
+		else {
+			log_warn("Invalid interface '%s'. Setting to Interface A\n", pgm->usbdev);
+			pdata->channels[0] = 'A';
+		}
+		pdata->nchan = 1;
 	}
 
 	/****************
 	 * Device setup *
 	 ****************/
 
-	E(ftdi_set_interface(pdata->ftdic, interface) < 0, pdata->ftdic);
+	for(c = 0; c < pdata->nchan; c++) {
+		struct ftdi_context* ftdic;
+
+		if (c > 0 && !pdata->chan[c]) {
+			pdata->chan[c] = ftdi_new();
+			if(!pdata->chan[c]) {
+				log_err("Error allocating memory.\n");
+				exit(-ENOMEM);
+			}
+		}
+		ftdic = pdata->chan[c];
+		interface = pdata->channels[c] == 'B'? INTERFACE_B: INTERFACE_A;
+
+		E(ftdi_set_interface(ftdic, interface) < 0, ftdic);
 	
-	err = ftdi_usb_open_desc_index(pdata->ftdic, vid, pid, desc, serial, index);
-	if(err) {
-		log_err("Error %d occured: %s\n", err, ftdi_get_error_string(pdata->ftdic));
-		//stupid hack, because avrdude calls pgm->close() even when pgm->open() fails
-		//and usb_dev is intialized to the last usb device from probing
-		pdata->ftdic->usb_dev = NULL;
-		return err;
-	} else {
-		log_info("Using device VID:PID %04x:%04x and SN '%s' on interface %c.\n",
-		         vid, pid, serial, INTERFACE_A == interface? 'A': 'B');
-	}
+		err = ftdi_usb_open_desc_index(ftdic, vid, pid, desc, serial, index);
+		if(err) {
+			log_err("Error %d occured: %s\n", err, ftdi_get_error_string(ftdic));
+			//stupid hack, because avrdude calls pgm->close() even when pgm->open() fails
+			//and usb_dev is intialized to the last usb device from probing
+			ftdic->usb_dev = NULL;
+			/* close only the channels opened so far */
+			if (c > 0)
+				pdata->nchan = c;
+			return err;
+		} else {
+			log_info("Using device VID:PID %04x:%04x and SN '%s' on interface %c.\n",
+			         vid, pid, serial, pdata->channels[c]);
+		}
 	
-	ftdi_set_latency_timer(pdata->ftdic, 1);
-	//ftdi_write_data_set_chunksize(pdata->ftdic, 16);
-	//ftdi_read_data_set_chunksize(pdata->ftdic, 16);
-
-	/* set SPI mode */
-	E(ftdi_set_bitmode(pdata->ftdic, 0, BITMODE_RESET) < 0, pdata->ftdic);
-	E(ftdi_set_bitmode(pdata->ftdic, pdata->pin_direction & 0xff, BITMODE_MPSSE) < 0, pdata->ftdic);
-	E(ftdi_usb_purge_buffers(pdata->ftdic), pdata->ftdic);
+		ftdi_set_latency_timer(ftdic, 1);
+		//ftdi_write_data_set_chunksize(ftdic, 16);
+		//ftdi_read_data_set_chunksize(ftdic, 16);
+
+		/* set SPI mode */
+		E(ftdi_set_bitmode(ftdic, 0, BITMODE_RESET) < 0, ftdic);
+		E(ftdi_set_bitmode(ftdic, pdata->pin_direction & 0xff, BITMODE_MPSSE) < 0, ftdic);
+		E(ftdi_usb_purge_buffers(ftdic), ftdic);
+	}
 
 	write_flush(pdata);
 
@@ -777,9 +850,20 @@ static int avrftdi_open(PROGRAMMER * pgm, char *port)
 			break;
 	}
 
+	if (pdata->nchan > 1 && pdata->ftdic->type != TYPE_2232H &&
+	    pdata->ftdic->type != TYPE_4232H) {
+		log_err("Only the 2232H and 4232H have a second MPSSE channel.\n");
+		return -1;
+	}
+
 	if(avrftdi_pin_setup(pgm))
 		return -1;
 
+	if (pdata->nchan > 1 && pdata->use_bitbanging) {
+		log_err("Several channels need the MPSSE pin configuration.\n");
+		return -1;
+	}
+
 	/**********************************************
 	 * set the ready LED and set our direction up *
 	 **********************************************/
@@ -793,6 +877,7 @@ static int avrftdi_open(PROGRAMMER * pgm, char *port)
 static void avrftdi_close(PROGRAMMER * pgm)
 {
 	avrftdi_t* pdata = to_pdata(pgm);
+	int c;
 
 	if(pdata->ftdic->usb_dev) {
 		set_pin(pgm, PIN_AVR_RESET, ON);
@@ -805,8 +890,10 @@ static void avrftdi_close(PROGRAMMER * pgm)
 		pdata->pin_value &= pdata->led_mask;
 		write_flush(pdata);
 		/* reset state recommended by FTDI */
-		ftdi_set_bitmode(pdata->ftdic, 0, BITMODE_RESET);
-		E_VOID(ftdi_usb_close(pdata->ftdic), pdata->ftdic);
+		for(c = 0; c < pdata->nchan; c++) {
+			ftdi_set_bitmode(pdata->chan[c], 0, BITMODE_RESET);
+			E_VOID(ftdi_usb_close(pdata->chan[c]), pdata->chan[c]);
+		}
 	}
 
 	return;
@@ -818,6 +905,10 @@ static int avrftdi_initialize(PROGRAMMER * pgm, AVRPART * p)
 
 	if(p->flags & AVRPART_HAS_TPI)
 	{
+		if (to_pdata(pgm)->nchan > 1) {
+			log_err("TPI works on one channel only.\n");
+			return -1;
+		}
 		/* see avrftdi_tpi.c */
 		avrftdi_tpi_initialize(pgm, p);
 	}
@@ -849,11 +940,65 @@ static void avrftdi_display(PROGRAMMER * pgm, const char *p)
 }
 
 
+/*
+ * Queue an SPI command whose 4 result bytes are stored in res by
+ * avrftdi_flush_deferred().  All queued commands go out in a single
+ * MPSSE transfer, so reading many single bytes costs one USB round
+ * trip instead of one each.
+ */
+static int avrftdi_cmd_deferred(PROGRAMMER * pgm, const unsigned char *cmd, unsigned char *res)
+{
+	avrftdi_t* pdata = to_pdata(pgm);
+
+	if(pdata->defer_count == pdata->defer_alloc) {
+		int n = pdata->defer_alloc ? 2 * pdata->defer_alloc : 64;
+
+		pdata->defer_buf = realloc(pdata->defer_buf, 4 * n);
+		pdata->defer_res = realloc(pdata->defer_res, n * sizeof(unsigned char *));
+		if(!pdata->defer_buf || !pdata->defer_res) {
+			log_err("Error allocating memory.\n");
+			exit(-ENOMEM);
+		}
+		pdata->defer_alloc = n;
+	}
+
+	memcpy(&pdata->defer_buf[4 * pdata->defer_count], cmd, 4);
+	pdata->defer_res[pdata->defer_count++] = res;
+
+	return 0;
+}
+
+/* send the queued commands and hand out their results */
+static int avrftdi_flush_deferred(PROGRAMMER * pgm)
+{
+	avrftdi_t* pdata = to_pdata(pgm);
+	int i, n = pdata->defer_count;
+
+	if(n == 0)
+		return 0;
+	pdata->defer_count = 0;
+
+	if (0 > avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE,
+				 pdata->defer_buf, pdata->defer_buf, 4 * n))
+		return -1;
+
+	for(i = 0; i < n; i++)
+		memcpy(pdata->defer_res[i], &pdata->defer_buf[4 * i], 4);
+
+	return 0;
+}
+
 static int avrftdi_cmd(PROGRAMMER * pgm, const unsigned char *cmd, unsigned char *res)
 {
 	return avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, cmd, res, 4);
 }
 
+/* any number of commands in one transfer */
+static int avrftdi_spi(PROGRAMMER * pgm, const unsigned char *cmd, unsigned char *res, int count)
+{
+	return avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, cmd, res, count);
+}
+
 
 static int avrftdi_program_enable(PROGRAMMER * pgm, AVRPART * p)
 {
@@ -870,8 +1015,8 @@ static int avrftdi_program_enable(PROGRAMMER * pgm, AVRPART * p)
 	avr_set_bits(p->op[AVR_OP_PGM_ENABLE], buf);
 
 	for(i = 0; i < 4; i++) {
-		pgm->cmd(pgm, buf, buf);
-		if (buf[p->pollindex-1] != p->pollvalue) {
+		if (0 > pgm->cmd(pgm, buf, buf) ||
+		    buf[p->pollindex-1] != p->pollvalue) {
 			log_warn("Program enable command not successful. Retrying.\n");
 			set_pin(pgm, PIN_AVR_RESET, ON);
 			usleep(20);
@@ -901,7 +1046,7 @@ static int avrftdi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
 	avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
 	pgm->cmd(pgm, cmd, res);
-	usleep(p->chip_erase_delay);
+	avr_wait_ready(pgm, p, p->chip_erase_delay);
 	pgm->initialize(pgm, p);
 
 	return 0;
@@ -943,7 +1088,7 @@ static int avrftdi_eeprom_write(PROGRAMMER *pgm, AVRPART *p, AVRMEM *m,
 
 		if (0 > avrftdi_transmit(pgm, MPSSE_DO_WRITE, cmd, cmd, 4))
 		    return -1;
-		usleep((m->max_write_delay));
+		avr_wait_ready(pgm, p, m->max_write_delay);
 
 	}
 	return len;
@@ -953,23 +1098,26 @@ static int avrftdi_eeprom_read(PROGRAMMER *pgm, AVRPART *p, AVRMEM *m,
 		unsigned int page_size, unsigned int addr, unsigned int len)
 {
 	unsigned char cmd[4];
-	unsigned char buffer[len], *bufptr = buffer;
-	unsigned int add;
+	unsigned char res[4*len];
+	unsigned int i;
 
-	memset(buffer, 0, sizeof(buffer));
-	for (add = addr; add < addr + len; add++)
+	/* all the reads of the page go out in one transfer */
+	for (i = 0; i < len; i++)
 	{
 		memset(cmd, 0, sizeof(cmd));
 		avr_set_bits(m->op[AVR_OP_READ], cmd);
-		avr_set_addr(m->op[AVR_OP_READ], cmd, add);
-
-		if (0 > avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, cmd, cmd, 4))
-			return -1;
+		avr_set_addr(m->op[AVR_OP_READ], cmd, addr + i);
+		avrftdi_cmd_deferred(pgm, cmd, &res[4*i]);
+	}
+	if (0 > avrftdi_flush_deferred(pgm))
+		return -1;
 
-		avr_get_output(m->op[AVR_OP_READ], cmd, bufptr++);
+	/* avr_get_output() only sets bits, the buffer may hold 0xff fill */
+	for (i = 0; i < len; i++) {
+		m->buf[addr + i] = 0;
+		avr_get_output(m->op[AVR_OP_READ], &res[4*i], &m->buf[addr + i]);
 	}
 
-	memcpy(m->buf + addr, buffer, len);
 	return len;
 }
 
@@ -1081,25 +1229,49 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	}
 	else
 	{
-		log_warn("No suitable byte (!=0xff) for polling found.\n");
-		log_warn("Trying to sleep instead, but programming errors may occur.\n");
-		log_warn("Be sure to verify programmed memory (no -V option)\n");
-		/* TODO sync write */
-		/* sleep */
-		usleep((m->max_write_delay));
+		/* an all 0xff page, RDY/BSY polling works if the part has it */
+		if (p->pollmethod != 1) {
+			log_warn("No suitable byte (!=0xff) for polling found.\n");
+			log_warn("Trying to sleep instead, but programming errors may occur.\n");
+			log_warn("Be sure to verify programmed memory (no -V option)\n");
+		}
+		avr_wait_ready(pgm, p, m->max_write_delay);
 	}
 
 	return len;
 }
 
+/* take the page apart from the answers to its read commands */
+static void avrftdi_flash_decode(AVRMEM * m, unsigned char *i_buf,
+		unsigned char *dst, unsigned int page_size)
+{
+	OPCODE * readop;
+	int byte;
+
+	memset(dst, 0, page_size);
+
+	/* every (read) op is 4 bytes in size and yields one byte of memory data */
+	for(byte = 0; byte < page_size; byte++) {
+		if(byte & 1)
+			readop = m->op[AVR_OP_READ_HI];
+		else
+			readop = m->op[AVR_OP_READ_LO];
+
+		/* take 4 bytes and put the memory byte in the buffer at
+		 * offset addr + offset of the current byte
+		 */
+		avr_get_output(readop, &i_buf[byte*4], &dst[byte]);
+	}
+}
+
 /*
- *Reading from flash
+ *Reading from flash, into dst
  */
-static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-		unsigned int page_size, unsigned int addr, unsigned int len)
+static int avrftdi_flash_read_to(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+		unsigned int page_size, unsigned int addr, unsigned int len,
+		unsigned char *dst)
 {
-	OPCODE * readop;
-	int byte, word;
+	int word;
 	int use_lext_address = m->op[AVR_OP_LOAD_EXT_ADDR] != NULL;
 	unsigned int address = addr/2;
 
@@ -1155,27 +1327,21 @@ static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		buf_dump(i_buf, sizeof(i_buf), "i_buf", 0, 32);
 	}
 
-	memset(&m->buf[addr], 0, page_size);
-
-	/* every (read) op is 4 bytes in size and yields one byte of memory data */
-	for(byte = 0; byte < page_size; byte++) {
-		if(byte & 1)
-			readop = m->op[AVR_OP_READ_HI];
-		else
-			readop = m->op[AVR_OP_READ_LO];
-
-		/* take 4 bytes and put the memory byte in the buffer at
-		 * offset addr + offset of the current byte
-		 */
-		avr_get_output(readop, &i_buf[byte*4], &m->buf[addr+byte]);
-	}
+	avrftdi_flash_decode(m, i_buf, dst, page_size);
 
 	if(verbose > TRACE)
-		buf_dump(&m->buf[addr], page_size, "page:", 0, 32);
+		buf_dump(dst, page_size, "page:", 0, 32);
 
 	return len;
 }
 
+static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+		unsigned int page_size, unsigned int addr, unsigned int len)
+{
+	return avrftdi_flash_read_to(pgm, p, m, page_size, addr, len,
+	                             &m->buf[addr]);
+}
+
 static int avrftdi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		unsigned int page_size, unsigned int addr, unsigned int n_bytes)
 {
@@ -1198,6 +1364,52 @@ static int avrftdi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		return -2;
 }
 
+/*
+ * Read a flash page back right after it has been written, while the
+ * write is still fresh in the MPSSE command stream; there is nothing
+ * left in flight afterwards.
+ */
+static int avrftdi_paged_verify(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+		unsigned int page_size, unsigned int addr, unsigned int n_bytes)
+{
+	avrftdi_t* pdata = to_pdata(pgm);
+	unsigned char page[m->page_size];
+	unsigned int i;
+	int c, rv;
+
+	if (strcmp(m->desc, "flash") != 0 || n_bytes != m->page_size)
+		return -2;
+	/* each channel is compared with the buffer on its own */
+	pdata->chan_check = false;
+	rv = avrftdi_flash_read_to(pgm, p, m, m->page_size, addr, n_bytes, page);
+	pdata->chan_check = true;
+	if (0 > rv)
+		return -1;
+
+	for (c = 0; c < pdata->nchan; c++) {
+		if (c > 0)
+			avrftdi_flash_decode(m, pdata->chan_rx[c], page, n_bytes);
+		for (i = 0; i < n_bytes; i++)
+			if (avr_mem_tagged(m, addr + i) &&
+			    page[i] != m->buf[addr + i]) {
+				if (pdata->nchan > 1)
+					log_err("channel %c: ", pdata->channels[c]);
+				log_err("verification error, first mismatch at byte 0x%04x: "
+				        "0x%02x != 0x%02x\n",
+				        addr + i, m->buf[addr + i], page[i]);
+				rv = -1;
+				break;
+			}
+	}
+
+	return rv < 0? -1: 0;
+}
+
+static int avrftdi_paged_verify_done(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+	return 0;
+}
+
 static void
 avrftdi_setup(PROGRAMMER * pgm)
 {
@@ -1217,6 +1429,18 @@ avrftdi_setup(PROGRAMMER * pgm)
 	pdata->pin_value = 0;
 	pdata->pin_direction = 0;
 	pdata->led_mask = 0;
+	pdata->defer_buf = NULL;
+	pdata->defer_res = NULL;
+	pdata->defer_count = 0;
+	pdata->defer_alloc = 0;
+
+	memset(pdata->chan, 0, sizeof(pdata->chan));
+	memset(pdata->chan_rx, 0, sizeof(pdata->chan_rx));
+	pdata->chan[0] = pdata->ftdic;
+	pdata->nchan = 1;
+	pdata->channels[0] = 0;
+	pdata->chan_rx_size = 0;
+	pdata->chan_check = true;
 }
 
 static void
@@ -1225,12 +1449,69 @@ avrftdi_teardown(PROGRAMMER * pgm)
 	avrftdi_t* pdata = to_pdata(pgm);
 
 	if(pdata) {
+		int c;
+
+		for(c = 1; c < AVRFTDI_CHANNELS; c++) {
+			if(pdata->chan[c])
+				ftdi_free(pdata->chan[c]);
+			free(pdata->chan_rx[c]);
+		}
 		ftdi_deinit(pdata->ftdic);
 		ftdi_free(pdata->ftdic);
+		free(pdata->defer_buf);
+		free(pdata->defer_res);
 		free(pdata);
 	}
 }
 
+/*
+ * -x channels=<interfaces>, e. g. AB: drive the MPSSE channels of one
+ * chip side by side, a target on each
+ */
+static int avrftdi_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+	avrftdi_t* pdata = to_pdata(pgm);
+	LNODEID ln;
+	const char *extended_param;
+	int rv = 0;
+
+	for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+		extended_param = ldata(ln);
+
+		if (strncmp(extended_param, "channels=", strlen("channels=")) == 0) {
+			const char *cp = extended_param + strlen("channels=");
+			int n = 0;
+
+			for (; *cp; cp++) {
+				char ch = toupper((unsigned char)*cp);
+
+				if ((ch != 'A' && ch != 'B') || n == AVRFTDI_CHANNELS ||
+				    memchr(pdata->channels, ch, n)) {
+					n = 0;
+					break;
+				}
+				pdata->channels[n++] = ch;
+			}
+			if (n == 0) {
+				log_err("Invalid channels '%s', must be A, B or AB\n",
+				        extended_param);
+				pdata->channels[0] = 0;
+				rv = -1;
+				continue;
+			}
+			pdata->channels[n] = 0;
+			pdata->nchan = n;
+			log_info("Programming on channels %s\n", pdata->channels);
+			continue;
+		}
+
+		log_err("Invalid extended parameter '%s'\n", extended_param);
+		rv = -1;
+	}
+
+	return rv;
+}
+
 void avrftdi_initpgm(PROGRAMMER * pgm)
 {
 
@@ -1258,13 +1539,17 @@ void avrftdi_initpgm(PROGRAMMER * pgm)
 	 * optional functions
 	 */
 
+	pgm->spi = avrftdi_spi;
 	pgm->paged_write = avrftdi_paged_write;
 	pgm->paged_load = avrftdi_paged_load;
+	pgm->paged_verify = avrftdi_paged_verify;
+	pgm->paged_verify_done = avrftdi_paged_verify_done;
 
 	pgm->setpin = set_pin;
 
 	pgm->setup = avrftdi_setup;
 	pgm->teardown = avrftdi_teardown;
+	pgm->parseextparams = avrftdi_parseextparms;
 
 	pgm->rdy_led = set_led_rdy;
 	pgm->err_led = set_led_err;
@@ -64,6 +64,9 @@ enum { ERR, WARN, INFO, DEBUG, TRACE };
 #define to_pdata(pgm) \
 	((avrftdi_t *)((pgm)->cookie))
 
+/* MPSSE channels of one chip, interface A and B of the 2232H and 4232H */
+#define AVRFTDI_CHANNELS 2
+
 typedef struct avrftdi_s {
 	/* pointer to struct maintained by libftdi to identify the device */
 	struct ftdi_context* ftdic; 
@@ -81,6 +84,22 @@ typedef struct avrftdi_s {
 	int tx_buffer_size;
 	/* use bitbanging instead of mpsse spi */
 	bool use_bitbanging;
+	/* SPI commands queued by avrftdi_cmd_deferred(), and where their
+	 * results go */
+	unsigned char *defer_buf;
+	unsigned char **defer_res;
+	int defer_count;
+	int defer_alloc;
+	/* the channels driven in parallel, chan[0] is ftdic; all get the
+	 * same command stream, one target on each (-x channels) */
+	struct ftdi_context* chan[AVRFTDI_CHANNELS];
+	int nchan;
+	char channels[AVRFTDI_CHANNELS + 1];
+	/* what the other channels shifted back in the last transfer */
+	unsigned char *chan_rx[AVRFTDI_CHANNELS];
+	int chan_rx_size;
+	/* fail a transfer if they differ from chan[0] */
+	bool chan_check;
 } avrftdi_t;
 
 void avrftdi_log(int level, const char * func, int line, const char * fmt, ...);
@@ -19,6 +19,8 @@
 
 static void avrftdi_tpi_disable(PROGRAMMER *);
 static int avrftdi_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p);
+static int avrftdi_cmd_tpi_seq(PROGRAMMER * pgm, const unsigned char *cmd,
+		int cmd_len, unsigned char *res, int res_len, int count);
 
 #ifdef notyet
 static void
@@ -76,6 +78,7 @@ avrftdi_tpi_initialize(PROGRAMMER * pgm, AVRPART * p)
 
 	pgm->program_enable = avrftdi_tpi_program_enable;
 	pgm->cmd_tpi = avrftdi_cmd_tpi;
+	pgm->cmd_tpi_seq = avrftdi_cmd_tpi_seq;
 	pgm->chip_erase = avr_tpi_chip_erase;
 	pgm->disable = avrftdi_tpi_disable;
 
@@ -142,76 +145,115 @@ avrftdi_tpi_break(PROGRAMMER * pgm)
 }
 #endif /* notyet */
 
+/* MPSSE command clocking out the frame for byte, 5 bytes */
 static int
-avrftdi_tpi_write_byte(PROGRAMMER * pgm, unsigned char byte)
+avrftdi_tpi_put_byte(unsigned char * buf, unsigned char byte)
 {
 	uint16_t frame;
 
-	struct ftdi_context* ftdic = to_pdata(pgm)->ftdic;
+	frame = tpi_byte2frame(byte);
 
-	unsigned char buffer[] = { MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_LSB, 1, 0, 0, 0 };
+	buf[0] = MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_LSB;
+	buf[1] = 1;
+	buf[2] = 0;
+	buf[3] = frame & 0xff;
+	buf[4] = frame >> 8;
 
-	frame = tpi_byte2frame(byte);
-	
-	buffer[3] = frame & 0xff;
-	buffer[4] = frame >> 8;
-	
 	log_trace("Byte %02x, frame: %04x, MPSSE: 0x%02x 0x%02x 0x%02x  0x%02x 0x%02x\n",
-			byte, frame, buffer[0], buffer[1], buffer[2], buffer[3], buffer[4]);
-
-	//avrftdi_debug_frame(frame);
-	
-	E(ftdi_write_data(ftdic, buffer, sizeof(buffer)) != sizeof(buffer), ftdic);
+			byte, frame, buf[0], buf[1], buf[2], buf[3], buf[4]);
 
-	return 0;
+	return 5;
 }
 
 #define TPI_FRAME_SIZE 12
 #define TPI_IDLE_BITS   2
 
+/* use 2 guard bits, 2 default idle bits + 12 frame bits = 16 bits total */
+#define TPI_READ_BYTES 3
+
+/* MPSSE command clocking in one frame, 3 bytes */
+static int
+avrftdi_tpi_put_read(unsigned char * buf)
+{
+	buf[0] = MPSSE_DO_READ | MPSSE_LSB;
+	buf[1] = (TPI_READ_BYTES-1) & 0xff;
+	buf[2] = ((TPI_READ_BYTES-1) >> 8) & 0xff;
+
+	return 3;
+}
+
 static int
-avrftdi_tpi_read_byte(PROGRAMMER * pgm, unsigned char * byte)
+avrftdi_tpi_get_byte(const unsigned char * buf, unsigned char * byte)
 {
 	uint16_t frame;
-	
-	/* use 2 guard bits, 2 default idle bits + 12 frame bits = 16 bits total */
-	const int bytes = 3;
-	int err, i = 0;
-	
-	unsigned char buffer[4];
+	int err;
+
+	frame = buf[0] | (buf[1] << 8);
+
+	err = tpi_frame2byte(frame, byte);
+	log_trace("Frame: 0x%04x, byte: 0x%02x\n", frame, *byte);
+
+	//avrftdi_debug_frame(frame);
+
+	return err;
+}
 
-	buffer[0] = MPSSE_DO_READ | MPSSE_LSB;
-	buffer[1] = (bytes-1) & 0xff;
-	buffer[2] = ((bytes-1) >> 8) & 0xff;
-	buffer[3] = SEND_IMMEDIATE;
+/*
+ * Run count commands of cmd_len bytes, each answered by res_len bytes.
+ * The frames of as many commands as their answers fit into the receive
+ * buffer of the chip go out in one write; the target is clocked by the
+ * MPSSE engine, so the answers line up with the read commands.
+ */
+static int
+avrftdi_cmd_tpi_seq(PROGRAMMER * pgm, const unsigned char *cmd, int cmd_len,
+		unsigned char *res, int res_len, int count)
+{
+	avrftdi_t* pdata = to_pdata(pgm);
+	int block, n, i, j, k, len;
 
-	log_trace("MPSSE: 0x%02x 0x%02x 0x%02x 0x%02x (Read frame)\n",
-			buffer[0], buffer[1], buffer[2], buffer[3]);
+	block = count;
+	if (res_len > 0) {
+		block = pdata->rx_buffer_size / (res_len * TPI_READ_BYTES);
+		if (block < 1)
+			block = 1;
+	}
 
-	ftdi_write_data(to_pdata(pgm)->ftdic, buffer, 4);
+	while (count > 0) {
+		n = (count > block) ? block : count;
 
-	memset(buffer, 0, sizeof(buffer));
+		unsigned char send[n * (cmd_len * 5 + res_len * 3) + 1];
+		unsigned char recv[n * res_len * TPI_READ_BYTES + 1];
 
-	i = 0;
-	do {
-		int err = ftdi_read_data(to_pdata(pgm)->ftdic, &buffer[i], bytes - i);
-		E(err < 0, to_pdata(pgm)->ftdic);
-		i += err;
-	} while(i < bytes);
+		len = 0;
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < cmd_len; j++)
+				len += avrftdi_tpi_put_byte(send + len, cmd[i * cmd_len + j]);
+			for (j = 0; j < res_len; j++)
+				len += avrftdi_tpi_put_read(send + len);
+		}
+		if (res_len > 0)
+			send[len++] = SEND_IMMEDIATE;
 
+		E(ftdi_write_data(pdata->ftdic, send, len) != len, pdata->ftdic);
 
-	log_trace("MPSSE: 0x%02x 0x%02x 0x%02x 0x%02x (Read frame)\n",
-			buffer[0], buffer[1], buffer[2], buffer[3]);
+		len = n * res_len * TPI_READ_BYTES;
+		for (k = 0; k < len; ) {
+			int err = ftdi_read_data(pdata->ftdic, &recv[k], len - k);
+			E(err < 0, pdata->ftdic);
+			k += err;
+		}
 
+		for (i = 0; i < n * res_len; i++)
+			if (avrftdi_tpi_get_byte(recv + i * TPI_READ_BYTES, &res[i]))
+				return -1;
 
-	frame = buffer[0] | (buffer[1] << 8);
-	
-	err = tpi_frame2byte(frame, byte);
-	log_trace("Frame: 0x%04x, byte: 0x%02x\n", frame, *byte);
-	
-	//avrftdi_debug_frame(frame);
+		cmd += n * cmd_len;
+		if (res_len > 0)
+			res += n * res_len;
+		count -= n;
+	}
 
-	return err;
+	return 0;
 }
 
 static int
@@ -224,23 +266,8 @@ int
 avrftdi_cmd_tpi(PROGRAMMER * pgm, const unsigned char *cmd, int cmd_len,
 		unsigned char *res, int res_len)
 {
-	int i, err = 0;
-
-	for(i = 0; i < cmd_len; i++)
-	{
-		err = avrftdi_tpi_write_byte(pgm, cmd[i]);
-		if(err)
-			return err;
-	}
-
-	for(i = 0; i < res_len; i++)
-	{
-		err = avrftdi_tpi_read_byte(pgm, &res[i]);
-		if(err)
-			return err;
-	}
-
-	return 0;
+	/* all frames of one command in a single transfer */
+	return avrftdi_cmd_tpi_seq(pgm, cmd, cmd_len, res, res_len, 1);
 }
 
 static void
@@ -20,10 +20,12 @@
 
 /* $Id: avrpart.c 1161 2013-05-05 13:35:35Z rliebscher $ */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "avrdude.h"
+#include "arena.h"
 #include "avrpart.h"
 #include "pindefs.h"
 
@@ -35,7 +37,7 @@ OPCODE * avr_new_opcode(void)
 {
   OPCODE * m;
 
-  m = (OPCODE *)malloc(sizeof(*m));
+  m = (OPCODE *)arena_alloc(sizeof(*m));
   if (m == NULL) {
     fprintf(stderr, "avr_new_opcode(): out of memory\n");
     exit(1);
@@ -55,7 +57,7 @@ static OPCODE * avr_dup_opcode(OPCODE * op)
     return NULL;
   }
 
-  m = (OPCODE *)malloc(sizeof(*m));
+  m = (OPCODE *)arena_alloc(sizeof(*m));
   if (m == NULL) {
     fprintf(stderr, "avr_dup_opcode(): out of memory\n");
     exit(1);
@@ -68,30 +70,121 @@ static OPCODE * avr_dup_opcode(OPCODE * op)
 
 void avr_free_opcode(OPCODE * op)
 {
-  free(op);
+  arena_free(op);
 }
 
 /*
- * avr_set_bits()
+ * Collect the command bits of the given type into runs of consecutive
+ * value bits.
+ */
+static void avr_compile_fields(OPCODE * op, int type, CMDFIELDS * f)
+{
+  CMDFIELD * cf;
+  int i, next;
+
+  f->n = 0;
+  f->bits = 0;
+  cf = NULL;
+  next = 0;
+  for (i=0; i<32; i++) {
+    if (op->bit[i].type != type) {
+      cf = NULL;
+      continue;
+    }
+    f->bits |= 1U << i;
+    if (f->n < 0)
+      continue;
+    if (cf != NULL && op->bit[i].bitno == next) {
+      cf->mask = (cf->mask << 1) | 1;
+    }
+    else if (f->n < CMDFIELD_MAX && op->bit[i].bitno >= 0 &&
+             op->bit[i].bitno < 32) {
+      cf = &f->field[f->n++];
+      cf->shift = i;
+      cf->bitno = op->bit[i].bitno;
+      cf->mask = 1;
+    }
+    else {
+      /* too scattered, use the bit loop */
+      f->n = -1;
+      cf = NULL;
+      continue;
+    }
+    next = op->bit[i].bitno + 1;
+  }
+}
+
+
+/*
+ * avr_compile_opcode()
  *
- * Set instruction bits in the specified command based on the opcode.
+ * Precompute the masks and value bit runs of the opcode, so commands
+ * are built with a few shifts instead of walking all 32 bit specs.
+ * Must be called again if the bit specs change.
  */
-int avr_set_bits(OPCODE * op, unsigned char * cmd)
+void avr_compile_opcode(OPCODE * op)
 {
-  int i, j, bit;
-  unsigned char mask;
+  int i;
 
+  op->value_mask = 0;
+  op->value_bits = 0;
   for (i=0; i<32; i++) {
     if (op->bit[i].type == AVR_CMDBIT_VALUE) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
+      op->value_mask |= 1U << i;
       if (op->bit[i].value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
+        op->value_bits |= 1U << i;
     }
   }
+  avr_compile_fields(op, AVR_CMDBIT_ADDRESS, &op->addr);
+  avr_compile_fields(op, AVR_CMDBIT_INPUT, &op->input);
+  avr_compile_fields(op, AVR_CMDBIT_OUTPUT, &op->output);
+  op->compiled = 1;
+}
+
+
+static unsigned int avr_cmd_word(const unsigned char * cmd)
+{
+  return ((unsigned int)cmd[0] << 24) | ((unsigned int)cmd[1] << 16) |
+         ((unsigned int)cmd[2] << 8) | cmd[3];
+}
+
+
+static void avr_put_cmd_word(unsigned char * cmd, unsigned int w)
+{
+  cmd[0] = w >> 24;
+  cmd[1] = w >> 16;
+  cmd[2] = w >> 8;
+  cmd[3] = w;
+}
+
+
+/* set the bits of fields f in command word w from value */
+static unsigned int avr_set_fields(const CMDFIELDS * f, unsigned int w,
+                                   unsigned long value)
+{
+  int i;
+
+  w &= ~f->bits;
+  for (i=0; i<f->n; i++)
+    w |= ((unsigned int)(value >> f->field[i].bitno) & f->field[i].mask)
+         << f->field[i].shift;
+
+  return w;
+}
+
+
+/*
+ * avr_set_bits()
+ *
+ * Set instruction bits in the specified command based on the opcode.
+ */
+int avr_set_bits(OPCODE * op, unsigned char * cmd)
+{
+  if (!op->compiled)
+    avr_compile_opcode(op);
+
+  avr_put_cmd_word(cmd, (avr_cmd_word(cmd) & ~op->value_mask) |
+                        op->value_bits);
 
   return 0;
 }
@@ -109,6 +202,14 @@ int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
   unsigned long value;
   unsigned char mask;
 
+  if (!op->compiled)
+    avr_compile_opcode(op);
+
+  if (op->addr.n >= 0) {
+    avr_put_cmd_word(cmd, avr_set_fields(&op->addr, avr_cmd_word(cmd), addr));
+    return 0;
+  }
+
   for (i=0; i<32; i++) {
     if (op->bit[i].type == AVR_CMDBIT_ADDRESS) {
       j = 3 - i / 8;
@@ -138,6 +239,14 @@ int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
   unsigned char value;
   unsigned char mask;
 
+  if (!op->compiled)
+    avr_compile_opcode(op);
+
+  if (op->input.n >= 0) {
+    avr_put_cmd_word(cmd, avr_set_fields(&op->input, avr_cmd_word(cmd), data));
+    return 0;
+  }
+
   for (i=0; i<32; i++) {
     if (op->bit[i].type == AVR_CMDBIT_INPUT) {
       j = 3 - i / 8;
@@ -166,6 +275,18 @@ int avr_get_output(OPCODE * op, unsigned char * res, unsigned char * data)
   int i, j, bit;
   unsigned char value;
   unsigned char mask;
+  unsigned int w;
+
+  if (!op->compiled)
+    avr_compile_opcode(op);
+
+  if (op->output.n >= 0) {
+    w = avr_cmd_word(res);
+    for (i=0; i<op->output.n; i++)
+      *data |= ((w >> op->output.field[i].shift) & op->output.field[i].mask)
+               << op->output.field[i].bitno;
+    return 0;
+  }
 
   for (i=0; i<32; i++) {
     if (op->bit[i].type == AVR_CMDBIT_OUTPUT) {
@@ -248,7 +369,7 @@ AVRMEM * avr_new_memtype(void)
 {
   AVRMEM * m;
 
-  m = (AVRMEM *)malloc(sizeof(*m));
+  m = (AVRMEM *)arena_alloc(sizeof(*m));
   if (m == NULL) {
     fprintf(stderr, "avr_new_memtype(): out of memory\n");
     exit(1);
@@ -260,6 +381,91 @@ AVRMEM * avr_new_memtype(void)
 }
 
 
+/*
+ * Memory buffers and tags are reference counted, so a duplicate of a
+ * memory shares them with the original until either side is written;
+ * the count is kept in front of the data.
+ */
+struct membuf {
+  int           refs;
+  unsigned char data[];
+};
+
+#define MEMBUF(b) ((struct membuf *)((b) - offsetof(struct membuf, data)))
+
+static unsigned char * avr_membuf_alloc(int size)
+{
+  struct membuf * mb;
+
+  mb = (struct membuf *)malloc(sizeof(*mb) + size);
+  if (mb == NULL)
+    return NULL;
+  mb->refs = 1;
+
+  return mb->data;
+}
+
+static unsigned char * avr_membuf_ref(unsigned char * b)
+{
+  if (b != NULL)
+    MEMBUF(b)->refs++;
+  return b;
+}
+
+static void avr_membuf_unref(unsigned char * b)
+{
+  if (b != NULL && --MEMBUF(b)->refs == 0)
+    free(MEMBUF(b));
+}
+
+/*
+ * Return a private copy of the shared buffer b of size bytes, with the
+ * old contents if keep is set.
+ */
+static unsigned char * avr_membuf_unshare(unsigned char * b, int size,
+                                          int keep)
+{
+  unsigned char * n;
+
+  if (b == NULL || MEMBUF(b)->refs == 1)
+    return b;
+
+  n = avr_membuf_alloc(size);
+  if (n == NULL) {
+    fprintf(stderr, "avr_mem_unshare(): out of memory (memsize=%d)\n",
+            size);
+    exit(1);
+  }
+  if (keep)
+    memcpy(n, b, size);
+  avr_membuf_unref(b);
+
+  return n;
+}
+
+/*
+ * Give m a buffer of its own before it is written to; the contents are
+ * kept if keep is set, else the caller is about to overwrite all of it.
+ */
+void avr_mem_unshare(AVRMEM * m, int keep)
+{
+  m->buf = avr_membuf_unshare(m->buf, m->size, keep);
+}
+
+/* size in bytes of the allocation tags, one bit per byte of memory */
+int avr_mem_tags_size(AVRMEM * m)
+{
+  return (m->size + 7) / 8;
+}
+
+/* size in bytes of the dirty page bitmap of a paged memory */
+static int avr_mem_dirty_size(AVRMEM * m)
+{
+  int npages = (m->size + m->page_size - 1) / m->page_size;
+
+  return (npages + 7) / 8;
+}
+
 /*
  * Allocate and initialize memory buffers for each of the device's
  * defined memory regions.
@@ -271,18 +477,27 @@ int avr_initmem(AVRPART * p)
 
   for (ln=lfirst(p->mem); ln; ln=lnext(ln)) {
     m = ldata(ln);
-    m->buf = (unsigned char *) malloc(m->size);
+    m->buf = avr_membuf_alloc(m->size);
     if (m->buf == NULL) {
       fprintf(stderr, "%s: can't alloc buffer for %s size of %d bytes\n",
               progname, m->desc, m->size);
       return -1;
     }
-    m->tags = (unsigned char *) malloc(m->size);
+    m->tags = avr_membuf_alloc(avr_mem_tags_size(m));
     if (m->tags == NULL) {
       fprintf(stderr, "%s: can't alloc buffer for %s size of %d bytes\n",
               progname, m->desc, m->size);
       return -1;
     }
+    memset(m->tags, 0, avr_mem_tags_size(m));
+    if (m->page_size > 0) {
+      m->dirty = (unsigned char *) calloc(avr_mem_dirty_size(m), 1);
+      if (m->dirty == NULL) {
+        fprintf(stderr, "%s: can't alloc page map for %s\n",
+                progname, m->desc);
+        return -1;
+      }
+    }
   }
 
   return 0;
@@ -298,28 +513,26 @@ AVRMEM * avr_dup_mem(AVRMEM * m)
 
   *n = *m;
 
-  if (m->buf != NULL) {
-    n->buf = (unsigned char *)malloc(n->size);
-    if (n->buf == NULL) {
-      fprintf(stderr,
-              "avr_dup_mem(): out of memory (memsize=%d)\n",
-              n->size);
-      exit(1);
-    }
-    memcpy(n->buf, m->buf, n->size);
-  }
+  /* buffer and tags are shared until one of the copies is written */
+  n->buf = avr_membuf_ref(m->buf);
+  n->tags = avr_membuf_ref(m->tags);
 
-  if (m->tags != NULL) {
-    n->tags = (unsigned char *)malloc(n->size);
-    if (n->tags == NULL) {
+  if (m->dirty != NULL) {
+    n->dirty = (unsigned char *)malloc(avr_mem_dirty_size(n));
+    if (n->dirty == NULL) {
       fprintf(stderr,
               "avr_dup_mem(): out of memory (memsize=%d)\n",
               n->size);
       exit(1);
     }
-    memcpy(n->tags, m->tags, n->size);
+    memcpy(n->dirty, m->dirty, avr_mem_dirty_size(n));
   }
 
+  /* the read-back cache describes the device, not the copy */
+  n->cache = NULL;
+  n->cached = NULL;
+  n->known_blank = 0;
+
   for (i = 0; i < AVR_OP_MAX; i++) {
     n->op[i] = avr_dup_opcode(n->op[i]);
   }
@@ -327,16 +540,38 @@ AVRMEM * avr_dup_mem(AVRMEM * m)
   return n;
 }
 
+/* copy buffer and tags of src into dst, a memory of the same layout */
+void avr_mem_copy_contents(AVRMEM * dst, AVRMEM * src)
+{
+  unsigned char * buf = dst->buf, * tags = dst->tags;
+
+  /* share rather than copy; either side unshares before writing */
+  dst->buf = avr_membuf_ref(src->buf);
+  dst->tags = avr_membuf_ref(src->tags);
+  avr_membuf_unref(buf);
+  avr_membuf_unref(tags);
+  if (dst->dirty != NULL && src->dirty != NULL)
+    memcpy(dst->dirty, src->dirty, avr_mem_dirty_size(dst));
+}
+
 void avr_free_mem(AVRMEM * m)
 {
     int i;
-    if (m->buf != NULL) {
-      free(m->buf);
-      m->buf = NULL;
+    avr_membuf_unref(m->buf);
+    m->buf = NULL;
+    avr_membuf_unref(m->tags);
+    m->tags = NULL;
+    if (m->dirty != NULL) {
+      free(m->dirty);
+      m->dirty = NULL;
+    }
+    if (m->cache != NULL) {
+      free(m->cache);
+      m->cache = NULL;
     }
-    if (m->tags != NULL) {
-      free(m->tags);
-      m->tags = NULL;
+    if (m->cached != NULL) {
+      free(m->cached);
+      m->cached = NULL;
     }
     for(i=0;i<sizeof(m->op)/sizeof(m->op[0]);i++)
     {
@@ -346,17 +581,360 @@ void avr_free_mem(AVRMEM * m)
         m->op[i] = NULL;
       }
     }
-    free(m);
+    arena_free(m);
 }
 
+/*
+ * Allocation tags: one bit per byte of memory, set for the bytes
+ * loaded from a file, 8 to a tags byte with the lowest address in
+ * bit 0.  Besides these, paged memories keep a bitmap with one bit per
+ * page that is set as soon as any byte of the page is tagged, so the
+ * paged read and write loops can go straight to the pages of interest.
+ * Memories without a bitmap fall back to scanning the tags.
+ */
+static void avr_tags_fill(unsigned char * tags, int addr, int len, int set)
+{
+  int end = addr + len, n;
+
+  for (; addr < end && addr % 8 != 0; addr++)
+    if (set)
+      tags[addr / 8] |= 1 << (addr % 8);
+    else
+      tags[addr / 8] &= ~(1 << (addr % 8));
+  n = (end - addr) / 8;
+  if (n > 0) {
+    memset(tags + addr / 8, set? 0xff: 0, n);
+    addr += 8 * n;
+  }
+  for (; addr < end; addr++)
+    if (set)
+      tags[addr / 8] |= 1 << (addr % 8);
+    else
+      tags[addr / 8] &= ~(1 << (addr % 8));
+}
+
+int avr_mem_tagged(AVRMEM * m, int addr)
+{
+  return (m->tags[addr / 8] >> (addr % 8)) & 1;
+}
+
+/*
+ * Return the first address from addr below limit that is tagged (or
+ * untagged if tagged is 0), or limit if there is none.
+ */
+int avr_mem_tag_find(AVRMEM * m, int addr, int limit, int tagged)
+{
+  unsigned char skip = tagged? 0x00: 0xff;
+
+  while (addr < limit) {
+    /* skip eight bytes at once */
+    if (addr % 8 == 0 && limit - addr >= 8 && m->tags[addr / 8] == skip) {
+      addr += 8;
+      continue;
+    }
+    if (avr_mem_tagged(m, addr) == (tagged != 0))
+      return addr;
+    addr++;
+  }
+
+  return limit;
+}
+
+/* whether the first size bytes of a and b are tagged alike */
+int avr_mem_tags_equal(AVRMEM * a, AVRMEM * b, int size)
+{
+  int i;
+
+  if (a->tags == b->tags)
+    return 1;
+  if (memcmp(a->tags, b->tags, size / 8) != 0)
+    return 0;
+  for (i = size / 8 * 8; i < size; i++)
+    if (avr_mem_tagged(a, i) != avr_mem_tagged(b, i))
+      return 0;
+
+  return 1;
+}
+
+void avr_mem_tag(AVRMEM * m, int addr, int len)
+{
+  int page;
+
+  if (len <= 0)
+    return;
+
+  m->tags = avr_membuf_unshare(m->tags, avr_mem_tags_size(m), 1);
+  avr_tags_fill(m->tags, addr, len, 1);
+
+  if (m->dirty == NULL)
+    return;
+  for (page = addr / m->page_size;
+       page <= (addr + len - 1) / m->page_size;
+       page++)
+    m->dirty[page / 8] |= 1 << (page % 8);
+}
+
+void avr_mem_untag(AVRMEM * m, int addr, int len)
+{
+  int page, first, last, end;
+
+  if (len <= 0)
+    return;
+
+  if (addr > 0 || len < m->size) {
+    m->tags = avr_membuf_unshare(m->tags, avr_mem_tags_size(m), 1);
+    avr_tags_fill(m->tags, addr, len, 0);
+  } else {
+    m->tags = avr_membuf_unshare(m->tags, avr_mem_tags_size(m), 0);
+    memset(m->tags, 0, avr_mem_tags_size(m));
+  }
+
+  if (m->dirty == NULL)
+    return;
+  first = addr / m->page_size;
+  last = (addr + len - 1) / m->page_size;
+  for (page = first; page <= last; page++) {
+    m->dirty[page / 8] &= ~(1 << (page % 8));
+    /* pages only partially cleared may still hold tagged bytes */
+    if (page == first || page == last) {
+      end = (page + 1) * m->page_size < m->size?
+        (page + 1) * m->page_size: m->size;
+      if (avr_mem_tag_find(m, page * m->page_size, end, 1) < end)
+        m->dirty[page / 8] |= 1 << (page % 8);
+    }
+  }
+}
+
+/*
+ * Set the tags of m from tags, a bitmap laid out as m->tags is, such
+ * as one saved from it earlier.
+ */
+void avr_mem_tag_bits(AVRMEM * m, const unsigned char * tags)
+{
+  int pageaddr, end;
+
+  m->tags = avr_membuf_unshare(m->tags, avr_mem_tags_size(m), 0);
+  memcpy(m->tags, tags, avr_mem_tags_size(m));
+  /* nothing past the end of the memory is tagged */
+  if (m->size % 8 != 0)
+    m->tags[m->size / 8] &= (1 << (m->size % 8)) - 1;
+
+  if (m->dirty == NULL)
+    return;
+  memset(m->dirty, 0, avr_mem_dirty_size(m));
+  for (pageaddr = 0; pageaddr < m->size; pageaddr += m->page_size) {
+    end = pageaddr + m->page_size < m->size? pageaddr + m->page_size: m->size;
+    if (avr_mem_tag_find(m, pageaddr, end, 1) < end)
+      m->dirty[pageaddr / m->page_size / 8] |=
+        1 << (pageaddr / m->page_size % 8);
+  }
+}
+
+/* whether the page starting at pageaddr holds any tagged byte */
+int avr_mem_page_dirty(AVRMEM * m, int pageaddr)
+{
+  int page, end;
+
+  if (m->dirty != NULL) {
+    page = pageaddr / m->page_size;
+    return (m->dirty[page / 8] >> (page % 8)) & 1;
+  }
+
+  end = pageaddr + m->page_size < m->size? pageaddr + m->page_size: m->size;
+  return avr_mem_tag_find(m, pageaddr, end, 1) < end;
+}
+
+/*
+ * Return the address of the first page at or after pageaddr that holds
+ * tagged bytes and starts below limit, or -1 if there is none.
+ */
+int avr_mem_next_dirty(AVRMEM * m, int pageaddr, int limit)
+{
+  int page, npages;
+
+  if (m->dirty == NULL) {
+    for (; pageaddr < limit; pageaddr += m->page_size)
+      if (avr_mem_page_dirty(m, pageaddr))
+        return pageaddr;
+    return -1;
+  }
+
+  npages = (limit + m->page_size - 1) / m->page_size;
+  for (page = pageaddr / m->page_size; page < npages; page++) {
+    /* skip eight clean pages at once */
+    if (page % 8 == 0 && m->dirty[page / 8] == 0) {
+      page += 7;
+      continue;
+    }
+    if ((m->dirty[page / 8] >> (page % 8)) & 1)
+      return page * m->page_size;
+  }
+  return -1;
+}
+
+/* number of pages starting below limit that hold tagged bytes */
+int avr_mem_count_dirty(AVRMEM * m, int limit)
+{
+  int pageaddr, n;
+
+  for (pageaddr = 0, n = 0;
+       (pageaddr = avr_mem_next_dirty(m, pageaddr, limit)) >= 0;
+       pageaddr += m->page_size)
+    n++;
+  return n;
+}
+
+/*
+ * Read-back cache: device contents that have been read back in this
+ * session, e.g. while polling a byte write, so that a later verify
+ * does not need to fetch them again.  Anything that writes to the
+ * device must invalidate the range it touches.
+ */
+void avr_mem_cache_store(AVRMEM * m, int addr, const unsigned char * data,
+                         int len)
+{
+  int i;
+
+  if (m->cache == NULL) {
+    m->cache = (unsigned char *)malloc(m->size);
+    m->cached = (unsigned char *)calloc((m->size + 7) / 8, 1);
+    if (m->cache == NULL || m->cached == NULL) {
+      fprintf(stderr,
+              "avr_mem_cache_store(): out of memory (memsize=%d)\n",
+              m->size);
+      exit(1);
+    }
+  }
+
+  memcpy(m->cache + addr, data, len);
+  for (i = addr; i < addr + len; i++)
+    m->cached[i / 8] |= 1 << (i % 8);
+}
+
+void avr_mem_cache_invalidate(AVRMEM * m, int addr, int len)
+{
+  int i;
+
+  if (len > m->size - addr)
+    len = m->size - addr;
+  /* whatever is written there is no longer known to be blank */
+  if (m->known_blank > m->size - (addr + len))
+    m->known_blank = m->size - (addr + len);
+
+  if (m->cached == NULL)
+    return;
+
+  for (i = addr; i < addr + len; i++)
+    m->cached[i / 8] &= ~(1 << (i % 8));
+}
+
+/*
+ * Whether every byte in the range that vmem has tagged as allocated
+ * (or every byte at all if vmem is NULL) is in the cache.
+ */
+int avr_mem_cache_covers(AVRMEM * m, AVRMEM * vmem, int addr, int len)
+{
+  int i;
+
+  if (m->cached == NULL)
+    return 0;
+
+  for (i = addr; i < addr + len && i < m->size; i++)
+    if ((vmem == NULL || avr_mem_tagged(vmem, i)) &&
+        (m->cached[i / 8] & (1 << (i % 8))) == 0)
+      return 0;
+  return 1;
+}
+
+/* copy the cached bytes of the range into the memory buffer */
+void avr_mem_cache_fetch(AVRMEM * m, int addr, int len)
+{
+  int i;
+
+  if (m->cached == NULL)
+    return;
+
+  avr_mem_unshare(m, 1);
+  for (i = addr; i < addr + len && i < m->size; i++)
+    if (m->cached[i / 8] & (1 << (i % 8)))
+      m->buf[i] = m->cache[i];
+}
+
+static int mem_index_compare(const void * a, const void * b)
+{
+  return strcmp((*(AVRMEM * const *)a)->desc, (*(AVRMEM * const *)b)->desc);
+}
+
+/*
+ * Build the sorted memory index of a part.  Returns 0 if that is not
+ * possible, in which case avr_locate_mem() walks the list instead.
+ */
+static int avr_build_mem_index(AVRPART * p)
+{
+  void ** mems;
+  int n;
+
+  avr_drop_mem_index(p);
+  n = lsize(p->mem);
+  if (n == 0)
+    return 0;
+  p->mem_index = malloc(n * sizeof(AVRMEM *));
+  if (p->mem_index == NULL || (mems = larray(p->mem)) == NULL) {
+    avr_drop_mem_index(p);
+    return 0;
+  }
+  memcpy(p->mem_index, mems, n * sizeof(AVRMEM *));
+  qsort(p->mem_index, n, sizeof(AVRMEM *), mem_index_compare);
+  p->n_mem_index = n;
+
+  return 1;
+}
+
+/*
+ * Forget the memory index of a part; must be called whenever
+ * memories are removed from p->mem.
+ */
+void avr_drop_mem_index(AVRPART * p)
+{
+  free(p->mem_index);
+  p->mem_index = NULL;
+  p->n_mem_index = 0;
+}
+
+/*
+ * Locate the memory whose name starts with desc; the prefix must be
+ * unambiguous.  The memories are looked up in an index sorted by
+ * name, where all names starting with desc follow each other.
+ */
 AVRMEM * avr_locate_mem(AVRPART * p, char * desc)
 {
   AVRMEM * m, * match;
   LNODEID ln;
   int matches;
   int l;
+  int lo, hi, mid;
 
   l = strlen(desc);
+
+  if ((p->mem_index != NULL && p->n_mem_index == lsize(p->mem)) ||
+      avr_build_mem_index(p)) {
+    lo = 0;
+    hi = p->n_mem_index;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (strcmp(p->mem_index[mid]->desc, desc) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < p->n_mem_index &&
+        strncmp(desc, p->mem_index[lo]->desc, l) == 0 &&
+        (lo + 1 == p->n_mem_index ||
+         strncmp(desc, p->mem_index[lo + 1]->desc, l) != 0))
+      return p->mem_index[lo];
+    return NULL;
+  }
+
   matches = 0;
   match = NULL;
   for (ln=lfirst(p->mem); ln; ln=lnext(ln)) {
@@ -443,7 +1021,7 @@ AVRPART * avr_new_part(void)
 {
   AVRPART * p;
 
-  p = (AVRPART *)malloc(sizeof(AVRPART));
+  p = (AVRPART *)arena_alloc(sizeof(AVRPART));
   if (p == NULL) {
     fprintf(stderr, "new_part(): out of memory\n");
     exit(1);
@@ -468,6 +1046,21 @@ AVRPART * avr_new_part(void)
 }
 
 
+/*
+ * Fill in the memories and opcodes of a part whose construction has
+ * been deferred; nothing to do for a part that is already complete.
+ */
+void avr_part_complete(AVRPART * p)
+{
+  void (*complete)(AVRPART *) = p->complete;
+
+  if (complete != NULL) {
+    p->complete = NULL;
+    complete(p);
+    p->complete_data = NULL;
+  }
+}
+
 AVRPART * avr_dup_part(AVRPART * d)
 {
   AVRPART * p;
@@ -475,12 +1068,16 @@ AVRPART * avr_dup_part(AVRPART * d)
   LNODEID ln;
   int i;
 
+  avr_part_complete(d);
+
   p = avr_new_part();
   save = p->mem;
 
   *p = *d;
 
   p->mem = save;
+  p->mem_index = NULL;
+  p->n_mem_index = 0;
 
   for (ln=lfirst(d->mem); ln; ln=lnext(ln)) {
     ladd(p->mem, avr_dup_mem(ldata(ln)));
@@ -498,6 +1095,7 @@ void avr_free_part(AVRPART * d)
 int i;
 	ldestroy_cb(d->mem, (void(*)(void *))avr_free_mem);
 	d->mem = NULL;
+	avr_drop_mem_index(d);
     for(i=0;i<sizeof(d->op)/sizeof(d->op[0]);i++)
     {
     	if (d->op[i] != NULL)
@@ -506,7 +1104,126 @@ int i;
     		d->op[i] = NULL;
     	}
     }
-	free(d);
+	arena_free(d);
+}
+
+/*
+ * Index of the part ids and descriptions of one part list, sorted by
+ * name and then by list position, so that the first entry for a name
+ * is the part a walk over the list would find.
+ */
+struct part_key {
+  const char * name;
+  int          seq;
+  AVRPART    * part;
+};
+
+/*
+ * The same for the signatures, for locate_part_by_signature().
+ */
+struct sig_key {
+  unsigned long sig;
+  int           seq;
+  AVRPART     * part;
+};
+
+static struct {
+  LISTID            parts;
+  int               nparts;
+  int               nkeys;
+  struct part_key * keys;
+  int               nsigs;
+  struct sig_key  * sigs;
+} part_index;
+
+static int part_key_compare(const void * a, const void * b)
+{
+  const struct part_key * k1 = a, * k2 = b;
+  int rc;
+
+  rc = strcasecmp(k1->name, k2->name);
+  if (rc == 0)
+    rc = k1->seq - k2->seq;
+  return rc;
+}
+
+static int sig_key_compare(const void * a, const void * b)
+{
+  const struct sig_key * k1 = a, * k2 = b;
+
+  if (k1->sig != k2->sig)
+    return k1->sig < k2->sig? -1: 1;
+  return k1->seq - k2->seq;
+}
+
+/*
+ * The signature of a part as one number, or 0 for the template parts
+ * (ids starting with a dot) and parts that have none.
+ */
+static unsigned long part_signature(AVRPART * p)
+{
+  if (p->id[0] == '.')
+    return 0;
+  if ((p->signature[0] == 0xff && p->signature[1] == 0xff &&
+       p->signature[2] == 0xff) ||
+      (p->signature[0] == 0 && p->signature[1] == 0 &&
+       p->signature[2] == 0))
+    return 0;
+
+  return ((unsigned long)p->signature[0] << 16) |
+    ((unsigned long)p->signature[1] << 8) | p->signature[2];
+}
+
+/*
+ * Build the lookup index for locate_part() and
+ * locate_part_by_signature() once the configuration has been read;
+ * the list must not be changed afterwards.
+ */
+void index_avrparts(LISTID avrparts)
+{
+  void ** parts;
+  AVRPART * p;
+  int i, n;
+
+  free(part_index.keys);
+  free(part_index.sigs);
+  part_index.parts = NULL;
+  part_index.nkeys = 0;
+  part_index.nsigs = 0;
+  part_index.keys = malloc(2 * lsize(avrparts) * sizeof(struct part_key) + 1);
+  part_index.sigs = malloc(lsize(avrparts) * sizeof(struct sig_key) + 1);
+  if (part_index.keys == NULL || part_index.sigs == NULL ||
+      (parts = larray(avrparts)) == NULL) {
+    free(part_index.keys);
+    free(part_index.sigs);
+    part_index.keys = NULL;
+    part_index.sigs = NULL;
+    return;
+  }
+
+  n = 0;
+  for (i = 0; parts[i] != NULL; i++) {
+    p = parts[i];
+    part_index.keys[n].name = p->id;
+    part_index.keys[n].seq = n;
+    part_index.keys[n].part = p;
+    n++;
+    part_index.keys[n].name = p->desc;
+    part_index.keys[n].seq = n;
+    part_index.keys[n].part = p;
+    n++;
+    if ((part_index.sigs[part_index.nsigs].sig = part_signature(p)) != 0) {
+      part_index.sigs[part_index.nsigs].seq = i;
+      part_index.sigs[part_index.nsigs].part = p;
+      part_index.nsigs++;
+    }
+  }
+  qsort(part_index.keys, n, sizeof(struct part_key), part_key_compare);
+  qsort(part_index.sigs, part_index.nsigs, sizeof(struct sig_key),
+        sig_key_compare);
+  part_index.parts = avrparts;
+  part_index.nparts = lsize(avrparts);
+  part_index.nkeys = n;
 }
 
 AVRPART * locate_part(LISTID parts, char * partdesc)
@@ -514,18 +1231,89 @@ AVRPART * locate_part(LISTID parts, char * partdesc)
   LNODEID ln1;
   AVRPART * p = NULL;
   int found;
+  int lo, hi, mid;
 
   found = 0;
 
-  for (ln1=lfirst(parts); ln1 && !found; ln1=lnext(ln1)) {
-    p = ldata(ln1);
-    if ((strcasecmp(partdesc, p->id) == 0) ||
-        (strcasecmp(partdesc, p->desc) == 0))
+  if (parts == part_index.parts && lsize(parts) == part_index.nparts) {
+    lo = 0;
+    hi = part_index.nkeys;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (strcasecmp(part_index.keys[mid].name, partdesc) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < part_index.nkeys &&
+        strcasecmp(part_index.keys[lo].name, partdesc) == 0) {
+      p = part_index.keys[lo].part;
       found = 1;
+    }
+  }
+  else {
+    for (ln1=lfirst(parts); ln1 && !found; ln1=lnext(ln1)) {
+      p = ldata(ln1);
+      if ((strcasecmp(partdesc, p->id) == 0) ||
+          (strcasecmp(partdesc, p->desc) == 0))
+        found = 1;
+    }
   }
 
-  if (found)
+  if (found) {
+    avr_part_complete(p);
     return p;
+  }
+
+  return NULL;
+}
+
+/*
+ * Find the part with the signature read from a device into sig.
+ * Where several parts share it, this is the first one in the list.
+ */
+AVRPART * locate_part_by_signature(LISTID parts, unsigned char * sig,
+                                   int sigsize)
+{
+  LNODEID ln1;
+  AVRPART * p = NULL;
+  unsigned long key;
+  int found;
+  int lo, hi, mid;
+
+  if (sigsize < 3)
+    return NULL;
+  key = ((unsigned long)sig[0] << 16) | ((unsigned long)sig[1] << 8) | sig[2];
+
+  found = 0;
+
+  if (parts == part_index.parts && lsize(parts) == part_index.nparts) {
+    lo = 0;
+    hi = part_index.nsigs;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (part_index.sigs[mid].sig < key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < part_index.nsigs && part_index.sigs[lo].sig == key) {
+      p = part_index.sigs[lo].part;
+      found = 1;
+    }
+  }
+  else {
+    for (ln1=lfirst(parts); ln1 && !found; ln1=lnext(ln1)) {
+      p = ldata(ln1);
+      if (part_signature(p) == key && key != 0)
+        found = 1;
+    }
+  }
+
+  if (found) {
+    avr_part_complete(p);
+    return p;
+  }
 
   return NULL;
 }
@@ -537,8 +1325,10 @@ AVRPART * locate_part_by_avr910_devcode(LISTID parts, int devcode)
 
   for (ln1=lfirst(parts); ln1; ln1=lnext(ln1)) {
     p = ldata(ln1);
-    if (p->avr910_devcode == devcode)
+    if (p->avr910_devcode == devcode) {
+      avr_part_complete(p);
       return p;
+    }
   }
 
   return NULL;
@@ -75,8 +75,36 @@ typedef struct cmdbit {
   int          value; /* bit value if type == AVR_CMDBIT_VALUD */
 } CMDBIT;
 
+/*
+ * A run of command bits taken from consecutive bits of an address or
+ * data value: the command word gets ((value >> bitno) & mask) << shift.
+ */
+typedef struct cmdfield {
+  unsigned char shift;   /* lowest command bit of the run */
+  unsigned char bitno;   /* lowest value bit of the run */
+  unsigned int  mask;    /* value bits of the run, shifted down */
+} CMDFIELD;
+
+#define CMDFIELD_MAX 4
+
+/* all command bits of one type, or n = -1 if they need the bit loop */
+typedef struct cmdfields {
+  int           n;
+  unsigned int  bits;    /* mask of the command bits */
+  CMDFIELD      field[CMDFIELD_MAX];
+} CMDFIELDS;
+
 typedef struct opcode {
   CMDBIT        bit[32]; /* opcode bit specs */
+
+  /*
+   * bit specs compiled by avr_compile_opcode(); bit i of a command
+   * word is bit i % 8 of byte 3 - i / 8 of the command
+   */
+  int           compiled;
+  unsigned int  value_mask; /* fixed bits */
+  unsigned int  value_bits; /* their values */
+  CMDFIELDS     addr, input, output;
 } OPCODE;
 
 
@@ -100,8 +128,6 @@ typedef struct opcode {
 #define FLASH_INSTR_SIZE 3
 #define EEPROM_INSTR_SIZE 20
 
-#define TAG_ALLOCATED          1    /* memory byte is allocated */
-
 typedef struct avrpart {
   char          desc[AVR_DESCLEN];  /* long part name */
   char          id[AVR_IDLEN];      /* short part name */
@@ -165,6 +191,16 @@ typedef struct avrpart {
   LISTID        mem;                /* avr memory definitions */
   char          config_file[PATH_MAX]; /* config file where defined */
   int           lineno;                /* config file line number */
+
+  /*
+   * Parts taken from the configuration cache get their memories and
+   * opcodes only when they are first located, see avr_part_complete().
+   */
+  void       (* complete)(struct avrpart * p);
+  const void  * complete_data;
+
+  struct avrmem ** mem_index;        /* mem sorted by desc, see avr_locate_mem() */
+  int           n_mem_index;
 } AVRPART;
 
 #define AVR_MEMDESCLEN 64
@@ -189,8 +225,15 @@ typedef struct avrmem {
   int readsize;               /* stk500 v2 xml file parameter */
   int pollindex;              /* stk500 v2 xml file parameter */
 
-  unsigned char * buf;        /* pointer to memory buffer */
-  unsigned char * tags;       /* allocation tags */
+  unsigned char * buf;        /* pointer to memory buffer, shared with
+                                 copies until avr_mem_unshare() */
+  unsigned char * tags;       /* allocation tags, one bit per byte, shared
+                                 likewise */
+  unsigned char * dirty;      /* one bit per page holding tagged bytes */
+  unsigned char * cache;      /* device contents already read back */
+  unsigned char * cached;     /* one bit per byte valid in cache */
+  int erased;                 /* all 0xff, chip erased since last write */
+  int known_blank;            /* bytes at the end left 0xff by a chip erase */
   OPCODE * op[AVR_OP_MAX];    /* opcodes */
 } AVRMEM;
 
@@ -201,6 +244,7 @@ extern "C" {
 /* Functions for OPCODE structures */
 OPCODE * avr_new_opcode(void);
 void     avr_free_opcode(OPCODE * op);
+void     avr_compile_opcode(OPCODE * op);
 int avr_set_bits(OPCODE * op, unsigned char * cmd);
 int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr);
 int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data);
@@ -212,16 +256,37 @@ AVRMEM * avr_new_memtype(void);
 int avr_initmem(AVRPART * p);
 AVRMEM * avr_dup_mem(AVRMEM * m);
 void     avr_free_mem(AVRMEM * m);
+void avr_mem_copy_contents(AVRMEM * dst, AVRMEM * src);
+void avr_mem_unshare(AVRMEM * m, int keep);
 AVRMEM * avr_locate_mem(AVRPART * p, char * desc);
+void     avr_drop_mem_index(AVRPART * p);
+int avr_mem_tags_size(AVRMEM * m);
+int avr_mem_tagged(AVRMEM * m, int addr);
+int avr_mem_tag_find(AVRMEM * m, int addr, int limit, int tagged);
+int avr_mem_tags_equal(AVRMEM * a, AVRMEM * b, int size);
+void avr_mem_tag(AVRMEM * m, int addr, int len);
+void avr_mem_untag(AVRMEM * m, int addr, int len);
+void avr_mem_tag_bits(AVRMEM * m, const unsigned char * tags);
+int avr_mem_page_dirty(AVRMEM * m, int pageaddr);
+int avr_mem_next_dirty(AVRMEM * m, int pageaddr, int limit);
+int avr_mem_count_dirty(AVRMEM * m, int limit);
+void avr_mem_cache_store(AVRMEM * m, int addr, const unsigned char * data,
+                         int len);
+void avr_mem_cache_invalidate(AVRMEM * m, int addr, int len);
+int avr_mem_cache_covers(AVRMEM * m, AVRMEM * vmem, int addr, int len);
+void avr_mem_cache_fetch(AVRMEM * m, int addr, int len);
 void avr_mem_display(const char * prefix, FILE * f, AVRMEM * m, int type,
                      int verbose);
 
 /* Functions for AVRPART structures */
 AVRPART * avr_new_part(void);
 AVRPART * avr_dup_part(AVRPART * d);
+void      avr_part_complete(AVRPART * p);
 void      avr_free_part(AVRPART * d);
 AVRPART * locate_part(LISTID parts, char * partdesc);
 AVRPART * locate_part_by_avr910_devcode(LISTID parts, int devcode);
+AVRPART * locate_part_by_signature(LISTID parts, unsigned char * sig,
+                                   int sigsize);
 void avr_display(FILE * f, AVRPART * p, const char * prefix, int verbose);
 
 typedef void (*walk_avrparts_cb)(const char *name, const char *desc,
@@ -229,6 +294,7 @@ typedef void (*walk_avrparts_cb)(const char *name, const char *desc,
                                  void *cookie);
 void walk_avrparts(LISTID avrparts, walk_avrparts_cb cb, void *cookie);
 void sort_avrparts(LISTID avrparts);
+void index_avrparts(LISTID avrparts);
 #ifdef __cplusplus
 }
 #endif
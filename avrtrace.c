@@ -0,0 +1,166 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * avrtrace: print a wire-level trace written by avrdude -j.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static char * progname;
+
+static unsigned long long get(const unsigned char * p, int n)
+{
+  unsigned long long v = 0;
+
+  while (n-- > 0)
+    v = (v << 8) | p[n];
+  return v;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "Usage: %s [-q] [-s usec] tracefile\n"
+          "  -q        Do not print the frame contents.\n"
+          "  -s usec   Only print transfers taking, or starting after a gap\n"
+          "            of, at least usec microseconds.\n",
+          progname);
+}
+
+static void dump(const unsigned char * buf, unsigned int len)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < len; i += 16) {
+    printf("    %04x ", i);
+    for (j = i; j < i + 16; j++)
+      if (j < len)
+        printf(" %02x", buf[j]);
+      else
+        printf("   ");
+    printf("  ");
+    for (j = i; j < i + 16 && j < len; j++)
+      putchar(buf[j] >= ' ' && buf[j] < 0x7f? buf[j]: '.');
+    putchar('\n');
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  static const char * types[] = { "TX", "RX", "TX-ERR", "RX-ERR" };
+  unsigned char hdr[TRACE_HDRLEN], rec[TRACE_RECLEN];
+  unsigned char * buf;
+  unsigned long long t, gap, dur, stall = 0;
+  unsigned long nrec = 0;
+  unsigned int len;
+  int ch, quiet = 0;
+  char * e;
+  FILE * f;
+
+  progname = strrchr(argv[0], '/');
+  progname = progname? progname + 1: argv[0];
+
+  while ((ch = getopt(argc, argv, "qs:")) != -1) {
+    switch (ch) {
+      case 'q':
+        quiet = 1;
+        break;
+
+      case 's':
+        stall = strtoull(optarg, &e, 0);
+        if (*e != 0 || e == optarg) {
+          fprintf(stderr, "%s: invalid stall time \"%s\"\n", progname, optarg);
+          return 1;
+        }
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+    return 1;
+  }
+
+  if ((f = fopen(argv[optind], "rb")) == NULL) {
+    fprintf(stderr, "%s: can't open \"%s\": %s\n",
+            progname, argv[optind], strerror(errno));
+    return 1;
+  }
+  if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+      memcmp(hdr, TRACE_MAGIC, 6) != 0) {
+    fprintf(stderr, "%s: \"%s\" is not an avrdude trace\n",
+            progname, argv[optind]);
+    return 1;
+  }
+  if (hdr[6] != TRACE_VERSION) {
+    fprintf(stderr, "%s: trace version %d not supported\n",
+            progname, hdr[6]);
+    return 1;
+  }
+  if ((buf = malloc(TRACE_MAXDATA)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    return 1;
+  }
+
+  t = 0;
+  while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+    len = get(rec + 1, 2);
+    gap = get(rec + 3, 4);
+    dur = get(rec + 7, 4);
+    if (fread(buf, 1, len, f) != len) {
+      fprintf(stderr, "%s: trace truncated in record %lu\n",
+              progname, nrec);
+      break;
+    }
+    nrec++;
+    t += gap;
+    if (stall > 0 && gap < stall && dur < stall)
+      continue;
+
+    printf("%12.6f +%.6f %-6s %5u bytes in %.6f s\n",
+           t / 1e6, gap / 1e6,
+           rec[0] < sizeof(types) / sizeof(types[0])? types[rec[0]]: "?",
+           len, dur / 1e6);
+    if (!quiet)
+      dump(buf, len);
+  }
+  if (ferror(f)) {
+    fprintf(stderr, "%s: can't read \"%s\": %s\n",
+            progname, argv[optind], strerror(errno));
+    return 1;
+  }
+
+  fclose(f);
+  free(buf);
+
+  return 0;
+}
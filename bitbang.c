@@ -31,6 +31,16 @@
 #if !defined(WIN32NATIVE)
 #  include <signal.h>
 #  include <sys/time.h>
+#  include <time.h>
+#endif
+
+/*
+ * Busy-wait on a monotonic clock where there is one; the raw clock is
+ * not slewed by NTP.
+ */
+#if !defined(WIN32NATIVE) && defined(HAVE_CLOCK_GETTIME) && \
+    defined(CLOCK_MONOTONIC)
+#  define BITBANG_CLOCK_GETTIME 1
 #endif
 
 #include "avrdude.h"
@@ -42,11 +52,16 @@
 #include "tpi.h"
 
 static int delay_decrement;
+static int delay_calibrated;
 
 #if defined(WIN32NATIVE)
 static int has_perfcount;
 static LARGE_INTEGER freq;
 #else
+#if defined(BITBANG_CLOCK_GETTIME)
+static int has_clock;
+static clockid_t delay_clock;
+#endif
 static volatile int done;
 
 typedef void (*mysighandler_t)(int);
@@ -60,10 +75,15 @@ static void alarmhandler(int signo)
 #endif /* WIN32NATIVE */
 
 /*
- * Calibrate the microsecond delay loop below.
+ * Calibrate the microsecond delay loop below.  This is done once, the
+ * delay does not change when the device is initialized again.
  */
 static void bitbang_calibrate_delay(void)
 {
+  if (delay_calibrated)
+    return;
+  delay_calibrated = 1;
+
 #if defined(WIN32NATIVE)
   /*
    * If the hardware supports a high-resolution performance counter,
@@ -98,6 +118,24 @@ static void bitbang_calibrate_delay(void)
 #else  /* !WIN32NATIVE */
   struct itimerval itv;
   volatile int i;
+#if defined(BITBANG_CLOCK_GETTIME)
+  struct timespec ts;
+
+  /* no calibration needed, if the clock is really there */
+#if defined(CLOCK_MONOTONIC_RAW)
+  delay_clock = CLOCK_MONOTONIC_RAW;
+  if (clock_gettime(delay_clock, &ts) != 0)
+#endif
+    delay_clock = CLOCK_MONOTONIC;
+  if (clock_gettime(delay_clock, &ts) == 0) {
+    has_clock = 1;
+    if (verbose >= 2)
+      fprintf(stderr,
+              "%s: Using monotonic clock for bitbang delays\n",
+              progname);
+    return;
+  }
+#endif
 
   if (verbose >= 2)
     fprintf(stderr,
@@ -155,14 +193,34 @@ void bitbang_delay(int us)
   }
   else /* no performance counters -- run normal uncalibrated delay */
   {
+#elif defined(BITBANG_CLOCK_GETTIME)
+  struct timespec now, end;
+
+  if (has_clock)
+  {
+    clock_gettime(delay_clock, &end);
+    end.tv_sec += us / 1000000;
+    end.tv_nsec += (long)(us % 1000000) * 1000;
+    if (end.tv_nsec >= 1000000000) {
+      end.tv_sec++;
+      end.tv_nsec -= 1000000000;
+    }
+
+    do
+      clock_gettime(delay_clock, &now);
+    while (now.tv_sec < end.tv_sec ||
+           (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+  }
+  else /* no usable clock -- run the calibrated delay loop */
+  {
 #endif  /* WIN32NATIVE */
   volatile int del = us * delay_decrement;
 
   while (del > 0)
     del--;
-#if defined(WIN32NATIVE)
+#if defined(WIN32NATIVE) || defined(BITBANG_CLOCK_GETTIME)
   }
-#endif /* WIN32NATIVE */
+#endif /* WIN32NATIVE || BITBANG_CLOCK_GETTIME */
 }
 
 /*
@@ -213,6 +271,24 @@ static unsigned char bitbang_txrx(PROGRAMMER * pgm, unsigned char byte)
   return rbyte;
 }
 
+/*
+ * transmit and receive len bytes, through the programmer's
+ * bitbang_xfer_buf() if it can do it
+ */
+static void bitbang_txrx_buf(PROGRAMMER * pgm, const unsigned char *tx,
+                             unsigned char *rx, int len)
+{
+  int i;
+
+  if (pgm->bitbang_xfer_buf != NULL &&
+      pgm->bitbang_xfer_buf(pgm, tx, rx, len) == 0)
+    return;
+
+  for (i=0; i<len; i++) {
+    rx[i] = bitbang_txrx(pgm, tx[i]);
+  }
+}
+
 static int bitbang_tpi_clk(PROGRAMMER * pgm) 
 {
   unsigned char r = 0;
@@ -335,9 +411,7 @@ int bitbang_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
 {
   int i;
 
-  for (i=0; i<4; i++) {
-    res[i] = bitbang_txrx(pgm, cmd[i]);
-  }
+  bitbang_txrx_buf(pgm, cmd, res, 4);
 
     if(verbose >= 2)
 	{
@@ -404,9 +478,7 @@ int bitbang_spi(PROGRAMMER * pgm, const unsigned char *cmd,
 
   pgm->setpin(pgm, PIN_LED_PGM, 0);
 
-  for (i=0; i<count; i++) {
-    res[i] = bitbang_txrx(pgm, cmd[i]);
-  }
+  bitbang_txrx_buf(pgm, cmd, res, count);
 
   pgm->setpin(pgm, PIN_LED_PGM, 1);
 
@@ -427,6 +499,136 @@ int bitbang_spi(PROGRAMMER * pgm, const unsigned char *cmd,
 }
 
 
+static void bitbang_set_cmd(OPCODE * op, unsigned char * cmd,
+                            unsigned long addr, unsigned char data)
+{
+  memset(cmd, 0, 4);
+  avr_set_bits(op, cmd);
+  avr_set_addr(op, cmd, addr);
+  avr_set_input(op, cmd, data);
+}
+
+static OPCODE * bitbang_read_op(AVRMEM * m, unsigned int addr)
+{
+  if (m->op[AVR_OP_READ_LO] == NULL)
+    return m->op[AVR_OP_READ];
+
+  return (addr & 0x01)? m->op[AVR_OP_READ_HI]: m->op[AVR_OP_READ_LO];
+}
+
+static unsigned char * bitbang_alloc(unsigned int len)
+{
+  unsigned char * buf = malloc(len);
+
+  if (buf == NULL) {
+    fprintf(stderr, "%s: out of memory allocating SPI buffer\n", progname);
+    exit(1);
+  }
+
+  return buf;
+}
+
+/*
+ * Paged access: the load page buffer resp. read commands for a whole
+ * page go out in one bitbang_spi() call instead of one pgm->cmd() per
+ * byte.  Only flash is written this way, avr_write_page() takes any
+ * memory with load page commands as word addressed; eeprom is written
+ * byte by byte further on.
+ */
+int bitbang_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                        unsigned int page_size, unsigned int addr,
+                        unsigned int n_bytes)
+{
+  unsigned char * cmd, * res;
+  unsigned int a, i, n, end;
+  OPCODE * op;
+
+  if ((p->flags & AVRPART_HAS_TPI) || !m->paged || page_size == 0 ||
+      m->op[AVR_OP_LOADPAGE_LO] == NULL || m->op[AVR_OP_LOADPAGE_HI] == NULL ||
+      m->op[AVR_OP_WRITEPAGE] == NULL)
+    return -1;
+
+  end = addr + n_bytes;
+  if (end > m->size)
+    end = m->size;
+
+  cmd = bitbang_alloc(4 * page_size);
+  res = bitbang_alloc(4 * page_size);
+
+  for (a = addr; a < end; a += n) {
+    n = end - a < page_size? end - a: page_size;
+    for (i = 0; i < n; i++) {
+      op = ((a + i) & 0x01)? m->op[AVR_OP_LOADPAGE_HI]:
+                             m->op[AVR_OP_LOADPAGE_LO];
+      bitbang_set_cmd(op, cmd + 4 * i, (a + i) / 2, m->buf[a + i]);
+    }
+    bitbang_spi(pgm, cmd, res, 4 * n);
+
+    if (avr_write_page(pgm, p, m, a) < 0) {
+      free(cmd);
+      free(res);
+      return -1;
+    }
+  }
+
+  free(cmd);
+  free(res);
+
+  return end - addr;
+}
+
+/*
+ * Flash is read with word addresses, eeprom with byte addresses.
+ */
+int bitbang_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned int page_size, unsigned int addr,
+                       unsigned int n_bytes)
+{
+  unsigned char * cmd, * res;
+  unsigned int a, i, n, end, ext;
+  OPCODE * lext;
+  int words;
+
+  if ((p->flags & AVRPART_HAS_TPI) || page_size == 0)
+    return -1;
+  words = m->op[AVR_OP_READ_LO] != NULL;
+  if (words? m->op[AVR_OP_READ_HI] == NULL: m->op[AVR_OP_READ] == NULL)
+    return -1;
+  lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+
+  end = addr + n_bytes;
+  if (end > m->size)
+    end = m->size;
+
+  /* room for the load extended address command in front */
+  cmd = bitbang_alloc(4 * (page_size + 1));
+  res = bitbang_alloc(4 * (page_size + 1));
+
+  for (a = addr; a < end; a += n) {
+    n = end - a < page_size? end - a: page_size;
+    ext = 0;
+    if (lext != NULL) {
+      bitbang_set_cmd(lext, cmd, words? a / 2: a, 0);
+      ext = 4;
+    }
+    for (i = 0; i < n; i++)
+      bitbang_set_cmd(bitbang_read_op(m, a + i), cmd + ext + 4 * i,
+                      words? (a + i) / 2: a + i, 0);
+    bitbang_spi(pgm, cmd, res, ext + 4 * n);
+
+    for (i = 0; i < n; i++) {
+      m->buf[a + i] = 0;
+      avr_get_output(bitbang_read_op(m, a + i), res + ext + 4 * i,
+                     &m->buf[a + i]);
+    }
+  }
+
+  free(cmd);
+  free(res);
+
+  return end - addr;
+}
+
 /*
  * issue the 'chip erase' command to the AVR device
  */
@@ -480,7 +682,7 @@ int bitbang_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
   avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
   pgm->cmd(pgm, cmd, res);
-  usleep(p->chip_erase_delay);
+  avr_wait_ready(pgm, p, p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   pgm->pgm_led(pgm, OFF);
@@ -795,13 +795,18 @@ static int buspirate_cmd_bin(struct programmer_t *pgm,
 				const unsigned char *cmd,
 				unsigned char *res)
 {
+	char buf[5];
+
 	/* 0001xxxx - Bulk transfer, send/read 1-16 bytes (0=1byte!)
-	 * we are sending 4 bytes -> 0x13 */
-	if (!buspirate_expect_bin_byte(pgm, 0x13, 0x01))
+	 * we are sending 4 bytes -> 0x13
+	 * The data follows the command at once, so the command costs a
+	 * single round trip; the Bus Pirate takes the bytes as they come. */
+	buf[0] = 0x13;
+	memcpy(buf + 1, cmd, 4);
+	buspirate_send_bin(pgm, buf, 5);
+	if (buspirate_recv_bin(pgm, buf, 5) == EOF || buf[0] != 0x01)
 		return -1;
-
-	buspirate_send_bin(pgm, (char *)cmd, 4);
-	buspirate_recv_bin(pgm, (char *)res, 4);
+	memcpy(res, buf + 1, 4);
 
 	return 0;
 }
@@ -860,7 +865,6 @@ static int buspirate_paged_load(
 {
 	unsigned char commandbuf[10];
 	unsigned char buf[275];
-	unsigned int addr = 0;
 
 	if (verbose > 1) fprintf(stderr, "BusPirate: buspirate_paged_load(..,%s,%d,%d,%d)\n",m->desc,m->page_size,address,n_bytes);
 
@@ -899,8 +903,10 @@ static int buspirate_paged_load(
 		return -1;
 	}
 
-	for (addr = 0; addr < n_bytes; addr++) {	
-		buspirate_recv_bin(pgm, &m->buf[addr+address], 1);
+	/* the data follows in one stream */
+	if (buspirate_recv_bin(pgm, (char *)&m->buf[address], n_bytes) == EOF) {
+		fprintf(stderr, "BusPirate: Paged Read did not return all data.\n");
+		return -1;
 	}
 
 	return n_bytes;
@@ -917,8 +923,8 @@ static int buspirate_paged_write(struct programmer_t *pgm,
 	int addr = base_addr;
 	int n_page_writes;
 	int this_page_size;
-	char cmd_buf[4096] = {'\0'};
-	char send_byte, recv_byte;
+	char cmd_buf[5 + 4096] = {'\0'};
+	char recv_byte;
 
 	if (!(pgm->flag & BP_FLAG_IN_BINMODE)) {
 		/* Return if we are not in binary mode. */
@@ -970,43 +976,39 @@ static int buspirate_paged_write(struct programmer_t *pgm,
 		if (page == n_page_writes-1)
 			this_page_size = n_data_bytes - page_size*page;
 
-		/* Set up command buffer: */
-		memset(cmd_buf, 0, 4*this_page_size);
+		/* Set up command buffer, after the write then read header: */
+		memset(cmd_buf, 0, 5 + 4*this_page_size);
 		for (i=0; i<this_page_size; i++) {
 
 			addr = base_addr + page*page_size + i;
 
 			if (i%2 == 0) {
-				avr_set_bits(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]));
-				avr_set_addr(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]), addr/2);
-				avr_set_input(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]), m->buf[addr]);
+				avr_set_bits(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[5+4*i]));
+				avr_set_addr(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[5+4*i]), addr/2);
+				avr_set_input(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[5+4*i]), m->buf[addr]);
 			} else {
-				avr_set_bits(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]));
-				avr_set_addr(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]), addr/2);
-				avr_set_input(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]), m->buf[addr]);
+				avr_set_bits(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[5+4*i]));
+				avr_set_addr(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[5+4*i]), addr/2);
+				avr_set_input(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[5+4*i]), m->buf[addr]);
 			}
 		}
 
-		/* 00000100 - Write then read */
-		send_byte = 0x05;
-		buspirate_send_bin(pgm, &send_byte, 1);
+		/* 00000101 - Write then read, without CS */
+		cmd_buf[0] = 0x05;
 
 		/* Number of bytes to write: */
-		send_byte = (4*this_page_size)/0x100;
-		buspirate_send_bin(pgm, &send_byte, 1); /* High byte */
-		send_byte = (4*this_page_size)%0x100;
-		buspirate_send_bin(pgm, &send_byte, 1); /* Low byte */
+		cmd_buf[1] = (4*this_page_size)/0x100; /* High byte */
+		cmd_buf[2] = (4*this_page_size)%0x100; /* Low byte */
 
 		/* Number of bytes to read: */
-		send_byte = 0x0;
-		buspirate_send_bin(pgm, &send_byte, 1); /* High byte */
-		buspirate_send_bin(pgm, &send_byte, 1); /* Low byte */
+		cmd_buf[3] = 0x0; /* High byte */
+		cmd_buf[4] = 0x0; /* Low byte */
 
 		/* Set programming LED: */
 		pgm->pgm_led(pgm, ON);
 
-		/* Send command buffer: */
-		buspirate_send_bin(pgm, cmd_buf, 4*this_page_size);
+		/* Send command and page in one go: */
+		buspirate_send_bin(pgm, cmd_buf, 5 + 4*this_page_size);
 
 		/* Check for write failure: */
 		if ((buspirate_recv_bin(pgm, &recv_byte, 1) == EOF) || (recv_byte != 0x01)) {
@@ -1074,7 +1076,7 @@ static int buspirate_chip_erase(struct programmer_t *pgm, AVRPART * p)
 
 	avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
 	pgm->cmd(pgm, cmd, res);
-	usleep(p->chip_erase_delay);
+	avr_wait_ready(pgm, p, p->chip_erase_delay);
 	pgm->initialize(pgm, p);
 
 	pgm->pgm_led(pgm, OFF);
@@ -1267,6 +1269,89 @@ static int buspirate_bb_setpin(struct programmer_t *pgm, int pinfunc, int value)
 }
 
 
+/*
+ * Clock a buffer through the SPI pins.  Every pin value byte sent is
+ * answered with the state of all pins, so the output bytes for a whole
+ * chunk of data (MOSI and SCK low, then SCK high, for each bit, MOSI
+ * changing along with the falling SCK edge of the previous bit) are
+ * sent in one go, and MISO is taken from the answers to the SCK high
+ * bytes.  This saves a USB round trip per bit compared to getpin().
+ */
+#define BP_BB_XFER_CHUNK 16
+
+static int buspirate_bb_xfer_buf(struct programmer_t *pgm,
+				 const unsigned char *tx, unsigned char *rx,
+				 int len)
+{
+	char buf[16 * BP_BB_XFER_CHUNK + 1];
+	int mosi = pgm->pinno[PIN_AVR_MOSI];
+	int sck = pgm->pinno[PIN_AVR_SCK];
+	int miso = pgm->pinno[PIN_AVR_MISO];
+	unsigned char out[2][2], v;
+	int b, last, i, j, k, n;
+
+	if ((mosi & PIN_MASK) < 1 || (mosi & PIN_MASK) > 5 ||
+	    (sck & PIN_MASK) < 1 || (sck & PIN_MASK) > 5 ||
+	    (miso & PIN_MASK) < 1 || (miso & PIN_MASK) > 5)
+		return -1;
+
+	/* out[MOSI][SCK] */
+	for (b = 0; b < 2; b++) {
+		v = PDATA(pgm)->pin_val & ~(1 << ((mosi & PIN_MASK) - 1)) &
+			~(1 << ((sck & PIN_MASK) - 1));
+		if (b ^ ((mosi & PIN_INVERSE) != 0))
+			v |= 1 << ((mosi & PIN_MASK) - 1);
+		out[b][0] = out[b][1] = v | 0x80;
+		out[b][(sck & PIN_INVERSE) == 0] |= 1 << ((sck & PIN_MASK) - 1);
+	}
+
+	last = 0;
+	for (i = 0; i < len; i += n) {
+		n = len - i < BP_BB_XFER_CHUNK? len - i: BP_BB_XFER_CHUNK;
+		for (j = 0, k = 0; j < n; j++) {
+			for (b = 7; b >= 0; b--) {
+				buf[k++] = out[(tx[i + j] >> b) & 0x01][0];
+				buf[k++] = out[(tx[i + j] >> b) & 0x01][1];
+			}
+		}
+		last = tx[i + n - 1] & 0x01;
+		buf[k++] = out[last][0];
+		if (buspirate_send_bin(pgm, buf, k) < 0)
+			goto fail;
+
+		/* the answers to earlier setpin() calls come first */
+		while (PDATA(pgm)->unread_bytes > 0) {
+			if (buspirate_recv_bin(pgm, buf, 1) < 0)
+				goto fail;
+			PDATA(pgm)->unread_bytes--;
+		}
+		if (buspirate_recv_bin(pgm, buf, k) < 0)
+			goto fail;
+
+		for (j = 0; j < n; j++) {
+			v = 0;
+			for (b = 0; b < 8; b++) {
+				if ((((unsigned char)buf[16 * j + 2 * b + 1] >> ((miso & PIN_MASK) - 1)) & 0x01) ^
+				    ((miso & PIN_INVERSE) != 0))
+					v |= 0x80 >> b;
+			}
+			rx[i + j] = v;
+		}
+	}
+
+	PDATA(pgm)->pin_val = out[last][0] & 0x7f;
+
+	return 0;
+
+fail:
+	/* the pins are in an unknown state, no point in trying setpin() */
+	fprintf(stderr, "%s: buspirate_bb_xfer_buf(): serial I/O failed\n",
+		progname);
+	PDATA(pgm)->pin_val = out[last][0] & 0x7f;
+	memset(rx + i, 0xff, len - i);
+	return 0;
+}
+
 static int buspirate_bb_highpulsepin(struct programmer_t *pgm, int pinfunc)
 {
 	int ret;
@@ -1313,11 +1398,14 @@ void buspirate_bb_initpgm(struct programmer_t *pgm)
 	pgm->program_enable = bitbang_program_enable;
 	pgm->chip_erase     = bitbang_chip_erase;
 	pgm->cmd            = bitbang_cmd;
+	pgm->paged_write    = bitbang_paged_write;
+	pgm->paged_load     = bitbang_paged_load;
 	pgm->cmd_tpi        = bitbang_cmd_tpi;
 	pgm->powerup        = buspirate_bb_powerup;
 	pgm->powerdown      = buspirate_bb_powerdown;
 	pgm->setpin         = buspirate_bb_setpin;
 	pgm->getpin         = buspirate_bb_getpin;
+	pgm->bitbang_xfer_buf = buspirate_bb_xfer_buf;
 	pgm->highpulsepin   = buspirate_bb_highpulsepin;
 	pgm->read_byte      = avr_read_byte_default;
 	pgm->write_byte     = avr_write_byte_default;
@@ -57,6 +57,8 @@ struct pdata
 {
   char has_auto_incr_addr;
   unsigned int buffersize;
+  int addr_valid;               /* addr is the device's address pointer */
+  unsigned long addr;
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -156,6 +158,8 @@ static int butterfly_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
   butterfly_send(pgm, "e", 1);
   butterfly_vfy_cmd_sent(pgm, "chip erase");
+  /* the AVR109 bootloader erases by walking its address pointer */
+  PDATA(pgm)->addr_valid = 0;
 
   return 0;
 }
@@ -165,6 +169,7 @@ static void butterfly_enter_prog_mode(PROGRAMMER * pgm)
 {
   butterfly_send(pgm, "P", 1);
   butterfly_vfy_cmd_sent(pgm, "enter prog mode");
+  PDATA(pgm)->addr_valid = 0;
 }
 
 
@@ -172,6 +177,7 @@ static void butterfly_leave_prog_mode(PROGRAMMER * pgm)
 {
   butterfly_send(pgm, "L", 1);
   butterfly_vfy_cmd_sent(pgm, "leave prog mode");
+  PDATA(pgm)->addr_valid = 0;
 }
 
 
@@ -425,16 +431,38 @@ static void butterfly_display(PROGRAMMER * pgm, const char * p)
 }
 
 
+/*
+ * The bootloader keeps a single address pointer, in words for flash
+ * and in bytes for eeprom, which the block and byte commands advance
+ * if it reports auto increment.  Track it, so that 'A' and 'H' are
+ * only sent where an access does not continue from the last one.
+ */
+static void butterfly_addr_advance(PROGRAMMER * pgm, unsigned int n_bytes,
+                                   unsigned int unit)
+{
+  if (PDATA(pgm)->has_auto_incr_addr == 'Y' && n_bytes % unit == 0)
+    PDATA(pgm)->addr += n_bytes / unit;
+  else
+    PDATA(pgm)->addr_valid = 0;
+}
+
+
 static void butterfly_set_addr(PROGRAMMER * pgm, unsigned long addr)
 {
   char cmd[3];
 
+  if (PDATA(pgm)->addr_valid && PDATA(pgm)->addr == addr)
+    return;
+
   cmd[0] = 'A';
   cmd[1] = (addr >> 8) & 0xff;
   cmd[2] = addr & 0xff;
   
   butterfly_send(pgm, cmd, sizeof(cmd));
   butterfly_vfy_cmd_sent(pgm, "set addr");
+
+  PDATA(pgm)->addr = addr & 0xffff;
+  PDATA(pgm)->addr_valid = 1;
 }
 
 
@@ -442,6 +470,9 @@ static void butterfly_set_extaddr(PROGRAMMER * pgm, unsigned long addr)
 {
   char cmd[4];
 
+  if (PDATA(pgm)->addr_valid && PDATA(pgm)->addr == addr)
+    return;
+
   cmd[0] = 'H';
   cmd[1] = (addr >> 16) & 0xff;
   cmd[2] = (addr >> 8) & 0xff;
@@ -449,6 +480,9 @@ static void butterfly_set_extaddr(PROGRAMMER * pgm, unsigned long addr)
 
   butterfly_send(pgm, cmd, sizeof(cmd));
   butterfly_vfy_cmd_sent(pgm, "set extaddr");
+
+  PDATA(pgm)->addr = addr & 0xffffff;
+  PDATA(pgm)->addr_valid = 1;
 }
 
 
@@ -491,6 +525,8 @@ static int butterfly_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
   butterfly_send(pgm, cmd, size);
   butterfly_vfy_cmd_sent(pgm, "write byte");
+  if (cmd[0] == 'B')
+    butterfly_addr_advance(pgm, 1, 1);
 
   return 0;
 }
@@ -521,6 +557,7 @@ static int butterfly_read_byte_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
     /* Read back the program mem word (MSB first) */
     butterfly_recv(pgm, buf, sizeof(buf));
+    butterfly_addr_advance(pgm, 2, 2);
 
     if ((addr & 0x01) == 0) {
       *value = buf[0];
@@ -543,6 +580,7 @@ static int butterfly_read_byte_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   butterfly_set_addr(pgm, addr);
   butterfly_send(pgm, "g\000\001E", 4);
   butterfly_recv(pgm, (char *)value, 1);
+  butterfly_addr_advance(pgm, 1, 1);
   return 0;
 }
 
@@ -607,8 +645,12 @@ static int butterfly_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   if (strcmp(m->desc, "flash") && strcmp(m->desc, "eeprom")) 
     return -2;
 
+  /*
+   * eeprom is byte addressed; the bootloader waits for each byte to
+   * complete before it acknowledges the block.
+   */
   if (m->desc[0] == 'e')
-    wr_size = blocksize = 1;		/* Write to eeprom single bytes only */
+    wr_size = 1;
 
   if (use_ext_addr) {
     butterfly_set_extaddr(pgm, addr / wr_size);
@@ -637,6 +679,7 @@ static int butterfly_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
     butterfly_send(pgm, cmd, 4+blocksize);
     butterfly_vfy_cmd_sent(pgm, "write block");
+    butterfly_addr_advance(pgm, blocksize, wr_size);
 
     addr += blocksize;
   } /* while */
@@ -661,7 +704,7 @@ static int butterfly_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     return -2;
 
   if (m->desc[0] == 'e')
-    rd_size = blocksize = 1;		/* Read from eeprom single bytes only */
+    rd_size = 1;		/* eeprom is byte addressed */
 
   {		/* use buffered mode */
     char cmd[4];
@@ -683,6 +726,7 @@ static int butterfly_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
       butterfly_send(pgm, cmd, 4);
       butterfly_recv(pgm, (char *)&m->buf[addr], blocksize);
+      butterfly_addr_advance(pgm, blocksize, rd_size);
 
       addr += blocksize;
     } /* while */
@@ -0,0 +1,179 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * The small files in the cache directory that runs leave to the next
+ * ones: where a USB device was, the SCK period a target took, and so
+ * on.  None of them is more than a hint; a file that cannot be read
+ * or written is no cache.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(WIN32NATIVE)
+#include <io.h>
+#endif
+
+#include "avrdude.h"
+#include "cachefile.h"
+
+void cachefile_path(char * path, size_t len, const char * name)
+{
+  const char * off = getenv("AVRDUDE_NO_CACHE");
+  const char * dir = getenv("XDG_CACHE_HOME");
+  const char * sub = "avrdude";
+  size_t n;
+
+  path[0] = 0;
+  if (off != NULL && off[0] != 0)
+    return;
+  /* a relative XDG_CACHE_HOME is to be ignored */
+  if (dir == NULL || dir[0] != '/') {
+    dir = getenv("HOME");
+    sub = ".cache/avrdude";
+  }
+  if (dir == NULL || (n = strlen(dir)) == 0)
+    return;
+  if (snprintf(path, len, "%s%s%s/%s", dir, dir[n - 1] == '/'? "": "/",
+               sub, name) >= len)
+    path[0] = 0;
+}
+
+/* create the missing directories that file is to be in */
+static void cachefile_mkdirs(const char * file)
+{
+  char dir[PATH_MAX];
+  char * s;
+
+  if (snprintf(dir, sizeof(dir), "%s", file) >= sizeof(dir))
+    return;
+  for (s = strchr(dir + 1, '/'); s != NULL; s = strchr(s + 1, '/')) {
+    *s = 0;
+#if defined(WIN32NATIVE)
+    mkdir(dir);
+#else
+    mkdir(dir, 0700);
+#endif
+    *s = '/';
+  }
+}
+
+FILE * cachefile_create(const char * file, char * tmp, size_t len,
+                        const char * what)
+{
+  FILE * f;
+
+  if (snprintf(tmp, len, "%s.%ld", file, (long)getpid()) >= len)
+    return NULL;
+  if ((f = fopen(tmp, "wb")) == NULL && errno == ENOENT) {
+    cachefile_mkdirs(tmp);
+    f = fopen(tmp, "wb");
+  }
+  if (f == NULL && verbose >= 2)
+    fprintf(stderr, "%s: can't write %s \"%s\": %s\n",
+            progname, what, tmp, strerror(errno));
+
+  return f;
+}
+
+void cachefile_commit(FILE * f, const char * tmp, const char * file,
+                      int err, const char * what)
+{
+  err |= ferror(f);
+  if (fclose(f) != 0 || err || rename(tmp, file) != 0) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: can't write %s \"%s\"\n", progname, what, file);
+    remove(tmp);
+  }
+}
+
+/* whether line, as fgets() got it, is a whole line of key */
+static int cachefile_match(const char * line, const char * key, size_t n)
+{
+  return strncmp(line, key, n) == 0 && line[n] == ' ';
+}
+
+int cachefile_lookup(const char * file, const char * key,
+                     char * value, size_t len)
+{
+  char line[CACHEFILE_LINELEN];
+  size_t n = strlen(key), k;
+  int found = 0;
+  FILE * f;
+
+  if (file[0] == 0 || n == 0 || (f = fopen(file, "r")) == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    k = strlen(line);
+    if (k == 0 || line[k - 1] != '\n')
+      continue;                 /* too long, or cut short */
+    line[--k] = 0;
+    if (cachefile_match(line, key, n) && k - n - 1 < len) {
+      strcpy(value, line + n + 1);
+      found = 1;
+    }
+  }
+  fclose(f);
+
+  return found? 0: -1;
+}
+
+void cachefile_remember(const char * file, const char * key,
+                        const char * value, const char * what)
+{
+  char lines[CACHEFILE_MAXLINES][CACHEFILE_LINELEN], tmp[PATH_MAX];
+  size_t len = strlen(key);
+  int i, n = 0;
+  FILE * f;
+
+  if (file[0] == 0 || len == 0 ||
+      len + strlen(value) + 2 >= CACHEFILE_LINELEN)
+    return;
+
+  if ((f = fopen(file, "r")) != NULL) {
+    while (fgets(lines[n], sizeof(lines[n]), f) != NULL) {
+      if (strchr(lines[n], '\n') == NULL ||
+          cachefile_match(lines[n], key, len))
+        continue;
+      /* drop the oldest entry to make room */
+      if (++n == CACHEFILE_MAXLINES) {
+        memmove(lines[0], lines[1], sizeof(lines[0]) * (n - 1));
+        n--;
+      }
+    }
+    fclose(f);
+  }
+
+  if ((f = cachefile_create(file, tmp, sizeof(tmp), what)) == NULL)
+    return;
+  for (i = 0; i < n; i++)
+    fputs(lines[i], f);
+  fprintf(f, "%s %s\n", key, value);
+  cachefile_commit(f, tmp, file, 0, what);
+}
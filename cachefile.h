@@ -0,0 +1,74 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef cachefile_h
+#define cachefile_h
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Set path to the file name in the cache directory,
+ * $XDG_CACHE_HOME/avrdude or else $HOME/.cache/avrdude, or to an empty
+ * string if there is none or AVRDUDE_NO_CACHE is set to anything but
+ * an empty string.
+ */
+void cachefile_path(char * path, size_t len, const char * name);
+
+/*
+ * Start rewriting file: open a temporary file next to it, whose name
+ * goes to tmp, creating the directories it is in if need be.  Returns
+ * NULL if that cannot be done; what the file holds is named in the
+ * messages.
+ */
+FILE * cachefile_create(const char * file, char * tmp, size_t len,
+                        const char * what);
+
+/*
+ * Close f, and if neither that nor the writing (err) failed, rename
+ * tmp over file, so readers never see half a file; else remove tmp.
+ */
+void cachefile_commit(FILE * f, const char * tmp, const char * file,
+                      int err, const char * what);
+
+/*
+ * A cache of at most CACHEFILE_MAXLINES lines "<key> <value>", most
+ * recent last.  cachefile_lookup() copies the value of key to value,
+ * and returns 0 if there is one; cachefile_remember() makes value that
+ * of key, dropping the least recent line if there is no room.  Keys
+ * must not start with white space, an empty file name or key is no
+ * cache.
+ */
+#define CACHEFILE_MAXLINES 64
+#define CACHEFILE_LINELEN  512
+
+int cachefile_lookup(const char * file, const char * key,
+                     char * value, size_t len);
+void cachefile_remember(const char * file, const char * key,
+                        const char * value, const char * what);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,564 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Binary cache of the parsed configuration.
+ *
+ * The cache holds the part and programmer lists and the default
+ * settings as parsed from one configuration file.  It is keyed by the
+ * path, modification time, size and FNV-1a hash of that file, and by
+ * the layout of the structures it stores, so a cache written by a
+ * different build or for a changed file is simply ignored and
+ * rewritten.  Parts and memories are stored as their structures with
+ * the pointers fixed up on load; programmers are stored field by
+ * field, as most of a PROGRAMMER is only filled in by its initpgm.
+ *
+ * The same image, keyed by the structure layout alone, can be built
+ * into avrdude (see mkconfdb.c), so that it starts without any
+ * configuration file to read.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "avrdude.h"
+#include "arena.h"
+#include "avr.h"
+#include "cachefile.h"
+#include "config.h"
+#include "confcache.h"
+#include "pgm.h"
+#include "pgm_type.h"
+
+#define CONFCACHE_MAGIC   "avrdude confcache\n"
+/*
+ * Bump whenever what is written changes, not only its size: the sizes
+ * in the key do not catch a field that now means something else.
+ */
+#define CONFCACHE_VERSION 3
+
+struct cc_key {
+  int version;
+  int sizes[5];               /* layout of the cached structures */
+  long mtime;
+  long size;
+  uint64_t hash;
+};
+
+/* cursor over the cache contents while loading */
+struct cc_cursor {
+  const unsigned char * p;
+  const unsigned char * end;
+  int bad;                    /* set once a read ran past the end */
+};
+
+
+static uint64_t cc_hash(const unsigned char * buf, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= buf[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* read all of file into a malloc()ed buffer */
+static unsigned char * cc_slurp(const char * file, size_t * len)
+{
+  FILE * f;
+  struct stat sb;
+  unsigned char * buf;
+
+  if ((f = fopen(file, "rb")) == NULL)
+    return NULL;
+  if (fstat(fileno(f), &sb) < 0 ||
+      (buf = malloc(sb.st_size + 1)) == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  *len = fread(buf, 1, sb.st_size, f);
+  fclose(f);
+  if (*len != (size_t)sb.st_size) {
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+/* the key of an image that does not belong to a file */
+static void cc_layout_key(struct cc_key * key)
+{
+  memset(key, 0, sizeof(*key));
+  key->version = CONFCACHE_VERSION;
+  key->sizes[0] = sizeof(AVRPART);
+  key->sizes[1] = sizeof(AVRMEM);
+  key->sizes[2] = sizeof(OPCODE);
+  key->sizes[3] = sizeof(struct pindef_t);
+  key->sizes[4] = AVR_OP_MAX;
+}
+
+static int cc_make_key(const char * file, struct cc_key * key)
+{
+  struct stat sb;
+  unsigned char * buf;
+  size_t len;
+
+  cc_layout_key(key);
+
+  if (stat(file, &sb) < 0)
+    return -1;
+  key->mtime = (long)sb.st_mtime;
+  key->size = (long)sb.st_size;
+
+  if ((buf = cc_slurp(file, &len)) == NULL)
+    return -1;
+  key->hash = cc_hash(buf, len);
+  free(buf);
+
+  return 0;
+}
+
+
+static void cc_get(struct cc_cursor * c, void * dst, size_t n)
+{
+  if (c->bad || (size_t)(c->end - c->p) < n) {
+    c->bad = 1;
+    memset(dst, 0, n);
+    return;
+  }
+  memcpy(dst, c->p, n);
+  c->p += n;
+}
+
+static int cc_get_int(struct cc_cursor * c)
+{
+  int v;
+
+  cc_get(c, &v, sizeof(v));
+  return v;
+}
+
+/* get a string into dst of size n; NUL terminated in any case */
+static void cc_get_str(struct cc_cursor * c, char * dst, size_t n)
+{
+  int len = cc_get_int(c);
+
+  if (len < 0 || (size_t)len >= n) {
+    c->bad = 1;
+    dst[0] = 0;
+    return;
+  }
+  cc_get(c, dst, len);
+  dst[len] = 0;
+}
+
+static void cc_put_int(FILE * f, int v)
+{
+  fwrite(&v, sizeof(v), 1, f);
+}
+
+static void cc_put_str(FILE * f, const char * s)
+{
+  cc_put_int(f, strlen(s));
+  fwrite(s, 1, strlen(s), f);
+}
+
+
+static void cc_put_ops(FILE * f, OPCODE * op[])
+{
+  int i;
+
+  for (i = 0; i < AVR_OP_MAX; i++) {
+    fputc(op[i] != NULL, f);
+    if (op[i] != NULL)
+      fwrite(op[i], sizeof(OPCODE), 1, f);
+  }
+}
+
+static void cc_get_ops(struct cc_cursor * c, OPCODE * op[])
+{
+  int i;
+  unsigned char present;
+
+  for (i = 0; i < AVR_OP_MAX; i++) {
+    cc_get(c, &present, 1);
+    if (present) {
+      op[i] = avr_new_opcode();
+      cc_get(c, op[i], sizeof(OPCODE));
+    } else
+      op[i] = NULL;
+  }
+}
+
+/*
+ * A part is stored as its structure, followed by the length of and
+ * then the block with its opcodes and memories.  Loading only creates
+ * the AVRPART; the block is decoded by cc_complete_part() once the
+ * part is actually located, so the hundreds of parts nobody asked for
+ * never get their memories and opcodes built.
+ */
+static void cc_put_part(FILE * f, AVRPART * p)
+{
+  LNODEID ln;
+  AVRMEM * m;
+  long start, end;
+
+  avr_part_complete(p);
+  fwrite(p, sizeof(AVRPART), 1, f);
+  start = ftell(f);
+  cc_put_int(f, 0);             /* block length, filled in below */
+  cc_put_ops(f, p->op);
+  cc_put_int(f, lsize(p->mem));
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    m = ldata(ln);
+    fwrite(m, sizeof(AVRMEM), 1, f);
+    cc_put_ops(f, m->op);
+  }
+  end = ftell(f);
+  if (start >= 0 && end >= 0) {
+    fseek(f, start, SEEK_SET);
+    cc_put_int(f, end - start - sizeof(int));
+    fseek(f, end, SEEK_SET);
+  }
+}
+
+static void cc_complete_part(AVRPART * p)
+{
+  struct cc_cursor c;
+  AVRMEM * m;
+  int i, n, len;
+
+  memcpy(&len, p->complete_data, sizeof(len));
+  c.p = (const unsigned char *)p->complete_data + sizeof(len);
+  c.end = c.p + len;
+  c.bad = 0;
+
+  cc_get_ops(&c, p->op);
+  n = cc_get_int(&c);
+  for (i = 0; i < n && !c.bad; i++) {
+    m = avr_new_memtype();
+    cc_get(&c, m, sizeof(AVRMEM));
+    m->buf = m->tags = m->dirty = m->cache = m->cached = NULL;
+    cc_get_ops(&c, m->op);
+    ladd(p->mem, m);
+  }
+  if (c.bad)
+    fprintf(stderr,
+            "%s: configuration cache damaged for part %s, please remove it\n",
+            progname, p->id);
+}
+
+static AVRPART * cc_get_part(struct cc_cursor * c)
+{
+  AVRPART * p;
+  LISTID mem;
+  int i, len;
+
+  p = avr_new_part();
+  mem = p->mem;
+  cc_get(c, p, sizeof(AVRPART));
+  p->mem = mem;
+  p->mem_index = NULL;
+  p->n_mem_index = 0;
+  for (i = 0; i < AVR_OP_MAX; i++)
+    p->op[i] = NULL;
+
+  p->complete = cc_complete_part;
+  p->complete_data = c->p;
+  len = cc_get_int(c);
+  if (len < 0 || c->end - c->p < len)
+    c->bad = 1;
+  else
+    c->p += len;
+
+  return p;
+}
+
+/* the programmer fields the configuration file can set */
+static void cc_put_programmer(FILE * f, PROGRAMMER * pgm)
+{
+  const PROGRAMMER_TYPE * type;
+  LNODEID ln;
+
+  type = locate_programmer_type_by_initpgm(pgm->initpgm);
+  cc_put_str(f, type != NULL? type->id: "");
+  cc_put_int(f, lsize(pgm->id));
+  for (ln = lfirst(pgm->id); ln; ln = lnext(ln))
+    cc_put_str(f, ldata(ln));
+  cc_put_str(f, pgm->desc);
+  fwrite(pgm->pinno, sizeof(pgm->pinno), 1, f);
+  fwrite(pgm->pin, sizeof(pgm->pin), 1, f);
+  cc_put_int(f, pgm->conntype);
+  cc_put_int(f, pgm->baudrate);
+  cc_put_int(f, pgm->usbvid);
+  cc_put_int(f, lsize(pgm->usbpid));
+  for (ln = lfirst(pgm->usbpid); ln; ln = lnext(ln))
+    cc_put_int(f, *(int *)ldata(ln));
+  cc_put_str(f, pgm->usbdev);
+  cc_put_str(f, pgm->usbsn);
+  cc_put_str(f, pgm->usbvendor);
+  cc_put_str(f, pgm->usbproduct);
+  cc_put_str(f, pgm->config_file);
+  cc_put_int(f, pgm->lineno);
+}
+
+static PROGRAMMER * cc_get_programmer(struct cc_cursor * c)
+{
+  const PROGRAMMER_TYPE * type;
+  PROGRAMMER * pgm;
+  char buf[MAX_STR_CONST];
+  int i, n, * ip;
+  char * id;
+
+  pgm = pgm_new();
+
+  cc_get_str(c, buf, sizeof(buf));
+  if ((type = locate_programmer_type(buf)) == NULL)
+    c->bad = 1;
+  else
+    pgm->initpgm = type->initpgm;
+
+  n = cc_get_int(c);
+  for (i = 0; i < n && !c->bad; i++) {
+    cc_get_str(c, buf, sizeof(buf));
+    if ((id = arena_strdup(buf)) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    ladd(pgm->id, id);
+  }
+  cc_get_str(c, pgm->desc, sizeof(pgm->desc));
+  cc_get(c, pgm->pinno, sizeof(pgm->pinno));
+  cc_get(c, pgm->pin, sizeof(pgm->pin));
+  pgm->conntype = cc_get_int(c);
+  pgm->baudrate = cc_get_int(c);
+  pgm->usbvid = cc_get_int(c);
+  n = cc_get_int(c);
+  for (i = 0; i < n && !c->bad; i++) {
+    if ((ip = arena_alloc(sizeof(int))) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    *ip = cc_get_int(c);
+    ladd(pgm->usbpid, ip);
+  }
+  cc_get_str(c, pgm->usbdev, sizeof(pgm->usbdev));
+  cc_get_str(c, pgm->usbsn, sizeof(pgm->usbsn));
+  cc_get_str(c, pgm->usbvendor, sizeof(pgm->usbvendor));
+  cc_get_str(c, pgm->usbproduct, sizeof(pgm->usbproduct));
+  cc_get_str(c, pgm->config_file, sizeof(pgm->config_file));
+  pgm->lineno = cc_get_int(c);
+
+  return pgm;
+}
+
+
+/*
+ * Take the lists from the image in buf, which has to stay around for
+ * the parts still to complete.
+ */
+static int cc_load_image(const unsigned char * buf, size_t len,
+                         const char * file, const struct cc_key * key)
+{
+  struct cc_cursor c;
+  struct cc_key ckey;
+  char path[PATH_MAX];
+  char dprogrammer[MAX_STR_CONST];
+  char dparallel[PATH_MAX], dserial[PATH_MAX];
+  double dbitclock;
+  int dsafemode;
+  LISTID parts, pgms;
+  LNODEID ln;
+  int i, n;
+
+  c.p = buf;
+  c.end = buf + len;
+  c.bad = 0;
+
+  if (len < strlen(CONFCACHE_MAGIC) ||
+      memcmp(buf, CONFCACHE_MAGIC, strlen(CONFCACHE_MAGIC)) != 0)
+    return -1;
+  c.p += strlen(CONFCACHE_MAGIC);
+  cc_get(&c, &ckey, sizeof(ckey));
+  cc_get_str(&c, path, sizeof(path));
+  if (c.bad || memcmp(&ckey, key, sizeof(ckey)) != 0 ||
+      strcmp(path, file) != 0)
+    return -1;
+
+  cc_get_str(&c, dprogrammer, sizeof(dprogrammer));
+  cc_get_str(&c, dparallel, sizeof(dparallel));
+  cc_get_str(&c, dserial, sizeof(dserial));
+  cc_get(&c, &dbitclock, sizeof(dbitclock));
+  dsafemode = cc_get_int(&c);
+
+  parts = lcreat(NULL, 0);
+  pgms = lcreat(NULL, 0);
+  n = cc_get_int(&c);
+  for (i = 0; i < n && !c.bad; i++)
+    ladd(pgms, cc_get_programmer(&c));
+  n = cc_get_int(&c);
+  for (i = 0; i < n && !c.bad; i++)
+    ladd(parts, cc_get_part(&c));
+
+  if (c.bad) {
+    ldestroy_cb(pgms, (void(*)(void *))pgm_free);
+    ldestroy_cb(parts, (void(*)(void *))avr_free_part);
+    return -1;
+  }
+
+  strcpy(default_programmer, dprogrammer);
+  strcpy(default_parallel, dparallel);
+  strcpy(default_serial, dserial);
+  default_bitclock = dbitclock;
+  default_safemode = dsafemode;
+  for (ln = lfirst(pgms); ln; ln = lnext(ln))
+    ladd(programmers, ldata(ln));
+  for (ln = lfirst(parts); ln; ln = lnext(ln))
+    ladd(part_list, ldata(ln));
+  ldestroy(pgms);
+  ldestroy(parts);
+
+  return 0;
+}
+
+static int cc_load(const char * file, const char * cachefile,
+                   const struct cc_key * key)
+{
+  static unsigned char * buf;   /* kept for the parts still to complete */
+  size_t len;
+
+  if ((buf = cc_slurp(cachefile, &len)) == NULL)
+    return -1;
+  if (cc_load_image(buf, len, file, key) < 0) {
+    free(buf);
+    buf = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int cc_write(FILE * f, const char * file, const struct cc_key * key)
+{
+  LNODEID ln;
+
+  fputs(CONFCACHE_MAGIC, f);
+  fwrite(key, sizeof(*key), 1, f);
+  cc_put_str(f, file);
+  cc_put_str(f, default_programmer);
+  cc_put_str(f, default_parallel);
+  cc_put_str(f, default_serial);
+  fwrite(&default_bitclock, sizeof(default_bitclock), 1, f);
+  cc_put_int(f, default_safemode);
+
+  cc_put_int(f, lsize(programmers));
+  for (ln = lfirst(programmers); ln; ln = lnext(ln))
+    cc_put_programmer(f, ldata(ln));
+  cc_put_int(f, lsize(part_list));
+  for (ln = lfirst(part_list); ln; ln = lnext(ln))
+    cc_put_part(f, ldata(ln));
+
+  return ferror(f)? -1: 0;
+}
+
+static void cc_save(const char * file, const char * cachefile,
+                    const struct cc_key * key)
+{
+  char tmp[PATH_MAX];
+  FILE * f;
+
+  if ((f = cachefile_create(cachefile, tmp, sizeof(tmp),
+                            "configuration cache")) == NULL)
+    return;
+  cachefile_commit(f, tmp, cachefile, cc_write(f, file, key),
+                   "configuration cache");
+}
+
+int read_config_cached(const char * file, const char * cachefile)
+{
+  struct cc_key key;
+  int rc;
+
+  if (cc_make_key(file, &key) < 0)
+    /* let read_config() report the problem */
+    return read_config(file);
+
+  arena_enable(1);
+  rc = lsize(part_list) == 0 && lsize(programmers) == 0?
+    cc_load(file, cachefile, &key): -1;
+  arena_enable(0);
+  if (rc == 0) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: configuration taken from cache \"%s\"\n",
+              progname, cachefile);
+    return 0;
+  }
+
+  rc = read_config(file);
+  if (rc == 0)
+    cc_save(file, cachefile, &key);
+
+  return rc;
+}
+
+/* the path recorded in a built-in image */
+#define CONFCACHE_BUILTIN "built-in"
+
+int read_config_image(const unsigned char * image, size_t len)
+{
+  struct cc_key key;
+  int rc;
+
+  if (lsize(part_list) != 0 || lsize(programmers) != 0)
+    return -1;
+
+  cc_layout_key(&key);
+  arena_enable(1);
+  rc = cc_load_image(image, len, CONFCACHE_BUILTIN, &key);
+  arena_enable(0);
+  if (rc < 0) {
+    fprintf(stderr,
+            "%s: the built-in configuration does not match this build\n",
+            progname);
+    return -1;
+  }
+
+  return 0;
+}
+
+int write_config_image(FILE * f)
+{
+  struct cc_key key;
+
+  cc_layout_key(&key);
+
+  return cc_write(f, CONFCACHE_BUILTIN, &key);
+}
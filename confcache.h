@@ -0,0 +1,65 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef confcache_h
+#define confcache_h
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Same as read_config(), but take the parsed part and programmer
+ * lists from the binary cache in cachefile if it is still valid for
+ * file, and refresh the cache after parsing otherwise.  Only meant for
+ * the first configuration file read, as the cache replaces the lists
+ * rather than adding to them.
+ */
+int read_config_cached(const char * file, const char * cachefile);
+
+/*
+ * Take the part and programmer lists from a configuration image as
+ * written by write_config_image(), without copying it: the parts are
+ * completed from the image when they are located, so it has to stay
+ * around.  Like read_config_cached(), this only works for the first
+ * configuration read.
+ */
+int read_config_image(const unsigned char * image, size_t len);
+
+/*
+ * Write the parts, programmers and defaults read so far to f as an
+ * image for read_config_image().  The image only fits the build that
+ * wrote it.
+ */
+int write_config_image(FILE * f);
+
+#if defined(HAVE_BUILTIN_CONFIG)
+/* the image of avrdude.conf built into avrdude, see mkconfdb.c */
+extern const unsigned char builtin_config[];
+extern const size_t builtin_config_size;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,6 +27,7 @@
 #include <string.h>
 
 #include "avrdude.h"
+#include "arena.h"
 #include "avr.h"
 #include "config.h"
 #include "config_gram.h"
@@ -61,6 +62,7 @@ void cleanup_config(void)
   ldestroy_cb(programmers, (void(*)(void*))pgm_free);
   ldestroy_cb(string_list, (void(*)(void*))free_token);
   ldestroy_cb(number_list, (void(*)(void*))free_token);
+  arena_release();
 }
 
 int init_config(void)
@@ -270,7 +272,7 @@ char * dup_string(const char * str)
 {
   char * s;
 
-  s = strdup(str);
+  s = arena_strdup(str);
   if (s == NULL) {
     fprintf(stderr, "dup_string(): out of memory\n");
     exit(1);
@@ -299,7 +301,10 @@ int read_config(const char * file)
   infile = file;
   yyin   = f;
 
+  /* parts and programmers stay until cleanup_config() */
+  arena_enable(1);
   yyparse();
+  arena_enable(0);
 
 #ifdef HAVE_YYLEX_DESTROY
   /* reset lexer and free any allocated memory */
@@ -27,6 +27,7 @@
 #include <math.h>
 
 #include "avrdude.h"
+#include "arena.h"
 
 #include "config.h"
 #include "lists.h"
@@ -542,7 +543,7 @@ prog_parm_usb:
 usb_pid_list:
   TKN_NUMBER {
     {
-      int *ip = malloc(sizeof(int));
+      int *ip = arena_alloc(sizeof(int));
       if (ip) {
         *ip = $1->value.number;
         ladd(current_prog->usbpid, ip);
@@ -552,7 +553,7 @@ usb_pid_list:
   } |
   usb_pid_list TKN_COMMA TKN_NUMBER {
     {
-      int *ip = malloc(sizeof(int));
+      int *ip = arena_alloc(sizeof(int));
       if (ip) {
         *ip = $3->value.number;
         ladd(current_prog->usbpid, ip);
@@ -1216,6 +1217,7 @@ part_parm :
       if (existing_mem != NULL) {
         lrmv_d(current_part->mem, existing_mem);
         avr_free_mem(existing_mem);
+        avr_drop_mem_index(current_part);
       }
       ladd(current_part->mem, current_mem); 
       current_mem = NULL; 
@@ -1560,6 +1562,8 @@ static int parse_cmdbits(OPCODE * op)
 
   }  /* while */
 
+  avr_compile_opcode(op);
+
   return 0;
 }
 
@@ -41,19 +41,51 @@ static const unsigned short crc_table[256] = {
 };
 
 /* CRC calculation macros */
-#define CRC_INIT 0xFFFF
 #define CRC(crcval,newchar) crcval = (crcval >> 8) ^ \
 	crc_table[(crcval ^ newchar) & 0x00ff]
 
+/*
+ * Slice-by-8 tables: crc_slice[k][b] is the CRC of byte b followed by
+ * k zero bytes, starting from 0.  crc_slice[0] is crc_table.
+ */
+static unsigned short crc_slice[8][256];
+static int crc_slice_ready;
+
+static void
+crc_slice_init(void)
+{
+  int i, k;
+
+  for (i = 0; i < 256; i++)
+    crc_slice[0][i] = crc_table[i];
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++)
+      crc_slice[k][i] = (crc_slice[k - 1][i] >> 8) ^
+	crc_table[crc_slice[k - 1][i] & 0xff];
+  crc_slice_ready = 1;
+}
+
 unsigned short
 crcsum(const unsigned char* message, unsigned long length,
        unsigned short crc)
 {
-  unsigned long i;
+  if (length >= 16) {
+    if (!crc_slice_ready)
+      crc_slice_init();
+
+    /* eight bytes at a time */
+    for (; length >= 8; length -= 8, message += 8) {
+      crc ^= message[0] | (message[1] << 8);
+      crc = crc_slice[7][crc & 0xff] ^ crc_slice[6][crc >> 8] ^
+	crc_slice[5][message[2]] ^ crc_slice[4][message[3]] ^
+	crc_slice[3][message[4]] ^ crc_slice[2][message[5]] ^
+	crc_slice[1][message[6]] ^ crc_slice[0][message[7]];
+    }
+  }
 
-  for(i = 0; i < length; i++)
+  for (; length > 0; length--, message++)
     {
-      CRC(crc, message[i]);
+      CRC(crc, *message);
     }
   return crc;
 }
@@ -10,6 +10,14 @@ extern "C" {
  * Appnote AVR067.  Converted from C++ to C.
  */
 
+#define CRC_INIT 0xFFFF
+
+/*
+ * CRC of length bytes of message, starting from crc.  Pass CRC_INIT
+ * for the first part of a message and the previous result for each
+ * following part, so the CRC can be computed while the message is
+ * assembled.
+ */
 extern unsigned short crcsum(const unsigned char* message,
 			     unsigned long length,
 			     unsigned short crc);
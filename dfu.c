@@ -55,6 +55,11 @@ int dfu_getstatus(struct dfu_dev *dfu, struct dfu_status *status)
   return -1;
 }
 
+int dfu_getstatus_done(struct dfu_dev *dfu, struct dfu_status *status)
+{
+  return -1;
+}
+
 int dfu_clrstatus(struct dfu_dev *dfu) {
   return -1;
 }
@@ -83,6 +88,11 @@ int dfu_upload(struct dfu_dev *dfu, void * ptr, int size) {
 #define DFU_GETSTATE 5          /* FLIPv1 only; not used */
 #define DFU_ABORT 6             /* FLIPv1 only */
 
+#define DFU_FUNCTIONAL_DESCRIPTOR 0x21
+
+/* Longest a device may stay busy after a download, in total */
+#define DFU_BUSY_TIMEOUT 10000 /* ms */
+
 /* Block counter global variable. Incremented each time a DFU_DNLOAD command
  * is sent to the device.
  */
@@ -93,6 +103,7 @@ static uint16_t wIndex = 0;
  */
 
 static char * get_usb_string(usb_dev_handle * dev_handle, int index);
+static unsigned int get_xfer_size(const unsigned char *extra, int len);
 
 /* EXPORTED FUNCTION DEFINITIONS
  */
@@ -100,13 +111,11 @@ static char * get_usb_string(usb_dev_handle * dev_handle, int index);
 struct dfu_dev * dfu_open(char *port_spec)
 {
   struct dfu_dev *dfu;
-  char *bus_name = NULL;
-  char *dev_name = NULL;
 
-  /* The following USB device spec parsing code was copied from usbtiny.c. The
-   * expected format is "usb:BUS:DEV" where BUS and DEV are the bus and device
-   * names. We stash these away in the dfu_dev structure for the dfu_init()
-   * function, where we actually open the device.
+  /* The expected format is "usb:BUS:DEV" where BUS and DEV are the bus and
+   * device names, as for usbtiny. We stash these away in the dfu_dev
+   * structure for the dfu_init() function, where we actually open the
+   * device.
    */
 
   if (strncmp(port_spec, "usb", 3) != 0) {
@@ -116,20 +125,8 @@ struct dfu_dev * dfu_open(char *port_spec)
     return NULL;
   }
 
-  if(':' == port_spec[3]) {
-      bus_name = strdup(port_spec + 3 + 1);
-      if (bus_name == NULL) {
-        fprintf(stderr, "%s: Out of memory in strdup\n", progname);
-        return NULL;
-      }
-
-      dev_name = strchr(bus_name, ':');
-      if(NULL != dev_name)
-        *dev_name++ = '\0';
-  }
-
-  /* Allocate the dfu_dev structure and save the bus_name and dev_name
-   * strings for use in dfu_initialize().
+  /* Allocate the dfu_dev structure and save the bus and device names for
+   * use in dfu_initialize().
    */
 
   dfu = calloc(1, sizeof(struct dfu_dev));
@@ -140,24 +137,18 @@ struct dfu_dev * dfu_open(char *port_spec)
     return 0;
   }
 
-  dfu->bus_name = bus_name;
-  dfu->dev_name = dev_name;
+  if (usbscan_port(port_spec, USBSCAN_LOCATION, &dfu->us) < 0) {
+    free(dfu);
+    return NULL;
+  }
   dfu->timeout = DFU_TIMEOUT;
 
-  /* LibUSB initialization. */
-
-  usb_init();
-  usb_find_busses();
-  usb_find_devices();
-
   return dfu;
 }
 
 int dfu_init(struct dfu_dev *dfu, unsigned short vid, unsigned short pid)
 {
   struct usb_device *found = NULL;
-  struct usb_device *dev;
-  struct usb_bus *bus;
 
   /* At last, we reach out through the USB bus to the part. There are three
    * ways to specify the part: by USB address, by USB vendor and product id,
@@ -168,14 +159,14 @@ int dfu_init(struct dfu_dev *dfu, unsigned short vid, unsigned short pid)
    * we use the default vendor and product id.
    */
 
-  if (pid == 0 && dfu->dev_name == NULL) {
+  if (pid == 0 && dfu->us.dev[0] == 0) {
     fprintf(stderr, "%s: Error: No DFU support for part; "
       "specify PID in config or USB address (via -P) to override.\n",
       progname);
     return -1;
   }
 
-  /* Scan through all the devices for the part. The matching rules are:
+  /* Look through the devices for the part. The matching rules are:
    *
    *   1. If the user specified a USB bus name, it must match.
    *   2. If the user specified a USB device name, it must match.
@@ -185,21 +176,10 @@ int dfu_init(struct dfu_dev *dfu, unsigned short vid, unsigned short pid)
    *      id, the product id must match.
    */
 
-  for (bus = usb_busses; !found && bus != NULL; bus = bus->next) {
-    for (dev = bus->devices; !found && dev != NULL; dev = dev->next) {
-      if (dfu->bus_name != NULL && strcmp(bus->dirname, dfu->bus_name))
-         continue;
-      if (dfu->dev_name != NULL) {
-        if (strcmp(dev->filename, dfu->dev_name))
-          continue;
-      } else if (vid != dev->descriptor.idVendor)
-        continue;
-      else if (pid != 0 && pid != dev->descriptor.idProduct)
-        continue;
-
-      found = dev;
-    }
-  }
+  if (dfu->us.dev[0] != 0)
+    found = usbscan_first(&dfu->us, 0, 0);
+  else
+    found = usbscan_first(&dfu->us, vid, pid);
 
   if (found == NULL) {
     /* We could try to be more informative here. For example, we could report
@@ -238,6 +218,16 @@ int dfu_init(struct dfu_dev *dfu, unsigned short vid, unsigned short pid)
       memcpy(&dfu->endp_desc, found->config->interface->altsetting->endpoint,
              sizeof(dfu->endp_desc));
 
+  /* The DFU functional descriptor follows the interface descriptor; it
+   * tells how much the device takes in one DFU_DNLOAD or DFU_UPLOAD.
+   */
+
+  dfu->xfer_size = get_xfer_size(found->config->interface->altsetting->extra,
+    found->config->interface->altsetting->extralen);
+  if (dfu->xfer_size == 0)
+    dfu->xfer_size = get_xfer_size(found->config->extra,
+      found->config->extralen);
+
   /* Get strings. */
 
   dfu->manf_str = get_usb_string(dfu->dev_handle,
@@ -256,8 +246,6 @@ void dfu_close(struct dfu_dev *dfu)
 {
   if (dfu->dev_handle != NULL)
     usb_close(dfu->dev_handle);
-  if (dfu->bus_name != NULL)
-    free(dfu->bus_name);
   if (dfu->manf_str != NULL)
     free(dfu->manf_str);
   if (dfu->prod_str != NULL)
@@ -301,13 +289,42 @@ int dfu_getstatus(struct dfu_dev *dfu, struct dfu_status *status)
             "%s: dfu_getstatus(): bStatus 0x%02x, bwPollTimeout %d, bState 0x%02x, iString %d\n",
             progname,
             status->bStatus,
-            status->bwPollTimeout[0] | (status->bwPollTimeout[1] << 8) | (status->bwPollTimeout[2] << 16),
+            dfu_poll_timeout(status),
             status->bState,
             status->iString);
 
   return 0;
 }
 
+/* Get the status after a DFU_DNLOAD, and as long as the device reports
+ * itself busy, ask again after the bwPollTimeout it wants the host to wait.
+ */
+
+int dfu_getstatus_done(struct dfu_dev *dfu, struct dfu_status *status)
+{
+  unsigned int waited = 0;
+  unsigned int ms;
+
+  for (;;) {
+    if (dfu_getstatus(dfu, status) != 0)
+      return -1;
+
+    if (status->bStatus != DFU_STATUS_OK ||
+        status->bState != DFU_STATE_DFU_DNBUSY)
+      return 0;
+
+    if (waited >= DFU_BUSY_TIMEOUT) {
+      fprintf(stderr, "%s: Error: DFU device busy for more than %d ms\n",
+        progname, DFU_BUSY_TIMEOUT);
+      return -1;
+    }
+
+    ms = dfu_poll_timeout(status);
+    usleep(ms * 1000);
+    waited += ms > 0 ? ms : 1;
+  }
+}
+
 int dfu_clrstatus(struct dfu_dev *dfu)
 {
   int result;
@@ -442,6 +459,9 @@ void dfu_show_info(struct dfu_dev *dfu)
 
   if (dfu->serno_str != NULL)
     fprintf(stderr, "    USB Serial No       : %s\n", dfu->serno_str);
+
+  if (dfu->xfer_size != 0)
+    fprintf(stderr, "    DFU transfer size   : %u\n", dfu->xfer_size);
 }
 
 /* INTERNAL FUNCTION DEFINITIONS
@@ -475,11 +495,33 @@ char * get_usb_string(usb_dev_handle * dev_handle, int index) {
   return str;
 }
 
+/* Find wTransferSize in the DFU functional descriptor among the class
+ * specific descriptors at extra; 0 if there is none.
+ */
+
+unsigned int get_xfer_size(const unsigned char *extra, int len)
+{
+  while (extra != NULL && len >= 2 && extra[0] >= 2 && extra[0] <= len) {
+    if (extra[1] == DFU_FUNCTIONAL_DESCRIPTOR && extra[0] >= 7)
+      return extra[5] | (extra[6] << 8);
+    len -= extra[0];
+    extra += extra[0];
+  }
+
+  return 0;
+}
+
 #endif /* defined(HAVE_LIBUSB) */
 
 /* EXPORTED FUNCTIONS THAT DO NO REQUIRE LIBUSB
  */
 
+unsigned int dfu_poll_timeout(const struct dfu_status *status)
+{
+  return status->bwPollTimeout[0] | (status->bwPollTimeout[1] << 8) |
+    (status->bwPollTimeout[2] << 16);
+}
+
 const char * dfu_status_str(int bStatus)
 {
   switch (bStatus) {
@@ -35,6 +35,8 @@
 
 #include <limits.h>
 
+#include "usbscan.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,7 +50,7 @@ extern "C" {
 
 struct dfu_dev
 {
-  char *bus_name, *dev_name;
+  struct usbscan us;
   usb_dev_handle *dev_handle;
   struct usb_device_descriptor dev_desc;
   struct usb_config_descriptor conf_desc;
@@ -56,6 +58,7 @@ struct dfu_dev
   struct usb_endpoint_descriptor endp_desc;
   char *manf_str, *prod_str, *serno_str;
   unsigned int timeout;
+  unsigned int xfer_size;  /* wTransferSize, 0 if the device does not say */
 };
 
 #else
@@ -120,6 +123,7 @@ extern int dfu_init(struct dfu_dev *dfu,
 extern void dfu_close(struct dfu_dev *dfu);
 
 extern int dfu_getstatus(struct dfu_dev *dfu, struct dfu_status *status);
+extern int dfu_getstatus_done(struct dfu_dev *dfu, struct dfu_status *status);
 extern int dfu_clrstatus(struct dfu_dev *dfu);
 extern int dfu_dnload(struct dfu_dev *dfu, void *ptr, int size);
 extern int dfu_upload(struct dfu_dev *dfu, void *ptr, int size);
@@ -127,6 +131,8 @@ extern int dfu_abort(struct dfu_dev *dfu);
 
 extern void dfu_show_info(struct dfu_dev *dfu);
 
+extern unsigned int dfu_poll_timeout(const struct dfu_status *status);
+
 extern const char * dfu_status_str(int bStatus);
 extern const char * dfu_state_str(int bState);
 
@@ -28,6 +28,19 @@
 #include <ctype.h>
 #include <stdint.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#define FIO_MMAP 1
+#endif
+
 #ifdef HAVE_LIBELF
 #ifdef HAVE_LIBELF_H
 #include <libelf.h>
@@ -37,9 +50,20 @@
 #define EM_AVR32 0x18ad         /* inofficial */
 #endif
 
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#define FIO_GZIP 1
+#endif
+
+#if defined(HAVE_LIBZSTD) && defined(HAVE_ZSTD_H)
+#include <zstd.h>
+#define FIO_ZSTD 1
+#endif
+
 #include "avrdude.h"
 #include "avr.h"
 #include "fileio.h"
+#include "imgcache.h"
 
 
 #define IHEX_MAXDATA 256
@@ -55,19 +79,100 @@ struct ihexrec {
   unsigned char    cksum;
 };
 
+#define FIO_BUFSIZE 65536 /* read size for input that cannot be mapped */
+
+/*
+ * Input file contents.  Regular files are mapped once, so autodetection
+ * and parsing work on the same pages without copying them through
+ * stdio.  Anything else, stdin in particular, is read in FIO_BUFSIZE
+ * chunks as the parser goes along; data holds the current chunk then.
+ */
+struct fioinput {
+  const unsigned char * data;   /* mapped file or current chunk */
+  size_t                len;    /* bytes available at data */
+  size_t                pos;    /* next byte to hand out */
+  FILE                * f;      /* stream to refill from, NULL if none */
+  unsigned char       * buf;    /* chunk buffer for streamed input */
+  void                * map;    /* mapping to release, NULL if none */
+  size_t                maplen;
+  struct fiounzip     * unzip;  /* decompressor refilling buf, or NULL */
+  int                   err;    /* input turned out to be corrupt */
+};
+
+/*
+ * gzip and zstd compressed input is decompressed as the parser goes
+ * along, one FIO_BUFSIZE chunk of output at a time, from the mapped
+ * file or from compressed chunks read from the stream.
+ */
+enum {
+  FIO_UNZIP_GZIP,
+  FIO_UNZIP_ZSTD
+};
+
+struct fiounzip {
+  int                   kind;
+  const unsigned char * src;    /* compressed bytes */
+  size_t                srclen;
+  size_t                srcpos;
+  unsigned char       * cbuf;   /* compressed chunk read from the stream */
+  int                   done;   /* last frame or member ended */
+#ifdef FIO_GZIP
+  z_stream              gz;
+#endif
+#ifdef FIO_ZSTD
+  ZSTD_DStream        * zd;
+#endif
+};
+
+#define FIO_MAXREC 600    /* more than the longest record we write */
+
+#define FIO_SPARSE_GAP 16 /* unused bytes that end a segment in sparse output */
+
+/*
+ * Output buffer for the Intel Hex and S-record writers; records are
+ * formatted into buf and handed to stdio FIO_BUFSIZE bytes at a time.
+ */
+struct fiooutput {
+  FILE * f;
+  char * buf;
+  size_t len;
+  int    err;
+};
+
+/* state of an Intel Hex or S-record writer */
+struct fiorecw {
+  struct fiooutput out;
+  unsigned char  * buf;         /* data, from startaddr on */
+  int              recsize;
+  unsigned int     startaddr;
+  unsigned int     pos;         /* bytes written so far */
+  unsigned int     nextaddr;    /* address of the next record */
+  int              n_64k;       /* Intel Hex extended address */
+  char           * outfile;
+  int              err;
+};
+
 
 static int b2ihex(unsigned char * inbuf, int bufsize, 
              int recsize, int startaddr,
              char * outfile, FILE * outf);
 
-static int ihex2b(char * infile, FILE * inf,
+static int b2ihex_sparse(unsigned char * inbuf, AVRMEM * mem,
+             int bufsize, int recsize, int startaddr,
+             char * outfile, FILE * outf);
+
+static int ihex2b(char * infile, struct fioinput * inf,
              AVRMEM * mem, int bufsize, unsigned int fileoffset);
 
 static int b2srec(unsigned char * inbuf, int bufsize, 
            int recsize, int startaddr,
            char * outfile, FILE * outf);
 
-static int srec2b(char * infile, FILE * inf,
+static int b2srec_sparse(unsigned char * inbuf, AVRMEM * mem,
+           int bufsize, int recsize, int startaddr,
+           char * outfile, FILE * outf);
+
+static int srec2b(char * infile, struct fioinput * inf,
              AVRMEM * mem, int bufsize, unsigned int fileoffset);
 
 static int ihex_readrec(struct ihexrec * ihex, char * rec);
@@ -75,13 +180,16 @@ static int ihex_readrec(struct ihexrec * ihex, char * rec);
 static int srec_readrec(struct ihexrec * srec, char * rec);
 
 static int fileio_rbin(struct fioparms * fio,
-                  char * filename, FILE * f, AVRMEM * mem, int size);
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size);
 
 static int fileio_ihex(struct fioparms * fio, 
-                  char * filename, FILE * f, AVRMEM * mem, int size);
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size, int sparse);
 
 static int fileio_srec(struct fioparms * fio,
-                  char * filename, FILE * f, AVRMEM * mem, int size);
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size, int sparse);
 
 #ifdef HAVE_LIBELF
 static int elf2b(char * infile, FILE * inf,
@@ -97,7 +205,11 @@ static int fileio_num(struct fioparms * fio,
 		char * filename, FILE * f, AVRMEM * mem, int size,
 		FILEFMT fmt);
 
-static int fmt_autodetect(char * fname);
+static int fileio_delta(struct fioparms * fio,
+                  char * filename, struct fioinput * in,
+                  AVRMEM * mem, int size);
+
+static int fmt_autodetect(struct fioinput * in);
 
 
 
@@ -109,74 +221,586 @@ char * fmtstr(FILEFMT format)
     case FMT_IHEX : return "Intel Hex"; break;
     case FMT_RBIN : return "raw binary"; break;
     case FMT_ELF  : return "ELF"; break;
+    case FMT_IHEX_SPARSE : return "sparse Intel Hex"; break;
+    case FMT_SREC_SPARSE : return "sparse Motorola S-Record"; break;
+    case FMT_DELTA : return "delta"; break;
     default       : return "invalid format"; break;
   };
 }
 
 
 
-static int b2ihex(unsigned char * inbuf, int bufsize, 
-           int recsize, int startaddr,
-           char * outfile, FILE * outf)
+/*
+ * Decompress the next chunk of output into in->buf; returns 0 at the
+ * end of the input, or if it is corrupt, which sets in->err.
+ */
+static int fio_unzip_fill(struct fioinput * in)
 {
-  unsigned char * buf;
-  unsigned int nextaddr;
-  int n, nbytes, n_64k;
+  struct fiounzip * z = in->unzip;
+  size_t out = 0, used = 0;
+  int more;
+
+  while (out == 0 && !in->err) {
+    if (z->srcpos == z->srclen && in->f != NULL) {
+      z->srclen = fread(z->cbuf, 1, FIO_BUFSIZE, in->f);
+      z->srcpos = 0;
+    }
+    more = z->srcpos < z->srclen;
+    if (!more && z->done)
+      break;
+    if (!more) {
+      fprintf(stderr, "%s: compressed input ends unexpectedly\n",
+              progname);
+      in->err = 1;
+      break;
+    }
+
+    switch (z->kind) {
+#ifdef FIO_GZIP
+    case FIO_UNZIP_GZIP: {
+      int rc;
+
+      if (z->done) {
+        /* another gzip member follows */
+        inflateReset(&z->gz);
+        z->done = 0;
+      }
+      z->gz.next_in = (unsigned char *)z->src + z->srcpos;
+      z->gz.avail_in = z->srclen - z->srcpos;
+      z->gz.next_out = in->buf;
+      z->gz.avail_out = FIO_BUFSIZE;
+      rc = inflate(&z->gz, Z_NO_FLUSH);
+      used = (z->srclen - z->srcpos) - z->gz.avail_in;
+      out = FIO_BUFSIZE - z->gz.avail_out;
+      if (rc == Z_STREAM_END)
+        z->done = 1;
+      else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        fprintf(stderr, "%s: error decompressing gzip input: %s\n",
+                progname, z->gz.msg != NULL? z->gz.msg: "corrupt data");
+        in->err = 1;
+      }
+      break;
+    }
+#endif
+#ifdef FIO_ZSTD
+    case FIO_UNZIP_ZSTD: {
+      ZSTD_inBuffer zin;
+      ZSTD_outBuffer zout;
+      size_t rc;
+
+      zin.src = z->src + z->srcpos;
+      zin.size = z->srclen - z->srcpos;
+      zin.pos = 0;
+      zout.dst = in->buf;
+      zout.size = FIO_BUFSIZE;
+      zout.pos = 0;
+      rc = ZSTD_decompressStream(z->zd, &zout, &zin);
+      used = zin.pos;
+      out = zout.pos;
+      if (ZSTD_isError(rc)) {
+        fprintf(stderr, "%s: error decompressing zstd input: %s\n",
+                progname, ZSTD_getErrorName(rc));
+        in->err = 1;
+      } else
+        z->done = rc == 0;
+      break;
+    }
+#endif
+    default:
+      in->err = 1;
+      break;
+    }
+    z->srcpos += used;
+    if (used == 0 && out == 0 && !in->err && !z->done) {
+      fprintf(stderr, "%s: compressed input is corrupt\n", progname);
+      in->err = 1;
+    }
+  }
+
+  in->data = in->buf;
+  in->len = out;
+  in->pos = 0;
+  return out > 0;
+}
+
+/* whether fname is named like a compressed file */
+static int fio_zipped_name(const char * fname)
+{
+  size_t len = strlen(fname);
+
+  return (len > 3 && strcasecmp(fname + len - 3, ".gz") == 0) ||
+    (len > 4 && strcasecmp(fname + len - 4, ".zst") == 0);
+}
+
+/*
+ * Switch in over to decompressing if it starts with a gzip or zstd
+ * header, looked for only if the format is to be detected or fname
+ * says so: a raw binary may start with the same bytes.  Returns -1 if
+ * it is compressed in a way this build cannot read.
+ */
+static int fio_unzip_open(struct fioinput * in, char * fname,
+                          FILEFMT format)
+{
+  static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+  static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+  struct fiounzip * z;
+  int kind;
+
+  if (format != FMT_AUTO && !fio_zipped_name(fname))
+    return 0;
+  /* the magic, and for gzip deflate with no reserved flags set */
+  if (in->len >= 10 &&
+      memcmp(in->data, gzip_magic, sizeof(gzip_magic)) == 0 &&
+      in->data[2] == 8 && (in->data[3] & 0xe0) == 0)
+    kind = FIO_UNZIP_GZIP;
+  /* the magic, and a frame header without the reserved bit set */
+  else if (in->len >= sizeof(zstd_magic) + 2 &&
+           memcmp(in->data, zstd_magic, sizeof(zstd_magic)) == 0 &&
+           (in->data[4] & 0x08) == 0)
+    kind = FIO_UNZIP_ZSTD;
+  else
+    return 0;
+
+#ifndef FIO_GZIP
+  if (kind == FIO_UNZIP_GZIP) {
+    fprintf(stderr, "%s: %s is gzip compressed, "
+            "gzip support was not compiled in\n", progname, fname);
+    return -1;
+  }
+#endif
+#ifndef FIO_ZSTD
+  if (kind == FIO_UNZIP_ZSTD) {
+    fprintf(stderr, "%s: %s is zstd compressed, "
+            "zstd support was not compiled in\n", progname, fname);
+    return -1;
+  }
+#endif
+
+  z = calloc(1, sizeof(*z));
+  if (z == NULL) {
+    fprintf(stderr, "%s: out of memory allocating decompressor\n",
+            progname);
+    exit(1);
+  }
+  z->kind = kind;
+  if (in->map != NULL) {
+    /* decompress straight from the mapping */
+    z->src = in->data;
+    z->srclen = in->len;
+    in->buf = malloc(FIO_BUFSIZE);
+  } else {
+    /* what has been read so far is compressed input */
+    z->cbuf = in->buf;
+    z->src = z->cbuf;
+    z->srclen = in->len;
+    in->buf = malloc(FIO_BUFSIZE);
+  }
+  if (in->buf == NULL) {
+    fprintf(stderr, "%s: out of memory allocating input buffer\n",
+            progname);
+    exit(1);
+  }
+
+#ifdef FIO_GZIP
+  if (kind == FIO_UNZIP_GZIP && inflateInit2(&z->gz, 15 + 16) != Z_OK) {
+    fprintf(stderr, "%s: out of memory allocating decompressor\n",
+            progname);
+    exit(1);
+  }
+#endif
+#ifdef FIO_ZSTD
+  if (kind == FIO_UNZIP_ZSTD && (z->zd = ZSTD_createDStream()) == NULL) {
+    fprintf(stderr, "%s: out of memory allocating decompressor\n",
+            progname);
+    exit(1);
+  }
+  if (kind == FIO_UNZIP_ZSTD)
+    ZSTD_initDStream(z->zd);
+#endif
+
+  in->unzip = z;
+  fio_unzip_fill(in);
+
+  return in->err? -1: 0;
+}
+
+static void fio_unzip_close(struct fiounzip * z)
+{
+#ifdef FIO_GZIP
+  if (z->kind == FIO_UNZIP_GZIP)
+    inflateEnd(&z->gz);
+#endif
+#ifdef FIO_ZSTD
+  if (z->kind == FIO_UNZIP_ZSTD)
+    ZSTD_freeDStream(z->zd);
+#endif
+  free(z->cbuf);
+  free(z);
+}
+
+static void fio_close_input(struct fioinput * in)
+{
+  if (in->unzip != NULL)
+    fio_unzip_close(in->unzip);
+#ifdef FIO_MMAP
+  if (in->map != NULL)
+    munmap(in->map, in->maplen);
+#endif
+  if (in->f != NULL && in->f != stdin)
+    fclose(in->f);
+  free(in->buf);
+  memset(in, 0, sizeof(*in));
+}
+
+/*
+ * Make the input file fname available through in, or stdin when f is
+ * given, decompressing it if need be.  Returns -1 if the file cannot
+ * be opened, -2 if it cannot be read, which has been reported.
+ */
+static int fio_open_input(struct fioinput * in, char * fname, FILE * f,
+                          char * mode, FILEFMT format)
+{
+  memset(in, 0, sizeof(*in));
+
+  if (f == NULL) {
+    f = fopen(fname, mode);
+    if (f == NULL)
+      return -1;
+#ifdef FIO_MMAP
+    {
+      struct stat st;
+      void * map;
+
+      if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) &&
+          st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                   fileno(f), 0);
+        if (map != MAP_FAILED) {
+          fclose(f);
+          f = NULL;
+          in->map = map;
+          in->maplen = st.st_size;
+          in->data = map;
+          in->len = st.st_size;
+        }
+      }
+    }
+#endif
+  }
+
+  if (in->map == NULL) {
+    in->buf = malloc(FIO_BUFSIZE);
+    if (in->buf == NULL) {
+      fprintf(stderr, "%s: out of memory allocating input buffer\n",
+              progname);
+      exit(1);
+    }
+    in->f = f;
+    in->data = in->buf;
+    in->len = fread(in->buf, 1, FIO_BUFSIZE, f);
+  }
+
+  if (fio_unzip_open(in, fname, format) < 0) {
+    fio_close_input(in);
+    return -2;
+  }
+
+  return 0;
+}
+
+/*
+ * Make sure there is at least one byte left to hand out; returns 0 at
+ * the end of the input.
+ */
+static int fio_fill(struct fioinput * in)
+{
+  if (in->pos < in->len)
+    return 1;
+  if (in->unzip != NULL)
+    return fio_unzip_fill(in);
+  if (in->f == NULL)
+    return 0;
+  in->len = fread(in->buf, 1, FIO_BUFSIZE, in->f);
+  in->pos = 0;
+  return in->len > 0;
+}
+
+/*
+ * Same as fgets(), taking the line from the input buffer.
+ */
+static char * fio_gets(char * s, int size, struct fioinput * in)
+{
+  const unsigned char * p, * nl;
+  size_t n;
+  int got = 0;
+
+  while (got < size - 1 && fio_fill(in)) {
+    p = in->data + in->pos;
+    n = in->len - in->pos;
+    if (n > (size_t)(size - 1 - got))
+      n = size - 1 - got;
+    nl = memchr(p, '\n', n);
+    if (nl != NULL)
+      n = nl - p + 1;
+    memcpy(s + got, p, n);
+    got += n;
+    in->pos += n;
+    if (nl != NULL)
+      break;
+  }
+  if (got == 0)
+    return NULL;
+  s[got] = 0;
+
+  return s;
+}
+
+/*
+ * Same as fread() of n bytes, taking them from the input buffer.
+ */
+static size_t fio_read(unsigned char * s, size_t n, struct fioinput * in)
+{
+  size_t got = 0, k;
+
+  while (got < n && fio_fill(in)) {
+    k = in->len - in->pos;
+    if (k > n - got)
+      k = n - got;
+    memcpy(s + got, in->data + in->pos, k);
+    got += k;
+    in->pos += k;
+  }
+
+  return got;
+}
+
+
+/*
+ * Value of each hex digit character, 0xff for anything else
+ * (including the terminating NUL).
+ */
+#define XX 0xff
+static const unsigned char hex_value[256] = {
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, XX, XX, XX, XX, XX, XX,
+  XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+#undef XX
+
+/*
+ * Convert the 2 * n hex digits at s into n bytes at out, adding them
+ * to *sum unless sum is NULL.  Returns -1 if a character is not a hex
+ * digit.
+ */
+static int hex_decode(const char * s, int n, unsigned char * out,
+                      unsigned char * sum)
+{
+  const unsigned char * u = (const unsigned char *)s;
+  unsigned char hi, lo, acc = 0;
   int i;
-  unsigned char cksum;
 
-  if (recsize > 255) {
-    fprintf(stderr, "%s: recsize=%d, must be < 256\n",
-              progname, recsize);
+  for (i = 0; i < n; i++, u += 2) {
+    hi = hex_value[u[0]];
+    lo = hex_value[u[1]];
+    if ((hi | lo) & 0xf0)
+      return -1;
+    out[i] = (hi << 4) | lo;
+    acc += out[i];
+  }
+  if (sum != NULL)
+    *sum += acc;
+
+  return 0;
+}
+
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static void fio_out_begin(struct fiooutput * out, FILE * f)
+{
+  out->f = f;
+  out->len = 0;
+  out->err = 0;
+  out->buf = malloc(FIO_BUFSIZE);
+  if (out->buf == NULL) {
+    fprintf(stderr, "%s: out of memory allocating output buffer\n",
+            progname);
+    exit(1);
+  }
+}
+
+static void fio_out_flush(struct fiooutput * out)
+{
+  if (out->len > 0 && fwrite(out->buf, 1, out->len, out->f) != out->len)
+    out->err = errno;
+  out->len = 0;
+}
+
+/*
+ * Flush the buffer and release it; returns -1 if writing failed.
+ */
+static int fio_out_end(struct fiooutput * out, char * outfile)
+{
+  fio_out_flush(out);
+  free(out->buf);
+  out->buf = NULL;
+  if (out->err) {
+    fprintf(stderr, "%s: ERROR: can't write %s: %s\n",
+            progname, outfile, strerror(out->err));
     return -1;
   }
+  return 0;
+}
 
-  n_64k    = 0;
-  nextaddr = startaddr;
-  buf      = inbuf;
-  nbytes   = 0;
+/*
+ * Make room for another record.
+ */
+static void fio_out_reserve(struct fiooutput * out)
+{
+  if (out->len > FIO_BUFSIZE - FIO_MAXREC)
+    fio_out_flush(out);
+}
 
-  while (bufsize) {
-    n = recsize;
-    if (n > bufsize)
-      n = bufsize;
+static void fio_out_char(struct fiooutput * out, char c)
+{
+  out->buf[out->len++] = c;
+}
 
-    if ((nextaddr + n) > 0x10000)
-      n = 0x10000 - nextaddr;
+/*
+ * Append v as ndigits upper-case hex digits, like "%0*X".
+ */
+static void fio_out_hex(struct fiooutput * out, unsigned int v, int ndigits)
+{
+  char * d = out->buf + out->len;
+
+  out->len += ndigits;
+  while (ndigits-- > 0) {
+    d[ndigits] = hex_digits[v & 0x0f];
+    v >>= 4;
+  }
+}
+
+/*
+ * Append n data bytes as hex digits, adding them to *cksum.
+ */
+static void fio_out_bytes(struct fiooutput * out, const unsigned char * b,
+                          int n, unsigned char * cksum)
+{
+  char * d = out->buf + out->len;
+  unsigned char sum = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    *d++ = hex_digits[b[i] >> 4];
+    *d++ = hex_digits[b[i] & 0x0f];
+    sum += b[i];
+  }
+  out->len += 2 * n;
+  *cksum += sum;
+}
+
+
+/*
+ * Intel Hex and S-record output is produced record by record from a
+ * buffer that may still be filling up: records only go out once all
+ * bytes they would hold in the complete file are there, so writing
+ * the data in one go or as it arrives gives the same file.
+ */
+static void fio_rec_begin(struct fiorecw * w, unsigned char * buf,
+                          int recsize, int startaddr, char * outfile,
+                          FILE * outf)
+{
+  memset(w, 0, sizeof(*w));
+  w->buf = buf;
+  w->recsize = recsize;
+  w->startaddr = startaddr;
+  w->nextaddr = startaddr;
+  w->outfile = outfile;
+  fio_out_begin(&w->out, outf);
+}
+
+/*
+ * Write the Intel Hex records for the data below avail; unless final,
+ * a record that could still get longer is left for later.
+ */
+static void ihex_records(struct fiorecw * w, unsigned int avail, int final)
+{
+  int n;
+  unsigned char cksum;
+
+  while (w->pos < avail) {
+    n = w->recsize;
+    if (n > avail - w->pos) {
+      if (!final)
+        break;
+      n = avail - w->pos;
+    }
+
+    if ((w->nextaddr + n) > 0x10000)
+      n = 0x10000 - w->nextaddr;
+
+    fio_out_reserve(&w->out);
 
     if (n) {
       cksum = 0;
-      fprintf(outf, ":%02X%04X00", n, nextaddr);
-      cksum += n + ((nextaddr >> 8) & 0x0ff) + (nextaddr & 0x0ff);
-      for (i=0; i<n; i++) {
-        fprintf(outf, "%02X", buf[i]);
-        cksum += buf[i];
-      }
+      fio_out_char(&w->out, ':');
+      fio_out_hex(&w->out, n, 2);
+      fio_out_hex(&w->out, w->nextaddr, 4);
+      fio_out_hex(&w->out, 0, 2);
+      cksum += n + ((w->nextaddr >> 8) & 0x0ff) + (w->nextaddr & 0x0ff);
+      fio_out_bytes(&w->out, w->buf + w->pos, n, &cksum);
       cksum = -cksum;
-      fprintf(outf, "%02X\n", cksum);
+      fio_out_hex(&w->out, cksum, 2);
+      fio_out_char(&w->out, '\n');
       
-      nextaddr += n;
-      nbytes   += n;
+      w->nextaddr += n;
     }
 
-    if (nextaddr >= 0x10000) {
+    if (w->nextaddr >= 0x10000) {
       int lo, hi;
       /* output an extended address record */
-      n_64k++;
-      lo = n_64k & 0xff;
-      hi = (n_64k >> 8) & 0xff;
+      w->n_64k++;
+      lo = w->n_64k & 0xff;
+      hi = (w->n_64k >> 8) & 0xff;
       cksum = 0;
-      fprintf(outf, ":02000004%02X%02X", hi, lo);
+      fio_out_char(&w->out, ':');
+      fio_out_hex(&w->out, 0x02000004, 8);
+      fio_out_hex(&w->out, hi, 2);
+      fio_out_hex(&w->out, lo, 2);
       cksum += 2 + 0 + 4 + hi + lo;
       cksum = -cksum;
-      fprintf(outf, "%02X\n", cksum);
-      nextaddr = 0;
+      fio_out_hex(&w->out, cksum, 2);
+      fio_out_char(&w->out, '\n');
+      w->nextaddr = 0;
     }
 
     /* advance to next 'recsize' bytes */
-    buf += n;
-    bufsize -= n;
+    w->pos += n;
   }
+}
+
+/*
+ * Add the end of file record and finish writing; returns the number
+ * of data bytes written, or -1.
+ */
+static int ihex_end(struct fiorecw * w)
+{
+  int n;
+  unsigned int nextaddr;
+  unsigned char cksum;
 
   /*-----------------------------------------------------------------
     add the end of record data line
@@ -184,87 +808,64 @@ static int b2ihex(unsigned char * inbuf, int bufsize,
   cksum = 0;
   n = 0;
   nextaddr = 0;
-  fprintf(outf, ":%02X%04X01", n, nextaddr);
+  fio_out_reserve(&w->out);
+  fio_out_char(&w->out, ':');
+  fio_out_hex(&w->out, n, 2);
+  fio_out_hex(&w->out, nextaddr, 4);
+  fio_out_hex(&w->out, 1, 2);
   cksum += n + ((nextaddr >> 8) & 0x0ff) + (nextaddr & 0x0ff) + 1;
   cksum = -cksum;
-  fprintf(outf, "%02X\n", cksum);
+  fio_out_hex(&w->out, cksum, 2);
+  fio_out_char(&w->out, '\n');
 
-  return nbytes;
-}
+  if (fio_out_end(&w->out, w->outfile) < 0)
+    return -1;
 
+  return w->pos;
+}
 
-static int ihex_readrec(struct ihexrec * ihex, char * rec)
+static int b2ihex(unsigned char * inbuf, int bufsize, 
+           int recsize, int startaddr,
+           char * outfile, FILE * outf)
 {
-  int i, j;
-  char buf[8];
-  int offset, len;
-  char * e;
-  unsigned char cksum;
-  int rc;
-
-  len    = strlen(rec);
-  offset = 1;
-  cksum  = 0;
+  struct fiorecw w;
 
-  /* reclen */
-  if (offset + 2 > len)
-    return -1;
-  for (i=0; i<2; i++)
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  ihex->reclen = strtoul(buf, &e, 16);
-  if (e == buf || *e != 0)
+  if (recsize > 255) {
+    fprintf(stderr, "%s: recsize=%d, must be < 256\n",
+              progname, recsize);
     return -1;
+  }
 
-  /* load offset */
-  if (offset + 4 > len)
-    return -1;
-  for (i=0; i<4; i++)
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  ihex->loadofs = strtoul(buf, &e, 16);
-  if (e == buf || *e != 0)
-    return -1;
+  fio_rec_begin(&w, inbuf, recsize, startaddr, outfile, outf);
+  ihex_records(&w, bufsize, 1);
 
-  /* record type */
-  if (offset + 2 > len)
-    return -1;
-  for (i=0; i<2; i++)
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  ihex->rectyp = strtoul(buf, &e, 16);
-  if (e == buf || *e != 0)
-    return -1;
+  return ihex_end(&w);
+}
 
-  cksum = ihex->reclen + ((ihex->loadofs >> 8) & 0x0ff) + 
-    (ihex->loadofs & 0x0ff) + ihex->rectyp;
 
-  /* data */
-  for (j=0; j<ihex->reclen; j++) {
-    if (offset + 2 > len)
-      return -1;
-    for (i=0; i<2; i++)
-      buf[i] = rec[offset++];
-    buf[i] = 0;
-    ihex->data[j] = strtoul(buf, &e, 16);
-    if (e == buf || *e != 0)
-      return -1;
-    cksum += ihex->data[j];
-  }
+static int ihex_readrec(struct ihexrec * ihex, char * rec)
+{
+  unsigned char hdr[4];
+  unsigned char cksum;
+  int len;
+
+  len   = strlen(rec);
+  cksum = 0;
 
-  /* cksum */
-  if (offset + 2 > len)
+  /* reclen, load offset, record type */
+  if (len < 1 + 2 * 4 || hex_decode(rec + 1, 4, hdr, &cksum) < 0)
     return -1;
-  for (i=0; i<2; i++)
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  ihex->cksum = strtoul(buf, &e, 16);
-  if (e == buf || *e != 0)
+  ihex->reclen  = hdr[0];
+  ihex->loadofs = (hdr[1] << 8) | hdr[2];
+  ihex->rectyp  = hdr[3];
+
+  /* data, cksum */
+  if (len < 1 + 2 * (4 + ihex->reclen + 1) ||
+      hex_decode(rec + 1 + 2 * 4, ihex->reclen, ihex->data, &cksum) < 0 ||
+      hex_decode(rec + 1 + 2 * (4 + ihex->reclen), 1, &ihex->cksum, NULL) < 0)
     return -1;
 
-  rc = -cksum & 0x000000ff;
-
-  return rc;
+  return -cksum & 0x000000ff;
 }
 
 
@@ -281,12 +882,11 @@ static int ihex_readrec(struct ihexrec * ihex, char * rec)
  * If an error occurs, return -1.
  *
  * */
-static int ihex2b(char * infile, FILE * inf,
+static int ihex2b(char * infile, struct fioinput * inf,
              AVRMEM * mem, int bufsize, unsigned int fileoffset)
 {
   char buffer [ MAX_LINE_LEN ];
   unsigned int nextaddr, baseaddr, maxaddr;
-  int i;
   int lineno;
   int len;
   struct ihexrec ihex;
@@ -297,7 +897,7 @@ static int ihex2b(char * infile, FILE * inf,
   maxaddr  = 0;
   nextaddr = 0;
 
-  while (fgets((char *)buffer,MAX_LINE_LEN,inf)!=NULL) {
+  while (fio_gets((char *)buffer,MAX_LINE_LEN,inf)!=NULL) {
     lineno++;
     len = strlen(buffer);
     if (buffer[len-1] == '\n') 
@@ -333,10 +933,8 @@ static int ihex2b(char * infile, FILE * inf,
                   progname, nextaddr+ihex.reclen, lineno, infile);
           return -1;
         }
-        for (i=0; i<ihex.reclen; i++) {
-          mem->buf[nextaddr+i] = ihex.data[i];
-          mem->tags[nextaddr+i] = TAG_ALLOCATED;
-        }
+        memcpy(mem->buf + nextaddr, ihex.data, ihex.reclen);
+        avr_mem_tag(mem, nextaddr, ihex.reclen);
         if (nextaddr+ihex.reclen > maxaddr)
           maxaddr = nextaddr+ihex.reclen;
         break;
@@ -390,78 +988,197 @@ static int ihex2b(char * infile, FILE * inf,
   }
 }
 
-static int b2srec(unsigned char * inbuf, int bufsize, 
-           int recsize, int startaddr,
-           char * outfile, FILE * outf)
+/*
+ * Find the next run of bytes at or after pos that is worth writing in
+ * sparse output: bytes that were loaded from a file (tagged) or
+ * that are not in the erased state.  The run ends before the first gap
+ * of FIO_SPARSE_GAP unused bytes.  Returns the start of the run and
+ * sets *end past its last byte, or returns -1 if nothing is left.
+ */
+static int sparse_segment(unsigned char * buf, AVRMEM * mem,
+                          int bufsize, int pos, int * end)
 {
-  unsigned char * buf;
-  unsigned int nextaddr;
-  int n, nbytes, addr_width;
-  int i;
-  unsigned char cksum;
+  int start, last;
+
+#define USED(i) (buf[i] != 0xff || (mem != NULL && avr_mem_tagged(mem, i)))
+
+  while (pos < bufsize && !USED(pos))
+    pos++;
+  if (pos >= bufsize)
+    return -1;
+
+  start = last = pos;
+  for (pos++; pos < bufsize && pos - last <= FIO_SPARSE_GAP; pos++)
+    if (USED(pos))
+      last = pos;
+
+#undef USED
+
+  *end = last + 1;
+  return start;
+}
 
-  char * tmpl=0;
+/*
+ * Same as b2ihex(), but only write the segments found by
+ * sparse_segment(), each preceded by an extended linear address
+ * record when it starts in a different 64 KiB block.
+ */
+static int b2ihex_sparse(unsigned char * inbuf, AVRMEM * mem,
+             int bufsize, int recsize, int startaddr,
+             char * outfile, FILE * outf)
+{
+  unsigned int addr, hiaddr;
+  int pos, end, n, nbytes;
+  unsigned char cksum;
+  struct fiooutput out;
 
   if (recsize > 255) {
-    fprintf(stderr, "%s: ERROR: recsize=%d, must be < 256\n",
-            progname, recsize);
+    fprintf(stderr, "%s: recsize=%d, must be < 256\n",
+              progname, recsize);
     return -1;
   }
-  
-  nextaddr = startaddr;
-  buf = inbuf;
-  nbytes = 0;    
 
-  addr_width = 0;
+  hiaddr = 0;
+  nbytes = 0;
+
+  fio_out_begin(&out, outf);
+
+  pos = 0;
+  while ((pos = sparse_segment(inbuf, mem, bufsize, pos, &end)) >= 0) {
+    while (pos < end) {
+      addr = startaddr + pos;
+      n = end - pos;
+      if (n > recsize)
+        n = recsize;
+      if ((addr & 0xffff) + n > 0x10000)
+        n = 0x10000 - (addr & 0xffff);
+
+      fio_out_reserve(&out);
+
+      if ((addr >> 16) != hiaddr) {
+        /* output an extended linear address record */
+        hiaddr = addr >> 16;
+        fio_out_char(&out, ':');
+        fio_out_hex(&out, 0x02000004, 8);
+        fio_out_hex(&out, hiaddr, 4);
+        cksum = 2 + 0 + 4 + (hiaddr >> 8) + hiaddr;
+        cksum = -cksum;
+        fio_out_hex(&out, cksum, 2);
+        fio_out_char(&out, '\n');
+      }
+
+      cksum = n + ((addr >> 8) & 0x0ff) + (addr & 0x0ff);
+      fio_out_char(&out, ':');
+      fio_out_hex(&out, n, 2);
+      fio_out_hex(&out, addr & 0xffff, 4);
+      fio_out_hex(&out, 0, 2);
+      fio_out_bytes(&out, inbuf + pos, n, &cksum);
+      cksum = -cksum;
+      fio_out_hex(&out, cksum, 2);
+      fio_out_char(&out, '\n');
+
+      pos += n;
+      nbytes += n;
+    }
+  }
+
+  /* end of file record */
+  fio_out_reserve(&out);
+  fio_out_char(&out, ':');
+  fio_out_hex(&out, 0x00000001, 8);
+  fio_out_hex(&out, 0xff, 2);
+  fio_out_char(&out, '\n');
+
+  if (fio_out_end(&out, outfile) < 0)
+    return -1;
+
+  return nbytes;
+}
+
+
+/*
+ * Same as ihex_records(), for S-records; on an address out of range,
+ * w->err is set.
+ */
+static void srec_records(struct fiorecw * w, unsigned int avail, int final)
+{
+  int n, addr_width;
+  int i;
+  unsigned char cksum;
 
-  while (bufsize) {
+  char tmpl = 0;
 
-    n = recsize;
+  while (w->pos < avail && !w->err) {
 
-    if (n > bufsize) 
-      n = bufsize;
+    n = w->recsize;
+
+    if (n > avail - w->pos) {
+      if (!final)
+        break;
+      n = avail - w->pos;
+    }
+
+    fio_out_reserve(&w->out);
 
     if (n) {
       cksum = 0;
-      if (nextaddr + n <= 0xffff) {
+      if (w->nextaddr + n <= 0xffff) {
         addr_width = 2;
-        tmpl="S1%02X%04X";
+        tmpl='1';
       }
-      else if (nextaddr + n <= 0xffffff) {
+      else if (w->nextaddr + n <= 0xffffff) {
         addr_width = 3;
-        tmpl="S2%02X%06X";
+        tmpl='2';
       }
-      else if (nextaddr + n <= 0xffffffff) {
+      else if (w->nextaddr + n <= 0xffffffff) {
         addr_width = 4;
-        tmpl="S3%02X%08X";
+        tmpl='3';
       }
       else {
         fprintf(stderr, "%s: ERROR: address=%d, out of range\n",
-                progname, nextaddr);
-        return -1;
+                progname, w->nextaddr);
+        w->err = 1;
+        return;
       }
 
-      fprintf(outf, tmpl, n + addr_width + 1, nextaddr);		
+      fio_out_char(&w->out, 'S');
+      fio_out_char(&w->out, tmpl);
+      fio_out_hex(&w->out, n + addr_width + 1, 2);
+      fio_out_hex(&w->out, w->nextaddr, 2 * addr_width);
 
       cksum += n + addr_width + 1;
 
       for (i=addr_width; i>0; i--) 
-        cksum += (nextaddr >> (i-1) * 8) & 0xff;
+        cksum += (w->nextaddr >> (i-1) * 8) & 0xff;
 
-      for (i=nextaddr; i<nextaddr + n; i++) {
-        fprintf(outf, "%02X", buf[i]);
-        cksum += buf[i];
-      }
+      fio_out_bytes(&w->out, w->buf + w->nextaddr, n, &cksum);
 
       cksum = 0xff - cksum;
-      fprintf(outf, "%02X\n", cksum);
+      fio_out_hex(&w->out, cksum, 2);
+      fio_out_char(&w->out, '\n');
 
-      nextaddr += n;
-      nbytes +=n;
+      w->nextaddr += n;
     }
 
     /* advance to next 'recsize' bytes */
-    bufsize -= n;
+    w->pos += n;
+  }
+}
+
+/*
+ * Add the end of file record and finish writing; returns the number
+ * of data bytes written, or -1.
+ */
+static int srec_end(struct fiorecw * w)
+{
+  int n, addr_width = 0;
+  unsigned int nextaddr;
+  int i;
+  unsigned char cksum;
+
+  if (w->err) {
+    fio_out_end(&w->out, w->outfile);
+    return -1;
   }
 
   /*-----------------------------------------------------------------
@@ -471,39 +1188,60 @@ static int b2srec(unsigned char * inbuf, int bufsize,
   n = 0;
   nextaddr = 0;
 
-  if (startaddr <= 0xffff) {
+  if (w->startaddr <= 0xffff) {
     addr_width = 2;
-    tmpl="S9%02X%04X";
   }
-  else if (startaddr <= 0xffffff) {
+  else if (w->startaddr <= 0xffffff) {
     addr_width = 3;
-    tmpl="S9%02X%06X";
   }
-  else if (startaddr <= 0xffffffff) {
+  else if (w->startaddr <= 0xffffffff) {
     addr_width = 4;
-    tmpl="S9%02X%08X";
   }
 
-  fprintf(outf, tmpl, n + addr_width + 1, nextaddr);
+  fio_out_reserve(&w->out);
+  fio_out_char(&w->out, 'S');
+  fio_out_char(&w->out, '9');
+  fio_out_hex(&w->out, n + addr_width + 1, 2);
+  fio_out_hex(&w->out, nextaddr, 2 * addr_width);
 
   cksum += n + addr_width +1;
   for (i=addr_width; i>0; i--) 
     cksum += (nextaddr >> (i - 1) * 8) & 0xff;
   cksum = 0xff - cksum;
-  fprintf(outf, "%02X\n", cksum);
+  fio_out_hex(&w->out, cksum, 2);
+  fio_out_char(&w->out, '\n');
+
+  if (fio_out_end(&w->out, w->outfile) < 0)
+    return -1;
+
+  return w->pos; 
+}
+
+static int b2srec(unsigned char * inbuf, int bufsize, 
+           int recsize, int startaddr,
+           char * outfile, FILE * outf)
+{
+  struct fiorecw w;
+
+  if (recsize > 255) {
+    fprintf(stderr, "%s: ERROR: recsize=%d, must be < 256\n",
+            progname, recsize);
+    return -1;
+  }
+  
+  fio_rec_begin(&w, inbuf, recsize, startaddr, outfile, outf);
+  srec_records(&w, bufsize, 1);
 
-  return nbytes; 
+  return srec_end(&w);
 }
 
 
 static int srec_readrec(struct ihexrec * srec, char * rec)
 {
-  int i, j;
-  char buf[8];
+  unsigned char addr[4];
   int offset, len, addr_width;
-  char * e;
   unsigned char cksum;
-  int rc;
+  int i;
 
   len = strlen(rec);
   offset = 1;
@@ -519,65 +1257,112 @@ static int srec_readrec(struct ihexrec * srec, char * rec)
   else if (srec->rectyp == 0x33 || srec->rectyp == 0x37) 
     addr_width = 4;	/* S3,S7-record */
 
-  /* reclen */
-  if (offset + 2 > len) 
+  /* reclen, load offset */
+  if (offset + 2 * (1 + addr_width) > len ||
+      hex_decode(rec + offset, 1, &srec->reclen, &cksum) < 0 ||
+      hex_decode(rec + offset + 2, addr_width, addr, &cksum) < 0)
     return -1;
-  for (i=0; i<2; i++) 
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  srec->reclen = strtoul(buf, &e, 16);
-  cksum += srec->reclen;
+  offset += 2 * (1 + addr_width);
   srec->reclen -= (addr_width+1);
-  if (e == buf || *e != 0) 
+  srec->loadofs = 0;
+  for (i=0; i<addr_width; i++)
+    srec->loadofs = (srec->loadofs << 8) | addr[i];
+
+  /* data, cksum */
+  if (offset + 2 * (srec->reclen + 1) > len ||
+      hex_decode(rec + offset, srec->reclen, srec->data, &cksum) < 0 ||
+      hex_decode(rec + offset + 2 * srec->reclen, 1, &srec->cksum, NULL) < 0)
     return -1;
 
-  /* load offset */
-  if (offset + addr_width > len) 
-    return -1;
-  for (i=0; i<addr_width*2; i++) 
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  srec->loadofs = strtoull(buf, &e, 16);
-  if (e == buf || *e != 0) 
+  return 0xff - cksum;
+}
+
+
+/*
+ * Same as b2srec(), but only write the segments found by
+ * sparse_segment().
+ */
+static int b2srec_sparse(unsigned char * inbuf, AVRMEM * mem,
+           int bufsize, int recsize, int startaddr,
+           char * outfile, FILE * outf)
+{
+  unsigned int addr;
+  int pos, end, n, nbytes, addr_width;
+  int i;
+  unsigned char cksum;
+  struct fiooutput out;
+
+  if (recsize > 255) {
+    fprintf(stderr, "%s: ERROR: recsize=%d, must be < 256\n",
+            progname, recsize);
     return -1;
+  }
 
-  for (i=addr_width; i>0; i--)
-    cksum += (srec->loadofs >> (i - 1) * 8) & 0xff;
+  nbytes = 0;
 
-  /* data */
-  for (j=0; j<srec->reclen; j++) {
-    if (offset+2  > len) 
-      return -1;
-    for (i=0; i<2; i++) 
-      buf[i] = rec[offset++];
-    buf[i] = 0;
-    srec->data[j] = strtoul(buf, &e, 16);
-    if (e == buf || *e != 0) 
-      return -1;
-    cksum += srec->data[j];
+  fio_out_begin(&out, outf);
+
+  pos = 0;
+  while ((pos = sparse_segment(inbuf, mem, bufsize, pos, &end)) >= 0) {
+    while (pos < end) {
+      addr = startaddr + pos;
+      n = end - pos;
+      if (n > recsize)
+        n = recsize;
+
+      if (addr + n <= 0xffff)
+        addr_width = 2;
+      else if (addr + n <= 0xffffff)
+        addr_width = 3;
+      else
+        addr_width = 4;
+
+      fio_out_reserve(&out);
+      fio_out_char(&out, 'S');
+      fio_out_char(&out, '0' + addr_width - 1);
+      fio_out_hex(&out, n + addr_width + 1, 2);
+      fio_out_hex(&out, addr, 2 * addr_width);
+      cksum = n + addr_width + 1;
+      for (i=addr_width; i>0; i--)
+        cksum += (addr >> (i-1) * 8) & 0xff;
+      fio_out_bytes(&out, inbuf + pos, n, &cksum);
+      cksum = 0xff - cksum;
+      fio_out_hex(&out, cksum, 2);
+      fio_out_char(&out, '\n');
+
+      pos += n;
+      nbytes += n;
+    }
   }
 
-  /* cksum */
-  if (offset + 2 > len) 
-    return -1;
-  for (i=0; i<2; i++) 
-    buf[i] = rec[offset++];
-  buf[i] = 0;
-  srec->cksum = strtoul(buf, &e, 16);
-  if (e == buf || *e != 0) 
+  /* termination record */
+  if (startaddr <= 0xffff)
+    addr_width = 2;
+  else if (startaddr <= 0xffffff)
+    addr_width = 3;
+  else
+    addr_width = 4;
+  fio_out_reserve(&out);
+  fio_out_char(&out, 'S');
+  fio_out_char(&out, '9');
+  fio_out_hex(&out, addr_width + 1, 2);
+  fio_out_hex(&out, 0, 2 * addr_width);
+  cksum = 0xff - (addr_width + 1);
+  fio_out_hex(&out, cksum, 2);
+  fio_out_char(&out, '\n');
+
+  if (fio_out_end(&out, outfile) < 0)
     return -1;
 
-  rc = 0xff - cksum;
-  return rc;
+  return nbytes;
 }
 
 
-static int srec2b(char * infile, FILE * inf,
+static int srec2b(char * infile, struct fioinput * inf,
            AVRMEM * mem, int bufsize, unsigned int fileoffset)
 {
   char buffer [ MAX_LINE_LEN ];
   unsigned int nextaddr, maxaddr;
-  int i;
   int lineno;
   int len;
   struct ihexrec srec;
@@ -591,7 +1376,7 @@ static int srec2b(char * infile, FILE * inf,
   maxaddr  = 0;
   reccount = 0;
 
-  while (fgets((char *)buffer,MAX_LINE_LEN,inf)!=NULL) {
+  while (fio_gets((char *)buffer,MAX_LINE_LEN,inf)!=NULL) {
     lineno++;
     len = strlen(buffer);
     if (buffer[len-1] == '\n') 
@@ -680,10 +1465,8 @@ static int srec2b(char * infile, FILE * inf,
                 lineno, infile);
         return -1;
       }
-      for (i=0; i<srec.reclen; i++) {
-        mem->buf[nextaddr+i] = srec.data[i];
-        mem->tags[nextaddr+i] = TAG_ALLOCATED;
-      }
+      memcpy(mem->buf + nextaddr, srec.data, srec.reclen);
+      avr_mem_tag(mem, nextaddr, srec.reclen);
       if (nextaddr+srec.reclen > maxaddr)
         maxaddr = nextaddr+srec.reclen;
       reccount++;	
@@ -723,44 +1506,245 @@ int is_section_in_segment(Elf32_Shdr *sh, Elf32_Phdr *ph)
 }
 
 /*
- * Return the ELF section descriptor that corresponds to program
- * header `ph'.  The program header is expected to be of p_type
- * PT_LOAD, and to have a nonzero p_filesz.  (PT_LOAD sections with a
- * zero p_filesz are typically RAM sections that are not initialized
- * by file data, e.g. ".bss".)
+ * The loadable contents of an ELF file: the ALLOC, PROGBITS sections
+ * that lie within a PT_LOAD program header entry, with their load
+ * addresses.  Only these sections are ever read from the file, so the
+ * debugging information a large ELF file mostly consists of is never
+ * touched.  The image of the last regular file is kept, so updating
+ * further memories from the same file (eeprom, fuses, lock) does not
+ * read it again.
  */
-static Elf_Scn *elf_get_scn(Elf *e, Elf32_Phdr *ph, Elf32_Shdr **shptr)
+struct elf_chunk {
+  unsigned int    lma;
+  unsigned int    size;
+  char          * name;
+  unsigned char * data;
+};
+
+struct elf_image {
+  char             * file;      /* file name, NULL if not to be kept */
+  dev_t              dev;
+  ino_t              ino;
+  off_t              size;
+  time_t             mtime;
+  unsigned char      class;
+  unsigned char      data;
+  Elf32_Half         type;
+  Elf32_Half         machine;
+  int                nchunks;
+  struct elf_chunk * chunks;
+};
+
+/*
+ * The image read last; input files can be read ahead on a thread of
+ * their own (see update_prefetch()), so only use it under elf_mutex.
+ */
+static struct elf_image elf_cache;
+#if defined(HAVE_PTHREAD_H)
+static pthread_mutex_t elf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void elf_free_image(struct elf_image * img)
+{
+  int i;
+
+  for (i = 0; i < img->nchunks; i++) {
+    free(img->chunks[i].name);
+    free(img->chunks[i].data);
+  }
+  free(img->chunks);
+  free(img->file);
+  memset(img, 0, sizeof(*img));
+}
+
+/*
+ * Read the headers and the loadable sections of infile into img.
+ * Returns -1 if the file cannot be used as an ELF file at all.
+ */
+static int elf_load_image(char * infile, FILE * inf, struct elf_image * img)
 {
-  Elf_Scn *s = NULL;
+  Elf *e;
+  Elf_Scn *s;
+  Elf32_Ehdr *eh;
+  Elf32_Phdr *ph;
+  Elf32_Shdr *sh;
+  size_t i, isize, sndx;
+  const char *id, *sname;
+  struct elf_chunk *c;
+  int rv = -1;
+
+  memset(img, 0, sizeof(*img));
 
+  if (elf_version(EV_CURRENT) == EV_NONE) {
+    fprintf(stderr,
+            "%s: ERROR: ELF library initialization failed: %s\n",
+            progname, elf_errmsg(-1));
+    return -1;
+  }
+  if ((e = elf_begin(fileno(inf), ELF_C_READ, NULL)) == NULL) {
+    fprintf(stderr,
+            "%s: ERROR: Cannot open \"%s\" as an ELF file: %s\n",
+            progname, infile, elf_errmsg(-1));
+    return -1;
+  }
+  if (elf_kind(e) != ELF_K_ELF) {
+    fprintf(stderr,
+            "%s: ERROR: Cannot use \"%s\" as an ELF input file\n",
+            progname, infile);
+    goto done;
+  }
+
+  if ((id = elf_getident(e, &isize)) == NULL) {
+    fprintf(stderr,
+            "%s: ERROR: Error reading ident area of \"%s\": %s\n",
+            progname, infile, elf_errmsg(-1));
+    goto done;
+  }
+  img->class = id[EI_CLASS];
+  img->data = id[EI_DATA];
+  if (img->class != ELFCLASS32) {
+    /* elf2b() complains about it */
+    rv = 0;
+    goto done;
+  }
+
+  if ((eh = elf32_getehdr(e)) == NULL) {
+    fprintf(stderr,
+            "%s: ERROR: Error reading ehdr of \"%s\": %s\n",
+            progname, infile, elf_errmsg(-1));
+    goto done;
+  }
+  img->type = eh->e_type;
+  img->machine = eh->e_machine;
+
+  if (eh->e_phnum == 0xffff /* PN_XNUM */) {
+    fprintf(stderr,
+            "%s: ERROR: ELF file \"%s\" uses extended "
+            "program header numbers which are not expected\n",
+            progname, infile);
+    goto done;
+  }
+
+  if ((ph = elf32_getphdr(e)) == NULL) {
+    fprintf(stderr,
+            "%s: ERROR: Error reading program header table of \"%s\": %s\n",
+            progname, infile, elf_errmsg(-1));
+    goto done;
+  }
+
+  if (elf_getshdrstrndx(e, &sndx) != 0) {
+    fprintf(stderr,
+            "%s: ERROR: Error obtaining section name string table: %s\n",
+            progname, elf_errmsg(-1));
+    sndx = 0;
+  }
+
+  if (verbose >= 2) {
+    for (i = 0; i < eh->e_phnum; i++) {
+      if (ph[i].p_type != PT_LOAD ||
+          ph[i].p_filesz == 0)
+        continue;
+      fprintf(stderr,
+              "%s: Considering PT_LOAD program header entry #%d:\n"
+              "    p_vaddr 0x%x, p_paddr 0x%x, p_filesz %d\n",
+              progname, (int)i, ph[i].p_vaddr, ph[i].p_paddr,
+              ph[i].p_filesz);
+    }
+  }
+
+  /*
+   * One pass over the section headers; each section holding data is
+   * located in the PT_LOAD entry that contains it, if any.
+   */
+  s = NULL;
   while ((s = elf_nextscn(e, s)) != NULL) {
-    Elf32_Shdr *sh;
-    size_t ndx = elf_ndxscn(s);
     if ((sh = elf32_getshdr(s)) == NULL) {
       fprintf(stderr,
               "%s: ERROR: Error reading section #%u header: %s\n",
-              progname, (unsigned int)ndx, elf_errmsg(-1));
+              progname, (unsigned int)elf_ndxscn(s), elf_errmsg(-1));
       continue;
     }
     if ((sh->sh_flags & SHF_ALLOC) == 0 ||
-        sh->sh_type != SHT_PROGBITS)
-      /* we are only interested in PROGBITS, ALLOC sections */
+        sh->sh_type != SHT_PROGBITS ||
+        sh->sh_size == 0)
+      /* we are only interested in non-empty PROGBITS, ALLOC sections */
       continue;
-    if (sh->sh_size == 0)
-      /* we are not interested in empty sections */
+
+    for (i = 0; i < eh->e_phnum; i++)
+      if (ph[i].p_type == PT_LOAD && ph[i].p_filesz != 0 &&
+          is_section_in_segment(sh, ph + i))
+        break;
+    if (i == eh->e_phnum)
       continue;
-    if (is_section_in_segment(sh, ph)) {
-      /* yeah, we found it */
-      *shptr = sh;
-      return s;
+
+    img->chunks = realloc(img->chunks,
+                          (img->nchunks + 1) * sizeof(struct elf_chunk));
+    if (img->chunks == NULL) {
+      fprintf(stderr, "%s: out of memory reading ELF file\n", progname);
+      exit(1);
+    }
+    c = &img->chunks[img->nchunks];
+    sname = sndx != 0? elf_strptr(e, sndx, sh->sh_name): NULL;
+    c->name = strdup(sname != NULL? sname: "*unknown*");
+    c->lma = ph[i].p_paddr + sh->sh_offset - ph[i].p_offset;
+    c->size = sh->sh_size;
+    c->data = malloc(sh->sh_size);
+    if (c->name == NULL || c->data == NULL) {
+      fprintf(stderr, "%s: out of memory reading ELF file\n", progname);
+      exit(1);
+    }
+    img->nchunks++;
+
+    if (fseek(inf, sh->sh_offset, SEEK_SET) != 0 ||
+        fread(c->data, 1, c->size, inf) != c->size) {
+      fprintf(stderr,
+              "%s: ERROR: Error reading section \"%s\" of \"%s\"\n",
+              progname, c->name, infile);
+      goto done;
     }
   }
 
-  fprintf(stderr,
-          "%s: ERROR: Cannot find a matching section for "
-          "program header entry @p_vaddr 0x%x\n",
-          progname, ph->p_vaddr);
-  return NULL;
+  rv = 0;
+
+done:
+  (void)elf_end(e);
+  if (rv != 0)
+    elf_free_image(img);
+  return rv;
+}
+
+/*
+ * Return the image of infile, from the cache if the file has not
+ * changed since it was loaded.
+ */
+static struct elf_image * elf_get_image(char * infile, FILE * inf)
+{
+  struct stat st;
+  int keep;
+
+  keep = fstat(fileno(inf), &st) == 0 && S_ISREG(st.st_mode);
+  if (keep && elf_cache.file != NULL &&
+      strcmp(elf_cache.file, infile) == 0 &&
+      elf_cache.dev == st.st_dev && elf_cache.ino == st.st_ino &&
+      elf_cache.size == st.st_size && elf_cache.mtime == st.st_mtime) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: Using sections of \"%s\" read before\n",
+              progname, infile);
+    return &elf_cache;
+  }
+
+  elf_free_image(&elf_cache);
+  if (elf_load_image(infile, inf, &elf_cache) < 0)
+    return NULL;
+  if (keep) {
+    elf_cache.file = strdup(infile);
+    elf_cache.dev = st.st_dev;
+    elf_cache.ino = st.st_ino;
+    elf_cache.size = st.st_size;
+    elf_cache.mtime = st.st_mtime;
+  }
+
+  return &elf_cache;
 }
 
 static int elf_mem_limits(AVRMEM *mem, struct avrpart * p,
@@ -825,7 +1809,9 @@ static int elf2b(char * infile, FILE * inf,
                  AVRMEM * mem, struct avrpart * p,
                  int bufsize, unsigned int fileoffset)
 {
-  Elf *e;
+  struct elf_image *img;
+  struct elf_chunk *c;
+  int i;
   int rv = -1;
   unsigned int low, high, foff;
 
@@ -860,34 +1846,15 @@ static int elf2b(char * infile, FILE * inf,
     high = low + mem->size - 1;
   }
 
-  if (elf_version(EV_CURRENT) == EV_NONE) {
-    fprintf(stderr,
-            "%s: ERROR: ELF library initialization failed: %s\n",
-            progname, elf_errmsg(-1));
-    return -1;
-  }
-  if ((e = elf_begin(fileno(inf), ELF_C_READ, NULL)) == NULL) {
-    fprintf(stderr,
-            "%s: ERROR: Cannot open \"%s\" as an ELF file: %s\n",
-            progname, infile, elf_errmsg(-1));
+#if defined(HAVE_PTHREAD_H)
+  pthread_mutex_lock(&elf_mutex);
+#endif
+  if ((img = elf_get_image(infile, inf)) == NULL) {
+#if defined(HAVE_PTHREAD_H)
+    pthread_mutex_unlock(&elf_mutex);
+#endif
     return -1;
   }
-  if (elf_kind(e) != ELF_K_ELF) {
-    fprintf(stderr,
-            "%s: ERROR: Cannot use \"%s\" as an ELF input file\n",
-            progname, infile);
-    goto done;
-  }
-
-  size_t i, isize;
-  const char *id = elf_getident(e, &isize);
-
-  if (id == NULL) {
-    fprintf(stderr,
-            "%s: ERROR: Error reading ident area of \"%s\": %s\n",
-            progname, infile, elf_errmsg(-1));
-    goto done;
-  }
 
   const char *endianname;
   unsigned char endianess;
@@ -898,8 +1865,8 @@ static int elf2b(char * infile, FILE * inf,
     endianess = ELFDATA2LSB;
     endianname = "big";
   }
-  if (id[EI_CLASS] != ELFCLASS32 ||
-      id[EI_DATA] != endianess) {
+  if (img->class != ELFCLASS32 ||
+      img->data != endianess) {
     fprintf(stderr,
             "%s: ERROR: ELF file \"%s\" is not a "
             "32-bit, %s-endian file that was expected\n",
@@ -907,15 +1874,7 @@ static int elf2b(char * infile, FILE * inf,
     goto done;
   }
 
-  Elf32_Ehdr *eh;
-  if ((eh = elf32_getehdr(e)) == NULL) {
-    fprintf(stderr,
-            "%s: ERROR: Error reading ehdr of \"%s\": %s\n",
-            progname, infile, elf_errmsg(-1));
-    goto done;
-  }
-
-  if (eh->e_type != ET_EXEC) {
+  if (img->type != ET_EXEC) {
     fprintf(stderr,
             "%s: ERROR: ELF file \"%s\" is not an executable file\n",
             progname, infile);
@@ -931,149 +1890,87 @@ static int elf2b(char * infile, FILE * inf,
     machine = EM_AVR;
     mname = "AVR";
   }
-  if (eh->e_machine != machine) {
+  if (img->machine != machine) {
     fprintf(stderr,
             "%s: ERROR: ELF file \"%s\" is not for machine %s\n",
             progname, infile, mname);
     goto done;
   }
-  if (eh->e_phnum == 0xffff /* PN_XNUM */) {
-    fprintf(stderr,
-            "%s: ERROR: ELF file \"%s\" uses extended "
-            "program header numbers which are not expected\n",
-            progname, infile);
-    goto done;
-  }
 
-  Elf32_Phdr *ph;
-  if ((ph = elf32_getphdr(e)) == NULL) {
-    fprintf(stderr,
-            "%s: ERROR: Error reading program header table of \"%s\": %s\n",
-            progname, infile, elf_errmsg(-1));
-    goto done;
-  }
-
-  size_t sndx;
-  if (elf_getshdrstrndx(e, &sndx) != 0) {
-    fprintf(stderr,
-            "%s: ERROR: Error obtaining section name string table: %s\n",
-            progname, elf_errmsg(-1));
-    sndx = 0;
-  }
-
-  /*
-   * Walk the program header table, pick up entries that are of type
-   * PT_LOAD, and have a non-zero p_filesz.
-   */
-  for (i = 0; i < eh->e_phnum; i++) {
-    if (ph[i].p_type != PT_LOAD ||
-        ph[i].p_filesz == 0)
-      continue;
+  for (i = 0; i < img->nchunks; i++) {
+    c = &img->chunks[i];
 
     if (verbose >= 2) {
       fprintf(stderr,
-              "%s: Considering PT_LOAD program header entry #%d:\n"
-              "    p_vaddr 0x%x, p_paddr 0x%x, p_filesz %d\n",
-              progname, i, ph[i].p_vaddr, ph[i].p_paddr, ph[i].p_filesz);
+              "%s: Found section \"%s\", LMA 0x%x, sh_size %u\n",
+              progname, c->name, c->lma, c->size);
     }
 
-    Elf32_Shdr *sh;
-    Elf_Scn *s = elf_get_scn(e, ph + i, &sh);
-    if (s == NULL)
-      continue;
-
-    if ((sh->sh_flags & SHF_ALLOC) && sh->sh_size) {
-      const char *sname;
-
-      if (sndx != 0) {
-        sname = elf_strptr(e, sndx, sh->sh_name);
-      } else {
-        sname = "*unknown*";
-      }
-
-      unsigned int lma;
-      lma = ph[i].p_paddr + sh->sh_offset - ph[i].p_offset;
-
+    if (c->lma >= low &&
+        c->lma + c->size < high) {
+      /* OK */
+    } else {
       if (verbose >= 2) {
         fprintf(stderr,
-                "%s: Found section \"%s\", LMA 0x%x, sh_size %u\n",
-                progname, sname, lma, sh->sh_size);
+                "    => skipping, inappropriate for \"%s\" memory region\n",
+                mem->desc);
       }
+      continue;
+    }
+    /*
+     * 1-byte sized memory regions are special: they are used for fuse
+     * bits, where multiple regions (in the config file) map to a
+     * single, larger region in the ELF file (e.g. "lfuse", "hfuse",
+     * and "efuse" all map to ".fuse").  We silently accept a larger
+     * ELF file region for these, and extract the actual byte to write
+     * from it, using the "foff" offset obtained above.
+     */
+    if (mem->size != 1 &&
+        c->size > mem->size) {
+      fprintf(stderr,
+              "%s: ERROR: section \"%s\" does not fit into \"%s\" memory:\n"
+              "    0x%x + %u > %u\n",
+              progname, c->name, mem->desc,
+              c->lma, c->size, mem->size);
+      continue;
+    }
 
-      if (lma >= low &&
-          lma + sh->sh_size < high) {
-        /* OK */
+    if (mem->size == 1) {
+      if (foff >= c->size) {
+        fprintf(stderr,
+                "%s: ERROR: ELF file section does not contain byte at offset %d\n",
+                progname, foff);
       } else {
         if (verbose >= 2) {
           fprintf(stderr,
-                  "    => skipping, inappropriate for \"%s\" memory region\n",
-                  mem->desc);
+                  "    Extracting one byte from file offset %d\n",
+                  foff);
         }
-        continue;
-      }
-      /*
-       * 1-byte sized memory regions are special: they are used for fuse
-       * bits, where multiple regions (in the config file) map to a
-       * single, larger region in the ELF file (e.g. "lfuse", "hfuse",
-       * and "efuse" all map to ".fuse").  We silently accept a larger
-       * ELF file region for these, and extract the actual byte to write
-       * from it, using the "foff" offset obtained above.
-       */
-      if (mem->size != 1 &&
-          sh->sh_size > mem->size) {
-        fprintf(stderr,
-                "%s: ERROR: section \"%s\" does not fit into \"%s\" memory:\n"
-                "    0x%x + %u > %u\n",
-                progname, sname, mem->desc,
-                lma, sh->sh_size, mem->size);
-        continue;
+        mem->buf[0] = c->data[foff];
+        avr_mem_tag(mem, 0, 1);
+        rv = 1;
       }
+    } else {
+      unsigned int idx;
 
-      Elf_Data *d = NULL;
-      while ((d = elf_getdata(s, d)) != NULL) {
-        if (verbose >= 2) {
-          fprintf(stderr,
-                  "    Data block: d_buf %p, d_off 0x%x, d_size %d\n",
-                  d->d_buf, (unsigned int)d->d_off, d->d_size);
-        }
-        if (mem->size == 1) {
-          if (d->d_off != 0) {
-            fprintf(stderr,
-                    "%s: ERROR: unexpected data block at offset != 0\n",
-                    progname);
-          } else if (foff >= d->d_size) {
-            fprintf(stderr,
-                    "%s: ERROR: ELF file section does not contain byte at offset %d\n",
-                    progname, foff);
-          } else {
-            if (verbose >= 2) {
-              fprintf(stderr,
-                      "    Extracting one byte from file offset %d\n",
-                      foff);
-            }
-            mem->buf[0] = ((unsigned char *)d->d_buf)[foff];
-            mem->tags[0] = TAG_ALLOCATED;
-            rv = 1;
-          }
-        } else {
-          unsigned int idx;
-
-          idx = lma - low + d->d_off;
-          if ((int)(idx + d->d_size) > rv)
-            rv = idx + d->d_size;
-          if (verbose >= 3) {
-            fprintf(stderr,
-                    "    Writing %d bytes to mem offset 0x%x\n",
-                    d->d_size, idx);
-          }
-          memcpy(mem->buf + idx, d->d_buf, d->d_size);
-          memset(mem->tags + idx, TAG_ALLOCATED, d->d_size);
-        }
+      idx = c->lma - low;
+      if ((int)(idx + c->size) > rv)
+        rv = idx + c->size;
+      if (verbose >= 3) {
+        fprintf(stderr,
+                "    Writing %d bytes to mem offset 0x%x\n",
+                c->size, idx);
       }
+      memcpy(mem->buf + idx, c->data, c->size);
+      avr_mem_tag(mem, idx, c->size);
     }
   }
 done:
-  (void)elf_end(e);
+  if (img->file == NULL)
+    elf_free_image(img);
+#if defined(HAVE_PTHREAD_H)
+  pthread_mutex_unlock(&elf_mutex);
+#endif
   return rv;
 }
 #endif  /* HAVE_LIBELF */
@@ -1119,16 +2016,17 @@ static char *itoa_simple(int n, char *buf, int base)
 
 
 static int fileio_rbin(struct fioparms * fio,
-                  char * filename, FILE * f, AVRMEM * mem, int size)
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size)
 {
   int rc;
   unsigned char *buf = mem->buf;
 
   switch (fio->op) {
     case FIO_READ:
-      rc = fread(buf, 1, size, f);
+      rc = fio_read(buf, size, in);
       if (rc > 0)
-        memset(mem->tags, TAG_ALLOCATED, rc);
+        avr_mem_tag(mem, 0, rc);
       break;
     case FIO_WRITE:
       rc = fwrite(buf, 1, size, f);
@@ -1151,6 +2049,118 @@ static int fileio_rbin(struct fioparms * fio,
 }
 
 
+static unsigned long fio_get32(const unsigned char * b)
+{
+  return b[0] | (b[1] << 8) | ((unsigned long)b[2] << 16) |
+    ((unsigned long)b[3] << 24);
+}
+
+/* whether hdr is the header of a delta file this version reads */
+static int fio_delta_header(const unsigned char * hdr, size_t len)
+{
+  return len == FIO_DELTA_HDRLEN && memcmp(hdr, FIO_DELTA_MAGIC, 8) == 0 &&
+    hdr[8] == FIO_DELTA_VERSION;
+}
+
+/*
+ * Only reading: the changed ranges are put in place and tagged.  The
+ * base is for do_op() to check, see fileio_delta_base().
+ */
+static int fileio_delta(struct fioparms * fio,
+                  char * filename, struct fioinput * in,
+                  AVRMEM * mem, int size)
+{
+  unsigned char hdr[FIO_DELTA_HDRLEN];
+  unsigned long addr, len;
+  size_t n;
+  int end = 0;
+
+  if (!fio_delta_header(hdr, fio_read(hdr, sizeof(hdr), in))) {
+    fprintf(stderr, "%s: %s is not a delta file of version %d\n",
+            progname, filename, FIO_DELTA_VERSION);
+    return -1;
+  }
+  /* the base goes to fileio_delta_base() */
+  if (hdr[9] & FIO_DELTA_HAS_BASE)
+    for (len = fio_get32(hdr + 12); len > 0; len -= n)
+      if ((n = fio_read(mem->buf, len < (unsigned long)size? len: size,
+                        in)) == 0) {
+        fprintf(stderr, "%s: delta file %s is truncated\n",
+                progname, filename);
+        return -1;
+      }
+
+  while ((n = fio_read(hdr, FIO_DELTA_RECLEN, in)) == FIO_DELTA_RECLEN) {
+    addr = fio_get32(hdr);
+    len = fio_get32(hdr + 4);
+    if (addr > (unsigned long)size || len > size - addr) {
+      fprintf(stderr, "%s: delta record at 0x%lx of %s is beyond the "
+              "%d bytes of %s\n", progname, addr, filename, size, mem->desc);
+      return -1;
+    }
+    if (fio_read(mem->buf + addr, len, in) != len)
+      break;
+    avr_mem_tag(mem, addr, len);
+    if (addr + len > (unsigned long)end)
+      end = addr + len;
+    n = 0;
+  }
+  if (n != 0 || in->err) {
+    fprintf(stderr, "%s: delta file %s is truncated\n", progname, filename);
+    return -1;
+  }
+
+  return end;
+}
+
+int fileio_delta_base(char * filename, FILEFMT format,
+                      struct fiodelta * base)
+{
+  struct fioinput in;
+  unsigned char hdr[FIO_DELTA_HDRLEN];
+  size_t n;
+  int rc;
+
+  if ((format != FMT_AUTO && format != FMT_DELTA) ||
+      strcmp(filename, "-") == 0)
+    return 0;
+
+  /* not even there: fileio() tells when it gets to read the file */
+  if ((rc = fio_open_input(&in, filename, NULL, "rb", format)) < 0)
+    return format == FMT_DELTA || rc == -2? -1: 0;
+  n = fio_read(hdr, sizeof(hdr), &in);
+  if (!fio_delta_header(hdr, n)) {
+    fio_close_input(&in);
+    if (format == FMT_AUTO)
+      return 0;
+    fprintf(stderr, "%s: %s is not a delta file of version %d\n",
+            progname, filename, FIO_DELTA_VERSION);
+    return -1;
+  }
+
+  base->base_size = fio_get32(hdr + 12);
+  memcpy(base->base_hash, hdr + 16, sizeof(base->base_hash));
+  base->base = NULL;
+  if (hdr[9] & FIO_DELTA_HAS_BASE) {
+    if ((base->base = malloc(base->base_size + 1)) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    if (fio_read(base->base, base->base_size, &in) != base->base_size) {
+      fprintf(stderr, "%s: delta file %s is truncated\n",
+              progname, filename);
+      fio_close_input(&in);
+      free(base->base);
+      base->base = NULL;
+      return -1;
+    }
+  }
+  fio_close_input(&in);
+
+  return 1;
+}
+
+
 static int fileio_imm(struct fioparms * fio,
                char * filename, FILE * f, AVRMEM * mem, int size)
 {
@@ -1176,7 +2186,7 @@ static int fileio_imm(struct fioparms * fio,
           return -1;
         }
         mem->buf[loc] = b;
-        mem->tags[loc++] = TAG_ALLOCATED;
+        avr_mem_tag(mem, loc++, 1);
         p = strtok(NULL, " ,");
         rc = loc;
       }
@@ -1200,20 +2210,25 @@ static int fileio_imm(struct fioparms * fio,
 
 
 static int fileio_ihex(struct fioparms * fio, 
-                  char * filename, FILE * f, AVRMEM * mem, int size)
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size, int sparse)
 {
   int rc;
 
   switch (fio->op) {
     case FIO_WRITE:
-      rc = b2ihex(mem->buf, size, 32, fio->fileoffset, filename, f);
+      if (sparse)
+        rc = b2ihex_sparse(mem->buf, mem, size, 32, fio->fileoffset,
+                           filename, f);
+      else
+        rc = b2ihex(mem->buf, size, 32, fio->fileoffset, filename, f);
       if (rc < 0) {
         return -1;
       }
       break;
 
     case FIO_READ:
-      rc = ihex2b(filename, f, mem, size, fio->fileoffset);
+      rc = ihex2b(filename, in, mem, size, fio->fileoffset);
       if (rc < 0)
         return -1;
       break;
@@ -1230,20 +2245,25 @@ static int fileio_ihex(struct fioparms * fio,
 
 
 static int fileio_srec(struct fioparms * fio,
-                  char * filename, FILE * f, AVRMEM * mem, int size)
+                  char * filename, FILE * f, struct fioinput * in,
+                  AVRMEM * mem, int size, int sparse)
 {
   int rc;
 
   switch (fio->op) {
     case FIO_WRITE:
-      rc = b2srec(mem->buf, size, 32, fio->fileoffset, filename, f);
+      if (sparse)
+        rc = b2srec_sparse(mem->buf, mem, size, 32, fio->fileoffset,
+                           filename, f);
+      else
+        rc = b2srec(mem->buf, size, 32, fio->fileoffset, filename, f);
       if (rc < 0) {
         return -1;
       }
       break;
 
     case FIO_READ:
-      rc = srec2b(filename, f, mem, size, fio->fileoffset);
+      rc = srec2b(filename, in, mem, size, fio->fileoffset);
       if (rc < 0)
         return -1;
       break;
@@ -1407,32 +2427,32 @@ int fileio_setparms(int op, struct fioparms * fp,
 
 
 
-static int fmt_autodetect(char * fname)
+/*
+ * Guess the format from the lines at the start of the input.  This
+ * works on a private view of the input that neither consumes it nor
+ * reads more of a stream, so the parser starts at the beginning again.
+ */
+static int fmt_autodetect(struct fioinput * in)
 {
-  FILE * f;
+  struct fioinput view = *in;
   unsigned char buf[MAX_LINE_LEN];
   int i;
   int len;
   int found;
   int first = 1;
 
-#if defined(WIN32NATIVE)
-  f = fopen(fname, "r");
-#else
-  f = fopen(fname, "rb");
-#endif
-  if (f == NULL) {
-    fprintf(stderr, "%s: error opening %s: %s\n",
-            progname, fname, strerror(errno));
-    return -1;
-  }
+  view.f = NULL;
+  view.unzip = NULL;
+
+  while (fio_gets((char *)buf, MAX_LINE_LEN, &view)!=NULL) {
+    /* check for a delta file */
+    if (first && memcmp(buf, FIO_DELTA_MAGIC, 8) == 0)
+      return FMT_DELTA;
 
-  while (fgets((char *)buf, MAX_LINE_LEN, f)!=NULL) {
     /* check for ELF file */
     if (first &&
         (buf[0] == 0177 && buf[1] == 'E' &&
          buf[2] == 'L' && buf[3] == 'F')) {
-      fclose(f);
       return FMT_ELF;
     }
 
@@ -1450,7 +2470,6 @@ static int fmt_autodetect(char * fname)
       }
     }
     if (found) {
-      fclose(f);
       return FMT_RBIN;
     }
 
@@ -1464,7 +2483,6 @@ static int fmt_autodetect(char * fname)
         }
       }
       if (found) {
-        fclose(f);
         return FMT_IHEX;
       }
     }
@@ -1479,7 +2497,6 @@ static int fmt_autodetect(char * fname)
         }
       }
       if (found) {
-        fclose(f);
         return FMT_SREC;
       }
     }
@@ -1487,7 +2504,6 @@ static int fmt_autodetect(char * fname)
     first = 0;
   }
 
-  fclose(f);
   return -1;
 }
 
@@ -1502,6 +2518,9 @@ int fileio(int op, char * filename, FILEFMT format,
   struct fioparms fio;
   AVRMEM * mem;
   int using_stdio;
+  struct fioinput in;
+  int have_input;
+  struct imgcache_key key;
 
   mem = avr_locate_mem(p, memtype);
   if (mem == NULL) {
@@ -1520,9 +2539,12 @@ int fileio(int op, char * filename, FILEFMT format,
 
   if (fio.op == FIO_READ) {
     /* 0xff fill unspecified memory */
+    avr_mem_unshare(mem, 0);
     memset(mem->buf, 0xff, size);
   }
-  memset(mem->tags, 0, size);
+  avr_mem_untag(mem, 0, size);
+
+  key.valid = 0;
 
   using_stdio = 0;
 
@@ -1542,20 +2564,57 @@ int fileio(int op, char * filename, FILEFMT format,
     f = NULL;
   }
 
-  if (format == FMT_AUTO) {
-    if (using_stdio) {
+  /*
+   * Input files, and output files whose format is to be detected, are
+   * read through a single mapping (or a stream buffer for stdin) that
+   * both the autodetection and the parser use.  ELF files are left to
+   * libelf.
+   */
+  have_input = 0;
+  if (format == FMT_AUTO ||
+      (fio.op == FIO_READ && format != FMT_IMM && format != FMT_ELF)) {
+    if (format == FMT_AUTO && fio.op == FIO_WRITE && using_stdio) {
       fprintf(stderr, 
-              "%s: can't auto detect file format when using stdin/out.\n"
+              "%s: can't auto detect file format when using stdout.\n"
               "%s  Please specify a file format and try again.\n", 
               progname, progbuf);
       return -1;
     }
+    rc = fio_open_input(&in, fname, using_stdio? f: NULL, "rb", format);
+    if (rc == -2)
+      return -1;
+    if (rc < 0) {
+      if (format == FMT_AUTO)
+        fprintf(stderr, "%s: error opening %s: %s\n",
+                progname, fname, strerror(errno));
+      else
+        fprintf(stderr, "%s: can't open %s file %s: %s\n",
+                progname, fio.iodesc, fname, strerror(errno));
+      return -1;
+    }
+    have_input = 1;
+  }
+
+  if (op == FIO_READ && format != FMT_IMM && !using_stdio) {
+    if (have_input && in.map != NULL)
+      imgcache_key(filename, format, p, mem, in.map, in.maplen, &key);
+    else
+      imgcache_key(filename, format, p, mem, NULL, 0, &key);
+    rc = imgcache_load(&key, mem);
+    if (rc >= 0) {
+      if (have_input)
+        fio_close_input(&in);
+      return rc;
+    }
+  }
 
-    format = fmt_autodetect(fname);
+  if (format == FMT_AUTO) {
+    format = fmt_autodetect(&in);
     if (format < 0) {
       fprintf(stderr, 
               "%s: can't determine file format for %s, specify explicitly\n",
               progname, fname);
+      fio_close_input(&in);
       return -1;
     }
 
@@ -1563,6 +2622,37 @@ int fileio(int op, char * filename, FILEFMT format,
       fprintf(stderr, "%s: %s file %s auto detected as %s\n", 
               progname, fio.iodesc, fname, fmtstr(format));
     }
+
+    if (format == FMT_ELF && fio.op == FIO_READ && in.unzip != NULL) {
+      fprintf(stderr, "%s: can't read a compressed ELF file, "
+              "decompress %s first\n", progname, fname);
+      fio_close_input(&in);
+      return -1;
+    }
+
+    if (fio.op == FIO_WRITE || format == FMT_ELF) {
+      fio_close_input(&in);
+      have_input = 0;
+      if (using_stdio && fio.op == FIO_READ) {
+        fprintf(stderr,
+                "%s: can't read an auto detected ELF file from stdin.\n"
+                "%s  Please specify the file format and try again.\n",
+                progname, progbuf);
+        return -1;
+      }
+    }
+  }
+
+  /* do_op() needs to read the base from the file by name */
+  if (format == FMT_DELTA && (fio.op == FIO_WRITE || using_stdio)) {
+    if (fio.op == FIO_WRITE)
+      fprintf(stderr, "%s: can't write a delta file, avrdelta makes them\n",
+              progname);
+    else
+      fprintf(stderr, "%s: can't read a delta file from stdin\n", progname);
+    if (have_input)
+      fio_close_input(&in);
+    return -1;
   }
 
 #if defined(WIN32NATIVE)
@@ -1580,7 +2670,7 @@ int fileio(int op, char * filename, FILEFMT format,
   }
 #endif
 
-  if (format != FMT_IMM) {
+  if (format != FMT_IMM && !have_input) {
     if (!using_stdio) {
       f = fopen(fname, fio.mode);
       if (f == NULL) {
@@ -1593,15 +2683,19 @@ int fileio(int op, char * filename, FILEFMT format,
 
   switch (format) {
     case FMT_IHEX:
-      rc = fileio_ihex(&fio, fname, f, mem, size);
+    case FMT_IHEX_SPARSE:
+      rc = fileio_ihex(&fio, fname, f, &in, mem, size,
+                       format == FMT_IHEX_SPARSE);
       break;
 
     case FMT_SREC:
-      rc = fileio_srec(&fio, fname, f, mem, size);
+    case FMT_SREC_SPARSE:
+      rc = fileio_srec(&fio, fname, f, &in, mem, size,
+                       format == FMT_SREC_SPARSE);
       break;
 
     case FMT_RBIN:
-      rc = fileio_rbin(&fio, fname, f, mem, size);
+      rc = fileio_rbin(&fio, fname, f, &in, mem, size);
       break;
 
     case FMT_ELF:
@@ -1616,6 +2710,10 @@ int fileio(int op, char * filename, FILEFMT format,
 #endif
       break;
 
+    case FMT_DELTA:
+      rc = fileio_delta(&fio, fname, &in, mem, size);
+      break;
+
     case FMT_IMM:
       rc = fileio_imm(&fio, fname, f, mem, size);
       break;
@@ -1630,7 +2728,8 @@ int fileio(int op, char * filename, FILEFMT format,
     default:
       fprintf(stderr, "%s: invalid %s file format: %d\n",
               progname, fio.iodesc, format);
-      return -1;
+      rc = -1;
+      break;
   }
 
   if (rc > 0) {
@@ -1645,10 +2744,198 @@ int fileio(int op, char * filename, FILEFMT format,
       rc = avr_mem_hiaddr(mem);
     }
   }
-  if (format != FMT_IMM && !using_stdio) {
+  if (have_input) {
+    if (in.err)
+      rc = -1;
+    fio_close_input(&in);
+  }
+  else if (format != FMT_IMM && !using_stdio) {
     fclose(f);
   }
 
+  if (rc >= 0)
+    imgcache_save(&key, mem, rc);
+
   return rc;
 }
 
+
+
+/*
+ * Writing a memory to a file while it is read: the file is written
+ * under a temporary name next to the final one and renamed when
+ * complete, so a failed read leaves an existing file alone.
+ */
+struct fiostream {
+  FILEFMT          format;
+  AVRMEM         * mem;
+  int              trim;        /* trailing 0xff bytes are left out */
+  unsigned long    done;        /* bytes of mem read so far */
+  unsigned long    avail;       /* bytes sure to be in the file */
+  unsigned long    written;     /* raw binary bytes written */
+  FILE           * f;
+  char           * fname;
+  char             tmp[PATH_MAX];
+  struct fiorecw   w;
+};
+
+struct fiostream * fileio_stream_open(char * filename, FILEFMT format,
+                                      struct avrpart * p, char * memtype)
+{
+#if defined(WIN32NATIVE)
+  /* renaming over an existing file does not work there */
+  return NULL;
+#else
+  struct fiostream * s;
+  struct fioparms fio;
+  struct fioinput in;
+  struct stat st;
+  AVRMEM * mem;
+  int exists;
+  FILE * f;
+
+  mem = avr_locate_mem(p, memtype);
+  if (mem == NULL || strcmp(filename, "-") == 0 ||
+      fileio_setparms(FIO_WRITE, &fio, p, mem) < 0 || fio.fileoffset != 0)
+    return NULL;
+
+  /* only plain files can be replaced by renaming */
+  exists = lstat(filename, &st) == 0;
+  if (exists && !S_ISREG(st.st_mode))
+    return NULL;
+
+  if (format == FMT_AUTO) {
+    if (!exists || fio_open_input(&in, filename, NULL, "rb", format) < 0)
+      return NULL;
+    format = fmt_autodetect(&in);
+    fio_close_input(&in);
+    if (format < 0)
+      return NULL;
+    if (quell_progress < 2 && (format == FMT_IHEX || format == FMT_SREC ||
+                               format == FMT_RBIN))
+      fprintf(stderr, "%s: %s file %s auto detected as %s\n",
+              progname, fio.iodesc, filename, fmtstr(format));
+  }
+  if (format != FMT_IHEX && format != FMT_SREC && format != FMT_RBIN)
+    return NULL;
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL) {
+    fprintf(stderr, "%s: out of memory allocating output stream\n",
+            progname);
+    exit(1);
+  }
+  if (snprintf(s->tmp, sizeof(s->tmp), "%s.%ld", filename,
+               (long)getpid()) >= sizeof(s->tmp) ||
+      (f = fopen(s->tmp, "w")) == NULL) {
+    free(s);
+    return NULL;
+  }
+  if (exists)
+    fchmod(fileno(f), st.st_mode & 07777);
+
+  s->format = format;
+  s->mem = mem;
+  s->trim = strcasecmp(mem->desc, "flash") == 0 ||
+    strcasecmp(mem->desc, "application") == 0 ||
+    strcasecmp(mem->desc, "apptable") == 0 ||
+    strcasecmp(mem->desc, "boot") == 0 ||
+    (p->flags & AVRPART_HAS_TPI) != 0;
+  s->f = f;
+  s->fname = filename;
+  if (format != FMT_RBIN)
+    fio_rec_begin(&s->w, mem->buf, 32, 0, filename, f);
+
+  return s;
+#endif
+}
+
+/* write what is sure to be in the file in the end */
+static void fio_stream_write(struct fiostream * s, unsigned long avail,
+                             int final)
+{
+  size_t n;
+
+  switch (s->format) {
+    case FMT_IHEX:
+      s->w.buf = s->mem->buf;
+      ihex_records(&s->w, avail, final);
+      break;
+
+    case FMT_SREC:
+      s->w.buf = s->mem->buf;
+      srec_records(&s->w, avail, final);
+      break;
+
+    default:
+      if (avail > s->written) {
+        n = fwrite(s->mem->buf + s->written, 1, avail - s->written, s->f);
+        if (n < avail - s->written)
+          s->w.err = 1;
+        s->written += n;
+      }
+      break;
+  }
+}
+
+void fileio_stream_feed(struct fiostream * s, unsigned long n)
+{
+  unsigned char * buf = s->mem->buf;
+  unsigned long i;
+
+  if (n <= s->done)
+    return;
+
+  if (!s->trim)
+    s->avail = n;
+  else {
+    /*
+     * Like avr_mem_hiaddr(): up to the last byte other than 0xff,
+     * rounded up to a whole word, and never counting byte 0.
+     */
+    for (i = n - 1; i >= s->done && i > 0; i--)
+      if (buf[i] != 0xff) {
+        s->avail = (i + 2) & ~1UL;
+        if (s->avail > n)
+          s->avail = n;
+        break;
+      }
+  }
+  s->done = n;
+
+  fio_stream_write(s, s->avail, 0);
+}
+
+int fileio_stream_close(struct fiostream * s, int size)
+{
+  unsigned long out;
+  int rc = -2, err;
+
+  out = s->format == FMT_RBIN? s->written: s->w.pos;
+  if (size >= 0 && out <= (unsigned long)size) {
+    fio_stream_write(s, size, 1);
+    switch (s->format) {
+      case FMT_IHEX: rc = ihex_end(&s->w); break;
+      case FMT_SREC: rc = srec_end(&s->w); break;
+      default:       rc = s->w.err? -1: size; break;
+    }
+  } else if (s->format != FMT_RBIN)
+    fio_out_end(&s->w.out, s->fname);
+
+  err = ferror(s->f);
+  if (fclose(s->f) != 0 || err) {
+    if (rc >= 0)
+      fprintf(stderr, "%s: ERROR: can't write %s\n", progname, s->fname);
+    rc = -1;
+  }
+  if (rc >= 0 && rename(s->tmp, s->fname) != 0) {
+    fprintf(stderr, "%s: can't rename %s to %s: %s\n",
+            progname, s->tmp, s->fname, strerror(errno));
+    rc = -1;
+  }
+  if (rc < 0)
+    remove(s->tmp);
+  free(s);
+
+  return size < 0? -1: rc;
+}
@@ -21,6 +21,8 @@
 #ifndef fileio_h
 #define fileio_h
 
+struct avrpart;
+
 typedef enum {
   FMT_AUTO,
   FMT_SREC,
@@ -31,9 +33,40 @@ typedef enum {
   FMT_DEC,
   FMT_OCT,
   FMT_BIN,
-  FMT_ELF
+  FMT_ELF,
+  FMT_IHEX_SPARSE,
+  FMT_SREC_SPARSE,
+  FMT_DELTA
 } FILEFMT;
 
+/*
+ * Delta files, as avrdelta writes them: the pages of an image that
+ * differ from a base image, with a hash of the base to make sure the
+ * device holds it.  All numbers are little endian.  The header is
+ *
+ *   0   FIO_DELTA_MAGIC
+ *   8   FIO_DELTA_VERSION
+ *   9   flags, then two zero bytes
+ *   12  size of the base, 4 bytes
+ *   16  64-bit FNV-1a hash of the base, 0xff filled to its size
+ *
+ * followed, with flag FIO_DELTA_HAS_BASE, by the base itself, for a
+ * programmer that can compare it by CRC but not read it back; then
+ * records of a 4-byte address, a 4-byte length, and as many bytes of
+ * data.
+ */
+#define FIO_DELTA_MAGIC    "AVRDELTA"
+#define FIO_DELTA_VERSION  1
+#define FIO_DELTA_HDRLEN   24
+#define FIO_DELTA_RECLEN   8
+#define FIO_DELTA_HAS_BASE 0x01
+
+struct fiodelta {
+  unsigned long base_size;
+  unsigned char base_hash[8];
+  unsigned char * base;         /* the base, if the file holds it */
+};
+
 struct fioparms {
   int    op;
   char * mode;
@@ -57,6 +90,34 @@ char * fmtstr(FILEFMT format);
 int fileio(int op, char * filename, FILEFMT format,
            struct avrpart * p, char * memtype, int size);
 
+/*
+ * The base of the delta file filename, when format is FMT_DELTA or
+ * detects as one.  Returns 1 with the base in *base, 0 if the file
+ * is not a delta, or -1 if it cannot be read as one.  base->base is
+ * allocated, or NULL.
+ */
+int fileio_delta_base(char * filename, FILEFMT format,
+                      struct fiodelta * base);
+
+/*
+ * Write memtype of p to filename while it is being read: after
+ * fileio_stream_open(), fileio_stream_feed() is told whenever the
+ * bytes below n are final, and fileio_stream_close() gets the size
+ * fileio() would have been given, or -1 if reading failed.
+ * fileio_stream_open() returns NULL if the file cannot be written
+ * this way (stdout, anything but Intel Hex, S-record or raw binary);
+ * fileio_stream_close() returns what fileio() would, or -2 if the
+ * file is to be written with fileio() after all.
+ */
+struct fiostream;
+
+struct fiostream * fileio_stream_open(char * filename, FILEFMT format,
+                                      struct avrpart * p, char * memtype);
+
+void fileio_stream_feed(struct fiostream * s, unsigned long n);
+
+int fileio_stream_close(struct fiostream * s, int size);
+
 #ifdef __cplusplus
 }
 #endif
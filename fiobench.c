@@ -0,0 +1,522 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * fiobench: time the file format readers and writers of fileio.c on
+ * synthetic images, for measuring changes to them.  Built by "make
+ * fiobench", it is not installed.
+ *
+ * Every case makes an image of a flash memory of its own part, writes
+ * it in each format with fileio() and reads it back, and reports the
+ * throughput of both in image bytes per second, plus how much the peak
+ * memory use grew.  The images whose files fileio() cannot write (an
+ * Intel Hex file changing the extended address before every record, an
+ * ELF file with debugging sections) are generated here, and only read.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#if !defined(WIN32NATIVE)
+#  include <sys/resource.h>
+#  include <sys/wait.h>
+#endif
+
+#include "avrdude.h"
+#include "avrpart.h"
+#include "fileio.h"
+#include "stats.h"
+
+char * progname = "fiobench";
+char   progbuf[PATH_MAX] = "        ";
+int    verbose;
+int    quell_progress = 2;
+int    ovsigck;
+
+/* the ELF constants needed to generate a file, without libelf */
+#define FB_EM_AVR        83
+#define FB_ET_EXEC       2
+#define FB_PT_LOAD       1
+#define FB_SHT_PROGBITS  1
+#define FB_SHT_STRTAB    3
+#define FB_SHF_ALLOC     2
+#define FB_SHF_EXECINSTR 4
+
+enum {
+  GEN_FILEIO,                   /* written by fileio() before reading */
+  GEN_EXTADDR,                  /* Intel Hex made here */
+  GEN_ELF                       /* ELF made here */
+};
+
+struct bench_case {
+  const char * name;
+  int gen;
+  void (*fill)(AVRMEM * mem);
+};
+
+static const struct {
+  FILEFMT fmt;
+  const char * suffix;
+} bench_formats[] = {
+  { FMT_IHEX,        "hex" },
+  { FMT_IHEX_SPARSE, "hex" },
+  { FMT_SREC,        "srec" },
+  { FMT_SREC_SPARSE, "srec" },
+  { FMT_RBIN,        "bin" },
+};
+
+static unsigned long bench_seed = 1;
+
+static unsigned char bench_random(void)
+{
+  bench_seed = bench_seed * 1103515245 + 12345;
+  return (bench_seed >> 16) & 0xff;
+}
+
+/*
+ * Fill len bytes of mem from addr with noise, and tag them; without
+ * 0xff, which the sparse formats leave out.
+ */
+static void bench_data(AVRMEM * mem, int addr, int len)
+{
+  int i;
+
+  if (addr + len > mem->size)
+    len = mem->size - addr;
+  for (i = 0; i < len; i++)
+    mem->buf[addr + i] = bench_random() % 0xff;
+  avr_mem_tag(mem, addr, len);
+}
+
+/* all of the memory */
+static void fill_dense(AVRMEM * mem)
+{
+  bench_data(mem, 0, mem->size);
+}
+
+/* little code, on both sides of every extended address boundary */
+static void fill_sparse(AVRMEM * mem)
+{
+  int addr;
+
+  for (addr = 0; addr < mem->size; addr += 0x1000)
+    bench_data(mem, addr, 16);
+  for (addr = 0x10000; addr < mem->size; addr += 0x10000)
+    bench_data(mem, addr - 24, 48);
+}
+
+/* many short segments with short gaps */
+static void fill_segments(AVRMEM * mem)
+{
+  int addr;
+
+  for (addr = 0; addr < mem->size; addr += 40)
+    bench_data(mem, addr, 8 + bench_random() % 24);
+}
+
+static const struct bench_case bench_cases[] = {
+  { "dense",    GEN_FILEIO,  fill_dense },
+  { "sparse",   GEN_FILEIO,  fill_sparse },
+  { "segments", GEN_FILEIO,  fill_segments },
+  { "extaddr",  GEN_EXTADDR, fill_dense },
+  { "elf",      GEN_ELF,     fill_dense },
+};
+
+static int bench_tagged(AVRMEM * mem)
+{
+  int i, n;
+
+  for (i = n = 0; i < mem->size; i++)
+    n += avr_mem_tagged(mem, i);
+  return n;
+}
+
+/* whether mem holds every byte of the image orig; gaps may have been read */
+static int bench_same(AVRMEM * mem, AVRMEM * orig)
+{
+  int i;
+
+  for (i = 0; i < orig->size; i++)
+    if (avr_mem_tagged(orig, i) &&
+        (!avr_mem_tagged(mem, i) || mem->buf[i] != orig->buf[i]))
+      return 0;
+  return 1;
+}
+
+static void ihex_record(FILE * f, int len, unsigned int addr, int type,
+                        const unsigned char * data)
+{
+  unsigned char sum;
+  int i;
+
+  fprintf(f, ":%02X%04X%02X", len, addr & 0xffff, type);
+  sum = len + (addr >> 8) + addr + type;
+  for (i = 0; i < len; i++) {
+    fprintf(f, "%02X", data[i]);
+    sum += data[i];
+  }
+  fprintf(f, "%02X\n", (unsigned char)-sum);
+}
+
+/*
+ * Intel Hex with an extended linear address record before every data
+ * record, the records going through the memory out of order.
+ */
+static int gen_extaddr(const char * file, AVRMEM * mem)
+{
+  unsigned char ext[2];
+  unsigned int addr, n, i;
+  FILE * f;
+
+  if ((f = fopen(file, "w")) == NULL)
+    return -1;
+  n = mem->size / 16;
+  for (i = 0; i < n; i++) {
+    /* a stride that is odd in records visits each of them once */
+    addr = (i * 4099u % n) * 16;
+    ext[0] = addr >> 24;
+    ext[1] = addr >> 16;
+    ihex_record(f, 2, 0, 4, ext);
+    ihex_record(f, 16, addr, 0, mem->buf + addr);
+  }
+  ihex_record(f, 0, 0, 1, NULL);
+
+  return fclose(f) == 0? 0: -1;
+}
+
+static void put16(unsigned char * p, unsigned int v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(unsigned char * p, unsigned long v)
+{
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static void elf_section(unsigned char * sh, unsigned long name,
+                        unsigned long type, unsigned long flags,
+                        unsigned long offset, unsigned long size)
+{
+  memset(sh, 0, 40);
+  put32(sh + 0, name);
+  put32(sh + 4, type);
+  put32(sh + 8, flags);
+  put32(sh + 16, offset);
+  put32(sh + 20, size);
+  put32(sh + 32, 1);
+}
+
+/*
+ * A 32-bit little-endian AVR executable of the memory as .text in one
+ * loadable segment, followed by four times as much of .debug_info, as
+ * a build with debugging information would have.
+ */
+static int gen_elf(const char * file, AVRMEM * mem)
+{
+  static const char names[] = "\0.text\0.debug_info\0.shstrtab";
+  unsigned char hdr[84], sh[4 * 40];
+  unsigned long text, debug, strs, shoff, i;
+  FILE * f;
+
+  text = sizeof(hdr);
+  debug = text + mem->size;
+  strs = debug + 4ul * mem->size;
+  shoff = (strs + sizeof(names) + 3) & ~3ul;
+
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(hdr, "\177ELF", 4);
+  hdr[4] = 1;                   /* 32-bit */
+  hdr[5] = 1;                   /* little-endian */
+  hdr[6] = 1;                   /* EV_CURRENT */
+  put16(hdr + 16, FB_ET_EXEC);
+  put16(hdr + 18, FB_EM_AVR);
+  put32(hdr + 20, 1);
+  put32(hdr + 28, 52);          /* e_phoff */
+  put32(hdr + 32, shoff);
+  put16(hdr + 40, 52);          /* e_ehsize */
+  put16(hdr + 42, 32);          /* e_phentsize */
+  put16(hdr + 44, 1);
+  put16(hdr + 46, 40);          /* e_shentsize */
+  put16(hdr + 48, 4);
+  put16(hdr + 50, 3);           /* e_shstrndx */
+
+  put32(hdr + 52, FB_PT_LOAD);
+  put32(hdr + 56, text);        /* p_offset */
+  put32(hdr + 64, 0);           /* p_paddr */
+  put32(hdr + 68, mem->size);
+  put32(hdr + 72, mem->size);
+  put32(hdr + 76, 5);           /* PF_R | PF_X */
+  put32(hdr + 80, 1);
+
+  memset(sh, 0, 40);
+  elf_section(sh + 40, 1, FB_SHT_PROGBITS, FB_SHF_ALLOC | FB_SHF_EXECINSTR,
+              text, mem->size);
+  elf_section(sh + 80, 7, FB_SHT_PROGBITS, 0, debug, 4ul * mem->size);
+  elf_section(sh + 120, 19, FB_SHT_STRTAB, 0, strs, sizeof(names));
+
+  if ((f = fopen(file, "wb")) == NULL)
+    return -1;
+  fwrite(hdr, 1, sizeof(hdr), f);
+  fwrite(mem->buf, 1, mem->size, f);
+  for (i = 0; i < 4ul * mem->size; i++)
+    putc(bench_random(), f);
+  fwrite(names, 1, sizeof(names), f);
+  for (i = strs + sizeof(names); i < shoff; i++)
+    putc(0, f);
+  fwrite(sh, 1, sizeof(sh), f);
+
+  return fclose(f) == 0? 0: -1;
+}
+
+static AVRPART * bench_part(int size)
+{
+  AVRPART * p;
+  AVRMEM * m;
+
+  p = avr_new_part();
+  strcpy(p->desc, "fiobench");
+  strcpy(p->id, "fiobench");
+  m = avr_new_memtype();
+  strcpy(m->desc, "flash");
+  m->size = size;
+  m->page_size = 256;
+  ladd(p->mem, m);
+  if (avr_initmem(p) < 0)
+    exit(1);
+
+  return p;
+}
+
+static long bench_file_size(const char * file)
+{
+  FILE * f;
+  long n;
+
+  if ((f = fopen(file, "rb")) == NULL)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  fclose(f);
+  return n;
+}
+
+/* peak memory use so far in KiB, or 0 if unknown */
+static long bench_peak(void)
+{
+#if !defined(WIN32NATIVE)
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+#  if defined(__APPLE__)
+    return ru.ru_maxrss / 1024;
+#  else
+    return ru.ru_maxrss;
+#  endif
+#endif
+  return 0;
+}
+
+/*
+ * Run one format of one case; the files read alternate between two
+ * copies, so the ELF reader cannot take its sections from its cache.
+ */
+static int bench_run(const struct bench_case * bc, FILEFMT fmt,
+                     const char * suffix, const char * dir, int size,
+                     int iterations)
+{
+  char file[2][PATH_MAX];
+  double start, emit, parse;
+  long peak, filesize;
+  AVRPART * p;
+  AVRMEM * mem, * orig;
+  int i, image, rc;
+
+  p = bench_part(size);
+  mem = avr_locate_mem(p, "flash");
+  bench_seed = 1;
+  avr_mem_unshare(mem, 0);
+  memset(mem->buf, 0xff, mem->size);
+  bc->fill(mem);
+  image = bench_tagged(mem);
+  orig = avr_dup_mem(mem);
+  for (i = 0; i < 2; i++)
+    snprintf(file[i], sizeof(file[i]), "%s/fiobench-%s-%d.%s",
+             dir, bc->name, i, suffix);
+  peak = bench_peak();
+
+  emit = 0;
+  for (i = 0; i < 2; i++) {
+    start = stats_time();
+    if (bc->gen == GEN_EXTADDR)
+      rc = gen_extaddr(file[i], mem);
+    else if (bc->gen == GEN_ELF)
+      rc = gen_elf(file[i], mem);
+    else
+      rc = fileio(FIO_WRITE, file[i], fmt, p, "flash", mem->size);
+    emit += stats_time() - start;
+    if (rc < 0) {
+      fprintf(stderr, "%s: cannot write \"%s\"\n", progname, file[i]);
+      return -1;
+    }
+  }
+  /* the other iterations of the writers, the same file again */
+  for (i = 2; i < iterations && bc->gen == GEN_FILEIO; i++) {
+    start = stats_time();
+    fileio(FIO_WRITE, file[i % 2], fmt, p, "flash", mem->size);
+    emit += stats_time() - start;
+  }
+  filesize = bench_file_size(file[0]);
+
+  parse = 0;
+  for (i = 0; i < iterations; i++) {
+    start = stats_time();
+    rc = fileio(FIO_READ, file[i % 2], fmt, p, "flash", -1);
+    parse += stats_time() - start;
+    if (rc < 0) {
+      fprintf(stderr, "%s: cannot read \"%s\"\n", progname, file[i % 2]);
+      return -1;
+    }
+  }
+  if (!bench_same(mem, orig)) {
+    fprintf(stderr, "%s: %s, %s: the image read back differs\n",
+            progname, bc->name, fmtstr(fmt));
+    return -1;
+  }
+  for (i = 0; i < 2; i++)
+    remove(file[i]);
+
+  printf("%-9s %-25s %8d %9ld", bc->name, fmtstr(fmt), image / 1024,
+         filesize / 1024);
+  if (bc->gen == GEN_FILEIO)
+    printf(" %9.2f", image / (emit / iterations) / 1e6);
+  else
+    printf(" %9s", "-");
+  printf(" %9.2f %8ld\n", image / (parse / iterations) / 1e6,
+         bench_peak() - peak);
+
+  avr_free_mem(orig);
+  avr_free_part(p);
+  return 0;
+}
+
+/* run it in a process of its own, so the peak memory is its own */
+static int bench_case_fork(const struct bench_case * bc, FILEFMT fmt,
+                           const char * suffix, const char * dir, int size,
+                           int iterations)
+{
+#if !defined(WIN32NATIVE)
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  if ((pid = fork()) == 0) {
+    status = bench_run(bc, fmt, suffix, dir, size, iterations);
+    fflush(stdout);
+    _exit(status < 0? 1: 0);
+  }
+  if (pid > 0) {
+    if (waitpid(pid, &status, 0) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      return -1;
+    return 0;
+  }
+#endif
+  return bench_run(bc, fmt, suffix, dir, size, iterations);
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "Usage: %s [-d dir] [-n iterations] [-s kbytes] [case ...]\n"
+          "  -d dir        Directory for the files, default \".\".\n"
+          "  -n iterations Times each file is written and read, default 10.\n"
+          "  -s kbytes     Size of the flash memory, default 256.\n"
+          "Cases are dense, sparse, segments, extaddr and elf, default all.\n",
+          progname);
+}
+
+int main(int argc, char * argv [])
+{
+  const char * dir = ".";
+  const struct bench_case * bc;
+  int ch, i, j, k, size, iterations, rc;
+
+  size = 256 * 1024;
+  iterations = 10;
+  while ((ch = getopt(argc, argv, "d:n:s:")) != -1) {
+    switch (ch) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 's':
+        size = atoi(optarg) * 1024;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (iterations < 2 || size < 1024) {
+    usage();
+    return 1;
+  }
+
+  printf("%-9s %-25s %8s %9s %9s %9s %8s\n", "case", "format",
+         "KiB", "file KiB", "emit MB/s", "parse MB/s", "peak KiB");
+  rc = 0;
+  for (i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    bc = &bench_cases[i];
+    for (k = optind; k < argc; k++)
+      if (strcmp(argv[k], bc->name) == 0)
+        break;
+    if (optind < argc && k == argc)
+      continue;
+
+    if (bc->gen == GEN_ELF) {
+#if defined(HAVE_LIBELF)
+      if (bench_case_fork(bc, FMT_ELF, "elf", dir, size, iterations) < 0)
+        rc = 1;
+#else
+      printf("%-9s %-25s (not built with libelf)\n", bc->name,
+             fmtstr(FMT_ELF));
+#endif
+    } else if (bc->gen == GEN_EXTADDR) {
+      if (bench_case_fork(bc, FMT_IHEX, "hex", dir, size, iterations) < 0)
+        rc = 1;
+    } else {
+      for (j = 0; j < sizeof(bench_formats) / sizeof(bench_formats[0]); j++)
+        if (bench_case_fork(bc, bench_formats[j].fmt, bench_formats[j].suffix,
+                            dir, size, iterations) < 0)
+          rc = 1;
+    }
+  }
+
+  return rc;
+}
@@ -375,7 +375,7 @@ int flip1_chip_erase(PROGRAMMER* pgm, AVRPART *part)
 
   FLIP1(pgm)->dfu->timeout = LONG_DFU_TIMEOUT;
   cmd_result = dfu_dnload(FLIP1(pgm)->dfu, &cmd, 3);
-  aux_result = dfu_getstatus(FLIP1(pgm)->dfu, &status);
+  aux_result = dfu_getstatus_done(FLIP1(pgm)->dfu, &status);
   FLIP1(pgm)->dfu->timeout = default_timeout;
 
   if (cmd_result < 0 || aux_result < 0)
@@ -783,7 +783,7 @@ int flip1_write_memory(struct dfu_dev *dfu,
                           sizeof(struct flip1_cmd_header) +
                           write_size +
                           sizeof(struct flip1_prog_footer));
-  aux_result = dfu_getstatus(dfu, &status);
+  aux_result = dfu_getstatus_done(dfu, &status);
   dfu->timeout = default_timeout;
 
   free(buf);
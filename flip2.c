@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #if HAVE_STDINT_H
 #include <stdint.h>
@@ -59,18 +60,6 @@
 
 const char flip2_desc[] = "FLIP USB DFU protocol version 2 (AVR4023)";
 
-/* PRIVATE DATA STRUCTURES */
-
-struct flip2
-{
-  struct dfu_dev *dfu;
-  unsigned char part_sig[3];
-  unsigned char part_rev;
-  unsigned char boot_ver;
-};
-
-#define FLIP2(pgm) ((struct flip2 *)(pgm->cookie))
-
 /* The FLIP2 protocol assigns specific meaning to certain combinations of
  * status and state bytes in the DFU_GETSTATUS response. These constants en-
  * code these combinations as a 16-bit value: the high order byte is the
@@ -100,6 +89,7 @@ struct flip2_cmd {
 
 #define FLIP2_CMD_PROG_START 0x00
 #define FLIP2_CMD_READ_MEMORY 0x00
+#define FLIP2_CMD_BLANK_CHECK 0x01
 #define FLIP2_CMD_SELECT_MEMORY 0x03
 #define FLIP2_CMD_CHIP_ERASE 0x00
 #define FLIP2_CMD_START_APP 0x03
@@ -128,6 +118,36 @@ enum flip2_mem_unit {
   FLIP2_MEM_UNIT_EXT_MEM_DF = 0x10
 };
 
+/* PRIVATE DATA STRUCTURES */
+
+struct flip2
+{
+  struct dfu_dev *dfu;
+  unsigned char part_sig[3];
+  unsigned char part_rev;
+  unsigned char boot_ver;
+
+  /* Pages submitted for writing, collected into one block. */
+  unsigned char *wbuf;
+  enum flip2_mem_unit wunit;
+  uint32_t waddr;
+  unsigned int wlen;
+  unsigned int pending;
+
+  /* A block the device is still programming, and when to ask again. */
+  int busy;
+  struct timeval busy_until;
+  unsigned short busy_offset, busy_size;
+
+  /* The block read last; reading on from its end reads ahead. */
+  unsigned char *rbuf;
+  enum flip2_mem_unit runit;
+  uint32_t raddr;
+  unsigned int rlen;
+};
+
+#define FLIP2(pgm) ((struct flip2 *)(pgm->cookie))
+
 /* EXPORTED PROGRAMMER FUNCTION PROTOTYPES */
 
 static int flip2_open(PROGRAMMER *pgm, char *port_spec);
@@ -146,7 +166,14 @@ static int flip2_paged_load(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
   unsigned int page_size, unsigned int addr, unsigned int n_bytes);
 static int flip2_paged_write(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
   unsigned int page_size, unsigned int addr, unsigned int n_bytes);
+static int flip2_paged_write_submit(PROGRAMMER* pgm, AVRPART *part,
+  AVRMEM *mem, unsigned int page_size, unsigned int addr,
+  unsigned int n_bytes);
+static int flip2_paged_write_complete(PROGRAMMER* pgm, AVRPART *part,
+  AVRMEM *mem);
 static int flip2_read_sig_bytes(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem);
+static int flip2_blank_check(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
+  unsigned long addr, unsigned long len);
 static void flip2_setup(PROGRAMMER * pgm);
 static void flip2_teardown(PROGRAMMER * pgm);
 
@@ -156,16 +183,24 @@ static void flip2_show_info(struct flip2 *flip2);
 
 static int flip2_read_memory(struct dfu_dev *dfu,
   enum flip2_mem_unit mem_unit, uint32_t addr, void *ptr, int size);
-static int flip2_write_memory(struct dfu_dev *dfu,
+static int flip2_write_memory(PROGRAMMER *pgm,
   enum flip2_mem_unit mem_unit, uint32_t addr, const void *ptr, int size);
+static int flip2_flush(PROGRAMMER *pgm);
+static int flip2_write_wait(PROGRAMMER *pgm);
 
 static int flip2_set_mem_unit(struct dfu_dev *dfu,
   enum flip2_mem_unit mem_unit);
 static int flip2_set_mem_page(struct dfu_dev *dfu, unsigned short page_addr);
-static int flip2_read_max1k(struct dfu_dev *dfu,
+static unsigned int flip2_block_size(struct dfu_dev *dfu, int write);
+static int flip2_read_block(struct dfu_dev *dfu,
   unsigned short offset, void *ptr, unsigned short size);
-static int flip2_write_max1k(struct dfu_dev *dfu,
+static int flip2_blank_block(struct dfu_dev *dfu,
+  unsigned short offset, unsigned int size);
+static int flip2_write_block(PROGRAMMER *pgm,
   unsigned short offset, const void *ptr, unsigned short size);
+static int flip2_write_status(struct dfu_dev *dfu,
+  const struct dfu_status *status, unsigned short offset,
+  unsigned short size);
 
 static const char * flip2_status_str(const struct dfu_status *status);
 static const char * flip2_mem_unit_str(enum flip2_mem_unit mem_unit);
@@ -188,9 +223,12 @@ void flip2_initpgm(PROGRAMMER *pgm)
   pgm->close            = flip2_close;
   pgm->paged_load       = flip2_paged_load;
   pgm->paged_write      = flip2_paged_write;
+  pgm->paged_write_submit   = flip2_paged_write_submit;
+  pgm->paged_write_complete = flip2_paged_write_complete;
   pgm->read_byte        = flip2_read_byte;
   pgm->write_byte       = flip2_write_byte;
   pgm->read_sig_bytes   = flip2_read_sig_bytes;
+  pgm->blank_check      = flip2_blank_check;
   pgm->setup            = flip2_setup;
   pgm->teardown         = flip2_teardown;
 }
@@ -322,6 +360,7 @@ flip2_initialize_fail:
 void flip2_close(PROGRAMMER* pgm)
 {
   if (FLIP2(pgm)->dfu != NULL) {
+    flip2_flush(pgm);
     dfu_close(FLIP2(pgm)->dfu);
     FLIP2(pgm)->dfu = NULL;
   }
@@ -365,6 +404,10 @@ int flip2_chip_erase(PROGRAMMER* pgm, AVRPART *part)
     FLIP2_CMD_GROUP_EXEC, FLIP2_CMD_CHIP_ERASE, { 0xFF, 0, 0, 0 }
   };
 
+  if (flip2_flush(pgm) != 0)
+    return -1;
+  FLIP2(pgm)->rlen = 0;
+
   for (;;) {
     cmd_result = dfu_dnload(FLIP2(pgm)->dfu, &cmd, sizeof(cmd));
     aux_result = dfu_getstatus(FLIP2(pgm)->dfu, &status);
@@ -408,6 +451,9 @@ int flip2_read_byte(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
     return -1;
   }
 
+  if (flip2_flush(pgm) != 0)
+    return -1;
+
   return flip2_read_memory(FLIP2(pgm)->dfu, mem_unit, addr, value, 1);
 }
 
@@ -431,13 +477,22 @@ int flip2_write_byte(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
     return -1;
   }
 
-  return flip2_write_memory(FLIP2(pgm)->dfu, mem_unit, addr, &value, 1);
+  if (flip2_flush(pgm) != 0)
+    return -1;
+
+  if (flip2_write_memory(pgm, mem_unit, addr, &value, 1) != 0 ||
+      flip2_write_wait(pgm) != 0)
+    return -1;
+
+  return 0;
 }
 
 int flip2_paged_load(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
   unsigned int page_size, unsigned int addr, unsigned int n_bytes)
 {
   enum flip2_mem_unit mem_unit;
+  struct flip2 *flip2;
+  unsigned int block_size, len;
   int result;
 
   if (FLIP2(pgm)->dfu == NULL)
@@ -462,10 +517,59 @@ int flip2_paged_load(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
     exit(1);
   }
 
-  result = flip2_read_memory(FLIP2(pgm)->dfu, mem_unit, addr,
-    mem->buf + addr, n_bytes);
+  if (flip2_flush(pgm) != 0)
+    return -1;
 
-  return (result == 0) ? n_bytes : -1;
+  flip2 = FLIP2(pgm);
+
+  if (flip2->rlen > 0 && mem_unit == flip2->runit &&
+      addr >= flip2->raddr && addr + n_bytes <= flip2->raddr + flip2->rlen) {
+    memcpy(mem->buf + addr, flip2->rbuf + (addr - flip2->raddr), n_bytes);
+    return n_bytes;
+  }
+
+  /* Reading on where the last block ended, read a whole block ahead, up to
+   * the end of the memory and of the 64 KiB page.
+   */
+
+  block_size = flip2_block_size(flip2->dfu, 0);
+  len = n_bytes;
+  if (flip2->rlen > 0 && mem_unit == flip2->runit &&
+      addr == flip2->raddr + flip2->rlen) {
+    len = block_size;
+    if (len > mem->size - addr)
+      len = mem->size - addr;
+    if (len > 0x10000 - (addr & 0xFFFF))
+      len = 0x10000 - (addr & 0xFFFF);
+    if (len < n_bytes)
+      len = n_bytes;
+  }
+
+  if (len > block_size) {
+    flip2->rlen = 0;
+    result = flip2_read_memory(flip2->dfu, mem_unit, addr,
+      mem->buf + addr, n_bytes);
+    return (result == 0) ? n_bytes : -1;
+  }
+
+  if (flip2->rbuf == NULL &&
+      (flip2->rbuf = malloc(block_size)) == NULL) {
+    fprintf(stderr, "%s: Out of memory allocating read buffer\n", progname);
+    exit(1);
+  }
+
+  flip2->rlen = 0;
+  result = flip2_read_memory(flip2->dfu, mem_unit, addr, flip2->rbuf, len);
+
+  if (result != 0)
+    return -1;
+
+  flip2->runit = mem_unit;
+  flip2->raddr = addr;
+  flip2->rlen = len;
+  memcpy(mem->buf + addr, flip2->rbuf, n_bytes);
+
+  return n_bytes;
 }
 
 int flip2_paged_write(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
@@ -496,12 +600,94 @@ int flip2_paged_write(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
     exit(1);
   }
 
-  result = flip2_write_memory(FLIP2(pgm)->dfu, mem_unit, addr,
-    mem->buf + addr, n_bytes);
+  if (flip2_flush(pgm) != 0)
+    return -1;
+
+  result = flip2_write_memory(pgm, mem_unit, addr, mem->buf + addr, n_bytes);
+
+  if (result == 0)
+    result = flip2_write_wait(pgm);
 
   return (result == 0) ? n_bytes : -1;
 }
 
+/* Submitted pages that follow each other are collected into blocks as large
+ * as the device takes in one DFU_DNLOAD; a block is sent when the next page
+ * does not fit, and the last one when all pages are completed. The device's
+ * answer to a block is only waited for before the next request, so the next
+ * block is put together while the device programs the last one.
+ */
+
+int flip2_paged_write_submit(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
+  unsigned int page_size, unsigned int addr, unsigned int n_bytes)
+{
+  enum flip2_mem_unit mem_unit;
+  struct flip2 *flip2 = FLIP2(pgm);
+  unsigned int block_size;
+
+  if (flip2->dfu == NULL)
+    return -1;
+
+  mem_unit = flip2_mem_unit(mem->desc);
+
+  if (mem_unit == FLIP2_MEM_UNIT_UNKNOWN) {
+    fprintf(stderr, "%s: Error: "
+      "\"%s\" memory not accessible using FLIP",
+      progname, mem->desc);
+    if (strcmp(mem->desc, "flash") == 0)
+      fprintf(stderr, " (did you mean \"application\"?)");
+    fprintf(stderr, "\n");
+    return -1;
+  }
+
+  block_size = flip2_block_size(flip2->dfu, 1);
+
+  if (flip2->wlen > 0 &&
+      (mem_unit != flip2->wunit || addr != flip2->waddr + flip2->wlen ||
+       flip2->wlen + n_bytes > block_size ||
+       (addr + n_bytes - 1) >> 16 != flip2->waddr >> 16)) {
+    if (flip2_flush(pgm) != 0)
+      return -1;
+  }
+
+  if (n_bytes > block_size || (addr + n_bytes - 1) >> 16 != addr >> 16) {
+    /* Too large to collect; flip2_write_memory() splits it up. */
+    if (flip2_write_memory(pgm, mem_unit, addr, mem->buf + addr,
+          n_bytes) != 0)
+      return -1;
+    flip2->pending++;
+    return n_bytes;
+  }
+
+  if (flip2->wbuf == NULL &&
+      (flip2->wbuf = malloc(block_size)) == NULL) {
+    fprintf(stderr, "%s: Out of memory allocating write buffer\n", progname);
+    exit(1);
+  }
+
+  if (flip2->wlen == 0) {
+    flip2->wunit = mem_unit;
+    flip2->waddr = addr;
+  }
+  memcpy(flip2->wbuf + flip2->wlen, mem->buf + addr, n_bytes);
+  flip2->wlen += n_bytes;
+  flip2->pending++;
+
+  return n_bytes;
+}
+
+int flip2_paged_write_complete(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem)
+{
+  struct flip2 *flip2 = FLIP2(pgm);
+
+  if (flip2->pending > 0)
+    flip2->pending--;
+  if (flip2->pending > 0)
+    return 0;
+
+  return flip2_flush(pgm);
+}
+
 int flip2_read_sig_bytes(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem)
 {
   if (FLIP2(pgm)->dfu == NULL)
@@ -517,6 +703,46 @@ int flip2_read_sig_bytes(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem)
   return 0;
 }
 
+/* The bootloader checks a range for being blank one 64 KiB page at a time.
+ */
+
+int flip2_blank_check(PROGRAMMER* pgm, AVRPART *part, AVRMEM *mem,
+  unsigned long addr, unsigned long len)
+{
+  enum flip2_mem_unit mem_unit;
+  struct dfu_dev *dfu = FLIP2(pgm)->dfu;
+  unsigned long size;
+  int result;
+
+  if (dfu == NULL)
+    return -1;
+
+  mem_unit = flip2_mem_unit(mem->desc);
+
+  if (mem_unit == FLIP2_MEM_UNIT_UNKNOWN)
+    return -1;
+
+  if (flip2_flush(pgm) != 0 || flip2_set_mem_unit(dfu, mem_unit) != 0)
+    return -1;
+
+  while (len > 0) {
+    size = 0x10000 - (addr & 0xFFFF);
+    if (size > len)
+      size = len;
+
+    if (flip2_set_mem_page(dfu, addr >> 16) != 0)
+      return -1;
+    result = flip2_blank_block(dfu, addr & 0xFFFF, size);
+    if (result != 1)
+      return result;
+
+    addr += size;
+    len -= size;
+  }
+
+  return 1;
+}
+
 void flip2_setup(PROGRAMMER * pgm)
 {
   pgm->cookie = calloc(1, sizeof(struct flip2));
@@ -530,6 +756,8 @@ void flip2_setup(PROGRAMMER * pgm)
 
 void flip2_teardown(PROGRAMMER * pgm)
 {
+  free(FLIP2(pgm)->wbuf);
+  free(FLIP2(pgm)->rbuf);
   free(pgm->cookie);
   pgm->cookie = NULL;
 }
@@ -610,8 +838,12 @@ int flip2_read_memory(struct dfu_dev *dfu,
       }
     }
 
-    read_size = (size > 0x400) ? 0x400 : size;
-    result = flip2_read_max1k(dfu, addr & 0xFFFF, ptr, read_size);
+    read_size = flip2_block_size(dfu, 0);
+    if (read_size > size)
+      read_size = size;
+    if (read_size > 0x10000 - (addr & 0xFFFF))
+      read_size = 0x10000 - (addr & 0xFFFF);
+    result = flip2_read_block(dfu, addr & 0xFFFF, ptr, read_size);
 
     if (result != 0) {
       fprintf(stderr, "%s: Error: Failed to read 0x%04X bytes at 0x%04lX\n",
@@ -627,9 +859,10 @@ int flip2_read_memory(struct dfu_dev *dfu,
   return 0;
 }
 
-int flip2_write_memory(struct dfu_dev *dfu,
+int flip2_write_memory(PROGRAMMER *pgm,
   enum flip2_mem_unit mem_unit, uint32_t addr, const void *ptr, int size)
 {
+  struct dfu_dev *dfu = FLIP2(pgm)->dfu;
   unsigned short prev_page_addr;
   unsigned short page_addr;
   const char * mem_name;
@@ -641,6 +874,12 @@ int flip2_write_memory(struct dfu_dev *dfu,
             "%s: flip_write_memory(%s, 0x%04x, %d)\n",
             progname, flip2_mem_unit_str(mem_unit), addr, size);
 
+  /* whatever was read ahead may be about to change */
+  FLIP2(pgm)->rlen = 0;
+
+  if (flip2_write_wait(pgm) != 0)
+    return -1;
+
   result = flip2_set_mem_unit(dfu, mem_unit);
 
   if (result != 0) {
@@ -667,6 +906,8 @@ int flip2_write_memory(struct dfu_dev *dfu,
     page_addr = addr >> 16;
 
     if (page_addr != prev_page_addr) {
+      if (flip2_write_wait(pgm) != 0)
+        return -1;
       result = flip2_set_mem_page(dfu, page_addr);
       if (result != 0) {
         fprintf(stderr, "%s: Error: Failed to set memory page 0x%04hX\n",
@@ -675,8 +916,12 @@ int flip2_write_memory(struct dfu_dev *dfu,
       }
     }
 
-    write_size = (size > 0x800) ? 0x800 : size;
-    result = flip2_write_max1k(dfu, addr & 0xFFFF, ptr, write_size);
+    write_size = flip2_block_size(dfu, 1);
+    if (write_size > size)
+      write_size = size;
+    if (write_size > 0x10000 - (addr & 0xFFFF))
+      write_size = 0x10000 - (addr & 0xFFFF);
+    result = flip2_write_block(pgm, addr & 0xFFFF, ptr, write_size);
 
     if (result != 0) {
       fprintf(stderr, "%s: Error: Failed to write 0x%04X bytes at 0x%04lX\n",
@@ -692,6 +937,55 @@ int flip2_write_memory(struct dfu_dev *dfu,
   return 0;
 }
 
+/* Send the pages collected by flip2_paged_write_submit(), and wait for the
+ * device to finish programming.
+ */
+
+int flip2_flush(PROGRAMMER *pgm)
+{
+  struct flip2 *flip2 = FLIP2(pgm);
+  int result = 0;
+
+  if (flip2->wlen > 0) {
+    result = flip2_write_memory(pgm, flip2->wunit, flip2->waddr,
+      flip2->wbuf, flip2->wlen);
+    flip2->wlen = 0;
+  }
+
+  if (flip2_write_wait(pgm) != 0)
+    result = -1;
+
+  return result;
+}
+
+/* Wait for the device to finish the block sent last, if it is still busy
+ * with it.
+ */
+
+int flip2_write_wait(PROGRAMMER *pgm)
+{
+  struct flip2 *flip2 = FLIP2(pgm);
+  struct dfu_status status;
+  struct timeval tv;
+  long us;
+
+  if (!flip2->busy)
+    return 0;
+  flip2->busy = 0;
+
+  gettimeofday(&tv, NULL);
+  us = (flip2->busy_until.tv_sec - tv.tv_sec) * 1000000L +
+    (flip2->busy_until.tv_usec - tv.tv_usec);
+  if (us > 0)
+    usleep(us);
+
+  if (dfu_getstatus_done(flip2->dfu, &status) != 0)
+    return -1;
+
+  return flip2_write_status(flip2->dfu, &status,
+    flip2->busy_offset, flip2->busy_size);
+}
+
 int flip2_set_mem_unit(struct dfu_dev *dfu, enum flip2_mem_unit mem_unit)
 {
   struct dfu_status status;
@@ -764,7 +1058,22 @@ int flip2_set_mem_page(struct dfu_dev *dfu,
   return cmd_result;
 }
 
-int flip2_read_max1k(struct dfu_dev *dfu,
+/* How much to read or write in one request: what the DFU functional
+ * descriptor allows, less the padding in front of the data for writes, or
+ * 1 KiB if the device does not say.
+ */
+
+unsigned int flip2_block_size(struct dfu_dev *dfu, int write)
+{
+  unsigned int overhead = write ? 2 * dfu->dev_desc.bMaxPacketSize0 : 0;
+
+  if (dfu->xfer_size <= overhead)
+    return 0x400;
+
+  return dfu->xfer_size - overhead;
+}
+
+int flip2_read_block(struct dfu_dev *dfu,
   unsigned short offset, void *ptr, unsigned short size)
 {
   struct dfu_status status;
@@ -783,11 +1092,11 @@ int flip2_read_max1k(struct dfu_dev *dfu,
   cmd_result = dfu_dnload(dfu, &cmd, sizeof(cmd));
 
   if (cmd_result != 0)
-    goto flip2_read_max1k_status;
+    goto flip2_read_block_status;
 
   cmd_result = dfu_upload(dfu, (char*) ptr, size);
 
-flip2_read_max1k_status:
+flip2_read_block_status:
 
   aux_result = dfu_getstatus(dfu, &status);
 
@@ -809,12 +1118,60 @@ flip2_read_max1k_status:
   return cmd_result;
 }
 
-int flip2_write_max1k(struct dfu_dev *dfu,
+/* A range that is not blank fails the check with BLANK_FAIL; that is an
+ * answer, not an error.
+ */
+
+int flip2_blank_block(struct dfu_dev *dfu,
+  unsigned short offset, unsigned int size)
+{
+  struct dfu_status status;
+  int cmd_result = 0;
+  int aux_result;
+
+  struct flip2_cmd cmd = {
+    FLIP2_CMD_GROUP_UPLOAD, FLIP2_CMD_BLANK_CHECK, { 0, 0, 0, 0 }
+  };
+
+  cmd.args[0] = (offset >> 8) & 0xFF;
+  cmd.args[1] = (offset >> 0) & 0xFF;
+  cmd.args[2] = ((offset+size-1) >> 8) & 0xFF;
+  cmd.args[3] = ((offset+size-1) >> 0) & 0xFF;
+
+  cmd_result = dfu_dnload(dfu, &cmd, sizeof(cmd));
+
+  aux_result = dfu_getstatus(dfu, &status);
+
+  if (aux_result != 0)
+    return -1;
+
+  if (status.bStatus != DFU_STATUS_OK) {
+    dfu_clrstatus(dfu);
+    if (status.bStatus == ((FLIP2_STATUS_BLANK_FAIL >> 8) & 0xFF) &&
+        status.bState == ((FLIP2_STATUS_BLANK_FAIL >> 0) & 0xFF))
+      return 0;
+    fprintf(stderr, "%s: Error: DFU status %s\n", progname,
+      flip2_status_str(&status));
+    return -1;
+  }
+
+  return cmd_result == 0 ? 1 : -1;
+}
+
+/* Send a block to write. If the device reports itself busy programming it,
+ * only note when to ask again; flip2_write_wait() collects the result.
+ */
+
+int flip2_write_block(PROGRAMMER *pgm,
   unsigned short offset, const void *ptr, unsigned short size)
 {
-  char buffer[64+64+0x400];
+  struct flip2 *flip2 = FLIP2(pgm);
+  struct dfu_dev *dfu = flip2->dfu;
+  unsigned char *buffer;
   unsigned short data_offset;
   struct dfu_status status;
+  struct timeval tv;
+  unsigned long ms;
   int cmd_result = 0;
   int aux_result;
 
@@ -827,12 +1184,15 @@ int flip2_write_max1k(struct dfu_dev *dfu,
   cmd.args[2] = ((offset+size-1) >> 8) & 0xFF;
   cmd.args[3] = ((offset+size-1) >> 0) & 0xFF;
 
-  if (size > 0x400) {
-    fprintf(stderr, "%s: Error: Write block too large (%hu > 1024)\n",
-      progname, size);
+  if (size > flip2_block_size(dfu, 1)) {
+    fprintf(stderr, "%s: Error: Write block too large (%hu > %u)\n",
+      progname, size, flip2_block_size(dfu, 1));
     exit(1);
   }
 
+  if (flip2_write_wait(pgm) != 0)
+    return -1;
+
   /* There are some special padding requirements for writes. The first packet
    * must consist only of the FLIP2 command data, which must be padded to
    * fill out the USB packet (the packet size is given by bMaxPacketSize0 in
@@ -844,30 +1204,63 @@ int flip2_write_max1k(struct dfu_dev *dfu,
   data_offset = dfu->dev_desc.bMaxPacketSize0;
   data_offset += offset % dfu->dev_desc.bMaxPacketSize0;
 
+  if ((buffer = malloc(data_offset + size)) == NULL) {
+    fprintf(stderr, "%s: Out of memory allocating write buffer\n", progname);
+    exit(1);
+  }
+
   memcpy(buffer, &cmd, sizeof(cmd));
   memset(buffer + sizeof(cmd), 0, data_offset - sizeof(cmd));
   memcpy(buffer + data_offset, ptr, size);
 
   cmd_result = dfu_dnload(dfu, buffer, data_offset + size);
+  free(buffer);
 
   aux_result = dfu_getstatus(dfu, &status);
 
   if (aux_result != 0)
     return aux_result;
 
-  if (status.bStatus != DFU_STATUS_OK) {
-    if (status.bStatus == ((FLIP2_STATUS_OUTOFRANGE >> 8) & 0xFF) &&
-        status.bState == ((FLIP2_STATUS_OUTOFRANGE >> 0) & 0xFF))
+  if (status.bStatus == DFU_STATUS_OK &&
+      status.bState == DFU_STATE_DFU_DNBUSY) {
+    ms = dfu_poll_timeout(&status);
+    gettimeofday(&tv, NULL);
+    tv.tv_sec += ms / 1000;
+    tv.tv_usec += (ms % 1000) * 1000;
+    if (tv.tv_usec >= 1000000) {
+      tv.tv_sec++;
+      tv.tv_usec -= 1000000;
+    }
+    flip2->busy = 1;
+    flip2->busy_until = tv;
+    flip2->busy_offset = offset;
+    flip2->busy_size = size;
+    return cmd_result;
+  }
+
+  if (flip2_write_status(dfu, &status, offset, size) != 0)
+    return -1;
+
+  return cmd_result;
+}
+
+int flip2_write_status(struct dfu_dev *dfu, const struct dfu_status *status,
+  unsigned short offset, unsigned short size)
+{
+  if (status->bStatus != DFU_STATUS_OK) {
+    if (status->bStatus == ((FLIP2_STATUS_OUTOFRANGE >> 8) & 0xFF) &&
+        status->bState == ((FLIP2_STATUS_OUTOFRANGE >> 0) & 0xFF))
     {
       fprintf(stderr, "%s: Error: Address out of range [0x%04hX,0x%04hX]\n",
         progname, offset, offset+size-1);
     } else
       fprintf(stderr, "%s: Error: DFU status %s\n", progname,
-        flip2_status_str(&status));
+        flip2_status_str(status));
     dfu_clrstatus(dfu);
+    return -1;
   }
 
-  return cmd_result;
+  return 0;
 }
 
 const char * flip2_status_str(const struct dfu_status *status)
@@ -127,91 +127,197 @@ void ft245r_initpgm(PROGRAMMER * pgm) {
 
 #include <pthread.h>
 
-#ifdef __APPLE__
-/* Mac OS X defines sem_init but actually does not implement them */
-#include <dispatch/dispatch.h>
-
-typedef dispatch_semaphore_t	sem_t;
-
-#define sem_init(psem,x,val)	*psem = dispatch_semaphore_create(val)
-#define sem_post(psem)		dispatch_semaphore_signal(*psem)
-#define sem_wait(psem)		dispatch_semaphore_wait(*psem, DISPATCH_TIME_FOREVER)
-#else
-#include <semaphore.h>
-#endif
-
 #define FT245R_CYCLES	2
 #define FT245R_FRAGMENT_SIZE  512
+/* commands of four bytes fitting into a fragment */
+#define FT245R_FRAGMENT_CMDS  (FT245R_FRAGMENT_SIZE/8/FT245R_CYCLES/4)
+/* room for a fragment plus two extra commands and the final sck */
+#define FT245R_REQ_SIZE       (FT245R_FRAGMENT_SIZE+1+128)
 #define REQ_OUTSTANDINGS	10
-//#define USE_INLINE_WRITE_PAGE
+/* all outstanding requests must fit into the receive ring */
+#define REQ_MAX			64
+/* targets sharing SCK, MOSI and RESET, each on its own MISO (-x miso) */
+#define FT245R_TARGETS		4
 
 #define FT245R_DEBUG	0
 
-static struct ftdi_context *handle;
+/* size of the receive ring, must be a power of two */
+#define BUFSIZE 0x10000
+/* give up when no data arrives for that many milliseconds */
+#define FT245R_RECV_TIMEOUT 5000
 
-static unsigned char ft245r_ddr;
-static unsigned char ft245r_out;
-static unsigned char ft245r_in;
+/*
+ * Fragments sent but not yet read back.  The queue is a fixed ring of
+ * up to reqs entries, the depth of the pipeline.
+ */
+struct ft245r_request {
+    int addr;
+    int bytes;
+    int skip;   /* commands in front of the data (load extended address) */
+    int n;      /* data bytes to extract */
+    int verify; /* compare them with the buffer rather than store them */
+};
 
-#define BUFSIZE 0x2000
+/*
+ * Private data for this programmer.
+ *
+ * The reader thread is the only one to advance head, ft245r_recv()
+ * the only one to advance tail, so the ring itself needs no lock.
+ * Both are free running counters, head - tail is the number of bytes
+ * in the ring.  The mutex and the condition variable are only used
+ * to sleep while the ring is empty (or full) and are touched once per
+ * chunk, not per byte.
+ */
+struct pdata
+{
+    struct ftdi_context *handle;
+
+    unsigned char ddr;
+    unsigned char out;
+    unsigned char in;
+
+    pthread_t readerthread;
+    pthread_mutex_t buf_mutex;
+    pthread_cond_t buf_cond;
+    unsigned char buffer[BUFSIZE];
+    unsigned int head, tail;
+    int reader_waiting;
+
+    struct ft245r_request req_queue[REQ_MAX];
+    int req_first, req_count;
+    int reqs;                   /* -x reqs */
+
+    int ntargets;               /* 1 + the extra MISO bits of -x miso */
+    unsigned char miso[FT245R_TARGETS]; /* their masks, [0] is PIN_AVR_MISO */
+
+    /* built by ft245r_build_tables() from the pin mapping at open time */
+    unsigned char sck_mosi;     /* the output bits set_data() drives */
+    unsigned char tx[256][8 * FT245R_CYCLES]; /* their samples for a byte */
+    unsigned char rx[256];      /* bit t: MISO of target t in a sample */
+
+    /* per target */
+    int verify_bad[FT245R_TARGETS]; /* bytes found different by paged_verify */
+    int verify_addr[FT245R_TARGETS]; /* the first of them */
+    unsigned char verify_got[FT245R_TARGETS], verify_want[FT245R_TARGETS];
+};
+
+#define PDATA(pgm) ((struct pdata *)(pgm->cookie))
 
 // libftdi / libftd2xx compatibility functions.
 
-static pthread_t readerthread;
-static sem_t buf_data, buf_space;
-static unsigned char buffer[BUFSIZE];
-static int head, tail;
+#define ring_load(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ring_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
 
-static void add_to_buf (unsigned char c) {
-    int nh;
+static void ring_wakeup (struct pdata *pd) {
+    pthread_mutex_lock (&pd->buf_mutex);
+    pthread_cond_broadcast (&pd->buf_cond);
+    pthread_mutex_unlock (&pd->buf_mutex);
+}
 
-    sem_wait (&buf_space);
-    if (head == (BUFSIZE -1)) nh = 0;
-    else                      nh = head + 1;
+static void ring_unlock (void *arg) {
+    pthread_mutex_unlock (&((struct pdata *)arg)->buf_mutex);
+}
 
-    if (nh == tail) {
-        fprintf (stderr, "buffer overflow. Cannot happen!\n");
-        //exit (1);
+static void add_to_buf (struct pdata *pd, const unsigned char *buf, int len) {
+    unsigned int h, n, k;
+
+    while (len > 0) {
+        h = pd->head;
+        n = BUFSIZE - (h - ring_load (&pd->tail));
+        if (n == 0) {
+            // the consumer lags behind, wait until it makes room
+            pthread_mutex_lock (&pd->buf_mutex);
+            pthread_cleanup_push (ring_unlock, pd);
+            __atomic_store_n (&pd->reader_waiting, 1, __ATOMIC_SEQ_CST);
+            while (h - __atomic_load_n (&pd->tail, __ATOMIC_SEQ_CST) == BUFSIZE)
+                pthread_cond_wait (&pd->buf_cond, &pd->buf_mutex);
+            pd->reader_waiting = 0;
+            pthread_cleanup_pop (1);
+            continue;
+        }
+        if (n > len) n = len;
+        k = BUFSIZE - (h & (BUFSIZE - 1));
+        if (k > n) k = n;
+        memcpy (pd->buffer + (h & (BUFSIZE - 1)), buf, k);
+        memcpy (pd->buffer, buf + k, n - k);
+        ring_store (&pd->head, h + n);
+        buf += n;
+        len -= n;
+        ring_wakeup (pd);
     }
-    buffer[head] = c;
-    head = nh;
-    sem_post (&buf_data);
 }
 
 static void *reader (void *arg) {
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
+    struct pdata *pd = (struct pdata *)(arg);
     unsigned char buf[0x1000];
-    int br, i;
+    int br;
 
     while (1) {
         pthread_testcancel();
-        br = ftdi_read_data (handle, buf, sizeof(buf));
-        for (i=0; i<br; i++)
-            add_to_buf (buf[i]);
+        br = ftdi_read_data (pd->handle, buf, sizeof(buf));
+        if (br > 0)
+            add_to_buf (pd, buf, br);
     }
     return NULL;
 }
 
+/* discard everything received so far */
+static void ft245r_flush_buf (PROGRAMMER * pgm) {
+    struct pdata *pd = PDATA(pgm);
+
+    __atomic_store_n (&pd->tail, ring_load (&pd->head), __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&pd->reader_waiting, __ATOMIC_SEQ_CST))
+        ring_wakeup (pd);
+}
+
 static int ft245r_send(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
     int rv;
 
-    rv = ftdi_write_data(handle, buf, len);
+    rv = ftdi_write_data(PDATA(pgm)->handle, buf, len);
     if (len != rv) return -1;
     return 0;
 }
 
 static int ft245r_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
-    int i;
+    struct pdata *pd = PDATA(pgm);
+    unsigned int t, n, k;
+    struct timeval tv;
+    struct timespec deadline;
+    int rv;
 
     // Copy over data from the circular buffer..
-    // XXX This should timeout, and return error if there isn't enough
-    // data.
-    for (i=0; i<len; i++) {
-        sem_wait (&buf_data);
-        buf[i] = buffer[tail];
-        if (tail == (BUFSIZE -1)) tail = 0;
-        else                      tail++;
-        sem_post (&buf_space);
+    while (len > 0) {
+        t = pd->tail;
+        n = ring_load (&pd->head) - t;
+        if (n == 0) {
+            gettimeofday (&tv, NULL);
+            tv.tv_usec += (FT245R_RECV_TIMEOUT % 1000) * 1000;
+            deadline.tv_sec = tv.tv_sec + FT245R_RECV_TIMEOUT / 1000 +
+                tv.tv_usec / 1000000;
+            deadline.tv_nsec = (tv.tv_usec % 1000000) * 1000;
+
+            rv = 0;
+            pthread_mutex_lock (&pd->buf_mutex);
+            while (ring_load (&pd->head) == t && rv == 0)
+                rv = pthread_cond_timedwait (&pd->buf_cond, &pd->buf_mutex, &deadline);
+            pthread_mutex_unlock (&pd->buf_mutex);
+            if (ring_load (&pd->head) == t) {
+                fprintf(stderr, "%s: ft245r_recv(): timeout, %u bytes missing\n",
+                        progname, (unsigned int)len);
+                return -1;
+            }
+            continue;
+        }
+        if (n > len) n = len;
+        k = BUFSIZE - (t & (BUFSIZE - 1));
+        if (k > n) k = n;
+        memcpy (buf, pd->buffer + (t & (BUFSIZE - 1)), k);
+        memcpy (buf + k, pd->buffer, n - k);
+        __atomic_store_n (&pd->tail, t + n, __ATOMIC_SEQ_CST);
+        buf += n;
+        len -= n;
+        if (__atomic_load_n (&pd->reader_waiting, __ATOMIC_SEQ_CST))
+            ring_wakeup (pd);
     }
 
     return 0;
@@ -220,18 +326,15 @@ static int ft245r_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
 
 static int ft245r_drain(PROGRAMMER * pgm, int display) {
     int r;
-    unsigned char t;
 
     // flush the buffer in the chip by changing the mode.....
-    r = ftdi_set_bitmode(handle, 0, BITMODE_RESET); 	// reset
+    r = ftdi_set_bitmode(PDATA(pgm)->handle, 0, BITMODE_RESET); 	// reset
     if (r) return -1;
-    r = ftdi_set_bitmode(handle, ft245r_ddr, BITMODE_SYNCBB); // set Synchronuse BitBang
+    r = ftdi_set_bitmode(PDATA(pgm)->handle, PDATA(pgm)->ddr, BITMODE_SYNCBB); // set Synchronuse BitBang
     if (r) return -1;
 
     // drain our buffer.
-    while (head != tail) {
-        ft245r_recv (pgm, &t, 1);
-    }
+    ft245r_flush_buf (pgm);
     return 0;
 }
 
@@ -248,7 +351,7 @@ static int ft245r_chip_erase(PROGRAMMER * pgm, AVRPART * p) {
 
     avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
     pgm->cmd(pgm, cmd, res);
-    usleep(p->chip_erase_delay);
+    avr_wait_ready(pgm, p, p->chip_erase_delay);
     return pgm->initialize(pgm, p);
 }
 
@@ -270,10 +373,10 @@ static int ft245r_set_bitclock(PROGRAMMER * pgm) {
         fprintf(stderr," ft245r:  spi bitclk %d -> ft baudrate %d\n",
                 rate / 2, rate);
     }
-    r = ftdi_set_baudrate(handle, rate);
+    r = ftdi_set_baudrate(PDATA(pgm)->handle, rate);
     if (r) {
         fprintf(stderr, "Set baudrate (%d) failed with error '%s'.\n",
-                rate, ftdi_get_error_string (handle));
+                rate, ftdi_get_error_string (PDATA(pgm)->handle));
         return -1;
     }
     return 0;
@@ -287,13 +390,13 @@ static int set_pin(PROGRAMMER * pgm, int pinname, int val) {
         return 0;
     }
 
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,pinname,val);
-    buf[0] = ft245r_out;
+    PDATA(pgm)->out = SET_BITS_0(PDATA(pgm)->out,pgm,pinname,val);
+    buf[0] = PDATA(pgm)->out;
 
     ft245r_send (pgm, buf, 1);
     ft245r_recv (pgm, buf, 1);
 
-    ft245r_in = buf[0];
+    PDATA(pgm)->in = buf[0];
     return 0;
 }
 
@@ -388,9 +491,8 @@ static int ft245r_program_enable(PROGRAMMER * pgm, AVRPART * p) {
     avr_set_bits(p->op[AVR_OP_PGM_ENABLE], cmd);
 
     for(i = 0; i < 4; i++) {
-        ft245r_cmd(pgm, cmd, res);
-
-        if (res[p->pollindex-1] == p->pollvalue) return 0;
+        if (ft245r_cmd(pgm, cmd, res) == 0 &&
+            res[p->pollindex-1] == p->pollvalue) return 0;
 
         if ((verbose>=1) || FT245R_DEBUG) {
             fprintf(stderr,
@@ -403,7 +505,7 @@ static int ft245r_program_enable(PROGRAMMER * pgm, AVRPART * p) {
 
         if (i == 3) {
             ft245r_drain(pgm, 0);
-            tail = head;
+            ft245r_flush_buf (pgm);
         }
     }
 
@@ -431,60 +533,92 @@ static int ft245r_initialize(PROGRAMMER * pgm, AVRPART * p) {
     return ft245r_program_enable(pgm, p);
 }
 
+/* bit of PDATA(pgm)->rx[] for MOSI, above those of the targets */
+#define FT245R_RX_MOSI 7
+
+/*
+ * Precompute the SCK and MOSI samples that shift out each byte value,
+ * and what each input sample holds on MISO, so that set_data() and
+ * extract_data() need not go through the pin mapping bit by bit.
+ */
+static void ft245r_build_tables(PROGRAMMER * pgm) {
+    struct pdata *pd = PDATA(pgm);
+    unsigned char out;
+    int data, j, t, s;
+
+    pd->sck_mosi = pgm->pin[PIN_AVR_SCK].mask[0] | pgm->pin[PIN_AVR_MOSI].mask[0];
+    for (data = 0; data < 256; data++) {
+        out = 0;
+        for (j = 0; j < 8; j++) {
+            out = SET_BITS_0(out,pgm,PIN_AVR_MOSI,data & (0x80 >> j));
+            out = SET_BITS_0(out,pgm,PIN_AVR_SCK,0);
+            pd->tx[data][j * FT245R_CYCLES] = out & pd->sck_mosi;
+            out = SET_BITS_0(out,pgm,PIN_AVR_SCK,1);
+            pd->tx[data][j * FT245R_CYCLES + 1] = out & pd->sck_mosi;
+        }
+    }
+    for (s = 0; s < 256; s++) {
+        pd->rx[s] = GET_BITS_0(s,pgm,PIN_AVR_MISO)? 1: 0;
+        for (t = 1; t < pd->ntargets; t++)
+            if (s & pd->miso[t])
+                pd->rx[s] |= 1 << t;
+        if (GET_BITS_0(s,pgm,PIN_AVR_MOSI))
+            pd->rx[s] |= 1 << FT245R_RX_MOSI;
+    }
+}
+
 static inline int set_data(PROGRAMMER * pgm, unsigned char *buf, unsigned char data) {
+    struct pdata *pd = PDATA(pgm);
+    unsigned char base = pd->out & ~pd->sck_mosi;
     int j;
-    int buf_pos = 0;
-    unsigned char bit = 0x80;
-
-    for (j=0; j<8; j++) {
-        ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_MOSI,data & bit);
 
-        ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0);
-        buf[buf_pos] = ft245r_out;
-        buf_pos++;
+    for (j = 0; j < 8 * FT245R_CYCLES; j++)
+        buf[j] = base | pd->tx[data][j];
+    pd->out = buf[8 * FT245R_CYCLES - 1];
+    return 8 * FT245R_CYCLES;
+}
 
-        ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,1);
-        buf[buf_pos] = ft245r_out;
-        buf_pos++;
+/* collect bit 'bit' of the rx[] entries of the samples where SCK rises */
+static inline unsigned char extract_bits(PROGRAMMER * pgm, unsigned char *buf,
+                                         int offset, int bit) {
+    const unsigned char *rx = PDATA(pgm)->rx;
+    unsigned char r = 0;
+    int j;
 
-        bit >>= 1;
-    }
-    return buf_pos;
+    buf += offset * (8 * FT245R_CYCLES) + 1;
+    for (j = 0; j < 8; j++)
+        r = (r << 1) | ((rx[buf[j * FT245R_CYCLES]] >> bit) & 1);
+    return r;
 }
 
 static inline unsigned char extract_data(PROGRAMMER * pgm, unsigned char *buf, int offset) {
-    int j;
-    int buf_pos = 1;
-    unsigned char bit = 0x80;
-    unsigned char r = 0;
+    return extract_bits(pgm, buf, offset, 0);
+}
 
-    buf += offset * (8 * FT245R_CYCLES);
-    for (j=0; j<8; j++) {
-        if (GET_BITS_0(buf[buf_pos],pgm,PIN_AVR_MISO)) {
-            r |= bit;
-        }
-        buf_pos += FT245R_CYCLES;
-        bit >>= 1;
-    }
-    return r;
+/* the same for target t of a gang, target 0 being PIN_AVR_MISO */
+static inline unsigned char extract_target(PROGRAMMER * pgm, unsigned char *buf,
+                                           int offset, int t) {
+    return extract_bits(pgm, buf, offset, t);
+}
+
+/*
+ * Check that every other target of a gang shifted out the same n
+ * bytes as target 0 (res); returns the first one that did not, or 0.
+ */
+static int other_target(PROGRAMMER * pgm, unsigned char *buf, int offset,
+                        const unsigned char *res, int n) {
+    int t, i;
+
+    for (t = 1; t < PDATA(pgm)->ntargets; t++)
+        for (i = 0; i < n; i++)
+            if (extract_target(pgm, buf, offset + i, t) != res[i])
+                return t;
+    return 0;
 }
 
 /* to check data */
 static inline unsigned char extract_data_out(PROGRAMMER * pgm, unsigned char *buf, int offset) {
-    int j;
-    int buf_pos = 1;
-    unsigned char bit = 0x80;
-    unsigned char r = 0;
-
-    buf += offset * (8 * FT245R_CYCLES);
-    for (j=0; j<8; j++) {
-        if (GET_BITS_0(buf[buf_pos],pgm,PIN_AVR_MOSI)) {
-            r |= bit;
-        }
-        buf_pos += FT245R_CYCLES;
-        bit >>= 1;
-    }
-    return r;
+    return extract_bits(pgm, buf, offset, FT245R_RX_MOSI);
 }
 
 
@@ -511,6 +645,15 @@ static int ft245r_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
     res[2] = extract_data(pgm, buf, 2);
     res[3] = extract_data(pgm, buf, 3);
 
+    i = other_target(pgm, buf, 0, res, 4);
+    if (i) {
+        fprintf(stderr,
+                "%s: target %d does not answer like target 0 "
+                "(%02x %02x %02x %02x)\n",
+                progname, i, res[0], res[1], res[2], res[3]);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -526,7 +669,8 @@ static const struct pin_checklist_t pin_checklist[] = {
 };
 
 static int ft245r_open(PROGRAMMER * pgm, char * port) {
-    int rv;
+    struct pdata *pd = PDATA(pgm);
+    int rv, i;
     int devnum = -1;
 
     rv = pins_check(pgm,pin_checklist,sizeof(pin_checklist)/sizeof(pin_checklist[0]), true);
@@ -556,8 +700,8 @@ static int ft245r_open(PROGRAMMER * pgm, char * port) {
         devnum = 0;
     }
 
-    handle = malloc (sizeof (struct ftdi_context));
-    ftdi_init(handle);
+    pd->handle = malloc (sizeof (struct ftdi_context));
+    ftdi_init(pd->handle);
     LNODEID usbpid = lfirst(pgm->usbpid);
     int pid;
     if (usbpid) {
@@ -569,18 +713,19 @@ static int ft245r_open(PROGRAMMER * pgm, char * port) {
     } else {
       pid = USB_DEVICE_FT245;
     }
-    rv = ftdi_usb_open_desc_index(handle,
+    rv = ftdi_usb_open_desc_index(pd->handle,
                                   pgm->usbvid?pgm->usbvid:USB_VENDOR_FTDI,
                                   pid,
                                   pgm->usbproduct[0]?pgm->usbproduct:NULL,
                                   pgm->usbsn[0]?pgm->usbsn:NULL,
                                   devnum);
     if (rv) {
-        fprintf (stderr, "can't open ftdi device %d. (%s)\n", devnum, ftdi_get_error_string(handle));
+        fprintf (stderr, "can't open ftdi device %d. (%s)\n", devnum, ftdi_get_error_string(pd->handle));
         goto cleanup_no_usb;
     }
 
-    ft245r_ddr = 
+    pd->miso[0] = pgm->pin[PIN_AVR_MISO].mask[0];
+    pd->ddr = 
          pgm->pin[PIN_AVR_SCK].mask[0]
        | pgm->pin[PIN_AVR_MOSI].mask[0]
        | pgm->pin[PIN_AVR_RESET].mask[0]
@@ -590,25 +735,36 @@ static int ft245r_open(PROGRAMMER * pgm, char * port) {
        | pgm->pin[PIN_LED_RDY].mask[0]
        | pgm->pin[PIN_LED_PGM].mask[0]
        | pgm->pin[PIN_LED_VFY].mask[0];
+    rv = pd->miso[0];
+    for (i = 1; i < pd->ntargets; i++) {
+        if (pd->miso[i] & (pd->ddr | rv)) {
+            fprintf(stderr,
+                    "%s: MISO of target %d is on an output or another MISO bit\n",
+                    progname, i);
+            goto cleanup;
+        }
+        rv |= pd->miso[i];
+    }
+    ft245r_build_tables(pgm);
 
     /* set initial values for outputs, no reset everything else is off */
-    ft245r_out = 0;
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_RESET,1);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_MOSI,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PPI_AVR_BUFF,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PPI_AVR_VCC,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_LED_ERR,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_LED_RDY,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_LED_PGM,0);
-    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_LED_VFY,0);
-
-
-    rv = ftdi_set_bitmode(handle, ft245r_ddr, BITMODE_SYNCBB); // set Synchronous BitBang
+    pd->out = 0;
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_AVR_RESET,1);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_AVR_SCK,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_AVR_MOSI,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PPI_AVR_BUFF,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PPI_AVR_VCC,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_LED_ERR,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_LED_RDY,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_LED_PGM,0);
+    pd->out = SET_BITS_0(pd->out,pgm,PIN_LED_VFY,0);
+
+
+    rv = ftdi_set_bitmode(pd->handle, pd->ddr, BITMODE_SYNCBB); // set Synchronous BitBang
     if (rv) {
         fprintf(stderr,
                 "%s: Synchronous BitBangMode is not supported (%s)\n",
-                progname, ftdi_get_error_string(handle));
+                progname, ftdi_get_error_string(pd->handle));
         goto cleanup;
     }
 
@@ -622,300 +778,495 @@ static int ft245r_open(PROGRAMMER * pgm, char * port) {
      * writing because the ftdi cannot send the results because we
      * haven't provided a read buffer yet. */
 
-    sem_init (&buf_data, 0, 0);
-    sem_init (&buf_space, 0, BUFSIZE);
-    pthread_create (&readerthread, NULL, reader, handle);
+    pd->head = pd->tail = 0;
+    pd->reader_waiting = 0;
+    pthread_create (&pd->readerthread, NULL, reader, pd);
 
     /*
      * drain any extraneous input
      */
     ft245r_drain (pgm, 0);
 
-    ft245r_send (pgm, &ft245r_out, 1);
-    ft245r_recv (pgm, &ft245r_in, 1);
+    ft245r_send (pgm, &pd->out, 1);
+    ft245r_recv (pgm, &pd->in, 1);
 
     return 0;
 
 cleanup:
-    ftdi_usb_close(handle);
+    ftdi_usb_close(pd->handle);
 cleanup_no_usb:
-    ftdi_deinit (handle);
-    free(handle);
-    handle = NULL;
+    ftdi_deinit (pd->handle);
+    free(pd->handle);
+    pd->handle = NULL;
     return -1;
 }
 
 
 static void ft245r_close(PROGRAMMER * pgm) {
-    if (handle) {
+    struct pdata *pd = PDATA(pgm);
+
+    if (pd->handle) {
         // I think the switch to BB mode and back flushes the buffer.
-        ftdi_set_bitmode(handle, 0, BITMODE_SYNCBB); // set Synchronous BitBang, all in puts
-        ftdi_set_bitmode(handle, 0, BITMODE_RESET); // disable Synchronous BitBang
-        pthread_cancel(readerthread);
-        pthread_join(readerthread, NULL);
-        ftdi_usb_close(handle);
-        ftdi_deinit (handle); // TODO this works with libftdi 0.20, but hangs with 1.0
-        free(handle);
-        handle = NULL;
+        ftdi_set_bitmode(pd->handle, 0, BITMODE_SYNCBB); // set Synchronous BitBang, all in puts
+        ftdi_set_bitmode(pd->handle, 0, BITMODE_RESET); // disable Synchronous BitBang
+        pthread_cancel(pd->readerthread);
+        pthread_join(pd->readerthread, NULL);
+        ftdi_usb_close(pd->handle);
+        ftdi_deinit (pd->handle); // TODO this works with libftdi 0.20, but hangs with 1.0
+        free(pd->handle);
+        pd->handle = NULL;
     }
 }
 
 static void ft245r_display(PROGRAMMER * pgm, const char * p) {
+    int t, bit;
+
     fprintf(stderr, "%sPin assignment  : 0..7 = DBUS0..7\n",p);/* , 8..11 = GPIO0..3\n",p);*/
     pgm_display_generic_mask(pgm, p, SHOW_ALL_PINS);
+    /* the extra MISO bits of a gang */
+    for (t = 1; t < PDATA(pgm)->ntargets; t++) {
+        for (bit = 0; !(PDATA(pgm)->miso[t] & (1 << bit)); bit++)
+            ;
+        fprintf(stderr, "%s  MISO %d  = %d\n", p, t, bit);
+    }
 }
 
-static int ft245r_paged_write_gen(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                  unsigned int page_size, unsigned int addr,
-                                  unsigned int n_bytes) {
-    unsigned long i, pa;
-    int rc;
+/* the command for reading addr, using the word address if needed */
+static OPCODE *ft245r_read_op(AVRMEM *m, unsigned long addr, unsigned long *caddr) {
+    if (m->op[AVR_OP_READ_LO]) {
+        *caddr = addr / 2;
+        return m->op[(addr & 1)? AVR_OP_READ_HI: AVR_OP_READ_LO];
+    }
+    *caddr = addr;
+    return m->op[AVR_OP_READ];
+}
 
-    for (i=0; i<n_bytes; i++, addr++) {
-        rc = avr_write_byte_default(pgm, p, m, addr, m->buf[addr]);
-        if (rc != 0) {
-            return -2;
-        }
+static int set_cmd(PROGRAMMER * pgm, unsigned char *buf, OPCODE *op,
+                   unsigned long addr, unsigned char data) {
+    unsigned char cmd[4];
+    int i, buf_pos = 0;
+
+    memset(cmd, 0, sizeof(cmd));
+    avr_set_bits(op, cmd);
+    avr_set_addr(op, cmd, addr);
+    avr_set_input(op, cmd, data);
+    for (i=0; i<4; i++)
+        buf_pos += set_data(pgm, buf+buf_pos, cmd[i]);
+    return buf_pos;
+}
 
-        if (m->paged) {
-            // Can this piece of code ever be activated?? Do AVRs exist that
-            // have paged non-flash memories? -- REW
-            // XXX Untested code below.
-            /*
-             * check to see if it is time to flush the page with a page
-             * write
-             */
-
-            if (((addr % m->page_size) == m->page_size-1) || (i == n_bytes-1)) {
-                pa = addr - (addr % m->page_size);
-
-                rc = avr_write_page(pgm, p, m, pa);
-                if (rc != 0) {
-                    return -2;
+static int do_request(PROGRAMMER * pgm, AVRMEM *m) {
+    struct pdata *pd = PDATA(pgm);
+    struct ft245r_request *p;
+    unsigned char buf[FT245R_REQ_SIZE];
+    unsigned char res[4], data;
+    unsigned long caddr;
+    OPCODE *op;
+    int addr, j, k, t, rv;
+
+    if (!pd->req_count) return 0;
+    p = &pd->req_queue[pd->req_first];
+    pd->req_first = (pd->req_first + 1) % REQ_MAX;
+    pd->req_count--;
+
+    rv = ft245r_recv(pgm, buf, p->bytes);
+    addr = p->addr;
+    for (j=0; j<p->n; j++, addr++) {
+        op = ft245r_read_op(m, addr, &caddr);
+        for (t=0; t<pd->ntargets; t++) {
+            for (k=0; k<4; k++)
+                res[k] = extract_target(pgm, buf, (p->skip + j) * 4 + k, t);
+            data = 0;
+            avr_get_output(op, res, &data);
+            if (!p->verify) {
+                /* the image is target 0, a gang must agree on it */
+                if (t == 0) {
+                    m->buf[addr] = data;
+                } else if (data != m->buf[addr] && rv >= 0) {
+                    fprintf(stderr,
+                            "%s: target %d reads 0x%02x at byte 0x%04x, "
+                            "target 0 0x%02x\n",
+                            progname, t, data, addr, m->buf[addr]);
+                    rv = -1;
                 }
+                continue;
+            }
+            if (avr_mem_tagged(m, addr) && data != m->buf[addr] &&
+                pd->verify_bad[t]++ == 0) {
+                pd->verify_addr[t] = addr;
+                pd->verify_got[t] = data;
+                pd->verify_want[t] = m->buf[addr];
             }
         }
     }
-    return i;
+    return rv < 0? -1: 1;
 }
 
-static struct ft245r_request {
-    int addr;
-    int bytes;
-    int n;
-    struct ft245r_request *next;
-} *req_head,*req_tail,*req_pool;
-
-static void put_request(int addr, int bytes, int n) {
+/*
+ * Send a fragment, keeping at most reqs of them in flight;
+ * returns -1 if reading back an earlier one failed.
+ */
+static int put_request(PROGRAMMER * pgm, AVRMEM *m, unsigned char *buf,
+                       int bytes, int addr, int skip, int n, int verify) {
+    struct pdata *pd = PDATA(pgm);
     struct ft245r_request *p;
-    if (req_pool) {
-        p = req_pool;
-        req_pool = p->next;
-    } else {
-        p = malloc(sizeof(struct ft245r_request));
-        if (!p) {
-            fprintf(stderr, "can't alloc memory\n");
-            exit(1);
-        }
-    }
-    memset(p, 0, sizeof(struct ft245r_request));
+
+    while (pd->req_count >= pd->reqs)
+        if (do_request(pgm, m) < 0)
+            return -1;
+
+    ft245r_send(pgm, buf, bytes);
+    p = &pd->req_queue[(pd->req_first + pd->req_count) % REQ_MAX];
+    pd->req_count++;
     p->addr = addr;
     p->bytes = bytes;
+    p->skip = skip;
     p->n = n;
-    if (req_tail) {
-        req_tail->next = p;
-        req_tail = p;
-    } else {
-        req_head = req_tail = p;
-    }
+    p->verify = verify;
+    return 0;
 }
 
-static int do_request(PROGRAMMER * pgm, AVRMEM *m) {
-    struct ft245r_request *p;
-    int addr, bytes, j, n;
-    unsigned char buf[FT245R_FRAGMENT_SIZE+1+128];
-
-    if (!req_head) return 0;
-    p = req_head;
-    req_head = p->next;
-    if (!req_head) req_tail = req_head;
+/* read back everything in flight */
+static int flush_requests(PROGRAMMER * pgm, AVRMEM *m) {
+    int rv = 0, r;
 
-    addr = p->addr;
-    bytes = p->bytes;
-    n = p->n;
-    memset(p, 0, sizeof(struct ft245r_request));
-    p->next = req_pool;
-    req_pool = p;
+    while ((r = do_request(pgm, m)) != 0)
+        if (r < 0)
+            rv = -1;
+    return rv;
+}
 
-    ft245r_recv(pgm, buf, bytes);
-    for (j=0; j<n; j++) {
-        m->buf[addr++] = extract_data(pgm, buf , (j * 4 + 3));
+/*
+ * transmit count bytes of AVR device commands and store the bytes
+ * shifted in at res, keeping up to reqs fragments in flight
+ */
+#define FT245R_FRAGMENT_BYTES (FT245R_FRAGMENT_CMDS * 4)
+
+static int ft245r_spi(PROGRAMMER * pgm, const unsigned char *cmd,
+                      unsigned char *res, int count) {
+    unsigned char buf[FT245R_REQ_SIZE];
+    int sent, rcvd, buf_pos, n, i;
+
+    for (sent = rcvd = 0; rcvd < count; ) {
+        if (sent < count &&
+            sent - rcvd < PDATA(pgm)->reqs * FT245R_FRAGMENT_BYTES) {
+            n = count - sent;
+            if (n > FT245R_FRAGMENT_BYTES) n = FT245R_FRAGMENT_BYTES;
+            buf_pos = 0;
+            for (i=0; i<n; i++) {
+                buf_pos += set_data(pgm, buf+buf_pos, cmd[sent+i]);
+            }
+            if (sent + n >= count) {
+                PDATA(pgm)->out = SET_BITS_0(PDATA(pgm)->out,pgm,PIN_AVR_SCK,0); // sck down
+                buf[buf_pos++] = PDATA(pgm)->out;
+            }
+            if (ft245r_send(pgm, buf, buf_pos) < 0) return -1;
+            sent += n;
+        } else {
+            n = count - rcvd;
+            if (n > FT245R_FRAGMENT_BYTES) n = FT245R_FRAGMENT_BYTES;
+            buf_pos = n * 8 * FT245R_CYCLES + (rcvd + n >= count);
+            if (ft245r_recv(pgm, buf, buf_pos) < 0) return -1;
+            for (i=0; i<n; i++) {
+                res[rcvd+i] = extract_data(pgm, buf, i);
+            }
+            i = other_target(pgm, buf, 0, res + rcvd, n);
+            if (i) {
+                fprintf(stderr,
+                        "%s: target %d does not answer like target 0\n",
+                        progname, i);
+                return -1;
+            }
+            rcvd += n;
+        }
     }
-    return 1;
+    return count;
 }
 
-static int ft245r_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                    int page_size, int addr, int n_bytes) {
-    unsigned int    i,j;
-    int addr_save,buf_pos,do_page_write,req_count;
-    unsigned char buf[FT245R_FRAGMENT_SIZE+1+128];
-
-    req_count = 0;
+/*
+ * Stream the page loads of a paged memory.  The page write command
+ * (and the extended address it needs) goes into the same fragment as
+ * the last bytes of the page, so only the write delay is waited for.
+ */
+static int ft245r_paged_write_stream(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                     unsigned int page_size, unsigned int addr,
+                                     unsigned int n_bytes) {
+    unsigned int i, j;
+    unsigned long caddr;
+    int addr_save, buf_pos, do_page_write, word, pa;
+    unsigned char buf[FT245R_REQ_SIZE];
+    OPCODE *op;
+
+    /* flash is loaded by words, a paged eeprom by bytes */
+    word = m->op[AVR_OP_LOADPAGE_HI] != NULL;
     for (i=0; i<n_bytes; ) {
         addr_save = addr;
         buf_pos = 0;
         do_page_write = 0;
-        for (j=0; j< FT245R_FRAGMENT_SIZE/8/FT245R_CYCLES/4; j++) {
-            buf_pos += set_data(pgm, buf+buf_pos, (addr & 1)?0x48:0x40 );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 9) & 0xff );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 1) & 0xff );
-            buf_pos += set_data(pgm, buf+buf_pos, m->buf[addr]);
+        for (j=0; j<FT245R_FRAGMENT_CMDS; j++) {
+            if (word) {
+                op = m->op[(addr & 1)? AVR_OP_LOADPAGE_HI: AVR_OP_LOADPAGE_LO];
+                caddr = addr / 2;
+            } else {
+                op = m->op[AVR_OP_LOADPAGE_LO];
+                caddr = addr;
+            }
+            buf_pos += set_cmd(pgm, buf+buf_pos, op, caddr, m->buf[addr]);
             addr ++;
             i++;
-            if ( (m->paged) &&
-                    (((i % m->page_size) == 0) || (i == n_bytes))) {
+            if (((i % m->page_size) == 0) || (i == n_bytes)) {
                 do_page_write = 1;
                 break;
             }
         }
-#if defined(USE_INLINE_WRITE_PAGE)
         if (do_page_write) {
-            int addr_wk = addr_save - (addr_save % m->page_size);
-            /* If this device has a "load extended address" command, issue it. */
-            if (m->op[AVR_OP_LOAD_EXT_ADDR]) {
-                unsigned char cmd[4];
-                OPCODE *lext = m->op[AVR_OP_LOAD_EXT_ADDR];
-
-                memset(cmd, 0, 4);
-                avr_set_bits(lext, cmd);
-                avr_set_addr(lext, cmd, addr_wk/2);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[0]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[1]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[2]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[3]);
-            }
-            buf_pos += set_data(pgm, buf+buf_pos, 0x4C); /* Issue Page Write */
-            buf_pos += set_data(pgm, buf+buf_pos,(addr_wk >> 9) & 0xff);
-            buf_pos += set_data(pgm, buf+buf_pos,(addr_wk >> 1) & 0xff);
-            buf_pos += set_data(pgm, buf+buf_pos, 0);
+            pa = addr_save - (addr_save % m->page_size);
+            if (word)
+                pa /= 2;
+            if (m->op[AVR_OP_LOAD_EXT_ADDR])
+                buf_pos += set_cmd(pgm, buf+buf_pos,
+                                   m->op[AVR_OP_LOAD_EXT_ADDR], pa, 0);
+            buf_pos += set_cmd(pgm, buf+buf_pos, m->op[AVR_OP_WRITEPAGE], pa, 0);
         }
-#endif
         if (i >= n_bytes) {
-            ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0); // sck down
-            buf[buf_pos++] = ft245r_out;
+            PDATA(pgm)->out = SET_BITS_0(PDATA(pgm)->out,pgm,PIN_AVR_SCK,0); // sck down
+            buf[buf_pos++] = PDATA(pgm)->out;
         }
-        ft245r_send(pgm, buf, buf_pos);
-        put_request(addr_save, buf_pos, 0);
-        //ft245r_sync(pgm);
-#if 0
-        fprintf(stderr, "send addr 0x%04x bufsize %d [%02x %02x] page_write %d\n",
-                addr_save,buf_pos,
-                extract_data_out(pgm, buf , (0*4 + 3) ),
-                extract_data_out(pgm, buf , (1*4 + 3) ),
-                do_page_write);
-#endif
-        req_count++;
-        if (req_count > REQ_OUTSTANDINGS)
-            do_request(pgm, m);
+        if (put_request(pgm, m, buf, buf_pos, addr_save, 0, 0, 0) < 0)
+            return -2;
         if (do_page_write) {
-#if defined(USE_INLINE_WRITE_PAGE)
-            while (do_request(pgm, m))
-                ;
-            usleep(m->max_write_delay);
-#else
-            int addr_wk = addr_save - (addr_save % m->page_size);
-            int rc;
-            while (do_request(pgm, m))
-                ;
-            rc = avr_write_page(pgm, p, m, addr_wk);
-            if (rc != 0) {
+            /* the page must be written before the next one is loaded */
+            if (flush_requests(pgm, m) < 0)
                 return -2;
-            }
-#endif
-            req_count = 0;
+            avr_wait_ready(pgm, p, m->max_write_delay);
         }
     }
-    while (do_request(pgm, m))
-        ;
-    return i;
-}
-
-
-static int ft245r_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                              unsigned int page_size, unsigned int addr, unsigned int n_bytes) {
-    if (strcmp(m->desc, "flash") == 0) {
-        return ft245r_paged_write_flash(pgm, p, m, page_size, addr, n_bytes);
-    } else if (strcmp(m->desc, "eeprom") == 0) {
-        return ft245r_paged_write_gen(pgm, p, m, page_size, addr, n_bytes);
-    } else {
+    if (flush_requests(pgm, m) < 0)
         return -2;
-    }
+    return i;
 }
 
-static int ft245r_paged_load_gen(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                 unsigned int page_size, unsigned int addr,
-                                 int n_bytes) {
-    unsigned char    rbyte;
-    unsigned long    i;
+static int ft245r_paged_write_gen(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                  unsigned int page_size, unsigned int addr,
+                                  unsigned int n_bytes) {
+    unsigned long i;
     int rc;
 
-    for (i=0; i<n_bytes; i++) {
-        rc = avr_read_byte_default(pgm, p, m, i+addr, &rbyte);
+    /*
+     * Byte mode memories need the write delay after each single byte,
+     * there is nothing to gain from streaming them.
+     */
+    for (i=0; i<n_bytes; i++, addr++) {
+        rc = avr_write_byte_default(pgm, p, m, addr, m->buf[addr]);
         if (rc != 0) {
             return -2;
         }
-        m->buf[i+addr] = rbyte;
     }
-    return 0;
+    return i;
 }
 
-static int ft245r_paged_load_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                   unsigned int page_size, unsigned int addr,
-                                   unsigned int n_bytes) {
-    unsigned long    i,j,n;
-    int addr_save,buf_pos;
-    int req_count = 0;
-    unsigned char buf[FT245R_FRAGMENT_SIZE+1];
+static int ft245r_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                              unsigned int page_size, unsigned int addr, unsigned int n_bytes) {
+    if (strcmp(m->desc, "flash") != 0 && strcmp(m->desc, "eeprom") != 0)
+        return -2;
+    if (m->paged && m->op[AVR_OP_LOADPAGE_LO] && m->op[AVR_OP_WRITEPAGE])
+        return ft245r_paged_write_stream(pgm, p, m, page_size, addr, n_bytes);
+    return ft245r_paged_write_gen(pgm, p, m, page_size, addr, n_bytes);
+}
 
+/*
+ * Stream the read commands of flash or eeprom.  A fragment starts
+ * with the load extended address command whenever the upper address
+ * bits change.  The data is stored in m->buf, or compared with it if
+ * verify is set; the last fragments may still be in flight on return.
+ */
+static int ft245r_stream_reads(PROGRAMMER * pgm, AVRMEM * m,
+                               unsigned int addr, unsigned int n_bytes,
+                               int verify) {
+    unsigned long i, caddr;
+    long ext = -1;
+    int j, addr_save, buf_pos, skip;
+    unsigned char buf[FT245R_REQ_SIZE];
+    OPCODE *lext, *op;
+
+    lext = m->op[AVR_OP_LOAD_EXT_ADDR];
     for (i=0; i<n_bytes; ) {
         buf_pos = 0;
         addr_save = addr;
-        for (j=0; j< FT245R_FRAGMENT_SIZE/8/FT245R_CYCLES/4; j++) {
-            if (i >= n_bytes) break;
-            buf_pos += set_data(pgm, buf+buf_pos, (addr & 1)?0x28:0x20 );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 9) & 0xff );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 1) & 0xff );
-            buf_pos += set_data(pgm, buf+buf_pos, 0);
+        skip = 0;
+        for (j=0; j<FT245R_FRAGMENT_CMDS && i<n_bytes; j++) {
+            op = ft245r_read_op(m, addr, &caddr);
+            if (lext && (long)(caddr >> 16) != ext) {
+                if (j > 0)
+                    break;
+                ext = caddr >> 16;
+                buf_pos += set_cmd(pgm, buf+buf_pos, lext, caddr, 0);
+                skip = 1;
+            }
+            buf_pos += set_cmd(pgm, buf+buf_pos, op, caddr, 0);
             addr ++;
             i++;
         }
         if (i >= n_bytes) {
-            ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0); // sck down
-            buf[buf_pos++] = ft245r_out;
+            PDATA(pgm)->out = SET_BITS_0(PDATA(pgm)->out,pgm,PIN_AVR_SCK,0); // sck down
+            buf[buf_pos++] = PDATA(pgm)->out;
         }
-        n = j;
-        ft245r_send(pgm, buf, buf_pos);
-        put_request(addr_save, buf_pos, n);
-        req_count++;
-        if (req_count > REQ_OUTSTANDINGS)
-            do_request(pgm, m);
-
+        if (put_request(pgm, m, buf, buf_pos, addr_save, skip, j, verify) < 0)
+            return -2;
     }
-    while (do_request(pgm, m))
-        ;
     return 0;
 }
 
 static int ft245r_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                              unsigned int page_size, unsigned int addr,
                              unsigned int n_bytes) {
-    if (strcmp(m->desc, "flash") == 0) {
-        return ft245r_paged_load_flash(pgm, p, m, page_size, addr, n_bytes);
-    } else if (strcmp(m->desc, "eeprom") == 0) {
-        return ft245r_paged_load_gen(pgm, p, m, page_size, addr, n_bytes);
-    } else {
+    if (strcmp(m->desc, "flash") != 0 && strcmp(m->desc, "eeprom") != 0)
         return -2;
+    if (m->op[AVR_OP_READ_LO] == NULL && m->op[AVR_OP_READ] == NULL)
+        return -2;
+
+    if (ft245r_stream_reads(pgm, m, addr, n_bytes, 0) < 0 ||
+        flush_requests(pgm, m) < 0)
+        return -2;
+    return 0;
+}
+
+/*
+ * Read back a page that has just been streamed.  The read commands
+ * stay in flight while the next page is loaded, and are compared as
+ * they come back; ft245r_paged_verify_done() waits for the last ones.
+ */
+static int ft245r_paged_verify(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                               unsigned int page_size, unsigned int addr,
+                               unsigned int n_bytes) {
+    if (strcmp(m->desc, "flash") != 0 && strcmp(m->desc, "eeprom") != 0)
+        return -2;
+    if (!m->paged || !m->op[AVR_OP_LOADPAGE_LO] || !m->op[AVR_OP_WRITEPAGE] ||
+        (m->op[AVR_OP_READ_LO] == NULL && m->op[AVR_OP_READ] == NULL))
+        return -2;
+
+    return ft245r_stream_reads(pgm, m, addr, n_bytes, 1) < 0? -1: 0;
+}
+
+static int ft245r_paged_verify_done(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m) {
+    struct pdata *pd = PDATA(pgm);
+    int rv, t;
+
+    rv = flush_requests(pgm, m);
+    for (t = 0; t < pd->ntargets; t++) {
+        if (pd->verify_bad[t] != 0) {
+            if (pd->ntargets > 1)
+                fprintf(stderr, "%s: target %d: %d bytes differ\n",
+                        progname, t, pd->verify_bad[t]);
+            fprintf(stderr,
+                    "%s: verification error, first mismatch at byte 0x%04x\n"
+                    "%s0x%02x != 0x%02x\n",
+                    progname, pd->verify_addr[t], progbuf,
+                    pd->verify_want[t], pd->verify_got[t]);
+            rv = -1;
+        }
+        pd->verify_bad[t] = 0;
     }
+    return rv;
+}
+
+static void ft245r_setup(PROGRAMMER * pgm)
+{
+    struct pdata *pd;
+
+    if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0) {
+        fprintf(stderr,
+                "%s: ft245r_setup(): Out of memory allocating private data\n",
+                progname);
+        exit(1);
+    }
+    pd = PDATA(pgm);
+    memset(pd, 0, sizeof(struct pdata));
+    pthread_mutex_init(&pd->buf_mutex, NULL);
+    pthread_cond_init(&pd->buf_cond, NULL);
+    pd->reqs = REQ_OUTSTANDINGS;
+    pd->ntargets = 1;
+}
+
+static void ft245r_teardown(PROGRAMMER * pgm)
+{
+    struct pdata *pd = PDATA(pgm);
+
+    pthread_mutex_destroy(&pd->buf_mutex);
+    pthread_cond_destroy(&pd->buf_cond);
+    free(pgm->cookie);
+    pgm->cookie = NULL;
+}
+
+static int ft245r_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+    LNODEID ln;
+    const char *extended_param;
+    int rv = 0;
+
+    for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+        extended_param = ldata(ln);
+
+        if (strncmp(extended_param, "reqs=", strlen("reqs=")) == 0) {
+            int reqs;
+            if (sscanf(extended_param, "reqs=%i", &reqs) != 1 ||
+                reqs <= 0 || reqs > REQ_MAX) {
+                fprintf(stderr,
+                        "%s: ft245r_parseextparms(): invalid reqs '%s', "
+                        "must be 1..%d\n",
+                        progname, extended_param, REQ_MAX);
+                rv = -1;
+                continue;
+            }
+            if (verbose >= 2) {
+                fprintf(stderr,
+                        "%s: ft245r_parseextparms(): %d requests in flight\n",
+                        progname, reqs);
+            }
+            PDATA(pgm)->reqs = reqs;
+            continue;
+        }
+
+        if (strncmp(extended_param, "miso=", strlen("miso=")) == 0) {
+            struct pdata *pd = PDATA(pgm);
+            const char *cp = extended_param + strlen("miso=");
+            char *endp;
+            long bit;
+
+            pd->ntargets = 1;
+            for (;;) {
+                bit = strtol(cp, &endp, 0);
+                if (endp == cp || bit < 0 || bit > 7 ||
+                    (*endp != ',' && *endp != '\0') ||
+                    pd->ntargets == FT245R_TARGETS) {
+                    fprintf(stderr,
+                            "%s: ft245r_parseextparms(): invalid miso '%s', "
+                            "must be up to %d data bits 0..7\n",
+                            progname, extended_param, FT245R_TARGETS - 1);
+                    pd->ntargets = 1;
+                    rv = -1;
+                    break;
+                }
+                pd->miso[pd->ntargets++] = 1 << bit;
+                if (*endp == '\0')
+                    break;
+                cp = endp + 1;
+            }
+            if (rv == 0 && verbose >= 2) {
+                fprintf(stderr,
+                        "%s: ft245r_parseextparms(): programming %d targets\n",
+                        progname, pd->ntargets);
+            }
+            continue;
+        }
+
+        fprintf(stderr,
+                "%s: ft245r_parseextparms(): invalid extended parameter '%s'\n",
+                progname, extended_param);
+        rv = -1;
+    }
+
+    return rv;
 }
 
 void ft245r_initpgm(PROGRAMMER * pgm) {
@@ -939,8 +1290,14 @@ void ft245r_initpgm(PROGRAMMER * pgm) {
     /*
      * optional functions
      */
+    pgm->spi = ft245r_spi;
     pgm->paged_write = ft245r_paged_write;
     pgm->paged_load = ft245r_paged_load;
+    pgm->paged_verify = ft245r_paged_verify;
+    pgm->paged_verify_done = ft245r_paged_verify_done;
+    pgm->parseextparams = ft245r_parseextparms;
+    pgm->setup          = ft245r_setup;
+    pgm->teardown       = ft245r_teardown;
 
     pgm->rdy_led        = set_led_rdy;
     pgm->err_led        = set_led_err;
@@ -948,8 +1305,6 @@ void ft245r_initpgm(PROGRAMMER * pgm) {
     pgm->vfy_led        = set_led_vfy;
     pgm->powerup        = ft245r_powerup;
     pgm->powerdown      = ft245r_powerdown;
-
-    handle = NULL;
 }
 
 #endif
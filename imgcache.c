@@ -0,0 +1,238 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * On-disk cache of decoded input files.
+ *
+ * For every input file, part and memory an image file holds a key,
+ * the value fileio() returned, and the memory buffer and allocation
+ * tags as they were after reading the file.  The key consists of the
+ * absolute path, modification time, size, inode and a hash of the
+ * contents of the input file, the part id, the memory name and size,
+ * and the file format asked for; an image whose key does not match is
+ * ignored and overwritten.  fileio() builds the key once, hashing the
+ * mapping it parses the file from, for both the lookup and the store.
+ * Image files are named after a hash of the path, part and memory.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#define IMGCACHE_MMAP 1
+#endif
+
+#include "avrdude.h"
+#include "avr.h"
+#include "cachefile.h"
+#include "imgcache.h"
+
+#define IMGCACHE_MAGIC   "avrdude image\n"
+#define IMGCACHE_VERSION 4
+
+static char * imgcache_dir;
+
+
+void imgcache_set_dir(const char * dir)
+{
+  free(imgcache_dir);
+  imgcache_dir = dir != NULL? strdup(dir): NULL;
+}
+
+static uint64_t ic_hash(uint64_t h, const char * s)
+{
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 1099511628211ULL;
+  }
+  /* separate the strings */
+  h *= 1099511628211ULL;
+  return h;
+}
+
+/* FNV-1a of len bytes at data, taken a 64-bit word at a time */
+static uint64_t ic_data_hash(uint64_t h, const unsigned char * data,
+                             size_t len)
+{
+  uint64_t w;
+
+  for (; len >= sizeof(w); data += sizeof(w), len -= sizeof(w)) {
+    memcpy(&w, data, sizeof(w));
+    h ^= w;
+    h *= 1099511628211ULL;
+  }
+  while (len--) {
+    h ^= *data++;
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/*
+ * Hash the contents of file, as the time stamp misses a file rewritten
+ * within the same second, or by tools that keep it.  Only used where
+ * fileio() does not have the file mapped, e.g. for ELF files.
+ */
+static int ic_file_hash(const char * file, uint64_t * h)
+{
+  unsigned char buf[8192];      /* a multiple of the word size */
+  size_t n;
+  FILE * f;
+  int rc;
+
+  if ((f = fopen(file, "rb")) == NULL)
+    return -1;
+  *h = 14695981039346656037ULL;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    *h = ic_data_hash(*h, buf, n);
+  rc = ferror(f)? -1: 0;
+  fclose(f);
+
+  return rc;
+}
+
+void imgcache_key(const char * file, FILEFMT format, struct avrpart * p,
+                  AVRMEM * mem, const unsigned char * data, size_t len,
+                  struct imgcache_key * key)
+{
+  struct stat sb;
+  uint64_t h;
+
+  memset(key, 0, sizeof(*key));
+  if (imgcache_dir == NULL)
+    return;
+  if (stat(file, &sb) < 0 || !S_ISREG(sb.st_mode))
+    return;
+  if (data != NULL && len != (size_t)sb.st_size)
+    return;
+
+  strncpy(key->id.magic, IMGCACHE_MAGIC, sizeof(key->id.magic));
+  key->id.version = IMGCACHE_VERSION;
+  key->id.mtime = (long)sb.st_mtime;
+  key->id.size = (long)sb.st_size;
+  key->id.ino = (long)sb.st_ino;
+  if (data != NULL)
+    key->id.hash = ic_data_hash(14695981039346656037ULL, data, len);
+  else if (ic_file_hash(file, &key->id.hash) < 0)
+    return;
+  key->id.format = format;
+  key->id.memsize = mem->size;
+#if !defined(WIN32NATIVE)
+  if (realpath(file, key->id.path) == NULL)
+#endif
+    snprintf(key->id.path, sizeof(key->id.path), "%s", file);
+  snprintf(key->id.part, sizeof(key->id.part), "%s", p->id);
+  snprintf(key->id.mem, sizeof(key->id.mem), "%s", mem->desc);
+
+  h = 14695981039346656037ULL;
+  h = ic_hash(h, key->id.path);
+  h = ic_hash(h, key->id.part);
+  h = ic_hash(h, key->id.mem);
+  if (snprintf(key->file, sizeof(key->file), "%s/%08lx%08lx.img",
+               imgcache_dir, (unsigned long)(h >> 32),
+               (unsigned long)(h & 0xffffffff)) >= sizeof(key->file))
+    return;
+
+  key->valid = 1;
+}
+
+int imgcache_load(const struct imgcache_key * key, AVRMEM * mem)
+{
+  const unsigned char * data;
+  unsigned char * buf;
+  struct stat sb;
+  size_t len;
+  FILE * f;
+  int rc;
+
+  if (!key->valid || (f = fopen(key->file, "rb")) == NULL)
+    return -1;
+  len = sizeof(key->id) + sizeof(rc) + (size_t)mem->size +
+    avr_mem_tags_size(mem);
+  if (fstat(fileno(f), &sb) < 0 || (size_t)sb.st_size != len) {
+    fclose(f);
+    return -1;
+  }
+
+  buf = NULL;
+#ifdef IMGCACHE_MMAP
+  data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (data == MAP_FAILED)
+#endif
+  {
+    if ((buf = malloc(len)) == NULL ||
+        fread(buf, 1, len, f) != len) {
+      free(buf);
+      fclose(f);
+      return -1;
+    }
+    data = buf;
+  }
+  fclose(f);
+
+  rc = -1;
+  if (memcmp(data, &key->id, sizeof(key->id)) == 0) {
+    memcpy(&rc, data + sizeof(key->id), sizeof(rc));
+    memcpy(mem->buf, data + sizeof(key->id) + sizeof(rc), mem->size);
+    avr_mem_tag_bits(mem, data + sizeof(key->id) + sizeof(rc) + mem->size);
+  }
+
+  if (buf != NULL)
+    free(buf);
+#ifdef IMGCACHE_MMAP
+  else
+    munmap((void *)data, len);
+#endif
+
+  if (rc >= 0 && verbose >= 2)
+    fprintf(stderr, "%s: image of %s for %s taken from cache \"%s\"\n",
+            progname, key->id.path, mem->desc, key->file);
+
+  return rc;
+}
+
+void imgcache_save(const struct imgcache_key * key, AVRMEM * mem, int rc)
+{
+  char tmp[PATH_MAX];
+  FILE * f;
+
+  if (!key->valid ||
+      (f = cachefile_create(key->file, tmp, sizeof(tmp), "image cache"))
+      == NULL)
+    return;
+
+  fwrite(&key->id, sizeof(key->id), 1, f);
+  fwrite(&rc, sizeof(rc), 1, f);
+  fwrite(mem->buf, 1, mem->size, f);
+  fwrite(mem->tags, 1, avr_mem_tags_size(mem), f);
+
+  cachefile_commit(f, tmp, key->file, 0, "image cache");
+}
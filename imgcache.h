@@ -0,0 +1,85 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef imgcache_h
+#define imgcache_h
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "avrpart.h"
+#include "fileio.h"
+
+/* what the image of an input file is found by, see imgcache_key() */
+struct imgcache_key {
+  struct {
+    char     magic[16];
+    int      version;
+    long     mtime;
+    long     size;
+    long     ino;
+    uint64_t hash;              /* of the file contents */
+    int      format;
+    int      memsize;
+    char     path[PATH_MAX];
+    char     part[AVR_IDLEN];
+    char     mem[AVR_MEMDESCLEN];
+  } id;                         /* as stored at the start of the image */
+  char file[PATH_MAX];          /* the image file */
+  int valid;                    /* 0 if the cache is off or file unusable */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Keep decoded input files in directory dir; NULL (the default)
+ * disables the image cache.
+ */
+void imgcache_set_dir(const char * dir);
+
+/*
+ * Build the key of file as read with the given format into mem of
+ * part p.  The contents are hashed from the len bytes at data where
+ * the caller has the file mapped already, else read from the file.
+ */
+void imgcache_key(const char * file, FILEFMT format, struct avrpart * p,
+                  AVRMEM * mem, const unsigned char * data, size_t len,
+                  struct imgcache_key * key);
+
+/*
+ * Fill mem from the cached image for key.  Returns what fileio()
+ * returned when the image was stored, or -1 if there is no valid
+ * image.
+ */
+int imgcache_load(const struct imgcache_key * key, AVRMEM * mem);
+
+/*
+ * Store the contents of mem, just read from the file of key, together
+ * with the result rc of fileio().
+ */
+void imgcache_save(const struct imgcache_key * key, AVRMEM * mem, int rc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -41,6 +41,7 @@
 #include "pgm.h"
 #include "jtag3.h"
 #include "jtag3_private.h"
+#include "pagecache.h"
 #include "serial.h"
 #include "usbdevs.h"
 
@@ -50,17 +51,16 @@
 struct pdata
 {
   unsigned short command_sequence; /* Next cmd seqno to issue. */
+  unsigned short pending_writes;   /* Submitted page writes not yet answered. */
 
   /*
    * See jtag3_read_byte() for an explanation of the flash and
    * EEPROM page caches.
    */
-  unsigned char *flash_pagecache;
-  unsigned long flash_pageaddr;
+  struct pagecache flash_cache;
   unsigned int flash_pagesize;
 
-  unsigned char *eeprom_pagecache;
-  unsigned long eeprom_pageaddr;
+  struct pagecache eeprom_cache;
   unsigned int eeprom_pagesize;
 
   int prog_enabled;	     /* Cached value of PROGRAMMING status. */
@@ -73,10 +73,34 @@ struct pdata
 
   /* Function to set the appropriate clock parameter */
   int (*set_sck)(PROGRAMMER *, unsigned char *);
+
+  /* CMSIS-DAP packets the EDBG ICE accepts before it is read from */
+  unsigned int edbg_pktcount;
+
+  /* Size of a CMSIS-DAP packet: the HID report size, or over bulk
+     endpoints what the ICE tells */
+  unsigned int edbg_pktsize;
+
+  /* The ICE rejected a read larger than the memory's readsize */
+  int blockread_failed;
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
 
+/*
+ * A response over EDBG comes in at most 15 fragments of one CMSIS-DAP
+ * packet each, less the 4 bytes of fragment header.
+ */
+#define JTAG3_EDBG_MAXFRAGS 15
+#define JTAG3_EDBG_MAXFRAME (JTAG3_EDBG_MAXFRAGS * (USBDEV_MAX_XFER_3 - 4))
+
+/*
+ * Largest memory read jtag3_paged_load() tries at once over EDBG.  The
+ * ICE's own limit is not documented; if it fails such a read, reads
+ * fall back to the memory's readsize.
+ */
+#define JTAG3_EDBG_MAXREAD 2048
+
 /*
  * pgm->flag is marked as "for private use of the programmer".
  * The following defines this programmer's use of that field.
@@ -89,13 +113,19 @@ struct pdata
 static int jtag3_open(PROGRAMMER * pgm, char * port);
 static int jtag3_edbg_prepare(PROGRAMMER * pgm);
 static int jtag3_edbg_signoff(PROGRAMMER * pgm);
-static int jtag3_edbg_send(PROGRAMMER * pgm, unsigned char * data, size_t len);
+static int jtag3_edbg_sendv(PROGRAMMER * pgm, const struct serial_iov * iov,
+                            int iovcnt);
 static int jtag3_edbg_recv_frame(PROGRAMMER * pgm, unsigned char **msg);
+static int jtag3_command_status(PROGRAMMER *pgm, unsigned char **resp,
+                                const char *descr);
 
 static int jtag3_initialize(PROGRAMMER * pgm, AVRPART * p);
 static int jtag3_chip_erase(PROGRAMMER * pgm, AVRPART * p);
 static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                                 unsigned long addr, unsigned char * value);
+static int jtag3_read_config_bytes(PROGRAMMER * pgm, AVRPART * p,
+                                   AVRMEM * mems[], const unsigned long addrs[],
+                                   unsigned char * values, int n);
 static int jtag3_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                                 unsigned long addr, unsigned char data);
 static int jtag3_set_sck_period(PROGRAMMER * pgm, double v);
@@ -103,6 +133,10 @@ static void jtag3_print_parms1(PROGRAMMER * pgm, const char * p);
 static int jtag3_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                 unsigned int page_size,
                                 unsigned int addr, unsigned int n_bytes);
+static int jtag3_paged_write_submit(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                    unsigned int page_size,
+                                    unsigned int addr, unsigned int n_bytes);
+static int jtag3_paged_write_complete(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m);
 static unsigned char jtag3_memtype(PROGRAMMER * pgm, AVRPART * p, unsigned long addr);
 static unsigned int jtag3_memaddr(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, unsigned long addr);
 
@@ -400,46 +434,115 @@ static void jtag3_prevent(PROGRAMMER * pgm, unsigned char * data, size_t len)
 
 
 
-int jtag3_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
+/*
+ * Sequence number for the next command sent.  Page writes submitted
+ * by jtag3_paged_write_submit() are still waiting for their response,
+ * so they have consumed the numbers following command_sequence.
+ */
+static unsigned short jtag3_send_seqno(PROGRAMMER * pgm)
 {
-  unsigned char *buf;
+  unsigned long seqno;
+
+  seqno = PDATA(pgm)->command_sequence + PDATA(pgm)->pending_writes;
+
+  return seqno % 0xffff;
+}
+
+/*
+ * Send the segments of iov as one command, so callers can put a header
+ * in front of their data without copying it.
+ */
+int jtag3_sendv(PROGRAMMER * pgm, const struct serial_iov * iov, int iovcnt)
+{
+  unsigned char hdr[4];
+  struct serial_iov v[JTAG3_MAXIOV + 1];
+  size_t len;
+  int i;
+
+  if (iovcnt > JTAG3_MAXIOV) {
+    fprintf(stderr, "%s: jtag3_sendv(): too many segments\n", progname);
+    return -1;
+  }
 
   if (pgm->flag & PGM_FL_IS_EDBG)
-    return jtag3_edbg_send(pgm, data, len);
+    return jtag3_edbg_sendv(pgm, iov, iovcnt);
+
+  for (len = 0, i = 0; i < iovcnt; i++)
+    len += iov[i].len;
 
   if (verbose >= 3)
     fprintf(stderr, "\n%s: jtag3_send(): sending %lu bytes\n",
 	    progname, (unsigned long)len);
 
-  if ((buf = malloc(len + 4)) == NULL)
-    {
-      fprintf(stderr, "%s: jtag3_send(): out of memory",
-	      progname);
-      return -1;
-    }
+  hdr[0] = TOKEN;
+  hdr[1] = 0;                   /* dummy */
+  u16_to_b2(hdr + 2, jtag3_send_seqno(pgm));
 
-  buf[0] = TOKEN;
-  buf[1] = 0;                   /* dummy */
-  u16_to_b2(buf + 2, PDATA(pgm)->command_sequence);
-  memcpy(buf + 4, data, len);
+  v[0].buf = hdr;
+  v[0].len = 4;
+  for (i = 0; i < iovcnt; i++)
+    v[i + 1] = iov[i];
 
-  if (serial_send(&pgm->fd, buf, len + 4) != 0) {
+  if (serial_sendv(&pgm->fd, v, iovcnt + 1) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_send(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
 
-  free(buf);
-
   return 0;
 }
 
-static int jtag3_edbg_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
+int jtag3_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
+{
+  struct serial_iov iov;
+
+  iov.buf = data;
+  iov.len = len;
+
+  return jtag3_sendv(pgm, &iov, 1);
+}
+
+/*
+ * Send one CMSIS-DAP packet of len bytes from buf, which must hold
+ * USBDEV_MAX_XFER_3 bytes.  A HID report is always sent in full, so
+ * the rest of it is cleared.  A bulk packet is sent as long as it is,
+ * but one byte longer if it would otherwise end with a zero length
+ * USB packet.
+ */
+static int jtag3_edbg_send_pkt(PROGRAMMER * pgm, unsigned char * buf,
+			       size_t len)
+{
+  if (pgm->fd.usb.use_interrupt_xfer) {
+    memset(buf + len, 0, PDATA(pgm)->edbg_pktsize - len);
+    len = PDATA(pgm)->edbg_pktsize;
+  } else if (len % pgm->fd.usb.max_xfer == 0 &&
+	     len < PDATA(pgm)->edbg_pktsize) {
+    buf[len++] = 0;
+  }
+
+  return serial_send(&pgm->fd, buf, len);
+}
+
+/*
+ * Receive one CMSIS-DAP packet into buf, which must hold
+ * USBDEV_MAX_XFER_3 bytes.
+ */
+static int jtag3_edbg_recv_pkt(PROGRAMMER * pgm, unsigned char * buf)
+{
+  return serial_recv(&pgm->fd, buf, PDATA(pgm)->edbg_pktsize);
+}
+
+static int jtag3_edbg_sendv(PROGRAMMER * pgm, const struct serial_iov * iov,
+                            int iovcnt)
 {
   unsigned char buf[USBDEV_MAX_XFER_3];
   unsigned char status[USBDEV_MAX_XFER_3];
-  int rv;
+  size_t len;
+  int i, rv;
+
+  for (len = 0, i = 0; i < iovcnt; i++)
+    len += iov[i].len;
 
   if (verbose >= 4)
     {
@@ -451,7 +554,7 @@ static int jtag3_edbg_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
     fprintf(stderr, "\n%s: jtag3_edbg_send(): sending %lu bytes\n",
 	    progname, (unsigned long)len);
 
-  if (len + 8 > USBDEV_MAX_XFER_3)
+  if (len + 8 > PDATA(pgm)->edbg_pktsize)
     {
       fprintf(stderr,
 	      "%s: jtag3_edbg_send(): Fragmentation not (yet) implemented!\n",
@@ -465,15 +568,18 @@ static int jtag3_edbg_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
   buf[4] = TOKEN;
   buf[5] = 0;                   /* dummy */
   u16_to_b2(buf + 6, PDATA(pgm)->command_sequence);
-  memcpy(buf + 8, data, len);
+  for (len = 0, i = 0; i < iovcnt; i++) {
+    memcpy(buf + 8 + len, iov[i].buf, iov[i].len);
+    len += iov[i].len;
+  }
 
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
+  if (jtag3_edbg_send_pkt(pgm, buf, 8 + len) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_send(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
-  rv = serial_recv(&pgm->fd, status, USBDEV_MAX_XFER_3);
+  rv = jtag3_edbg_recv_pkt(pgm, status);
 
   if (rv < 0) {
     /* timeout in receive */
@@ -507,19 +613,22 @@ static int jtag3_edbg_prepare(PROGRAMMER * pgm)
     fprintf(stderr, "\n%s: jtag3_edbg_prepare()\n",
 	    progname);
 
+  /* a bulk ICE may tell a larger packet size below */
+  PDATA(pgm)->edbg_pktsize = pgm->fd.usb.max_xfer;
+
   if (verbose >= 4)
     memset(buf, 0, USBDEV_MAX_XFER_3);
 
   buf[0] = CMSISDAP_CMD_CONNECT;
   buf[1] = CMSISDAP_CONN_SWD;
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
+  if (jtag3_edbg_send_pkt(pgm, buf, 2) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_prepare(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
-  rv = serial_recv(&pgm->fd, status, USBDEV_MAX_XFER_3);
-  if (rv != USBDEV_MAX_XFER_3) {
+  rv = jtag3_edbg_recv_pkt(pgm, status);
+  if (rv < 2) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_prepare(): failed to read from serial port (%d)\n",
 	    progname, rv);
@@ -538,14 +647,14 @@ static int jtag3_edbg_prepare(PROGRAMMER * pgm)
   buf[0] = CMSISDAP_CMD_LED;
   buf[1] = CMSISDAP_LED_CONNECT;
   buf[2] = 1;
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
+  if (jtag3_edbg_send_pkt(pgm, buf, 3) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_prepare(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
-  rv = serial_recv(&pgm->fd, status, USBDEV_MAX_XFER_3);
-  if (rv != USBDEV_MAX_XFER_3) {
+  rv = jtag3_edbg_recv_pkt(pgm, status);
+  if (rv < 2) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_prepare(): failed to read from serial port (%d)\n",
 	    progname, rv);
@@ -557,6 +666,68 @@ static int jtag3_edbg_prepare(PROGRAMMER * pgm)
 	    "%s: jtag3_edbg_prepare(): unexpected response 0x%02x, 0x%02x\n",
 	    progname, status[0], status[1]);
 
+  /*
+   * The number of packets the ICE buffers tells how many fragment
+   * requests jtag3_edbg_recv_frame() may have outstanding.
+   */
+  PDATA(pgm)->edbg_pktcount = 1;
+  buf[0] = CMSISDAP_CMD_INFO;
+  buf[1] = CMSISDAP_INFO_PACKET_COUNT;
+  if (jtag3_edbg_send_pkt(pgm, buf, 2) != 0) {
+    fprintf(stderr,
+	    "%s: jtag3_edbg_prepare(): failed to send command to serial port\n",
+	    progname);
+    return -1;
+  }
+  rv = jtag3_edbg_recv_pkt(pgm, status);
+  if (rv < 2) {
+    fprintf(stderr,
+	    "%s: jtag3_edbg_prepare(): failed to read from serial port (%d)\n",
+	    progname, rv);
+    return -1;
+  }
+  if (rv >= 3 && status[0] == CMSISDAP_CMD_INFO && status[1] == 1 &&
+      status[2] > 1)
+    PDATA(pgm)->edbg_pktcount = status[2];
+  if (verbose >= 2)
+    fprintf(stderr,
+	    "%s: jtag3_edbg_prepare(): packet count %u\n",
+	    progname, PDATA(pgm)->edbg_pktcount);
+
+  /*
+   * Over bulk endpoints, a packet may span several USB packets, up to
+   * the size the ICE tells.
+   */
+  if (!pgm->fd.usb.use_interrupt_xfer) {
+    buf[0] = CMSISDAP_CMD_INFO;
+    buf[1] = CMSISDAP_INFO_PACKET_SIZE;
+    if (jtag3_edbg_send_pkt(pgm, buf, 2) != 0) {
+      fprintf(stderr,
+	      "%s: jtag3_edbg_prepare(): failed to send command to serial port\n",
+	      progname);
+      return -1;
+    }
+    rv = jtag3_edbg_recv_pkt(pgm, status);
+    if (rv < 2) {
+      fprintf(stderr,
+	      "%s: jtag3_edbg_prepare(): failed to read from serial port (%d)\n",
+	      progname, rv);
+      return -1;
+    }
+    if (rv >= 4 && status[0] == CMSISDAP_CMD_INFO && status[1] == 2) {
+      unsigned int pktsize = status[2] | (status[3] << 8);
+
+      if (pktsize > USBDEV_MAX_XFER_3)
+	pktsize = USBDEV_MAX_XFER_3;
+      if (pktsize > PDATA(pgm)->edbg_pktsize)
+	PDATA(pgm)->edbg_pktsize = pktsize;
+    }
+    if (verbose >= 2)
+      fprintf(stderr,
+	      "%s: jtag3_edbg_prepare(): packet size %u\n",
+	      progname, PDATA(pgm)->edbg_pktsize);
+  }
+
   return 0;
 }
 
@@ -580,14 +751,14 @@ static int jtag3_edbg_signoff(PROGRAMMER * pgm)
   buf[0] = CMSISDAP_CMD_LED;
   buf[1] = CMSISDAP_LED_CONNECT;
   buf[2] = 0;
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
+  if (jtag3_edbg_send_pkt(pgm, buf, 3) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_signoff(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
-  rv = serial_recv(&pgm->fd, status, USBDEV_MAX_XFER_3);
-  if (rv != USBDEV_MAX_XFER_3) {
+  rv = jtag3_edbg_recv_pkt(pgm, status);
+  if (rv < 2) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_signoff(): failed to read from serial port (%d)\n",
 	    progname, rv);
@@ -600,14 +771,14 @@ static int jtag3_edbg_signoff(PROGRAMMER * pgm)
 	    progname, status[0], status[1]);
 
   buf[0] = CMSISDAP_CMD_DISCONNECT;
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
+  if (jtag3_edbg_send_pkt(pgm, buf, 1) != 0) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_signoff(): failed to send command to serial port\n",
 	    progname);
     return -1;
   }
-  rv = serial_recv(&pgm->fd, status, USBDEV_MAX_XFER_3);
-  if (rv != USBDEV_MAX_XFER_3) {
+  rv = jtag3_edbg_recv_pkt(pgm, status);
+  if (rv < 2) {
     fprintf(stderr,
 	    "%s: jtag3_edbg_signoff(): failed to read from serial port (%d)\n",
 	    progname, rv);
@@ -672,60 +843,89 @@ static int jtag3_recv_frame(PROGRAMMER * pgm, unsigned char **msg) {
   return rv;
 }
 
+/*
+ * Receive a response over EDBG, one fragment per CMSIS-DAP report.
+ * Once the first fragment tells how many follow, the requests for
+ * them are sent ahead, as many as the ICE buffers, so the fragments
+ * do not each wait for a round trip.
+ */
 static int jtag3_edbg_recv_frame(PROGRAMMER * pgm, unsigned char **msg) {
-  int rv, len;
-  unsigned char *buf = NULL;
+  unsigned char request[USBDEV_MAX_XFER_3];
+  unsigned char rsp[USBDEV_MAX_XFER_3];
+  unsigned char *buf;
+  unsigned int asked, frag, nfrags, pktcount;
+  int rv, len, thislen;
 
   if (verbose >= 4)
     fprintf(stderr, "%s: jtag3_edbg_recv():\n", progname);
 
-  if ((buf = malloc(USBDEV_MAX_XFER_3)) == NULL) {
+  if ((buf = malloc(JTAG3_EDBG_MAXFRAME)) == NULL) {
     fprintf(stderr, "%s: jtag3_edbg_recv(): out of memory\n",
 	    progname);
     return -1;
   }
 
-  buf[0] = EDBG_VENDOR_AVR_RSP;
-
-  if (serial_send(&pgm->fd, buf, USBDEV_MAX_XFER_3) != 0) {
-    fprintf(stderr,
-	    "%s: jtag3_edbg_recv(): error sending CMSIS-DAP vendor command\n",
-	    progname);
-    return -1;
-  }
+  memset(request, 0, USBDEV_MAX_XFER_3);
+  request[0] = EDBG_VENDOR_AVR_RSP;
+  pktcount = PDATA(pgm)->edbg_pktcount? PDATA(pgm)->edbg_pktcount: 1;
+
+  len = 0;
+  nfrags = 1;
+  for (asked = 0, frag = 1; frag <= nfrags; frag++) {
+    /* keep up to pktcount requests for the remaining fragments queued */
+    while (asked < nfrags && asked - (frag - 1) < pktcount) {
+      if (jtag3_edbg_send_pkt(pgm, request, 1) != 0) {
+	fprintf(stderr,
+		"%s: jtag3_edbg_recv(): error sending CMSIS-DAP vendor command\n",
+		progname);
+	goto fail;
+      }
+      asked++;
+    }
 
-  rv = serial_recv(&pgm->fd, buf, USBDEV_MAX_XFER_3);
+    rv = jtag3_edbg_recv_pkt(pgm, rsp);
+    if (rv < 0) {
+      /* timeout in receive */
+      if (verbose > 1)
+	fprintf(stderr,
+		"%s: jtag3_edbg_recv(): Timeout receiving packet\n",
+		progname);
+      goto fail;
+    }
 
-  if (rv < 0) {
-    /* timeout in receive */
-    if (verbose > 1)
+    if (rsp[0] != EDBG_VENDOR_AVR_RSP ||
+	(rsp[1] >> 4) != frag ||
+	(rsp[1] & 0x0f) == 0 ||
+	(frag > 1 && (rsp[1] & 0x0f) != nfrags)) {
       fprintf(stderr,
-	      "%s: jtag3_edbg_recv(): Timeout receiving packet\n",
-	      progname);
-    free(buf);
-    return -1;
-  }
+	      "%s: jtag3_edbg_recv(): Unexpected response 0x%02x, 0x%02x\n",
+	      progname, rsp[0], rsp[1]);
+      goto fail;
+    }
+    nfrags = rsp[1] & 0x0f;
 
-  if (buf[0] != EDBG_VENDOR_AVR_RSP ||
-      buf[1] != ((1 << 4) | 1)) {
-    fprintf(stderr,
-	    "%s: jtag3_edbg_recv(): Unexpected response 0x%02x, 0x%02x\n",
-	    progname, buf[0], buf[1]);
-    return -1;
-  }
-  /* calculate length from response; CMSIS-DAP response might be larger */
-  len = (buf[2] << 8) | buf[3];
-  if (len > rv + 4) {
-    fprintf(stderr,
-	    "%s: jtag3_edbg_recv(): Unexpected length value (%d > %d)\n",
-	    progname, len, rv + 4);
-    len = rv + 4;
+    /* calculate length from response; CMSIS-DAP response might be larger */
+    thislen = (rsp[2] << 8) | rsp[3];
+    if (thislen > rv - 4) {
+      fprintf(stderr,
+	      "%s: jtag3_edbg_recv(): Unexpected length value (%d > %d)\n",
+	      progname, thislen, rv - 4);
+      thislen = rv - 4;
+    }
+    memcpy(buf + len, rsp + 4, thislen);
+    len += thislen;
   }
-  memmove(buf, buf + 4, len);
 
   *msg = buf;
 
-  return rv;
+  return len;
+
+fail:
+  /* drop the answers to fragment requests still outstanding */
+  if (asked >= frag)
+    serial_drain(&pgm->fd, 0);
+  free(buf);
+  return -1;
 }
 
 int jtag3_recv(PROGRAMMER * pgm, unsigned char **msg) {
@@ -775,14 +975,24 @@ int jtag3_recv(PROGRAMMER * pgm, unsigned char **msg) {
  int jtag3_command(PROGRAMMER *pgm, unsigned char *cmd, unsigned int cmdlen,
 		   unsigned char **resp, const char *descr)
 {
-  int status;
-  unsigned char c;
-
   if (verbose >= 2)
     fprintf(stderr, "%s: Sending %s command: ",
 	    progname, descr);
   jtag3_send(pgm, cmd, cmdlen);
 
+  return jtag3_command_status(pgm, resp, descr);
+}
+
+/*
+ * Receive and check the response to a command sent earlier; the second
+ * half of jtag3_command().
+ */
+static int jtag3_command_status(PROGRAMMER *pgm, unsigned char **resp,
+                                const char *descr)
+{
+  int status;
+  unsigned char c;
+
   status = jtag3_recv(pgm, resp);
   if (status <= 0) {
     if (verbose >= 2)
@@ -852,6 +1062,9 @@ static int jtag3_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   if (jtag3_command(pgm, buf, 8, &resp, "chip erase") < 0)
     return -1;
 
+  pagecache_clear(&PDATA(pgm)->flash_cache);
+  pagecache_clear(&PDATA(pgm)->eeprom_cache);
+
   free(resp);
   return 0;
 }
@@ -1196,20 +1409,15 @@ static int jtag3_initialize(PROGRAMMER * pgm, AVRPART * p)
     }
   }
 
-  free(PDATA(pgm)->flash_pagecache);
-  free(PDATA(pgm)->eeprom_pagecache);
-  if ((PDATA(pgm)->flash_pagecache = malloc(PDATA(pgm)->flash_pagesize)) == NULL) {
+  if (pagecache_init(&PDATA(pgm)->flash_cache,
+                     PDATA(pgm)->flash_pagesize) < 0 ||
+      pagecache_init(&PDATA(pgm)->eeprom_cache,
+                     PDATA(pgm)->eeprom_pagesize) < 0) {
     fprintf(stderr, "%s: jtag3_initialize(): Out of memory\n",
 	    progname);
+    pagecache_free(&PDATA(pgm)->flash_cache);
     return -1;
   }
-  if ((PDATA(pgm)->eeprom_pagecache = malloc(PDATA(pgm)->eeprom_pagesize)) == NULL) {
-    fprintf(stderr, "%s: jtag3_initialize(): Out of memory\n",
-	    progname);
-    free(PDATA(pgm)->flash_pagecache);
-    return -1;
-  }
-  PDATA(pgm)->flash_pageaddr = PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
 
   return 0;
 }
@@ -1217,10 +1425,8 @@ static int jtag3_initialize(PROGRAMMER * pgm, AVRPART * p)
 static void jtag3_disable(PROGRAMMER * pgm)
 {
 
-  free(PDATA(pgm)->flash_pagecache);
-  PDATA(pgm)->flash_pagecache = NULL;
-  free(PDATA(pgm)->eeprom_pagecache);
-  PDATA(pgm)->eeprom_pagecache = NULL;
+  pagecache_free(&PDATA(pgm)->flash_cache);
+  pagecache_free(&PDATA(pgm)->eeprom_cache);
 
   /*
    * jtag3_program_disable() doesn't do anything if the
@@ -1340,8 +1546,8 @@ int jtag3_open_common(PROGRAMMER * pgm, char * port)
     pgm->flag |= PGM_FL_IS_EDBG;
     if (verbose)
       fprintf(stderr,
-              "%s: Found CMSIS-DAP compliant device, using EDBG protocol\n",
-              progname);
+              "%s: Found CMSIS-DAP compliant device, using EDBG protocol over %s\n",
+              progname, pgm->fd.usb.use_interrupt_xfer? "HID": "bulk endpoints");
   }
 
   /*
@@ -1500,7 +1706,8 @@ static int jtag3_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   cmd[1] = CMD3_WRITE_MEMORY;
   cmd[2] = 0;
   if (strcmp(m->desc, "flash") == 0) {
-    PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+    pagecache_invalidate(&PDATA(pgm)->flash_cache,
+                         (m->offset & (512 * 1024 - 1)) + addr, n_bytes);
     cmd[3] = jtag3_memtype(pgm, p, addr);
     if (p->flags & AVRPART_HAS_PDI)
       /* dynamically decide between flash/boot memtype */
@@ -1522,12 +1729,17 @@ static int jtag3_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       return n_bytes;
     }
     cmd[3] = ( p->flags & AVRPART_HAS_PDI ) ? MTYPE_EEPROM_XMEGA : MTYPE_EEPROM_PAGE;
-    PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+    pagecache_invalidate(&PDATA(pgm)->eeprom_cache, addr, n_bytes);
   } else if ( ( strcmp(m->desc, "usersig") == 0 ) ) {
     cmd[3] = MTYPE_USERSIG;
   } else if ( ( strcmp(m->desc, "boot") == 0 ) ) {
+    pagecache_invalidate(&PDATA(pgm)->flash_cache,
+                         (m->offset & (512 * 1024 - 1)) + addr, n_bytes);
     cmd[3] = MTYPE_BOOT_FLASH;
   } else if ( p->flags & AVRPART_HAS_PDI ) {
+    /* application, apptable */
+    pagecache_invalidate(&PDATA(pgm)->flash_cache,
+                         (m->offset & (512 * 1024 - 1)) + addr, n_bytes);
     cmd[3] = MTYPE_FLASH;
   } else {
     cmd[3] = MTYPE_SPM;
@@ -1576,11 +1788,106 @@ static int jtag3_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   return n_bytes;
 }
 
+/*
+ * Send the write memory command for one flash page without waiting for
+ * the response, so the next page can be encoded and transferred while
+ * the ICE is still programming this one.  Anything that cannot be
+ * pipelined (EDBG transport, debugWIRE, non-flash memories) is written
+ * synchronously through jtag3_paged_write().
+ */
+static int jtag3_paged_write_submit(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                    unsigned int page_size,
+                                    unsigned int addr, unsigned int n_bytes)
+{
+  unsigned int block_size;
+  unsigned char *cmd;
+
+  if ((pgm->flag & (PGM_FL_IS_EDBG | PGM_FL_IS_DW)) != 0 ||
+      strcmp(m->desc, "flash") != 0)
+    return jtag3_paged_write(pgm, p, m, page_size, addr, n_bytes);
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtag3_paged_write_submit(.., %s, %d, %d)\n",
+	    progname, m->desc, page_size, n_bytes);
+
+  if (PDATA(pgm)->pending_writes == 0 && jtag3_program_enable(pgm) < 0)
+    return -1;
+
+  if (page_size == 0) page_size = 256;
+  block_size = n_bytes < page_size? n_bytes: page_size;
+
+  if ((cmd = malloc(page_size + 13)) == NULL) {
+    fprintf(stderr, "%s: jtag3_paged_write_submit(): Out of memory\n",
+	    progname);
+    return -1;
+  }
+
+  pagecache_invalidate(&PDATA(pgm)->flash_cache,
+                       (m->offset & (512 * 1024 - 1)) + addr, block_size);
+
+  cmd[0] = SCOPE_AVR;
+  cmd[1] = CMD3_WRITE_MEMORY;
+  cmd[2] = 0;
+  cmd[3] = jtag3_memtype(pgm, p, addr);
+  u32_to_b4(cmd + 4, jtag3_memaddr(pgm, p, m, addr));
+  u32_to_b4(cmd + 8, page_size);
+  cmd[12] = 0;
+  /* the ICE only writes full pages, see jtag3_paged_write() */
+  memset(cmd + 13, 0xff, page_size);
+  memcpy(cmd + 13, m->buf + addr, block_size);
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: Sending write memory command\n", progname);
+  if (jtag3_send(pgm, cmd, page_size + 13) < 0) {
+    free(cmd);
+    return -1;
+  }
+  free(cmd);
+
+  PDATA(pgm)->pending_writes++;
+
+  return n_bytes;
+}
+
+/*
+ * Collect the response to the oldest page write still pending.  Pages
+ * that jtag3_paged_write_submit() wrote synchronously have nothing to
+ * wait for.
+ */
+static int jtag3_paged_write_complete(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+  unsigned char *resp;
+  long otimeout = serial_recv_timeout;
+  unsigned long next;
+  int status;
+
+  if (PDATA(pgm)->pending_writes == 0)
+    return 0;
+
+  next = PDATA(pgm)->command_sequence + PDATA(pgm)->pending_writes;
+  serial_recv_timeout = 100;
+  /* jtag3_recv() accepts the number following the answered ones */
+  PDATA(pgm)->pending_writes--;
+  status = jtag3_command_status(pgm, &resp, "write memory");
+  serial_recv_timeout = otimeout;
+
+  if (status < 0) {
+    /* the remaining responses cannot be matched anymore, drop them */
+    PDATA(pgm)->command_sequence = next % 0xffff;
+    PDATA(pgm)->pending_writes = 0;
+    return -1;
+  }
+
+  free(resp);
+
+  return 0;
+}
+
 static int jtag3_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                unsigned int page_size,
                                unsigned int addr, unsigned int n_bytes)
 {
-  unsigned int block_size;
+  unsigned int block_size, max_block;
   unsigned int maxaddr = addr + n_bytes;
   unsigned char cmd[12];
   unsigned char *resp;
@@ -1620,12 +1927,26 @@ static int jtag3_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   } else {
     cmd[3] = MTYPE_SPM;
   }
+  /*
+   * Over EDBG, every command costs several CMSIS-DAP report round
+   * trips, so read as many pages at once as fit into a fragmented
+   * response.  The JTAGICE3's own USB frames hold one readsize block.
+   */
+  max_block = page_size;
+  if ((pgm->flag & PGM_FL_IS_EDBG) && !PDATA(pgm)->blockread_failed &&
+      page_size != 0 && page_size < JTAG3_EDBG_MAXREAD)
+    max_block = JTAG3_EDBG_MAXREAD - JTAG3_EDBG_MAXREAD % page_size;
+
   serial_recv_timeout = 100;
-  for (; addr < maxaddr; addr += page_size) {
-    if ((maxaddr - addr) < page_size)
+  for (; addr < maxaddr; addr += block_size) {
+    if ((maxaddr - addr) < max_block)
       block_size = maxaddr - addr;
     else
-      block_size = page_size;
+      block_size = max_block;
+    /* a read must not cross into the Xmega boot area */
+    if (dynamic_memtype && addr < PDATA(pgm)->boot_start &&
+	addr + block_size > PDATA(pgm)->boot_start)
+      block_size = PDATA(pgm)->boot_start - addr;
     if (verbose >= 3)
       fprintf(stderr, "%s: jtag3_paged_load(): "
 	      "block_size at addr %d is %d\n",
@@ -1637,8 +1958,21 @@ static int jtag3_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     u32_to_b4(cmd + 8, block_size);
     u32_to_b4(cmd + 4, jtag3_memaddr(pgm, p, m, addr));
 
-    if ((status = jtag3_command(pgm, cmd, 12, &resp, "read memory")) < 0)
+    if ((status = jtag3_command(pgm, cmd, 12, &resp, "read memory")) < 0) {
+      if (block_size > page_size) {
+	/* the ICE does not take reads this large, stick to readsize */
+	if (verbose >= 1)
+	  fprintf(stderr, "%s: jtag3_paged_load(): "
+		  "falling back to %u byte reads\n",
+		  progname, page_size);
+	PDATA(pgm)->blockread_failed = 1;
+	max_block = page_size;
+	block_size = 0;
+	continue;
+      }
+      serial_recv_timeout = otimeout;
       return -1;
+    }
 
     if (resp[1] != RSP3_DATA ||
 	status < block_size + 4) {
@@ -1648,7 +1982,7 @@ static int jtag3_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       free(resp);
       return -1;
     }
-    memcpy(m->buf + addr, resp + 3, status - 4);
+    memcpy(m->buf + addr, resp + 3, block_size);
     free(resp);
   }
   serial_recv_timeout = otimeout;
@@ -1660,10 +1994,11 @@ static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 			      unsigned long addr, unsigned char * value)
 {
   unsigned char cmd[12];
-  unsigned char *resp, *cache_ptr = NULL;
+  unsigned char *resp, *cache_ptr;
   int status, unsupp = 0;
-  unsigned long paddr = 0UL, *paddr_ptr = NULL;
-  unsigned int pagesize = 0;
+  struct pagecache *pc = NULL;
+  unsigned long paddr = 0UL, end = 0UL;
+  unsigned int len = 0;
 
   if (verbose >= 2)
     fprintf(stderr, "%s: jtag3_read_byte(.., %s, 0x%lx, ...)\n",
@@ -1682,20 +2017,16 @@ static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       strcmp(mem->desc, "apptable") == 0 ||
       strcmp(mem->desc, "boot") == 0) {
     addr += mem->offset & (512 * 1024 - 1); /* max 512 KiB flash */
-    pagesize = PDATA(pgm)->flash_pagesize;
-    paddr = addr & ~(pagesize - 1);
-    paddr_ptr = &PDATA(pgm)->flash_pageaddr;
-    cache_ptr = PDATA(pgm)->flash_pagecache;
+    end = (mem->offset & (512 * 1024 - 1)) + mem->size;
+    pc = &PDATA(pgm)->flash_cache;
   } else if (strcmp(mem->desc, "eeprom") == 0) {
     if ( (pgm->flag & PGM_FL_IS_DW) || ( p->flags & AVRPART_HAS_PDI ) ) {
       cmd[3] = MTYPE_EEPROM;
     } else {
       cmd[3] = MTYPE_EEPROM_PAGE;
     }
-    pagesize = mem->page_size;
-    paddr = addr & ~(pagesize - 1);
-    paddr_ptr = &PDATA(pgm)->eeprom_pageaddr;
-    cache_ptr = PDATA(pgm)->eeprom_pagecache;
+    end = mem->size;
+    pc = &PDATA(pgm)->eeprom_cache;
   } else if (strcmp(mem->desc, "lfuse") == 0) {
     cmd[3] = MTYPE_FUSE_BITS;
     addr = 0;
@@ -1772,18 +2103,23 @@ static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
    * To improve the read speed, we used paged reads for flash and
    * EEPROM, and cache the results in a page cache.
    *
-   * Page cache validation is based on "{flash,eeprom}_pageaddr"
-   * (holding the base address of the most recent cache fill
-   * operation).  This variable is set to (unsigned long)-1L when the
-   * cache needs to be invalidated.
+   * The cache holds several pages; writes only invalidate the pages
+   * they touch.  Reading on from the page fetched last reads as many
+   * pages in one command as the memory's readsize allows; debugWIRE
+   * reads stay at one page.
    */
-  if (pagesize && paddr == *paddr_ptr) {
-    *value = cache_ptr[addr & (pagesize - 1)];
+  if (pc != NULL && pc->pagesize == 0)
+    pc = NULL;
+  if (pc != NULL && (cache_ptr = pagecache_lookup(pc, addr)) != NULL) {
+    *value = *cache_ptr;
     return 0;
   }
 
-  if (pagesize) {
-    u32_to_b4(cmd + 8, pagesize);
+  if (pc != NULL) {
+    paddr = addr & ~(unsigned long)(pc->pagesize - 1);
+    len = pagecache_readahead(pc, paddr, end,
+                              (pgm->flag & PGM_FL_IS_DW)? 0: mem->readsize);
+    u32_to_b4(cmd + 8, len);
     u32_to_b4(cmd + 4, paddr);
   } else {
     u32_to_b4(cmd + 8, 1);
@@ -1794,17 +2130,16 @@ static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     return -1;
 
   if (resp[1] != RSP3_DATA ||
-      status < (pagesize? pagesize: 1) + 4) {
+      status < (pc != NULL? len: 1) + 4) {
     fprintf(stderr, "%s: wrong/short reply to read memory command\n",
 	    progname);
     free(resp);
     return -1;
   }
 
-  if (pagesize) {
-    *paddr_ptr = paddr;
-    memcpy(cache_ptr, resp + 3, pagesize);
-    *value = cache_ptr[addr & (pagesize - 1)];
+  if (pc != NULL) {
+    pagecache_fill(pc, paddr, resp + 3, len);
+    *value = resp[3 + addr - paddr];
   } else
     *value = resp[3];
 
@@ -1812,12 +2147,81 @@ static int jtag3_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   return 0;
 }
 
+/*
+ * Read lfuse, hfuse and efuse with a single MTYPE_FUSE_BITS read
+ * covering all of them; everything else goes through
+ * jtag3_read_byte().
+ */
+#define JTAG3_CONFIG_MAX 16
+
+static int jtag3_read_config_bytes(PROGRAMMER * pgm, AVRPART * p,
+                                   AVRMEM * mems[], const unsigned long addrs[],
+                                   unsigned char * values, int n)
+{
+  static const char * fuses[] = { "lfuse", "hfuse", "efuse" };
+  unsigned char cmd[12];
+  unsigned char *resp;
+  int fuseaddr[JTAG3_CONFIG_MAX];
+  int i, j, first = 3, last = -1, status;
+
+  for (i = 0; i < n && i < JTAG3_CONFIG_MAX; i++) {
+    fuseaddr[i] = -1;
+    for (j = 0; j < 3; j++)
+      if (strcmp(mems[i]->desc, fuses[j]) == 0) {
+        fuseaddr[i] = j;
+        if (j < first)
+          first = j;
+        if (j > last)
+          last = j;
+      }
+  }
+  if (i < n || first >= last)
+    /* nothing to gain */
+    return avr_read_config_bytes_default(pgm, p, mems, addrs, values, n);
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtag3_read_config_bytes(.., %d bytes)\n",
+	    progname, n);
+
+  if (jtag3_program_enable(pgm) < 0)
+    return -1;
+
+  cmd[0] = SCOPE_AVR;
+  cmd[1] = CMD3_READ_MEMORY;
+  cmd[2] = 0;
+  cmd[3] = MTYPE_FUSE_BITS;
+  u32_to_b4(cmd + 4, first);
+  u32_to_b4(cmd + 8, last - first + 1);
+
+  if ((status = jtag3_command(pgm, cmd, 12, &resp, "read memory")) < 0)
+    return -1;
+
+  if (resp[1] != RSP3_DATA || status < last - first + 1 + 4) {
+    fprintf(stderr, "%s: wrong/short reply to read memory command\n",
+	    progname);
+    free(resp);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++)
+    if (fuseaddr[i] >= 0)
+      values[i] = resp[3 + fuseaddr[i] - first];
+  free(resp);
+
+  for (i = 0; i < n; i++)
+    if (fuseaddr[i] < 0 &&
+        jtag3_read_byte(pgm, p, mems[i], addrs[i], values + i) < 0)
+      return -1;
+
+  return 0;
+}
+
 static int jtag3_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 			       unsigned long addr, unsigned char data)
 {
   unsigned char cmd[14];
   unsigned char *resp;
-  unsigned char *cache_ptr = 0;
+  struct pagecache *pc = NULL;
   int status, unsupp = 0;
   unsigned int pagesize = 0;
 
@@ -1830,19 +2234,18 @@ static int jtag3_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   cmd[2] = 0;
   cmd[3] = ( p->flags & AVRPART_HAS_PDI ) ? MTYPE_FLASH : MTYPE_SPM;
   if (strcmp(mem->desc, "flash") == 0) {
-     cache_ptr = PDATA(pgm)->flash_pagecache;
-     pagesize = PDATA(pgm)->flash_pagesize;
-     PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+     pc = &PDATA(pgm)->flash_cache;
+     pagesize = pc->pagesize;
      if (pgm->flag & PGM_FL_IS_DW)
        unsupp = 1;
   } else if (strcmp(mem->desc, "eeprom") == 0) {
+    pc = &PDATA(pgm)->eeprom_cache;
     if (pgm->flag & PGM_FL_IS_DW) {
       cmd[3] = MTYPE_EEPROM;
+      pagecache_invalidate(pc, addr, 1);
     } else {
-      cache_ptr = PDATA(pgm)->eeprom_pagecache;
-      pagesize = PDATA(pgm)->eeprom_pagesize;
+      pagesize = pc->pagesize;
     }
-    PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
   } else if (strcmp(mem->desc, "lfuse") == 0) {
     cmd[3] = MTYPE_FUSE_BITS;
     addr = 0;
@@ -1884,19 +2287,22 @@ static int jtag3_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
   if (pagesize != 0) {
     /* flash or EEPROM write: use paged algorithm */
-    unsigned char dummy;
+    unsigned char dummy, *cache_ptr;
+    unsigned long paddr = addr & ~(pagesize - 1);	/* page base address */
     int i;
 
-    /* step #1: ensure the page cache is up to date */
-    if (jtag3_read_byte(pgm, p, mem, addr, &dummy) < 0)
+    /*
+     * step #1: ensure the page is in the cache; flash and EEPROM
+     * both start at address 0 of their cache
+     */
+    if (jtag3_read_byte(pgm, p, mem, addr, &dummy) < 0 ||
+        (cache_ptr = pagecache_lookup(pc, paddr)) == NULL)
       return -1;
-    /* step #2: update our value in page cache, and copy
-     * cache to mem->buf */
-    cache_ptr[addr & (pagesize - 1)] = data;
-    addr &= ~(pagesize - 1);	/* page base address */
-    memcpy(mem->buf + addr, cache_ptr, pagesize);
-    /* step #3: write back */
-    i = jtag3_paged_write(pgm, p, mem, pagesize, addr, pagesize);
+    /* step #2: copy the page to mem->buf, and update our value */
+    memcpy(mem->buf + paddr, cache_ptr, pagesize);
+    mem->buf[addr] = data;
+    /* step #3: write back; this drops the page from the cache */
+    i = jtag3_paged_write(pgm, p, mem, pagesize, paddr, pagesize);
     if (i < 0)
       return -1;
     else
@@ -2172,8 +2578,11 @@ void jtag3_initpgm(PROGRAMMER * pgm)
    * optional functions
    */
   pgm->paged_write    = jtag3_paged_write;
+  pgm->paged_write_submit   = jtag3_paged_write_submit;
+  pgm->paged_write_complete = jtag3_paged_write_complete;
   pgm->paged_load     = jtag3_paged_load;
   pgm->page_erase     = jtag3_page_erase;
+  pgm->read_config_bytes = jtag3_read_config_bytes;
   pgm->print_parms    = jtag3_print_parms;
   pgm->set_sck_period = jtag3_set_sck_period;
   pgm->parseextparams = jtag3_parseextparms;
@@ -2239,6 +2648,8 @@ void jtag3_pdi_initpgm(PROGRAMMER * pgm)
    * optional functions
    */
   pgm->paged_write    = jtag3_paged_write;
+  pgm->paged_write_submit   = jtag3_paged_write_submit;
+  pgm->paged_write_complete = jtag3_paged_write_complete;
   pgm->paged_load     = jtag3_paged_load;
   pgm->page_erase     = jtag3_page_erase;
   pgm->print_parms    = jtag3_print_parms;
@@ -26,7 +26,14 @@ extern "C" {
 #endif
 
 int  jtag3_open_common(PROGRAMMER * pgm, char * port);
+struct serial_iov;
+
+/* maximum number of segments jtag3_sendv() takes */
+#define JTAG3_MAXIOV 4
+
 int  jtag3_send(PROGRAMMER * pgm, unsigned char * data, size_t len);
+int  jtag3_sendv(PROGRAMMER * pgm, const struct serial_iov * iov,
+		 int iovcnt);
 int  jtag3_recv(PROGRAMMER * pgm, unsigned char **msg);
 void jtag3_close(PROGRAMMER * pgm);
 int  jtag3_getsync(PROGRAMMER * pgm, int mode);
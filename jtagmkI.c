@@ -60,6 +60,18 @@ struct pdata
   unsigned int eeprom_pagesize;
 
   int prog_enabled;	/* Cached value of PROGRAMMING status. */
+
+  /*
+   * Commands sent ahead of the reply to the previous one, see
+   * jtagmkI_paged_load() and jtagmkI_paged_write_submit().
+   */
+  int no_lookahead;		/* the ICE lost a command sent ahead */
+  AVRMEM *ahead_mem;		/* block read requested ahead, or NULL */
+  unsigned long ahead_addr;
+  int ahead_size;		/* size of its reply */
+  int write_pending;		/* last page write still to be answered */
+  unsigned long write_addr;
+  unsigned int write_size;
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -108,6 +120,12 @@ static int jtagmkI_setparm(PROGRAMMER * pgm, unsigned char parm,
 static void jtagmkI_print_parms1(PROGRAMMER * pgm, const char * p);
 
 static int jtagmkI_resync(PROGRAMMER *pgm, int maxtries, int signon);
+static void jtagmkI_discard_ahead(PROGRAMMER * pgm);
+static int jtagmkI_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                               unsigned int page_size,
+                               unsigned int addr, unsigned int n_bytes);
+static int jtagmkI_paged_write_complete(PROGRAMMER * pgm, AVRPART * p,
+					AVRMEM * m);
 
 static void jtagmkI_setup(PROGRAMMER * pgm)
 {
@@ -199,6 +217,9 @@ static int jtagmkI_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
 {
   unsigned char *buf;
 
+  if (PDATA(pgm)->ahead_mem != NULL)
+    jtagmkI_discard_ahead(pgm);
+
   if (verbose >= 3)
     fprintf(stderr, "\n%s: jtagmkI_send(): sending %u bytes\n",
 	    progname, (unsigned int)len);
@@ -243,9 +264,67 @@ static void jtagmkI_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len)
 
 static int jtagmkI_drain(PROGRAMMER * pgm, int display)
 {
+  /* whatever was requested ahead goes as well */
+  PDATA(pgm)->ahead_mem = NULL;
+  PDATA(pgm)->write_pending = 0;
+
   return serial_drain(&pgm->fd, display);
 }
 
+/*
+ * Like jtagmkI_recv(), but for the reply to a command sent ahead: a
+ * reply that does not arrive is reported rather than fatal, so the
+ * caller can resynchronize and carry on without look-ahead.
+ */
+static int jtagmkI_recv_ahead(PROGRAMMER * pgm, unsigned char * buf, size_t len)
+{
+  long otimeout = serial_recv_timeout;
+  int rc;
+
+  serial_recv_timeout = 1000;
+  rc = serial_recv(&pgm->fd, buf, len);
+  serial_recv_timeout = otimeout;
+  if (rc != 0)
+    return -1;
+  if (verbose >= 3) {
+    putc('\n', stderr);
+    jtagmkI_prmsg(pgm, buf, len);
+  }
+
+  return 0;
+}
+
+/*
+ * The ICE lost a command sent while it was still busy with the
+ * previous one: do without look-ahead from now on.  The caller has to
+ * get back in sync.
+ */
+static void jtagmkI_lookahead_lost(PROGRAMMER * pgm, const char * where)
+{
+  if (verbose >= 1)
+    fprintf(stderr,
+	    "%s: %s(): no reply to a command sent ahead, "
+	    "disabling look-ahead\n",
+	    progname, where);
+  PDATA(pgm)->no_lookahead = 1;
+}
+
+/*
+ * Throw away the reply to a block read that jtagmkI_paged_load()
+ * requested ahead but nobody asked for.
+ */
+static void jtagmkI_discard_ahead(PROGRAMMER * pgm)
+{
+  unsigned char resp[512 + 3];
+  int len = PDATA(pgm)->ahead_size;
+
+  PDATA(pgm)->ahead_mem = NULL;
+  if (jtagmkI_recv_ahead(pgm, resp, len) < 0 || resp[len - 1] != RESP_OK) {
+    jtagmkI_lookahead_lost(pgm, "jtagmkI_send");
+    jtagmkI_resync(pgm, 2000, 0);
+  }
+}
+
 
 static int jtagmkI_resync(PROGRAMMER * pgm, int maxtries, int signon)
 {
@@ -331,21 +410,33 @@ static int jtagmkI_resync(PROGRAMMER * pgm, int maxtries, int signon)
 static int jtagmkI_getsync(PROGRAMMER * pgm)
 {
   unsigned char buf[1], resp[9];
+  int tries;
 
   if (jtagmkI_resync(pgm, 5, 1) < 0) {
     jtagmkI_drain(pgm, 0);
     return -1;
   }
 
-  jtagmkI_drain(pgm, 0);
-
-  if (verbose >= 2)
-    fprintf(stderr, "%s: jtagmkI_getsync(): Sending sign-on command: ",
-	    progname);
+  /*
+   * The resync has consumed its replies, so the line only needs
+   * draining if the sign-on reply shows something else was still in
+   * the way.
+   */
+  for (tries = 0; ; tries++) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: jtagmkI_getsync(): Sending sign-on command: ",
+	      progname);
 
-  buf[0] = CMD_GET_SIGNON;
-  jtagmkI_send(pgm, buf, 1);
-  jtagmkI_recv(pgm, resp, 9);
+    buf[0] = CMD_GET_SIGNON;
+    jtagmkI_send(pgm, buf, 1);
+    if (tries > 0) {
+      jtagmkI_recv(pgm, resp, 9);
+      break;
+    }
+    if (jtagmkI_recv_ahead(pgm, resp, 9) == 0 && resp[0] == RESP_OK)
+      break;
+    jtagmkI_drain(pgm, 0);
+  }
   if (verbose >= 2) {
     resp[8] = '\0';
     fprintf(stderr, "got %s\n", resp + 1);
@@ -679,11 +770,7 @@ static int jtagmkI_open(PROGRAMMER * pgm, char * port)
       return -1;
     }
 
-    /*
-     * drain any extraneous input
-     */
-    jtagmkI_drain(pgm, 0);
-
+    /* jtagmkI_getsync() drains any extraneous input first */
     if (jtagmkI_getsync(pgm) == 0) {
       PDATA(pgm)->initial_baudrate = baudtab[i].baud;
       if (verbose >= 2)
@@ -876,13 +963,193 @@ static int jtagmkI_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   return n_bytes;
 }
 
+/*
+ * Collect the reply to the page write that jtagmkI_paged_write_submit()
+ * left pending.
+ */
+static int jtagmkI_write_done(PROGRAMMER * pgm)
+{
+  unsigned char resp[2];
+
+  PDATA(pgm)->write_pending = 0;
+  if (jtagmkI_recv_ahead(pgm, resp, 2) < 0 || resp[1] != RESP_OK)
+    return -1;
+  if (verbose == 2)
+    fprintf(stderr, "OK\n");
+
+  return 0;
+}
+
+/*
+ * Write the pending page (if its reply went missing) and the page at
+ * addr again the slow way, after the ICE lost track of a command sent
+ * ahead.
+ */
+static int jtagmkI_write_again(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+			       int lost_pending, unsigned int addr,
+			       unsigned int n_bytes)
+{
+  unsigned long pending_addr = PDATA(pgm)->write_addr;
+  unsigned int pending_size = PDATA(pgm)->write_size;
+
+  jtagmkI_lookahead_lost(pgm, "jtagmkI_paged_write_submit");
+  if (jtagmkI_resync(pgm, 2000, 0) < 0)
+    return -1;
+  if (lost_pending &&
+      jtagmkI_paged_write(pgm, p, m, m->page_size,
+			  pending_addr, pending_size) < 0)
+    return -1;
+  if (n_bytes > 0 &&
+      jtagmkI_paged_write(pgm, p, m, m->page_size, addr, n_bytes) < 0)
+    return -1;
+
+  return n_bytes;
+}
+
+/*
+ * Write one page, but leave the reply to its data for later.  The
+ * write memory command for the next page is then sent while the ICE
+ * is still programming this one, so only the data has to wait for the
+ * ICE to get ready.
+ */
+static int jtagmkI_paged_write_submit(PROGRAMMER * pgm, AVRPART * p,
+				      AVRMEM * m, unsigned int page_size,
+				      unsigned int addr, unsigned int n_bytes)
+{
+  unsigned int block_size;
+  unsigned char cmd[6], *datacmd;
+  unsigned char resp[1];
+  int is_flash;
+  long otimeout = serial_recv_timeout;
+
+  if (strcmp(m->desc, "flash") == 0)
+    is_flash = 1;
+  else if (strcmp(m->desc, "eeprom") == 0)
+    is_flash = 0;
+  else
+    is_flash = -1;
+  if (PDATA(pgm)->no_lookahead || is_flash < 0)
+    return jtagmkI_paged_write(pgm, p, m, page_size, addr, n_bytes);
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkI_paged_write_submit(.., %s, %d, %d)\n",
+	    progname, m->desc, page_size, n_bytes);
+
+  if (jtagmkI_program_enable(pgm) < 0)
+    return -1;
+
+  cmd[0] = CMD_WRITE_MEM;
+  if (is_flash) {
+    cmd[1] = MTYPE_FLASH_PAGE;
+    PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+    page_size = PDATA(pgm)->flash_pagesize;
+    cmd[2] = page_size / 2 - 1;
+    u32_to_b3(cmd + 3, addr / 2);
+  } else {
+    cmd[1] = MTYPE_EEPROM_PAGE;
+    PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+    page_size = PDATA(pgm)->eeprom_pagesize;
+    cmd[2] = page_size - 1;
+    u32_to_b3(cmd + 3, addr);
+  }
+
+  if (page_size == 0 || page_size > 256 || n_bytes > page_size) {
+    jtagmkI_paged_write_complete(pgm, p, m);
+    return jtagmkI_paged_write(pgm, p, m, page_size, addr, n_bytes);
+  }
+  block_size = n_bytes;
+
+  if ((datacmd = malloc(page_size + 1)) == NULL) {
+    fprintf(stderr, "%s: jtagmkI_paged_write_submit(): Out of memory\n",
+	    progname);
+    return -1;
+  }
+  /* full pages only, see jtagmkI_paged_write() */
+  datacmd[0] = CMD_DATA;
+  memset(datacmd + 1, 0xff, page_size);
+  memcpy(datacmd + 1, m->buf + addr, block_size);
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkI_paged_write_submit(): "
+	    "Sending write memory command: ",
+	    progname);
+  jtagmkI_send(pgm, cmd, 6);
+
+  serial_recv_timeout = 1000;
+  if (PDATA(pgm)->write_pending && jtagmkI_write_done(pgm) < 0) {
+    serial_recv_timeout = otimeout;
+    free(datacmd);
+    return jtagmkI_write_again(pgm, p, m, 1, addr, n_bytes);
+  }
+  if (jtagmkI_recv_ahead(pgm, resp, 1) < 0 || resp[0] != RESP_OK) {
+    serial_recv_timeout = otimeout;
+    free(datacmd);
+    return jtagmkI_write_again(pgm, p, m, 0, addr, n_bytes);
+  }
+  serial_recv_timeout = otimeout;
+
+  jtagmkI_send(pgm, datacmd, page_size + 1);
+  free(datacmd);
+
+  PDATA(pgm)->write_pending = 1;
+  PDATA(pgm)->write_addr = addr;
+  PDATA(pgm)->write_size = n_bytes;
+
+  return n_bytes;
+}
+
+static int jtagmkI_paged_write_complete(PROGRAMMER * pgm, AVRPART * p,
+					AVRMEM * m)
+{
+  if (!PDATA(pgm)->write_pending)
+    return 0;
+
+  if (jtagmkI_write_done(pgm) < 0 &&
+      jtagmkI_write_again(pgm, p, m, 1, 0, 0) < 0)
+    return -1;
+
+  return 0;
+}
+
+/*
+ * Fill in the read memory command for the block at addr, and return
+ * the number of data bytes it will answer with.
+ */
+static int jtagmkI_read_cmd(unsigned char * cmd, int is_flash,
+			    unsigned int page_size, unsigned long addr,
+			    int block_size)
+{
+  int read_size;
+
+  if (is_flash) {
+    read_size = 2 * ((block_size + 1) / 2); /* round up */
+    cmd[2] = read_size / 2 - 1;
+    u32_to_b3(cmd + 3, addr / 2);
+  } else {
+    read_size = page_size;
+    cmd[2] = page_size - 1;
+    u32_to_b3(cmd + 3, addr);
+  }
+
+  return read_size;
+}
+
+/*
+ * Unless the ICE has been seen to lose commands, the read command for
+ * the block following the one asked for is sent while the reply to
+ * the latter is coming in, so the ICE reads the next block as soon as
+ * it is done sending this one.  A caller that continues there finds
+ * its block requested already.
+ */
 static int jtagmkI_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 			      unsigned int page_size,
                               unsigned int addr, unsigned int n_bytes)
 {
-  int block_size, read_size, is_flash = 0, tries;
+  int block_size, read_size, is_flash = 0, tries, ahead;
   unsigned int maxaddr = addr + n_bytes;
-  unsigned char cmd[6], resp[256 * 2 + 3];
+  unsigned char cmd[6], next[6], resp[256 * 2 + 3];
+  unsigned long nextaddr;
+  int next_size;
   long otimeout = serial_recv_timeout;
 #define MAXTRIES 3
 
@@ -902,6 +1169,7 @@ static int jtagmkI_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   } else if (strcmp(m->desc, "eeprom") == 0) {
     cmd[1] = MTYPE_EEPROM_PAGE;
   }
+  memcpy(next, cmd, 2);
 
   if (page_size > (is_flash? 512: 256)) {
     fprintf(stderr, "%s: jtagmkI_paged_load(): page size %d too large\n",
@@ -920,8 +1188,8 @@ static int jtagmkI_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       return -1;
     }
 
-    if ((n_bytes-addr) < page_size)
-      block_size = n_bytes - addr;
+    if ((maxaddr-addr) < page_size)
+      block_size = maxaddr - addr;
     else
       block_size = page_size;
     if (verbose >= 3)
@@ -929,22 +1197,54 @@ static int jtagmkI_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	      "block_size at addr %d is %d\n",
 	      progname, addr, block_size);
 
-    if (is_flash) {
-      read_size = 2 * ((block_size + 1) / 2); /* round up */
-      cmd[2] = read_size / 2 - 1;
-      u32_to_b3(cmd + 3, addr / 2);
+    read_size = jtagmkI_read_cmd(cmd, is_flash, page_size, addr, block_size);
+
+    ahead = !PDATA(pgm)->no_lookahead;
+    if (PDATA(pgm)->ahead_mem == m && PDATA(pgm)->ahead_addr == addr &&
+	PDATA(pgm)->ahead_size == read_size + 3) {
+      /* asked for by the previous call already */
+      PDATA(pgm)->ahead_mem = NULL;
+      if (verbose >= 2)
+	fprintf(stderr, "%s: jtagmkI_paged_load(): Read memory command "
+		"sent ahead: ", progname);
     } else {
-      read_size = page_size;
-      cmd[2] = page_size - 1;
-      u32_to_b3(cmd + 3, addr);
-    }
+      if (verbose >= 2)
+	fprintf(stderr, "%s: jtagmkI_paged_load(): Sending read memory command: ",
+		progname);
 
-    if (verbose >= 2)
-      fprintf(stderr, "%s: jtagmkI_paged_load(): Sending read memory command: ",
-	      progname);
+      jtagmkI_send(pgm, cmd, 6);
+    }
 
-    jtagmkI_send(pgm, cmd, 6);
-    jtagmkI_recv(pgm, resp, read_size + 3);
+    if (ahead) {
+      /*
+       * With no sequence numbers, a lost command could only be told
+       * from a late one by the timeout, so the reply to this command
+       * has to start before the next one is sent.
+       */
+      if (jtagmkI_recv_ahead(pgm, resp, 1) < 0) {
+	jtagmkI_lookahead_lost(pgm, "jtagmkI_paged_load");
+	tries++;
+	goto again;
+      }
+      /* the same amount again from where this block ends */
+      nextaddr = addr + block_size;
+      if (nextaddr < m->size) {
+	next_size = jtagmkI_read_cmd(next, is_flash, page_size, nextaddr,
+				     m->size - nextaddr < block_size?
+				     m->size - nextaddr: block_size);
+	jtagmkI_send(pgm, next, 6);
+	PDATA(pgm)->ahead_mem = m;
+	PDATA(pgm)->ahead_addr = nextaddr;
+	PDATA(pgm)->ahead_size = next_size + 3;
+      }
+      if (jtagmkI_recv_ahead(pgm, resp + 1, read_size + 2) < 0) {
+	jtagmkI_lookahead_lost(pgm, "jtagmkI_paged_load");
+	tries++;
+	goto again;
+      }
+    } else {
+      jtagmkI_recv(pgm, resp, read_size + 3);
+    }
 
     if (resp[read_size + 3 - 1] != RESP_OK) {
       if (verbose >= 2)
@@ -953,6 +1253,8 @@ static int jtagmkI_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
               "%s: jtagmkI_paged_load(): "
               "timeout/error communicating with programmer (resp %c)\n",
               progname, resp[read_size + 3 - 1]);
+      if (ahead)
+	jtagmkI_lookahead_lost(pgm, "jtagmkI_paged_load");
       if (tries++ < MAXTRIES)
 	goto again;
 
@@ -1399,6 +1701,8 @@ void jtagmkI_initpgm(PROGRAMMER * pgm)
    */
   pgm->paged_write    = jtagmkI_paged_write;
   pgm->paged_load     = jtagmkI_paged_load;
+  pgm->paged_write_submit   = jtagmkI_paged_write_submit;
+  pgm->paged_write_complete = jtagmkI_paged_write_complete;
   pgm->print_parms    = jtagmkI_print_parms;
   pgm->set_sck_period = jtagmkI_set_sck_period;
   pgm->setup          = jtagmkI_setup;
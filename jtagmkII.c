@@ -44,10 +44,13 @@
 
 #include "avrdude.h"
 #include "avr.h"
+#include "cachefile.h"
 #include "crc16.h"
 #include "pgm.h"
 #include "jtagmkII.h"
 #include "jtagmkII_private.h"
+#include "pagecache.h"
+#include "stats.h"
 #include "serial.h"
 #include "usbdevs.h"
 
@@ -62,12 +65,10 @@ struct pdata
    * See jtagmkII_read_byte() for an explanation of the flash and
    * EEPROM page caches.
    */
-  unsigned char *flash_pagecache;
-  unsigned long flash_pageaddr;
+  struct pagecache flash_cache;
   unsigned int flash_pagesize;
 
-  unsigned char *eeprom_pagecache;
-  unsigned long eeprom_pageaddr;
+  struct pagecache eeprom_cache;
   unsigned int eeprom_pagesize;
 
   int prog_enabled;	     /* Cached value of PROGRAMMING status. */
@@ -84,6 +85,31 @@ struct pdata
 
   /* Major firmware version (needed for Xmega programming) */
   unsigned int fwver;
+
+  /*
+   * Receive buffer, lent out by jtagmkII_recv() until the caller
+   * passes the message to jtagmkII_release().  Frames arriving while
+   * it is lent out get a buffer of their own.
+   */
+  unsigned char *rbuf;
+  size_t rbuf_size;
+  int rbuf_lent;
+
+  /*
+   * AVR32 page writes submitted since the target was reset for
+   * writing, whether the last of them is still programming, and the
+   * pages [avr32_erase_first, avr32_erase_end) unlocked and erased
+   * for them.
+   */
+  unsigned int avr32_pending;
+  int avr32_writing;
+  int avr32_busy;
+  unsigned int avr32_erase_first, avr32_erase_end;
+
+  /* line speed, 0 for the 19200 Bd the port was opened at */
+  long link_baud;
+  long signon_baud;             /* line speed of the last sign-on */
+  int link_mode;                /* emulator mode of the last sign-on */
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -165,9 +191,17 @@ static int jtagmkII_smc_init32(PROGRAMMER * pgm);
 static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                   unsigned int page_size,
                                   unsigned int addr, unsigned int n_bytes);
+static int jtagmkII_paged_write_submit32(PROGRAMMER * pgm, AVRPART * p,
+                                         AVRMEM * m, unsigned int page_size,
+                                         unsigned int addr,
+                                         unsigned int n_bytes);
+static int jtagmkII_paged_write_complete32(PROGRAMMER * pgm, AVRPART * p,
+                                           AVRMEM * m);
 static int jtagmkII_flash_lock32(PROGRAMMER * pgm, unsigned char lock,
                                   unsigned int page);
-static int jtagmkII_flash_erase32(PROGRAMMER * pgm, unsigned int page);
+static int jtagmkII_flash_wait32(PROGRAMMER * pgm, unsigned long * fsr);
+static int jtagmkII_flash_erase32(PROGRAMMER * pgm, unsigned int page,
+                                  unsigned int npages);
 static int jtagmkII_flash_write_page32(PROGRAMMER * pgm, unsigned int page);
 static int jtagmkII_flash_clear_pagebuffer32(PROGRAMMER * pgm);
 static int jtagmkII_paged_load32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
@@ -187,6 +221,7 @@ void jtagmkII_setup(PROGRAMMER * pgm)
 
 void jtagmkII_teardown(PROGRAMMER * pgm)
 {
+  free(PDATA(pgm)->rbuf);
   free(pgm->cookie);
 }
 
@@ -422,41 +457,68 @@ static void jtagmkII_prmsg(PROGRAMMER * pgm, unsigned char * data, size_t len)
 }
 
 
-int jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
+/*
+ * Send the segments of iov as the body of one frame, so callers can
+ * put a header in front of their data without copying it.
+ */
+int jtagmkII_sendv(PROGRAMMER * pgm, const struct serial_iov * iov, int iovcnt)
 {
-  unsigned char *buf;
+  unsigned char hdr[8], crcbuf[2];
+  unsigned short crc;
+  struct serial_iov v[JTAGMKII_MAXIOV + 2];
+  size_t len;
+  int i;
+
+  if (iovcnt > JTAGMKII_MAXIOV) {
+    fprintf(stderr, "%s: jtagmkII_sendv(): too many segments\n", progname);
+    return -1;
+  }
+
+  for (len = 0, i = 0; i < iovcnt; i++)
+    len += iov[i].len;
 
   if (verbose >= 3)
     fprintf(stderr, "\n%s: jtagmkII_send(): sending %lu bytes\n",
 	    progname, (unsigned long)len);
 
-  if ((buf = malloc(len + 10)) == NULL)
-    {
-      fprintf(stderr, "%s: jtagmkII_send(): out of memory",
-	      progname);
-      return -1;
-    }
-
-  buf[0] = MESSAGE_START;
-  u16_to_b2(buf + 1, PDATA(pgm)->command_sequence);
-  u32_to_b4(buf + 3, len);
-  buf[7] = TOKEN;
-  memcpy(buf + 8, data, len);
-
-  crcappend(buf, len + 8);
-
-  if (serial_send(&pgm->fd, buf, len + 10) != 0) {
+  hdr[0] = MESSAGE_START;
+  u16_to_b2(hdr + 1, PDATA(pgm)->command_sequence);
+  u32_to_b4(hdr + 3, len);
+  hdr[7] = TOKEN;
+
+  crc = crcsum(hdr, 8, CRC_INIT);
+  for (i = 0; i < iovcnt; i++)
+    crc = crcsum(iov[i].buf, iov[i].len, crc);
+  crcbuf[0] = crc & 0xff;
+  crcbuf[1] = (crc >> 8) & 0xff;
+
+  v[0].buf = hdr;
+  v[0].len = 8;
+  for (i = 0; i < iovcnt; i++)
+    v[i + 1] = iov[i];
+  v[iovcnt + 1].buf = crcbuf;
+  v[iovcnt + 1].len = 2;
+
+  if (serial_sendv(&pgm->fd, v, iovcnt + 2) != 0) {
     fprintf(stderr,
 	    "%s: jtagmkII_send(): failed to send command to serial port\n",
 	    progname);
     exit(1);
   }
 
-  free(buf);
-
   return 0;
 }
 
+int jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
+{
+  struct serial_iov iov;
+
+  iov.buf = data;
+  iov.len = len;
+
+  return jtagmkII_sendv(pgm, &iov, 1);
+}
+
 
 static int jtagmkII_drain(PROGRAMMER * pgm, int display)
 {
@@ -464,13 +526,56 @@ static int jtagmkII_drain(PROGRAMMER * pgm, int display)
 }
 
 
+/*
+ * Get a buffer for a frame of len bytes: the receive buffer if it is
+ * not lent out, a separate one otherwise.
+ */
+static unsigned char *jtagmkII_frame_alloc(PROGRAMMER * pgm, size_t len)
+{
+  unsigned char *buf;
+
+  if (PDATA(pgm)->rbuf_lent)
+    return malloc(len);
+
+  if (len > PDATA(pgm)->rbuf_size) {
+    if ((buf = realloc(PDATA(pgm)->rbuf, len)) == NULL)
+      return NULL;
+    PDATA(pgm)->rbuf = buf;
+    PDATA(pgm)->rbuf_size = len;
+  }
+  PDATA(pgm)->rbuf_lent = 1;
+
+  return PDATA(pgm)->rbuf;
+}
+
+static void jtagmkII_frame_free(PROGRAMMER * pgm, unsigned char * buf)
+{
+  if (buf == NULL)
+    return;
+  if (buf == PDATA(pgm)->rbuf)
+    PDATA(pgm)->rbuf_lent = 0;
+  else
+    free(buf);
+}
+
+/*
+ * Give back a message returned by jtagmkII_recv().
+ */
+void jtagmkII_release(PROGRAMMER * pgm, unsigned char * msg)
+{
+  if (msg != NULL)
+    jtagmkII_frame_free(pgm, msg - 8);
+}
+
 /*
  * Receive one frame, return it in *msg.  Received sequence number is
  * returned in seqno.  Any valid frame will be returned, regardless
  * whether it matches the expected sequence number, including event
  * notification frames (seqno == 0xffff).
  *
- * Caller must eventually free the buffer.
+ * The buffer comes from jtagmkII_frame_alloc(); the caller gives it
+ * back with jtagmkII_frame_free(), or, for the payload jtagmkII_recv()
+ * hands out, jtagmkII_release().
  */
 static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
 			       unsigned short * seqno) {
@@ -520,7 +625,7 @@ static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
 	  fprintf(stderr,
 		  "%s: jtagmkII_recv(): Timeout receiving packet\n",
 		  progname);
-	free(buf);
+	jtagmkII_frame_free(pgm, buf);
 	return -1;
       }
     } else {
@@ -564,7 +669,7 @@ static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
 		    progname, msglen, MAX_MESSAGE);
 	    state = sSTART;
 	    headeridx = 0;
-	  } else if ((buf = malloc(msglen + 10)) == NULL) {
+	  } else if ((buf = jtagmkII_frame_alloc(pgm, msglen + 10)) == NULL) {
 	    fprintf(stderr, "%s: jtagmkII_recv(): out of memory\n",
 		    progname);
 	    ignorpkt++;
@@ -593,7 +698,7 @@ static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
 	  } else {
 	    fprintf(stderr, "%s: jtagmkII_recv(): checksum error\n",
 		    progname);
-	    free(buf);
+	    jtagmkII_frame_free(pgm, buf);
 	    return -4;
 	  }
 	} else
@@ -602,7 +707,7 @@ static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
       default:
         fprintf(stderr, "%s: jtagmkII_recv(): unknown state\n",
                 progname);
-	free(buf);
+	jtagmkII_frame_free(pgm, buf);
         return -5;
      }
 
@@ -611,6 +716,7 @@ static int jtagmkII_recv_frame(PROGRAMMER * pgm, unsigned char **msg,
      if (tnow - tstart > timeoutval) {
        fprintf(stderr, "%s: jtagmkII_recv_frame(): timeout\n",
                progname);
+       jtagmkII_frame_free(pgm, buf);
        return -1;
      }
 
@@ -629,8 +735,13 @@ int jtagmkII_recv(PROGRAMMER * pgm, unsigned char **msg) {
   int rv;
 
   for (;;) {
-    if ((rv = jtagmkII_recv_frame(pgm, msg, &r_seqno)) <= 0)
+    if ((rv = jtagmkII_recv_frame(pgm, msg, &r_seqno)) <= 0) {
+      /* callers do not release an empty frame, or one never received */
+      if (rv == 0)
+        jtagmkII_frame_free(pgm, *msg);
+      *msg = NULL;
       return rv;
+    }
     if (verbose >= 3)
       fprintf(stderr, "%s: jtagmkII_recv(): "
 	      "Got message seqno %d (command_sequence == %d)\n",
@@ -639,11 +750,10 @@ int jtagmkII_recv(PROGRAMMER * pgm, unsigned char **msg) {
       if (++(PDATA(pgm)->command_sequence) == 0xffff)
 	PDATA(pgm)->command_sequence = 0;
       /*
-       * We move the payload to the beginning of the buffer, to make
-       * the job easier for the caller.  We have to return the
-       * original pointer though, as the caller must free() it.
+       * Hand out the payload in place; the caller gives it back
+       * through jtagmkII_release().
        */
-      memmove(*msg, *msg + 8, rv);
+      *msg += 8;
 
       if (verbose == 4)
       {
@@ -678,11 +788,144 @@ int jtagmkII_recv(PROGRAMMER * pgm, unsigned char **msg) {
 		"got wrong sequence number, %u != %u\n",
 		progname, r_seqno, PDATA(pgm)->command_sequence);
     }
-    free(*msg);
+    jtagmkII_frame_free(pgm, *msg);
   }
 }
 
 
+/*
+ * How each ICE was reached on a serial port last time is kept in a
+ * small file, so the next sign-on can try that first rather than
+ * wait for timeouts at 19200 Bd while the ICE is still at the speed a
+ * killed run left it at.
+ */
+#define JTAGMKII_QUICK_TIMEOUT 250      /* ms for a sign-on tried first */
+
+struct jtagmkII_link {
+  unsigned char serno[6];
+  int mode;                     /* emulator mode asked for */
+  unsigned int fwver;
+  long signon_baud;             /* speed the ICE signed on at */
+  long baud;                    /* speed the session went on at */
+};
+
+static char jtagmkII_file[PATH_MAX];
+
+void jtagmkII_cache(const char * file)
+{
+  snprintf(jtagmkII_file, sizeof(jtagmkII_file), "%s", file);
+}
+
+/* whether port can be a key of the cache file */
+static int jtagmkII_link_key(const char * port)
+{
+  const char * s;
+
+  if (jtagmkII_file[0] == 0 || port[0] == 0 || strlen(port) > 400)
+    return 0;
+  for (s = port; *s != 0; s++)
+    if (isspace((int)*s))
+      return 0;
+
+  return 1;
+}
+
+/*
+ * The cache file holds "<port> <serial number> <mode> <firmware>
+ * <sign-on baud> <baud>" lines.  Returns 0 if port is in it.
+ */
+static int jtagmkII_link_lookup(const char * port, struct jtagmkII_link * l)
+{
+  char value[128], serno[13];
+  struct jtagmkII_link e;
+  unsigned int b;
+  int i;
+
+  if (!jtagmkII_link_key(port) ||
+      cachefile_lookup(jtagmkII_file, port, value, sizeof(value)) < 0 ||
+      sscanf(value, "%12s %d %x %ld %ld", serno, &e.mode, &e.fwver,
+             &e.signon_baud, &e.baud) != 5 ||
+      strlen(serno) != 12 || e.signon_baud <= 0 || e.baud <= 0)
+    return -1;
+  for (i = 0; i < 6 && sscanf(serno + 2 * i, "%2x", &b) == 1; i++)
+    e.serno[i] = b;
+  if (i != 6)
+    return -1;
+  *l = e;
+
+  return 0;
+}
+
+static void jtagmkII_link_remember(const char * port,
+                                   const struct jtagmkII_link * l)
+{
+  struct jtagmkII_link old;
+  char value[128];
+
+  if (!jtagmkII_link_key(port) ||
+      (jtagmkII_link_lookup(port, &old) == 0 &&
+       memcmp(&old, l, sizeof(old)) == 0))
+    return;
+
+  snprintf(value, sizeof(value), "%02x%02x%02x%02x%02x%02x %d %x %ld %ld",
+           l->serno[0], l->serno[1], l->serno[2], l->serno[3], l->serno[4],
+           l->serno[5], l->mode, l->fwver, l->signon_baud, l->baud);
+  cachefile_remember(jtagmkII_file, port, value, "JTAG ICE link cache");
+}
+
+/* switch the serial line to baud, if it is not there yet */
+static void jtagmkII_link_speed(PROGRAMMER * pgm, long baud)
+{
+  if ((PDATA(pgm)->link_baud? PDATA(pgm)->link_baud: 19200) == baud)
+    return;
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkII_getsync(): trying %ld Bd\n",
+            progname, baud);
+  serial_setspeed(&pgm->fd, baud);
+  PDATA(pgm)->link_baud = baud;
+}
+
+/*
+ * Fill in bauds[] with the speeds to try a quick sign-on at before
+ * the usual one at 19200 Bd, and return how many there are.
+ */
+static int jtagmkII_link_bauds(PROGRAMMER * pgm, int mode, long bauds[2])
+{
+  struct jtagmkII_link l;
+  int n = 0;
+
+  if (!(serdev->flags & SERDEV_FL_CANSETSPEED) ||
+      jtagmkII_link_lookup(pgm->port, &l) < 0 || l.mode != mode)
+    return 0;
+
+  bauds[n++] = l.signon_baud;
+  if (l.baud != l.signon_baud)
+    bauds[n++] = l.baud;
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkII_getsync(): ICE %02x:%02x:%02x:%02x:%02x:%02x "
+            "signed on at %ld Bd last time, went on at %ld Bd\n",
+            progname, l.serno[0], l.serno[1], l.serno[2], l.serno[3],
+            l.serno[4], l.serno[5], l.signon_baud, l.baud);
+
+  return n;
+}
+
+/* note how the ICE is reached, as of now */
+static void jtagmkII_link_save(PROGRAMMER * pgm)
+{
+  struct jtagmkII_link l;
+
+  if (!(serdev->flags & SERDEV_FL_CANSETSPEED))
+    return;
+  memset(&l, 0, sizeof(l));
+  memcpy(l.serno, PDATA(pgm)->serno, sizeof(l.serno));
+  l.mode = PDATA(pgm)->link_mode;
+  l.fwver = PDATA(pgm)->fwver;
+  l.signon_baud = PDATA(pgm)->signon_baud;
+  l.baud = PDATA(pgm)->link_baud? PDATA(pgm)->link_baud: 19200;
+  jtagmkII_link_remember(pgm->port, &l);
+}
+
 int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
   int tries;
 #define MAXTRIES 33
@@ -690,6 +933,8 @@ int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
   int status;
   unsigned int fwver, hwver;
   int is_dragon;
+  long bauds[2], otimeout;
+  int nquick;
 
   if (verbose >= 3)
     fprintf(stderr, "%s: jtagmkII_getsync()\n", progname);
@@ -704,7 +949,19 @@ int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
             progname);
     return -1;
   }
-  for (tries = 0; tries < MAXTRIES; tries++) {
+  /* first the speeds that worked before, briefly */
+  nquick = jtagmkII_link_bauds(pgm, mode, bauds);
+  otimeout = serial_recv_timeout;
+  for (tries = -nquick; tries < MAXTRIES; tries++) {
+    if (tries < 0) {
+      jtagmkII_link_speed(pgm, bauds[tries + nquick]);
+      serial_recv_timeout = JTAGMKII_QUICK_TIMEOUT;
+    } else if (tries == 0 && nquick > 0) {
+      /* from the speed the ICE starts at, as if it were unknown */
+      serial_recv_timeout = otimeout;
+      jtagmkII_link_speed(pgm, 19200);
+      jtagmkII_drain(pgm, 0);
+    }
 
     /* Get the sign-on information. */
     buf[0] = CMND_GET_SIGN_ON;
@@ -715,6 +972,7 @@ int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
 
     status = jtagmkII_recv(pgm, &resp);
     if (status <= 0) {
+      if (tries >= 0 || verbose >= 2)
 	fprintf(stderr, "%s: jtagmkII_getsync(): sign-on command: "
 		"status %d\n",
 		progname, status);
@@ -757,9 +1015,10 @@ int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
 	}
 	break;
       }
-      free(resp);
+      jtagmkII_release(pgm, resp);
     }
   }
+  serial_recv_timeout = otimeout;
   if (tries >= MAXTRIES) {
     if (status <= 0)
       fprintf(stderr,
@@ -829,6 +1088,10 @@ int jtagmkII_getsync(PROGRAMMER * pgm, int mode) {
   }
 #undef FWVER
 
+  PDATA(pgm)->link_mode = mode;
+  PDATA(pgm)->signon_baud = PDATA(pgm)->link_baud? PDATA(pgm)->link_baud: 19200;
+  jtagmkII_link_save(pgm);
+
   if(mode < 0) return 0;  // for AVR32
 
   tries = 0;
@@ -897,7 +1160,7 @@ retry:
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_getsync(): "
@@ -949,7 +1212,7 @@ static int jtagmkII_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_chip_erase(): "
@@ -958,6 +1221,9 @@ static int jtagmkII_chip_erase(PROGRAMMER * pgm, AVRPART * p)
     return -1;
   }
 
+  pagecache_clear(&PDATA(pgm)->flash_cache);
+  pagecache_clear(&PDATA(pgm)->eeprom_cache);
+
   if (!(p->flags & AVRPART_HAS_PDI))
       pgm->initialize(pgm, p);
 
@@ -1041,7 +1307,7 @@ static void jtagmkII_set_devdescr(PROGRAMMER * pgm, AVRPART * p)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_set_devdescr(): "
@@ -1121,7 +1387,7 @@ static void jtagmkII_set_xmega_params(PROGRAMMER * pgm, AVRPART * p)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_set_xmega_params(): "
@@ -1171,7 +1437,7 @@ static int jtagmkII_reset(PROGRAMMER * pgm, unsigned char flags)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_reset(): "
@@ -1221,7 +1487,7 @@ static int jtagmkII_program_enable(PROGRAMMER * pgm)
     } else if (verbose == 2)
       fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
     c = resp[0];
-    free(resp);
+    jtagmkII_release(pgm, resp);
     if (c != RSP_OK) {
       fprintf(stderr,
 	      "%s: jtagmkII_program_enable(): "
@@ -1280,7 +1546,7 @@ static int jtagmkII_program_disable(PROGRAMMER * pgm)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_program_disable(): "
@@ -1359,8 +1625,11 @@ static int jtagmkII_initialize(PROGRAMMER * pgm, AVRPART * p)
 	fprintf(stderr, "%s: jtagmkII_initialize(): "
 		"trying to set baudrate to %d\n",
 		progname, pgm->baudrate);
-      if (jtagmkII_setparm(pgm, PAR_BAUD_RATE, &b) == 0)
+      if (jtagmkII_setparm(pgm, PAR_BAUD_RATE, &b) == 0) {
 	serial_setspeed(&pgm->fd, pgm->baudrate);
+	PDATA(pgm)->link_baud = pgm->baudrate;
+	jtagmkII_link_save(pgm);
+      }
     }
   }
   if ((pgm->flag & PGM_FL_IS_JTAG) && pgm->bitclock != 0.0) {
@@ -1428,20 +1697,15 @@ static int jtagmkII_initialize(PROGRAMMER * pgm, AVRPART * p)
     }
   }
 
-  free(PDATA(pgm)->flash_pagecache);
-  free(PDATA(pgm)->eeprom_pagecache);
-  if ((PDATA(pgm)->flash_pagecache = malloc(PDATA(pgm)->flash_pagesize)) == NULL) {
+  if (pagecache_init(&PDATA(pgm)->flash_cache,
+                     PDATA(pgm)->flash_pagesize) < 0 ||
+      pagecache_init(&PDATA(pgm)->eeprom_cache,
+                     PDATA(pgm)->eeprom_pagesize) < 0) {
     fprintf(stderr, "%s: jtagmkII_initialize(): Out of memory\n",
 	    progname);
+    pagecache_free(&PDATA(pgm)->flash_cache);
     return -1;
   }
-  if ((PDATA(pgm)->eeprom_pagecache = malloc(PDATA(pgm)->eeprom_pagesize)) == NULL) {
-    fprintf(stderr, "%s: jtagmkII_initialize(): Out of memory\n",
-	    progname);
-    free(PDATA(pgm)->flash_pagecache);
-    return -1;
-  }
-  PDATA(pgm)->flash_pageaddr = PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
 
   if (PDATA(pgm)->fwver >= 0x700 && (p->flags & AVRPART_HAS_PDI)) {
     /*
@@ -1477,10 +1741,8 @@ static int jtagmkII_initialize(PROGRAMMER * pgm, AVRPART * p)
 static void jtagmkII_disable(PROGRAMMER * pgm)
 {
 
-  free(PDATA(pgm)->flash_pagecache);
-  PDATA(pgm)->flash_pagecache = NULL;
-  free(PDATA(pgm)->eeprom_pagecache);
-  PDATA(pgm)->eeprom_pagecache = NULL;
+  pagecache_free(&PDATA(pgm)->flash_cache);
+  pagecache_free(&PDATA(pgm)->eeprom_cache);
 
   /*
    * jtagmkII_program_disable() doesn't do anything if the
@@ -1892,7 +2154,7 @@ void jtagmkII_close(PROGRAMMER * pgm)
       } else if (verbose == 2)
 	fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
       c = resp[0];
-      free(resp);
+      jtagmkII_release(pgm, resp);
       if (c != RSP_OK) {
 	fprintf(stderr,
 		"%s: jtagmkII_close(): "
@@ -1924,7 +2186,7 @@ void jtagmkII_close(PROGRAMMER * pgm)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_close(): "
@@ -2007,6 +2269,7 @@ static int jtagmkII_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
               progname, status);
     if (tries++ < 4) {
       serial_recv_timeout *= 2;
+      stats_retry();
       goto retry;
     }
     fprintf(stderr,
@@ -2026,11 +2289,11 @@ static int jtagmkII_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
             "%s: jtagmkII_page_erase(): "
             "bad response to xmega erase command: %s\n",
             progname, jtagmkII_get_rc(resp[0]));
-    free(resp);
+    jtagmkII_release(pgm, resp);
     serial_recv_timeout = otimeout;
     return -1;
   }
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   serial_recv_timeout = otimeout;
 
@@ -2066,7 +2329,7 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
   cmd[0] = CMND_WRITE_MEMORY;
   if (strcmp(m->desc, "flash") == 0) {
-    PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+    pagecache_invalidate(&PDATA(pgm)->flash_cache, m->offset + addr, n_bytes);
     cmd[1] = jtagmkII_memtype(pgm, p, addr);
     if (p->flags & AVRPART_HAS_PDI)
       /* dynamically decide between flash/boot memtype */
@@ -2088,12 +2351,15 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       return n_bytes;
     }
     cmd[1] = ( p->flags & AVRPART_HAS_PDI ) ? MTYPE_EEPROM : MTYPE_EEPROM_PAGE;
-    PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+    pagecache_invalidate(&PDATA(pgm)->eeprom_cache, m->offset + addr, n_bytes);
   } else if ( ( strcmp(m->desc, "usersig") == 0 ) ) {
     cmd[1] = MTYPE_USERSIG;
   } else if ( ( strcmp(m->desc, "boot") == 0 ) ) {
+    pagecache_invalidate(&PDATA(pgm)->flash_cache, m->offset + addr, n_bytes);
     cmd[1] = MTYPE_BOOT_FLASH;
   } else if ( p->flags & AVRPART_HAS_PDI ) {
+    /* application, apptable */
+    pagecache_invalidate(&PDATA(pgm)->flash_cache, m->offset + addr, n_bytes);
     cmd[1] = MTYPE_FLASH;
   } else {
     cmd[1] = MTYPE_SPM;
@@ -2145,6 +2411,7 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		progname, status);
       if (tries++ < 4) {
 	serial_recv_timeout *= 2;
+	stats_retry();
 	goto retry;
       }
       fprintf(stderr,
@@ -2165,12 +2432,12 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	      "%s: jtagmkII_paged_write(): "
 	      "bad response to write memory command: %s\n",
 	      progname, jtagmkII_get_rc(resp[0]));
-      free(resp);
+      jtagmkII_release(pgm, resp);
       free(cmd);
       serial_recv_timeout = otimeout;
       return -1;
     }
-    free(resp);
+    jtagmkII_release(pgm, resp);
   }
 
   free(cmd);
@@ -2256,6 +2523,7 @@ static int jtagmkII_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		progname, status);
       if (tries++ < 4) {
 	serial_recv_timeout *= 2;
+	stats_retry();
 	goto retry;
       }
       fprintf(stderr,
@@ -2275,12 +2543,12 @@ static int jtagmkII_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	      "%s: jtagmkII_paged_load(): "
 	      "bad response to read memory command: %s\n",
 	      progname, jtagmkII_get_rc(resp[0]));
-      free(resp);
+      jtagmkII_release(pgm, resp);
       serial_recv_timeout = otimeout;
       return -1;
     }
     memcpy(m->buf + addr, resp + 1, status-1);
-    free(resp);
+    jtagmkII_release(pgm, resp);
   }
   serial_recv_timeout = otimeout;
 
@@ -2291,10 +2559,11 @@ static int jtagmkII_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 			      unsigned long addr, unsigned char * value)
 {
   unsigned char cmd[10];
-  unsigned char *resp = NULL, *cache_ptr = NULL;
+  unsigned char *resp = NULL, *cache_ptr;
   int status, tries, unsupp;
-  unsigned long paddr = 0UL, *paddr_ptr = NULL;
-  unsigned int pagesize = 0;
+  struct pagecache *pc = NULL;
+  unsigned long paddr = 0UL, end;
+  unsigned int len = 0;
 
   if (verbose >= 2)
     fprintf(stderr, "%s: jtagmkII_read_byte(.., %s, 0x%lx, ...)\n",
@@ -2312,20 +2581,14 @@ static int jtagmkII_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       strcmp(mem->desc, "application") == 0 ||
       strcmp(mem->desc, "apptable") == 0 ||
       strcmp(mem->desc, "boot") == 0) {
-    pagesize = PDATA(pgm)->flash_pagesize;
-    paddr = addr & ~(pagesize - 1);
-    paddr_ptr = &PDATA(pgm)->flash_pageaddr;
-    cache_ptr = PDATA(pgm)->flash_pagecache;
+    pc = &PDATA(pgm)->flash_cache;
   } else if (strcmp(mem->desc, "eeprom") == 0) {
     if ( (pgm->flag & PGM_FL_IS_DW) || ( p->flags & AVRPART_HAS_PDI ) ) {
       /* debugWire cannot use page access for EEPROM */
       cmd[1] = MTYPE_EEPROM;
     } else {
       cmd[1] = MTYPE_EEPROM_PAGE;
-      pagesize = mem->page_size;
-      paddr = addr & ~(pagesize - 1);
-      paddr_ptr = &PDATA(pgm)->eeprom_pageaddr;
-      cache_ptr = PDATA(pgm)->eeprom_pagecache;
+      pc = &PDATA(pgm)->eeprom_cache;
     }
   } else if (strcmp(mem->desc, "lfuse") == 0) {
     cmd[1] = MTYPE_FUSE_BITS;
@@ -2402,18 +2665,22 @@ static int jtagmkII_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
    * To improve the read speed, we used paged reads for flash and
    * EEPROM, and cache the results in a page cache.
    *
-   * Page cache validation is based on "{flash,eeprom}_pageaddr"
-   * (holding the base address of the most recent cache fill
-   * operation).  This variable is set to (unsigned long)-1L when the
-   * cache needs to be invalidated.
+   * The cache holds several pages; writes only invalidate the pages
+   * they touch.  Reading on from the page fetched last reads as many
+   * pages in one command as the memory's readsize allows.
    */
-  if (pagesize && paddr == *paddr_ptr) {
-    *value = cache_ptr[addr & (pagesize - 1)];
+  if (pc != NULL && pc->pagesize == 0)
+    pc = NULL;
+  if (pc != NULL && (cache_ptr = pagecache_lookup(pc, addr)) != NULL) {
+    *value = *cache_ptr;
     return 0;
   }
 
-  if (pagesize) {
-    u32_to_b4(cmd + 2, pagesize);
+  if (pc != NULL) {
+    paddr = addr & ~(unsigned long)(pc->pagesize - 1);
+    end = mem->offset + mem->size;
+    len = pagecache_readahead(pc, paddr, end, mem->readsize);
+    u32_to_b4(cmd + 2, len);
     u32_to_b4(cmd + 6, paddr);
   } else {
     u32_to_b4(cmd + 2, 1);
@@ -2436,8 +2703,10 @@ static int jtagmkII_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 	      "%s: jtagmkII_read_byte(): "
 	      "timeout/error communicating with programmer (status %d)\n",
 	      progname, status);
-    if (tries++ < 3)
+    if (tries++ < 3) {
+      stats_retry();
       goto retry;
+    }
     fprintf(stderr,
 	    "%s: jtagmkII_read_byte(): "
 	    "fatal timeout/error communicating with programmer (status %d)\n",
@@ -2459,18 +2728,24 @@ static int jtagmkII_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     goto fail;
   }
 
-  if (pagesize) {
-    *paddr_ptr = paddr;
-    memcpy(cache_ptr, resp + 1, pagesize);
-    *value = cache_ptr[addr & (pagesize - 1)];
+  if (pc != NULL) {
+    if (status - 1 < len) {
+      fprintf(stderr,
+	      "%s: jtagmkII_read_byte(): "
+	      "short reply to read memory command\n",
+	      progname);
+      goto fail;
+    }
+    pagecache_fill(pc, paddr, resp + 1, len);
+    *value = resp[1 + addr - paddr];
   } else
     *value = resp[1];
 
-  free(resp);
+  jtagmkII_release(pgm, resp);
   return 0;
 
 fail:
-  free(resp);
+  jtagmkII_release(pgm, resp);
   return -1;
 }
 
@@ -2499,13 +2774,13 @@ static int jtagmkII_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
      }
      writesize = 2;
      need_progmode = 0;
-     PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+     pagecache_invalidate(&PDATA(pgm)->flash_cache, addr, 2);
      if (pgm->flag & PGM_FL_IS_DW)
        unsupp = 1;
   } else if (strcmp(mem->desc, "eeprom") == 0) {
     cmd[1] = ( p->flags & AVRPART_HAS_PDI ) ? MTYPE_EEPROM_XMEGA: MTYPE_EEPROM;
     need_progmode = 0;
-    PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+    pagecache_invalidate(&PDATA(pgm)->eeprom_cache, addr, 1);
   } else if (strcmp(mem->desc, "lfuse") == 0) {
     cmd[1] = MTYPE_FUSE_BITS;
     addr = 0;
@@ -2573,8 +2848,10 @@ static int jtagmkII_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 	      "%s: jtagmkII_write_byte(): "
 	      "timeout/error communicating with programmer (status %d)\n",
 	      progname, status);
-    if (tries++ < 3)
+    if (tries++ < 3) {
+      stats_retry();
       goto retry;
+    }
     fprintf(stderr,
 	    "%s: jtagmkII_write_byte(): "
 	    "fatal timeout/error communicating with programmer (status %d)\n",
@@ -2594,11 +2871,11 @@ static int jtagmkII_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     goto fail;
   }
 
-  free(resp);
+  jtagmkII_release(pgm, resp);
   return 0;
 
 fail:
-  free(resp);
+  jtagmkII_release(pgm, resp);
   return -1;
 }
 
@@ -2673,12 +2950,12 @@ int jtagmkII_getparm(PROGRAMMER * pgm, unsigned char parm,
 	    "%s: jtagmkII_getparm(): "
 	    "bad response to get parameter command: %s\n",
 	    progname, jtagmkII_get_rc(c));
-    free(resp);
+    jtagmkII_release(pgm, resp);
     return -1;
   }
 
   memcpy(value, resp + 1, 4);
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   return 0;
 }
@@ -2743,7 +3020,7 @@ static int jtagmkII_setparm(PROGRAMMER * pgm, unsigned char parm,
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_setparm(): "
@@ -3212,20 +3489,15 @@ static int jtagmkII_initialize32(PROGRAMMER * pgm, AVRPART * p)
     return -1;
   }
 
-  free(PDATA(pgm)->flash_pagecache);
-  free(PDATA(pgm)->eeprom_pagecache);
-  if ((PDATA(pgm)->flash_pagecache = malloc(PDATA(pgm)->flash_pagesize)) == NULL) {
-    fprintf(stderr, "%s: jtagmkII_initialize(): Out of memory\n",
-	    progname);
-    return -1;
-  }
-  if ((PDATA(pgm)->eeprom_pagecache = malloc(PDATA(pgm)->eeprom_pagesize)) == NULL) {
+  if (pagecache_init(&PDATA(pgm)->flash_cache,
+                     PDATA(pgm)->flash_pagesize) < 0 ||
+      pagecache_init(&PDATA(pgm)->eeprom_cache,
+                     PDATA(pgm)->eeprom_pagesize) < 0) {
     fprintf(stderr, "%s: jtagmkII_initialize32(): Out of memory\n",
 	    progname);
-    free(PDATA(pgm)->flash_pagecache);
+    pagecache_free(&PDATA(pgm)->flash_cache);
     return -1;
   }
-  PDATA(pgm)->flash_pageaddr = PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
 
   for(j=0; j<2; ++j) {
     buf[0] = CMND_GET_IR;
@@ -3242,7 +3514,7 @@ static int jtagmkII_initialize32(PROGRAMMER * pgm, AVRPART * p)
                 progname, status);
       return -1;
     }
-    free(resp);
+    jtagmkII_release(pgm, resp);
 
     memset(buf, 0, sizeof(buf));
     buf[0] = CMND_GET_xxx;
@@ -3275,7 +3547,7 @@ static int jtagmkII_initialize32(PROGRAMMER * pgm, AVRPART * p)
         return -1;
       }
     }
-    free(resp);
+    jtagmkII_release(pgm, resp);
   }
 
   return 0;
@@ -3313,7 +3585,7 @@ static int jtagmkII_chip_erase32(PROGRAMMER * pgm, AVRPART * p)
       {lineno = __LINE__; goto eRR;}
     }
     x = resp[1];
-    free(resp);
+    jtagmkII_release(pgm, resp);
     if(x == *retP) ++retP;
     if(*retP == 0x00) break;
   }
@@ -3332,7 +3604,7 @@ static int jtagmkII_chip_erase32(PROGRAMMER * pgm, AVRPART * p)
   jtagmkII_send(pgm, buf, 3);
   status = jtagmkII_recv(pgm, &resp);
   if(status < 0 || resp[0] != RSP_OK) {lineno = __LINE__; goto eRR;}
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   return 0;
 
@@ -3395,7 +3667,7 @@ static unsigned long jtagmkII_read_SABaddr(PROGRAMMER * pgm, unsigned long addr,
   }
 
   val = b4_to_u32r(&resp[1]);
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   if (verbose) {
     if (verbose >= 2)
@@ -3506,7 +3778,7 @@ static int jtagmkII_open32(PROGRAMMER * pgm, char * port)
   status = jtagmkII_recv(pgm, &resp);
   if(status < 0 || resp[0] != RSP_OK)
     return -1;
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   buf[1] = 0x03;
   buf[2] = 0x02;
@@ -3514,7 +3786,7 @@ static int jtagmkII_open32(PROGRAMMER * pgm, char * port)
   status = jtagmkII_recv(pgm, &resp);
   if(status < 0 || resp[0] != RSP_OK)
     return -1;
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   buf[1] = 0x03;
   buf[2] = 0x04;
@@ -3522,7 +3794,7 @@ static int jtagmkII_open32(PROGRAMMER * pgm, char * port)
   status = jtagmkII_recv(pgm, &resp);
   if(status < 0 || resp[0] != RSP_OK)
     return -1;
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   return 0;
 }
@@ -3543,7 +3815,7 @@ static void jtagmkII_close32(PROGRAMMER * pgm)
   jtagmkII_send(pgm, buf, 3);
   status = jtagmkII_recv(pgm, &resp);
   if(status < 0 || resp[0] != RSP_OK) {lineno = __LINE__; goto eRR;}
-  free(resp);
+  jtagmkII_release(pgm, resp);
 
   buf[0] = CMND_SIGN_OFF;
   if (verbose >= 2)
@@ -3567,7 +3839,7 @@ static void jtagmkII_close32(PROGRAMMER * pgm)
   } else if (verbose == 2)
     fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
   c = resp[0];
-  free(resp);
+  jtagmkII_release(pgm, resp);
   if (c != RSP_OK) {
     fprintf(stderr,
 	    "%s: jtagmkII_close(): "
@@ -3656,11 +3928,11 @@ static int jtagmkII_paged_load32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
               "%s: jtagmkII_paged_load32(): "
               "bad response to write memory command: %s\n",
               progname, jtagmkII_get_rc(resp[0]));
-      free(resp);
+      jtagmkII_release(pgm, resp);
       return -1;
     }
     memcpy(m->buf + addr, resp + 1, block_size);
-    free(resp);
+    jtagmkII_release(pgm, resp);
 
   }
 
@@ -3683,58 +3955,123 @@ static int jtagmkII_paged_load32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                   unsigned int page_size,
                                   unsigned int addr, unsigned int n_bytes)
+{
+  int rc, rc2;
+
+  rc = jtagmkII_paged_write_submit32(pgm, p, m, page_size, addr, n_bytes);
+  if (rc < 0 && PDATA(pgm)->avr32_pending == 0)
+    return -1;
+  rc2 = jtagmkII_paged_write_complete32(pgm, p, m);
+
+  return rc < 0 || rc2 < 0? -1: rc;
+}
+
+/*
+ * Write the pages in n_bytes from addr, and leave the last one
+ * programming: the flash controller is only polled for it before its
+ * next command, so the host prepares the following page meanwhile.
+ *
+ * The target is reset for writing once for a series of submitted
+ * pages, and set running again when the last of them is completed.
+ * Pages are unlocked and erased in runs: the first page of a run of
+ * pages with data in m erases the whole run, so the erase only waits
+ * for the flash controller once per page instead of twice.
+ */
+static int jtagmkII_paged_write_submit32(PROGRAMMER * pgm, AVRPART * p,
+                                         AVRMEM * m, unsigned int page_size,
+                                         unsigned int addr,
+                                         unsigned int n_bytes)
 {
   unsigned int block_size;
   unsigned char *cmd=NULL;
   unsigned char *resp;
-  int lineno, status, pages, sPageNum, pageNum, blocks;
+  int lineno, status, blocks, next;
+  unsigned int pageNum, sPageNum, ePageNum, runEnd;
   unsigned long val=0;
   unsigned long otimeout = serial_recv_timeout;
   unsigned int maxaddr = addr + n_bytes;
 
-  serial_recv_timeout = 256;
+  if(n_bytes == 0 || page_size == 0) return -1;
 
-  if(n_bytes == 0) return -1;
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkII_paged_write_submit32(.., %s, %d, %d)\n",
+	    progname, m->desc, page_size, n_bytes);
 
-  status = jtagmkII_reset32(pgm, AVR32_RESET_WRITE);
-  if(status != 0) {lineno = __LINE__; goto eRR;}
-  p->flags |= AVRPART_WRITE;
+  serial_recv_timeout = 256;
 
-  pages = (n_bytes - addr - 1)/page_size + 1;
   sPageNum = addr/page_size;
+  ePageNum = (maxaddr - 1)/page_size + 1;
   //fprintf(stderr, "\n pageSize=%d bytes=%d pages=%d m->offset=0x%x pgm->page_size %d\n",
   //        page_size, n_bytes, pages, m->offset, pgm->page_size);
 
   // Before any errors can happen
   if ((cmd = malloc(pgm->page_size + 10)) == NULL) {
     fprintf(stderr, "%s: jtagmkII_paged_write32(): Out of memory\n", progname);
+    serial_recv_timeout = otimeout;
     return -1;
   }
 
-  // Init SMC and set clocks
-  if(!(p->flags & AVRPART_INIT_SMC)) {
-    status = jtagmkII_smc_init32(pgm);
-    if(status != 0) {lineno = __LINE__; goto eRR;} // PLL 0
-    p->flags |= AVRPART_INIT_SMC;
-  }
+  if(!PDATA(pgm)->avr32_writing) {
+    status = jtagmkII_reset32(pgm, AVR32_RESET_WRITE);
+    if(status != 0) {lineno = __LINE__; goto eRR;}
+    p->flags |= AVRPART_WRITE;
 
-  // First unlock the pages
-  for(pageNum=sPageNum; pageNum < pages; ++pageNum) {
-    status =jtagmkII_flash_lock32(pgm, 0, pageNum);
-    if(status < 0) {lineno = __LINE__; goto eRR;}
+    // Init SMC and set clocks
+    if(!(p->flags & AVRPART_INIT_SMC)) {
+      status = jtagmkII_smc_init32(pgm);
+      if(status != 0) {lineno = __LINE__; goto eRR;} // PLL 0
+      p->flags |= AVRPART_INIT_SMC;
+    }
+
+    PDATA(pgm)->avr32_writing = 1;
+    PDATA(pgm)->avr32_busy = 0;
+    PDATA(pgm)->avr32_erase_first = PDATA(pgm)->avr32_erase_end = 0;
   }
 
-  // Then erase them (guess could do this in the same loop above?)
-  for(pageNum=sPageNum; pageNum < pages; ++pageNum) {
-    status =jtagmkII_flash_erase32(pgm, pageNum);
+  if(sPageNum < PDATA(pgm)->avr32_erase_first ||
+     ePageNum > PDATA(pgm)->avr32_erase_end) {
+    // Extend over the following pages that are going to be written
+    for(runEnd = ePageNum;
+        page_size == (unsigned int)m->page_size &&
+        runEnd * page_size < (unsigned int)m->size; ++runEnd) {
+      next = avr_mem_next_dirty(m, runEnd * page_size, m->size);
+      if(next < 0 || (unsigned int)next != runEnd * page_size)
+        break;
+    }
+
+    // The page still programming must be done first
+    if(PDATA(pgm)->avr32_busy) {
+      PDATA(pgm)->avr32_busy = 0;
+      if(jtagmkII_flash_wait32(pgm, &val) < 0) {lineno = __LINE__; goto eRR;}
+      if(val & AVR32_FLASHC_FSR_ERR) {lineno = __LINE__; goto eRR;}
+    }
+
+    // First unlock the pages
+    for(pageNum=sPageNum; pageNum < runEnd; ++pageNum) {
+      status =jtagmkII_flash_lock32(pgm, 0, pageNum);
+      if(status < 0) {lineno = __LINE__; goto eRR;}
+    }
+
+    // Then erase them
+    status = jtagmkII_flash_erase32(pgm, sPageNum, runEnd - sPageNum);
     if(status < 0) {lineno = __LINE__; goto eRR;}
+
+    PDATA(pgm)->avr32_erase_first = sPageNum;
+    PDATA(pgm)->avr32_erase_end = runEnd;
   }
 
   cmd[0] = CMND_WRITE_MEMORY32;
   u32_to_b4r(&cmd[1], 0x40000000);  // who knows
   cmd[5] = 0x5;
 
-  for(pageNum=sPageNum; pageNum < pages; ++pageNum) {
+  for(pageNum=sPageNum; pageNum < ePageNum; ++pageNum) {
+
+    // Collect the previous page, which programmed meanwhile
+    if(PDATA(pgm)->avr32_busy) {
+      PDATA(pgm)->avr32_busy = 0;
+      if(jtagmkII_flash_wait32(pgm, &val) < 0) {lineno = __LINE__; goto eRR;}
+      if(val & AVR32_FLASHC_FSR_ERR) {lineno = __LINE__; goto eRR;}
+    }
 
     status = jtagmkII_flash_clear_pagebuffer32(pgm);
     if(status != 0) {lineno = __LINE__; goto eRR;}
@@ -3765,11 +4102,11 @@ static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                 "%s: jtagmkII_paged_write32(): "
                 "bad response to write memory command: %s\n",
                 progname, jtagmkII_get_rc(resp[0]));
-        free(resp);
-        free(cmd);
-        return -1;
+        jtagmkII_release(pgm, resp);
+        lineno = __LINE__;
+        goto eRR;
       }
-      free(resp);
+      jtagmkII_release(pgm, resp);
 
       addr += block_size;
 
@@ -3777,18 +4114,20 @@ static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     }
     status = jtagmkII_flash_write_page32(pgm, pageNum);
     if(status < 0) {lineno = __LINE__; goto eRR;}
+    PDATA(pgm)->avr32_busy = 1;
   }
   free(cmd);
   serial_recv_timeout = otimeout;
 
-  status = jtagmkII_reset32(pgm, AVR32_SET4RUNNING);  // AVR32_SET4RUNNING | AVR32_RELEASE_JTAG
-  if(status < 0) {lineno = __LINE__; goto eRR;}
+  PDATA(pgm)->avr32_pending++;
 
-  return addr;
+  return n_bytes;
 
   eRR:
     serial_recv_timeout = otimeout;
     free(cmd);
+    if(PDATA(pgm)->avr32_pending == 0)
+      PDATA(pgm)->avr32_writing = 0;
     fprintf(stderr,
 	    "%s: jtagmkII_paged_write32(): "
 	    "failed at line %d (status=%x val=%lx)\n",
@@ -3796,6 +4135,41 @@ static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     return -1;
 }
 
+/*
+ * Count off a page submitted by jtagmkII_paged_write_submit32().  The
+ * last one is waited for, and the target set running again.
+ */
+static int jtagmkII_paged_write_complete32(PROGRAMMER * pgm, AVRPART * p,
+                                           AVRMEM * m)
+{
+  unsigned long val = 0;
+  unsigned long otimeout = serial_recv_timeout;
+  int rc = 0;
+
+  if(PDATA(pgm)->avr32_pending > 0)
+    PDATA(pgm)->avr32_pending--;
+  if(PDATA(pgm)->avr32_pending > 0 || !PDATA(pgm)->avr32_writing)
+    return 0;
+
+  PDATA(pgm)->avr32_writing = 0;
+
+  serial_recv_timeout = 256;
+  if(PDATA(pgm)->avr32_busy &&
+     (jtagmkII_flash_wait32(pgm, &val) < 0 || (val & AVR32_FLASHC_FSR_ERR))) {
+    fprintf(stderr,
+	    "%s: jtagmkII_paged_write_complete32(): "
+	    "page write failed (val=%lx)\n",
+	    progname, val);
+    rc = -1;
+  }
+  PDATA(pgm)->avr32_busy = 0;
+  serial_recv_timeout = otimeout;
+
+  if(jtagmkII_reset32(pgm, AVR32_SET4RUNNING) < 0)  // AVR32_SET4RUNNING | AVR32_RELEASE_JTAG
+    rc = -1;
+
+  return rc;
+}
 
 static int jtagmkII_flash_lock32(PROGRAMMER * pgm, unsigned char lock, unsigned int page)
 {
@@ -3825,36 +4199,51 @@ static int jtagmkII_flash_lock32(PROGRAMMER * pgm, unsigned char lock, unsigned
     return -1;
 }
 
-static int jtagmkII_flash_erase32(PROGRAMMER * pgm, unsigned int page)
+/*
+ * Wait for the flash controller to become ready; *fsr gets all the
+ * status bits seen meanwhile.
+ */
+static int jtagmkII_flash_wait32(PROGRAMMER * pgm, unsigned long * fsr)
 {
-  int status, lineno, i;
-  unsigned long val=0, cmd=0, err=0;
+  unsigned long val=0;
+  int i;
 
+  *fsr = 0;
   for(i=0; i<256; ++i) {
     val = jtagmkII_read_SABaddr(pgm, AVR32_FLASHC_FSR, 0x05);
     if(val == ERROR_SAB) continue;
+    *fsr |= val;
     if(val & AVR32_FLASHC_FSR_RDY) break;
   }
-  if(val == ERROR_SAB) {lineno = __LINE__; goto eRR;}
-  if(!(val&AVR32_FLASHC_FSR_RDY)) {lineno = __LINE__; goto eRR;} // Flash better be ready
+  if(val == ERROR_SAB || !(val & AVR32_FLASHC_FSR_RDY))
+    return -1;
 
-  page <<= 8;
-  cmd = AVR32_FLASHC_FCMD_KEY | page | AVR32_FLASHC_FCMD_ERASE_PAGE;
-  status = jtagmkII_write_SABaddr(pgm, AVR32_FLASHC_FCMD, 0x05, cmd);
-  if (status < 0) {lineno = __LINE__; goto eRR;}
+  return 0;
+}
+
+/*
+ * Erase npages pages from page; waiting for each erase to finish
+ * covers the ready check before the next one.
+ */
+static int jtagmkII_flash_erase32(PROGRAMMER * pgm, unsigned int page,
+                                  unsigned int npages)
+{
+  int status, lineno;
+  unsigned long val=0, cmd=0;
+
+  // Flash better be ready
+  if(jtagmkII_flash_wait32(pgm, &val) < 0) {lineno = __LINE__; goto eRR;}
+
+  for(; npages > 0; ++page, --npages) {
+    cmd = AVR32_FLASHC_FCMD_KEY | (page << 8) | AVR32_FLASHC_FCMD_ERASE_PAGE;
+    status = jtagmkII_write_SABaddr(pgm, AVR32_FLASHC_FCMD, 0x05, cmd);
+    if (status < 0) {lineno = __LINE__; goto eRR;}
 
 //fprintf(stderr, "ERASE %x -> %x\n", cmd, AVR32_FLASHC_FCMD);
 
-  err = 0;
-  for(i=0; i<256; ++i) {
-    val = jtagmkII_read_SABaddr(pgm, AVR32_FLASHC_FSR, 0x05);
-    if(val == ERROR_SAB) continue;
-    err |= val;
-    if(val & AVR32_FLASHC_FSR_RDY) break;
+    if(jtagmkII_flash_wait32(pgm, &val) < 0) {lineno = __LINE__; goto eRR;}
+    if(val & AVR32_FLASHC_FSR_ERR) {lineno = __LINE__; goto eRR;}
   }
-  if(val == ERROR_SAB) {lineno = __LINE__; goto eRR;}
-  if(!(val & AVR32_FLASHC_FSR_RDY)) {lineno = __LINE__; goto eRR;}
-  if(err & AVR32_FLASHC_FSR_ERR) {lineno = __LINE__; goto eRR;}
 
   return 0;
 
@@ -3866,35 +4255,27 @@ static int jtagmkII_flash_erase32(PROGRAMMER * pgm, unsigned int page)
     return -1;
 }
 
+/*
+ * Start programming page from the page buffer.  The flash controller
+ * stays busy for a while; the next flash command waits for it.
+ */
 static int jtagmkII_flash_write_page32(PROGRAMMER * pgm, unsigned int page)
 {
-  int status, lineno, i;
-  unsigned long val=0, cmd, err;
+  int status;
+  unsigned long cmd;
 
   page <<= 8;
   cmd = AVR32_FLASHC_FCMD_KEY | page | AVR32_FLASHC_FCMD_WRITE_PAGE;
   status = jtagmkII_write_SABaddr(pgm, AVR32_FLASHC_FCMD, 0x05, cmd);
-  if (status < 0) {lineno = __LINE__; goto eRR;}
-
-  err = 0;
-  for(i=0; i<256; ++i) {
-    val = jtagmkII_read_SABaddr(pgm, AVR32_FLASHC_FSR, 0x05);
-    if(val == ERROR_SAB) continue;
-    err |= val;
-    if(val & AVR32_FLASHC_FSR_RDY) break;
-  }
-  if(val == ERROR_SAB) {lineno = __LINE__; goto eRR;}
-  if(!(val & AVR32_FLASHC_FSR_RDY)) {lineno = __LINE__; goto eRR;}
-  if(err & AVR32_FLASHC_FSR_ERR) {lineno = __LINE__; goto eRR;}
-
-  return 0;
-
-  eRR:
+  if (status < 0) {
     fprintf(stderr,
 	    "%s: jtagmkII_flash_write_page32(): "
-	    "failed at line %d page %d cmd %8.8lx val %lx\n",
-	    progname, lineno, page, cmd, val);
+	    "failed page %d cmd %8.8lx\n",
+	    progname, page, cmd);
     return -1;
+  }
+
+  return 0;
 }
 
 static int jtagmkII_flash_clear_pagebuffer32(PROGRAMMER * pgm)
@@ -4122,6 +4503,8 @@ void jtagmkII_avr32_initpgm(PROGRAMMER * pgm)
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write32;
+  pgm->paged_write_submit   = jtagmkII_paged_write_submit32;
+  pgm->paged_write_complete = jtagmkII_paged_write_complete32;
   pgm->paged_load     = jtagmkII_paged_load32;
   pgm->print_parms    = jtagmkII_print_parms;
   //pgm->set_sck_period = jtagmkII_set_sck_period;
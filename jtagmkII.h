@@ -25,8 +25,16 @@
 extern "C" {
 #endif
 
+struct serial_iov;
+
+/* maximum number of segments jtagmkII_sendv() takes */
+#define JTAGMKII_MAXIOV 4
+
 int  jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len);
+int  jtagmkII_sendv(PROGRAMMER * pgm, const struct serial_iov * iov,
+		    int iovcnt);
 int  jtagmkII_recv(PROGRAMMER * pgm, unsigned char **msg);
+void jtagmkII_release(PROGRAMMER * pgm, unsigned char * msg);
 void jtagmkII_close(PROGRAMMER * pgm);
 int  jtagmkII_getsync(PROGRAMMER * pgm, int mode);
 int  jtagmkII_getparm(PROGRAMMER * pgm, unsigned char parm,
@@ -55,6 +63,9 @@ void jtagmkII_dragon_pdi_initpgm (PROGRAMMER * pgm);
 void jtagmkII_setup(PROGRAMMER * pgm);
 void jtagmkII_teardown(PROGRAMMER * pgm);
 
+/* file remembering the link speeds an ICE answered at on a port */
+void jtagmkII_cache(const char * file);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,7 @@
 /*
  * avrdude - A Downloader/Uploader for AVR device programmers
- * Support for bitbanging GPIO pins using the /sys/class/gpio interface
+ * Support for bitbanging GPIO pins using the /sys/class/gpio interface,
+ * the GPIO character device, or the registers of a BCM2835 GPIO block
  * 
  * Copyright (C) 2013 Radoslav Kolev <radoslav@kolev.info>
  *
@@ -27,6 +28,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#if defined(HAVE_LINUX_GPIO_H)
+#include <linux/gpio.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#define LINUXGPIO_MMAP 1
+#endif
 
 #include "avrdude.h"
 #include "avr.h"
@@ -144,6 +156,258 @@ static int linuxgpio_dir_in(unsigned int gpio)
 */
 static int linuxgpio_fds[N_GPIO] ;
 
+/*
+ * The port name selects how the lines are driven: "/dev/gpiochipN"
+ * uses the GPIO character device, which sets all output lines with a
+ * single ioctl, "/dev/gpiomem" maps the registers of the BCM2835 style
+ * GPIO block of the Raspberry Pi 1 to 4, and anything else uses sysfs.
+ */
+enum {
+  LINUXGPIO_SYSFS,
+  LINUXGPIO_CDEV,
+  LINUXGPIO_BCM2835
+};
+
+static int linuxgpio_backend;
+
+/*
+ * Avrdude assumes that if a pin number is 0 it means not used/available
+ * this causes a problem because 0 is a valid GPIO number in Linux sysfs.
+ * To avoid annoying off by one pin numbering we assume SCK, MOSI, MISO
+ * and RESET pins are always defined in avrdude.conf, even as 0. If they're
+ * not programming will not work anyway. The drawbacks of this approach are
+ * that unwanted toggling of GPIO0 can occur and that other optional pins
+ * mostry LED status, can't be set to GPIO0. It can be fixed when a better
+ * solution exists.
+ */
+static int linuxgpio_used(PROGRAMMER *pgm, int pinfunc)
+{
+  return (pgm->pinno[pinfunc] & PIN_MASK) != 0 ||
+         pinfunc == PIN_AVR_RESET ||
+         pinfunc == PIN_AVR_SCK   ||
+         pinfunc == PIN_AVR_MOSI  ||
+         pinfunc == PIN_AVR_MISO;
+}
+
+#if defined(HAVE_LINUX_GPIO_H)
+
+/*
+ * GPIO character device: all output lines are requested in one
+ * handle, MISO in another.  The values of the outputs are kept here,
+ * so changing one line is a single ioctl, and none at all if the line
+ * already has the value.
+ */
+static int linuxgpio_chip_fd = -1;
+static int linuxgpio_out_fd = -1;
+static int linuxgpio_in_fd = -1;
+/* index of a line within the output handle, -1 if it is no output */
+static int linuxgpio_index[N_GPIO];
+static struct gpiohandle_data linuxgpio_out;
+static struct gpiohandle_request linuxgpio_req;
+
+static int linuxgpio_cdev_request(uint32_t *lines, int n, uint32_t flags)
+{
+  struct gpiohandle_request req;
+
+  memset(&req, 0, sizeof(req));
+  memcpy(req.lineoffsets, lines, n * sizeof(lines[0]));
+  req.lines = n;
+  req.flags = flags;
+  strcpy(req.consumer_label, "avrdude");
+  if (ioctl(linuxgpio_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+    return -1;
+
+  return req.fd;
+}
+
+static int linuxgpio_cdev_open(PROGRAMMER *pgm, const char *port)
+{
+  uint32_t miso;
+  int i, pin;
+
+  if ((linuxgpio_chip_fd = open(port, O_RDWR)) < 0) {
+    fprintf(stderr, "%s: linuxgpio_cdev_open(): can't open %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+
+  memset(&linuxgpio_req, 0, sizeof(linuxgpio_req));
+  for (i=0; i<N_GPIO; i++)
+    linuxgpio_index[i] = -1;
+  for (i=0; i<N_PINS; i++) {
+    pin = pgm->pinno[i] & PIN_MASK;
+    if (!linuxgpio_used(pgm, i) || i == PIN_AVR_MISO ||
+        linuxgpio_index[pin] >= 0)
+      continue;
+    linuxgpio_index[pin] = linuxgpio_req.lines;
+    linuxgpio_req.lineoffsets[linuxgpio_req.lines++] = pin;
+  }
+
+  memset(&linuxgpio_out, 0, sizeof(linuxgpio_out));
+  linuxgpio_out_fd = linuxgpio_cdev_request(linuxgpio_req.lineoffsets,
+                                            linuxgpio_req.lines,
+                                            GPIOHANDLE_REQUEST_OUTPUT);
+  miso = pgm->pinno[PIN_AVR_MISO] & PIN_MASK;
+  if (linuxgpio_out_fd >= 0)
+    linuxgpio_in_fd = linuxgpio_cdev_request(&miso, 1,
+                                             GPIOHANDLE_REQUEST_INPUT);
+  if (linuxgpio_out_fd < 0 || linuxgpio_in_fd < 0) {
+    fprintf(stderr, "%s: linuxgpio_cdev_open(): can't request the lines of %s, "
+            "busy?: %s\n", progname, port, strerror(errno));
+    if (linuxgpio_out_fd >= 0)
+      close(linuxgpio_out_fd);
+    close(linuxgpio_chip_fd);
+    linuxgpio_out_fd = linuxgpio_chip_fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void linuxgpio_cdev_close(PROGRAMMER *pgm)
+{
+  uint32_t lines[GPIOHANDLES_MAX], reset;
+  int i, n, fd;
+
+  if (linuxgpio_chip_fd < 0)
+    return;
+
+  //first configure all pins as input, except RESET
+  //this should avoid possible conflicts when AVR firmware starts
+  reset = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
+  close(linuxgpio_out_fd);
+  close(linuxgpio_in_fd);
+  for (i=0, n=0; i<linuxgpio_req.lines; i++)
+    if (linuxgpio_req.lineoffsets[i] != reset)
+      lines[n++] = linuxgpio_req.lineoffsets[i];
+  if (n > 0 && (fd = linuxgpio_cdev_request(lines, n, GPIOHANDLE_REQUEST_INPUT)) >= 0)
+    close(fd);
+  //configure RESET as input, if there's external pull up it will go high
+  if ((fd = linuxgpio_cdev_request(&reset, 1, GPIOHANDLE_REQUEST_INPUT)) >= 0)
+    close(fd);
+
+  close(linuxgpio_chip_fd);
+  linuxgpio_chip_fd = linuxgpio_out_fd = linuxgpio_in_fd = -1;
+}
+
+static int linuxgpio_cdev_setpin(int pin, int value)
+{
+  int i = linuxgpio_index[pin];
+
+  if (i < 0)
+    return -1;
+  if (linuxgpio_out.values[i] == value)
+    return 0;
+
+  linuxgpio_out.values[i] = value;
+  if (ioctl(linuxgpio_out_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &linuxgpio_out) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int linuxgpio_cdev_getpin(int pin)
+{
+  struct gpiohandle_data data;
+
+  if (ioctl(linuxgpio_in_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+    return -1;
+
+  return data.values[0] != 0;
+}
+
+#endif /* HAVE_LINUX_GPIO_H */
+
+#if defined(LINUXGPIO_MMAP)
+
+/*
+ * BCM2835 GPIO registers, as 32 bit word offsets.  /dev/gpiomem maps
+ * just this block and needs no root permissions.
+ */
+#define BCM2835_GPFSEL0   0
+#define BCM2835_GPSET0    7
+#define BCM2835_GPCLR0    10
+#define BCM2835_GPLEV0    13
+#define BCM2835_NGPIO     54
+#define BCM2835_MAPSIZE   4096
+
+/*
+ * A register access takes nanoseconds, keep each pin change at least
+ * that many microseconds so SCK stays within what a target running
+ * at 1 MHz accepts.
+ */
+#define BCM2835_MIN_DELAY 1
+
+static volatile uint32_t *linuxgpio_regs;
+
+static void bcm2835_dir(int pin, int out)
+{
+  volatile uint32_t *fsel = linuxgpio_regs + BCM2835_GPFSEL0 + pin / 10;
+  int shift = (pin % 10) * 3;
+
+  *fsel = (*fsel & ~(7u << shift)) | ((out? 1u: 0u) << shift);
+}
+
+static int linuxgpio_bcm2835_open(PROGRAMMER *pgm, const char *port)
+{
+  void *map;
+  int fd, i, pin;
+
+  for (i=0; i<N_PINS; i++) {
+    if (linuxgpio_used(pgm, i) && (pgm->pinno[i] & PIN_MASK) >= BCM2835_NGPIO) {
+      fprintf(stderr, "%s: linuxgpio_bcm2835_open(): no GPIO %d on BCM2835\n",
+              progname, pgm->pinno[i] & PIN_MASK);
+      return -1;
+    }
+  }
+
+  if ((fd = open(port, O_RDWR | O_SYNC)) < 0) {
+    fprintf(stderr, "%s: linuxgpio_bcm2835_open(): can't open %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+  map = mmap(NULL, BCM2835_MAPSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: linuxgpio_bcm2835_open(): can't map %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+  linuxgpio_regs = map;
+
+  for (i=0; i<N_PINS; i++) {
+    if (!linuxgpio_used(pgm, i))
+      continue;
+    pin = pgm->pinno[i] & PIN_MASK;
+    if (i != PIN_AVR_MISO)
+      linuxgpio_regs[BCM2835_GPCLR0 + pin / 32] = 1u << (pin % 32);
+    bcm2835_dir(pin, i != PIN_AVR_MISO);
+  }
+
+  return 0;
+}
+
+static void linuxgpio_bcm2835_close(PROGRAMMER *pgm)
+{
+  int i, reset_pin;
+
+  if (linuxgpio_regs == NULL)
+    return;
+
+  //first configure all pins as input, except RESET
+  //this should avoid possible conflicts when AVR firmware starts
+  reset_pin = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
+  for (i=0; i<N_PINS; i++)
+    if (linuxgpio_used(pgm, i) && (pgm->pinno[i] & PIN_MASK) != reset_pin)
+      bcm2835_dir(pgm->pinno[i] & PIN_MASK, 0);
+  //configure RESET as input, if there's external pull up it will go high
+  bcm2835_dir(reset_pin, 0);
+
+  munmap((void *)linuxgpio_regs, BCM2835_MAPSIZE);
+  linuxgpio_regs = NULL;
+}
+
+#endif /* LINUXGPIO_MMAP */
 
 static int linuxgpio_setpin(PROGRAMMER * pgm, int pinfunc, int value)
 {
@@ -156,15 +420,36 @@ static int linuxgpio_setpin(PROGRAMMER * pgm, int pinfunc, int value)
     pin   &= PIN_MASK;
   }
 
-  if ( linuxgpio_fds[pin] < 0 )
-    return -1;
-
-  if (value)
-    r = write(linuxgpio_fds[pin], "1", 1);
-  else
-    r = write(linuxgpio_fds[pin], "0", 1);
-
-  if (r!=1) return -1;
+  switch (linuxgpio_backend) {
+#if defined(HAVE_LINUX_GPIO_H)
+  case LINUXGPIO_CDEV:
+    if (linuxgpio_cdev_setpin(pin, value != 0) < 0)
+      return -1;
+    break;
+#endif
+#if defined(LINUXGPIO_MMAP)
+  case LINUXGPIO_BCM2835:
+    /* like the sysfs backend, leave GPIO0 alone for unassigned pins */
+    if (!linuxgpio_used(pgm, pinfunc))
+      return -1;
+    linuxgpio_regs[(value? BCM2835_GPSET0: BCM2835_GPCLR0) + pin / 32] =
+      1u << (pin % 32);
+    bitbang_delay(pgm->ispdelay > BCM2835_MIN_DELAY?
+                  pgm->ispdelay: BCM2835_MIN_DELAY);
+    return 0;
+#endif
+  default:
+    if ( linuxgpio_fds[pin] < 0 )
+      return -1;
+
+    if (value)
+      r = write(linuxgpio_fds[pin], "1", 1);
+    else
+      r = write(linuxgpio_fds[pin], "0", 1);
+
+    if (r!=1) return -1;
+    break;
+  }
 
   if (pgm->ispdelay > 1)
     bitbang_delay(pgm->ispdelay);
@@ -177,6 +462,7 @@ static int linuxgpio_getpin(PROGRAMMER * pgm, int pinfunc)
   unsigned char invert=0;
   char c;
   int pin = pgm->pinno[pinfunc]; // TODO
+  int r;
 
   if (pin & PIN_INVERSE)
   {
@@ -184,6 +470,22 @@ static int linuxgpio_getpin(PROGRAMMER * pgm, int pinfunc)
     pin   &= PIN_MASK;
   }
 
+  switch (linuxgpio_backend) {
+#if defined(HAVE_LINUX_GPIO_H)
+  case LINUXGPIO_CDEV:
+    if ((r = linuxgpio_cdev_getpin(pin)) < 0)
+      return -1;
+    return r ^ invert;
+#endif
+#if defined(LINUXGPIO_MMAP)
+  case LINUXGPIO_BCM2835:
+    r = (linuxgpio_regs[BCM2835_GPLEV0 + pin / 32] >> (pin % 32)) & 1;
+    return r ^ invert;
+#endif
+  default:
+    break;
+  }
+
   if ( linuxgpio_fds[pin] < 0 )
     return -1;
 
@@ -202,11 +504,100 @@ static int linuxgpio_getpin(PROGRAMMER * pgm, int pinfunc)
 
 }
 
+/*
+ * Clock a buffer through the SPI lines, with MOSI changing along with
+ * the falling SCK edge of the previous bit.  With the character device
+ * that is a single ioctl, so a bit takes three instead of four; with
+ * the BCM2835 registers the set and clear masks for every half clock
+ * are computed up front.  sysfs has a file per line and uses setpin().
+ */
+static int linuxgpio_xfer_buf(PROGRAMMER *pgm, const unsigned char *tx,
+                              unsigned char *rx, int len)
+{
+  int mosi = pgm->pinno[PIN_AVR_MOSI];
+  int sck = pgm->pinno[PIN_AVR_SCK];
+  int minv = (mosi & PIN_INVERSE) != 0;
+  int sinv = (sck & PIN_INVERSE) != 0;
+  int i, j;
+  unsigned char byte;
+
+  mosi &= PIN_MASK;
+  sck &= PIN_MASK;
+
+  switch (linuxgpio_backend) {
+#if defined(HAVE_LINUX_GPIO_H)
+  case LINUXGPIO_CDEV: {
+    int mi = linuxgpio_index[mosi], si = linuxgpio_index[sck];
+
+    if (mi < 0 || si < 0)
+      return -1;
+    for (i=0; i<len; i++) {
+      byte = 0;
+      for (j=7; j>=0; j--) {
+        linuxgpio_out.values[mi] = ((tx[i] >> j) & 0x01) ^ minv;
+        linuxgpio_out.values[si] = sinv;
+        ioctl(linuxgpio_out_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &linuxgpio_out);
+        if (pgm->ispdelay > 1)
+          bitbang_delay(pgm->ispdelay);
+        linuxgpio_out.values[si] = !sinv;
+        ioctl(linuxgpio_out_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &linuxgpio_out);
+        if (pgm->ispdelay > 1)
+          bitbang_delay(pgm->ispdelay);
+        if (linuxgpio_getpin(pgm, PIN_AVR_MISO) > 0)
+          byte |= 1 << j;
+      }
+      rx[i] = byte;
+    }
+    linuxgpio_out.values[si] = sinv;
+    ioctl(linuxgpio_out_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &linuxgpio_out);
+    if (pgm->ispdelay > 1)
+      bitbang_delay(pgm->ispdelay);
+    return 0;
+  }
+#endif
+#if defined(LINUXGPIO_MMAP)
+  case LINUXGPIO_BCM2835: {
+    /* where to write the MOSI mask for a 0 and a 1 bit, SCK low, SCK high */
+    volatile uint32_t *mreg[2], *sreg[2];
+    uint32_t mmask = 1u << (mosi % 32), smask = 1u << (sck % 32);
+    unsigned int delay = pgm->ispdelay > BCM2835_MIN_DELAY?
+                         pgm->ispdelay: BCM2835_MIN_DELAY;
+    int b;
+
+    for (b=0; b<2; b++) {
+      mreg[b] = linuxgpio_regs + ((b ^ minv)? BCM2835_GPSET0: BCM2835_GPCLR0) + mosi / 32;
+      sreg[b] = linuxgpio_regs + ((b ^ sinv)? BCM2835_GPSET0: BCM2835_GPCLR0) + sck / 32;
+    }
+    for (i=0; i<len; i++) {
+      byte = 0;
+      for (j=7; j>=0; j--) {
+        b = (tx[i] >> j) & 0x01;
+        *mreg[b] = mmask;
+        *sreg[0] = smask;
+        bitbang_delay(delay);
+        *sreg[1] = smask;
+        bitbang_delay(delay);
+        if (linuxgpio_getpin(pgm, PIN_AVR_MISO) > 0)
+          byte |= 1 << j;
+      }
+      rx[i] = byte;
+    }
+    *sreg[0] = smask;
+    bitbang_delay(delay);
+    return 0;
+  }
+#endif
+  default:
+    return -1;
+  }
+}
+
 static int linuxgpio_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 {
   int pin = pgm->pinno[pinfunc]; // TODO
   
-  if ( linuxgpio_fds[pin & PIN_MASK] < 0 )
+  if (linuxgpio_backend == LINUXGPIO_SYSFS &&
+      linuxgpio_fds[pin & PIN_MASK] < 0 )
     return -1;
 
   linuxgpio_setpin(pgm, pinfunc, 1);
@@ -219,7 +610,17 @@ static int linuxgpio_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 
 static void linuxgpio_display(PROGRAMMER *pgm, const char *p)
 {
-    fprintf(stderr, "%sPin assignment  : /sys/class/gpio/gpio{n}\n",p);
+    switch (linuxgpio_backend) {
+    case LINUXGPIO_CDEV:
+      fprintf(stderr, "%sPin assignment  : %s line {n}\n", p, pgm->port);
+      break;
+    case LINUXGPIO_BCM2835:
+      fprintf(stderr, "%sPin assignment  : BCM2835 GPIO{n}\n", p);
+      break;
+    default:
+      fprintf(stderr, "%sPin assignment  : /sys/class/gpio/gpio{n}\n",p);
+      break;
+    }
     pgm_display_generic_mask(pgm, p, SHOW_AVR_PINS);
 }
 
@@ -249,23 +650,35 @@ static int linuxgpio_open(PROGRAMMER *pgm, char *port)
 
   bitbang_check_prerequisites(pgm);
 
+  strcpy(pgm->port, port);
 
   for (i=0; i<N_GPIO; i++)
     linuxgpio_fds[i] = -1;
-  //Avrdude assumes that if a pin number is 0 it means not used/available
-  //this causes a problem because 0 is a valid GPIO number in Linux sysfs.
-  //To avoid annoying off by one pin numbering we assume SCK, MOSI, MISO 
-  //and RESET pins are always defined in avrdude.conf, even as 0. If they're
-  //not programming will not work anyway. The drawbacks of this approach are
-  //that unwanted toggling of GPIO0 can occur and that other optional pins
-  //mostry LED status, can't be set to GPIO0. It can be fixed when a better 
-  //solution exists.
+
+  linuxgpio_backend = LINUXGPIO_SYSFS;
+  if (strncmp(port, "/dev/gpiochip", strlen("/dev/gpiochip")) == 0) {
+#if defined(HAVE_LINUX_GPIO_H)
+    linuxgpio_backend = LINUXGPIO_CDEV;
+    return linuxgpio_cdev_open(pgm, port);
+#else
+    fprintf(stderr, "%s: GPIO character device support not available in this "
+            "configuration\n", progname);
+    return -1;
+#endif
+  }
+  if (strcmp(port, "/dev/gpiomem") == 0) {
+#if defined(LINUXGPIO_MMAP)
+    linuxgpio_backend = LINUXGPIO_BCM2835;
+    return linuxgpio_bcm2835_open(pgm, port);
+#else
+    fprintf(stderr, "%s: %s support not available in this configuration\n",
+            progname, port);
+    return -1;
+#endif
+  }
+
   for (i=0; i<N_PINS; i++) {
-    if ( (pgm->pinno[i] & PIN_MASK) != 0 ||
-         i == PIN_AVR_RESET ||
-         i == PIN_AVR_SCK   ||
-         i == PIN_AVR_MOSI  ||
-         i == PIN_AVR_MISO ) {
+    if (linuxgpio_used(pgm, i)) {
         pin = pgm->pinno[i] & PIN_MASK;
         if ((r=linuxgpio_export(pin)) < 0) {
             fprintf(stderr, "Can't export GPIO %d, already exported/busy?: %s",
@@ -292,6 +705,21 @@ static void linuxgpio_close(PROGRAMMER *pgm)
 {
   int i, reset_pin;
 
+  switch (linuxgpio_backend) {
+#if defined(HAVE_LINUX_GPIO_H)
+  case LINUXGPIO_CDEV:
+    linuxgpio_cdev_close(pgm);
+    return;
+#endif
+#if defined(LINUXGPIO_MMAP)
+  case LINUXGPIO_BCM2835:
+    linuxgpio_bcm2835_close(pgm);
+    return;
+#endif
+  default:
+    break;
+  }
+
   reset_pin = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
 
   //first configure all pins as input, except RESET
@@ -330,10 +758,13 @@ void linuxgpio_initpgm(PROGRAMMER *pgm)
   pgm->program_enable = bitbang_program_enable;
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
   pgm->open           = linuxgpio_open;
   pgm->close          = linuxgpio_close;
   pgm->setpin         = linuxgpio_setpin;
   pgm->getpin         = linuxgpio_getpin;
+  pgm->bitbang_xfer_buf = linuxgpio_xfer_buf;
   pgm->highpulsepin   = linuxgpio_highpulsepin;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
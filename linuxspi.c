@@ -0,0 +1,366 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Support for the hardware SPI controller through the Linux spidev
+ * interface, with RESET on a line of the GPIO character device
+ *
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pindefs.h"
+#include "pgm.h"
+#include "bitbang.h"
+#include "linuxspi.h"
+
+#if HAVE_LINUXSPI
+
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+/* SCK rate unless -b or -B say otherwise, fine for a target at 1 MHz */
+#define LINUXSPI_DEFAULT_HZ 200000
+/* the spidev driver takes at most its bufsiz (4 KiB by default) at once */
+#define LINUXSPI_MAXXFER    4096
+/* where the RESET line is unless the port names a chip */
+#define LINUXSPI_GPIOCHIP   "/dev/gpiochip0"
+
+static int linuxspi_fd = -1;
+static int linuxspi_chip_fd = -1;
+static int linuxspi_reset_fd = -1;
+static uint32_t linuxspi_hz;
+
+static int linuxspi_xfer(const unsigned char *tx, unsigned char *rx, int len)
+{
+  struct spi_ioc_transfer xfer;
+  int n;
+
+  while (len > 0) {
+    n = len < LINUXSPI_MAXXFER? len: LINUXSPI_MAXXFER;
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)tx;
+    xfer.rx_buf = (unsigned long)rx;
+    xfer.len = n;
+    xfer.speed_hz = linuxspi_hz;
+    xfer.bits_per_word = 8;
+    if (ioctl(linuxspi_fd, SPI_IOC_MESSAGE(1), &xfer) != n) {
+      fprintf(stderr, "%s: linuxspi_xfer(): SPI transfer failed: %s\n",
+              progname, strerror(errno));
+      return -1;
+    }
+    tx += n;
+    rx += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/*
+ * Hook for the paged access of the bitbang core.  Its fallback would
+ * try to clock the bits through setpin(), which can't reach SCK, so a
+ * failed transfer hands back zeros for verification to catch.
+ */
+static int linuxspi_xfer_buf(PROGRAMMER *pgm, const unsigned char *tx,
+                             unsigned char *rx, int len)
+{
+  if (linuxspi_xfer(tx, rx, len) < 0)
+    memset(rx, 0, len);
+
+  return 0;
+}
+
+static void linuxspi_dump(const char *name, const unsigned char *cmd,
+                          const unsigned char *res, int count)
+{
+  int i;
+
+  fprintf(stderr, "%s(): [ ", name);
+  for (i = 0; i < count; i++)
+    fprintf(stderr, "%02X ", cmd[i]);
+  fprintf(stderr, "] [ ");
+  for (i = 0; i < count; i++)
+    fprintf(stderr, "%02X ", res[i]);
+  fprintf(stderr, "]\n");
+}
+
+static int linuxspi_cmd(PROGRAMMER *pgm, const unsigned char *cmd,
+                        unsigned char *res)
+{
+  if (linuxspi_xfer(cmd, res, 4) < 0)
+    return -1;
+  if (verbose >= 2)
+    linuxspi_dump("linuxspi_cmd", cmd, res, 4);
+
+  return 0;
+}
+
+static int linuxspi_spi(PROGRAMMER *pgm, const unsigned char *cmd,
+                        unsigned char *res, int count)
+{
+  if (linuxspi_xfer(cmd, res, count) < 0)
+    return -1;
+  if (verbose >= 2)
+    linuxspi_dump("linuxspi_spi", cmd, res, count);
+
+  return 0;
+}
+
+/*
+ * Only RESET is a GPIO line, SCK, MOSI and MISO belong to the SPI
+ * controller.  Setting the LEDs of the bitbang core fails quietly.
+ */
+static int linuxspi_setpin(PROGRAMMER *pgm, int pinfunc, int value)
+{
+  struct gpiohandle_data data;
+
+  if (pinfunc != PIN_AVR_RESET || linuxspi_reset_fd < 0)
+    return -1;
+  if (pgm->pinno[PIN_AVR_RESET] & PIN_INVERSE)
+    value = !value;
+
+  memset(&data, 0, sizeof(data));
+  data.values[0] = value != 0;
+  if (ioctl(linuxspi_reset_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+    return -1;
+
+  return 0;
+}
+
+/*
+ * A positive pulse on RESET while SCK idles low, then the 20 ms the
+ * target needs before it takes the program enable command.
+ */
+static void linuxspi_reset_pulse(PROGRAMMER *pgm)
+{
+  pgm->setpin(pgm, PIN_AVR_RESET, 1);
+  usleep(100);
+  pgm->setpin(pgm, PIN_AVR_RESET, 0);
+  usleep(20000);
+}
+
+static int linuxspi_initialize(PROGRAMMER *pgm, AVRPART *p)
+{
+  int rc, tries;
+
+  if (p->flags & AVRPART_HAS_TPI) {
+    fprintf(stderr, "%s: Error: %s programmer does not support TPI\n",
+            progname, pgm->type);
+    return -1;
+  }
+
+  pgm->setpin(pgm, PIN_AVR_RESET, 0);
+  usleep(20000);
+  linuxspi_reset_pulse(pgm);
+
+  if (p->flags & AVRPART_IS_AT90S1200) {
+    pgm->program_enable(pgm, p);
+    return 0;
+  }
+
+  /*
+   * The controller can't clock a single bit to get back into sync
+   * with the chip, so retry after another RESET pulse instead.
+   */
+  tries = 0;
+  do {
+    rc = pgm->program_enable(pgm, p);
+    if (rc == 0 || rc == -1)
+      break;
+    linuxspi_reset_pulse(pgm);
+    tries++;
+  } while (tries < 65);
+
+  if (rc) {
+    fprintf(stderr, "%s: AVR device not responding\n", progname);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void linuxspi_display(PROGRAMMER *pgm, const char *p)
+{
+  fprintf(stderr, "%sSPI clock       : %u Hz\n", p, (unsigned int)linuxspi_hz);
+  fprintf(stderr, "%sPin assignment  : RESET is a line of the GPIO chip\n", p);
+  pgm_display_generic_mask(pgm, p, 1 << PIN_AVR_RESET);
+}
+
+static void linuxspi_enable(PROGRAMMER *pgm)
+{
+  /* nothing */
+}
+
+static void linuxspi_disable(PROGRAMMER *pgm)
+{
+  /* nothing */
+}
+
+static void linuxspi_powerup(PROGRAMMER *pgm)
+{
+  /* nothing */
+}
+
+static void linuxspi_powerdown(PROGRAMMER *pgm)
+{
+  /* nothing */
+}
+
+/*
+ * The port is the spidev device, optionally followed by the GPIO chip
+ * of the RESET line: "/dev/spidev0.0[:/dev/gpiochip0]".  The line
+ * number comes from the reset entry of the programmer definition.
+ */
+static int linuxspi_open(PROGRAMMER *pgm, char *port)
+{
+  struct gpiohandle_request req;
+  char dev[PGM_PORTLEN], *chip;
+  uint8_t mode = SPI_MODE_0, bits = 8;
+
+  strcpy(pgm->port, port);
+  strcpy(dev, port);
+  if ((chip = strchr(dev, ':')) != NULL)
+    *chip++ = '\0';
+  else
+    chip = LINUXSPI_GPIOCHIP;
+
+  if ((linuxspi_fd = open(dev, O_RDWR)) < 0) {
+    fprintf(stderr, "%s: linuxspi_open(): can't open %s: %s\n",
+            progname, dev, strerror(errno));
+    return -1;
+  }
+
+  linuxspi_hz = LINUXSPI_DEFAULT_HZ;
+  if (pgm->baudrate > 0)
+    linuxspi_hz = pgm->baudrate;
+  else if (pgm->bitclock > 0)
+    linuxspi_hz = 1 / pgm->bitclock;
+  if (ioctl(linuxspi_fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+      ioctl(linuxspi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(linuxspi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &linuxspi_hz) < 0) {
+    fprintf(stderr, "%s: linuxspi_open(): can't set up %s for mode 0 at %u Hz: %s\n",
+            progname, dev, (unsigned int)linuxspi_hz, strerror(errno));
+    close(linuxspi_fd);
+    linuxspi_fd = -1;
+    return -1;
+  }
+  if (verbose >= 2)
+    fprintf(stderr, "%s: SPI clock set to %u Hz\n",
+            progname, (unsigned int)linuxspi_hz);
+
+  if ((linuxspi_chip_fd = open(chip, O_RDWR)) < 0) {
+    fprintf(stderr, "%s: linuxspi_open(): can't open %s: %s\n",
+            progname, chip, strerror(errno));
+    close(linuxspi_fd);
+    linuxspi_fd = -1;
+    return -1;
+  }
+
+  /* hold the target in reset from the start */
+  memset(&req, 0, sizeof(req));
+  req.lineoffsets[0] = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
+  req.lines = 1;
+  req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+  req.default_values[0] = (pgm->pinno[PIN_AVR_RESET] & PIN_INVERSE) != 0;
+  strcpy(req.consumer_label, "avrdude");
+  if (ioctl(linuxspi_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+    fprintf(stderr, "%s: linuxspi_open(): can't request line %d of %s, "
+            "busy?: %s\n", progname, pgm->pinno[PIN_AVR_RESET] & PIN_MASK,
+            chip, strerror(errno));
+    close(linuxspi_chip_fd);
+    close(linuxspi_fd);
+    linuxspi_chip_fd = linuxspi_fd = -1;
+    return -1;
+  }
+  linuxspi_reset_fd = req.fd;
+
+  return 0;
+}
+
+static void linuxspi_close(PROGRAMMER *pgm)
+{
+  struct gpiohandle_request req;
+
+  if (linuxspi_reset_fd >= 0) {
+    close(linuxspi_reset_fd);
+    //configure RESET as input, if there's external pull up it will go high
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_INPUT;
+    strcpy(req.consumer_label, "avrdude");
+    if (ioctl(linuxspi_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) >= 0)
+      close(req.fd);
+  }
+  if (linuxspi_chip_fd >= 0)
+    close(linuxspi_chip_fd);
+  if (linuxspi_fd >= 0)
+    close(linuxspi_fd);
+  linuxspi_fd = linuxspi_chip_fd = linuxspi_reset_fd = -1;
+}
+
+void linuxspi_initpgm(PROGRAMMER *pgm)
+{
+  strcpy(pgm->type, "linuxspi");
+
+  pgm_fill_old_pins(pgm); // TODO to be removed if old pin data no longer needed
+
+  pgm->initialize     = linuxspi_initialize;
+  pgm->display        = linuxspi_display;
+  pgm->enable         = linuxspi_enable;
+  pgm->disable        = linuxspi_disable;
+  pgm->powerup        = linuxspi_powerup;
+  pgm->powerdown      = linuxspi_powerdown;
+  pgm->program_enable = bitbang_program_enable;
+  pgm->chip_erase     = bitbang_chip_erase;
+  pgm->cmd            = linuxspi_cmd;
+  pgm->spi            = linuxspi_spi;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
+  pgm->open           = linuxspi_open;
+  pgm->close          = linuxspi_close;
+  pgm->setpin         = linuxspi_setpin;
+  pgm->bitbang_xfer_buf = linuxspi_xfer_buf;
+  pgm->read_byte      = avr_read_byte_default;
+  pgm->write_byte     = avr_write_byte_default;
+}
+
+const char linuxspi_desc[] = "SPI using the Linux spidev interface";
+
+#else  /* !HAVE_LINUXSPI */
+
+void linuxspi_initpgm(PROGRAMMER * pgm)
+{
+  fprintf(stderr,
+	  "%s: Linux spidev support not available in this configuration\n",
+	  progname);
+}
+
+const char linuxspi_desc[] = "SPI using the Linux spidev interface (not available)";
+
+#endif /* HAVE_LINUXSPI */
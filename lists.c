@@ -40,6 +40,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "lists.h"
 
 #define MAGIC 0xb05b05b0
@@ -50,8 +51,9 @@
 #define MALLOC(size,x) kmalloc(size,x)
 #define FREE           kfree
 #else
-#define MALLOC(size,x) malloc(size)
-#define FREE           free
+/* lists built from the configuration live in its arena */
+#define MALLOC(size,x) arena_alloc(size)
+#define FREE           arena_free
 #endif
 
 
@@ -96,6 +98,8 @@ typedef struct LIST {
   LISTNODE * next_ln;       /* next available list node          */
   NODEPOOL * np_top;        /* top of the node pool chain        */
   NODEPOOL * np_bottom;     /* bottom of the node pool chain     */
+  void    ** vec;           /* data pointers in list order, or
+                               NULL if the list changed          */
 #if CHECK_MAGIC
   unsigned int magic2;
 #endif
@@ -128,6 +132,16 @@ typedef struct LIST {
 
 static int insert_ln ( LIST * l, LISTNODE * ln, void * data_ptr );
 
+/* forget the array of data pointers, the list is about to change */
+static void
+drop_vec ( LIST * l )
+{
+  if (l->vec != NULL) {
+    free(l->vec);
+    l->vec = NULL;
+  }
+}
+
 
 #if CHECK_MAGIC
 static int cknpmagic ( LIST * l )
@@ -295,6 +309,8 @@ get_listnode ( LIST * l )
 
   CKLMAGIC(l);
 
+  drop_vec(l);
+
   if (l->next_ln == NULL) {
     /*--------------------------------------------------
     | allocate a new node pool and chain to the others
@@ -374,6 +390,8 @@ free_listnode ( LIST * l, LISTNODE * ln )
 {
   CKLMAGIC(l);
 
+  drop_vec(l);
+
   /*--------------------------------------------------
   |  insert the list node at the head of the list of
   |  free list nodes.
@@ -459,6 +477,7 @@ lcreat ( void * liststruct, int elements )
   l->np_top = NULL;
   l->np_bottom = NULL;
   l->next_ln = NULL;
+  l->vec = NULL;
 
   CKLMAGIC(l);
 
@@ -515,6 +534,8 @@ ldestroy ( LISTID lid )
 
   CKLMAGIC(l);
 
+  drop_vec(l);
+
   /*--------------------------------------------------
   |  free each node pool - start at the first node
   |  pool and free each successive until there are
@@ -807,6 +828,15 @@ lget_n ( LISTID lid, unsigned int n )
     return NULL;
   }
 
+  /*--------------------------------------------------
+  |  index the array of data pointers if there is one,
+  |  or build it, so that further lookups are direct
+   --------------------------------------------------*/
+  if (l->vec != NULL || larray(l) != NULL) {
+    CKLMAGIC(l);
+    return l->vec[n-1];
+  }
+
   ln = l->top;
   i = 1;
   while (ln && (i!=n)) {
@@ -827,6 +857,45 @@ lget_n ( LISTID lid, unsigned int n )
 
 
 
+/*---------------------------------------------------------------
+|  larray
+|
+|  return the data pointers of the list as a contiguous,
+|  NULL terminated array, for indexing and fast scans.  The
+|  array belongs to the list and stays valid until the list
+|  is changed.  Returns NULL if out of memory.
+ ---------------------------------------------------------------*/
+void **
+larray ( LISTID lid )
+{
+  LIST * l;
+  LISTNODE * ln;
+  int i;
+
+  l = (LIST *)lid;
+
+  CKLMAGIC(l);
+
+  if (l->vec != NULL)
+    return l->vec;
+
+  l->vec = (void **) malloc((l->num + 1) * sizeof(void *));
+  if (l->vec == NULL)
+    return NULL;
+
+  for (ln = l->top, i = 0; ln != NULL; ln = ln->next) {
+    CKMAGIC(ln);
+    l->vec[i++] = ln->data;
+  }
+  l->vec[i] = NULL;
+
+  CKLMAGIC(l);
+
+  return l->vec;
+}
+
+
+
 /*---------------------------------------------------------------
 |  lget_ln
 |
@@ -1282,7 +1351,9 @@ lsrch ( LISTID lid, void * p, int (* compare)(void * p1, void * p2) )
 /*----------------------------------------------------------------------
 |  lsort
 |
-|  sort list - sorts list inplace (using bubble sort)
+|  sort list - sorts list inplace (using a merge sort of the
+|  data pointers, or bubble sort if out of memory); the sort is
+|  stable
 |
  ----------------------------------------------------------------------*/
 void
@@ -1292,11 +1363,47 @@ lsort ( LISTID lid, int (* compare)(void * p1, void * p2) )
   LISTNODE * lt; /* this */
   LISTNODE * ln; /* next */
   int unsorted = 1;
+  void ** a, ** b, ** t;
+  int w, i, j, k, m, e;
 
   l = (LIST *)lid;
 
   CKLMAGIC(l);
 
+  a = larray(l);
+  b = (void **) malloc((l->num + 1) * sizeof(void *));
+  if (a != NULL && b != NULL) {
+    /* l->vec is replaced by the sorted array below */
+    l->vec = NULL;
+    for (w = 1; w < l->num; w *= 2) {
+      for (i = 0; i < l->num; i += 2 * w) {
+        m = i + w < l->num ? i + w : l->num;
+        e = i + 2 * w < l->num ? i + 2 * w : l->num;
+        for (j = i, k = m; j < m || k < e; ) {
+          if (k >= e || (j < m && compare(a[j], a[k]) <= 0)) {
+            b[j + k - m] = a[j];
+            j++;
+          }
+          else {
+            b[j + k - m] = a[k];
+            k++;
+          }
+        }
+      }
+      t = a; a = b; b = t;
+    }
+    free(b);
+    a[l->num] = NULL;
+    for (lt = l->top, i = 0; lt != NULL; lt = lt->next)
+      lt->data = a[i++];
+    l->vec = a;
+    CKLMAGIC(l);
+    return;
+  }
+  free(b);
+
+  drop_vec(l);
+
   while(unsorted){
     lt = l->top;
     unsorted = 0;
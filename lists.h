@@ -94,6 +94,7 @@ int        lins_ln  ( LISTID lid, LNODEID lnid, void * data_ptr );
 
 void     * lget    ( LISTID lid );
 void     * lget_n  ( LISTID lid, unsigned int n );
+void    ** larray  ( LISTID lid );
 LNODEID    lget_ln ( LISTID lid, unsigned int n );
 
 void     * lrmv    ( LISTID lid );
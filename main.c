@@ -43,23 +43,48 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#if !defined(WIN32NATIVE)
+#  include <sys/wait.h>
+#endif
 
 #include "avr.h"
+#include "cachefile.h"
 #include "config.h"
+#include "confcache.h"
+#include "imgcache.h"
+#include "memsum.h"
 #include "confwin.h"
 #include "fileio.h"
+#include "jtagmkII.h"
 #include "lists.h"
 #include "par.h"
 #include "pindefs.h"
+#include "pool.h"
 #include "term.h"
 #include "safemode.h"
+#include "scktune.h"
+#include "server.h"
+#include "replay.h"
+#include "sim.h"
+#include "stats.h"
+#include "stk500generic.h"
+#include "trace.h"
+#include "serial.h"
 #include "update.h"
+#include "usbdevs.h"
+#include "usbscan.h"
 #include "pgm_type.h"
 
 
 /* Get VERSION from ac_cfg.h */
 char * version      = VERSION;
 
+#if !defined(HAVE_BUILTIN_CONFIG)
+/* no configuration built in, the system wide one is always read */
+static const unsigned char builtin_config[1];
+static const size_t builtin_config_size = 0;
+#endif
+
 char * progname;
 char   progbuf[PATH_MAX]; /* temporary buffer of spaces the same
                              length as progname; used for lining up
@@ -77,6 +102,8 @@ static LISTID extended_params = NULL;
 
 static LISTID additional_config_files = NULL;
 
+static LISTID ports = NULL;
+
 static PROGRAMMER * pgm;
 
 /*
@@ -95,41 +122,81 @@ static void usage(void)
   fprintf(stderr,
  "Usage: %s [options]\n"
  "Options:\n"
- "  -p <partno>                Required. Specify AVR device.\n"
+ "  -p <partno>|auto           Required. Specify AVR device, or detect it\n"
+ "                             from its signature.\n"
  "  -b <baudrate>              Override RS-232 baud rate.\n"
- "  -B <bitclock>              Specify JTAG/STK500v2 bit clock period (us).\n"
+ "  -B <bitclock>|auto         Specify JTAG/STK500v2 bit clock period (us),\n"
+ "                             or find the shortest one that works.\n"
  "  -C <config-file>           Specify location of configuration file.\n"
  "  -c <programmer>            Specify programmer type.\n"
  "  -D                         Disable auto erase for flash memory\n"
  "  -i <delay>                 ISP Clock Delay [in microseconds]\n"
  "  -P <port>                  Specify connection port.\n"
+ "                             Multiple -P options program one device per\n"
+ "                             port at the same time (gang mode).\n"
  "  -F                         Override invalid signature check.\n"
  "  -e                         Perform a chip erase.\n"
+ "  -H <memtype>:<address>     Keep a fingerprint of the writes there, and\n"
+ "                             skip them when the device has it already.\n"
  "  -O                         Perform RC oscillator calibration (see AVR053). \n"
  "  -U <memtype>:r|w|v:<filename>[:format]\n"
  "                             Memory operation specification.\n"
  "                             Multiple -U options are allowed, each request\n"
  "                             is performed in the order specified.\n"
+ "  -K <directory>             Keep decoded input files in <directory>.\n"
  "  -n                         Do not write anything to the device.\n"
  "  -V                         Do not verify.\n"
+ "  -z                         Stop reading flash where the rest is blank.\n"
+ "  -W                         Read EEPROM pages first, and write only those\n"
+ "                             that change.\n"
  "  -u                         Disable safemode, default when running from a script.\n"
  "  -s                         Silent safemode operation, will not ask you if\n"
  "                             fuses should be changed back.\n"
  "  -t                         Enter terminal mode.\n"
+ "  -T <cmdfile>               Run the terminal mode commands in <cmdfile>.\n"
+ "  -S <socket>                Keep the programmer open and serve -U operations\n"
+ "                             sent to local socket <socket>.\n"
+ "  -w                         Program one board after the other as they are\n"
+ "                             plugged in (continuous mode), with several\n"
+ "                             -P [<programmer>@]<port> by a pool of them.\n"
  "  -E <exitspec>[,<exitspec>] List programmer exit specifications.\n"
  "  -x <extended_param>        Pass <extended_param> to programmer.\n"
  "  -y                         Count # erase cycles in EEPROM.\n"
  "  -Y <number>                Initialize erase cycle # in EEPROM.\n"
  "  -v                         Verbose output. -v -v for more.\n"
  "  -q                         Quell progress output. -q -q for less.\n"
+ "  -J <file>                  Write transfer statistics as JSON to <file>.\n"
+ "  -j <file>                  Write a wire-level trace to <file>.\n"
+ "  -k <file>                  Estimate the time of the -U operations from\n"
+ "                             statistics written by -J, and exit.\n"
  "  -l logfile                 Use logfile rather than stderr for diagnostics.\n"
+ "  -L                         Tune USB-serial adapters for low latency.\n"
  "  -?                         Display this usage.\n"
  "\navrdude version %s, URL: <http://savannah.nongnu.org/projects/avrdude/>\n"
           ,progname, version);
 }
 
 
-static void update_progress_tty (int percent, double etime, char *hdr)
+/*
+ * The transfer rate so far and, until done, the time it takes to
+ * finish at that rate, in fields of fixed width so that redrawing the
+ * line leaves nothing of the previous one behind.
+ */
+static void progress_rate (int percent, double etime, long bytes)
+{
+  if (bytes > 0 && etime > 0)
+    fprintf (stderr, " %8.2f kB/s", bytes / etime / 1000);
+  else
+    fprintf (stderr, "%14s", "");
+
+  if (percent > 0 && percent < 100)
+    fprintf (stderr, " ETA %6.2fs", etime * (100 - percent) / percent);
+  else
+    fprintf (stderr, "%12s", "");
+}
+
+static void update_progress_tty (int percent, double etime, char *hdr,
+                                 long bytes)
 {
   static char hashes[51];
   static char *header;
@@ -154,6 +221,7 @@ static void update_progress_tty (int percent, double etime, char *hdr)
   if (last == 0) {
     fprintf(stderr, "\r%s | %s | %d%% %0.2fs", 
             header, hashes, percent, etime);
+    progress_rate(percent, etime, bytes);
   }
 
   if (percent == 100) {
@@ -164,7 +232,8 @@ static void update_progress_tty (int percent, double etime, char *hdr)
   setvbuf(stderr, (char*)NULL, _IOLBF, 0);
 }
 
-static void update_progress_no_tty (int percent, double etime, char *hdr)
+static void update_progress_no_tty (int percent, double etime, char *hdr,
+                                    long bytes)
 {
   static int done = 0;
   static int last = 0;
@@ -185,7 +254,10 @@ static void update_progress_no_tty (int percent, double etime, char *hdr)
   }
 
   if ((percent == 100) && (done == 0)) {
-    fprintf (stderr, " | 100%% %0.2fs\n\n", etime);
+    fprintf (stderr, " | 100%% %0.2fs", etime);
+    if (bytes > 0 && etime > 0)
+      fprintf (stderr, ", %0.2f kB/s", bytes / etime / 1000);
+    fprintf (stderr, "\n\n");
     last = 0;
     done = 1;
   }
@@ -270,12 +342,71 @@ static void list_parts(FILE * f, const char *prefix, LISTID avrparts)
     walk_avrparts(avrparts, list_avrparts_callback, &c);
 }
 
+static int exithook_set;
+
 static void exithook(void)
 {
     if (pgm->teardown)
         pgm->teardown(pgm);
 }
 
+/*
+ * Find programmer id in the configuration and get it ready: the
+ * backend set up and the extended parameters applied.  Exits if that
+ * fails.
+ */
+static PROGRAMMER * programmer_prepare(const char * id)
+{
+  PROGRAMMER * prog;
+
+  prog = locate_programmer(programmers, id);
+  if (prog == NULL) {
+    fprintf(stderr,"\n");
+    fprintf(stderr,
+            "%s: Can't find programmer id \"%s\"\n",
+            progname, id);
+    fprintf(stderr,"\nValid programmers are:\n");
+    list_programmers(stderr, "  ", programmers);
+    fprintf(stderr,"\n");
+    exit(1);
+  }
+
+  if (prog->initpgm) {
+    prog->initpgm(prog);
+  } else {
+    fprintf(stderr,
+            "\n%s: Can't initialize the programmer.\n\n",
+            progname);
+    exit(1);
+  }
+
+  if (prog->setup) {
+    prog->setup(prog);
+  }
+  if (prog->teardown && !exithook_set) {
+    atexit(exithook);
+    exithook_set = 1;
+  }
+
+  if (lsize(extended_params) > 0) {
+    if (prog->parseextparams == NULL) {
+      fprintf(stderr,
+              "%s: WARNING: Programmer doesn't support extended parameters,"
+              " -x option(s) ignored\n",
+              progname);
+    } else {
+      if (prog->parseextparams(prog, extended_params) < 0) {
+        fprintf(stderr,
+              "%s: Error parsing extended parameter list\n",
+              progname);
+        exit(1);
+      }
+    }
+  }
+
+  return prog;
+}
+
 static void cleanup_main(void)
 {
     if (updates) {
@@ -290,10 +421,579 @@ static void cleanup_main(void)
         ldestroy(additional_config_files);
         additional_config_files = NULL;
     }
+    if (ports) {
+        ldestroy(ports);
+        ports = NULL;
+    }
 
     cleanup_config();
 }
 
+/*
+ * Use name for the messages from now on, keeping progbuf as wide.
+ */
+static void progname_set(char * name)
+{
+  int len;
+
+  progname = name;
+  len = strlen(progname) + 2;
+  if (len >= sizeof(progbuf))
+    len = sizeof(progbuf) - 1;
+  memset(progbuf, ' ', len);
+  progbuf[len] = 0;
+}
+
+/*
+ * Gang mode: program one device per -P port, sharing the parsed
+ * configuration and the preloaded input files.  Every device gets a
+ * process of its own, which returns from here with its port and goes
+ * on like a single-device run, with the port added to progname so its
+ * messages can be told apart.  The parent only waits for them and
+ * reports the outcome and timing per port.  Processes rather than
+ * threads, as the programmer backends keep global state.
+ */
+static char * gang_fork(LISTID ports)
+{
+#if !defined(WIN32NATIVE)
+  struct gang_device {
+    char * port;
+    pid_t pid;
+    struct timeval start, end;
+    int status;
+  } * dev;
+  LNODEID ln;
+  int i, n, running, failures;
+  pid_t pid;
+  int status;
+  char * name;
+  double elapsed;
+
+  n = lsize(ports);
+  dev = calloc(n, sizeof(*dev));
+  if (dev == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (ln=lfirst(ports), i=0, running=0; ln; ln=lnext(ln), i++) {
+    dev[i].port = ldata(ln);
+    gettimeofday(&dev[i].start, NULL);
+    pid = fork();
+    if (pid == 0) {
+      name = malloc(strlen(progname) + strlen(dev[i].port) + 3);
+      if (name == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+      sprintf(name, "%s[%s]", progname, dev[i].port);
+      progname_set(name);
+      free(dev);
+      return ldata(ln);
+    }
+    if (pid < 0) {
+      fprintf(stderr, "%s: cannot start process for port %s: %s\n",
+              progname, dev[i].port, strerror(errno));
+      dev[i].status = -1;
+      continue;
+    }
+    dev[i].pid = pid;
+    running++;
+  }
+
+  while (running > 0) {
+    pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (i = 0; i < n; i++)
+      if (dev[i].pid == pid) {
+        gettimeofday(&dev[i].end, NULL);
+        dev[i].status = status;
+        running--;
+        break;
+      }
+  }
+
+  fprintf(stderr, "\n%s: gang mode results:\n", progname);
+  for (i = 0, failures = 0; i < n; i++) {
+    if (dev[i].pid <= 0 ||
+        !WIFEXITED(dev[i].status) || WEXITSTATUS(dev[i].status) != 0) {
+      failures++;
+      if (dev[i].pid > 0 && WIFSIGNALED(dev[i].status))
+        fprintf(stderr, "%s%-24s FAILED (signal %d)",
+                progbuf, dev[i].port, WTERMSIG(dev[i].status));
+      else
+        fprintf(stderr, "%s%-24s FAILED", progbuf, dev[i].port);
+    } else
+      fprintf(stderr, "%s%-24s OK", progbuf, dev[i].port);
+    if (dev[i].pid > 0) {
+      elapsed = (dev[i].end.tv_sec - dev[i].start.tv_sec) +
+        (dev[i].end.tv_usec - dev[i].start.tv_usec) / 1e6;
+      fprintf(stderr, " %.2fs", elapsed);
+    }
+    fprintf(stderr, "\n");
+  }
+  fprintf(stderr, "%s%d of %d devices failed\n", progbuf, failures, n);
+
+  free(dev);
+  exit(failures? 1: 0);
+#else
+  fprintf(stderr, "%s: gang mode is not supported on this platform\n",
+          progname);
+  exit(1);
+#endif
+}
+
+#if !defined(WIN32NATIVE)
+
+#define BOARD_POLL   100000     /* us between looks at the port */
+#define BOARD_SETTLE 250000     /* us from arrival to programming */
+
+/*
+ * Continuous mode: whether a board is attached at port.  A board is
+ * noticed by what it brings along, the serial port of its bootloader
+ * or USB-serial chip, or a USB device with the IDs of the programmer
+ * (or of the part, for DFU).  Returns -1 if port cannot be watched.
+ */
+static int board_present(PROGRAMMER * pgm, struct avrpart * p,
+                         const char * port)
+{
+  struct stat sb;
+  int pids[16], n, vid;
+  LNODEID ln;
+
+  if (pgm->conntype == CONNTYPE_USB ||
+      (strncmp(port, "usb", 3) == 0 && (port[3] == 0 || port[3] == ':'))) {
+    for (n = 0, ln = lfirst(pgm->usbpid); ln != NULL && n < 16;
+         ln = lnext(ln))
+      pids[n++] = *(int *)ldata(ln);
+    if (n == 0 && p->usbpid != 0)
+      pids[n++] = p->usbpid;
+    vid = pgm->usbvid;
+    if (vid == 0 && p->usbpid != 0)
+      vid = USB_VENDOR_ATMEL;   /* as the DFU programmers do */
+    if (vid == 0 && n == 0)
+      return -1;
+    return usbscan_present(port, vid, pids, n);
+  }
+
+  if (pgm->conntype != CONNTYPE_SERIAL || strncmp(port, "net:", 4) == 0 ||
+      sim_port(port) || replay_port(port))
+    return -1;
+
+  return stat(port, &sb) == 0;
+}
+
+#endif
+
+/*
+ * Continuous mode: program one board after the other at port, with
+ * the configuration parsed and the input files read only once.  For
+ * every board that arrives, a process is started which returns from
+ * here and goes on like a single-device run.  The parent logs the
+ * outcome and timing, waits for the board to go away and then for the
+ * next one; it only ends when interrupted.
+ */
+static void board_loop(PROGRAMMER * pgm, struct avrpart * p,
+                       const char * port)
+{
+#if !defined(WIN32NATIVE)
+  struct timeval start, end;
+  int n, ok, failed, status;
+  pid_t pid;
+  char * name;
+
+  if (board_present(pgm, p, port) < 0) {
+    fprintf(stderr,
+            "%s: continuous mode cannot watch port \"%s\" for boards\n",
+            progname, port);
+    fprintf(stderr,
+            "%sIt needs a serial port that comes and goes with the board, or\n"
+            "%sa USB port with usbvid/usbpid known, and libusb support\n",
+            progbuf, progbuf);
+    exit(1);
+  }
+
+  for (n = 1, ok = failed = 0; ; n++) {
+    if (quell_progress < 2)
+      fprintf(stderr, "\n%s: waiting for board %d on %s\n",
+              progname, n, port);
+    while (board_present(pgm, p, port) == 0)
+      usleep(BOARD_POLL);
+    /* let the system finish setting up the new device */
+    usleep(BOARD_SETTLE);
+
+    fflush(stdout);
+    fflush(stderr);
+    gettimeofday(&start, NULL);
+    pid = fork();
+    if (pid == 0) {
+      name = malloc(strlen(progname) + 16);
+      if (name == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+      sprintf(name, "%s[%d]", progname, n);
+      progname_set(name);
+      pgm->fresh_device = 1;
+      return;
+    }
+    if (pid < 0) {
+      fprintf(stderr, "%s: cannot start process for board %d: %s\n",
+              progname, n, strerror(errno));
+      exit(1);
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    gettimeofday(&end, NULL);
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      ok++;
+    else
+      failed++;
+    fprintf(stderr, "%s: board %d %s %.2fs (%d OK, %d failed)\n",
+            progname, n, WIFEXITED(status) && WEXITSTATUS(status) == 0?
+            "OK": "FAILED",
+            (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6,
+            ok, failed);
+
+    if (quell_progress < 2)
+      fprintf(stderr, "%s: remove board %d\n", progname, n);
+    while (board_present(pgm, p, port) > 0)
+      usleep(BOARD_POLL);
+  }
+#else
+  fprintf(stderr, "%s: continuous mode is not supported on this platform\n",
+          progname);
+  exit(1);
+#endif
+}
+
+#if !defined(WIN32NATIVE)
+
+/* a programmer of the pool, and where its boards are put */
+struct pool_worker {
+  char * port;
+  PROGRAMMER * pgm;     /* its configuration entry */
+  const char * id;
+  enum { POOL_WAIT, POOL_BUSY, POOL_REMOVE } state;
+  pid_t pid;
+  int board;            /* the one it works on */
+  struct timeval start;
+  int ok, failed;
+  double busy;          /* seconds spent on the good boards */
+  double expect;        /* seconds per board, 0 while not known */
+};
+
+/*
+ * The waiting worker the next board is best given to: one that has
+ * not been timed yet, so that it will be, else the fastest.
+ */
+static int pool_pick(struct pool_worker * w, int n)
+{
+  int i, best = -1;
+
+  for (i = 0; i < n; i++) {
+    if (w[i].state != POOL_WAIT)
+      continue;
+    if (w[i].expect == 0)
+      return i;
+    if (best < 0 || w[i].expect < w[best].expect)
+      best = i;
+  }
+  return best;
+}
+
+#endif
+
+/*
+ * Continuous mode with several ports: a pool of workers, each a
+ * programmer with its own port, given as <programmer>@<port> or just
+ * <port> for the -c one.  The boards are jobs, numbered as they
+ * arrive; whichever worker has a board put on its port and is free
+ * takes it, in a process of its own which returns from here with the
+ * port (and in *pgmid the programmer, if not the -c one), and goes on
+ * like a single-device run.  So a slow programmer only ever holds up
+ * its own board.  The parent keeps the time per good board of each
+ * worker, which also goes into the pool cache for the next run, and
+ * names the fastest free worker for the next board.  It only ends
+ * when interrupted.
+ */
+static char * board_pool(PROGRAMMER * pgm, struct avrpart * p, LISTID ports,
+                         const char ** pgmid)
+{
+#if !defined(WIN32NATIVE)
+  struct pool_worker * w, * wk;
+  struct timeval end;
+  LNODEID ln;
+  int i, n, next, announced, status, good;
+  pid_t pid;
+  char * s, * at, * name;
+  double secs;
+
+  n = lsize(ports);
+  w = calloc(n, sizeof(*w));
+  if (w == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  for (ln=lfirst(ports), i=0; ln; ln=lnext(ln), i++) {
+    wk = &w[i];
+    if ((s = strdup(ldata(ln))) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    wk->pgm = pgm;
+    wk->port = s;
+    if ((at = strchr(s, '@')) != NULL) {
+      *at = 0;
+      wk->port = at + 1;
+      wk->pgm = locate_programmer(programmers, s);
+      if (wk->pgm == NULL) {
+        fprintf(stderr, "%s: Can't find programmer id \"%s\" of port %s\n",
+                progname, s, wk->port);
+        exit(1);
+      }
+    }
+    wk->id = ldata(lfirst(wk->pgm->id));
+    if (board_present(wk->pgm, p, wk->port) < 0) {
+      fprintf(stderr,
+              "%s: continuous mode cannot watch port \"%s\" for boards\n",
+              progname, wk->port);
+      fprintf(stderr,
+              "%sIt needs a serial port that comes and goes with the board, or\n"
+              "%sa USB port with usbvid/usbpid known, and libusb support\n",
+              progbuf, progbuf);
+      exit(1);
+    }
+    wk->expect = pool_lookup(wk->id, p->id);
+  }
+
+  fprintf(stderr, "\n%s: pool of %d programmers for %s:\n",
+          progname, n, p->desc);
+  for (i = 0; i < n; i++) {
+    fprintf(stderr, "%s%-24s %-16s ", progbuf, w[i].port, w[i].id);
+    if (w[i].expect > 0)
+      fprintf(stderr, "%.2fs per board\n", w[i].expect);
+    else
+      fprintf(stderr, "not timed yet\n");
+  }
+
+  for (next = 1, announced = 0; ; ) {
+    /* boards done */
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (i = 0; i < n && w[i].pid != pid; i++)
+        ;
+      if (i == n)
+        continue;
+      wk = &w[i];
+      gettimeofday(&end, NULL);
+      secs = (end.tv_sec - wk->start.tv_sec) +
+        (end.tv_usec - wk->start.tv_usec) / 1e6;
+      good = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      if (good) {
+        wk->ok++;
+        wk->busy += secs;
+        wk->expect = wk->busy / wk->ok;
+        pool_remember(wk->id, p->id, secs);
+      } else
+        wk->failed++;
+      fprintf(stderr, "%s: board %d on %s %s %.2fs "
+              "(%d OK, %d failed, %.2fs per board)\n",
+              progname, wk->board, wk->port, good? "OK": "FAILED", secs,
+              wk->ok, wk->failed, wk->expect);
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: remove board %d from %s\n",
+                progname, wk->board, wk->port);
+      wk->pid = 0;
+      wk->state = POOL_REMOVE;
+    }
+
+    for (i = 0; i < n; i++) {
+      wk = &w[i];
+      /* boards taken away */
+      if (wk->state == POOL_REMOVE && board_present(wk->pgm, p, wk->port) == 0) {
+        wk->state = POOL_WAIT;
+        announced = 0;
+      }
+      /* boards put on */
+      if (wk->state != POOL_WAIT || board_present(wk->pgm, p, wk->port) <= 0)
+        continue;
+      /* let the system finish setting up the new device */
+      usleep(BOARD_SETTLE);
+
+      fflush(stdout);
+      fflush(stderr);
+      wk->board = next;
+      gettimeofday(&wk->start, NULL);
+      pid = fork();
+      if (pid == 0) {
+        name = malloc(strlen(progname) + 16);
+        if (name == NULL) {
+          fprintf(stderr, "%s: out of memory\n", progname);
+          exit(1);
+        }
+        sprintf(name, "%s[%d]", progname, next);
+        progname_set(name);
+        *pgmid = wk->pgm != pgm? wk->id: NULL;
+        return wk->port;
+      }
+      if (pid < 0) {
+        fprintf(stderr, "%s: cannot start process for board %d: %s\n",
+                progname, next, strerror(errno));
+        exit(1);
+      }
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: board %d on %s (%s)\n",
+                progname, next, wk->port, wk->id);
+      wk->pid = pid;
+      wk->state = POOL_BUSY;
+      next++;
+      announced = 0;
+    }
+
+    /* where the next board goes best */
+    if (!announced && quell_progress < 2 && (i = pool_pick(w, n)) >= 0) {
+      fprintf(stderr, "\n%s: waiting for board %d, best on %s (%s)\n",
+              progname, next, w[i].port, w[i].id);
+      announced = 1;
+    }
+
+    usleep(BOARD_POLL);
+  }
+#else
+  fprintf(stderr, "%s: continuous mode is not supported on this platform\n",
+          progname);
+  exit(1);
+#endif
+}
+
+/*
+ * Fill in the device-dependent default region name of the -U options
+ * that use the default memory region, either "application" (for
+ * Xmega devices), or "flash" (everything else).
+ */
+static void update_default_memtype(struct avrpart * p, LISTID updates)
+{
+  LNODEID ln;
+  UPDATE * upd;
+
+  for (ln=lfirst(updates); ln; ln=lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->memtype == NULL) {
+      const char *mtype = (p->flags & AVRPART_HAS_PDI)? "application": "flash";
+      if (verbose >= 2) {
+        fprintf(stderr,
+                "%s: defaulting memtype in -U %c:%s option to \"%s\"\n",
+                progname,
+                (upd->op == DEVICE_READ)? 'r': (upd->op == DEVICE_WRITE)? 'w': 'v',
+                upd->filename, mtype);
+      }
+      if ((upd->memtype = strdup(mtype)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+    }
+  }
+}
+
+/*
+ * Whether the device holds fingerprint fp at addr of memory memtype,
+ * reading only the pages (or bytes) it is in.
+ */
+static int fingerprint_found(PROGRAMMER * pgm, struct avrpart * p,
+                             const char * memtype, unsigned long addr,
+                             const unsigned char * fp)
+{
+  AVRMEM * mem, * vmem;
+  int rc;
+
+  mem = avr_locate_mem(p, (char *)memtype);
+  vmem = avr_dup_mem(mem);
+  avr_mem_untag(vmem, 0, vmem->size);
+  avr_mem_tag(vmem, addr, UPDATE_FPLEN);
+  if (quell_progress < 2)
+    fprintf(stderr, "%s: reading the fingerprint in %s:\n",
+            progname, mem->desc);
+  report_progress(0, 1, "Reading");
+  rc = avr_read_mem(pgm, p, mem, vmem);
+  report_progress(1, 1, NULL);
+  avr_free_mem(vmem);
+  if (rc < 0) {
+    fprintf(stderr, "%s: can't read the fingerprint, writing anyway\n",
+            progname);
+    return 0;
+  }
+
+  return memcmp(mem->buf + addr, fp, UPDATE_FPLEN) == 0;
+}
+
+/*
+ * -p auto: the part to talk to the device with until its signature
+ * is known, the first one of the configuration that is programmed
+ * through the classic serial interface.
+ */
+static struct avrpart * autodetect_bootstrap(LISTID parts)
+{
+  LNODEID ln;
+  struct avrpart * p;
+  AVRMEM * sig;
+
+  for (ln=lfirst(parts); ln; ln=lnext(ln)) {
+    p = ldata(ln);
+    if (p->id[0] == '.' || !(p->flags & AVRPART_SERIALOK) ||
+        (p->flags & (AVRPART_HAS_PDI | AVRPART_HAS_TPI | AVRPART_AVR32 |
+                     AVRPART_IS_AT90S1200)))
+      continue;
+    avr_part_complete(p);
+    if (p->op[AVR_OP_PGM_ENABLE] == NULL ||
+        (sig = avr_locate_mem(p, "signature")) == NULL ||
+        sig->op[AVR_OP_READ] == NULL)
+      continue;
+    return p;
+  }
+
+  return NULL;
+}
+
+/*
+ * -p auto: read the signature through part p, and find the part it
+ * belongs to.  A device that has not woken up yet answers all ones
+ * or zeros, so give it a few tries like the signature check does.
+ */
+static struct avrpart * autodetect_part(PROGRAMMER * pgm, struct avrpart * p,
+                                        LISTID parts)
+{
+  struct avrpart * np;
+  AVRMEM * sig;
+  int attempt;
+  int waittime = 10000;       /* 10 ms */
+
+  for (attempt = 0; attempt < 3; attempt++, waittime *= 5) {
+    usleep(waittime);
+    if (avr_signature(pgm, p) != 0 ||
+        (sig = avr_locate_mem(p, "signature")) == NULL || sig->size < 3) {
+      fprintf(stderr, "%s: error reading signature data\n", progname);
+      return NULL;
+    }
+    if ((np = locate_part_by_signature(parts, sig->buf, sig->size)) != NULL)
+      return np;
+  }
+  fprintf(stderr,
+          "%s: no part with device signature 0x%02x%02x%02x in the "
+          "configuration\n",
+          progname, sig->buf[0], sig->buf[1], sig->buf[2]);
+
+  return NULL;
+}
+
 /*
  * main routine
  */
@@ -313,18 +1013,33 @@ int main(int argc, char * argv [])
 
   /* options / operating mode variables */
   int     erase;       /* 1=erase chip, 0=don't */
+  int     delta;       /* 1=a write is of a delta file, 0=none */
   int     calibrate;   /* 1=calibrate RC oscillator, 0=don't */
   char  * port;        /* device port (/dev/xxx) */
   int     terminal;    /* 1=enter terminal mode, 0=don't */
+  char  * batchfile;   /* terminal mode commands to run, NULL=interactive */
+  char  * serversock;  /* socket to serve operations on, NULL=don't */
+  int     continuous;  /* 1=program boards as they arrive, 0=just one */
+  char  * statsfile;   /* file for the transfer statistics, NULL=none */
+  char  * tracefile;   /* file for the wire-level trace, NULL=none */
+  char  * estimatefile; /* statistics to estimate the time from, NULL=none */
+  char  * fpmemtype;   /* memory to keep the fingerprint in, NULL=none */
+  unsigned long fpaddr; /* address of the fingerprint in it */
+  unsigned char fp[UPDATE_FPLEN]; /* the fingerprint of the writes */
   int     verify;      /* perform a verify operation */
   char  * exitspecs;   /* exit specs string from command line */
   char  * programmer;  /* programmer id */
   char  * partdesc;    /* part id */
+  int     autopart;    /* -p auto: find the part by its signature */
   char    sys_config[PATH_MAX]; /* system wide config file */
+  int     sys_config_given; /* -C named the system wide config file */
   char    usr_config[PATH_MAX]; /* per-user config file */
+  char    cache_file[PATH_MAX]; /* parsed system config cache */
+  char    cache_path[PATH_MAX]; /* of the caches the modules keep */
   char  * e;           /* for strtol() error checking */
   int     baudrate;    /* override default programmer baud rate */
   double  bitclock;    /* Specify programmer bit clock (JTAG ICE) */
+  int     scktuning;   /* -B auto: find the bit clock */
   int     ispdelay;    /* Specify the delay for ISP clock */
   int     safemode;    /* Enable safemode, 1=safemode on, 0=normal */
   int     silentsafe;  /* Don't ask about fuses, 1=silent, 0=normal */
@@ -332,6 +1047,7 @@ int main(int argc, char * argv [])
   int     is_open;     /* Device open succeeded */
   char  * logfile;     /* Use logfile rather than stderr for diagnostics */
   enum updateflags uflags = UF_AUTO_ERASE; /* Flags for do_op() */
+  enum updateflags serverflags;            /* Flags for server_mode() */
   unsigned char safemode_lfuse = 0xff;
   unsigned char safemode_hfuse = 0xff;
   unsigned char safemode_efuse = 0xff;
@@ -390,13 +1106,29 @@ int main(int argc, char * argv [])
     exit(1);
   }
 
+  ports = lcreat(NULL, 0);
+  if (ports == NULL) {
+    fprintf(stderr, "%s: cannot initialize port list\n", progname);
+    exit(1);
+  }
+
   partdesc      = NULL;
+  sys_config_given = 0;
+  autopart      = 0;
   port          = NULL;
   erase         = 0;
   calibrate     = 0;
   p             = NULL;
   ovsigck       = 0;
   terminal      = 0;
+  batchfile     = NULL;
+  serversock    = NULL;
+  continuous    = 0;
+  statsfile     = NULL;
+  estimatefile  = NULL;
+  tracefile     = NULL;
+  fpmemtype     = NULL;
+  fpaddr        = 0;
   verify        = 1;        /* on by default */
   quell_progress = 0;
   exitspecs     = NULL;
@@ -405,6 +1137,7 @@ int main(int argc, char * argv [])
   verbose       = 0;
   baudrate      = 0;
   bitclock      = 0.0;
+  scktuning     = 0;
   ispdelay      = 0;
   safemode      = 1;       /* Safemode on by default */
   silentsafe    = 0;       /* Ask by default */
@@ -415,6 +1148,7 @@ int main(int argc, char * argv [])
 
   win_sys_config_set(sys_config);
   win_usr_config_set(usr_config);
+  cache_file[0] = 0;
 
 #else
 
@@ -434,6 +1168,20 @@ int main(int argc, char * argv [])
     strcat(usr_config, ".avrduderc");
   }
 
+  cachefile_path(cache_file, sizeof(cache_file), "config");
+  cachefile_path(cache_path, sizeof(cache_path), "usb");
+  usbscan_cache(cache_path);
+  cachefile_path(cache_path, sizeof(cache_path), "sum");
+  memsum_cache(cache_path);
+  cachefile_path(cache_path, sizeof(cache_path), "sck");
+  scktune_cache(cache_path);
+  cachefile_path(cache_path, sizeof(cache_path), "stk");
+  stk500generic_cache(cache_path);
+  cachefile_path(cache_path, sizeof(cache_path), "jtag");
+  jtagmkII_cache(cache_path);
+  cachefile_path(cache_path, sizeof(cache_path), "pool");
+  pool_cache(cache_path);
+
 #endif
 
   len = strlen(progname) + 2;
@@ -453,7 +1201,7 @@ int main(int argc, char * argv [])
   /*
    * process command line arguments
    */
-  while ((ch = getopt(argc,argv,"?b:B:c:C:DeE:Fi:l:np:OP:qstU:uvVx:yY:")) != -1) {
+  while ((ch = getopt(argc,argv,"?b:B:c:C:DeE:FH:i:j:J:k:K:l:Lnp:OP:qsS:tT:U:uvVwWx:yY:z")) != -1) {
 
     switch (ch) {
       case 'b': /* override default programmer baud rate */
@@ -466,6 +1214,10 @@ int main(int argc, char * argv [])
         break;
 
       case 'B':	/* specify JTAG ICE bit clock period */
+	if (strcmp(optarg, "auto") == 0) {
+	  scktuning = 1;
+	  break;
+	}
 	bitclock = strtod(optarg, &e);
 	if ((e == optarg) || (*e != 0) || bitclock == 0.0) {
 	  fprintf(stderr, "%s: invalid bit clock period specified '%s'\n",
@@ -493,6 +1245,7 @@ int main(int argc, char * argv [])
         } else {
           strncpy(sys_config, optarg, PATH_MAX);
           sys_config[PATH_MAX-1] = 0;
+          sys_config_given = 1;
         }
         break;
 
@@ -513,6 +1266,34 @@ int main(int argc, char * argv [])
         ovsigck = 1;
         break;
 
+      case 'H': /* keep a fingerprint of the writes */
+        if ((fpmemtype = strdup(optarg)) == NULL) {
+          fprintf(stderr, "%s: out of memory\n", progname);
+          exit(1);
+        }
+        e = strrchr(fpmemtype, ':');
+        if (e == NULL || e == fpmemtype || e[1] == 0) {
+          fprintf(stderr, "%s: invalid fingerprint location \"%s\", "
+                  "expected <memtype>:<address>\n", progname, optarg);
+          exit(1);
+        }
+        *e++ = 0;
+        fpaddr = strtoul(e, &e, 0);
+        if (*e != 0) {
+          fprintf(stderr, "%s: invalid fingerprint location \"%s\"\n",
+                  progname, optarg);
+          exit(1);
+        }
+        break;
+
+      case 'K':
+        imgcache_set_dir(optarg);
+        break;
+
+      case 'L': /* low-latency serial port settings */
+        serial_low_latency = 1;
+        break;
+
       case 'l':
 	logfile = optarg;
 	break;
@@ -531,6 +1312,7 @@ int main(int argc, char * argv [])
 
       case 'P':
         port = optarg;
+        ladd(ports, optarg);
         break;
 
       case 'q' : /* Quell progress output */
@@ -542,10 +1324,32 @@ int main(int argc, char * argv [])
         safemode = 1;
         break;
         
+      case 'J': /* write transfer statistics */
+        statsfile = optarg;
+        stats_enable();
+        break;
+
+      case 'j': /* write a wire-level trace */
+        tracefile = optarg;
+        break;
+
+      case 'k': /* estimate the programming time */
+        estimatefile = optarg;
+        break;
+
+      case 'S': /* serve operations on a local socket */
+        serversock = optarg;
+        break;
+
       case 't': /* enter terminal mode */
         terminal = 1;
         break;
 
+      case 'T': /* run terminal mode commands from a file */
+        terminal = 1;
+        batchfile = optarg;
+        break;
+
       case 'u' : /* Disable safemode */
         safemode = 0;
         break;
@@ -574,6 +1378,10 @@ int main(int argc, char * argv [])
         verify = 0;
         break;
 
+      case 'w': /* continuous mode */
+        continuous = 1;
+        break;
+
       case 'x':
         ladd(extended_params, optarg);
         break;
@@ -583,6 +1391,14 @@ int main(int argc, char * argv [])
                 progname);
         break;
 
+      case 'z': /* stop flash reads at the blank remainder */
+        read_stop_blank = 1;
+        break;
+
+      case 'W': /* leave out EEPROM pages that hold the data already */
+        eeprom_skip_same = 1;
+        break;
+
       case 'Y':
         fprintf(stderr, "%s: erase cycle counter no longer supported\n",
                 progname);
@@ -612,6 +1428,9 @@ int main(int argc, char * argv [])
     }
   }
 
+  if (tracefile != NULL && trace_open(tracefile) < 0)
+    exit(1);
+
   if (quell_progress == 0) {
     if (isatty (STDERR_FILENO))
       update_progress = update_progress_tty;
@@ -637,12 +1456,28 @@ int main(int argc, char * argv [])
             progname, version, __DATE__, __TIME__, progbuf, progbuf);
   }
 
-  if (verbose) {
-    fprintf(stderr, "%sSystem wide configuration file is \"%s\"\n",
-            progbuf, sys_config);
-  }
+  /* with a configuration built in, -C still reads a file instead */
+  if (builtin_config_size > 0 && !sys_config_given) {
+    if (verbose) {
+      fprintf(stderr, "%sSystem wide configuration is built in\n", progbuf);
+    }
+    if (read_config_image(builtin_config, builtin_config_size) != 0) {
+      fprintf(stderr,
+              "%s: error reading the built-in configuration\n", progname);
+      exit(1);
+    }
+    rc = 0;
+  } else {
+    if (verbose) {
+      fprintf(stderr, "%sSystem wide configuration file is \"%s\"\n",
+              progbuf, sys_config);
+    }
 
-  rc = read_config(sys_config);
+    if (cache_file[0] != 0)
+      rc = read_config_cached(sys_config, cache_file);
+    else
+      rc = read_config(sys_config);
+  }
   if (rc) {
     fprintf(stderr,
             "%s: error reading system wide configuration file \"%s\"\n",
@@ -733,6 +1568,9 @@ int main(int argc, char * argv [])
   }
 
 
+  index_programmers(programmers);
+  index_avrparts(part_list);
+
   if (programmer[0] == 0) {
     fprintf(stderr,
             "\n%s: no programmer has been specified on the command line "
@@ -744,49 +1582,7 @@ int main(int argc, char * argv [])
     exit(1);
   }
 
-  pgm = locate_programmer(programmers, programmer);
-  if (pgm == NULL) {
-    fprintf(stderr,"\n");
-    fprintf(stderr,
-            "%s: Can't find programmer id \"%s\"\n",
-            progname, programmer);
-    fprintf(stderr,"\nValid programmers are:\n");
-    list_programmers(stderr, "  ", programmers);
-    fprintf(stderr,"\n");
-    exit(1);
-  }
-
-  if (pgm->initpgm) {
-    pgm->initpgm(pgm);
-  } else {
-    fprintf(stderr,
-            "\n%s: Can't initialize the programmer.\n\n",
-            progname);
-    exit(1);
-  }
-
-  if (pgm->setup) {
-    pgm->setup(pgm);
-  }
-  if (pgm->teardown) {
-    atexit(exithook);
-  }
-
-  if (lsize(extended_params) > 0) {
-    if (pgm->parseextparams == NULL) {
-      fprintf(stderr,
-              "%s: WARNING: Programmer doesn't support extended parameters,"
-              " -x option(s) ignored\n",
-              progname);
-    } else {
-      if (pgm->parseextparams(pgm, extended_params) < 0) {
-        fprintf(stderr,
-              "%s: Error parsing extended parameter list\n",
-              progname);
-        exit(1);
-      }
-    }
-  }
+  pgm = programmer_prepare(programmer);
 
   if (port == NULL) {
     switch (pgm->conntype)
@@ -816,7 +1612,24 @@ int main(int argc, char * argv [])
   }
 
 
-  p = locate_part(part_list, partdesc);
+  if (strcasecmp(partdesc, "auto") == 0) {
+    if (lsize(ports) > 1 || continuous || estimatefile != NULL) {
+      fprintf(stderr,
+              "%s: -p auto needs a single -P port, and neither continuous "
+              "mode nor -k\n",
+              progname);
+      exit(1);
+    }
+    autopart = 1;
+    p = autodetect_bootstrap(part_list);
+    if (p == NULL) {
+      fprintf(stderr,
+              "%s: no part in the configuration to detect others with\n",
+              progname);
+      exit(1);
+    }
+  } else
+    p = locate_part(part_list, partdesc);
   if (p == NULL) {
     fprintf(stderr,
             "%s: AVR Part \"%s\" not found.\n\n",
@@ -873,26 +1686,79 @@ int main(int argc, char * argv [])
 
   /*
    * Now that we know which part we are going to program, locate any
-   * -U options using the default memory region, and fill in the
-   * device-dependent default region name, either "application" (for
-   * Xmega devices), or "flash" (everything else).
+   * -U options using the default memory region.  With -p auto, that
+   * is only once the device has told.
    */
-  for (ln=lfirst(updates); ln; ln=lnext(ln)) {
-    upd = ldata(ln);
-    if (upd->memtype == NULL) {
-      const char *mtype = (p->flags & AVRPART_HAS_PDI)? "application": "flash";
-      if (verbose >= 2) {
+  if (!autopart) {
+    update_default_memtype(p, updates);
+    if (update_merge_writes(p, updates) < 0)
+      exit(1);
+  }
+
+  if (estimatefile != NULL) {
+    /* a dry run: the device is not even looked at */
+    if (baudrate != 0)
+      pgm->baudrate = baudrate;
+    if (stats_read(estimatefile) < 0 ||
+        update_estimate(pgm, p, updates, uflags, erase) < 0)
+      exit(1);
+    exit(0);
+  }
+
+  if (lsize(ports) > 1) {
+    /*
+     * gang mode: read the input files only once, then fork one
+     * process per port, or per board for a pool in continuous mode
+     */
+    if (terminal || calibrate || serversock != NULL) {
+      fprintf(stderr,
+              "%s: terminal mode, server mode and calibration need a single -P port\n",
+              progname);
+      exit(1);
+    }
+    for (ln=lfirst(extended_params); ln; ln=lnext(ln)) {
+      /* one key for all the devices would mix up their entries */
+      if (strncmp(ldata(ln), "manifest_key=", strlen("manifest_key=")) == 0) {
         fprintf(stderr,
-                "%s: defaulting memtype in -U %c:%s option to \"%s\"\n",
-                progname,
-                (upd->op == DEVICE_READ)? 'r': (upd->op == DEVICE_WRITE)? 'w': 'v',
-                upd->filename, mtype);
+                "%s: -x %s names a single device, it needs a single -P port\n",
+                progname, (char *)ldata(ln));
+        exit(1);
       }
-      if ((upd->memtype = strdup(mtype)) == NULL) {
-        fprintf(stderr, "%s: out of memory\n", progname);
+    }
+    for (ln=lfirst(updates); ln; ln=lnext(ln)) {
+      upd = ldata(ln);
+      /* every device would write the same output file */
+      if (upd->op == DEVICE_READ) {
+        fprintf(stderr,
+                "%s: reading %s into \"%s\" needs a single -P port\n",
+                progname, upd->memtype, upd->filename);
         exit(1);
       }
+      if (update_preload(p, upd) < 0)
+        exit(1);
     }
+    /* the devices can neither share a progress bar nor ask questions */
+    update_progress = NULL;
+    silentsafe = 1;
+    if (continuous) {
+      const char * pgmid;
+
+      port = board_pool(pgm, p, ports, &pgmid);
+      continuous = 0;
+      if (pgmid != NULL) {
+        /* a worker with a programmer of its own */
+        programmer = (char *)pgmid;
+        pgm = programmer_prepare(programmer);
+        if (exitspecs != NULL && (pgm->parseexitspecs == NULL ||
+                                  pgm->parseexitspecs(pgm, exitspecs) < 0)) {
+          fprintf(stderr,
+                  "%s: WARNING: -E option not supported by programmer %s\n",
+                  progname, programmer);
+        }
+      }
+      pgm->fresh_device = 1;
+    } else
+      port = gang_fork(ports);
   }
 
   /*
@@ -907,6 +1773,26 @@ int main(int argc, char * argv [])
     exit(1);
   }
 
+  if (continuous) {
+    /*
+     * continuous mode: read the input files only once, then start one
+     * process per board
+     */
+    if (terminal || calibrate || serversock != NULL) {
+      fprintf(stderr,
+              "%s: continuous mode cannot be combined with terminal mode, "
+              "server mode or calibration\n",
+              progname);
+      exit(1);
+    }
+    for (ln=lfirst(updates); ln; ln=lnext(ln)) {
+      upd = ldata(ln);
+      if (update_preload(p, upd) < 0)
+        exit(1);
+    }
+    board_loop(pgm, p, port);
+  }
+
   if (verbose) {
     fprintf(stderr, "%sUsing Port                    : %s\n", progbuf, port);
     fprintf(stderr, "%sUsing Programmer              : %s\n", progbuf, programmer);
@@ -938,6 +1824,15 @@ int main(int argc, char * argv [])
     pgm->ispdelay = ispdelay;
   }
 
+  if (sim_port(port) && sim_attach(pgm, p) < 0)
+    exit(1);
+  if (replay_port(port) && replay_attach(pgm) < 0)
+    exit(1);
+
+  /* read the input files while the programmer and the device start up */
+  if (!calibrate && !autopart)
+    update_prefetch(p, updates);
+
   rc = pgm->open(pgm, port);
   if (rc < 0) {
     exitrc = 1;
@@ -946,6 +1841,13 @@ int main(int argc, char * argv [])
   }
   is_open = 1;
 
+  if (replay_port(port) && !replay_active()) {
+    fprintf(stderr, "%s: programmer type \"%s\" cannot be replayed\n",
+            progname, pgm->type);
+    exitrc = 1;
+    goto main_exit;
+  }
+
   if (calibrate) {
     /*
      * perform an RC oscillator calibration
@@ -1009,6 +1911,46 @@ int main(int argc, char * argv [])
     }
   }
 
+  if (init_ok && scktuning && scktune(pgm, p, port) < 0) {
+    exitrc = 1;
+    goto main_exit;
+  }
+
+  if (autopart) {
+    struct avrpart * np;
+
+    if (!init_ok || (np = autodetect_part(pgm, p, part_list)) == NULL) {
+      fprintf(stderr, "%s: cannot detect the AVR part\n", progname);
+      exitrc = 1;
+      goto main_exit;
+    }
+    if (quell_progress < 2)
+      fprintf(stderr, "%s: Detected AVR part %s\n", progname, np->desc);
+    if (np != p) {
+      p = np;
+      if (avr_initmem(p) != 0) {
+        fprintf(stderr, "\n%s: failed to initialize memories\n",
+                progname);
+        exit(1);
+      }
+      if (p->flags & (AVRPART_AVR32 | AVRPART_HAS_PDI | AVRPART_HAS_TPI))
+        safemode = 0;
+      /* enter programming mode again, with the parameters of this part */
+      pgm->disable(pgm);
+      pgm->enable(pgm);
+      if ((rc = pgm->initialize(pgm, p)) < 0) {
+        fprintf(stderr, "%s: initialization failed, rc=%d\n", progname, rc);
+        exitrc = 1;
+        goto main_exit;
+      }
+    }
+    update_default_memtype(p, updates);
+    if (update_merge_writes(p, updates) < 0) {
+      exitrc = 1;
+      goto main_exit;
+    }
+  }
+
   /* indicate ready */
   pgm->rdy_led(pgm, ON);
 
@@ -1066,6 +2008,7 @@ int main(int argc, char * argv [])
       if (ff || zz) {
         if (++attempt < 3) {
           waittime *= 5;
+          avr_mem_cache_invalidate(sig, 0, sig->size);
           if (quell_progress < 2) {
               fprintf(stderr, " (retrying)\n");
           }
@@ -1143,8 +2086,72 @@ int main(int argc, char * argv [])
     }
   }
 
+  /* server mode decides about erasing per operation */
+  serverflags = uflags;
+
+  /*
+   * -H: if the device holds the fingerprint of the writes, they are
+   * done already; else have it written after them
+   */
+  if (fpmemtype != NULL && !(uflags & UF_NOWRITE)) {
+    rc = update_fingerprint(p, updates, fpmemtype, fpaddr, fp);
+    if (rc < 0) {
+      exitrc = 1;
+      goto main_exit;
+    }
+    if (rc > 0 && !erase && fingerprint_found(pgm, p, fpmemtype, fpaddr, fp)) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: the fingerprint in %s matches, "
+                "the device holds what is to be written\n",
+                progname, fpmemtype);
+      uflags = (uflags & ~UF_AUTO_ERASE) | UF_UNCHANGED;
+    } else if (rc > 0 &&
+               update_fingerprint_add(p, updates, fpmemtype, fpaddr, fp) < 0) {
+      exitrc = 1;
+      goto main_exit;
+    }
+  }
+
+  /*
+   * A delta write relies on the pages it does not change: no chip
+   * erase then, only the page erases of Xmega devices, or those of a
+   * bootloader as it writes each page; without either, the changed
+   * pages could not be written.
+   */
+  delta = !(uflags & UF_NOWRITE) && update_has_delta(updates);
+  if (delta && erase) {
+    fprintf(stderr, "%s: a chip erase would lose what the delta write "
+            "leaves alone, don't use -e\n", progname);
+    exitrc = 1;
+    goto main_exit;
+  }
+  if (delta && !((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL)) {
+    if (!pgm->page_write_erases) {
+      fprintf(stderr, "%s: a delta write needs a programmer that erases "
+              "each page it writes,\n"
+              "%swhich the %s programmer does not\n",
+              progname, progbuf, pgm->type);
+      exitrc = 1;
+      goto main_exit;
+    }
+    uflags &= ~UF_AUTO_ERASE;
+  }
+
   if (uflags & UF_AUTO_ERASE) {
     if ((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL &&
+        lsize(updates) > 0 && !(uflags & UF_NOWRITE) && !delta &&
+        update_plan_chip_erase(p, updates)) {
+      /* the pages to write are more than a chip erase costs */
+      uflags &= ~UF_AUTO_ERASE;
+      erase = 1;
+      if (quell_progress < 2) {
+        fprintf(stderr,
+                "%s: NOTE: erasing the chip takes less time than erasing each page\n"
+                "%sto be written, a chip erase will be performed.\n"
+                "%sTo disable erasing, specify the -D option.\n",
+                progname, progbuf, progbuf);
+      }
+    } else if ((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL &&
         lsize(updates) > 0) {
       if (quell_progress < 2) {
         fprintf(stderr,
@@ -1200,7 +2207,10 @@ int main(int argc, char * argv [])
     /*
      * terminal mode
      */
-    exitrc = terminal_mode(pgm, p);
+    if (batchfile != NULL)
+      exitrc = terminal_batch(pgm, p, batchfile) < 0? 1: 0;
+    else
+      exitrc = terminal_mode(pgm, p);
   }
 
   if (!init_ok) {
@@ -1212,6 +2222,10 @@ int main(int argc, char * argv [])
   }
 
 
+  for (ln=lfirst(updates); ln; ln=lnext(ln))
+    if (((UPDATE *)ldata(ln))->op == DEVICE_VERIFY)
+      uflags |= UF_VERIFY;
+
   for (ln=lfirst(updates); ln; ln=lnext(ln)) {
     upd = ldata(ln);
     rc = do_op(pgm, p, upd, uflags);
@@ -1221,9 +2235,22 @@ int main(int argc, char * argv [])
     }
   }
 
+  if (serversock != NULL && exitrc == 0) {
+    /*
+     * server mode
+     */
+    if (server_mode(pgm, p, serversock, serverflags) < 0)
+      exitrc = 1;
+  }
+
   /* Right before we exit programming mode, which will make the fuse
-     bits active, check to make sure they are still correct */
-  if (safemode == 1) {
+     bits active, check to make sure they are still correct; unless
+     nothing in this session has written any */
+  if (safemode == 1 && !avr_fuses_written()) {
+    if (quell_progress < 2)
+      fprintf(stderr, "\n%s: safemode: Fuses not written (E:%02X, H:%02X, L:%02X)\n",
+              progname, safemode_efuse, safemode_hfuse, safemode_lfuse);
+  } else if (safemode == 1) {
     /* If safemode is enabled, go ahead and read the current low,
      * high, and extended fuse bytes as needed */
     unsigned char safemodeafter_lfuse = 0xff;
@@ -1394,6 +2421,11 @@ main_exit:
 
     pgm->close(pgm);
   }
+  update_prefetch_end();
+
+  if (statsfile != NULL && stats_write(statsfile) < 0)
+    exitrc = 1;
+  trace_close();
 
   if (quell_progress < 2) {
     fprintf(stderr, "\n%s done.  Thank you.\n\n", progname);
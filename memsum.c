@@ -0,0 +1,160 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Verifying a memory by a checksum the programmer or the target
+ * computes, instead of reading it back.
+ *
+ * A CRC over a range of a memory that the backend can compute on the
+ * host as well is compared by the backend itself.  How a checksum
+ * over a whole memory is computed differs between devices and is not
+ * always documented, so that one is never computed here.  Instead, the
+ * checksum a device gave for a memory that was then verified by
+ * readback is kept in a small file, keyed by part, memory and a hash
+ * of the contents and of which bytes of them are allocated.  The next
+ * device programmed with the same image giving the same checksum holds
+ * the same contents; any other checksum just means reading back as
+ * before.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "avrdude.h"
+#include "avrpart.h"
+#include "cachefile.h"
+#include "pgm.h"
+#include "memsum.h"
+
+static char memsum_file[PATH_MAX];
+
+
+int memsum_ranges(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, int size)
+{
+  int i, start, rc;
+
+  if (pgm->verify_range == NULL)
+    return -1;
+  if (size > mem->size)
+    size = mem->size;
+
+  for (i = 0; (start = avr_mem_tag_find(mem, i, size, 1)) < size; ) {
+    i = avr_mem_tag_find(mem, start, size, 0);
+    rc = pgm->verify_range(pgm, p, mem, start, i - start);
+    if (rc > 0)
+      fprintf(stderr, "%s: device CRC of %s 0x%04x..0x%04x does not match\n",
+              progname, mem->desc, start, i - 1);
+    if (rc != 0)
+      return rc;
+  }
+
+  return 0;
+}
+
+void memsum_cache(const char * file)
+{
+  snprintf(memsum_file, sizeof(memsum_file), "%s", file);
+}
+
+/*
+ * FNV-1a of the whole memory buffer and its allocation tags: the
+ * readback a checksum is remembered from only compared the tagged
+ * bytes, so it does not vouch for an image tagging any others.
+ */
+static uint64_t memsum_hash(AVRMEM * mem)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int i, ntags = avr_mem_tags_size(mem);
+
+  for (i = 0; i < mem->size; i++) {
+    h ^= mem->buf[i];
+    h *= 1099511628211ULL;
+  }
+  for (i = 0; i < ntags; i++) {
+    h ^= mem->tags[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/* the cache file key of mem in p: "<part> <memory> <hash>" */
+static void memsum_key(const AVRPART * p, AVRMEM * mem, char * key,
+                       size_t keysize)
+{
+  uint64_t h = memsum_hash(mem);
+
+  snprintf(key, keysize, "%s %s %08lx%08lx", p->id, mem->desc,
+           (unsigned long)(h >> 32), (unsigned long)(h & 0xffffffff));
+}
+
+/* the cache file holds "<key> <checksum>" lines */
+static int memsum_lookup(const char * key, unsigned long * sum)
+{
+  char value[32];
+
+  if (cachefile_lookup(memsum_file, key, value, sizeof(value)) < 0 ||
+      sscanf(value, "%lx", sum) != 1)
+    return -1;
+
+  return 0;
+}
+
+int memsum_check(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                 unsigned long * sum)
+{
+  char key[128];
+  unsigned long known;
+
+  if (pgm->mem_checksum == NULL || pgm->mem_checksum(pgm, p, mem, sum) < 0)
+    return -1;
+
+  memsum_key(p, mem, key, sizeof(key));
+  if (memsum_lookup(key, &known) < 0) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: no known device checksum for these %s contents\n",
+              progname, mem->desc);
+    return 1;
+  }
+  if (known != *sum) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: device checksum 0x%06lx of %s is not 0x%06lx\n",
+              progname, *sum, mem->desc, known);
+    return 1;
+  }
+
+  return 0;
+}
+
+void memsum_remember(AVRPART * p, AVRMEM * mem, unsigned long sum)
+{
+  char key[128], value[32];
+
+  if (memsum_file[0] == 0)
+    return;
+  memsum_key(p, mem, key, sizeof(key));
+  snprintf(value, sizeof(value), "%06lx", sum);
+  cachefile_remember(memsum_file, key, value, "checksum cache");
+}
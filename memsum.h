@@ -0,0 +1,58 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef memsum_h
+#define memsum_h
+
+#include "avrpart.h"
+#include "pgm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compare each run of tagged bytes of mem below size with mem->buf
+ * by the programmer's range CRC.  Returns 0 if all of them are the
+ * same, 1 if one is not, or -1 if the programmer cannot tell.
+ */
+int memsum_ranges(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, int size);
+
+/* file the device checksums of verified images are kept in */
+void memsum_cache(const char * file);
+
+/*
+ * Ask the programmer for its checksum of all of memory mem and look
+ * up the checksum an earlier run read back for the contents of
+ * mem->buf.  Returns 0 if both are the same, so the memory holds
+ * these contents, 1 if the device checksum (in *sum) is different or
+ * not known yet, or -1 if the programmer cannot tell it.
+ */
+int memsum_check(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                 unsigned long * sum);
+
+/* mem was verified by readback to hold mem->buf; its checksum is sum */
+void memsum_remember(AVRPART * p, AVRMEM * mem, unsigned long sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
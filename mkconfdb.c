@@ -0,0 +1,94 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Build-time tool for configure --enable-builtin-config: parse a
+ * configuration file, and write the image of its parts and programmers
+ * (see confcache.c) as a C source file defining builtin_config[].
+ * The image is in the layout of the structures of this very build, so
+ * the tool cannot be used when cross-compiling.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "avrdude.h"
+#include "config.h"
+#include "confcache.h"
+
+char * progname = "mkconfdb";
+char   progbuf[PATH_MAX] = "        ";
+int    verbose;
+int    quell_progress;
+int    ovsigck;
+
+int main(int argc, char * argv [])
+{
+  FILE * img, * out;
+  int c;
+  long n;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s avrdude.conf output.c\n", progname);
+    return 1;
+  }
+
+  if (init_config() < 0 || read_config(argv[1]) != 0) {
+    fprintf(stderr, "%s: error reading configuration file \"%s\"\n",
+            progname, argv[1]);
+    return 1;
+  }
+
+  if ((img = tmpfile()) == NULL || write_config_image(img) < 0) {
+    fprintf(stderr, "%s: can't write the configuration image\n", progname);
+    return 1;
+  }
+  rewind(img);
+
+  if ((out = fopen(argv[2], "w")) == NULL) {
+    fprintf(stderr, "%s: can't open \"%s\"\n", progname, argv[2]);
+    return 1;
+  }
+  fprintf(out,
+          "/* Generated by mkconfdb from %s; do not edit. */\n"
+          "\n"
+          "#include <stddef.h>\n"
+          "\n"
+          "const unsigned char builtin_config[] = {\n",
+          argv[1]);
+  /* decimal keeps the mostly zero image small as source */
+  for (n = 0; (c = getc(img)) != EOF; n++)
+    fprintf(out, "%d,%s", c, n % 24 == 23? "\n": "");
+  fprintf(out,
+          "\n};\n"
+          "\n"
+          "const size_t builtin_config_size = sizeof(builtin_config);\n");
+  fclose(img);
+  if (fclose(out) != 0) {
+    fprintf(stderr, "%s: error writing \"%s\"\n", progname, argv[2]);
+    remove(argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Multi-page read cache shared by the JTAG ICE mkII and JTAGICE3
+ * backends.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pagecache.h"
+
+/*
+ * The cache holds about PAGECACHE_SIZE bytes, but at least
+ * PAGECACHE_MINPAGES pages.  A read-ahead fills at most half of it,
+ * so it does not push out everything read before.
+ */
+#define PAGECACHE_SIZE     2048
+#define PAGECACHE_MINPAGES 4
+
+
+int pagecache_init(struct pagecache * pc, unsigned int pagesize)
+{
+  unsigned int n;
+
+  pagecache_free(pc);
+  if (pagesize == 0)
+    return 0;
+
+  n = PAGECACHE_SIZE / pagesize;
+  if (n < PAGECACHE_MINPAGES)
+    n = PAGECACHE_MINPAGES;
+
+  pc->data = malloc((size_t)n * pagesize);
+  pc->addr = malloc(n * sizeof(unsigned long));
+  pc->used = malloc(n * sizeof(unsigned long));
+  if (pc->data == NULL || pc->addr == NULL || pc->used == NULL) {
+    pagecache_free(pc);
+    return -1;
+  }
+  pc->pagesize = pagesize;
+  pc->npages = n;
+  pagecache_clear(pc);
+
+  return 0;
+}
+
+void pagecache_free(struct pagecache * pc)
+{
+  free(pc->data);
+  free(pc->addr);
+  free(pc->used);
+  memset(pc, 0, sizeof(*pc));
+}
+
+void pagecache_clear(struct pagecache * pc)
+{
+  unsigned int i;
+
+  for (i = 0; i < pc->npages; i++) {
+    pc->addr[i] = (unsigned long)-1L;
+    pc->used[i] = 0;
+  }
+  pc->clock = 0;
+  pc->last = 0;
+  pc->next = (unsigned long)-1L;
+}
+
+void pagecache_invalidate(struct pagecache * pc,
+                          unsigned long addr, unsigned long len)
+{
+  unsigned long first, last;
+  unsigned int i;
+
+  if (pc->pagesize == 0 || len == 0)
+    return;
+
+  first = addr & ~(unsigned long)(pc->pagesize - 1);
+  last = (addr + len - 1) & ~(unsigned long)(pc->pagesize - 1);
+  for (i = 0; i < pc->npages; i++)
+    if (pc->addr[i] != (unsigned long)-1L &&
+        pc->addr[i] >= first && pc->addr[i] <= last)
+      pc->addr[i] = (unsigned long)-1L;
+}
+
+static int pagecache_find(struct pagecache * pc, unsigned long paddr)
+{
+  unsigned int i;
+
+  if (pc->addr[pc->last] == paddr)
+    return pc->last;
+  for (i = 0; i < pc->npages; i++)
+    if (pc->addr[i] == paddr)
+      return i;
+
+  return -1;
+}
+
+unsigned char * pagecache_lookup(struct pagecache * pc, unsigned long addr)
+{
+  unsigned long paddr;
+  int i;
+
+  if (pc->pagesize == 0)
+    return NULL;
+
+  paddr = addr & ~(unsigned long)(pc->pagesize - 1);
+  if ((i = pagecache_find(pc, paddr)) < 0)
+    return NULL;
+
+  pc->used[i] = ++pc->clock;
+  pc->last = i;
+
+  return pc->data + (size_t)i * pc->pagesize + (addr - paddr);
+}
+
+unsigned int pagecache_readahead(struct pagecache * pc, unsigned long paddr,
+                                 unsigned long end, unsigned int maxlen)
+{
+  unsigned int n, max;
+
+  if (paddr != pc->next)
+    return pc->pagesize;
+
+  max = maxlen / pc->pagesize;
+  if (max > pc->npages / 2)
+    max = pc->npages / 2;
+  for (n = 1; n < max && paddr + (n + 1) * pc->pagesize <= end; n++)
+    ;
+
+  return n * pc->pagesize;
+}
+
+void pagecache_fill(struct pagecache * pc, unsigned long paddr,
+                    const unsigned char * buf, unsigned int len)
+{
+  unsigned int i, j;
+  int k;
+
+  for (; len >= pc->pagesize;
+       paddr += pc->pagesize, buf += pc->pagesize, len -= pc->pagesize) {
+    if ((k = pagecache_find(pc, paddr)) >= 0) {
+      i = k;
+    } else {
+      /* replace the least recently used page */
+      for (i = 0, j = 1; j < pc->npages; j++)
+        if (pc->used[j] < pc->used[i])
+          i = j;
+      pc->addr[i] = paddr;
+    }
+    memcpy(pc->data + (size_t)i * pc->pagesize, buf, pc->pagesize);
+    pc->used[i] = ++pc->clock;
+    pc->last = i;
+    pc->next = paddr + pc->pagesize;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef pagecache_h
+#define pagecache_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cache of target memory pages for programmers that read single bytes
+ * by reading the whole page around them.  Pages are kept in least
+ * recently used order; a miss on the page following the previous fill
+ * reads several pages ahead.  The page size must be a power of two.
+ */
+struct pagecache {
+  unsigned int    pagesize;	/* 0 if not set up */
+  unsigned int    npages;
+  unsigned char * data;		/* npages * pagesize bytes */
+  unsigned long * addr;		/* address of each page, -1 if unused */
+  unsigned long * used;		/* time of last use of each page */
+  unsigned long   clock;
+  unsigned int    last;		/* most recently used page */
+  unsigned long   next;		/* address following the last fill */
+};
+
+/*
+ * Set up pc for pages of pagesize bytes; returns -1 if out of memory.
+ */
+int pagecache_init(struct pagecache * pc, unsigned int pagesize);
+
+void pagecache_free(struct pagecache * pc);
+
+/* forget all pages */
+void pagecache_clear(struct pagecache * pc);
+
+/* forget the pages overlapping len bytes from addr */
+void pagecache_invalidate(struct pagecache * pc,
+                          unsigned long addr, unsigned long len);
+
+/*
+ * Return a pointer to the cached byte at addr, or NULL if its page is
+ * not cached.
+ */
+unsigned char * pagecache_lookup(struct pagecache * pc, unsigned long addr);
+
+/*
+ * Number of bytes to read from the page at paddr on a miss: one page,
+ * or as many as fit into maxlen bytes and below end if the access
+ * continues the previous fill.
+ */
+unsigned int pagecache_readahead(struct pagecache * pc, unsigned long paddr,
+                                 unsigned long end, unsigned int maxlen);
+
+/* store the whole pages in len bytes from buf read at paddr */
+void pagecache_fill(struct pagecache * pc, unsigned long paddr,
+                    const unsigned char * buf, unsigned int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
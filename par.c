@@ -108,18 +108,34 @@ static int par_setpin(PROGRAMMER * pgm, int pinfunc, int value)
   return par_setpin_internal(pgm, pgm->pinno[pinfunc], value);
 }
 
+/*
+ * All pins of a pin set that live in one register change with a
+ * single write, and the ISP delay is taken once.
+ */
 static void par_setmany(PROGRAMMER * pgm, int pinfunc, int value)
 {
-  int pin, mask;
+  int pin, p, v, reg;
+  int mask[PPISTATUS + 1] = { 0 }, val[PPISTATUS + 1] = { 0 };
   int pinset = pgm->pinno[pinfunc];
 
-  /* mask is anything non-pin - needs to be applied to each par_setpin to preserve inversion */
-  mask = pinset & (~PIN_MASK);
-
   for (pin = 1; pin <= 17; pin++) {
-    if (pinset & (1 << pin))
-      par_setpin_internal(pgm, pin | mask, value);
+    if (!(pinset & (1 << pin)))
+      continue;
+    p = pin - 1;
+    v = value;
+    if (!(pinset & PIN_INVERSE) != !ppipins[p].inverted)
+      v = !v;
+    mask[ppipins[p].reg] |= ppipins[p].bit;
+    if (v)
+      val[ppipins[p].reg] |= ppipins[p].bit;
   }
+
+  for (reg = PPIDATA; reg <= PPISTATUS; reg++)
+    if (mask[reg])
+      ppi_setbits(&pgm->fd, reg, mask[reg], val[reg]);
+
+  if (pgm->ispdelay > 1)
+    bitbang_delay(pgm->ispdelay);
 }
 
 static int par_getpin(PROGRAMMER * pgm, int pinfunc)
@@ -151,6 +167,83 @@ static int par_getpin(PROGRAMMER * pgm, int pinfunc)
 }
 
 
+/*
+ * Look up register and bit of a pin; returns whether the pin is
+ * inverted, or -1 if it is no valid pin.
+ */
+static int par_pinbit(PROGRAMMER * pgm, int pinfunc, int * reg, int * bit)
+{
+  int inverted;
+  int pin = pgm->pinno[pinfunc];
+
+  inverted = pin & PIN_INVERSE ? 1 : 0;
+  pin &= PIN_MASK;
+
+  if (pin < 1 || pin > 17)
+    return -1;
+
+  pin--;
+
+  if (ppipins[pin].inverted)
+    inverted = !inverted;
+
+  *reg = ppipins[pin].reg;
+  *bit = ppipins[pin].bit;
+
+  return inverted;
+}
+
+/*
+ * Clock a buffer through the SPI pins.  When MOSI and SCK are bits
+ * of the same output register, which they are with all cables in
+ * avrdude.conf, the values the two bits can take are computed up
+ * front, and each bit becomes two register writes from the shadow
+ * copy and the MISO read: MOSI changes along with the falling SCK
+ * edge of the previous bit.
+ */
+static int par_xfer_buf(PROGRAMMER * pgm, const unsigned char *tx,
+                        unsigned char *rx, int len)
+{
+  int mreg = 0, mbit = 0, minv, sreg = 0, sbit = 0, sinv;
+  unsigned char out[2][2], r;
+  int mask, b, i, j;
+
+  minv = par_pinbit(pgm, PIN_AVR_MOSI, &mreg, &mbit);
+  sinv = par_pinbit(pgm, PIN_AVR_SCK, &sreg, &sbit);
+  if (minv < 0 || sinv < 0 || mreg != sreg || mreg == PPISTATUS)
+    return -1;
+  mask = mbit | sbit;
+
+  /* out[MOSI][SCK] */
+  for (b=0; b<2; b++) {
+    out[b][0] = out[b][1] = (b ^ minv)? mbit: 0;
+    out[b][!sinv] |= sbit;
+  }
+
+  b = 0;
+  for (i=0; i<len; i++) {
+    r = 0;
+    for (j=7; j>=0; j--) {
+      b = (tx[i] >> j) & 0x01;
+      ppi_setbits(&pgm->fd, mreg, mask, out[b][0]);
+      if (pgm->ispdelay > 1)
+        bitbang_delay(pgm->ispdelay);
+      ppi_setbits(&pgm->fd, mreg, mask, out[b][1]);
+      if (pgm->ispdelay > 1)
+        bitbang_delay(pgm->ispdelay);
+      if (par_getpin(pgm, PIN_AVR_MISO) > 0)
+        r |= 1 << j;
+    }
+    rx[i] = r;
+  }
+  ppi_setbits(&pgm->fd, mreg, mask, out[b][0]);
+  if (pgm->ispdelay > 1)
+    bitbang_delay(pgm->ispdelay);
+
+  return 0;
+}
+
+
 static int par_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 {
   int inverted;
@@ -386,12 +479,15 @@ void par_initpgm(PROGRAMMER * pgm)
   pgm->program_enable = bitbang_program_enable;
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
   pgm->cmd_tpi        = bitbang_cmd_tpi;
   pgm->spi            = bitbang_spi;
   pgm->open           = par_open;
   pgm->close          = par_close;
   pgm->setpin         = par_setpin;
   pgm->getpin         = par_getpin;
+  pgm->bitbang_xfer_buf = par_xfer_buf;
   pgm->highpulsepin   = par_highpulsepin;
   pgm->parseexitspecs = par_parseexitspecs;
   pgm->read_byte      = avr_read_byte_default;
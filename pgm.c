@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "avrdude.h"
+#include "arena.h"
 #include "pgm.h"
 
 static int  pgm_default_2 (struct programmer_t *, AVRPART *);
@@ -66,7 +67,7 @@ PROGRAMMER * pgm_new(void)
   int i;
   PROGRAMMER * pgm;
 
-  pgm = (PROGRAMMER *)malloc(sizeof(*pgm));
+  pgm = (PROGRAMMER *)arena_alloc(sizeof(*pgm));
   if (pgm == NULL) {
     fprintf(stderr, "%s: out of memory allocating programmer structure\n",
             progname);
@@ -122,14 +123,27 @@ PROGRAMMER * pgm_new(void)
    */
   pgm->cmd            = NULL;
   pgm->cmd_tpi        = NULL;
+  pgm->cmd_tpi_seq    = NULL;
   pgm->spi            = NULL;
   pgm->paged_write    = NULL;
   pgm->paged_load     = NULL;
+  pgm->paged_write_submit   = NULL;
+  pgm->paged_write_complete = NULL;
+  pgm->page_erase_queued = 0;
+  pgm->page_write_erases = 0;
+  pgm->fresh_device   = 0;
+  pgm->paged_verify   = NULL;
+  pgm->paged_verify_done = NULL;
   pgm->write_setup    = NULL;
   pgm->read_sig_bytes = NULL;
+  pgm->read_config_bytes = NULL;
+  pgm->mem_checksum   = NULL;
+  pgm->verify_range   = NULL;
+  pgm->blank_check    = NULL;
   pgm->set_vtarget    = NULL;
   pgm->set_varef      = NULL;
   pgm->set_fosc       = NULL;
+  pgm->bitbang_xfer_buf = NULL;
   pgm->perform_osccal = NULL;
   pgm->parseextparams = NULL;
   pgm->setup          = NULL;
@@ -140,21 +154,21 @@ PROGRAMMER * pgm_new(void)
 
 void pgm_free(PROGRAMMER * const p)
 {
-  ldestroy_cb(p->id, free);
+  ldestroy_cb(p->id, arena_free);
   p->id = NULL;
   /* this is done by pgm_teardown, but usually cookie is not set to NULL */
   /* if (p->cookie !=NULL) {
     free(p->cookie);
     p->cookie = NULL;
   }*/
-  free(p);
+  arena_free(p);
 }
 
 PROGRAMMER * pgm_dup(const PROGRAMMER * const src)
 {
   PROGRAMMER * pgm;
 
-  pgm = (PROGRAMMER *)malloc(sizeof(*pgm));
+  pgm = (PROGRAMMER *)arena_alloc(sizeof(*pgm));
   if (pgm == NULL) {
     fprintf(stderr, "%s: out of memory allocating programmer structure\n",
             progname);
@@ -244,21 +258,112 @@ void pgm_display_generic(PROGRAMMER * pgm, const char * p)
   pgm_display_generic_mask(pgm, p, SHOW_ALL_PINS);
 }
 
+/*
+ * Index of all programmer ids of one programmer list, sorted by id
+ * and then by list position, so that the first entry for an id is the
+ * programmer a walk over the list would find.
+ */
+struct pgm_key {
+  const char * id;
+  int          seq;
+  PROGRAMMER * pgm;
+};
+
+static struct {
+  LISTID           programmers;
+  int              nprogrammers;
+  int              nkeys;
+  struct pgm_key * keys;
+} pgm_index;
+
+static int pgm_key_compare(const void * a, const void * b)
+{
+  const struct pgm_key * k1 = a, * k2 = b;
+  int rc;
+
+  rc = strcasecmp(k1->id, k2->id);
+  if (rc == 0)
+    rc = k1->seq - k2->seq;
+  return rc;
+}
+
+/*
+ * Build the lookup index for locate_programmer() once the
+ * configuration has been read; the list must not be changed afterwards.
+ */
+void index_programmers(LISTID programmers)
+{
+  void ** pgms;
+  LNODEID ln2;
+  PROGRAMMER * p;
+  int i, n;
+
+  free(pgm_index.keys);
+  pgm_index.programmers = NULL;
+  pgm_index.nkeys = 0;
+
+  if ((pgms = larray(programmers)) == NULL)
+    return;
+  n = 0;
+  for (i = 0; pgms[i] != NULL; i++) {
+    p = pgms[i];
+    n += lsize(p->id);
+  }
+  pgm_index.keys = malloc(n * sizeof(struct pgm_key) + 1);
+  if (pgm_index.keys == NULL)
+    return;
+
+  n = 0;
+  for (i = 0; pgms[i] != NULL; i++) {
+    p = pgms[i];
+    for (ln2=lfirst(p->id); ln2; ln2=lnext(ln2)) {
+      pgm_index.keys[n].id = ldata(ln2);
+      pgm_index.keys[n].seq = n;
+      pgm_index.keys[n].pgm = p;
+      n++;
+    }
+  }
+  qsort(pgm_index.keys, n, sizeof(struct pgm_key), pgm_key_compare);
+  pgm_index.programmers = programmers;
+  pgm_index.nprogrammers = lsize(programmers);
+  pgm_index.nkeys = n;
+}
+
 PROGRAMMER * locate_programmer(LISTID programmers, const char * configid)
 {
   LNODEID ln1, ln2;
   PROGRAMMER * p = NULL;
   const char * id;
   int found;
+  int lo, hi, mid;
 
   found = 0;
 
-  for (ln1=lfirst(programmers); ln1 && !found; ln1=lnext(ln1)) {
-    p = ldata(ln1);
-    for (ln2=lfirst(p->id); ln2 && !found; ln2=lnext(ln2)) {
-      id = ldata(ln2);
-      if (strcasecmp(configid, id) == 0)
-        found = 1;
+  if (programmers == pgm_index.programmers &&
+      lsize(programmers) == pgm_index.nprogrammers) {
+    lo = 0;
+    hi = pgm_index.nkeys;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (strcasecmp(pgm_index.keys[mid].id, configid) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < pgm_index.nkeys &&
+        strcasecmp(pgm_index.keys[lo].id, configid) == 0) {
+      p = pgm_index.keys[lo].pgm;
+      found = 1;
+    }
+  }
+  else {
+    for (ln1=lfirst(programmers); ln1 && !found; ln1=lnext(ln1)) {
+      p = ldata(ln1);
+      for (ln2=lfirst(p->id); ln2 && !found; ln2=lnext(ln2)) {
+        id = ldata(ln2);
+        if (strcasecmp(configid, id) == 0)
+          found = 1;
+      }
     }
   }
 
@@ -37,6 +37,9 @@
 #define PGM_TYPELEN 32
 #define PGM_USBSTRINGLEN 256
 
+/* maximum number of pages avr_write() keeps in flight via paged_write_submit */
+#define PAGED_WRITE_DEPTH 4
+
 typedef enum {
   EXIT_VCC_UNSPEC,
   EXIT_VCC_ENABLED,
@@ -100,6 +103,9 @@ typedef struct programmer_t {
                           unsigned char *res);
   int  (*cmd_tpi)        (struct programmer_t * pgm, const unsigned char *cmd,
                           int cmd_len, unsigned char res[], int res_len);
+  int  (*cmd_tpi_seq)    (struct programmer_t * pgm, const unsigned char *cmd,
+                          int cmd_len, unsigned char res[], int res_len,
+                          int count);
   int  (*spi)            (struct programmer_t * pgm, const unsigned char *cmd,
                           unsigned char *res, int count);
   int  (*open)           (struct programmer_t * pgm, char * port);
@@ -112,12 +118,79 @@ typedef struct programmer_t {
                           unsigned int n_bytes);
   int  (*page_erase)     (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
                           unsigned int baseaddr);
+  /*
+   * Optional asynchronous paged write: submit starts writing one page
+   * and returns without waiting for the target, complete waits for the
+   * oldest submitted page to finish.  avr_write() keeps at most
+   * PAGED_WRITE_DEPTH pages outstanding and drains them all before any
+   * other programmer call.
+   */
+  int  (*paged_write_submit)   (struct programmer_t * pgm, AVRPART * p,
+                                AVRMEM * m, unsigned int page_size,
+                                unsigned int baseaddr, unsigned int n_bytes);
+  int  (*paged_write_complete) (struct programmer_t * pgm, AVRPART * p,
+                                AVRMEM * m);
+  /*
+   * Set if page_erase() only queues the erase for the write of that
+   * page that follows, so avr_write() need not drain the pages in
+   * flight before it.
+   */
+  int  page_erase_queued;
+  /*
+   * Set if paged_write() erases each flash page before writing it, as
+   * most bootloaders do, so pages can be rewritten without an erase.
+   */
+  int  page_write_erases;
+  /*
+   * Set in continuous mode: the device has just been put on, so what
+   * the host remembers of the one before it at the port does not apply.
+   */
+  int  fresh_device;
+  /*
+   * Optional: read back the n_bytes just written by paged_write() at
+   * baseaddr and compare them with the allocated bytes of m->buf.  The
+   * read may still be in flight on return; paged_verify_done() waits
+   * for all of them.  Both return -1 on a mismatch or error, and
+   * paged_verify() returns -2 if it cannot verify memory m.
+   */
+  int  (*paged_verify)   (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned int page_size, unsigned int baseaddr,
+                          unsigned int n_bytes);
+  int  (*paged_verify_done) (struct programmer_t * pgm, AVRPART * p,
+                             AVRMEM * m);
   void (*write_setup)    (struct programmer_t * pgm, AVRPART * p, AVRMEM * m);
   int  (*write_byte)     (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
                           unsigned long addr, unsigned char value);
   int  (*read_byte)      (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
                           unsigned long addr, unsigned char * value);
   int  (*read_sig_bytes) (struct programmer_t * pgm, AVRPART * p, AVRMEM * m);
+  /*
+   * Optional: read the bytes at addrs[i] of the n memories mems[i] in
+   * one transaction; see avr_read_config_bytes().
+   */
+  int  (*read_config_bytes) (struct programmer_t * pgm, AVRPART * p,
+                             AVRMEM * mems[], const unsigned long addrs[],
+                             unsigned char * values, int n);
+  /*
+   * Optional: a checksum the device computes over all of memory m, so
+   * a verify need not read it back; -1 if m has none.
+   */
+  int  (*mem_checksum)   (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned long * sum);
+  /*
+   * Optional: compare len bytes of m from addr with m->buf by a CRC
+   * the device computes; 0 if they are the same, 1 if not, -1 if the
+   * device cannot tell.
+   */
+  int  (*verify_range)   (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned long addr, unsigned long len);
+  /*
+   * Optional: whether len bytes of m from addr are all 0xff on the
+   * device, checked without reading them; 1 if so, 0 if not, -1 if
+   * the device cannot tell.
+   */
+  int  (*blank_check)    (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
+                          unsigned long addr, unsigned long len);
   void (*print_parms)    (struct programmer_t * pgm);
   int  (*set_vtarget)    (struct programmer_t * pgm, double v);
   int  (*set_varef)      (struct programmer_t * pgm, unsigned int chan, double v);
@@ -126,6 +199,11 @@ typedef struct programmer_t {
   int  (*setpin)         (struct programmer_t * pgm, int pinfunc, int value);
   int  (*getpin)         (struct programmer_t * pgm, int pinfunc);
   int  (*highpulsepin)   (struct programmer_t * pgm, int pinfunc);
+  /* optional for bitbang programmers: clock len bytes out on MOSI, the
+     MISO samples go to rx; returns -1 without touching a pin if the
+     wiring does not allow it, so bitbang.c falls back to setpin() */
+  int  (*bitbang_xfer_buf) (struct programmer_t * pgm, const unsigned char *tx,
+                            unsigned char *rx, int len);
   int  (*parseexitspecs) (struct programmer_t * pgm, char *s);
   int  (*perform_osccal) (struct programmer_t * pgm);
   int  (*parseextparams) (struct programmer_t * pgm, LISTID xparams);
@@ -163,6 +241,7 @@ typedef void (*walk_programmers_cb)(const char *name, const char *desc,
 void walk_programmers(LISTID programmers, walk_programmers_cb cb, void *cookie);
 
 void sort_programmers(LISTID programmers);
+void index_programmers(LISTID programmers);
 
 #ifdef __cplusplus
 }
@@ -41,11 +41,13 @@
 #include "jtagmkII.h"
 #include "jtag3.h"
 #include "linuxgpio.h"
+#include "linuxspi.h"
 #include "par.h"
 #include "pickit2.h"
 #include "picoboot.h"
 #include "ppi.h"
 #include "serbb.h"
+#include "sim.h"
 #include "stk500.h"
 #include "stk500generic.h"
 #include "stk500v2.h"
@@ -82,10 +84,12 @@ const PROGRAMMER_TYPE const programmers_types[] = {
         {"jtagice3_dw", jtag3_dw_initpgm, jtag3_dw_desc},
         {"jtagice3_isp", stk500v2_jtag3_initpgm, stk500v2_jtag3_desc},
         {"linuxgpio", linuxgpio_initpgm, linuxgpio_desc},
+        {"linuxspi", linuxspi_initpgm, linuxspi_desc},
         {"par", par_initpgm, par_desc},
         {"pickit2", pickit2_initpgm, pickit2_desc},
         {"picoboot", picoboot_initpgm, picoboot_desc},
         {"serbb", serbb_initpgm, serbb_desc},
+        {"sim", sim_initpgm, sim_desc},
         {"stk500", stk500_initpgm, stk500_desc},
         {"stk500generic", stk500generic_initpgm, stk500generic_desc},
         {"stk500v2", stk500v2_initpgm, stk500v2_desc},
@@ -119,6 +123,18 @@ const PROGRAMMER_TYPE * locate_programmer_type(const char * id)
   return NULL;
 }
 
+/* the reverse of locate_programmer_type(), for the type of a parsed programmer */
+const PROGRAMMER_TYPE * locate_programmer_type_by_initpgm(void (*initpgm)(struct programmer_t * pgm))
+{
+  int i;
+
+  for (i = 0; i < sizeof(programmers_types)/sizeof(programmers_types[0]); i++)
+    if (programmers_types[i].initpgm == initpgm)
+      return &(programmers_types[i]);
+
+  return NULL;
+}
+
 /*
  * Iterate over the list of programmers given as "programmers", and
  * call the callback function cb for each entry found.  cb is being
@@ -38,6 +38,7 @@ extern "C" {
 #endif
 
 const PROGRAMMER_TYPE * locate_programmer_type(/*LISTID programmer_types, */const char * id);
+const PROGRAMMER_TYPE * locate_programmer_type_by_initpgm(void (*initpgm)(struct programmer_t * pgm));
 
 typedef void (*walk_programmer_types_cb)(const char *id, const char *desc,
                                     void *cookie);
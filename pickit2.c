@@ -91,6 +91,8 @@
 #define PICKIT2_PID 0x0033
 
 #define SPI_MAX_CHUNK (64 - 10)    // max packet size less the command overhead
+#define SPI_MAX_READS  60          // read commands per script run, limited by the upload report
+#define SPI_MAX_WRITES 63          // write commands per script run, limited by the download buffer
 
 // win32native only:
 #if (defined(WIN32NATIVE) && defined(HAVE_LIBHID))
@@ -128,6 +130,7 @@ struct pdata
 #endif
     uint8_t clock_period;  // SPI clock period in us
     int transaction_timeout;    // usb trans timeout in ms
+    int have_scripts;           // SPI scripts are stored in the PICkit2
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -137,11 +140,14 @@ struct pdata
 #define CMD_SET_VDD_4(v)    0xA0, (uint8_t)((v)*2048+672), (uint8_t)(((v)*2048+672)/256), (uint8_t)((v)*36)
 #define CMD_SET_VPP_4(v)    0xA1, 0x40, (uint8_t)((v)*18.61), (uint8_t)((v)*13)
 #define CMD_READ_VDD_VPP    0xA3
+#define CMD_DOWNLOAD_SCRIPT_3(n, len)  0xA4, (n), (len)
+#define CMD_RUN_SCRIPT_3(n, cnt)  0xA5, (n), (cnt)
 #define CMD_EXEC_SCRIPT_2(len)  0xA6, (len)
 #define CMD_CLR_DLOAD_BUFF  0xA7
 #define CMD_DOWNLOAD_DATA_2(len)  0xA8, (len)
 #define CMD_CLR_ULOAD_BUFF  0xA9
 #define CMD_UPLOAD_DATA     0xAA
+#define CMD_CLR_SCRIPT_BUFF 0xAB
 #define CMD_UPLOAD_DATA_NO_LEN     0xAC
 #define CMD_END_OF_BUFFER   0xAD
 
@@ -163,8 +169,14 @@ struct pdata
 #define SCR_SET_AUX_2(ad, av)   0xCF, (((ad)!=0) | (((av)!=0)<<1))
 #define SCR_SPI_SETUP_PINS_4    SCR_SET_PINS_2(1,0,0,0), SCR_SET_AUX_2(0,0)
 #define SCR_SPI             0xC3
+#define SCR_SPI_RD_BUF      0xC5
+#define SCR_SPI_WR_BUF      0xC6
 #define SCR_SPI_LIT_2(v)    0xC7,(v)
 
+// scripts kept in the PICkit2 script buffer, run over the download buffer
+#define SCRIPT_SPI_WRITE    0   // shift out one byte, discard the reply
+#define SCRIPT_SPI_READ     1   // shift out three bytes, upload the fourth reply byte
+
 static void pickit2_setup(PROGRAMMER * pgm)
 {
     if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0)
@@ -306,6 +318,24 @@ static int pickit2_initialize(PROGRAMMER * pgm, AVRPART * p)
                 fprintf(stderr, "pickit2_read_report failed (ec %d). %s\n", errorCode, usb_strerror());
                 return -1;
             }
+
+            // store the scripts used by the paged read and write functions
+            uint8_t scripts[65] =
+            {
+                0, CMD_CLR_SCRIPT_BUFF,
+                CMD_DOWNLOAD_SCRIPT_3(SCRIPT_SPI_WRITE, 1),
+                SCR_SPI_WR_BUF,
+                CMD_DOWNLOAD_SCRIPT_3(SCRIPT_SPI_READ, 4),
+                SCR_SPI_WR_BUF, SCR_SPI_WR_BUF, SCR_SPI_WR_BUF,
+                SCR_SPI_RD_BUF,
+                CMD_END_OF_BUFFER
+            };
+
+            PDATA(pgm)->have_scripts = pickit2_write_report(pgm, scripts) >= 0;
+            if (!PDATA(pgm)->have_scripts && verbose)
+            {
+                fprintf(stderr, "%s: can't store scripts in the %s, using slower paged access\n", progname, pgm->desc);
+            }
         }
         else
         {
@@ -474,7 +504,7 @@ static int  pickit2_chip_erase(struct programmer_t * pgm, AVRPART * p)
 
     avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
     pgm->cmd(pgm, cmd, res);
-    usleep(p->chip_erase_delay);
+    avr_wait_ready(pgm, p, p->chip_erase_delay);
     pgm->initialize(pgm, p);
 
     pgm->pgm_led(pgm, OFF);
@@ -482,6 +512,82 @@ static int  pickit2_chip_erase(struct programmer_t * pgm, AVRPART * p)
     return 0;
 }
 
+// append a script delay of at least us microseconds, returns the number of bytes used (2)
+static int pickit2_delay(uint8_t *script, unsigned int us)
+{
+    if (us > 5400)
+    {
+        script[0] = 0xE8;           // SCR_DELAY_LONG, 5.46 ms units
+        script[1] = MIN((us + 5459) / 5460, 255);
+    }
+    else
+    {
+        script[0] = 0xE7;           // SCR_DELAY_SHORT, 21.3 us units
+        script[1] = MIN((us * 10 + 212) / 213, 255);
+    }
+
+    return 2;
+}
+
+// Downloads n_bytes from cmd[] and runs the stored script iterations times over them, in as few
+// reports as possible.  The download buffer holds 256 bytes.  If res is given, the n_res bytes the
+// script put into the upload buffer are read back into it.
+static int pickit2_run_script(struct programmer_t * pgm, uint8_t script, const unsigned char *cmd,
+                int n_bytes, int iterations, unsigned char *res, int n_res)
+{
+    int done = 0, tail = 3 + (res != NULL);
+
+    while (!done)
+    {
+        uint8_t report[65] = {0};
+        uint8_t *repptr = report + 1;
+        int len = MIN(n_bytes, 62);
+
+        memset(report + 1, CMD_END_OF_BUFFER, sizeof(report) - 1);
+
+        if (len > 0)
+        {
+            *repptr++ = 0xA8;       // CMD_DOWNLOAD_DATA_2
+            *repptr++ = len;
+            memcpy(repptr, cmd, len);
+            repptr += len;
+            cmd += len;
+            n_bytes -= len;
+        }
+
+        // run the script from the last data report if there is room left, END_OF_BUFFER included
+        if (n_bytes == 0 && (repptr - report - 1) + tail < 64)
+        {
+            *repptr++ = 0xA5;       // CMD_RUN_SCRIPT_3
+            *repptr++ = script;
+            *repptr++ = iterations;
+            if (res)
+            {
+                *repptr++ = CMD_UPLOAD_DATA;
+            }
+            done = 1;
+        }
+
+        if (pickit2_write_report(pgm, report) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (res)
+    {
+        uint8_t report[65];
+
+        if (pickit2_read_report(pgm, report) < 0 || report[1] != n_res)
+        {
+            return -1;
+        }
+        memcpy(res, &report[2], n_res);
+    }
+
+    return 0;
+}
+
 static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                         unsigned int page_size, unsigned int addr, unsigned int n_bytes)
 {
@@ -494,9 +600,10 @@ static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     DEBUG( "paged read ps %d, mem %s\n", page_size, mem->desc);
 
     OPCODE *readop = 0, *lext = mem->op[AVR_OP_LOAD_EXT_ADDR];
-    uint8_t data = 0, cmd[SPI_MAX_CHUNK], res[SPI_MAX_CHUNK];
+    uint8_t data = 0, cmd[SPI_MAX_READS * 4], res[SPI_MAX_READS * 4];
     unsigned int addr_base;
     unsigned int max_addr = addr + n_bytes;
+    int stream = PDATA(pgm)->have_scripts;
 
     pgm->pgm_led(pgm, ON);
 
@@ -515,7 +622,9 @@ static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
         // bytes to send in the next packet -- not necessary as pickit2_spi() handles breaking up
         // the data into packets -- but we need to keep transfers frequent so that we can update the
         // status indicator bar
-        uint32_t blockSize = MIN(65536 - (addr_base % 65536), MIN(max_addr - addr_base, SPI_MAX_CHUNK / 4));
+        // with the read script, only the first three bytes of each command are sent and only the
+        // reply byte comes back, so a lot more commands fit into the reports
+        uint32_t blockSize = MIN(65536 - (addr_base % 65536), MIN(max_addr - addr_base, stream ? SPI_MAX_READS : SPI_MAX_CHUNK / 4));
 
         memset(cmd, 0, sizeof(cmd));
         memset(res, 0, sizeof(res));
@@ -548,7 +657,31 @@ static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
             avr_set_addr(readop, &cmd[addr_off*4], caddr);
         }
 
-        int bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
+        int bytes_read;
+
+        if (stream)
+        {
+            for (addr_off = 0; addr_off < blockSize; addr_off++)
+            {
+                memmove(&cmd[addr_off*3], &cmd[addr_off*4], 3);
+            }
+
+            bytes_read = -1;
+            if (pickit2_run_script(pgm, SCRIPT_SPI_READ, cmd, blockSize*3, blockSize,
+                                   res, blockSize) == 0)
+            {
+                // put the reply bytes back where avr_get_output() looks for them
+                for (addr_off = blockSize; addr_off-- > 0; )
+                {
+                    res[addr_off*4 + 3] = res[addr_off];
+                }
+                bytes_read = blockSize*4;
+            }
+        }
+        else
+        {
+            bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
+        }
 
         if (bytes_read < 0)
         {
@@ -611,6 +744,29 @@ static int pickit2_commit_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     avr_set_bits(wp, &cmd[4]);
     avr_set_addr(wp, &cmd[4], addr);
 
+    if (PDATA(pgm)->have_scripts)
+    {
+        // send the commands and let the PICkit2 wait for the page to be written, so the
+        // next page can be queued right away
+        uint8_t report[65] = {0};
+        uint8_t *repptr = report + 1;
+        int len = lext != NULL ? 8 : 4;
+
+        memset(report + 1, CMD_END_OF_BUFFER, sizeof(report) - 1);
+        *repptr++ = 0xA8;           // CMD_DOWNLOAD_DATA_2
+        *repptr++ = len;
+        memcpy(repptr, lext != NULL ? cmd : &cmd[4], len);
+        repptr += len;
+        *repptr++ = 0xA5;           // CMD_RUN_SCRIPT_3
+        *repptr++ = SCRIPT_SPI_WRITE;
+        *repptr++ = len;
+        *repptr++ = 0xA6;           // CMD_EXEC_SCRIPT_2
+        *repptr++ = 2;
+        pickit2_delay(repptr, mem->max_write_delay);
+
+        return pickit2_write_report(pgm, report) < 0 ? -1 : 0;
+    }
+
     if (lext != NULL)
     {
         // write the load extended address cmd && the write_page cmd
@@ -622,7 +778,7 @@ static int pickit2_commit_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
         pgm->spi(pgm, &cmd[4], NULL, 4);
     }
 
-    // just delay the max (we could do the delay in the PICkit2 if we wanted)
+    // just delay the max
     usleep(mem->max_write_delay);
 
     return 0;
@@ -643,9 +799,11 @@ static int  pickit2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     DEBUG( "loadpagehi %x, loadpagelow %x, writepage %x\n", (int)mem->op[AVR_OP_LOADPAGE_HI], (int)mem->op[AVR_OP_LOADPAGE_LO], (int)mem->op[AVR_OP_WRITEPAGE]);
 
     OPCODE *writeop;
-    uint8_t cmd[SPI_MAX_CHUNK], res[SPI_MAX_CHUNK];
+    uint8_t cmd[SPI_MAX_WRITES * 4], res[SPI_MAX_CHUNK];
     unsigned int addr_base;
     unsigned int max_addr = addr + n_bytes;
+    // page loads don't need a reply, so they can be run by the write script without waiting
+    int stream = PDATA(pgm)->have_scripts && mem->paged && mem->op[AVR_OP_LOADPAGE_LO];
 
     pgm->pgm_led(pgm, ON);
 
@@ -655,7 +813,7 @@ static int  pickit2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
         if (mem->paged)
         {
-            blockSize = MIN(page_size - (addr_base % page_size), MIN(max_addr - addr_base, SPI_MAX_CHUNK/4) );     // bytes remaining in page
+            blockSize = MIN(page_size - (addr_base % page_size), MIN(max_addr - addr_base, stream ? SPI_MAX_WRITES : SPI_MAX_CHUNK/4) );     // bytes remaining in page
         }
         else
         {
@@ -713,7 +871,17 @@ static int  pickit2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
             avr_set_input(writeop, &cmd[addr_off*4], mem->buf[addr]);
         }
 
-        int bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
+        int bytes_read;
+
+        if (stream)
+        {
+            bytes_read = pickit2_run_script(pgm, SCRIPT_SPI_WRITE, cmd, blockSize*4, blockSize*4,
+                                            NULL, 0);
+        }
+        else
+        {
+            bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
+        }
 
         if (bytes_read < 0)
         {
@@ -728,7 +896,11 @@ static int  pickit2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
         if (mem->paged && (((addr_base % page_size) == 0) || (addr_base == max_addr)))
         {
             DEBUG( "Calling pickit2_commit_page()\n");
-            pickit2_commit_page(pgm, p, mem, addr_base-1);
+            if (pickit2_commit_page(pgm, p, mem, addr_base-1) < 0)
+            {
+                pgm->err_led(pgm, ON);
+                return -1;
+            }
         }
         else if (!mem->paged)
         {
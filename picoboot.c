@@ -26,13 +26,21 @@
 
 #include "ac_cfg.h"
 
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "avrdude.h"
+#include "avr.h"
+#include "crc16.h"
 #include "pgm.h"
 #include "serial.h"
+#include "stats.h"
 #include "picoboot.h"
 
 struct frame{
@@ -42,16 +50,447 @@ struct frame{
   uint8_t command;
 };
 
-/* due to ACK buffering, keep MAX_FRAMES <= serial fifo size 
- * also keep MAX_FRAMES <= chip page size in bytes */
+/* due to ACK buffering, keep MAX_FRAMES <= serial fifo size
+ * MAX_FRAMES is the number of frames allowed in flight (sent, but
+ * not yet ACKed); new frames go out in bursts of BURST_FRAMES as
+ * soon as enough older ACKs have come back */
 #define MAX_FRAMES 32
+#define BURST_FRAMES 8
+
+#define PICOBOOT_BAUD 230400     /* unless -b says otherwise */
+
+/*
+ * Rates -x upshift tries, fastest first.  The bootloader times the bit
+ * rate from each frame of zeros, so it follows a change of speed as
+ * soon as it gets a sync frame at the new one.
+ */
+static const long picoboot_rates[] = {
+  2000000, 1000000, 500000, 460800, 250000
+};
+#define UPSHIFT_SYNCS   8       /* sync frames a rate must pass */
+#define UPSHIFT_TIMEOUT 100     /* ms to wait for their ACKs */
+#define UPSHIFT_JITTER  3       /* ACK delay allowed, in times the least */
 
 /* 2 byte virtual reset vector + 64 bytes code = 66 */
 #define BOOTLOADER_SIZE 66
 
+/* frame commands, the bootloader writes them into SPMCSR */
+#define CMD_DATA        0x00    /* load data word */
+#define CMD_FILL        0x01    /* fill temp buffer at address */
+#define CMD_ERASE       0x03    /* erase page */
+#define CMD_WRITE       0x05    /* write page */
+/* fill temp buffer at the address following the previous fill, data
+ * word in the same frame; bit 6 (RWWSB) is read-only in SPMCSR */
+#define CMD_FILL_NEXT   0x41
+/* CRC of the number of bytes in the preceding data frame, starting at
+ * the address in this one; answered with the crcsum() of those bytes,
+ * LSB first, instead of an ACK.  Not an SPM command: with SPMEN clear,
+ * SPMCSR would not start one either */
+#define CMD_CRC         0x80
+
+/* a data frame carrying PROBE_LO/PROBE_HI right after the sync frame
+ * is answered instead of ACK with the PROTO_* bits of the commands the
+ * bootloader understands beyond the basic ones; older ones just ACK it */
+#define PROBE_LO        0x50
+#define PROBE_HI        0x42
+#define PROTO_FILL_NEXT 0x01    /* CMD_FILL_NEXT */
+#define PROTO_CRC       0x02    /* CMD_CRC */
+
 #define DEBUG(...) if (verbose > 1) fprintf(stderr, __VA_ARGS__)
 #define DEBUG_FUNC DEBUG("%s\n", __func__)
 
+/* one page known to hold given content, from the page manifest */
+struct manifest_entry {
+  unsigned int addr;
+  unsigned long hash;
+  int touched;                    /* part of the image of this session */
+};
+
+/*
+ * Private data for this programmer.
+ */
+struct pdata
+{
+  struct frame txq[BURST_FRAMES]; /* frames queued for the next burst */
+  int queued;                     /* number of frames in txq */
+  int in_flight;                  /* frames sent, ACK still outstanding */
+
+  char manifest_file[PATH_MAX];   /* page manifest, empty if unused */
+  char manifest_key[PGM_PORTLEN]; /* device key, defaults to the port */
+  struct manifest_entry *pages;   /* manifest of this device */
+  int npages, maxpages;
+  char *others;                   /* manifest lines of other devices */
+  size_t others_len;
+  int manifest_dirty;
+  int manifest_complete;          /* pages not listed are known erased */
+  int manifest_cleared;           /* entry dropped from the file for erasing */
+
+  int full_erase;                 /* -x full_erase */
+  int erase_deferred;             /* chip erase replaced by page erases */
+  unsigned char *blank;           /* flash pages known to be erased */
+  unsigned int flash_pagesize;
+  unsigned int flash_top;         /* end of the erasable flash */
+
+  int no_fill_next;               /* -x no_fill_next */
+  int fill_next;                  /* bootloader understands CMD_FILL_NEXT */
+  int no_crc;                     /* -x no_crc */
+  int crc;                        /* bootloader understands CMD_CRC */
+
+  long baud;                      /* rate the port was opened at */
+  long upshift;                   /* -x upshift: highest rate to try */
+};
+
+#define PDATA(pgm) ((struct pdata *)(pgm->cookie))
+
+static void picoboot_setup(PROGRAMMER * pgm)
+{
+  if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0) {
+    fprintf(stderr,
+	    "%s: picoboot_setup(): Out of memory allocating private data\n",
+	    progname);
+    exit(1);
+  }
+  memset(pgm->cookie, 0, sizeof(struct pdata));
+}
+
+static void picoboot_teardown(PROGRAMMER * pgm)
+{
+  free(PDATA(pgm)->pages);
+  free(PDATA(pgm)->others);
+  free(PDATA(pgm)->blank);
+  free(pgm->cookie);
+}
+
+/*
+ * Page manifest: since the bootloader cannot read flash back, the
+ * content hash of every page successfully written is remembered in a
+ * host-side file, one "<device key> <page address> <hash>" line per
+ * page.  Pages whose content matches the manifest are not written
+ * again on later runs.  A "<device key> erased" line says the device
+ * has been fully erased since the manifest was started, so the pages
+ * not listed are known to be blank.
+ */
+static unsigned long picoboot_page_hash(const unsigned char *buf,
+                                        unsigned int len)
+{
+  unsigned long h = 2166136261UL;       /* 32-bit FNV-1a */
+
+  while (len--) {
+    h ^= *buf++;
+    h = (h * 16777619UL) & 0xffffffffUL;
+  }
+  return h;
+}
+
+static struct manifest_entry *picoboot_manifest_find(PROGRAMMER * pgm,
+                                                     unsigned int addr)
+{
+  struct pdata *pd = PDATA(pgm);
+  int i;
+
+  for (i = 0; i < pd->npages; i++)
+    if (pd->pages[i].addr == addr)
+      return &pd->pages[i];
+  return NULL;
+}
+
+static void picoboot_manifest_add(PROGRAMMER * pgm, unsigned int addr,
+                                  unsigned long hash, int touched)
+{
+  struct pdata *pd = PDATA(pgm);
+  struct manifest_entry *e;
+
+  if ((e = picoboot_manifest_find(pgm, addr)) == NULL) {
+    if (pd->npages == pd->maxpages) {
+      pd->maxpages = pd->maxpages? 2 * pd->maxpages: 64;
+      pd->pages = realloc(pd->pages, pd->maxpages * sizeof(*pd->pages));
+      if (pd->pages == NULL) {
+        fprintf(stderr, "%s: picoboot: out of memory\n", progname);
+        exit(1);
+      }
+    }
+    e = &pd->pages[pd->npages++];
+    e->addr = addr;
+  }
+  e->hash = hash;
+  e->touched = touched;
+}
+
+static void picoboot_manifest_forget(PROGRAMMER * pgm, unsigned int addr)
+{
+  struct pdata *pd = PDATA(pgm);
+  struct manifest_entry *e;
+
+  if ((e = picoboot_manifest_find(pgm, addr)) != NULL) {
+    *e = pd->pages[--pd->npages];
+    pd->manifest_dirty = 1;
+  }
+}
+
+/* does the device hold this content already? */
+static int picoboot_manifest_match(PROGRAMMER * pgm, unsigned int addr,
+                                   unsigned long hash)
+{
+  struct manifest_entry *e;
+
+  if (PDATA(pgm)->manifest_file[0] == 0)
+    return 0;
+  if ((e = picoboot_manifest_find(pgm, addr)) == NULL || e->hash != hash)
+    return 0;
+  e->touched = 1;
+  return 1;
+}
+
+static void picoboot_manifest_record(PROGRAMMER * pgm, unsigned int addr,
+                                     unsigned long hash)
+{
+  if (PDATA(pgm)->manifest_file[0] == 0)
+    return;
+  picoboot_manifest_add(pgm, addr, hash, 1);
+  PDATA(pgm)->manifest_dirty = 1;
+}
+
+/*
+ * The processes of gang mode share the manifest file, so it is read
+ * and rewritten under a lock, and only ever rewritten with the lines
+ * of the other devices as they are in the file at the time.
+ */
+static int picoboot_manifest_lock(int fd, int write)
+{
+#if !defined(WIN32NATIVE)
+  struct flock fl;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = write? F_WRLCK: F_RDLCK;
+  fl.l_whence = SEEK_SET;
+  while (fcntl(fd, F_SETLKW, &fl) < 0)
+    if (errno != EINTR)
+      return -1;
+#endif
+  return 0;
+}
+
+/* read the manifest from f, the entries of this device only if mine */
+static void picoboot_manifest_scan(PROGRAMMER * pgm, FILE * f, int mine)
+{
+  struct pdata *pd = PDATA(pgm);
+  char line[PGM_PORTLEN + 64], key[PGM_PORTLEN], word[8];
+  unsigned int addr;
+  unsigned long hash;
+  size_t len, klen;
+  int c;
+
+  free(pd->others);
+  pd->others = NULL;
+  pd->others_len = 0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    len = strlen(line);
+    if (len > 0 && line[len - 1] != '\n' && !feof(f)) {
+      /* longer than any line we write: drop the rest of it */
+      while ((c = getc(f)) != EOF && c != '\n')
+        ;
+      goto malformed;
+    }
+    if (line[0] == '#')
+      continue;
+    /* the key is the first word, bounded by the size of key[] */
+    klen = strcspn(line, " \t\r\n");
+    if (klen == 0 || klen >= sizeof(key))
+      goto malformed;
+    memcpy(key, line, klen);
+    key[klen] = 0;
+    if (sscanf(line + klen, " %7s", word) == 1 &&
+        strcmp(word, "erased") == 0) {
+      if (strcmp(key, pd->manifest_key) != 0)
+        goto other;
+      if (mine)
+        pd->manifest_complete = 1;
+      continue;
+    }
+    if (sscanf(line + klen, " %x %lx", &addr, &hash) != 2) {
+    malformed:
+      if (mine)
+        fprintf(stderr,
+                "%s: picoboot: ignoring malformed line in manifest \"%s\"\n",
+                progname, pd->manifest_file);
+      continue;
+    }
+    if (strcmp(key, pd->manifest_key) == 0) {
+      if (mine)
+        picoboot_manifest_add(pgm, addr, hash, 0);
+      continue;
+    }
+  other:
+    /* keep entries of other devices for writing back */
+    pd->others = realloc(pd->others, pd->others_len + len + 1);
+    if (pd->others == NULL) {
+      fprintf(stderr, "%s: picoboot: out of memory\n", progname);
+      exit(1);
+    }
+    memcpy(pd->others + pd->others_len, line, len + 1);
+    pd->others_len += len;
+  }
+}
+
+static int picoboot_manifest_load(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+  FILE *f;
+
+  if ((f = fopen(pd->manifest_file, "r")) == NULL)
+    return 0;                   /* no manifest yet */
+  picoboot_manifest_lock(fileno(f), 0);
+  picoboot_manifest_scan(pgm, f, 1);
+  fclose(f);
+
+  if (verbose)
+    fprintf(stderr, "%s: picoboot: %d pages of \"%s\" in manifest \"%s\"\n",
+            progname, pd->npages, pd->manifest_key, pd->manifest_file);
+  return 0;
+}
+
+/* rewrite the manifest file, with the entry of this device if mine */
+static int picoboot_manifest_write(PROGRAMMER * pgm, int mine)
+{
+  struct pdata *pd = PDATA(pgm);
+  FILE *f;
+  int fd, i;
+
+  if ((fd = open(pd->manifest_file, O_RDWR | O_CREAT, 0666)) < 0 ||
+      (f = fdopen(fd, "r+")) == NULL) {
+    fprintf(stderr, "%s: picoboot: cannot write manifest \"%s\": %s\n",
+            progname, pd->manifest_file, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  if (picoboot_manifest_lock(fd, 1) < 0) {
+    fprintf(stderr, "%s: picoboot: cannot lock manifest \"%s\": %s\n",
+            progname, pd->manifest_file, strerror(errno));
+    fclose(f);
+    return -1;
+  }
+  /* the other devices may have been written since the load */
+  picoboot_manifest_scan(pgm, f, 0);
+  rewind(f);
+
+  fprintf(f, "# avrdude picoboot page manifest\n");
+  if (pd->others_len)
+    fputs(pd->others, f);
+  if (mine && pd->manifest_complete)
+    fprintf(f, "%s erased\n", pd->manifest_key);
+  for (i = 0; mine && i < pd->npages; i++)
+    fprintf(f, "%s %04x %08lx\n",
+            pd->manifest_key, pd->pages[i].addr, pd->pages[i].hash);
+  if (fflush(f) != 0 || ftruncate(fd, ftell(f)) < 0) {
+    fprintf(stderr, "%s: picoboot: cannot write manifest \"%s\": %s\n",
+            progname, pd->manifest_file, strerror(errno));
+    fclose(f);
+    return -1;
+  }
+  fclose(f);                    /* releases the lock */
+  return 0;
+}
+
+static int picoboot_manifest_save(PROGRAMMER * pgm)
+{
+  if (picoboot_manifest_write(pgm, 1) < 0)
+    return -1;
+  PDATA(pgm)->manifest_dirty = 0;
+  return 0;
+}
+
+/*
+ * Before the first page is erased, drop the entry of this device from
+ * the file: should the run end before close, the next one must not
+ * take pages for written, or for blank, that the erase has changed.
+ */
+static int picoboot_manifest_clear(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+
+  if (pd->manifest_file[0] == 0 || pd->manifest_cleared)
+    return 0;
+  if (picoboot_manifest_write(pgm, 0) < 0)
+    return -1;
+  pd->manifest_cleared = 1;
+  return 0;
+}
+
+static int picoboot_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+  LNODEID ln;
+  const char *extended_param;
+  struct pdata *pd = PDATA(pgm);
+  int rv = 0;
+
+  for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+    extended_param = ldata(ln);
+
+    if (strncmp(extended_param, "manifest=", strlen("manifest=")) == 0) {
+      const char *fn = extended_param + strlen("manifest=");
+      if (*fn == 0 || strlen(fn) >= sizeof(pd->manifest_file)) {
+        fprintf(stderr,
+                "%s: picoboot_parseextparms(): invalid manifest file '%s'\n",
+                progname, extended_param);
+        rv = -1;
+        continue;
+      }
+      strcpy(pd->manifest_file, fn);
+      continue;
+    }
+    if (strncmp(extended_param, "manifest_key=", strlen("manifest_key=")) == 0) {
+      const char *key = extended_param + strlen("manifest_key=");
+      if (*key == 0 || strlen(key) >= sizeof(pd->manifest_key) ||
+          strpbrk(key, " \t\n") != NULL) {
+        fprintf(stderr,
+                "%s: picoboot_parseextparms(): invalid manifest key '%s'\n",
+                progname, extended_param);
+        rv = -1;
+        continue;
+      }
+      strcpy(pd->manifest_key, key);
+      continue;
+    }
+    if (strcmp(extended_param, "full_erase") == 0) {
+      pd->full_erase = 1;
+      continue;
+    }
+    if (strcmp(extended_param, "no_fill_next") == 0) {
+      pd->no_fill_next = 1;
+      continue;
+    }
+    if (strcmp(extended_param, "no_crc") == 0) {
+      pd->no_crc = 1;
+      continue;
+    }
+    if (strcmp(extended_param, "upshift") == 0) {
+      pd->upshift = picoboot_rates[0];
+      continue;
+    }
+    if (strncmp(extended_param, "upshift=", strlen("upshift=")) == 0) {
+      char *e;
+      pd->upshift = strtol(extended_param + strlen("upshift="), &e, 0);
+      if (*e != 0 || pd->upshift <= 0) {
+        fprintf(stderr,
+                "%s: picoboot_parseextparms(): invalid baud rate in '%s'\n",
+                progname, extended_param);
+        pd->upshift = 0;
+        rv = -1;
+      }
+      continue;
+    }
+
+    fprintf(stderr,
+            "%s: picoboot_parseextparms(): invalid extended parameter '%s'\n",
+            progname, extended_param);
+    rv = -1;
+  }
+
+  return rv;
+}
+
 static void picoboot_not_implemented_1 (PROGRAMMER * pgm)
 {
   DEBUG_FUNC;
@@ -79,43 +518,82 @@ void picoboot_send_frame(union filedescriptor *fd, struct frame* f)
   serial_send(fd, buf, sizeof(*f));
 }
 
-int picoboot_wait_ack(union filedescriptor *fd)
+/* wait for count ACKs, collecting as many as possible per read */
+static int picoboot_wait_acks(union filedescriptor *fd, int count)
 {
-  char resp;
+  unsigned char resp[MAX_FRAMES];
+  int i, n;
 
-  if (serial_recv(fd, &resp, 1) < 0){
-    DEBUG("PICOBOOT: picoboot_wait_ack() response not received\n");
-    return -1;
+  while (count > 0) {
+    n = count > MAX_FRAMES ? MAX_FRAMES : count;
+    if (serial_recv(fd, resp, n) < 0){
+      DEBUG("PICOBOOT: picoboot_wait_ack() response not received\n");
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      if (resp[i] != 0) {
+        fprintf(stderr,
+          "\n%s: picoboot_wait_ack(): protocol error, "
+          "expect ACK=0x%02x, resp=0x%02x\n",
+          progname, 0, resp[i]);
+        return -1;
+      }
+    }
+    count -= n;
   }
-  else if (resp != 0) {
-    fprintf(stderr,
-      "\n%s: picoboot_wait_ack(): protocol error, "
-      "expect ACK=0x%02x, resp=0x%02x\n",
-      progname, 0, resp);
-    exit(1);
+
+  return 0;
+}
+
+int picoboot_wait_ack(union filedescriptor *fd)
+{
+  return picoboot_wait_acks(fd, 1);
+}
+
+/* send the queued frames, first waiting for just enough ACKs to keep
+ * no more than MAX_FRAMES in flight */
+static int picoboot_send_burst(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+  int excess;
+
+  if (pd->queued == 0)
+    return 0;
+
+  excess = pd->in_flight + pd->queued - MAX_FRAMES;
+  if (excess > 0) {
+    if (picoboot_wait_acks(&pgm->fd, excess) != 0) return -1;
+    pd->in_flight -= excess;
   }
 
+  serial_send(&pgm->fd, (unsigned char *)pd->txq,
+              pd->queued * sizeof(struct frame));
+  pd->in_flight += pd->queued;
+  pd->queued = 0;
   return 0;
 }
 
-/* send multiple frames back-to-back for higher serial throughput */
-int picoboot_buffered_send(union filedescriptor *fd, struct frame* f)
+/* queue a frame for windowed transmission for higher serial throughput */
+static int picoboot_buffered_send(PROGRAMMER * pgm, struct frame* f)
 {
-  static char buf[MAX_FRAMES * sizeof(*f)];
-  static char* bufp = buf;
-  int ack_count;
+  struct pdata *pd = PDATA(pgm);
 
   f->check = f->data_lo ^ f->data_hi ^ f->command;
-  memcpy (bufp, f, sizeof(*f));
-  bufp += sizeof(*f);
+  pd->txq[pd->queued++] = *f;
 
-  /* check for full buffer */
-  if ( bufp - buf == MAX_FRAMES * sizeof(*f)){
-    serial_send(fd, buf, bufp - buf);
-    bufp = buf;
-    for (ack_count = MAX_FRAMES; ack_count--;)
-      if (picoboot_wait_ack(fd) != 0) return -1;
-  }
+  if (pd->queued == BURST_FRAMES)
+    return picoboot_send_burst(pgm);
+  return 0;
+}
+
+/* send anything still queued, and wait until all frames are ACKed */
+static int picoboot_flush(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+
+  if (picoboot_send_burst(pgm) != 0) return -1;
+  if (picoboot_wait_acks(&pgm->fd, pd->in_flight) != 0) return -1;
+  pd->in_flight = 0;
   return 0;
 }
 
@@ -125,11 +603,24 @@ static int picoboot_open(PROGRAMMER * pgm, char * port)
 
   union pinfo pinfo;
   strcpy(pgm->port, port);
-  pinfo.baud = pgm->baudrate? pgm->baudrate: 230400;
+  pinfo.baud = pgm->baudrate? pgm->baudrate: PICOBOOT_BAUD;
+  PDATA(pgm)->baud = pinfo.baud;
   if (serial_open(port, pinfo, &pgm->fd)==-1) {
     return -1;
   }
 
+  if (PDATA(pgm)->manifest_file[0]) {
+    if (PDATA(pgm)->manifest_key[0] == 0)
+      strcpy(PDATA(pgm)->manifest_key, port);
+    picoboot_manifest_load(pgm);
+    if (pgm->fresh_device) {
+      /* the entry is that of the board before at this port */
+      PDATA(pgm)->npages = 0;
+      PDATA(pgm)->manifest_complete = 0;
+      PDATA(pgm)->manifest_dirty = 1;
+    }
+  }
+
   /* Clear DTR and RTS to unload the RESET capacitor 
    * (for example in Arduino) */
   /* serial_set_dtr_rts(&pgm->fd, 0);
@@ -141,15 +632,124 @@ static int picoboot_open(PROGRAMMER * pgm, char * port)
   return serial_drain(&pgm->fd, 1);
 }
 
+/*
+ * Send sync frames at the current speed; 0 if every one is ACKed,
+ * and, if jitter, with no ACK taking much longer than the quickest,
+ * which would hint at characters being lost or repeated by the link.
+ */
+static int picoboot_sync_test(PROGRAMMER * pgm, int jitter)
+{
+  struct frame f;
+  unsigned char resp;
+  double t, least = 0, most = 0;
+  int i;
+
+  serial_drain(&pgm->fd, 0);
+  memset(&f, 0, sizeof(f));
+  for (i = 0; i < UPSHIFT_SYNCS; i++) {
+    t = stats_time();
+    picoboot_send_frame(&pgm->fd, &f);
+    if (serial_recv(&pgm->fd, &resp, 1) < 0 || resp != 0)
+      return -1;
+    t = stats_time() - t;
+    if (i == 0 || t < least)
+      least = t;
+    if (t > most)
+      most = t;
+  }
+  if (jitter && most > UPSHIFT_JITTER * least) {
+    DEBUG("PICOBOOT: ACK delays %.1f to %.1f ms, link is marginal\n",
+          least * 1000, most * 1000);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* move to the fastest rate up to -x upshift that passes the sync test */
+static int picoboot_upshift(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+  long timeout = serial_recv_timeout;
+  int i, rc = -1;
+
+  serial_recv_timeout = UPSHIFT_TIMEOUT;
+  for (i = 0; i < sizeof(picoboot_rates) / sizeof(picoboot_rates[0]); i++) {
+    if (picoboot_rates[i] > pd->upshift || picoboot_rates[i] <= pd->baud)
+      continue;
+    DEBUG("PICOBOOT: trying %ld baud\n", picoboot_rates[i]);
+    if (serial_setspeed(&pgm->fd, picoboot_rates[i]) == 0 &&
+        picoboot_sync_test(pgm, 1) == 0) {
+      if (verbose)
+        fprintf(stderr, "%s: picoboot: using %ld baud\n",
+                progname, picoboot_rates[i]);
+      rc = 0;
+      break;
+    }
+  }
+  /* none is better, back to where we started, which worked before */
+  if (rc < 0 && (serial_setspeed(&pgm->fd, pd->baud) != 0 ||
+                 (rc = picoboot_sync_test(pgm, 0)) < 0))
+    fprintf(stderr,
+            "%s: picoboot_upshift(): no answer at %ld baud any more\n",
+            progname, pd->baud);
+  serial_recv_timeout = timeout;
+
+  return rc;
+}
+
 static int picoboot_initialize (PROGRAMMER * pgm, AVRPART * p)
 {
   DEBUG_FUNC;
 
   struct frame f;
+  unsigned char resp;
+
   memset (&f, 0, sizeof(f));
   /* send frame of zeros */
   picoboot_send_frame(&pgm->fd, &f);
-  return picoboot_wait_ack(&pgm->fd);
+  if (picoboot_wait_ack(&pgm->fd) != 0)
+    return -1;
+
+  if (PDATA(pgm)->upshift > 0) {
+    if (!(serdev->flags & SERDEV_FL_CANSETSPEED))
+      fprintf(stderr, "%s: picoboot: WARNING: port cannot change speed, "
+              "-x upshift ignored\n", progname);
+    else if (picoboot_upshift(pgm) < 0)
+      return -1;
+  }
+
+  PDATA(pgm)->fill_next = 0;
+  PDATA(pgm)->crc = 0;
+  if (PDATA(pgm)->no_fill_next && PDATA(pgm)->no_crc)
+    return 0;
+
+  /* ask for the protocol extensions */
+  f.data_lo = PROBE_LO;
+  f.data_hi = PROBE_HI;
+  f.command = CMD_DATA;
+  picoboot_send_frame(&pgm->fd, &f);
+  if (serial_recv(&pgm->fd, &resp, 1) < 0) {
+    DEBUG("PICOBOOT: picoboot_initialize() probe response not received\n");
+    return -1;
+  }
+  if ((resp & ~(PROTO_FILL_NEXT | PROTO_CRC)) != 0) {
+    fprintf(stderr,
+      "\n%s: picoboot_initialize(): protocol error, "
+      "unexpected probe response 0x%02x\n",
+      progname, resp);
+    return -1;
+  }
+  PDATA(pgm)->fill_next = !PDATA(pgm)->no_fill_next && (resp & PROTO_FILL_NEXT);
+  PDATA(pgm)->crc = !PDATA(pgm)->no_crc && (resp & PROTO_CRC);
+  if (verbose) {
+    fprintf(stderr, "%s: picoboot: bootloader %s auto-increment fill\n",
+            progname, (resp & PROTO_FILL_NEXT)? "supports": "does not support");
+    fprintf(stderr, "%s: picoboot: bootloader %s range CRC\n",
+            progname, (resp & PROTO_CRC)? "supports": "does not support");
+  }
+
+  return 0;
 }
 
 static int picoboot_read_sig_bytes(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
@@ -169,30 +769,76 @@ static int picoboot_read_sig_bytes(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
 int picoboot_erase_page (PROGRAMMER * pgm, int page_addr)
 {
   struct frame f;
-  union filedescriptor *fd = &pgm->fd;
 
   f.data_lo = page_addr & 0xff;
   f.data_hi = (page_addr & 0xff00) >> 8;
-  f.command = 0x03; /* erase page */
-  picoboot_send_frame(fd, &f);
-  if (picoboot_wait_ack(fd) != 0) return -1;
-  return 0;
+  f.command = CMD_ERASE;
+  if (picoboot_manifest_clear(pgm) != 0) return -1;
+  /* nothing may be sent while the page is being erased */
+  if (picoboot_buffered_send(pgm, &f) != 0) return -1;
+  return picoboot_flush(pgm);
 }
 
 /* erase flash from top down */
+static int picoboot_erase_all(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+  uint16_t page_addr = pd->flash_top;
+
+  /* what an erase stopped half way leaves is not known */
+  if (pd->manifest_file[0]) {
+    pd->npages = 0;
+    pd->manifest_complete = 0;
+    pd->manifest_dirty = 1;
+  }
+  do {
+    page_addr -= pd->flash_pagesize;
+    if (picoboot_erase_page(pgm, page_addr)) return -1;
+  } while (page_addr);
+
+  memset(pd->blank, 1, pd->flash_top / pd->flash_pagesize);
+  if (pd->manifest_file[0])
+    pd->manifest_complete = 1;
+  return 0;
+}
+
+/*
+ * Where the manifest knows every page that is not blank, and -x
+ * full_erase is not given, the chip erase is only planned here: the
+ * pages in the manifest are erased right before they are written, and
+ * those no write of the session touched at close.  Otherwise all of
+ * flash is erased.  Either way, only the pages in pd->blank are left
+ * unerased by a later write, so writes that follow in the same session
+ * (as in -S server mode) still erase every page they reuse.
+ */
 static int picoboot_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
-  uint16_t page_addr;
+  struct pdata *pd = PDATA(pgm);
   AVRMEM* m;
+  int i;
   DEBUG_FUNC;
 
   m = avr_locate_mem(p, "flash");
-  page_addr = (m->page_size * m->num_pages) - BOOTLOADER_SIZE + 2; 
-  do {
-    page_addr -= m->page_size;
-    if (picoboot_erase_page(pgm, page_addr)) return -1;
-  } while (page_addr);
+  pd->flash_pagesize = m->page_size;
+  pd->flash_top = (m->page_size * m->num_pages) - BOOTLOADER_SIZE + 2;
+  if (pd->blank == NULL &&
+      (pd->blank = calloc(m->num_pages, 1)) == NULL) {
+    fprintf(stderr, "%s: picoboot: out of memory\n", progname);
+    return -1;
+  }
+
+  if (pd->full_erase || !pd->manifest_complete)
+    return picoboot_erase_all(pgm);
 
+  pd->erase_deferred = 1;
+  memset(pd->blank, 1, pd->flash_top / pd->flash_pagesize);
+  for (i = 0; i < pd->npages; i++) {
+    pd->blank[pd->pages[i].addr / pd->flash_pagesize] = 0;
+    pd->pages[i].touched = 0;
+  }
+  if (verbose)
+    fprintf(stderr, "%s: picoboot: chip erase deferred to the pages written\n",
+            progname);
   return 0;
 }
 
@@ -204,9 +850,10 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 {
   uint16_t appstart, vrst_vec_addr =
     m->size - BOOTLOADER_SIZE;
+  uint16_t vrst_vec_page = vrst_vec_addr - page_size +2;
+  struct pdata *pd = PDATA(pgm);
   struct frame f;
-  union filedescriptor *fd = &pgm->fd;
- 
+
   int fill_page_buf (uint16_t page_addr)
   {
     uint16_t cur_addr = page_addr;
@@ -215,13 +862,19 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     for (;cur_addr < (page_addr + page_size); cur_addr+=2 ){
       f.data_lo = m->buf[cur_addr];
       f.data_hi = m->buf[cur_addr+1];
-      f.command = 0;
-      picoboot_buffered_send(fd, &f);
+      if (PDATA(pgm)->fill_next && cur_addr != page_addr) {
+        /* one frame per word, address implied */
+        f.command = CMD_FILL_NEXT;
+        if (picoboot_buffered_send(pgm, &f) != 0) return -1;
+        continue;
+      }
+      f.command = CMD_DATA;
+      if (picoboot_buffered_send(pgm, &f) != 0) return -1;
 
       f.data_lo = cur_addr & 0xff;
       f.data_hi = (cur_addr & 0xff00) >> 8;
-      f.command = 0x01; /* fill temp buffer */
-      picoboot_buffered_send(fd, &f);
+      f.command = CMD_FILL;
+      if (picoboot_buffered_send(pgm, &f) != 0) return -1;
     }
     return 0;
   }
@@ -230,9 +883,35 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   {
     f.data_lo = page_addr & 0xff;
     f.data_hi = (page_addr & 0xff00) >> 8;
-    f.command = 0x05; /* write page */
-    picoboot_send_frame(fd, &f);
-    if (picoboot_wait_ack(fd) != 0) return -1;
+    f.command = CMD_WRITE;
+    /* goes out behind the page fill frames; nothing else may be sent
+     * while the page is being programmed */
+    if (picoboot_buffered_send(pgm, &f) != 0) return -1;
+    return picoboot_flush(pgm);
+  }
+
+  int program_page (uint16_t page_addr)
+  {
+    unsigned long hash = picoboot_page_hash(m->buf + page_addr, page_size);
+    int complete = pd->manifest_complete;
+
+    if (picoboot_manifest_match(pgm, page_addr, hash)) {
+      DEBUG("\nPICOBOOT: page 0x%04X unchanged, skipped\n", page_addr);
+      return 0;
+    }
+    picoboot_manifest_forget(pgm, page_addr);
+    /* until it is written, the page holds neither old nor new data */
+    pd->manifest_complete = 0;
+    if (pd->blank == NULL || !pd->blank[page_addr / page_size]) {
+      /* holds data, from before or from an earlier write */
+      if (picoboot_erase_page(pgm, page_addr) != 0) return -1;
+    } else {
+      pd->blank[page_addr / page_size] = 0;
+    }
+    if (fill_page_buf(page_addr) != 0) return -1;
+    if (write_page(page_addr) != 0) return -1;
+    picoboot_manifest_record(pgm, page_addr, hash);
+    pd->manifest_complete = complete;
     return 0;
   }
 
@@ -258,8 +937,6 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   }
 
   if ( addr == 0 ) {
-    uint16_t vrst_vec_page = vrst_vec_addr - page_size +2;
-
     /* save and redirect reset app vector */
     appstart = *((uint8_t *)m->buf) | 
                *((uint8_t *)m->buf +1 ) << 8; 
@@ -277,8 +954,7 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     m->buf[1] = ((vrst_vec_addr/2) | 0xC000) >> 8;
 
     /* write page 0 */
-    if (fill_page_buf(addr) != 0) return -1;
-    if (write_page(addr) != 0) return -1;
+    if (program_page(addr) != 0) return -1;
 
     /* calculate new rjmp for appstart */
     appstart = 0xc000 |
@@ -288,20 +964,91 @@ static int picoboot_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     DEBUG("\nPICOBOOT: virtual reset vector 0x%04x at 0x%04x.\n",
           appstart, vrst_vec_addr);
 
-    if (fill_page_buf(vrst_vec_page) != 0) return -1;
-    if (write_page(vrst_vec_page) != 0) return -1;
+    if (program_page(vrst_vec_page) != 0) return -1;
   }
   else {
-    if (fill_page_buf(addr) != 0) return -1;
-    if (write_page(addr) != 0) return -1;
+    if (program_page(addr) != 0) return -1;
   }
 
   return num_bytes;
 }
 
+/*
+ * Verify len bytes of flash from addr by the bootloader's CRC.  The
+ * device holds the jump to the bootloader at the reset vector, not the
+ * one in m->buf; nothing from the virtual reset vector up can be
+ * written from the image, so it is not compared.
+ */
+static int picoboot_verify_range(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                 unsigned long addr, unsigned long len)
+{
+  uint16_t vrst_vec_addr = m->size - BOOTLOADER_SIZE;
+  unsigned char resp[2], rjmp[2];
+  unsigned short crc;
+  unsigned long i;
+  struct frame f;
+
+  DEBUG_FUNC;
+
+  if (!PDATA(pgm)->crc || strcmp(m->desc, "flash") != 0)
+    return -1;
+  if (addr >= vrst_vec_addr)
+    return 0;
+  if (addr + len > vrst_vec_addr)
+    len = vrst_vec_addr - addr;
+
+  rjmp[0] = (vrst_vec_addr/2) & 0x00FF;
+  rjmp[1] = ((vrst_vec_addr/2) | 0xC000) >> 8;
+  crc = CRC_INIT;
+  for (i = addr; i < addr + len && i < 2; i++)
+    crc = crcsum(rjmp + i, 1, crc);
+  crc = crcsum(m->buf + i, addr + len - i, crc);
+
+  if (picoboot_flush(pgm) != 0) return -1;
+  f.data_lo = len & 0xff;
+  f.data_hi = (len & 0xff00) >> 8;
+  f.command = CMD_DATA;
+  picoboot_send_frame(&pgm->fd, &f);
+  if (picoboot_wait_ack(&pgm->fd) != 0) return -1;
+  f.data_lo = addr & 0xff;
+  f.data_hi = (addr & 0xff00) >> 8;
+  f.command = CMD_CRC;
+  picoboot_send_frame(&pgm->fd, &f);
+  if (serial_recv(&pgm->fd, resp, 2) < 0) {
+    DEBUG("PICOBOOT: picoboot_verify_range() CRC not received\n");
+    return -1;
+  }
+
+  DEBUG("PICOBOOT: CRC of 0x%04lX..0x%04lX 0x%04X, expected 0x%04X\n",
+        addr, addr + len - 1, resp[0] | (resp[1] << 8), crc);
+  return (resp[0] | (resp[1] << 8)) == crc? 0: 1;
+}
+
 static void picoboot_close(PROGRAMMER * pgm)
 {
+  struct pdata *pd = PDATA(pgm);
+  int i;
+
   DEBUG_FUNC;
+
+  if (pd->erase_deferred) {
+    /* pages from the manifest that are not part of this session's
+     * image still hold old data */
+    for (i = 0; i < pd->npages; ) {
+      unsigned int addr = pd->pages[i].addr;
+      if (pd->pages[i].touched) {
+        i++;
+        continue;
+      }
+      picoboot_manifest_forget(pgm, addr);
+      if (picoboot_erase_page(pgm, addr) != 0)
+        break;
+    }
+    pd->erase_deferred = 0;
+  }
+  if (pd->manifest_dirty)
+    picoboot_manifest_save(pgm);
+
   serial_close(&pgm->fd);
   pgm->fd.ifd = -1;
 }
@@ -313,6 +1060,8 @@ void picoboot_initpgm(PROGRAMMER * pgm)
   DEBUG_FUNC;
 
   strcpy(pgm->type, "Picoboot");
+  pgm->setup    = picoboot_setup;
+  pgm->teardown = picoboot_teardown;
   pgm->open     = picoboot_open;
   pgm->enable   = picoboot_not_implemented_1;
   pgm->disable  = picoboot_not_implemented_1;
@@ -325,4 +1074,7 @@ void picoboot_initpgm(PROGRAMMER * pgm)
 
   /* optional functions */
   pgm->paged_write    = picoboot_paged_write;
+  pgm->verify_range   = picoboot_verify_range;
+  pgm->page_write_erases = 1;
+  pgm->parseextparams = picoboot_parseextparms;
 }
@@ -0,0 +1,112 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Throughput of the programmers of a pool.
+ *
+ * In continuous mode with several -P ports, every programmer takes
+ * boards as they come.  How long a good board took is averaged per
+ * programmer and part and kept in a small file, so that the next run
+ * knows which of the programmers waiting for a board is the fastest
+ * one for the part.
+ */
+
+#include "ac_cfg.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "avrdude.h"
+#include "cachefile.h"
+#include "pool.h"
+
+#define POOL_WEIGHT   20        /* boards the average is taken over */
+
+static char pool_file[PATH_MAX];
+
+
+void pool_cache(const char * file)
+{
+  snprintf(pool_file, sizeof(pool_file), "%s", file);
+}
+
+/* "<programmer> <part>", or empty if it cannot be a cache key */
+static void pool_key(const char * pgmid, const char * partid,
+                     char * key, size_t len)
+{
+  const char * s;
+
+  key[0] = 0;
+  for (s = pgmid; *s != 0; s++)
+    if (isspace((int)*s))
+      return;
+  if (snprintf(key, len, "%s %s", pgmid, partid) >= len)
+    key[0] = 0;
+}
+
+/*
+ * The cache file holds "<key> <boards> <seconds>" lines.  Returns the
+ * number of boards, 0 if not found.
+ */
+static int pool_find(const char * key, double * secs)
+{
+  char value[64];
+  int boards;
+  double s;
+
+  if (cachefile_lookup(pool_file, key, value, sizeof(value)) < 0 ||
+      sscanf(value, "%d %lf", &boards, &s) != 2 || boards <= 0 || s <= 0)
+    return 0;
+  *secs = s;
+
+  return boards;
+}
+
+double pool_lookup(const char * pgmid, const char * partid)
+{
+  char key[256];
+  double secs;
+
+  pool_key(pgmid, partid, key, sizeof(key));
+  return pool_find(key, &secs) > 0? secs: 0;
+}
+
+void pool_remember(const char * pgmid, const char * partid, double secs)
+{
+  char key[256], value[64];
+  double avg = 0;
+  int boards;
+
+  pool_key(pgmid, partid, key, sizeof(key));
+  if (pool_file[0] == 0 || key[0] == 0)
+    return;
+
+  /* a running average, which follows when the setup changes */
+  boards = pool_find(key, &avg);
+  if (boards < POOL_WEIGHT)
+    boards++;
+  avg += (secs - avg) / boards;
+
+  snprintf(value, sizeof(value), "%d %.3f", boards, avg);
+  cachefile_remember(pool_file, key, value, "programmer pool cache");
+}
@@ -0,0 +1,44 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef pool_h
+#define pool_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* file remembering how long each programmer took per board */
+void pool_cache(const char * file);
+
+/*
+ * Seconds a good board of part partid took with programmer pgmid,
+ * on average, or 0 if that is not known yet.
+ */
+double pool_lookup(const char * pgmid, const char * partid);
+
+/* add a good board that took secs */
+void pool_remember(const char * pgmid, const char * partid, double secs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
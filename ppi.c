@@ -129,6 +129,26 @@ int ppi_clr(union filedescriptor *fdp, int reg, int bit)
 }
 
 
+/*
+ * set the bits in mask of the specified register to those of val,
+ * with a single write.
+ */
+int ppi_setbits(union filedescriptor *fdp, int reg, int mask, int val)
+{
+  unsigned char v;
+  int rc;
+
+  rc = ppi_shadow_access(fdp, reg, &v, PPI_SHADOWREAD);
+  v = (v & ~mask) | (val & mask);
+  rc |= ppi_shadow_access(fdp, reg, &v, PPI_WRITE);
+
+  if (rc)
+    return -1;
+
+  return 0;
+}
+
+
 /*
  * get the indicated bit of the specified register.
  */
@@ -213,6 +233,7 @@ void ppi_open(char * port, union filedescriptor *fdp)
   }
 
   ppi_claim (fd);
+  fdp->ifd = fd;
 
   /*
    * Initialize shadow registers
@@ -221,8 +242,6 @@ void ppi_open(char * port, union filedescriptor *fdp)
   ppi_shadow_access (fdp, PPIDATA, &v, PPI_READ);
   ppi_shadow_access (fdp, PPICTRL, &v, PPI_READ);
   ppi_shadow_access (fdp, PPISTATUS, &v, PPI_READ);
-
-  fdp->ifd = fd;
 }
 
 
@@ -40,6 +40,8 @@ int ppi_set       (union filedescriptor *fdp, int reg, int bit);
 
 int ppi_clr       (union filedescriptor *fdp, int reg, int bit);
 
+int ppi_setbits   (union filedescriptor *fdp, int reg, int mask, int val);
+
 int ppi_getall    (union filedescriptor *fdp, int reg);
 
 int ppi_setall    (union filedescriptor *fdp, int reg, int val);
@@ -78,6 +78,12 @@ static unsigned char reg2offset(int reg);
 static unsigned char inb(unsigned short port);
 static void outb(unsigned char value, unsigned short port);
 
+/*
+ * Last value written to, or read from, each register, so changing a
+ * bit is a single outb() instead of an inb() and an outb().
+ */
+static unsigned char shadow[3];
+
 
 
 /* FUNCTION DEFINITIONS */
@@ -133,6 +139,10 @@ void ppi_open(char *port, union filedescriptor *fdp)
     }
 
     fdp->ifd = fd;
+
+    /* Initialize shadow registers */
+    for(i = PPIDATA; i <= PPISTATUS; i++)
+        shadow[i] = inb(port_get(fdp, i));
 }
 
 
@@ -189,13 +199,8 @@ void ppi_close(union filedescriptor *fdp)
  */
 int ppi_set(union filedescriptor *fdp, int reg, int bit)
 {
-    unsigned char v;
-    unsigned short port;
-
-    port = port_get(fdp, reg);
-    v = inb(port);
-    v |= bit;
-    outb(v, port);
+    shadow[reg] |= bit;
+    outb(shadow[reg], port_get(fdp, reg));
     return 0;
 }
 
@@ -205,13 +210,21 @@ int ppi_set(union filedescriptor *fdp, int reg, int bit)
  */
 int ppi_clr(union filedescriptor *fdp, int reg, int bit)
 {
-    unsigned char v;
-    unsigned short port;
+    shadow[reg] &= ~bit;
+    outb(shadow[reg], port_get(fdp, reg));
 
-    port = port_get(fdp, reg);
-    v = inb(port);
-    v &= ~bit;
-    outb(v, port);
+    return 0;
+}
+
+
+/*
+ * set the bits in mask of the specified register to those of val,
+ * with a single write.
+ */
+int ppi_setbits(union filedescriptor *fdp, int reg, int mask, int val)
+{
+    shadow[reg] = (shadow[reg] & ~mask) | (val & mask);
+    outb(shadow[reg], port_get(fdp, reg));
 
     return 0;
 }
@@ -225,6 +238,7 @@ int ppi_get(union filedescriptor *fdp, int reg, int bit)
     unsigned char v;
 
     v = inb(port_get(fdp, reg));
+    shadow[reg] = v;
     v &= bit;
 
     return(v);
@@ -238,14 +252,8 @@ int ppi_get(union filedescriptor *fdp, int reg, int bit)
  */
 int ppi_toggle(union filedescriptor *fdp, int reg, int bit)
 {
-    unsigned char v;
-    unsigned short port;
-
-    port = port_get(fdp, reg);
-
-    v = inb(port);
-    v ^= bit;
-    outb(v, port);
+    shadow[reg] ^= bit;
+    outb(shadow[reg], port_get(fdp, reg));
 
     return 0;
 }
@@ -259,6 +267,7 @@ int ppi_getall(union filedescriptor *fdp, int reg)
     unsigned char v;
 
     v = inb(port_get(fdp, reg));
+    shadow[reg] = v;
 
     return((int)v);
 }
@@ -271,7 +280,8 @@ int ppi_getall(union filedescriptor *fdp, int reg)
  */
 int ppi_setall(union filedescriptor *fdp, int reg, int val)
 {
-    outb((unsigned char)val, port_get(fdp, reg));
+    shadow[reg] = (unsigned char)val;
+    outb(shadow[reg], port_get(fdp, reg));
     return 0;
 }
 
@@ -0,0 +1,380 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Replay of a wire-level trace written by -j: with a port name of
+ * "replay:<tracefile>", a serial programmer gets the answers of the
+ * recorded session instead of talking to a device, so its real
+ * protocol code runs the same way each time, without any hardware.
+ *
+ * What avrdude sends is compared with the recorded requests; at the
+ * first difference the replay stops, and every transfer fails from
+ * there on.  Recorded failures, such as receive timeouts, fail again
+ * at the same place.  The answers come at once, or with ":timed"
+ * after the port name as long after the preceding request as they
+ * did in the recorded session.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "avrdude.h"
+#include "pgm.h"
+#include "serial.h"
+#include "replay.h"
+#include "trace.h"
+
+struct replay_rec {
+  int type;
+  size_t len;
+  unsigned long long end;       /* trace time at the end */
+  const unsigned char * data;
+};
+
+struct replay {
+  unsigned char * image;        /* the trace file */
+  struct replay_rec * rec;
+  unsigned long nrec;
+  unsigned long cur;            /* next record */
+  size_t off;                   /* bytes of it already used */
+  int timed;
+  int failed;
+  /* the trace time of the last request, and when it was replayed */
+  unsigned long long sent_trace, sent_now;
+};
+
+/* replays open; a programmer that bypasses serdev never opens one */
+static int replay_open_count;
+
+
+static unsigned long long replay_get(const unsigned char * p, int n)
+{
+  unsigned long long v = 0;
+
+  while (n-- > 0)
+    v = (v << 8) | p[n];
+  return v;
+}
+
+static int replay_load(struct replay * r, const char * file)
+{
+  FILE * f;
+  size_t size, alloced, n, pos;
+  unsigned long long t;
+
+  if ((f = fopen(file, "rb")) == NULL) {
+    fprintf(stderr, "%s: replay: can't open trace file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+  for (size = 0, alloced = 0; ; size += n) {
+    if (size == alloced) {
+      alloced = alloced? 2 * alloced: 64 * 1024;
+      if ((r->image = realloc(r->image, alloced)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+    }
+    if ((n = fread(r->image + size, 1, alloced - size, f)) == 0)
+      break;
+  }
+  if (ferror(f)) {
+    fprintf(stderr, "%s: replay: can't read trace file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  if (size < TRACE_HDRLEN || memcmp(r->image, TRACE_MAGIC, 6) != 0 ||
+      r->image[6] != TRACE_VERSION) {
+    fprintf(stderr, "%s: replay: \"%s\" is not an avrdude trace\n",
+            progname, file);
+    return -1;
+  }
+
+  /* two passes: count the records, then set them up */
+  for (pos = TRACE_HDRLEN; pos + TRACE_RECLEN <= size; r->nrec++)
+    pos += TRACE_RECLEN + replay_get(r->image + pos + 1, 2);
+  if (pos != size) {
+    fprintf(stderr, "%s: replay: trace file \"%s\" is truncated\n",
+            progname, file);
+    return -1;
+  }
+  if ((r->rec = malloc((r->nrec + 1) * sizeof(*r->rec))) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  t = replay_get(r->image + 8, 8);
+  r->sent_trace = t;
+  for (pos = TRACE_HDRLEN, n = 0; n < r->nrec; n++) {
+    const unsigned char * p = r->image + pos;
+
+    t += replay_get(p + 3, 4);
+    r->rec[n].type = p[0];
+    r->rec[n].len = replay_get(p + 1, 2);
+    r->rec[n].end = t + replay_get(p + 7, 4);
+    r->rec[n].data = p + TRACE_RECLEN;
+    pos += TRACE_RECLEN + r->rec[n].len;
+  }
+
+  return 0;
+}
+
+static void replay_diverged(struct replay * r, const char * what)
+{
+  fprintf(stderr, "%s: replay: %s at trace record %lu\n",
+          progname, what, r->cur + 1);
+  r->failed = 1;
+}
+
+/* with ":timed", wait until the answer in rec would have come */
+static void replay_wait(struct replay * r, const struct replay_rec * rec)
+{
+  unsigned long long until, now;
+
+  if (!r->timed || rec->end <= r->sent_trace)
+    return;
+  until = r->sent_now + (rec->end - r->sent_trace);
+  while ((now = trace_time()) < until)
+    usleep(until - now);
+}
+
+/*
+ * The record the next transfer of type (TRACE_TX or TRACE_RX) goes
+ * with, or NULL if the transfer is to fail: it failed in the trace,
+ * or it is not what happened next there.
+ */
+static struct replay_rec * replay_expect(struct replay * r, int type)
+{
+  struct replay_rec * rec = r->rec + r->cur;
+
+  if (r->failed)
+    return NULL;
+  if (r->cur == r->nrec) {
+    replay_diverged(r, type == TRACE_TX?
+                    "request after the end of the trace":
+                    "receive after the end of the trace");
+    return NULL;
+  }
+  if (rec->type == type + (TRACE_TX_ERROR - TRACE_TX) && r->off == 0) {
+    /* one failed transfer in the trace fails one transfer here */
+    if (type == TRACE_RX)
+      replay_wait(r, rec);
+    r->cur++;
+    return NULL;
+  }
+  if (rec->type != type) {
+    replay_diverged(r, type == TRACE_TX?
+                    "request where the trace receives":
+                    "receive where the trace sends a request");
+    return NULL;
+  }
+
+  return rec;
+}
+
+static void replay_advance(struct replay * r, struct replay_rec * rec,
+                           size_t n)
+{
+  if ((r->off += n) == rec->len) {
+    r->cur++;
+    r->off = 0;
+  }
+}
+
+
+int replay_port(const char * port)
+{
+  return strncmp(port, "replay:", 7) == 0;
+}
+
+int replay_attach(PROGRAMMER * pgm)
+{
+  if (pgm->conntype == CONNTYPE_PARALLEL) {
+    fprintf(stderr,
+            "%s: replay: programmer type \"%s\" does not use a serial port\n",
+            progname, pgm->type);
+    return -1;
+  }
+  serdev = &replay_serdev;
+
+  return 0;
+}
+
+int replay_active(void)
+{
+  return replay_open_count > 0;
+}
+
+
+static int replay_open(char * port, union pinfo pinfo,
+                       union filedescriptor * fd)
+{
+  struct replay * r;
+  char * file, * e;
+  int rv;
+
+  if ((r = calloc(1, sizeof(*r))) == NULL ||
+      (file = strdup(port + 7)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  if ((e = strrchr(file, ':')) != NULL && strcmp(e, ":timed") == 0) {
+    *e = 0;
+    r->timed = 1;
+  }
+
+  rv = replay_load(r, file);
+  free(file);
+  if (rv < 0) {
+    free(r->image);
+    free(r->rec);
+    free(r);
+    return -1;
+  }
+  r->sent_now = trace_time();
+  fd->pfd = r;
+  replay_open_count++;
+
+  return 0;
+}
+
+static int replay_setspeed(union filedescriptor * fd, long baud)
+{
+  return 0;
+}
+
+static void replay_close(union filedescriptor * fd)
+{
+  struct replay * r = fd->pfd;
+
+  if (r == NULL)
+    return;
+  if (!r->failed && r->cur < r->nrec)
+    fprintf(stderr, "%s: replay: %lu of %lu trace records not replayed\n",
+            progname, r->nrec - r->cur, r->nrec);
+  free(r->image);
+  free(r->rec);
+  free(r);
+  fd->pfd = NULL;
+  replay_open_count--;
+}
+
+static int replay_send(union filedescriptor * fd, unsigned char * buf,
+                       size_t buflen)
+{
+  struct replay * r = fd->pfd;
+  struct replay_rec * rec;
+  size_t n;
+
+  /* a request may span records, and a record requests */
+  do {
+    if ((rec = replay_expect(r, TRACE_TX)) == NULL)
+      return -1;
+    n = rec->len - r->off;
+    if (n > buflen)
+      n = buflen;
+    if (memcmp(rec->data + r->off, buf, n) != 0) {
+      char what[80];
+      size_t i;
+
+      for (i = 0; buf[i] == rec->data[r->off + i]; i++)
+        ;
+      sprintf(what, "request byte 0x%02x differs from 0x%02x, offset %lu,",
+              buf[i], rec->data[r->off + i], (unsigned long)(r->off + i));
+      replay_diverged(r, what);
+      return -1;
+    }
+    buf += n;
+    buflen -= n;
+    replay_advance(r, rec, n);
+  } while (buflen > 0);
+
+  r->sent_trace = rec->end;
+  r->sent_now = trace_time();
+
+  return 0;
+}
+
+static int replay_sendv(union filedescriptor * fd,
+                        const struct serial_iov * iov, int iovcnt)
+{
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    if (replay_send(fd, iov[i].buf, iov[i].len) < 0)
+      return -1;
+
+  return 0;
+}
+
+static int replay_recv(union filedescriptor * fd, unsigned char * buf,
+                       size_t buflen)
+{
+  struct replay * r = fd->pfd;
+  struct replay_rec * rec;
+  size_t n;
+
+  do {
+    if ((rec = replay_expect(r, TRACE_RX)) == NULL)
+      return -1;
+    n = rec->len - r->off;
+    if (n > buflen)
+      n = buflen;
+    replay_wait(r, rec);
+    memcpy(buf, rec->data + r->off, n);
+    buf += n;
+    buflen -= n;
+    replay_advance(r, rec, n);
+  } while (buflen > 0);
+
+  return 0;
+}
+
+/* drain() is not traced, so there is nothing to replay */
+static int replay_drain(union filedescriptor * fd, int display)
+{
+  return 0;
+}
+
+static int replay_set_dtr_rts(union filedescriptor * fd, int is_on)
+{
+  return 0;
+}
+
+struct serial_device replay_serdev =
+{
+  .open = replay_open,
+  .setspeed = replay_setspeed,
+  .close = replay_close,
+  .send = replay_send,
+  .sendv = replay_sendv,
+  .recv = replay_recv,
+  .drain = replay_drain,
+  .set_dtr_rts = replay_set_dtr_rts,
+  .flags = SERDEV_FL_CANSETSPEED,
+};
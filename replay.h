@@ -0,0 +1,52 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef replay_h
+#define replay_h
+
+#include "pgm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the serial device answering from a trace written by -j */
+extern struct serial_device replay_serdev;
+
+/* nonzero if port names a trace to replay, "replay:<file>[:timed]" */
+int replay_port(const char * port);
+
+/*
+ * Make the serial programmer pgm talk to replay_serdev; returns -1 if
+ * pgm is a parallel port programmer.
+ */
+int replay_attach(PROGRAMMER * pgm);
+
+/*
+ * Nonzero while a replay is open, so after pgm->open() tells whether
+ * the programmer went through the serial device at all.
+ */
+int replay_active(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
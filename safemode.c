@@ -77,246 +77,69 @@ int safemode_writefuse (unsigned char fuse, char * fusename, PROGRAMMER * pgm,
 /* 
  * Reads the fuses three times, checking that all readings are the
  * same. This will ensure that the before values aren't in error! 
+ * Each reading fetches all fuses the part has in one go.
  */
 int safemode_readfuses (unsigned char * lfuse, unsigned char * hfuse, 
                         unsigned char * efuse, unsigned char * fuse, 
                         PROGRAMMER * pgm, AVRPART * p, int verbose)  
 {
-
-  unsigned char value;
-  unsigned char fusegood = 0;
-  unsigned char allowfuseread = 1;
-  unsigned char safemode_lfuse;
-  unsigned char safemode_hfuse;
-  unsigned char safemode_efuse;
-  unsigned char safemode_fuse;
-  AVRMEM * m;
-  
-  safemode_lfuse = *lfuse;
-  safemode_hfuse = *hfuse;
-  safemode_efuse = *efuse;
-  safemode_fuse  = *fuse;
-
-
-  /* Read fuse three times */ 
-  fusegood = 2; /* If AVR device doesn't support this fuse, don't want
-                   to generate a verify error */
-  m = avr_locate_mem(p, "fuse");
-  if (m != NULL) {
-    fusegood = 0; /* By default fuse is a failure */
-    if(pgm->read_byte(pgm, p, m, 0, &safemode_fuse) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 1, fuse value: %x\n",progname, safemode_fuse);
-		}
-    if(pgm->read_byte(pgm, p, m, 0, &value) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 2, fuse value: %x\n",progname,  value);
-		}
-    if (value == safemode_fuse) {
-        if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-            {
-            allowfuseread = 0;
-            }
-		if (verbose > 2)
-			{
-			fprintf(stderr, "%s: safemode read 3, fuse value: %x\n",progname,  value);
-			}
-        if (value == safemode_fuse)
-            {
-            fusegood = 1; /* Fuse read OK three times */
-            }
-    }
-  } 
-
-	//Programmer does not allow fuse reading.... no point trying anymore
-    if (allowfuseread == 0)
-		{
-		return -5;
-		}
-
-    if (fusegood == 0)   {
-        fprintf(stderr,
-           "%s: safemode: Verify error - unable to read fuse properly. "
-           "Programmer may not be reliable.\n", progname);
-        return -1;
-    }
-    else if ((fusegood == 1) && (verbose > 0)) {
-        fprintf(stderr, "%s: safemode: fuse reads as %X\n", progname, safemode_fuse);
-    }
-
-
-  /* Read lfuse three times */  
-  fusegood = 2; /* If AVR device doesn't support this fuse, don't want
-                   to generate a verify error */
-  m = avr_locate_mem(p, "lfuse");
-  if (m != NULL) {
-    fusegood = 0; /* By default fuse is a failure */
-    if (pgm->read_byte(pgm, p, m, 0, &safemode_lfuse) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 1, lfuse value: %x\n",progname,  safemode_lfuse);
-		}
-    if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 2, lfuse value: %x\n",progname,  value);
-		}
-    if (value == safemode_lfuse) {
-        if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-            {
-            allowfuseread = 0;
-            }
-		if (verbose > 2)
-			{
-			fprintf(stderr, "%s: safemode read 3, lfuse value: %x\n",progname,  value);
-			}
-        if (value == safemode_lfuse){
-        fusegood = 1; /* Fuse read OK three times */
-        }
+  static const char * fusenames[] = { "fuse", "lfuse", "hfuse", "efuse" };
+  static const int fuseerrors[] = { -1, -1, -2, -3 };
+  unsigned char * fuses[4];
+  unsigned char fusegood[4];
+  unsigned char first[4], value[4];
+  AVRMEM * mems[4];
+  unsigned long addrs[4];
+  int idx[4];
+  int i, n, tries;
+
+  fuses[0] = fuse;
+  fuses[1] = lfuse;
+  fuses[2] = hfuse;
+  fuses[3] = efuse;
+
+  for (i = n = 0; i < 4; i++) {
+    fusegood[i] = 2; /* If AVR device doesn't support this fuse, don't want
+                        to generate a verify error */
+    if ((mems[n] = avr_locate_mem(p, (char *)fusenames[i])) != NULL) {
+      fusegood[i] = 1;
+      addrs[n] = 0;
+      idx[n++] = i;
     }
   }
 
-	//Programmer does not allow fuse reading.... no point trying anymore
-    if (allowfuseread == 0)
-		{
-		return -5;
-		}
-
-
-    if (fusegood == 0)	 {
-        fprintf(stderr,
-           "%s: safemode: Verify error - unable to read lfuse properly. "
-           "Programmer may not be reliable.\n", progname);
-        return -1;
-    }
-    else if ((fusegood == 1) && (verbose > 0)) {
-        fprintf(stderr, "%s: safemode: lfuse reads as %X\n", progname, safemode_lfuse);
-    }
-
-  /* Read hfuse three times */  
-  fusegood = 2; /* If AVR device doesn't support this fuse, don't want
-                   to generate a verify error */
-  m = avr_locate_mem(p, "hfuse");
-  if (m != NULL) {
-    fusegood = 0; /* By default fuse is a failure */
-    if (pgm->read_byte(pgm, p, m, 0, &safemode_hfuse) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 1, hfuse value: %x\n",progname,  safemode_hfuse);
-		}
-    if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 2, hfuse value: %x\n",progname,  value);
-		}
-    if (value == safemode_hfuse) {
-        if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-            {
-            allowfuseread = 0;
-            }
-		if (verbose > 2)
-			{
-			fprintf(stderr, "%s: safemode read 3, hfuse value: %x\n",progname, value);
-			}
-        if (value == safemode_hfuse){
-             fusegood = 1; /* Fuse read OK three times */
-        }
+  /* Read fuses three times */
+  for (tries = 1; tries <= 3; tries++) {
+    if (avr_read_config_bytes(pgm, p, mems, addrs,
+                              tries == 1? first: value, n) != 0)
+      //Programmer does not allow fuse reading.... no point trying anymore
+      return -5;
+    for (i = 0; i < n; i++) {
+      if (verbose > 2)
+        fprintf(stderr, "%s: safemode read %d, %s value: %x\n", progname,
+                tries, fusenames[idx[i]], tries == 1? first[i]: value[i]);
+      if (tries > 1 && value[i] != first[i])
+        fusegood[idx[i]] = 0;
     }
   }
 
-	//Programmer does not allow fuse reading.... no point trying anymore
-    if (allowfuseread == 0)
-		{
-		return -5;
-		}
-
-    if (fusegood == 0)	 {
-            fprintf(stderr,
-           "%s: safemode: Verify error - unable to read hfuse properly. "
-           "Programmer may not be reliable.\n", progname);
-       return -2;
-    }
-    else if ((fusegood == 1) && (verbose > 0)){
-        fprintf(stderr, "%s: safemode: hfuse reads as %X\n", progname, safemode_hfuse);
-    }
-
-  /* Read efuse three times */  
-  fusegood = 2; /* If AVR device doesn't support this fuse, don't want
-                   to generate a verify error */
-  m = avr_locate_mem(p, "efuse");
-  if (m != NULL) {
-    fusegood = 0; /* By default fuse is a failure */
-    if (pgm->read_byte(pgm, p, m, 0, &safemode_efuse) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 1, efuse value: %x\n",progname, safemode_efuse);
-		}
-    if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-        {
-        allowfuseread = 0;
-        }
-	if (verbose > 2)
-		{
-		fprintf(stderr, "%s: safemode read 2, efuse value: %x\n",progname,  value);
-		}
-    if (value == safemode_efuse) {
-        if (pgm->read_byte(pgm, p, m, 0, &value) != 0)
-            {
-            allowfuseread = 0;
-            }
-		if (verbose > 2)
-			{
-			fprintf(stderr, "%s: safemode read 3, efuse value: %x\n",progname, value);
-			}
-        if (value == safemode_efuse){
-             fusegood = 1; /* Fuse read OK three times */
-        }
+  for (i = 0; i < 4; i++) {
+    if (fusegood[i] == 0) {
+      fprintf(stderr,
+              "%s: safemode: Verify error - unable to read %s properly. "
+              "Programmer may not be reliable.\n", progname, fusenames[i]);
+      return fuseerrors[i];
     }
   }
-   
-	//Programmer does not allow fuse reading.... no point trying anymore
-    if (allowfuseread == 0)
-		{
-		return -5;
-		}
- 
-    if (fusegood == 0)	 {
-        fprintf(stderr,
-           "%s: safemode: Verify error - unable to read efuse properly. "
-           "Programmer may not be reliable.\n", progname);
-        return -3;
-        }
-    else if ((fusegood == 1) && (verbose > 0)) {
-        fprintf(stderr, "%s: safemode: efuse reads as %X\n", progname, safemode_efuse);
-        }
 
-  *lfuse = safemode_lfuse;
-  *hfuse = safemode_hfuse;
-  *efuse = safemode_efuse;
-  *fuse  = safemode_fuse;
+  for (i = 0; i < n; i++) {
+    if (verbose > 0)
+      fprintf(stderr, "%s: safemode: %s reads as %X\n",
+              progname, fusenames[idx[i]], first[i]);
+    *fuses[idx[i]] = first[i];
+    /* so that avr_read() need not fetch it again */
+    avr_mem_cache_store(mems[i], 0, &first[i], 1);
+  }
 
   return 0;
 }
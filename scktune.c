@@ -0,0 +1,181 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Finding the shortest SCK period a programmer and target work at.
+ *
+ * Starting at the fastest clock any of the backends offers, the period
+ * is made longer until the signature reads back as expected and the
+ * first bytes of flash read the same twice.  The period found is kept
+ * in a small file, keyed by programmer, port and part, and tried first
+ * the next time.
+ */
+
+#include "ac_cfg.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "avrdude.h"
+#include "avr.h"
+#include "avrpart.h"
+#include "cachefile.h"
+#include "pgm.h"
+#include "scktune.h"
+
+#define SCKTUNE_TESTBYTES 16    /* flash bytes read twice at each step */
+
+/* periods tried, in microseconds; backends round up to what they have */
+static const double scktune_periods[] = {
+  0.125, 0.25, 0.5, 1, 2, 4, 8, 16, 32, 64, 128
+};
+
+static char scktune_file[PATH_MAX];
+
+
+void scktune_cache(const char * file)
+{
+  snprintf(scktune_file, sizeof(scktune_file), "%s", file);
+}
+
+/* "<programmer> <part> <port>", or empty if it cannot be a cache key */
+static void scktune_key(PROGRAMMER * pgm, AVRPART * p, const char * port,
+                        char * key, size_t len)
+{
+  const char * s;
+
+  key[0] = 0;
+  for (s = port; *s != 0; s++)
+    if (isspace((int)*s))
+      return;
+  if (snprintf(key, len, "%s %s %s", (char *)ldata(lfirst(pgm->id)),
+               p->id, port) >= len)
+    key[0] = 0;
+}
+
+/* the cache file holds "<key> <period in us>" lines */
+static int scktune_lookup(const char * key, double * period)
+{
+  char value[64];
+
+  if (cachefile_lookup(scktune_file, key, value, sizeof(value)) < 0 ||
+      sscanf(value, "%lf", period) != 1 || *period <= 0)
+    return -1;
+
+  return 0;
+}
+
+static void scktune_remember(const char * key, double period)
+{
+  char value[64];
+
+  snprintf(value, sizeof(value), "%g", period * 1e6);
+  cachefile_remember(scktune_file, key, value, "SCK period cache");
+}
+
+/* whether the target answers properly at the current clock */
+static int scktune_check(PROGRAMMER * pgm, AVRPART * p)
+{
+  unsigned char first[SCKTUNE_TESTBYTES], again;
+  AVRMEM * sig, * flash;
+  int i, n;
+
+  sig = avr_locate_mem(p, "signature");
+  if (avr_read(pgm, p, "signature", 0) < 0 || sig->size != 3 ||
+      memcmp(sig->buf, p->signature, 3) != 0)
+    return -1;
+
+  flash = avr_locate_mem(p, "flash");
+  if (flash == NULL || pgm->read_byte == NULL)
+    return 0;
+  n = flash->size < SCKTUNE_TESTBYTES? flash->size: SCKTUNE_TESTBYTES;
+  for (i = 0; i < n; i++)
+    if (pgm->read_byte(pgm, p, flash, i, &first[i]) < 0)
+      return -1;
+  for (i = 0; i < n; i++)
+    if (pgm->read_byte(pgm, p, flash, i, &again) < 0 || again != first[i])
+      return -1;
+
+  return 0;
+}
+
+/* set the period, starting over with the target after a failed step */
+static int scktune_try(PROGRAMMER * pgm, AVRPART * p, double period,
+                       int restart)
+{
+  if (verbose >= 2)
+    fprintf(stderr, "%s: trying SCK period %g us\n", progname, period * 1e6);
+  if (pgm->set_sck_period(pgm, period) != 0)
+    return -1;
+  pgm->bitclock = period;
+  if (restart && pgm->initialize(pgm, p) < 0)
+    return -1;
+
+  return scktune_check(pgm, p);
+}
+
+int scktune(PROGRAMMER * pgm, AVRPART * p, const char * port)
+{
+  char key[512];
+  double period;
+  int i, restart = 0;
+
+  if (pgm->set_sck_period == NULL) {
+    fprintf(stderr, "%s: WARNING: the %s programmer cannot set the SCK period, "
+            "-B auto ignored\n", progname, pgm->type);
+    return 0;
+  }
+  if (avr_locate_mem(p, "signature") == NULL) {
+    fprintf(stderr, "%s: WARNING: no signature to check the SCK period by, "
+            "-B auto ignored\n", progname);
+    return 0;
+  }
+
+  scktune_key(pgm, p, port, key, sizeof(key));
+  if (scktune_lookup(key, &period) == 0) {
+    period *= 1e-6;
+    if (scktune_try(pgm, p, period, 0) == 0) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: using SCK period %g us found before\n",
+                progname, period * 1e6);
+      return 0;
+    }
+    restart = 1;
+  }
+
+  for (i = 0; i < sizeof(scktune_periods) / sizeof(scktune_periods[0]); i++) {
+    period = scktune_periods[i] * 1e-6;
+    if (scktune_try(pgm, p, period, restart) == 0) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: using SCK period %g us\n",
+                progname, period * 1e6);
+      scktune_remember(key, period);
+      return 0;
+    }
+    restart = 1;
+  }
+
+  fprintf(stderr, "%s: no SCK period found that the target works at\n",
+          progname);
+  return -1;
+}
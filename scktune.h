@@ -0,0 +1,45 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef scktune_h
+#define scktune_h
+
+#include "avrpart.h"
+#include "pgm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* file remembering the SCK periods found */
+void scktune_cache(const char * file);
+
+/*
+ * Set the shortest SCK period pgm and the initialized part p work at
+ * through port, trying the one found last time first.  Returns -1 if
+ * the target does not answer properly at any of them.
+ */
+int scktune(PROGRAMMER * pgm, AVRPART * p, const char * port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -59,6 +59,14 @@ static int  reportDataSizes[4] = {13, 29, 61, 125};
 static unsigned char    avrdoperRxBuffer[280];  /* buffer for receive data */
 static int              avrdoperRxLength = 0;   /* amount of valid bytes in rx buffer */
 static int              avrdoperRxPosition = 0; /* amount of bytes already consumed in rx buffer */
+static int              avrdoperRxPending = 0;  /* bytes the device said it still holds */
+static int              avrdoperRxGuess = 29;   /* size of the last reply, for sizing the first report */
+
+/* Small messages are collected here and sent as full reports; the rest
+ * goes out as soon as a reply is read, on drain and on close.  Must be
+ * able to hold two of the largest reports. */
+static unsigned char    avrdoperTxBuffer[2 * 125];
+static int              avrdoperTxLength = 0;   /* amount of bytes waiting to be sent */
 
 /* ------------------------------------------------------------------------ */
 /* ------------------------------------------------------------------------ */
@@ -527,8 +535,11 @@ static int avrdoper_open(char *port, union pinfo pinfo, union filedescriptor *fd
 
 /* ------------------------------------------------------------------------- */
 
+static void avrdoperFlush(union filedescriptor *fdp, int all);
+
 static void avrdoper_close(union filedescriptor *fdp)
 {
+    avrdoperFlush(fdp, 1);
     usbCloseDevice(fdp);
 }
 
@@ -545,11 +556,15 @@ static int  chooseDataSize(int len)
     return i - 1;
 }
 
-static int avrdoper_send(union filedescriptor *fdp, unsigned char *buf, size_t buflen)
+/* Send the tx buffer in reports of the largest size.  Unless "all" is
+ * set, a remainder too short to fill such a report stays in the buffer. */
+static void avrdoperFlush(union filedescriptor *fdp, int all)
 {
-    if(verbose > 3)
-        dumpBlock("Send", buf, buflen);
-    while(buflen > 0){
+    int maxLen = reportDataSizes[sizeof(reportDataSizes)/sizeof(reportDataSizes[0]) - 1];
+    unsigned char *buf = avrdoperTxBuffer;
+    int buflen = avrdoperTxLength;
+
+    while(buflen >= (all ? 1 : maxLen)){
         unsigned char buffer[256];
         int rval, lenIndex = chooseDataSize(buflen);
         int thisLen = buflen > reportDataSizes[lenIndex] ?
@@ -568,16 +583,52 @@ static int avrdoper_send(union filedescriptor *fdp, unsigned char *buf, size_t b
         buflen -= thisLen;
         buf += thisLen;
     }
+    memmove(avrdoperTxBuffer, buf, buflen);
+    avrdoperTxLength = buflen;
+}
+
+static int avrdoper_send(union filedescriptor *fdp, unsigned char *buf, size_t buflen)
+{
+    if(verbose > 3)
+        dumpBlock("Send", buf, buflen);
+    while(buflen > 0){
+        int len = sizeof(avrdoperTxBuffer) - avrdoperTxLength;
+        if(len > buflen)
+            len = buflen;
+        memcpy(avrdoperTxBuffer + avrdoperTxLength, buf, len);
+        avrdoperTxLength += len;
+        buflen -= len;
+        buf += len;
+        avrdoperFlush(fdp, 0);
+    }
     return 0;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static void avrdoperFillBuffer(union filedescriptor *fdp)
+static int avrdoper_sendv(union filedescriptor *fdp,
+                          const struct serial_iov *iov, int iovcnt)
 {
-    int bytesPending = reportDataSizes[1];  /* guess how much data is buffered in device */
+    return serial_sendv_gather(fdp, iov, iovcnt, avrdoper_send);
+}
 
-    avrdoperRxPosition = avrdoperRxLength = 0;
+/* ------------------------------------------------------------------------- */
+
+/* Fetch what the device holds.  Unread data stays in the buffer.  The
+ * first report is sized from what the device announced last time or,
+ * failing that, from the larger of the caller's need and the last reply. */
+static void avrdoperFillBuffer(union filedescriptor *fdp, int wanted)
+{
+    int bytesPending = avrdoperRxPending;
+
+    if(bytesPending <= 0)
+        bytesPending = wanted > avrdoperRxGuess ? wanted : avrdoperRxGuess;
+    if(avrdoperRxPosition > 0){     /* keep the tail, drop what was consumed */
+        avrdoperRxLength -= avrdoperRxPosition;
+        memmove(avrdoperRxBuffer, avrdoperRxBuffer + avrdoperRxPosition, avrdoperRxLength);
+        avrdoperRxPosition = 0;
+    }
+    wanted = avrdoperRxLength;
     while(bytesPending > 0){
         int len, usbErr, lenIndex = chooseDataSize(bytesPending);
         unsigned char buffer[128];
@@ -606,6 +657,9 @@ static void avrdoperFillBuffer(union filedescriptor *fdp)
         memcpy(avrdoperRxBuffer + avrdoperRxLength, buffer + 2, len);
         avrdoperRxLength += len;
     }
+    avrdoperRxPending = bytesPending;
+    if(avrdoperRxLength > wanted)
+        avrdoperRxGuess = avrdoperRxLength - wanted + avrdoperRxPending;
 }
 
 static int avrdoper_recv(union filedescriptor *fdp, unsigned char *buf, size_t buflen)
@@ -613,10 +667,11 @@ static int avrdoper_recv(union filedescriptor *fdp, unsigned char *buf, size_t b
     unsigned char   *p = buf;
     int             remaining = buflen;
 
+    avrdoperFlush(fdp, 1);
     while(remaining > 0){
         int len, available = avrdoperRxLength - avrdoperRxPosition;
         if(available <= 0){ /* buffer is empty */
-            avrdoperFillBuffer(fdp);
+            avrdoperFillBuffer(fdp, remaining);
             continue;
         }
         len = remaining < available ? remaining : available;
@@ -634,9 +689,12 @@ static int avrdoper_recv(union filedescriptor *fdp, unsigned char *buf, size_t b
 
 static int avrdoper_drain(union filedescriptor *fdp, int display)
 {
+    avrdoperFlush(fdp, 1);
     do{
-        avrdoperFillBuffer(fdp);
+        avrdoperRxPosition = avrdoperRxLength = avrdoperRxPending = 0;
+        avrdoperFillBuffer(fdp, 0);
     }while(avrdoperRxLength > 0);
+    avrdoperRxPosition = avrdoperRxLength = 0;
     return 0;
 }
 
@@ -655,6 +713,7 @@ struct serial_device avrdoper_serdev =
   .open = avrdoper_open,
   .close = avrdoper_close,
   .send = avrdoper_send,
+  .sendv = avrdoper_sendv,
   .recv = avrdoper_recv,
   .drain = avrdoper_drain,
   .set_dtr_rts = avrdoper_set_dtr_rts,
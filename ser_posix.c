@@ -35,17 +35,72 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netdb.h>
 #include <netinet/in.h>
 
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#include <linux/serial.h>
+#endif
 
 #include "avrdude.h"
 #include "serial.h"
 
 long serial_recv_timeout = 5000; /* ms */
+int serial_low_latency;
+
+/*
+ * Settings changed for low-latency mode, to be restored when the port
+ * is closed.  USB-serial adapters hold back received bytes for their
+ * latency timer (16 ms by default for FTDI chips) unless their buffer
+ * fills up, which is what costs request/response protocols most.
+ */
+static struct {
+  int  fd;
+  int  serial_saved;            /* ASYNC_LOW_LATENCY was off */
+  int  latency_saved;           /* old value of the latency timer */
+  char latency_file[PATH_MAX];
+} ser_lowlat = { -1 };
+
+/*
+ * Receive buffer of an open port.  Whatever the driver has got when
+ * a caller asks for a few bytes is read at once, and later calls are
+ * served from the buffer until it runs empty, so byte-at-a-time
+ * protocols do not cost a poll() and a read() per byte.
+ */
+#define SER_RBUFSIZE 4096
+#define SER_NRBUF    4
+
+struct ser_rbuf {
+  int           inuse;
+  int           fd;
+  size_t        pos;
+  size_t        count;
+  unsigned char data[SER_RBUFSIZE];
+};
+
+static struct ser_rbuf ser_rbufs[SER_NRBUF];
+
+/*
+ * Round-trip estimate from the time between a send and the first byte
+ * received after it, smoothed as for TCP retransmission timeouts.
+ */
+#define SER_RTT_INITIAL 250     /* ms, before the first sample */
+#define SER_RTT_MIN     100     /* ms */
+
+static struct timeval ser_sent;
+static int  ser_rtt_pending;    /* waiting for the reply to ser_sent */
+static int  ser_rtt_samples;
+static long ser_srtt;           /* us */
+static long ser_rttvar;         /* us */
 
 struct baud_mapping {
   long baud;
@@ -69,6 +124,21 @@ static struct baud_mapping baud_lookup_table [] = {
 #endif
 #ifdef B230400
   { 230400, B230400 },
+#endif
+#ifdef B250000
+  { 250000, B250000 },
+#endif
+#ifdef B460800
+  { 460800, B460800 },
+#endif
+#ifdef B500000
+  { 500000, B500000 },
+#endif
+#ifdef B1000000
+  { 1000000, B1000000 },
+#endif
+#ifdef B2000000
+  { 2000000, B2000000 },
 #endif
   { 0,      0 }                 /* Terminator. */
 };
@@ -97,6 +167,96 @@ static speed_t serial_baud_lookup(long baud)
   return baud;
 }
 
+/*
+ * Return the receive buffer of fd, setting up one if there is none
+ * yet.  Returns NULL if all buffers are taken; fd is then read
+ * directly.
+ */
+static struct ser_rbuf * ser_get_rbuf(int fd)
+{
+  struct ser_rbuf * rb, * free_rb;
+  int i;
+
+  free_rb = NULL;
+  for (i = 0; i < SER_NRBUF; i++) {
+    rb = &ser_rbufs[i];
+    if (rb->inuse && rb->fd == fd)
+      return rb;
+    if (!rb->inuse && free_rb == NULL)
+      free_rb = rb;
+  }
+  if (free_rb != NULL) {
+    free_rb->inuse = 1;
+    free_rb->fd = fd;
+    free_rb->pos = free_rb->count = 0;
+  }
+
+  return free_rb;
+}
+
+static void ser_drop_rbuf(int fd)
+{
+  int i;
+
+  for (i = 0; i < SER_NRBUF; i++)
+    if (ser_rbufs[i].inuse && ser_rbufs[i].fd == fd)
+      ser_rbufs[i].inuse = 0;
+}
+
+static void ser_rtt_sample(void)
+{
+  struct timeval now;
+  long rtt, err;
+
+  gettimeofday(&now, NULL);
+  rtt = (now.tv_sec - ser_sent.tv_sec) * 1000000L +
+    (now.tv_usec - ser_sent.tv_usec);
+  ser_rtt_pending = 0;
+  if (rtt < 0)
+    return;
+
+  if (ser_rtt_samples++ == 0) {
+    ser_srtt = rtt;
+    ser_rttvar = rtt / 2;
+  }
+  else {
+    err = rtt - ser_srtt;
+    ser_srtt += err / 8;
+    ser_rttvar += ((err < 0? -err: err) - ser_rttvar) / 4;
+  }
+}
+
+long serial_adaptive_timeout(int attempt)
+{
+  long t;
+
+  if (ser_rtt_samples == 0)
+    t = SER_RTT_INITIAL;
+  else {
+    t = (ser_srtt + 4 * ser_rttvar) / 1000;
+    if (t < SER_RTT_MIN)
+      t = SER_RTT_MIN;
+  }
+
+  while (attempt-- > 0 && t < serial_recv_timeout)
+    t *= 2;
+
+  return t < serial_recv_timeout? t: serial_recv_timeout;
+}
+
+/* milliseconds left until deadline, 0 if it has passed */
+static int ser_time_left(struct timeval * deadline)
+{
+  struct timeval now;
+  long ms;
+
+  gettimeofday(&now, NULL);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000L +
+    (deadline->tv_usec - now.tv_usec) / 1000L;
+
+  return ms > 0? ms: 0;
+}
+
 static int ser_setspeed(union filedescriptor *fd, long baud)
 {
   int rc;
@@ -253,6 +413,104 @@ static int ser_set_dtr_rts(union filedescriptor *fdp, int is_on)
   return 0;
 }
 
+/*
+ * Find the sysfs latency timer file of the tty fd refers to.
+ */
+static int ser_latency_file(int fd, char * buf, size_t bufsize)
+{
+#if defined(__linux__)
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || !S_ISCHR(st.st_mode))
+    return -1;
+  if (snprintf(buf, bufsize, "/sys/dev/char/%u:%u/device/latency_timer",
+               (unsigned)major(st.st_rdev), (unsigned)minor(st.st_rdev))
+      >= bufsize)
+    return -1;
+  return access(buf, R_OK | W_OK);
+#else
+  return -1;
+#endif
+}
+
+static void ser_set_low_latency(int fd, const char * port)
+{
+  FILE * f;
+  int done = 0;
+
+  ser_lowlat.fd = fd;
+  ser_lowlat.serial_saved = 0;
+  ser_lowlat.latency_saved = -1;
+
+#if defined(__linux__) && defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+  {
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+      if ((ss.flags & ASYNC_LOW_LATENCY) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &ss) == 0)
+          ser_lowlat.serial_saved = 1;
+      }
+      done = 1;
+    }
+  }
+#endif
+
+  if (ser_latency_file(fd, ser_lowlat.latency_file,
+                       sizeof(ser_lowlat.latency_file)) == 0 &&
+      (f = fopen(ser_lowlat.latency_file, "r+")) != NULL) {
+    if (fscanf(f, "%d", &ser_lowlat.latency_saved) == 1 &&
+        ser_lowlat.latency_saved > 1) {
+      rewind(f);
+      if (fprintf(f, "1\n") < 0 || fflush(f) != 0)
+        ser_lowlat.latency_saved = -1;
+    }
+    else
+      ser_lowlat.latency_saved = -1;
+    fclose(f);
+    done = 1;
+  }
+
+  if (verbose > 0 && !done)
+    fprintf(stderr,
+            "%s: ser_open(): can't enable low-latency mode for \"%s\"\n",
+            progname, port);
+  else if (verbose > 1)
+    fprintf(stderr,
+            "%s: ser_open(): low-latency mode for \"%s\"%s\n",
+            progname, port,
+            ser_lowlat.latency_saved > 0? ", latency timer 1 ms": "");
+}
+
+static void ser_restore_latency(int fd)
+{
+  FILE * f;
+
+  if (ser_lowlat.fd != fd)
+    return;
+
+#if defined(__linux__) && defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+  if (ser_lowlat.serial_saved) {
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+      ss.flags &= ~ASYNC_LOW_LATENCY;
+      (void)ioctl(fd, TIOCSSERIAL, &ss);
+    }
+  }
+#endif
+
+  if (ser_lowlat.latency_saved > 0 &&
+      (f = fopen(ser_lowlat.latency_file, "w")) != NULL) {
+    fprintf(f, "%d\n", ser_lowlat.latency_saved);
+    fclose(f);
+  }
+
+  ser_lowlat.fd = -1;
+}
+
+
 static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
 {
   int rc;
@@ -289,6 +547,10 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
     close(fd);
     return -1;
   }
+
+  if (serial_low_latency)
+    ser_set_low_latency(fd, port);
+
   return 0;
 }
 
@@ -308,74 +570,137 @@ static void ser_close(union filedescriptor *fd)
     saved_original_termios = 0;
   }
 
+  ser_restore_latency(fd->ifd);
+  ser_drop_rbuf(fd->ifd);
   close(fd->ifd);
 }
 
 
-static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+#define SER_MAXIOV 16
+
+static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen);
+
+static int ser_sendv(union filedescriptor *fd, const struct serial_iov * iov,
+                     int iovcnt)
 {
+  struct iovec v[SER_MAXIOV], * vp;
+  struct ser_rbuf * rb;
   int rc;
-  unsigned char * p = buf;
-  size_t len = buflen;
+  int i, n;
+  size_t k;
 
-  if (!len)
-    return 0;
+  if (iovcnt > SER_MAXIOV)
+    return serial_sendv_gather(fd, iov, iovcnt, ser_send);
 
   if (verbose > 3)
   {
       fprintf(stderr, "%s: Send: ", progname);
 
-      while (buflen) {
-        unsigned char c = *buf;
-        if (isprint(c)) {
-          fprintf(stderr, "%c ", c);
+      for (i = 0; i < iovcnt; i++) {
+        for (k = 0; k < iov[i].len; k++) {
+          unsigned char c = iov[i].buf[k];
+          if (isprint(c)) {
+            fprintf(stderr, "%c ", c);
+          }
+          else {
+            fprintf(stderr, ". ");
+          }
+          fprintf(stderr, "[%02x] ", c);
         }
-        else {
-          fprintf(stderr, ". ");
-        }
-        fprintf(stderr, "[%02x] ", c);
-
-        buf++;
-        buflen--;
       }
 
       fprintf(stderr, "\n");
   }
 
-  while (len) {
-    rc = write(fd->ifd, p, (len > 1024) ? 1024 : len);
+  for (n = 0, i = 0; i < iovcnt; i++)
+    if (iov[i].len > 0) {
+      v[n].iov_base = iov[i].buf;
+      v[n].iov_len = iov[i].len;
+      n++;
+    }
+
+  /* time the reply, unless older data is still waiting to be read */
+  rb = ser_get_rbuf(fd->ifd);
+  if (n > 0 && (rb == NULL || rb->count == 0)) {
+    gettimeofday(&ser_sent, NULL);
+    ser_rtt_pending = 1;
+  }
+
+  vp = v;
+  while (n > 0) {
+    rc = writev(fd->ifd, vp, n);
     if (rc < 0) {
       fprintf(stderr, "%s: ser_send(): write error: %s\n",
               progname, strerror(errno));
       exit(1);
     }
-    p += rc;
-    len -= rc;
+    /* skip what has been written, in case of a short write */
+    while (n > 0 && (size_t)rc >= vp->iov_len) {
+      rc -= vp->iov_len;
+      vp++;
+      n--;
+    }
+    if (n > 0) {
+      vp->iov_base = (char *)vp->iov_base + rc;
+      vp->iov_len -= rc;
+    }
   }
 
   return 0;
 }
 
 
+static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+{
+  struct serial_iov iov;
+
+  iov.buf = buf;
+  iov.len = buflen;
+
+  return ser_sendv(fd, &iov, 1);
+}
+
+
 static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
 {
-  struct timeval timeout, to2;
-  fd_set rfds;
+  struct timeval deadline;
+  struct pollfd pfd;
+  struct ser_rbuf * rb;
   int nfds;
   int rc;
+  size_t n;
   unsigned char * p = buf;
   size_t len = 0;
 
-  timeout.tv_sec  = serial_recv_timeout / 1000L;
-  timeout.tv_usec = (serial_recv_timeout % 1000L) * 1000;
-  to2 = timeout;
+  gettimeofday(&deadline, NULL);
+  deadline.tv_sec  += serial_recv_timeout / 1000L;
+  deadline.tv_usec += (serial_recv_timeout % 1000L) * 1000;
+  if (deadline.tv_usec >= 1000000) {
+    deadline.tv_sec++;
+    deadline.tv_usec -= 1000000;
+  }
+
+  rb = ser_get_rbuf(fd->ifd);
 
   while (len < buflen) {
-  reselect:
-    FD_ZERO(&rfds);
-    FD_SET(fd->ifd, &rfds);
+    if (rb != NULL && rb->count > 0) {
+      n = buflen - len;
+      if (n > rb->count)
+        n = rb->count;
+      memcpy(p, rb->data + rb->pos, n);
+      rb->pos += n;
+      rb->count -= n;
+      p += n;
+      len += n;
+      continue;
+    }
 
-    nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &to2);
+  repoll:
+    pfd.fd = fd->ifd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    nfds = poll(&pfd, 1, ser_time_left(&deadline));
     if (nfds == 0) {
       if (verbose > 1)
 	fprintf(stderr,
@@ -388,23 +713,38 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 	fprintf(stderr,
 		"%s: ser_recv(): programmer is not responding,reselecting\n",
 		progname);
-        goto reselect;
+        goto repoll;
       }
       else {
-        fprintf(stderr, "%s: ser_recv(): select(): %s\n",
+        fprintf(stderr, "%s: ser_recv(): poll(): %s\n",
                 progname, strerror(errno));
         exit(1);
       }
     }
 
-    rc = read(fd->ifd, p, (buflen - len > 1024) ? 1024 : buflen - len);
+    if (ser_rtt_pending)
+      ser_rtt_sample();
+
+    if (rb == NULL || buflen - len >= SER_RBUFSIZE) {
+      /* large reads go straight to the caller's buffer */
+      rc = read(fd->ifd, p, buflen - len);
+      if (rc > 0) {
+        p += rc;
+        len += rc;
+      }
+    }
+    else {
+      rc = read(fd->ifd, rb->data, SER_RBUFSIZE);
+      if (rc > 0) {
+        rb->pos = 0;
+        rb->count = rc;
+      }
+    }
     if (rc < 0) {
       fprintf(stderr, "%s: ser_recv(): read error: %s\n",
               progname, strerror(errno));
       exit(1);
     }
-    p += rc;
-    len += rc;
   }
 
   p = buf;
@@ -433,27 +773,89 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 }
 
 
-static int ser_drain(union filedescriptor *fd, int display)
+/*
+ * How long the line has to stay quiet for a drain: long enough for
+ * the latency timer of a USB-serial adapter and a good many characters
+ * at the port speed.  Network connections get the old fixed time, as
+ * does a drain as a whole when the other end keeps talking.
+ */
+#define SER_DRAIN_MIN    20     /* ms */
+#define SER_DRAIN_CHARS  64     /* characters at the port speed */
+#define SER_DRAIN_MAX   250     /* ms */
+
+static int ser_drain_window(int fd)
 {
-  struct timeval timeout;
-  fd_set rfds;
-  int nfds;
-  int rc;
-  unsigned char buf;
+  struct termios termios;
+  struct baud_mapping *map;
+  speed_t speed;
+  long baud, ms;
+
+  if (!isatty(fd) || tcgetattr(fd, &termios) < 0)
+    return SER_DRAIN_MAX;
 
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 250000;
+  speed = cfgetispeed(&termios);
+  /* a non-standard rate is set as it is */
+  baud = (long)speed;
+  for (map = baud_lookup_table; map->baud; map++)
+    if (map->speed == speed)
+      baud = map->baud;
+  ms = baud > 0? SER_DRAIN_CHARS * 10 * 1000L / baud + 1: SER_DRAIN_MAX;
+
+  return ms < SER_DRAIN_MIN? SER_DRAIN_MIN: ms > SER_DRAIN_MAX? SER_DRAIN_MAX: ms;
+}
+
+static int ser_drain(union filedescriptor *fd, int display)
+{
+  struct timeval deadline, limit;
+  struct pollfd pfd;
+  struct ser_rbuf * rb;
+  int nfds, window;
+  int rc, i;
+  unsigned char buf[SER_RBUFSIZE];
+
+  window = ser_drain_window(fd->ifd);
+  gettimeofday(&limit, NULL);
+  limit.tv_usec += SER_DRAIN_MAX * 1000L;
+  while (limit.tv_usec >= 1000000) {
+    limit.tv_sec++;
+    limit.tv_usec -= 1000000;
+  }
 
   if (display) {
     fprintf(stderr, "drain>");
   }
 
+  /* throw away what has been received already */
+  rb = ser_get_rbuf(fd->ifd);
+  if (rb != NULL) {
+    if (display)
+      while (rb->count > 0) {
+        fprintf(stderr, "%02x ", rb->data[rb->pos++]);
+        rb->count--;
+      }
+    rb->pos = rb->count = 0;
+  }
+  /* and what the driver holds, unless it is to be shown */
+  if (!display && isatty(fd->ifd))
+    tcflush(fd->ifd, TCIFLUSH);
+
   while (1) {
-    FD_ZERO(&rfds);
-    FD_SET(fd->ifd, &rfds);
+    pfd.fd = fd->ifd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    /* until the line has been quiet for a window, within the limit */
+    gettimeofday(&deadline, NULL);
+    deadline.tv_usec += window * 1000L;
+    while (deadline.tv_usec >= 1000000) {
+      deadline.tv_sec++;
+      deadline.tv_usec -= 1000000;
+    }
+    if (timercmp(&deadline, &limit, >))
+      deadline = limit;
 
   reselect:
-    nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &timeout);
+    nfds = poll(&pfd, 1, ser_time_left(&deadline));
     if (nfds == 0) {
       if (display) {
         fprintf(stderr, "<drain\n");
@@ -466,20 +868,21 @@ static int ser_drain(union filedescriptor *fd, int display)
         goto reselect;
       }
       else {
-        fprintf(stderr, "%s: ser_drain(): select(): %s\n",
+        fprintf(stderr, "%s: ser_drain(): poll(): %s\n",
                 progname, strerror(errno));
         exit(1);
       }
     }
 
-    rc = read(fd->ifd, &buf, 1);
+    rc = read(fd->ifd, buf, sizeof(buf));
     if (rc < 0) {
       fprintf(stderr, "%s: ser_drain(): read error: %s\n",
               progname, strerror(errno));
       exit(1);
     }
     if (display) {
-      fprintf(stderr, "%02x ", buf);
+      for (i = 0; i < rc; i++)
+        fprintf(stderr, "%02x ", buf[i]);
     }
   }
 
@@ -492,6 +895,7 @@ struct serial_device serial_serdev =
   .setspeed = ser_setspeed,
   .close = ser_close,
   .send = ser_send,
+  .sendv = ser_sendv,
   .recv = ser_recv,
   .drain = ser_drain,
   .set_dtr_rts = ser_set_dtr_rts,
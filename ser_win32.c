@@ -29,13 +29,43 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <ctype.h>   /* for isprint */
 
 #include "serial.h"
 
 long serial_recv_timeout = 5000; /* ms */
+int serial_low_latency;         /* not supported here */
 
-#define W32SERBUFSIZE 1024
+/* what the driver is asked to buffer each way */
+#define W32SERBUFSIZE 16384
+
+/*
+ * Receive buffer of an open port, as in ser_posix.c.  The port is
+ * opened for overlapped I/O with read timeouts that make ReadFile()
+ * return as soon as anything has arrived, with all there is; so one
+ * read fetches what the driver has got, later calls are served from
+ * the buffer, and the wait for a reply is a wait on an event with the
+ * time left, not a COMMTIMEOUTS call per byte.
+ */
+#define SER_RBUFSIZE 4096
+#define SER_NRBUF    4
+
+struct ser_rbuf {
+  int           inuse;
+  HANDLE        h;
+  OVERLAPPED    rov, wov;       /* for reads and writes, with events */
+  long          baud;
+  size_t        pos;
+  size_t        count;
+  unsigned char data[SER_RBUFSIZE];
+};
+
+static struct ser_rbuf ser_rbufs[SER_NRBUF];
+
+/* ms a write may take beyond sending the bytes at the port speed */
+#define SER_SEND_SLACK  500
 
 struct baud_mapping {
   long baud;
@@ -78,21 +108,139 @@ static DWORD serial_baud_lookup(long baud)
 }
 
 
-static BOOL serial_w32SetTimeOut(HANDLE hComPort, DWORD timeout) // in ms
+static struct ser_rbuf * ser_get_rbuf(HANDLE h)
+{
+	int i;
+
+	for (i = 0; i < SER_NRBUF; i++)
+		if (ser_rbufs[i].inuse && ser_rbufs[i].h == h)
+			return &ser_rbufs[i];
+
+	return NULL;
+}
+
+/* a buffer and the events for a newly opened port, or NULL */
+static struct ser_rbuf * ser_new_rbuf(HANDLE h)
+{
+	struct ser_rbuf * rb;
+	int i;
+
+	for (i = 0; i < SER_NRBUF; i++) {
+		rb = &ser_rbufs[i];
+		if (rb->inuse)
+			continue;
+		ZeroMemory(&rb->rov, sizeof(rb->rov));
+		ZeroMemory(&rb->wov, sizeof(rb->wov));
+		rb->rov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		rb->wov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (rb->rov.hEvent == NULL || rb->wov.hEvent == NULL) {
+			if (rb->rov.hEvent != NULL)
+				CloseHandle(rb->rov.hEvent);
+			if (rb->wov.hEvent != NULL)
+				CloseHandle(rb->wov.hEvent);
+			return NULL;
+		}
+		rb->inuse = 1;
+		rb->h = h;
+		rb->baud = 0;
+		rb->pos = rb->count = 0;
+		return rb;
+	}
+
+	return NULL;
+}
+
+static void ser_drop_rbuf(struct ser_rbuf * rb)
+{
+	CloseHandle(rb->rov.hEvent);
+	CloseHandle(rb->wov.hEvent);
+	rb->inuse = 0;
+}
+
+/*
+ * ReadFile() returns at once with what there is, or with the first
+ * byte to arrive; how long to wait for it is up to ser_overlapped().
+ * Writes have no timeout of their own either.
+ */
+static BOOL serial_w32SetTimeOut(HANDLE hComPort)
 {
 	COMMTIMEOUTS ctmo;
 	ZeroMemory (&ctmo, sizeof(COMMTIMEOUTS));
-	ctmo.ReadIntervalTimeout = timeout;
-	ctmo.ReadTotalTimeoutMultiplier = timeout;
-	ctmo.ReadTotalTimeoutConstant = timeout;
+	ctmo.ReadIntervalTimeout = MAXDWORD;
+	ctmo.ReadTotalTimeoutMultiplier = MAXDWORD;
+	ctmo.ReadTotalTimeoutConstant = MAXDWORD - 1;
 
 	return SetCommTimeouts(hComPort, &ctmo);
 }
 
+/*
+ * Read or write len bytes through the overlapped port, waiting at most
+ * ms for the transfer to complete.  What has been transferred by then
+ * is in *done, anything still pending is cancelled.  Returns -1 on
+ * errors.
+ */
+static int ser_overlapped(HANDLE h, OVERLAPPED * ov, int write,
+			  unsigned char * buf, DWORD len, DWORD ms,
+			  DWORD * done)
+{
+	BOOL ok;
+
+	*done = 0;
+	ov->Offset = ov->OffsetHigh = 0;
+	ResetEvent(ov->hEvent);
+	if (write)
+		ok = WriteFile(h, buf, len, done, ov);
+	else
+		ok = ReadFile(h, buf, len, done, ov);
+	if (ok)
+		return 0;
+	if (GetLastError() != ERROR_IO_PENDING)
+		return -1;
+
+	if (WaitForSingleObject(ov->hEvent, ms) != WAIT_OBJECT_0)
+		CancelIo(h);
+	/* waits for the cancellation, and gets what came before it */
+	if (!GetOverlappedResult(h, ov, done, TRUE)) {
+		if (GetLastError() != ERROR_OPERATION_ABORTED)
+			return -1;
+		*done = (DWORD)ov->InternalHigh;
+	}
+
+	return 0;
+}
+
+/* ms until deadline, a GetTickCount() value, 0 once it has passed */
+static DWORD ser_time_left(DWORD deadline)
+{
+	LONG left = (LONG)(deadline - GetTickCount());
+
+	return left > 0? (DWORD)left: 0;
+}
+
+static void ser_print_error(const char * func, const char * what)
+{
+	LPVOID lpMsgBuf;
+
+	FormatMessage( 
+		FORMAT_MESSAGE_ALLOCATE_BUFFER | 
+		FORMAT_MESSAGE_FROM_SYSTEM | 
+		FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL,
+		GetLastError(),
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
+		(LPTSTR) &lpMsgBuf,
+		0,
+		NULL 	);
+	fprintf(stderr, "%s: %s(): %s error: %s\n",
+		progname, func, what, (char*)lpMsgBuf);
+	LocalFree( lpMsgBuf );
+}
+
 static int ser_setspeed(union filedescriptor *fd, long baud)
 {
 	DCB dcb;
 	HANDLE hComPort = (HANDLE)fd->pfd;
+	struct ser_rbuf * rb;
 
 	ZeroMemory (&dcb, sizeof(DCB));
 	dcb.DCBlength = sizeof(DCB);
@@ -107,6 +255,9 @@ static int ser_setspeed(union filedescriptor *fd, long baud)
 	if (!SetCommState(hComPort, &dcb))
 		return -1;
 
+	if ((rb = ser_get_rbuf(hComPort)) != NULL)
+		rb->baud = baud;
+
 	return 0;
 }
 
@@ -115,6 +266,7 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
 {
 	LPVOID lpMsgBuf;
 	HANDLE hComPort=INVALID_HANDLE_VALUE;
+	struct ser_rbuf * rb;
 	char *newname = 0;
 
 	/*
@@ -149,7 +301,7 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
 	}
 
 	hComPort = CreateFile(port, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
 
 	if (hComPort == INVALID_HANDLE_VALUE) {
 		FormatMessage( 
@@ -168,8 +320,17 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
 		return -1;
 	}
 
+	if ((rb = ser_new_rbuf(hComPort)) == NULL)
+	{
+		CloseHandle(hComPort);
+		fprintf(stderr, "%s: ser_open(): too many ports open for \"%s\"\n",
+				progname, port);
+		return -1;
+	}
+
 	if (!SetupComm(hComPort, W32SERBUFSIZE, W32SERBUFSIZE))
 	{
+		ser_drop_rbuf(rb);
 		CloseHandle(hComPort);
 		fprintf(stderr, "%s: ser_open(): can't set buffers for \"%s\"\n",
 				progname, port);
@@ -179,14 +340,16 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
         fdp->pfd = (void *)hComPort;
 	if (ser_setspeed(fdp, pinfo.baud) != 0)
 	{
+		ser_drop_rbuf(rb);
 		CloseHandle(hComPort);
 		fprintf(stderr, "%s: ser_open(): can't set com-state for \"%s\"\n",
 				progname, port);
 		return -1;
 	}
 
-	if (!serial_w32SetTimeOut(hComPort,0))
+	if (!serial_w32SetTimeOut(hComPort))
 	{
+		ser_drop_rbuf(rb);
 		CloseHandle(hComPort);
 		fprintf(stderr, "%s: ser_open(): can't set initial timeout for \"%s\"\n",
 				progname, port);
@@ -203,8 +366,14 @@ static int ser_open(char * port, union pinfo pinfo, union filedescriptor *fdp)
 static void ser_close(union filedescriptor *fd)
 {
 	HANDLE hComPort=(HANDLE)fd->pfd;
-	if (hComPort != INVALID_HANDLE_VALUE)
+	struct ser_rbuf * rb;
+
+	if (hComPort != INVALID_HANDLE_VALUE) {
+		CancelIo(hComPort);
+		if ((rb = ser_get_rbuf(hComPort)) != NULL)
+			ser_drop_rbuf(rb);
 		CloseHandle (hComPort);
+	}
 
 	hComPort = INVALID_HANDLE_VALUE;
 }
@@ -228,8 +397,9 @@ static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen
 {
 	size_t len = buflen;
 	unsigned char c='\0';
-	DWORD written;
+	DWORD written, ms;
         unsigned char * b = buf;
+	struct ser_rbuf * rb;
 
 	HANDLE hComPort=(HANDLE)fd->pfd;
 
@@ -261,11 +431,14 @@ static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen
       fprintf(stderr, "\n");
 	}
 	
-	serial_w32SetTimeOut(hComPort,500);
-
-	if (!WriteFile (hComPort, buf, buflen, &written, NULL)) {
-		fprintf(stderr, "%s: ser_send(): write error: %s\n",
-              progname, "sorry no info avail"); // TODO
+	rb = ser_get_rbuf(hComPort);
+	/* ten bits a byte, and some time for the driver */
+	ms = SER_SEND_SLACK;
+	if (rb->baud > 0)
+		ms += buflen * 10000 / rb->baud;
+
+	if (ser_overlapped(hComPort, &rb->wov, 1, buf, buflen, ms, &written) < 0) {
+		ser_print_error("ser_send", "write");
 		exit(1);
 	}
 
@@ -279,11 +452,39 @@ static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen
 }
 
 
+/*
+ * WriteFile() has no gathering form for a serial port; send the
+ * message in one piece at least.
+ */
+static int ser_sendv(union filedescriptor *fd, const struct serial_iov * iov,
+                     int iovcnt)
+{
+	return serial_sendv_gather(fd, iov, iovcnt, ser_send);
+}
+
+
+/*
+ * No round-trip time is measured here; start from a short timeout and
+ * back off.
+ */
+long serial_adaptive_timeout(int attempt)
+{
+	long t = 250;
+
+	while (attempt-- > 0 && t < serial_recv_timeout)
+		t *= 2;
+
+	return t < serial_recv_timeout? t: serial_recv_timeout;
+}
+
+
 static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
 {
 	unsigned char c;
 	unsigned char * p = buf;
-	DWORD read;
+	size_t n, len = 0;
+	struct ser_rbuf * rb;
+	DWORD deadline, got;
 
 	HANDLE hComPort=(HANDLE)fd->pfd;
 	
@@ -292,34 +493,51 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
               progname); 
 		exit(1);
 	}
-	
-	serial_w32SetTimeOut(hComPort, serial_recv_timeout);
-	
-	if (!ReadFile(hComPort, buf, buflen, &read, NULL)) {
-		LPVOID lpMsgBuf;
-		FormatMessage( 
-			FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-			FORMAT_MESSAGE_FROM_SYSTEM | 
-			FORMAT_MESSAGE_IGNORE_INSERTS,
-			NULL,
-			GetLastError(),
-			MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
-			(LPTSTR) &lpMsgBuf,
-			0,
-			NULL 	);
-		fprintf(stderr, "%s: ser_recv(): read error: %s\n",
-			      progname, (char*)lpMsgBuf);
-		LocalFree( lpMsgBuf );
-		exit(1);
-	}
 
-	/* time out detected */
-	if (read == 0) {
-		if (verbose > 1)
-		fprintf(stderr,
-			"%s: ser_recv(): programmer is not responding\n",
-			progname);
-		return -1;
+	deadline = GetTickCount() + serial_recv_timeout;
+	rb = ser_get_rbuf(hComPort);
+
+	while (len < buflen) {
+		if (rb->count > 0) {
+			n = buflen - len;
+			if (n > rb->count)
+				n = rb->count;
+			memcpy(p, rb->data + rb->pos, n);
+			rb->pos += n;
+			rb->count -= n;
+			p += n;
+			len += n;
+			continue;
+		}
+
+		if (buflen - len >= SER_RBUFSIZE) {
+			/* large reads go straight to the caller's buffer */
+			if (ser_overlapped(hComPort, &rb->rov, 0, p, buflen - len,
+					   ser_time_left(deadline), &got) < 0) {
+				ser_print_error("ser_recv", "read");
+				exit(1);
+			}
+			p += got;
+			len += got;
+		}
+		else {
+			if (ser_overlapped(hComPort, &rb->rov, 0, rb->data, SER_RBUFSIZE,
+					   ser_time_left(deadline), &got) < 0) {
+				ser_print_error("ser_recv", "read");
+				exit(1);
+			}
+			rb->pos = 0;
+			rb->count = got;
+		}
+
+		/* time out detected */
+		if (got == 0) {
+			if (verbose > 1)
+			fprintf(stderr,
+				"%s: ser_recv(): programmer is not responding\n",
+				progname);
+			return -1;
+		}
 	}
 
 	p = buf;
@@ -328,7 +546,7 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 	{
 		fprintf(stderr, "%s: Recv: ", progname);
 
-		while (read) {
+		while (len) {
 			c = *p;
 			if (isprint(c)) {
 				fprintf(stderr, "%c ", c);
@@ -339,7 +557,7 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 			fprintf(stderr, "[%02x] ", c);
 
 			p++;
-			read--;
+			len--;
 		}
 		fprintf(stderr, "\n");
 	}
@@ -347,12 +565,22 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 }
 
 
+/*
+ * How long the line has to stay quiet for a drain, as in ser_posix.c:
+ * long enough for the latency timer of a USB-serial adapter and a good
+ * many characters at the port speed, but no longer than the old fixed
+ * time, which also bounds a drain as a whole.
+ */
+#define SER_DRAIN_MIN    20     /* ms */
+#define SER_DRAIN_CHARS  64     /* characters at the port speed */
+#define SER_DRAIN_MAX   250     /* ms */
+
 static int ser_drain(union filedescriptor *fd, int display)
 {
-	// int rc;
-	unsigned char buf[10];
-	BOOL readres;
-	DWORD read;
+	unsigned char buf[SER_RBUFSIZE];
+	struct ser_rbuf * rb;
+	DWORD read, window, limit, left;
+	DWORD i;
 
 	HANDLE hComPort=(HANDLE)fd->pfd;
 
@@ -362,34 +590,45 @@ static int ser_drain(union filedescriptor *fd, int display)
 		exit(1);
 	}
 
-	serial_w32SetTimeOut(hComPort,250);
+	rb = ser_get_rbuf(hComPort);
+	window = rb->baud > 0? SER_DRAIN_CHARS * 10 * 1000L / rb->baud + 1:
+		SER_DRAIN_MAX;
+	if (window < SER_DRAIN_MIN)
+		window = SER_DRAIN_MIN;
+	if (window > SER_DRAIN_MAX)
+		window = SER_DRAIN_MAX;
+	limit = GetTickCount() + SER_DRAIN_MAX;
   
 	if (display) {
 		fprintf(stderr, "drain>");
 	}
 
+	/* throw away what has been received already */
+	if (display)
+		while (rb->count > 0) {
+			fprintf(stderr, "%02x ", rb->data[rb->pos++]);
+			rb->count--;
+		}
+	rb->pos = rb->count = 0;
+	/* and what the driver holds, unless it is to be shown */
+	if (!display)
+		PurgeComm(hComPort, PURGE_RXCLEAR);
+
 	while (1) {
-		readres=ReadFile(hComPort, buf, 1, &read, NULL);
-		if (!readres) {
-			LPVOID lpMsgBuf;
-			FormatMessage( 
-				FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-				FORMAT_MESSAGE_FROM_SYSTEM | 
-				FORMAT_MESSAGE_IGNORE_INSERTS,
-				NULL,
-				GetLastError(),
-				MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
-				(LPTSTR) &lpMsgBuf,
-				0,
-				NULL 	);
-			fprintf(stderr, "%s: ser_drain(): read error: %s\n",
-					  progname, (char*)lpMsgBuf);
-			LocalFree( lpMsgBuf );
+		/* until the line has been quiet for a window, within the limit */
+		left = ser_time_left(limit);
+		if (left > window)
+			left = window;
+		if (ser_overlapped(hComPort, &rb->rov, 0, buf, sizeof(buf), left,
+				   &read) < 0) {
+			ser_print_error("ser_drain", "read");
 			exit(1);
 		}
 
 		if (read) { // data avail
-			if (display) fprintf(stderr, "%02x ", buf[0]);
+			if (display)
+				for (i = 0; i < read; i++)
+					fprintf(stderr, "%02x ", buf[i]);
 		}
 		else { // no more data
 			if (display) fprintf(stderr, "<drain\n");
@@ -405,6 +644,7 @@ struct serial_device serial_serdev =
   .setspeed = ser_setspeed,
   .close = ser_close,
   .send = ser_send,
+  .sendv = ser_sendv,
   .recv = ser_recv,
   .drain = ser_drain,
   .set_dtr_rts = ser_set_dtr_rts,
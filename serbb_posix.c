@@ -71,9 +71,58 @@ static char *serpins[DB9PINS + 1] =
   { "NONE", "CD", "RXD", "TXD", "DTR", "GND", "DSR", "RTS", "CTS", "RI" };
 #endif
 
+/*
+ * Private data for this programmer: the state of the output lines as
+ * last set, so that a pin change is a single TIOCMBIS or TIOCMBIC, or
+ * nothing at all if the pin is already there.  Only serbb drives the
+ * lines of the port, so the copy stays right once read.
+ */
+struct pdata
+{
+  unsigned int ctl;             /* modem control word */
+  int ctl_valid;
+  int brk;                      /* txd break state, -1 if unknown */
+};
+
+#define PDATA(pgm) ((struct pdata *)(pgm->cookie))
+
+static void serbb_setup(PROGRAMMER * pgm)
+{
+  if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0) {
+    fprintf(stderr,
+	    "%s: serbb_setup(): Out of memory allocating private data\n",
+	    progname);
+    exit(1);
+  }
+  memset(pgm->cookie, 0, sizeof(struct pdata));
+  PDATA(pgm)->brk = -1;
+}
+
+static void serbb_teardown(PROGRAMMER * pgm)
+{
+  free(pgm->cookie);
+}
+
+/* the modem control word, read from the port the first time */
+static int serbb_getctl(PROGRAMMER * pgm, unsigned int * ctl)
+{
+  struct pdata *pd = PDATA(pgm);
+
+  if (!pd->ctl_valid) {
+    if (ioctl(pgm->fd.ifd, TIOCMGET, &pd->ctl) < 0) {
+      perror("ioctl(\"TIOCMGET\")");
+      return -1;
+    }
+    pd->ctl_valid = 1;
+  }
+  *ctl = pd->ctl;
+  return 0;
+}
+
 static int serbb_setpin(PROGRAMMER * pgm, int pinfunc, int value)
 {
-  unsigned int	ctl;
+  struct pdata *pd = PDATA(pgm);
+  unsigned int	ctl, bit;
   int           r;
   int pin = pgm->pinno[pinfunc]; // get its value
 
@@ -93,29 +142,35 @@ static int serbb_setpin(PROGRAMMER * pgm, int pinfunc, int value)
   switch ( pin )
   {
     case 3:  /* txd */
+             value = value != 0;
+             if (pd->brk == value)
+               break;
 	     r = ioctl(pgm->fd.ifd, value ? TIOCSBRK : TIOCCBRK, 0);
 	     if (r < 0) {
 	       perror("ioctl(\"TIOCxBRK\")");
+	       pd->brk = -1;
 	       return -1;
 	     }
+             pd->brk = value;
              break;
 
     case 4:  /* dtr */
     case 7:  /* rts */
-             r = ioctl(pgm->fd.ifd, TIOCMGET, &ctl);
+             if (serbb_getctl(pgm, &ctl) < 0)
+               return -1;
+             bit = serregbits[pin];
+             if (((ctl & bit) != 0) == (value != 0))
+               break;
+	     r = ioctl(pgm->fd.ifd, value ? TIOCMBIS : TIOCMBIC, &bit);
  	     if (r < 0) {
-	       perror("ioctl(\"TIOCMGET\")");
+	       perror("ioctl(\"TIOCMBIx\")");
+	       pd->ctl_valid = 0;
 	       return -1;
  	     }
              if ( value )
-               ctl |= serregbits[pin];
+               pd->ctl |= bit;
              else
-               ctl &= ~(serregbits[pin]);
-	     r = ioctl(pgm->fd.ifd, TIOCMSET, &ctl);
- 	     if (r < 0) {
-	       perror("ioctl(\"TIOCMSET\")");
-	       return -1;
- 	     }
+               pd->ctl &= ~bit;
              break;
 
     default: /* impossible */
@@ -179,6 +234,82 @@ static int serbb_getpin(PROGRAMMER * pgm, int pinfunc)
   }
 }
 
+static void serbb_mset(PROGRAMMER * pgm, unsigned int ctl)
+{
+  if (ioctl(pgm->fd.ifd, TIOCMSET, &ctl) < 0) {
+    perror("ioctl(\"TIOCMSET\")");
+    PDATA(pgm)->ctl_valid = 0;
+  } else
+    PDATA(pgm)->ctl = ctl;
+
+  if (pgm->ispdelay > 1)
+    bitbang_delay(pgm->ispdelay);
+}
+
+/*
+ * Clock a buffer through the SPI pins.  With MOSI and SCK both on
+ * DTR or RTS the modem control word of every half clock is known in
+ * advance, so a bit is two TIOCMSET and one TIOCMGET, with MOSI
+ * changing along with the falling SCK edge of the previous bit,
+ * instead of a read-modify-write for every pin change.
+ */
+static int serbb_xfer_buf(PROGRAMMER * pgm, const unsigned char *tx,
+                          unsigned char *rx, int len)
+{
+  unsigned int ctl, out[2][2];
+  int mosi = pgm->pinno[PIN_AVR_MOSI];
+  int sck = pgm->pinno[PIN_AVR_SCK];
+  int miso = pgm->pinno[PIN_AVR_MISO];
+  int mbit, sbit, b, i, j;
+  unsigned char r;
+
+  if (((mosi & PIN_MASK) != 4 && (mosi & PIN_MASK) != 7) ||
+      ((sck & PIN_MASK) != 4 && (sck & PIN_MASK) != 7) ||
+      (mosi & PIN_MASK) == (sck & PIN_MASK))
+    return -1;
+  switch (miso & PIN_MASK) {
+    case 1: case 6: case 8: case 9:
+      break;
+    default:
+      return -1;
+  }
+
+  if (serbb_getctl(pgm, &ctl) < 0)
+    return -1;
+
+  /* out[MOSI][SCK] */
+  mbit = serregbits[mosi & PIN_MASK];
+  sbit = serregbits[sck & PIN_MASK];
+  for (b=0; b<2; b++) {
+    out[b][0] = out[b][1] = ctl & ~(mbit | sbit);
+    if (b ^ ((mosi & PIN_INVERSE) != 0)) {
+      out[b][0] |= mbit;
+      out[b][1] |= mbit;
+    }
+    out[b][(sck & PIN_INVERSE) == 0] |= sbit;
+  }
+
+  b = 0;
+  for (i=0; i<len; i++) {
+    r = 0;
+    for (j=7; j>=0; j--) {
+      b = (tx[i] >> j) & 0x01;
+      serbb_mset(pgm, out[b][0]);
+      serbb_mset(pgm, out[b][1]);
+      /* the input lines, the shadow copy is left alone */
+      if (ioctl(pgm->fd.ifd, TIOCMGET, &ctl) < 0)
+        perror("ioctl(\"TIOCMGET\")");
+      else if (((ctl & serregbits[miso & PIN_MASK]) != 0) ^
+               ((miso & PIN_INVERSE) != 0))
+        r |= 1 << j;
+    }
+    rx[i] = r;
+  }
+  serbb_mset(pgm, out[b][0]);
+
+  return 0;
+}
+
 static int serbb_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 {
   int pin = pgm->pinno[pinfunc]; // replace pin name by its value
@@ -230,6 +361,8 @@ static int serbb_open(PROGRAMMER *pgm, char *port)
   /* adapted from uisp code */
 
   pgm->fd.ifd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  PDATA(pgm)->ctl_valid = 0;
+  PDATA(pgm)->brk = -1;
 
   if (pgm->fd.ifd < 0) {
     perror(port);
@@ -308,12 +441,17 @@ void serbb_initpgm(PROGRAMMER *pgm)
   pgm->program_enable = bitbang_program_enable;
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
   pgm->cmd_tpi        = bitbang_cmd_tpi;
   pgm->open           = serbb_open;
   pgm->close          = serbb_close;
   pgm->setpin         = serbb_setpin;
   pgm->getpin         = serbb_getpin;
+  pgm->bitbang_xfer_buf = serbb_xfer_buf;
   pgm->highpulsepin   = serbb_highpulsepin;
+  pgm->setup          = serbb_setup;
+  pgm->teardown       = serbb_teardown;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
 }
@@ -0,0 +1,63 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Code shared by the serial devices of serial.h.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avrdude.h"
+#include "serial.h"
+
+int serial_sendv_gather(union filedescriptor *fd,
+                        const struct serial_iov * iov, int iovcnt,
+                        int (*send)(union filedescriptor *fd,
+                                    unsigned char * buf, size_t buflen))
+{
+  unsigned char sbuf[512], * buf;
+  size_t len;
+  int i, rc;
+
+  for (len = 0, i = 0; i < iovcnt; i++)
+    len += iov[i].len;
+
+  buf = sbuf;
+  if (len > sizeof(sbuf) && (buf = malloc(len)) == NULL) {
+    fprintf(stderr, "%s: serial_sendv_gather(): out of memory\n",
+            progname);
+    exit(1);
+  }
+  for (len = 0, i = 0; i < iovcnt; i++) {
+    memcpy(buf + len, iov[i].buf, iov[i].len);
+    len += iov[i].len;
+  }
+
+  rc = send(fd, buf, len);
+
+  if (buf != sbuf)
+    free(buf);
+
+  return rc;
+}
@@ -30,6 +30,7 @@
 #define serial_h
 
 extern long serial_recv_timeout;
+extern int serial_low_latency;  /* tune USB-serial adapters for latency */
 union filedescriptor
 {
   int ifd;
@@ -58,6 +59,12 @@ union pinfo
   } usbinfo;
 };
 
+/* one segment of a message handed to sendv() */
+struct serial_iov
+{
+  unsigned char * buf;
+  size_t len;
+};
 
 struct serial_device
 {
@@ -67,6 +74,9 @@ struct serial_device
   void (*close)(union filedescriptor *fd);
 
   int (*send)(union filedescriptor *fd, unsigned char * buf, size_t buflen);
+  // send the segments of iov as one message
+  int (*sendv)(union filedescriptor *fd, const struct serial_iov * iov,
+               int iovcnt);
   int (*recv)(union filedescriptor *fd, unsigned char * buf, size_t buflen);
   int (*drain)(union filedescriptor *fd, int display);
 
@@ -78,6 +88,19 @@ struct serial_device
 };
 
 extern struct serial_device *serdev;
+
+/*
+ * serial_send(), serial_sendv() and serial_recv() go through these
+ * while serial_watch is set, i.e. when the transfer statistics or the
+ * trace are on; see stats.h and trace.h.
+ */
+extern int serial_watch;
+int serial_watch_send(union filedescriptor *fd, unsigned char * buf,
+                      size_t buflen);
+int serial_watch_sendv(union filedescriptor *fd,
+                       const struct serial_iov * iov, int iovcnt);
+int serial_watch_recv(union filedescriptor *fd, unsigned char * buf,
+                      size_t buflen);
 extern struct serial_device serial_serdev;
 extern struct serial_device usb_serdev;
 extern struct serial_device usb_serdev_frame;
@@ -86,9 +109,31 @@ extern struct serial_device avrdoper_serdev;
 #define serial_open (serdev->open)
 #define serial_setspeed (serdev->setspeed)
 #define serial_close (serdev->close)
-#define serial_send (serdev->send)
-#define serial_recv (serdev->recv)
+#define serial_send(fd, buf, len) \
+  (serial_watch? serial_watch_send(fd, buf, len): serdev->send(fd, buf, len))
+#define serial_sendv(fd, iov, cnt) \
+  (serial_watch? serial_watch_sendv(fd, iov, cnt): serdev->sendv(fd, iov, cnt))
+#define serial_recv(fd, buf, len) \
+  (serial_watch? serial_watch_recv(fd, buf, len): serdev->recv(fd, buf, len))
 #define serial_drain (serdev->drain)
 #define serial_set_dtr_rts (serdev->set_dtr_rts)
 
+/*
+ * Receive timeout in ms for the given retry (counting from 0) of a
+ * handshake: srtt + 4 * rttvar, the smoothed round-trip time measured
+ * on the serial line so far plus four times its mean deviation, but at
+ * least 100 ms; 250 ms before anything has been measured (always, on
+ * Win32).  Doubled on every retry and limited to serial_recv_timeout.
+ */
+long serial_adaptive_timeout(int attempt);
+
+/*
+ * Copy the segments of iov into one buffer and hand it to send(), for
+ * devices that cannot send scattered data themselves.
+ */
+int serial_sendv_gather(union filedescriptor *fd,
+                        const struct serial_iov * iov, int iovcnt,
+                        int (*send)(union filedescriptor *fd,
+                                    unsigned char * buf, size_t buflen));
+
 #endif /* serial_h */
@@ -0,0 +1,264 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Server mode: keep the programmer open and in programming mode, and
+ * carry out memory operations sent over a local socket.
+ *
+ * Clients send one request per line and get one reply line, "ok" or
+ * "error", for each.  A request is a -U operation
+ * (memtype:op:filename[:format], optionally preceded by "-U"),
+ * "erase" for a chip erase, or "quit" to end server mode.  Empty lines
+ * and lines starting with '#' are ignored.  Diagnostics go to the
+ * server's stderr as usual; file names are relative to the server's
+ * working directory.  Clients are served one after the other.
+ */
+
+#include "ac_cfg.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if !defined(WIN32NATIVE)
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+#include "server.h"
+#include "update.h"
+
+#if !defined(WIN32NATIVE)
+
+#define SERVER_LINELEN 1024
+
+/*
+ * Run the -U operation in line, erasing the chip first where a
+ * command line run would have done that for it.
+ */
+static int server_update(PROGRAMMER * pgm, struct avrpart * p, char * line,
+                         enum updateflags flags)
+{
+  const char * memname = (p->flags & AVRPART_HAS_PDI)? "application": "flash";
+  UPDATE * upd;
+  AVRMEM * m;
+  int rc;
+
+  if ((upd = parse_op(line)) == NULL)
+    return -1;
+
+  if (upd->memtype == NULL && (upd->memtype = strdup(memname)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  if (update_is_delta(upd) &&
+      !((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL)) {
+    /* as on the command line, see main() */
+    if (!pgm->page_write_erases) {
+      fprintf(stderr, "%s: a delta write needs a programmer that erases "
+              "each page it writes\n", progname);
+      free_update(upd);
+      return -1;
+    }
+    flags &= ~UF_AUTO_ERASE;
+  }
+
+  if ((flags & UF_AUTO_ERASE) &&
+      !((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL)) {
+    flags &= ~UF_AUTO_ERASE;
+    m = avr_locate_mem(p, upd->memtype);
+    if (m != NULL && strcasecmp(m->desc, memname) == 0 &&
+        upd->op == DEVICE_WRITE && !(flags & UF_NOWRITE)) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: erasing chip\n", progname);
+      if (avr_chip_erase(pgm, p) != 0) {
+        free_update(upd);
+        return -1;
+      }
+    }
+  }
+
+  rc = do_op(pgm, p, upd, flags);
+  free_update(upd);
+
+  return rc;
+}
+
+/*
+ * Serve the requests of one client; returns 1 after "quit", else 0.
+ */
+static int server_client(PROGRAMMER * pgm, struct avrpart * p, int fd,
+                         enum updateflags flags)
+{
+  char line[SERVER_LINELEN];
+  const char * reply;
+  char * s, * e;
+  FILE * f;
+  size_t len;
+  int c, rc, quit = 0;
+
+  if ((f = fdopen(fd, "r")) == NULL) {
+    close(fd);
+    return 0;
+  }
+
+  while (!quit && fgets(line, sizeof(line), f) != NULL) {
+    len = strlen(line);
+    if (len > 0 && line[len - 1] != '\n' && !feof(f)) {
+      /* never run a part of a request */
+      while ((c = getc(f)) != EOF && c != '\n')
+        ;
+      fprintf(stderr, "%s: server request longer than %d characters\n",
+              progname, SERVER_LINELEN - 2);
+      if (write(fd, "error\n", 6) < 0)
+        break;
+      continue;
+    }
+    for (s = line; isspace((int)*s); s++)
+      ;
+    for (e = s + strlen(s); e > s && isspace((int)e[-1]); e--)
+      ;
+    *e = 0;
+    if (*s == 0 || *s == '#')
+      continue;
+
+    if (verbose > 0)
+      fprintf(stderr, "%s: server request: %s\n", progname, s);
+
+    if (strcmp(s, "quit") == 0) {
+      quit = 1;
+      rc = 0;
+    } else if (strcmp(s, "erase") == 0) {
+      if (flags & UF_NOWRITE) {
+        fprintf(stderr, "%s: -n option specified, NOT erasing chip\n",
+                progname);
+        rc = -1;
+      } else {
+        rc = avr_chip_erase(pgm, p);
+      }
+    } else {
+      if (strncmp(s, "-U", 2) == 0)
+        for (s += 2; isspace((int)*s); s++)
+          ;
+      rc = server_update(pgm, p, s, flags);
+    }
+
+    reply = rc == 0? "ok\n": "error\n";
+    if (write(fd, reply, strlen(reply)) < 0)
+      break;
+  }
+
+  fclose(f);
+
+  return quit;
+}
+
+int server_mode(PROGRAMMER * pgm, struct avrpart * p, const char * path,
+                enum updateflags flags)
+{
+  struct sockaddr_un addr;
+  void (*oldpipe)(int);
+  struct stat st;
+  mode_t oldmask;
+  int sfd, fd, rc = 0;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: server socket name \"%s\" is too long\n",
+            progname, path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((sfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "%s: can't create server socket: %s\n",
+            progname, strerror(errno));
+    return -1;
+  }
+  /* a socket left over from an earlier run, but nothing else */
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "%s: \"%s\" exists and is not a socket\n",
+              progname, path);
+      close(sfd);
+      return -1;
+    }
+    unlink(path);
+  }
+  /* only the user running avrdude may connect */
+  oldmask = umask(077);
+  if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(sfd, 1) < 0) {
+    fprintf(stderr, "%s: can't listen on server socket \"%s\": %s\n",
+            progname, path, strerror(errno));
+    umask(oldmask);
+    close(sfd);
+    return -1;
+  }
+  umask(oldmask);
+
+  /* a client going away must not take the server with it */
+  oldpipe = signal(SIGPIPE, SIG_IGN);
+
+  if (quell_progress < 2)
+    fprintf(stderr, "%s: serving requests on \"%s\"\n", progname, path);
+
+  for (;;) {
+    if ((fd = accept(sfd, NULL, NULL)) < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "%s: accept on server socket failed: %s\n",
+              progname, strerror(errno));
+      rc = -1;
+      break;
+    }
+    if (server_client(pgm, p, fd, flags))
+      break;
+  }
+
+  signal(SIGPIPE, oldpipe);
+  close(sfd);
+  unlink(path);
+
+  return rc;
+}
+
+#else  /* WIN32NATIVE */
+
+int server_mode(PROGRAMMER * pgm, struct avrpart * p, const char * path,
+                enum updateflags flags)
+{
+  fprintf(stderr, "%s: server mode is not supported on this platform\n",
+          progname);
+  return -1;
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef server_h
+#define server_h
+
+#include "avr.h"
+#include "pgm.h"
+#include "update.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Listen on the local socket path and carry out the memory operations
+ * clients send, with the update flags of the command line, until a
+ * client sends "quit".  Returns -1 if the socket cannot be set up.
+ */
+int server_mode(PROGRAMMER * pgm, struct avrpart * p, const char * path,
+                enum updateflags flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,951 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Simulated programmers, to measure the host side of avrdude without
+ * any hardware.
+ *
+ * The "sim" programmer type talks to an in-memory AVR target through
+ * its ISP instructions, like a bitbang programmer would.  With a port
+ * name of "sim", the serial programmers "stk500v2" and "picoboot" talk
+ * to a firmware emulation instead of a serial port, so their real
+ * protocol code runs.  Options follow the port name, separated by
+ * colons:
+ *
+ *   latency=<usec>     time between the end of a request and the start
+ *                      of the answer (default 0)
+ *   bandwidth=<B/s>    line speed, in bytes per second; 0 for an
+ *                      infinitely fast line (default: baud rate / 10
+ *                      for the serial programmers, 0 for "sim")
+ *
+ * Page writes and erases keep the simulated device busy for the times
+ * given in the part description.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+#include "serial.h"
+#include "sim.h"
+#include "stk500v2_private.h"
+
+#define SIM_QUEUELEN    16384   /* answer bytes in flight */
+#define SIM_FRAMELEN    1024    /* request frame received by the device */
+
+/* picoboot frame commands and answers, see picoboot.c */
+#define PICO_DATA       0x00
+#define PICO_FILL       0x01
+#define PICO_ERASE      0x03
+#define PICO_WRITE      0x05
+#define PICO_FILL_NEXT  0x41
+#define PICO_PROBE_LO   0x50
+#define PICO_PROBE_HI   0x42
+#define PICO_ACK        0x00
+#define PICO_NAK        0xff
+#define PICO_PROTO      0x01
+
+/*
+ * The target: memories and fuses, and the page buffers filled by the
+ * load page instructions.
+ */
+struct sim_target {
+  unsigned char * flash, * flash_page;
+  unsigned long flash_size, flash_pagesize;
+  unsigned char * eeprom, * eeprom_page, * eeprom_loaded;
+  unsigned long eeprom_size, eeprom_pagesize;
+  unsigned char signature[3], fuse[3], lock, calibration;
+  unsigned char ext_addr;
+  /* device busy times, in microseconds */
+  unsigned long flash_delay, eeprom_delay, erase_delay;
+};
+
+/*
+ * The line between host and device.  Answer bytes are queued with the
+ * time they have arrived at the host.
+ */
+struct sim_link {
+  unsigned long latency;        /* usec */
+  unsigned long bandwidth;      /* bytes per second, 0 is unlimited */
+  unsigned long long tx_free;   /* host to device line idle from then */
+  unsigned long long rx_free;   /* device to host line idle from then */
+  unsigned char q[SIM_QUEUELEN];
+  unsigned long long q_time[SIM_QUEUELEN];
+  unsigned int q_head, q_len;
+};
+
+enum sim_proto {
+  SIM_SPI,
+  SIM_STK500V2,
+  SIM_PICOBOOT
+};
+
+/* one simulated connection */
+struct sim {
+  enum sim_proto proto;
+  struct sim_target * t;
+  struct sim_link link;
+
+  /* request frame being received by the device */
+  unsigned char frame[SIM_FRAMELEN];
+  unsigned int framelen;
+
+  /* stk500v2 firmware */
+  unsigned char params[256];
+  unsigned long addr;
+
+  /* picoboot bootloader */
+  unsigned int word, fill_addr;
+  int after_sync;
+};
+
+/* set up by sim_attach() for the next sim_serdev open */
+static struct sim * sim_pending;
+
+
+static unsigned long long sim_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static void sim_wait_until(unsigned long long t)
+{
+  unsigned long long now;
+
+  while ((now = sim_now()) < t)
+    usleep(t - now);
+}
+
+/* time needed to move n bytes over the line */
+static unsigned long long sim_bytes_time(struct sim_link * l, unsigned long n)
+{
+  return l->bandwidth? n * 1000000ULL / l->bandwidth: 0;
+}
+
+
+static struct sim_target * sim_target_new(AVRPART * p)
+{
+  struct sim_target * t;
+  AVRMEM * m;
+
+  if ((t = calloc(1, sizeof(*t))) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  if ((m = avr_locate_mem(p, "flash")) != NULL) {
+    t->flash_size = m->size;
+    t->flash_pagesize = m->page_size > 0? m->page_size: 2;
+    t->flash_delay = m->max_write_delay;
+  }
+  if ((m = avr_locate_mem(p, "eeprom")) != NULL) {
+    t->eeprom_size = m->size;
+    t->eeprom_pagesize = m->page_size > 0? m->page_size: 1;
+    t->eeprom_delay = m->max_write_delay;
+  }
+  t->erase_delay = p->chip_erase_delay;
+
+  if ((t->flash = malloc(t->flash_size + 1)) == NULL ||
+      (t->flash_page = malloc(t->flash_pagesize)) == NULL ||
+      (t->eeprom = malloc(t->eeprom_size + 1)) == NULL ||
+      (t->eeprom_page = malloc(t->eeprom_pagesize)) == NULL ||
+      (t->eeprom_loaded = malloc(t->eeprom_pagesize)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  memset(t->flash, 0xff, t->flash_size);
+  memset(t->flash_page, 0xff, t->flash_pagesize);
+  memset(t->eeprom, 0xff, t->eeprom_size);
+  memset(t->eeprom_loaded, 0, t->eeprom_pagesize);
+
+  memcpy(t->signature, p->signature, sizeof(t->signature));
+  memset(t->fuse, 0xff, sizeof(t->fuse));
+  t->lock = 0xff;
+  t->calibration = 0x80;
+
+  return t;
+}
+
+static void sim_target_free(struct sim_target * t)
+{
+  if (t == NULL)
+    return;
+  free(t->flash);
+  free(t->flash_page);
+  free(t->eeprom);
+  free(t->eeprom_page);
+  free(t->eeprom_loaded);
+  free(t);
+}
+
+/*
+ * Carry out one 4-byte ISP instruction on the target.  Returns the
+ * time the target is busy afterwards, in microseconds.
+ */
+static unsigned long sim_isp(struct sim_target * t, const unsigned char * cmd,
+                             unsigned char * res)
+{
+  unsigned long addr = (cmd[1] << 8) | cmd[2];
+  unsigned long faddr = (((unsigned long)t->ext_addr << 16) | addr) * 2 +
+    ((cmd[0] & 0x08) != 0);
+  unsigned long i, base;
+
+  res[0] = 0;
+  res[1] = cmd[0];
+  res[2] = cmd[1];
+  res[3] = 0;
+
+  switch (cmd[0]) {
+    case 0xac:
+      if (cmd[1] == 0x53)
+        break;                  /* programming enable, echoed */
+      if ((cmd[1] & 0xe0) == 0x80) {
+        memset(t->flash, 0xff, t->flash_size);
+        memset(t->eeprom, 0xff, t->eeprom_size);
+        t->lock = 0xff;
+        return t->erase_delay;
+      }
+      if ((cmd[1] & 0xe0) == 0xe0)
+        t->lock = cmd[3];
+      else if (cmd[1] == 0xa0)
+        t->fuse[0] = cmd[3];
+      else if (cmd[1] == 0xa8)
+        t->fuse[1] = cmd[3];
+      else if (cmd[1] == 0xa4)
+        t->fuse[2] = cmd[3];
+      return t->eeprom_delay;
+
+    case 0x50:                  /* lfuse, efuse */
+      res[3] = cmd[1] & 0x08? t->fuse[2]: t->fuse[0];
+      break;
+
+    case 0x58:                  /* lock, hfuse */
+      res[3] = cmd[1] & 0x08? t->fuse[1]: t->lock;
+      break;
+
+    case 0x30:
+      res[3] = (cmd[2] & 3) < 3? t->signature[cmd[2] & 3]: 0xff;
+      break;
+
+    case 0x38:
+      res[3] = t->calibration;
+      break;
+
+    case 0x20:                  /* read program memory */
+    case 0x28:
+      res[3] = faddr < t->flash_size? t->flash[faddr]: 0xff;
+      break;
+
+    case 0x40:                  /* load program memory page */
+    case 0x48:
+      t->flash_page[faddr % t->flash_pagesize] = cmd[3];
+      break;
+
+    case 0x60:                  /* write program memory, unpaged */
+    case 0x68:
+      if (faddr < t->flash_size)
+        t->flash[faddr] &= cmd[3];
+      return t->flash_delay;
+
+    case 0x4c:                  /* write program memory page */
+      base = (faddr & ~1UL) & ~(t->flash_pagesize - 1);
+      for (i = 0; i < t->flash_pagesize && base + i < t->flash_size; i++)
+        t->flash[base + i] &= t->flash_page[i];
+      memset(t->flash_page, 0xff, t->flash_pagesize);
+      return t->flash_delay;
+
+    case 0x4d:                  /* load extended address */
+      t->ext_addr = cmd[2];
+      break;
+
+    case 0xa0:                  /* read eeprom */
+      if (t->eeprom_size)
+        res[3] = t->eeprom[addr % t->eeprom_size];
+      break;
+
+    case 0xc0:                  /* write eeprom */
+      if (t->eeprom_size == 0)
+        break;
+      t->eeprom[addr % t->eeprom_size] = cmd[3];
+      return t->eeprom_delay;
+
+    case 0xc1:                  /* load eeprom page */
+      i = addr % t->eeprom_pagesize;
+      t->eeprom_page[i] = cmd[3];
+      t->eeprom_loaded[i] = 1;
+      break;
+
+    case 0xc2:                  /* write eeprom page */
+      if (t->eeprom_size == 0)
+        break;
+      base = (addr % t->eeprom_size) & ~(t->eeprom_pagesize - 1);
+      for (i = 0; i < t->eeprom_pagesize; i++)
+        if (t->eeprom_loaded[i] && base + i < t->eeprom_size)
+          t->eeprom[base + i] = t->eeprom_page[i];
+      memset(t->eeprom_loaded, 0, t->eeprom_pagesize);
+      return t->eeprom_delay;
+
+    case 0xf0:                  /* poll RDY/BSY: always ready */
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Queue the answer of the device, sent once the request has arrived
+ * and the device is no longer busy.
+ */
+static void sim_answer(struct sim * s, const unsigned char * buf,
+                       unsigned int len, unsigned long long ready)
+{
+  struct sim_link * l = &s->link;
+  unsigned long long t = ready + l->latency;
+  unsigned int i, k;
+
+  if (t < l->rx_free)
+    t = l->rx_free;
+  for (i = 0; i < len; i++) {
+    if (l->q_len == SIM_QUEUELEN) {
+      fprintf(stderr, "%s: sim: answer queue overflow\n", progname);
+      break;
+    }
+    k = (l->q_head + l->q_len++) % SIM_QUEUELEN;
+    l->q[k] = buf[i];
+    l->q_time[k] = t + sim_bytes_time(l, i + 1);
+  }
+  l->rx_free = t + sim_bytes_time(l, len);
+}
+
+/* stk500v2: answer the command in body, which has been received at t */
+static void sim_stk500v2_cmd(struct sim * s, unsigned char seq,
+                             unsigned char * body, unsigned int len,
+                             unsigned long long t)
+{
+  static unsigned char ans[SIM_FRAMELEN + 8];
+  unsigned char * a = ans + 5, cmd[4], res[4];
+  struct sim_target * tg = s->t;
+  unsigned int n = 0, i, cnt;
+  unsigned long busy = 0, wa;
+
+  a[n++] = body[0];
+  a[n++] = STATUS_CMD_OK;
+
+  switch (body[0]) {
+    case CMD_SIGN_ON:
+      a[n++] = 8;
+      memcpy(a + n, "STK500_2", 8);
+      n += 8;
+      break;
+
+    case CMD_SET_PARAMETER:
+      if (len >= 3)
+        s->params[body[1]] = body[2];
+      break;
+
+    case CMD_GET_PARAMETER:
+      a[n++] = len >= 2? s->params[body[1]]: 0;
+      break;
+
+    case CMD_LOAD_ADDRESS:
+      s->addr = ((unsigned long)body[1] << 24) | (body[2] << 16) |
+        (body[3] << 8) | body[4];
+      if (s->addr & 0x80000000UL) {
+        cmd[0] = 0x4d;
+        cmd[1] = 0;
+        cmd[2] = (s->addr >> 16) & 0xff;
+        cmd[3] = 0;
+        sim_isp(tg, cmd, res);
+      }
+      s->addr &= 0x7fffffffUL;
+      break;
+
+    case CMD_ENTER_PROGMODE_ISP:
+      sim_isp(tg, body + 8, res);
+      break;
+
+    case CMD_LEAVE_PROGMODE_ISP:
+      break;
+
+    case CMD_CHIP_ERASE_ISP:
+      busy = sim_isp(tg, body + 3, res);
+      break;
+
+    case CMD_PROGRAM_FLASH_ISP:
+    case CMD_PROGRAM_EEPROM_ISP:
+      cnt = (body[1] << 8) | body[2];
+      if (len < 10)
+        cnt = 0;
+      else if (cnt > len - 10)
+        cnt = len - 10;
+      wa = s->addr;
+      for (i = 0; i < cnt; i++) {
+        if (body[0] == CMD_PROGRAM_FLASH_ISP) {
+          cmd[0] = body[5] | (i & 1? 0x08: 0);
+          wa = s->addr + i / 2;
+        } else {
+          cmd[0] = body[5];
+          wa = s->addr + i;
+        }
+        cmd[1] = wa >> 8;
+        cmd[2] = wa;
+        cmd[3] = body[10 + i];
+        busy += sim_isp(tg, cmd, res);
+      }
+      if ((body[3] & 0x81) == 0x81) {
+        cmd[0] = body[6];
+        cmd[1] = s->addr >> 8;
+        cmd[2] = s->addr;
+        cmd[3] = 0;
+        busy += sim_isp(tg, cmd, res);
+      }
+      s->addr += body[0] == CMD_PROGRAM_FLASH_ISP? cnt / 2: cnt;
+      break;
+
+    case CMD_READ_FLASH_ISP:
+    case CMD_READ_EEPROM_ISP:
+      cnt = (body[1] << 8) | body[2];
+      if (cnt > SIM_FRAMELEN - 3)
+        cnt = SIM_FRAMELEN - 3;
+      for (i = 0; i < cnt; i++) {
+        if (body[0] == CMD_READ_FLASH_ISP) {
+          cmd[0] = body[3] | (i & 1? 0x08: 0);
+          wa = s->addr + i / 2;
+        } else {
+          cmd[0] = body[3];
+          wa = s->addr + i;
+        }
+        cmd[1] = wa >> 8;
+        cmd[2] = wa;
+        cmd[3] = 0;
+        sim_isp(tg, cmd, res);
+        a[n++] = res[3];
+      }
+      a[n++] = STATUS_CMD_OK;
+      s->addr += body[0] == CMD_READ_FLASH_ISP? cnt / 2: cnt;
+      break;
+
+    case CMD_PROGRAM_FUSE_ISP:
+    case CMD_PROGRAM_LOCK_ISP:
+      busy = sim_isp(tg, body + 1, res);
+      a[n++] = STATUS_CMD_OK;
+      break;
+
+    case CMD_READ_FUSE_ISP:
+    case CMD_READ_LOCK_ISP:
+    case CMD_READ_SIGNATURE_ISP:
+    case CMD_READ_OSCCAL_ISP:
+      sim_isp(tg, body + 2, res);
+      a[n++] = res[(body[1] - 1) & 3];
+      a[n++] = STATUS_CMD_OK;
+      break;
+
+    case CMD_SPI_MULTI:
+      cnt = body[1];
+      for (i = 0; i + 4 <= cnt && 4 + i + 4 <= len; i += 4) {
+        busy += sim_isp(tg, body + 4 + i, res);
+        memcpy(body + 4 + i, res, 4);
+      }
+      for (i = 0; i < body[2]; i++)
+        a[n++] = body[3] + i < cnt? body[4 + body[3] + i]: 0;
+      a[n++] = STATUS_CMD_OK;
+      break;
+
+    default:
+      a[1] = STATUS_CMD_UNKNOWN;
+      break;
+  }
+
+  ans[0] = MESSAGE_START;
+  ans[1] = seq;
+  ans[2] = n >> 8;
+  ans[3] = n;
+  ans[4] = TOKEN;
+  a[n] = 0;
+  for (i = 0; i < n + 5; i++)
+    a[n] ^= ans[i];
+
+  sim_answer(s, ans, n + 6, t + busy);
+}
+
+/* stk500v2: collect the request frame, byte by byte */
+static void sim_stk500v2_rx(struct sim * s, unsigned char c,
+                            unsigned long long t)
+{
+  static const unsigned char cksum_err[] = { ANSWER_CKSUM_ERROR,
+                                             STATUS_CKSUM_ERROR };
+  unsigned int len, i;
+  unsigned char x;
+
+  if (s->framelen == 0 && c != MESSAGE_START)
+    return;
+  if (s->framelen == 4 && c != TOKEN) {
+    s->framelen = 0;
+    return;
+  }
+  s->frame[s->framelen++] = c;
+  if (s->framelen < 5)
+    return;
+
+  len = (s->frame[2] << 8) | s->frame[3];
+  if (len + 6 > SIM_FRAMELEN) {
+    s->framelen = 0;
+    return;
+  }
+  if (s->framelen < len + 6)
+    return;
+
+  for (i = 0, x = 0; i < s->framelen; i++)
+    x ^= s->frame[i];
+  s->framelen = 0;
+  if (x != 0) {
+    unsigned char ans[8];
+
+    ans[0] = MESSAGE_START;
+    ans[1] = s->frame[1];
+    ans[2] = 0;
+    ans[3] = 2;
+    ans[4] = TOKEN;
+    memcpy(ans + 5, cksum_err, 2);
+    ans[7] = 0;
+    for (i = 0; i < 7; i++)
+      ans[7] ^= ans[i];
+    sim_answer(s, ans, 8, t);
+    return;
+  }
+  if (len > 0)
+    sim_stk500v2_cmd(s, s->frame[1], s->frame + 5, len, t);
+}
+
+/* picoboot: one 4-byte frame: data_lo, data_hi, check, command */
+static void sim_picoboot_rx(struct sim * s, unsigned char c,
+                            unsigned long long t)
+{
+  struct sim_target * tg = s->t;
+  unsigned char * f = s->frame, ans;
+  unsigned long busy = 0, i, base;
+  unsigned int data;
+  int sync;
+
+  f[s->framelen++] = c;
+  if (s->framelen < 4)
+    return;
+  s->framelen = 0;
+
+  data = f[0] | (f[1] << 8);
+  sync = f[0] == 0 && f[1] == 0 && f[3] == PICO_DATA;
+  ans = PICO_ACK;
+  if ((f[0] ^ f[1] ^ f[3]) != f[2]) {
+    ans = PICO_NAK;
+  } else switch (f[3]) {
+    case PICO_DATA:
+      if (s->after_sync && f[0] == PICO_PROBE_LO && f[1] == PICO_PROBE_HI)
+        ans = PICO_PROTO;
+      s->word = data;
+      break;
+
+    case PICO_FILL:
+    case PICO_FILL_NEXT:
+      if (f[3] == PICO_FILL) {
+        s->fill_addr = data;
+      } else {
+        s->fill_addr += 2;
+        s->word = data;
+      }
+      i = s->fill_addr % tg->flash_pagesize;
+      tg->flash_page[i] = s->word;
+      tg->flash_page[(i + 1) % tg->flash_pagesize] = s->word >> 8;
+      break;
+
+    case PICO_ERASE:
+      base = data & ~(tg->flash_pagesize - 1);
+      for (i = 0; i < tg->flash_pagesize && base + i < tg->flash_size; i++)
+        tg->flash[base + i] = 0xff;
+      busy = tg->flash_delay;
+      break;
+
+    case PICO_WRITE:
+      base = data & ~(tg->flash_pagesize - 1);
+      for (i = 0; i < tg->flash_pagesize && base + i < tg->flash_size; i++)
+        tg->flash[base + i] &= tg->flash_page[i];
+      memset(tg->flash_page, 0xff, tg->flash_pagesize);
+      busy = tg->flash_delay;
+      break;
+
+    default:
+      ans = PICO_NAK;
+      break;
+  }
+  s->after_sync = sync;
+
+  sim_answer(s, &ans, 1, t + busy);
+}
+
+/* bytes sent by the host arrive at the device */
+static void sim_transmit(struct sim * s, const unsigned char * buf,
+                         size_t len)
+{
+  struct sim_link * l = &s->link;
+  unsigned long long t = sim_now();
+  size_t i;
+
+  if (t < l->tx_free)
+    t = l->tx_free;
+  for (i = 0; i < len; i++) {
+    unsigned long long arrival = t + sim_bytes_time(l, i + 1);
+
+    if (s->proto == SIM_STK500V2)
+      sim_stk500v2_rx(s, buf[i], arrival);
+    else
+      sim_picoboot_rx(s, buf[i], arrival);
+  }
+  l->tx_free = t + sim_bytes_time(l, len);
+}
+
+
+/*
+ * Parse the options following the port name; returns -1 on an
+ * unknown option.
+ */
+static int sim_parse_port(struct sim_link * l, const char * port)
+{
+  const char * s = strchr(port, ':');
+  char * e;
+  unsigned long v;
+
+  while (s != NULL) {
+    s++;
+    if (strncmp(s, "latency=", 8) == 0) {
+      v = strtoul(s + 8, &e, 0);
+      l->latency = v;
+    } else if (strncmp(s, "bandwidth=", 10) == 0) {
+      v = strtoul(s + 10, &e, 0);
+      l->bandwidth = v;
+    } else {
+      e = (char *)s;
+    }
+    if (e == s || (*e != ':' && *e != 0)) {
+      fprintf(stderr, "%s: sim: invalid option in port \"%s\"\n",
+              progname, port);
+      return -1;
+    }
+    s = *e? e: NULL;
+  }
+
+  return 0;
+}
+
+int sim_port(const char * port)
+{
+  return strncmp(port, "sim", 3) == 0 && (port[3] == 0 || port[3] == ':');
+}
+
+int sim_attach(PROGRAMMER * pgm, AVRPART * p)
+{
+  enum sim_proto proto;
+  struct sim * s;
+
+  if (strcmp(pgm->type, "sim") == 0)
+    return 0;
+  if (strcmp(pgm->type, "STK500V2") == 0) {
+    proto = SIM_STK500V2;
+  } else if (strcmp(pgm->type, "Picoboot") == 0) {
+    proto = SIM_PICOBOOT;
+  } else {
+    fprintf(stderr, "%s: sim: programmer type \"%s\" cannot be simulated\n",
+            progname, pgm->type);
+    return -1;
+  }
+
+  if ((s = calloc(1, sizeof(*s))) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  s->proto = proto;
+  s->t = sim_target_new(p);
+  s->params[PARAM_HW_VER] = 2;
+  s->params[PARAM_SW_MAJOR] = 2;
+  s->params[PARAM_SW_MINOR] = 10;
+  s->params[PARAM_VTARGET] = 50;
+  s->params[PARAM_VADJUST] = 50;
+  s->params[PARAM_SCK_DURATION] = 1;
+  s->params[PARAM_TOPCARD_DETECT] = 0xff;
+
+  if (sim_pending != NULL) {
+    sim_target_free(sim_pending->t);
+    free(sim_pending);
+  }
+  sim_pending = s;
+  serdev = &sim_serdev;
+
+  return 0;
+}
+
+
+static int sim_open(char * port, union pinfo pinfo, union filedescriptor * fd)
+{
+  struct sim * s = sim_pending;
+
+  if (s == NULL) {
+    fprintf(stderr, "%s: sim: no simulated device\n", progname);
+    return -1;
+  }
+  s->link.bandwidth = pinfo.baud / 10;
+  if (sim_parse_port(&s->link, port) < 0)
+    return -1;
+  sim_pending = NULL;
+  fd->pfd = s;
+
+  return 0;
+}
+
+static int sim_setspeed(union filedescriptor * fd, long baud)
+{
+  ((struct sim *)fd->pfd)->link.bandwidth = baud / 10;
+  return 0;
+}
+
+static void sim_close(union filedescriptor * fd)
+{
+  struct sim * s = fd->pfd;
+
+  if (s == NULL)
+    return;
+  sim_target_free(s->t);
+  free(s);
+  fd->pfd = NULL;
+}
+
+static int sim_send(union filedescriptor * fd, unsigned char * buf,
+                    size_t buflen)
+{
+  sim_transmit(fd->pfd, buf, buflen);
+  return 0;
+}
+
+static int sim_sendv(union filedescriptor * fd, const struct serial_iov * iov,
+                     int iovcnt)
+{
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    sim_transmit(fd->pfd, iov[i].buf, iov[i].len);
+  return 0;
+}
+
+static int sim_recv(union filedescriptor * fd, unsigned char * buf,
+                    size_t buflen)
+{
+  struct sim_link * l = &((struct sim *)fd->pfd)->link;
+  size_t i;
+
+  for (i = 0; i < buflen; i++) {
+    if (l->q_len == 0) {
+      /* nothing will come: time out like a real port */
+      usleep(serial_recv_timeout * 1000);
+      return -1;
+    }
+    sim_wait_until(l->q_time[l->q_head]);
+    buf[i] = l->q[l->q_head];
+    l->q_head = (l->q_head + 1) % SIM_QUEUELEN;
+    l->q_len--;
+  }
+
+  return 0;
+}
+
+static int sim_drain(union filedescriptor * fd, int display)
+{
+  struct sim_link * l = &((struct sim *)fd->pfd)->link;
+
+  if (l->q_len > 0)
+    sim_wait_until(l->q_time[(l->q_head + l->q_len - 1) % SIM_QUEUELEN]);
+  l->q_len = 0;
+
+  return 0;
+}
+
+static int sim_set_dtr_rts(union filedescriptor * fd, int is_on)
+{
+  return 0;
+}
+
+struct serial_device sim_serdev =
+{
+  .open = sim_open,
+  .setspeed = sim_setspeed,
+  .close = sim_close,
+  .send = sim_send,
+  .sendv = sim_sendv,
+  .recv = sim_recv,
+  .drain = sim_drain,
+  .set_dtr_rts = sim_set_dtr_rts,
+  .flags = SERDEV_FL_CANSETSPEED,
+};
+
+
+/*
+ * The "sim" programmer type: ISP instructions straight to the target.
+ */
+#define PDATA(pgm) ((struct sim *)(pgm->cookie))
+
+static void sim_setup(PROGRAMMER * pgm)
+{
+  if ((pgm->cookie = calloc(1, sizeof(struct sim))) == NULL) {
+    fprintf(stderr, "%s: sim_setup(): Out of memory allocating private data\n",
+            progname);
+    exit(1);
+  }
+  PDATA(pgm)->proto = SIM_SPI;
+}
+
+static void sim_teardown(PROGRAMMER * pgm)
+{
+  sim_target_free(PDATA(pgm)->t);
+  free(pgm->cookie);
+}
+
+static int sim_pgm_open(PROGRAMMER * pgm, char * port)
+{
+  strcpy(pgm->port, port);
+  if (sim_port(port) && sim_parse_port(&PDATA(pgm)->link, port) < 0)
+    return -1;
+  return 0;
+}
+
+static void sim_pgm_close(PROGRAMMER * pgm)
+{
+}
+
+static void sim_enable(PROGRAMMER * pgm)
+{
+}
+
+static void sim_display(PROGRAMMER * pgm, const char * p)
+{
+  fprintf(stderr, "%sLink latency    : %lu us\n", p, PDATA(pgm)->link.latency);
+  fprintf(stderr, "%sLink bandwidth  : %lu bytes/s\n", p,
+          PDATA(pgm)->link.bandwidth);
+}
+
+/* a full-duplex SPI transfer of count bytes, as one transaction */
+static int sim_spi(PROGRAMMER * pgm, const unsigned char * cmd,
+                   unsigned char * res, int count)
+{
+  struct sim * s = PDATA(pgm);
+  unsigned long long done = sim_now() + s->link.latency +
+    sim_bytes_time(&s->link, count);
+  int i;
+
+  if (s->t == NULL)
+    return -1;
+  /* avr.c waits out the write times itself */
+  for (i = 0; i + 4 <= count; i += 4)
+    sim_isp(s->t, cmd + i, res + i);
+  sim_wait_until(done);
+
+  return 0;
+}
+
+static int sim_cmd(PROGRAMMER * pgm, const unsigned char * cmd,
+                   unsigned char * res)
+{
+  return sim_spi(pgm, cmd, res, 4);
+}
+
+static int sim_program_enable(PROGRAMMER * pgm, AVRPART * p)
+{
+  unsigned char cmd[4], res[4];
+
+  if (p->op[AVR_OP_PGM_ENABLE] == NULL) {
+    fprintf(stderr,
+            "%s: sim_program_enable(): program enable instruction not defined for part \"%s\"\n",
+            progname, p->desc);
+    return -1;
+  }
+
+  memset(cmd, 0, sizeof(cmd));
+  avr_set_bits(p->op[AVR_OP_PGM_ENABLE], cmd);
+  if (pgm->cmd(pgm, cmd, res) < 0 || res[2] != cmd[1])
+    return -2;
+
+  return 0;
+}
+
+static int sim_chip_erase(PROGRAMMER * pgm, AVRPART * p)
+{
+  unsigned char cmd[4], res[4];
+
+  if (p->op[AVR_OP_CHIP_ERASE] == NULL) {
+    fprintf(stderr,
+            "%s: sim_chip_erase(): chip erase instruction not defined for part \"%s\"\n",
+            progname, p->desc);
+    return -1;
+  }
+
+  memset(cmd, 0, sizeof(cmd));
+  avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
+  pgm->cmd(pgm, cmd, res);
+  usleep(p->chip_erase_delay);
+
+  return pgm->initialize(pgm, p);
+}
+
+static int sim_initialize(PROGRAMMER * pgm, AVRPART * p)
+{
+  if (PDATA(pgm)->t == NULL)
+    PDATA(pgm)->t = sim_target_new(p);
+
+  return pgm->program_enable(pgm, p);
+}
+
+const char sim_desc[] = "Simulated ISP programmer and target, for benchmarking";
+
+void sim_initpgm(PROGRAMMER * pgm)
+{
+  strcpy(pgm->type, "sim");
+
+  pgm->setup          = sim_setup;
+  pgm->teardown       = sim_teardown;
+  pgm->open           = sim_pgm_open;
+  pgm->close          = sim_pgm_close;
+  pgm->enable         = sim_enable;
+  pgm->disable        = sim_enable;
+  pgm->display        = sim_display;
+  pgm->initialize     = sim_initialize;
+  pgm->program_enable = sim_program_enable;
+  pgm->chip_erase     = sim_chip_erase;
+  pgm->cmd            = sim_cmd;
+  pgm->spi            = sim_spi;
+  pgm->read_byte      = avr_read_byte_default;
+  pgm->write_byte     = avr_write_byte_default;
+}
@@ -0,0 +1,50 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef sim_h
+#define sim_h
+
+#include "avrpart.h"
+#include "pgm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const char sim_desc[];
+void sim_initpgm(PROGRAMMER * pgm);
+
+/* the serial device emulating the programmer firmware */
+extern struct serial_device sim_serdev;
+
+/* nonzero if port names the simulator, "sim" or "sim:<options>" */
+int sim_port(const char * port);
+
+/*
+ * Make the serial programmer pgm talk to an emulation of its firmware
+ * and a target like part p; returns -1 if pgm cannot be simulated.
+ */
+int sim_attach(PROGRAMMER * pgm, AVRPART * p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
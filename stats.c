@@ -0,0 +1,338 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "avrpart.h"
+#include "serial.h"
+#include "stats.h"
+#include "trace.h"
+
+#define STATS_MAXMEM 32
+
+struct stats_count {
+  unsigned long calls;          /* operations, or transport calls */
+  unsigned long bytes;
+  unsigned long pages;
+  double        seconds;
+};
+
+static struct stats_mem {
+  char desc[AVR_MEMDESCLEN];
+  struct stats_count dir[2];
+} stats_mems[STATS_MAXMEM];
+static int stats_nmems;
+
+static struct stats_count stats_transport[2];
+static unsigned long stats_retries;
+static double stats_start;
+
+/* the counts of an earlier run, read back by stats_read() */
+static struct stats_mem stats_refs[STATS_MAXMEM];
+static int stats_nrefs;
+static struct stats_count stats_ref_transport[2];
+
+int stats_enabled;
+int serial_watch;
+
+
+void stats_enable(void)
+{
+  stats_enabled = 1;
+  serial_watch = 1;
+  stats_start = stats_time();
+}
+
+double stats_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct stats_count * stats_find(const char * desc, int dir)
+{
+  int i;
+
+  for (i = 0; i < stats_nmems; i++)
+    if (strcmp(stats_mems[i].desc, desc) == 0)
+      return &stats_mems[i].dir[dir];
+  if (stats_nmems == STATS_MAXMEM)
+    return NULL;
+
+  snprintf(stats_mems[i].desc, sizeof(stats_mems[i].desc), "%s", desc);
+  stats_nmems++;
+  return &stats_mems[i].dir[dir];
+}
+
+void stats_mem(const char * desc, int dir, long bytes, double start)
+{
+  struct stats_count * c;
+
+  if (!stats_enabled || (c = stats_find(desc, dir)) == NULL)
+    return;
+  c->calls++;
+  if (bytes > 0)
+    c->bytes += bytes;
+  c->seconds += stats_time() - start;
+}
+
+void stats_page(const char * desc, int dir)
+{
+  struct stats_count * c;
+
+  if (stats_enabled && (c = stats_find(desc, dir)) != NULL)
+    c->pages++;
+}
+
+void stats_xfer(int dir, long bytes, double start)
+{
+  struct stats_count * c = &stats_transport[dir];
+
+  if (!stats_enabled)
+    return;
+  c->calls++;
+  if (bytes > 0)
+    c->bytes += bytes;
+  c->seconds += stats_time() - start;
+}
+
+void stats_retry(void)
+{
+  if (stats_enabled)
+    stats_retries++;
+}
+
+
+int serial_watch_send(union filedescriptor * fd, unsigned char * buf,
+                      size_t buflen)
+{
+  struct serial_iov iov;
+
+  iov.buf = buf;
+  iov.len = buflen;
+  return serial_watch_sendv(fd, &iov, 1);
+}
+
+int serial_watch_sendv(union filedescriptor * fd,
+                       const struct serial_iov * iov, int iovcnt)
+{
+  double start = stats_enabled? stats_time(): 0;
+  unsigned long long tstart = trace_enabled? trace_time(): 0;
+  int i, rv;
+  size_t len;
+
+  if (iovcnt == 1)
+    rv = serdev->send(fd, iov[0].buf, iov[0].len);
+  else
+    rv = serdev->sendv(fd, iov, iovcnt);
+
+  if (trace_enabled)
+    trace_frame(rv < 0? TRACE_TX_ERROR: TRACE_TX, tstart, trace_time(),
+                iov, iovcnt);
+  for (i = 0, len = 0; i < iovcnt; i++)
+    len += iov[i].len;
+  stats_xfer(STATS_WRITE, rv < 0? 0: len, start);
+  return rv;
+}
+
+int serial_watch_recv(union filedescriptor * fd, unsigned char * buf,
+                      size_t buflen)
+{
+  double start = stats_enabled? stats_time(): 0;
+  unsigned long long tstart = trace_enabled? trace_time(): 0;
+  int rv = serdev->recv(fd, buf, buflen);
+  struct serial_iov iov;
+
+  /* plain serial recv() fills the buffer, framed USB returns the length */
+  iov.buf = buf;
+  iov.len = rv < 0? 0: rv > 0? (size_t)rv: buflen;
+  if (trace_enabled)
+    trace_frame(rv < 0? TRACE_RX_ERROR: TRACE_RX, tstart, trace_time(),
+                &iov, 1);
+  stats_xfer(STATS_READ, iov.len, start);
+  return rv;
+}
+
+
+static void stats_write_count(FILE * f, const char * name,
+                              const struct stats_count * c, int pages)
+{
+  fprintf(f, "\"%s\": {\"calls\": %lu, \"bytes\": %lu, ",
+          name, c->calls, c->bytes);
+  if (pages)
+    fprintf(f, "\"pages\": %lu, ", c->pages);
+  fprintf(f, "\"seconds\": %.6f}", c->seconds);
+}
+
+int stats_write(const char * file)
+{
+  FILE * f;
+  int i, err;
+
+  if (strcmp(file, "-") == 0)
+    f = stdout;
+  else if ((f = fopen(file, "w")) == NULL) {
+    fprintf(stderr, "%s: can't open statistics file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+
+  fprintf(f, "{\n  \"seconds\": %.6f,\n  \"memories\": [",
+          stats_time() - stats_start);
+  for (i = 0; i < stats_nmems; i++) {
+    fprintf(f, "%s\n    {\"memory\": \"%s\", ", i? ",": "",
+            stats_mems[i].desc);
+    stats_write_count(f, "read", &stats_mems[i].dir[STATS_READ], 1);
+    fprintf(f, ", ");
+    stats_write_count(f, "write", &stats_mems[i].dir[STATS_WRITE], 1);
+    fprintf(f, "}");
+  }
+  fprintf(f, "%s],\n  \"transport\": {", stats_nmems? "\n  ": "");
+  stats_write_count(f, "send", &stats_transport[STATS_WRITE], 0);
+  fprintf(f, ", ");
+  stats_write_count(f, "recv", &stats_transport[STATS_READ], 0);
+  fprintf(f, "},\n  \"retries\": %lu\n}\n", stats_retries);
+
+  err = ferror(f);
+  if (f != stdout) {
+    if (fclose(f) != 0)
+      err = 1;
+  } else
+    fflush(f);
+  if (err) {
+    fprintf(stderr, "%s: can't write statistics file \"%s\"\n",
+            progname, file);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Scan one count as stats_write_count() prints it from s; returns a
+ * pointer past it, or NULL if s does not hold one.
+ */
+static const char * stats_scan_count(const char * s, const char * name,
+                                     struct stats_count * c, int pages)
+{
+  char key[16];
+  int n;
+
+  snprintf(key, sizeof(key), "\"%s\":", name);
+  if ((s = strstr(s, key)) == NULL)
+    return NULL;
+  s += strlen(key);
+  n = -1;
+  if (pages)
+    sscanf(s, " {\"calls\": %lu, \"bytes\": %lu, \"pages\": %lu, "
+           "\"seconds\": %lf}%n",
+           &c->calls, &c->bytes, &c->pages, &c->seconds, &n);
+  else
+    sscanf(s, " {\"calls\": %lu, \"bytes\": %lu, \"seconds\": %lf}%n",
+           &c->calls, &c->bytes, &c->seconds, &n);
+
+  return n < 0? NULL: s + n;
+}
+
+int stats_read(const char * file)
+{
+  char line[512], desc[AVR_MEMDESCLEN];
+  struct stats_mem * r;
+  const char * s;
+  FILE * f;
+  int n, bad;
+
+  if ((f = fopen(file, "r")) == NULL) {
+    fprintf(stderr, "%s: can't open statistics file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+
+  /* what stats_write() prints, one memory or the transport per line */
+  stats_nrefs = 0;
+  bad = 1;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    n = -1;
+    sscanf(line, " {\"memory\": \"%63[^\"]\",%n", desc, &n);
+    if (n > 0 && stats_nrefs < STATS_MAXMEM) {
+      r = &stats_refs[stats_nrefs];
+      if ((s = stats_scan_count(line + n, "read", &r->dir[STATS_READ], 1))
+          == NULL ||
+          stats_scan_count(s, "write", &r->dir[STATS_WRITE], 1) == NULL)
+        break;
+      snprintf(r->desc, sizeof(r->desc), "%s", desc);
+      stats_nrefs++;
+    } else if (strstr(line, "\"transport\":") != NULL) {
+      if ((s = stats_scan_count(line, "send",
+                                &stats_ref_transport[STATS_WRITE], 0))
+          == NULL ||
+          stats_scan_count(s, "recv", &stats_ref_transport[STATS_READ], 0)
+          == NULL)
+        break;
+      bad = 0;
+    }
+  }
+  fclose(f);
+
+  if (bad) {
+    fprintf(stderr, "%s: \"%s\" is not a statistics file written by -J\n",
+            progname, file);
+    return -1;
+  }
+
+  return 0;
+}
+
+int stats_ref_mem(const char * desc, int dir, unsigned long * pages,
+                  unsigned long * bytes, double * seconds)
+{
+  int i;
+
+  for (i = 0; i < stats_nrefs; i++)
+    if (strcmp(stats_refs[i].desc, desc) == 0 &&
+        stats_refs[i].dir[dir].calls > 0) {
+      *pages = stats_refs[i].dir[dir].pages;
+      *bytes = stats_refs[i].dir[dir].bytes;
+      *seconds = stats_refs[i].dir[dir].seconds;
+      return 0;
+    }
+
+  return -1;
+}
+
+double stats_ref_byte(void)
+{
+  unsigned long bytes = stats_ref_transport[STATS_READ].bytes +
+    stats_ref_transport[STATS_WRITE].bytes;
+
+  if (bytes == 0)
+    return 0;
+  return (stats_ref_transport[STATS_READ].seconds +
+          stats_ref_transport[STATS_WRITE].seconds) / bytes;
+}
@@ -0,0 +1,85 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef stats_h
+#define stats_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Transfer statistics: bytes, pages and time per memory and
+ * direction, calls, bytes and time of the serial (and USB framed)
+ * transport, and handshake retries.  Nothing is counted until
+ * stats_enable() is called.
+ */
+enum {
+  STATS_READ,
+  STATS_WRITE
+};
+
+extern int stats_enabled;
+
+void stats_enable(void);
+
+/* seconds since some fixed point, for taking the time of an operation */
+double stats_time(void);
+
+/* a read or write of bytes bytes of memory desc, started at start */
+void stats_mem(const char * desc, int dir, long bytes, double start);
+
+/* one page read or written */
+void stats_page(const char * desc, int dir);
+
+/* a transport send or receive of bytes bytes, started at start */
+void stats_xfer(int dir, long bytes, double start);
+
+/* a command or handshake that had to be repeated */
+void stats_retry(void);
+
+/*
+ * Write the statistics as a JSON object to file, "-" for stdout;
+ * returns -1 if the file cannot be written.
+ */
+int stats_write(const char * file);
+
+/*
+ * Read a statistics file written by stats_write() in an earlier run,
+ * as the reference stats_ref_mem() and stats_ref_byte() report on;
+ * returns -1 if it cannot be read.
+ */
+int stats_read(const char * file);
+
+/*
+ * What the reference run counted for memory desc in direction dir;
+ * returns -1 if it has no record of the memory.
+ */
+int stats_ref_mem(const char * desc, int dir, unsigned long * pages,
+                  unsigned long * bytes, double * seconds);
+
+/* transport seconds per byte in the reference run, or 0 if unknown */
+double stats_ref_byte(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
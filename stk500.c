@@ -42,6 +42,7 @@
 #include "stk500.h"
 #include "stk500_private.h"
 #include "serial.h"
+#include "stats.h"
 
 #define STK500_XTAL 7372800U
 #define MAX_SYNC_ATTEMPTS 10
@@ -50,6 +51,8 @@ struct pdata
 {
   unsigned char ext_addr_byte; /* Record ext-addr byte set in the
 				* target device (if used) */
+  int nosync;                  /* a page exchange lost sync, send the page
+                                * command after the address is acked */
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -91,6 +94,7 @@ int stk500_getsync(PROGRAMMER * pgm)
 {
   unsigned char buf[32], resp[32];
   int attempt;
+  long otimeout;
 
   /*
    * get in sync */
@@ -106,9 +110,15 @@ int stk500_getsync(PROGRAMMER * pgm)
   stk500_send(pgm, buf, 2);
   stk500_drain(pgm, 0);
 
+  otimeout = serial_recv_timeout;
   for (attempt = 0; attempt < MAX_SYNC_ATTEMPTS; attempt++) {
     stk500_send(pgm, buf, 2);
+    serial_recv_timeout = serial_adaptive_timeout(attempt);
+    if (attempt > 0)
+      stats_retry();
+    resp[0] = 0;
     stk500_recv(pgm, resp, 1);
+    serial_recv_timeout = otimeout;
     if (resp[0] == Resp_STK_INSYNC){
       break;
     }
@@ -206,7 +216,7 @@ static int stk500_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
   avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
   pgm->cmd(pgm, cmd, res);
-  usleep(p->chip_erase_delay);
+  avr_wait_ready(pgm, p, p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   pgm->pgm_led(pgm, OFF);
@@ -707,17 +717,18 @@ static void stk500_close(PROGRAMMER * pgm)
 }
 
 
-static int stk500_loadaddr(PROGRAMMER * pgm, AVRMEM * mem, unsigned int addr)
+/*
+ * Put the STK_LOAD_ADDRESS command for addr into buf, after setting
+ * the extended address byte if need be; returns the command length.
+ * The reply is collected by stk500_loadaddr_reply(), so the command
+ * can share one write with the page command that follows it.
+ */
+static int stk500_loadaddr_cmd(PROGRAMMER * pgm, AVRMEM * mem,
+                               unsigned int addr, unsigned char * buf)
 {
-  unsigned char buf[16];
-  int tries;
   unsigned char ext_byte;
   OPCODE * lext;
 
-  tries = 0;
- retry:
-  tries++;
-
   /* To support flash > 64K words the correct Extended Address Byte is needed */
   lext = mem->op[AVR_OP_LOAD_EXT_ADDR];
   if (lext != NULL) {
@@ -737,20 +748,22 @@ static int stk500_loadaddr(PROGRAMMER * pgm, AVRMEM * mem, unsigned int addr)
   buf[2] = (addr >> 8) & 0xff;
   buf[3] = Sync_CRC_EOP;
 
-  stk500_send(pgm, buf, 4);
+  return 4;
+}
+
+
+/*
+ * Read the reply to an STK_LOAD_ADDRESS command.  Returns 1 if the
+ * programmer is out of sync and the command has to be repeated.
+ */
+static int stk500_loadaddr_reply(PROGRAMMER * pgm)
+{
+  unsigned char buf[1];
 
   if (stk500_recv(pgm, buf, 1) < 0)
     exit(1);
-  if (buf[0] == Resp_STK_NOSYNC) {
-    if (tries > 33) {
-      fprintf(stderr, "%s: stk500_loadaddr(): can't get into sync\n",
-              progname);
-      return -1;
-    }
-    if (stk500_getsync(pgm) < 0)
-      return -1;
-    goto retry;
-  }
+  if (buf[0] == Resp_STK_NOSYNC)
+    return 1;
   else if (buf[0] != Resp_STK_INSYNC) {
     fprintf(stderr,
             "%s: stk500_loadaddr(): (a) protocol error, "
@@ -774,6 +787,50 @@ static int stk500_loadaddr(PROGRAMMER * pgm, AVRMEM * mem, unsigned int addr)
 }
 
 
+/*
+ * Send the len bytes at buf, a load address command followed by a
+ * page command, and read the reply to the former and the first byte of
+ * the reply to the latter into buf[0].  The two go out in one write
+ * while the programmer is in sync.  After it has lost sync, the page
+ * command is held back until the load address is acknowledged, as it
+ * would otherwise act on the address loaded before.  Returns 1 if the
+ * pair has to be sent again after stk500_getsync(), -1 on a protocol
+ * error.
+ */
+static int stk500_page_exchange(PROGRAMMER * pgm, unsigned char * buf,
+                                int len)
+{
+  int paired = !PDATA(pgm)->nosync;
+  int rc;
+
+  stk500_send(pgm, buf, paired? len: 4);
+
+  rc = stk500_loadaddr_reply(pgm);
+  if (rc < 0)
+    return -1;
+  if (rc > 0) {
+    /* the page command may have been taken as it came: drop its reply */
+    if (paired)
+      stk500_drain(pgm, 0);
+    PDATA(pgm)->nosync = 1;
+    return 1;
+  }
+
+  if (!paired)
+    stk500_send(pgm, buf + 4, len - 4);
+  if (stk500_recv(pgm, buf, 1) < 0)
+    exit(1);
+  if (buf[0] == Resp_STK_NOSYNC) {
+    PDATA(pgm)->nosync = 1;
+    return 1;
+  }
+  if (buf[0] == Resp_STK_INSYNC)
+    PDATA(pgm)->nosync = 0;
+
+  return 0;
+}
+
+
 static int stk500_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                               unsigned int page_size,
                               unsigned int addr, unsigned int n_bytes)
@@ -785,6 +842,7 @@ static int stk500_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   int tries;
   unsigned int n;
   unsigned int i;
+  int rc;
 
   if (strcmp(m->desc, "flash") == 0) {
     memtype = 'F';
@@ -824,11 +882,11 @@ static int stk500_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     tries = 0;
   retry:
     tries++;
-    stk500_loadaddr(pgm, m, addr/a_div);
 
     /* build command block and avoid multiple send commands as it leads to a crash
-        of the silabs usb serial driver on mac os x */
-    i = 0;
+        of the silabs usb serial driver on mac os x; the address goes in
+        front of it, saving a round trip per page */
+    i = stk500_loadaddr_cmd(pgm, m, addr/a_div, buf);
     buf[i++] = Cmnd_STK_PROG_PAGE;
     buf[i++] = (block_size >> 8) & 0xff;
     buf[i++] = block_size & 0xff;
@@ -836,11 +894,11 @@ static int stk500_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     memcpy(&buf[i], &m->buf[addr], block_size);
     i += block_size;
     buf[i++] = Sync_CRC_EOP;
-    stk500_send( pgm, buf, i);
 
-    if (stk500_recv(pgm, buf, 1) < 0)
-      exit(1);
-    if (buf[0] == Resp_STK_NOSYNC) {
+    rc = stk500_page_exchange(pgm, buf, i);
+    if (rc < 0)
+      return -1;
+    if (rc > 0) {
       if (tries > 33) {
         fprintf(stderr, "\n%s: stk500_paged_write(): can't get into sync\n",
                 progname);
@@ -882,6 +940,7 @@ static int stk500_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   int tries;
   unsigned int n;
   int block_size;
+  int i, rc;
 
   if (strcmp(m->desc, "flash") == 0) {
     memtype = 'F';
@@ -913,17 +972,17 @@ static int stk500_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     tries = 0;
   retry:
     tries++;
-    stk500_loadaddr(pgm, m, addr/a_div);
-    buf[0] = Cmnd_STK_READ_PAGE;
-    buf[1] = (block_size >> 8) & 0xff;
-    buf[2] = block_size & 0xff;
-    buf[3] = memtype;
-    buf[4] = Sync_CRC_EOP;
-    stk500_send(pgm, buf, 5);
+    i = stk500_loadaddr_cmd(pgm, m, addr/a_div, buf);
+    buf[i++] = Cmnd_STK_READ_PAGE;
+    buf[i++] = (block_size >> 8) & 0xff;
+    buf[i++] = block_size & 0xff;
+    buf[i++] = memtype;
+    buf[i++] = Sync_CRC_EOP;
 
-    if (stk500_recv(pgm, buf, 1) < 0)
-      exit(1);
-    if (buf[0] == Resp_STK_NOSYNC) {
+    rc = stk500_page_exchange(pgm, buf, i);
+    if (rc < 0)
+      return -1;
+    if (rc > 0) {
       if (tries > 33) {
         fprintf(stderr, "\n%s: stk500_paged_load(): can't get into sync\n",
                 progname);
@@ -24,40 +24,123 @@
  * This is a wrapper around the STK500[v1] and STK500v2 programmers.
  * Try to select the programmer type that actually responds, and
  * divert to the actual programmer implementation if successful.
+ *
+ * Which one answered on a port is kept in a small file, and tried
+ * alone the next time; only if it does not answer any more are both
+ * probed again.
  */
 
 #include "ac_cfg.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "avrdude.h"
+#include "cachefile.h"
 #include "pgm.h"
 #include "stk500generic.h"
 #include "stk500.h"
 #include "stk500v2.h"
 
-static int stk500generic_open(PROGRAMMER * pgm, char * port)
+static char stk500generic_file[PATH_MAX];
+
+
+void stk500generic_cache(const char * file)
 {
-  stk500_initpgm(pgm);
-  if (pgm->open(pgm, port) >= 0)
-    {
-      fprintf(stderr,
-	      "%s: successfully opened stk500v1 device -- please use -c stk500v1\n",
-	      progname);
+  snprintf(stk500generic_file, sizeof(stk500generic_file), "%s", file);
+}
+
+/* whether port can be a key of the cache file */
+static int stk500generic_key(const char * port)
+{
+  const char * s;
+
+  if (stk500generic_file[0] == 0 || port[0] == 0 || strlen(port) > 400)
+    return 0;
+  for (s = port; *s != 0; s++)
+    if (isspace((int)*s))
       return 0;
-    }
 
-  pgm->close(pgm);
+  return 1;
+}
+
+/*
+ * The cache file holds "<port> <version>" lines, with version 1 or 2.
+ * Returns the version, or 0.
+ */
+static int stk500generic_lookup(const char * port)
+{
+  char value[16];
+  int v;
 
-  stk500v2_initpgm(pgm);
-  if (pgm->open(pgm, port) >= 0)
-    {
-      fprintf(stderr,
-	      "%s: successfully opened stk500v2 device -- please use -c stk500v2\n",
-	      progname);
+  if (!stk500generic_key(port) ||
+      cachefile_lookup(stk500generic_file, port, value, sizeof(value)) < 0 ||
+      sscanf(value, "%d", &v) != 1 || (v != 1 && v != 2))
+    return 0;
+
+  return v;
+}
+
+static void stk500generic_remember(const char * port, int version)
+{
+  char value[16];
+
+  if (!stk500generic_key(port) || stk500generic_lookup(port) == version)
+    return;
+
+  snprintf(value, sizeof(value), "%d", version);
+  cachefile_remember(stk500generic_file, port, value,
+                     "STK500 version cache");
+}
+
+/*
+ * Open port as the given version.  stk500v2_open() goes on when the
+ * programmer does not answer, so when that is all there is to go by,
+ * make sure of it with another sync.
+ */
+static int stk500generic_open_as(PROGRAMMER * pgm, char * port, int version,
+                                 int check)
+{
+  if (version == 1)
+    stk500_initpgm(pgm);
+  else
+    stk500v2_initpgm(pgm);
+
+  if (pgm->open(pgm, port) < 0 ||
+      (version == 2 && check && stk500v2_getsync(pgm) < 0)) {
+    pgm->close(pgm);
+    return -1;
+  }
+
+  fprintf(stderr,
+          "%s: successfully opened stk500v%d device -- please use -c stk500v%d\n",
+          progname, version, version);
+  return 0;
+}
+
+static int stk500generic_open(PROGRAMMER * pgm, char * port)
+{
+  int cached = stk500generic_lookup(port);
+
+  if (cached != 0) {
+    if (stk500generic_open_as(pgm, port, cached, 1) == 0)
       return 0;
-    }
+    if (verbose >= 1)
+      fprintf(stderr, "%s: no stk500v%d device any more, trying the other\n",
+              progname, cached);
+  }
+
+  if (cached != 1 && stk500generic_open_as(pgm, port, 1, 0) == 0) {
+    stk500generic_remember(port, 1);
+    return 0;
+  }
+
+  if (cached != 2 && stk500generic_open_as(pgm, port, 2, 0) == 0) {
+    stk500generic_remember(port, 2);
+    return 0;
+  }
 
   fprintf(stderr,
 	  "%s: cannot open either stk500v1 or stk500v2 programmer\n",
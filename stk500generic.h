@@ -24,6 +24,9 @@
 extern const char stk500generic_desc[];
 void stk500generic_initpgm (PROGRAMMER * pgm);
 
+/* file remembering which version answered on a port */
+void stk500generic_cache(const char * file);
+
 #endif
 
 
@@ -54,6 +54,7 @@
 #include "stk500v2.h"
 #include "stk500v2_private.h"
 #include "serial.h"
+#include "stats.h"
 #include "usbdevs.h"
 
 /*
@@ -278,6 +279,7 @@ static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                 unsigned int page_size,
                                 unsigned int addr, unsigned int n_bytes);
+static int stk500v2_flush_pagecache(PROGRAMMER * pgm);
 
 static unsigned int stk500v2_mode_for_pagesize(unsigned int pagesize);
 
@@ -289,6 +291,7 @@ static int stk600_set_sck_period(PROGRAMMER * pgm, double v);
 static void stk600_setup_xprog(PROGRAMMER * pgm);
 static void stk600_setup_isp(PROGRAMMER * pgm);
 static int stk600_xprog_program_enable(PROGRAMMER * pgm, AVRPART * p);
+static int stk600_xprog_sync(PROGRAMMER * pgm);
 
 void stk500v2_setup(PROGRAMMER * pgm)
 {
@@ -418,7 +421,8 @@ static unsigned short get_jtagisp_return_size(unsigned char cmd)
  */
 static int stk500v2_jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
 {
-  unsigned char *cmdbuf;
+  unsigned char hdr[3];
+  struct serial_iov iov[2];
   int rv;
   unsigned short sz;
   void *mycookie;
@@ -444,19 +448,17 @@ static int stk500v2_jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t
     sz = 3 + data[2];
   }
 
-  if ((cmdbuf = malloc(len + 3)) == NULL) {
-    fprintf(stderr, "%s: out of memory for command packet\n",
-            progname);
-    exit(1);
-  }
+  /* the ISP packet header goes out in front of the data, uncopied */
+  hdr[0] = CMND_ISP_PACKET;
+  hdr[1] = sz & 0xff;
+  hdr[2] = (sz >> 8) & 0xff;
+  iov[0].buf = hdr;
+  iov[0].len = 3;
+  iov[1].buf = data;
+  iov[1].len = len;
   mycookie = pgm->cookie;
   pgm->cookie = PDATA(pgm)->chained_pdata;
-  cmdbuf[0] = CMND_ISP_PACKET;
-  cmdbuf[1] = sz & 0xff;
-  cmdbuf[2] = (sz >> 8) & 0xff;
-  memcpy(cmdbuf + 3, data, len);
-  rv = jtagmkII_send(pgm, cmdbuf, len + 3);
-  free(cmdbuf);
+  rv = jtagmkII_sendv(pgm, iov, 2);
   pgm->cookie = mycookie;
 
   return rv;
@@ -467,21 +469,18 @@ static int stk500v2_jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t
  */
 static int stk500v2_jtag3_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
 {
-  unsigned char *cmdbuf;
+  unsigned char scope = SCOPE_AVR_ISP;
+  struct serial_iov iov[2];
   int rv;
   void *mycookie;
 
-  if ((cmdbuf = malloc(len + 1)) == NULL) {
-    fprintf(stderr, "%s: out of memory for command packet\n",
-            progname);
-    exit(1);
-  }
+  iov[0].buf = &scope;
+  iov[0].len = 1;
+  iov[1].buf = data;
+  iov[1].len = len;
   mycookie = pgm->cookie;
   pgm->cookie = PDATA(pgm)->chained_pdata;
-  cmdbuf[0] = SCOPE_AVR_ISP;
-  memcpy(cmdbuf + 1, data, len);
-  rv = jtag3_send(pgm, cmdbuf, len + 1);
-  free(cmdbuf);
+  rv = jtag3_sendv(pgm, iov, 2);
   pgm->cookie = mycookie;
 
   return rv;
@@ -489,7 +488,8 @@ static int stk500v2_jtag3_send(PROGRAMMER * pgm, unsigned char * data, size_t le
 
 static int stk500v2_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
 {
-  unsigned char buf[275 + 6];		// max MESSAGE_BODY of 275 bytes, 6 bytes overhead
+  unsigned char hdr[5], cksum;
+  struct serial_iov iov[3];
   int i;
 
   if (PDATA(pgm)->pgmtype == PGMTYPE_AVRISP_MKII ||
@@ -500,23 +500,34 @@ static int stk500v2_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
   else if (PDATA(pgm)->pgmtype == PGMTYPE_JTAGICE3)
     return stk500v2_jtag3_send(pgm, data, len);
 
-  buf[0] = MESSAGE_START;
-  buf[1] = PDATA(pgm)->command_sequence;
-  buf[2] = len / 256;
-  buf[3] = len % 256;
-  buf[4] = TOKEN;
-  memcpy(buf+5, data, len);
+  hdr[0] = MESSAGE_START;
+  hdr[1] = PDATA(pgm)->command_sequence;
+  hdr[2] = len / 256;
+  hdr[3] = len % 256;
+  hdr[4] = TOKEN;
 
   // calculate the XOR checksum
-  buf[5+len] = 0;
-  for (i=0;i<5+len;i++)
-    buf[5+len] ^= buf[i];
+  cksum = 0;
+  for (i=0;i<5;i++)
+    cksum ^= hdr[i];
+  for (i=0;i<len;i++)
+    cksum ^= data[i];
 
   DEBUG("STK500V2: stk500v2_send(");
-  for (i=0;i<len+6;i++) DEBUG("0x%02x ",buf[i]);
+  for (i=0;i<5;i++) DEBUG("0x%02x ",hdr[i]);
+  for (i=0;i<len;i++) DEBUG("0x%02x ",data[i]);
+  DEBUG("0x%02x ",cksum);
   DEBUG(", %d)\n",len+6);
 
-  if (serial_send(&pgm->fd, buf, len+6) != 0) {
+  // header, message body and checksum go out in one write
+  iov[0].buf = hdr;
+  iov[0].len = 5;
+  iov[1].buf = data;
+  iov[1].len = len;
+  iov[2].buf = &cksum;
+  iov[2].len = 1;
+
+  if (serial_sendv(&pgm->fd, iov, 3) != 0) {
     fprintf(stderr,"%s: stk500_send(): failed to send command to serial port\n",progname);
     exit(1);
   }
@@ -568,21 +579,30 @@ static int stk500v2_jtagmkII_recv(PROGRAMMER * pgm, unsigned char *msg,
   }
   switch (jtagmsg[0]) {
   case RSP_SPI_DATA:
+    memcpy(msg, jtagmsg + 1, rv - 1);
     break;
   case RSP_FAILED:
     fprintf(stderr, "%s: stk500v2_jtagmkII_recv(): failed\n",
 	    progname);
-    return -1;
+    rv = -1;
+    break;
   case RSP_ILLEGAL_MCU_STATE:
     fprintf(stderr, "%s: stk500v2_jtagmkII_recv(): illegal MCU state\n",
 	    progname);
-    return -1;
+    rv = -1;
+    break;
   default:
     fprintf(stderr, "%s: stk500v2_jtagmkII_recv(): unknown status %d\n",
 	    progname, jtagmsg[0]);
-    return -1;
+    rv = -1;
+    break;
   }
-  memcpy(msg, jtagmsg + 1, rv - 1);
+
+  mycookie = pgm->cookie;
+  pgm->cookie = PDATA(pgm)->chained_pdata;
+  jtagmkII_release(pgm, jtagmsg);
+  pgm->cookie = mycookie;
+
   return rv;
 }
 
@@ -744,6 +764,7 @@ int stk500v2_getsync(PROGRAMMER * pgm) {
   int tries = 0;
   unsigned char buf[1], resp[32];
   int status;
+  long otimeout;
 
   DEBUG("STK500V2: stk500v2_getsync()\n");
 
@@ -758,8 +779,14 @@ retry:
   buf[0] = CMD_SIGN_ON;
   stk500v2_send(pgm, buf, 1);
 
-  // try to get the response back and see where we got
+  // try to get the response back and see where we got; a device that
+  // is still starting up gets longer with every try
+  otimeout = serial_recv_timeout;
+  serial_recv_timeout = serial_adaptive_timeout(tries - 1);
+  if (tries > 1)
+    stats_retry();
   status = stk500v2_recv(pgm, resp, sizeof(resp));
+  serial_recv_timeout = otimeout;
 
   // if we got bytes returned, check to see what came back
   if (status > 0) {
@@ -824,6 +851,92 @@ retry:
   return 0;
 }
 
+/*
+ * Decode the reply of status bytes that stk500v2_recv() put into buf;
+ * returns what stk500v2_command() returns for it.
+ */
+static int stk500v2_command_status(PROGRAMMER * pgm, unsigned char * buf,
+                                   int status)
+{
+  if (status < 2) {
+    fprintf(stderr, "%s: stk500v2_command(): short reply\n", progname);
+    return -1;
+  }
+  if (buf[0] == CMD_XPROG_SETMODE || buf[0] == CMD_XPROG) {
+      /*
+       * Decode XPROG wrapper errors.
+       */
+      const char *msg;
+      int i;
+
+      /*
+       * For CMD_XPROG_SETMODE, the status is returned in buf[1].
+       * For CMD_XPROG, buf[1] contains the XPRG_CMD_* command, and
+       * buf[2] contains the status.
+       */
+      i = buf[0] == CMD_XPROG_SETMODE? 1: 2;
+
+      if (buf[i] != XPRG_ERR_OK) {
+          switch (buf[i]) {
+          case XPRG_ERR_FAILED:   msg = "Failed"; break;
+          case XPRG_ERR_COLLISION: msg = "Collision"; break;
+          case XPRG_ERR_TIMEOUT:  msg = "Timeout"; break;
+          default:                msg = "Unknown"; break;
+          }
+          fprintf(stderr, "%s: stk500v2_command(): error in %s: %s\n",
+                  progname,
+                  (buf[0] == CMD_XPROG_SETMODE? "CMD_XPROG_SETMODE": "CMD_XPROG"),
+                  msg);
+          return -1;
+      }
+      return 0;
+  } else {
+      /*
+       * Decode STK500v2 errors.
+       */
+      if (buf[1] >= STATUS_CMD_TOUT && buf[1] < 0xa0) {
+          const char *msg;
+          char msgbuf[30];
+          switch (buf[1]) {
+          case STATUS_CMD_TOUT:
+              msg = "Command timed out";
+              break;
+
+          case STATUS_RDY_BSY_TOUT:
+              msg = "Sampling of the RDY/nBSY pin timed out";
+              break;
+
+          case STATUS_SET_PARAM_MISSING:
+              msg = "The `Set Device Parameters' have not been "
+                  "executed in advance of this command";
+
+          default:
+              sprintf(msgbuf, "unknown, code 0x%02x", buf[1]);
+              msg = msgbuf;
+              break;
+          }
+          if (quell_progress < 2) {
+              fprintf(stderr, "%s: stk500v2_command(): warning: %s\n",
+                      progname, msg);
+          }
+      } else if (buf[1] == STATUS_CMD_OK) {
+          return status;
+      } else if (buf[1] == STATUS_CMD_FAILED) {
+          fprintf(stderr,
+                  "%s: stk500v2_command(): command failed\n",
+                  progname);
+      } else if (buf[1] == STATUS_CMD_UNKNOWN) {
+          fprintf(stderr,
+                  "%s: stk500v2_command(): unknown command\n",
+                  progname);
+      } else {
+          fprintf(stderr, "%s: stk500v2_command(): unknown status 0x%02x\n",
+                  progname, buf[1]);
+      }
+      return -1;
+  }
+}
+
 static int stk500v2_command(PROGRAMMER * pgm, unsigned char * buf,
                             size_t len, size_t maxlen) {
   int i;
@@ -834,6 +947,16 @@ static int stk500v2_command(PROGRAMMER * pgm, unsigned char * buf,
   for (i=0;i<len;i++) DEBUG("0x%02x ",buf[i]);
   DEBUG(", %d)\n",len);
 
+  // XPROG page writes in flight and a queued page erase come first
+  if ((PDATA(pgm)->xprog_pending > 0 || PDATA(pgm)->xprog_erase) &&
+      stk600_xprog_sync(pgm) < 0)
+    return -1;
+
+  // bytes collected for a flash page go out before anything else
+  if (PDATA(pgm)->flash_pagedirty && stk500v2_flush_pagecache(pgm) < 0)
+    return -1;
+  PDATA(pgm)->prog_addr_cmd = 0;
+
 retry:
   tries++;
 
@@ -845,83 +968,7 @@ retry:
   // if we got a successful readback, return
   if (status > 0) {
     DEBUG(" = %d\n",status);
-    if (status < 2) {
-      fprintf(stderr, "%s: stk500v2_command(): short reply\n", progname);
-      return -1;
-    }
-    if (buf[0] == CMD_XPROG_SETMODE || buf[0] == CMD_XPROG) {
-        /*
-         * Decode XPROG wrapper errors.
-         */
-        const char *msg;
-        int i;
-
-        /*
-         * For CMD_XPROG_SETMODE, the status is returned in buf[1].
-         * For CMD_XPROG, buf[1] contains the XPRG_CMD_* command, and
-         * buf[2] contains the status.
-         */
-        i = buf[0] == CMD_XPROG_SETMODE? 1: 2;
-
-        if (buf[i] != XPRG_ERR_OK) {
-            switch (buf[i]) {
-            case XPRG_ERR_FAILED:   msg = "Failed"; break;
-            case XPRG_ERR_COLLISION: msg = "Collision"; break;
-            case XPRG_ERR_TIMEOUT:  msg = "Timeout"; break;
-            default:                msg = "Unknown"; break;
-            }
-            fprintf(stderr, "%s: stk500v2_command(): error in %s: %s\n",
-                    progname,
-                    (buf[0] == CMD_XPROG_SETMODE? "CMD_XPROG_SETMODE": "CMD_XPROG"),
-                    msg);
-            return -1;
-        }
-        return 0;
-    } else {
-        /*
-         * Decode STK500v2 errors.
-         */
-        if (buf[1] >= STATUS_CMD_TOUT && buf[1] < 0xa0) {
-            const char *msg;
-            char msgbuf[30];
-            switch (buf[1]) {
-            case STATUS_CMD_TOUT:
-                msg = "Command timed out";
-                break;
-
-            case STATUS_RDY_BSY_TOUT:
-                msg = "Sampling of the RDY/nBSY pin timed out";
-                break;
-
-            case STATUS_SET_PARAM_MISSING:
-                msg = "The `Set Device Parameters' have not been "
-                    "executed in advance of this command";
-
-            default:
-                sprintf(msgbuf, "unknown, code 0x%02x", buf[1]);
-                msg = msgbuf;
-                break;
-            }
-            if (quell_progress < 2) {
-                fprintf(stderr, "%s: stk500v2_command(): warning: %s\n",
-                        progname, msg);
-            }
-        } else if (buf[1] == STATUS_CMD_OK) {
-            return status;
-        } else if (buf[1] == STATUS_CMD_FAILED) {
-            fprintf(stderr,
-                    "%s: stk500v2_command(): command failed\n",
-                    progname);
-        } else if (buf[1] == STATUS_CMD_UNKNOWN) {
-            fprintf(stderr,
-                    "%s: stk500v2_command(): unknown command\n",
-                    progname);
-        } else {
-            fprintf(stderr, "%s: stk500v2_command(): unknown status 0x%02x\n",
-                    progname, buf[1]);
-        }
-        return -1;
-    }
+    return stk500v2_command_status(pgm, buf, status);
   }
 
   // otherwise try to sync up again
@@ -931,8 +978,10 @@ retry:
       fprintf(stderr,"%s: stk500v2_command(): failed miserably to execute command 0x%02x\n",
               progname,buf[0]);
       return -1;
-    } else
+    } else {
+      stats_retry();
       goto retry;
+    }
   }
 
   DEBUG(" = 0\n");
@@ -1003,12 +1052,16 @@ static int stk500v2_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
   pgm->pgm_led(pgm, ON);
 
+  /*
+   * The programmer answers when the erase is done, after the delay or
+   * as soon as RDY/BSY polling says so for parts that have it.
+   */
   buf[0] = CMD_CHIP_ERASE_ISP;
   buf[1] = p->chip_erase_delay / 1000;
-  buf[2] = 0;	// use delay (?)
+  buf[2] = p->pollmethod == 1;	// 0 = use delay, 1 = poll RDY/BSY
+  memset(buf + 3, 0, 4);	// the instruction's "x" bits
   avr_set_bits(p->op[AVR_OP_CHIP_ERASE], buf+3);
   result = stk500v2_command(pgm, buf, 7, sizeof(buf));
-  usleep(p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   pgm->pgm_led(pgm, OFF);
@@ -1035,8 +1088,8 @@ static int stk500hv_chip_erase(PROGRAMMER * pgm, AVRPART * p, enum hvmode mode)
     buf[1] = p->chiperasepolltimeout;
     buf[2] = p->chiperasetime;
   }
+  /* the programmer polls RDY/BSY before it answers */
   result = stk500v2_command(pgm, buf, 3, sizeof(buf));
-  usleep(p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   pgm->pgm_led(pgm, OFF);
@@ -1397,6 +1450,7 @@ static int stk500v2_jtag3_initialize(PROGRAMMER * pgm, AVRPART * p)
     return -1;
   }
   PDATA(pgm)->flash_pageaddr = PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+  PDATA(pgm)->flash_pagedirty = 0;
 
   return pgm->program_enable(pgm, p);
 }
@@ -1470,6 +1524,7 @@ static int stk500hv_initialize(PROGRAMMER * pgm, AVRPART * p, enum hvmode mode)
     return -1;
   }
   PDATA(pgm)->flash_pageaddr = PDATA(pgm)->eeprom_pageaddr = (unsigned long)-1L;
+  PDATA(pgm)->flash_pagedirty = 0;
 
   return pgm->program_enable(pgm, p);
 }
@@ -1493,8 +1548,14 @@ static int stk500hvsp_initialize(PROGRAMMER * pgm, AVRPART * p)
 static void stk500v2_jtag3_disable(PROGRAMMER * pgm)
 {
   unsigned char buf[16];
+  unsigned long paddr = PDATA(pgm)->flash_pageaddr;
   int result;
 
+  /* the last flash page of byte writes is only sent here */
+  if (stk500v2_flush_pagecache(pgm) < 0)
+    fprintf(stderr,
+            "%s: stk500v2_jtag3_disable(): failed to write flash page "
+            "at 0x%04lx\n", progname, paddr);
   free(PDATA(pgm)->flash_pagecache);
   PDATA(pgm)->flash_pagecache = NULL;
   free(PDATA(pgm)->eeprom_pagecache);
@@ -1744,8 +1805,11 @@ static int stk500v2_loadaddr(PROGRAMMER * pgm, unsigned int addr)
     fprintf(stderr,
             "%s: stk500v2_loadaddr(): failed to set load address\n",
             progname);
+    PDATA(pgm)->loadaddr_valid = 0;
     return -1;
   }
+  PDATA(pgm)->loadaddr = addr;
+  PDATA(pgm)->loadaddr_valid = 1;
 
   return 0;
 }
@@ -1887,6 +1951,49 @@ static int stk500hvsp_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
  * By now, only used on the JTAGICE3 which does not implement the
  * CMD_SPI_MULTI SPI passthrough command.
  */
+/*
+ * Read several fuse, lock or signature bytes with one CMD_SPI_MULTI,
+ * which clocks out the ISP read commands back to back.
+ */
+#define STK500V2_CONFIG_BATCH 16
+
+static int stk500v2_read_config_bytes(PROGRAMMER * pgm, AVRPART * p,
+                                      AVRMEM * mems[],
+                                      const unsigned long addrs[],
+                                      unsigned char * values, int n)
+{
+  unsigned char buf[4 + 4 * STK500V2_CONFIG_BATCH];
+  int i, k, result;
+
+  for (i = 0; i < n; i += k) {
+    k = n - i < STK500V2_CONFIG_BATCH? n - i: STK500V2_CONFIG_BATCH;
+    if (avr_config_cmds(mems + i, addrs + i, k, buf + 4) < 0)
+      return avr_read_config_bytes_default(pgm, p, mems, addrs, values, n);
+
+    buf[0] = CMD_SPI_MULTI;
+    buf[1] = 4 * k;
+    buf[2] = 4 * k;
+    buf[3] = 0;
+
+    result = stk500v2_command(pgm, buf, 4 + 4 * k, sizeof(buf));
+    if (result < 0) {
+      fprintf(stderr,
+              "%s: stk500v2_read_config_bytes(): failed to send command\n",
+              progname);
+      return -1;
+    } else if (result < 2 + 4 * k) {
+      fprintf(stderr,
+              "%s: stk500v2_read_config_bytes(): short reply, len = %d\n",
+              progname, result);
+      return -1;
+    }
+
+    avr_config_values(mems + i, buf + 2, values + i, k);
+  }
+
+  return 0;
+}
+
 static int stk500isp_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 			       unsigned long addr, unsigned char * value)
 {
@@ -1918,6 +2025,10 @@ static int stk500isp_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
       cache_ptr = PDATA(pgm)->eeprom_pagecache;
     }
 
+    /* bytes still to be written are not what the device holds */
+    if (stk500v2_flush_pagecache(pgm) < 0)
+      return -1;
+
     if (paddr == *paddr_ptr) {
       *value = cache_ptr[addr & (pagesize - 1)];
       return 0;
@@ -2148,6 +2259,32 @@ static int stk500hvsp_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 }
 
 
+/*
+ * Write the flash page that stk500isp_write_byte() has collected in
+ * the page cache, if any.
+ */
+static int stk500v2_flush_pagecache(PROGRAMMER * pgm)
+{
+  AVRMEM *mem = PDATA(pgm)->flash_dirtymem;
+  unsigned long paddr = PDATA(pgm)->flash_pageaddr;
+  unsigned int pagesize = PDATA(pgm)->flash_pagesize;
+
+  if (!PDATA(pgm)->flash_pagedirty)
+    return 0;
+
+  /* clear it first, the write below passes through stk500v2_command() */
+  PDATA(pgm)->flash_pagedirty = 0;
+  PDATA(pgm)->flash_pageaddr = (unsigned long)-1L;
+
+  avr_mem_unshare(mem, 1);
+  memcpy(mem->buf + paddr, PDATA(pgm)->flash_pagecache, pagesize);
+  if (stk500v2_paged_write(pgm, PDATA(pgm)->flash_dirtypart, mem, pagesize,
+                           paddr, pagesize) < 0)
+    return -1;
+
+  return 0;
+}
+
 /*
  * Write one byte, ISP mode
  */
@@ -2187,7 +2324,25 @@ static int stk500isp_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
      * EEPROM does not support auto-erase in parallel mode), we just
      * pre-fill the page cache with 0xff, so all those cells that are
      * outside our current address will remain unaffected.
+     *
+     * Bytes for the same flash page are collected, and the page is
+     * only written once another page or any other command follows.
      */
+    if (paddr_ptr == &PDATA(pgm)->flash_pageaddr) {
+      if (!PDATA(pgm)->flash_pagedirty || paddr != *paddr_ptr) {
+        if (stk500v2_flush_pagecache(pgm) < 0)
+          return -1;
+        memset(cache_ptr, 0xff, pagesize);
+        *paddr_ptr = paddr;
+        PDATA(pgm)->flash_pagedirty = 1;
+        PDATA(pgm)->flash_dirtypart = p;
+        PDATA(pgm)->flash_dirtymem = mem;
+      }
+      cache_ptr[addr & (pagesize - 1)] = data;
+
+      return 0;
+    }
+
     memset(cache_ptr, 0xff, pagesize);
     cache_ptr[addr & (pagesize - 1)] = data;
 
@@ -2268,7 +2423,8 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                 unsigned int page_size,
                                 unsigned int addr, unsigned int n_bytes)
 {
-  unsigned int block_size, last_addr, addrshift, use_ext_addr;
+  unsigned int block_size, addrshift, use_ext_addr;
+  unsigned long load_addr;
   unsigned int maxaddr = addr + n_bytes;
   unsigned char commandbuf[10];
   unsigned char buf[266];
@@ -2279,6 +2435,10 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   DEBUG("STK500V2: stk500v2_paged_write(..,%s,%u,%u,%u)\n",
         m->desc, page_size, addr, n_bytes);
 
+  /* collected bytes must not end up at the address set below */
+  if (stk500v2_flush_pagecache(pgm) < 0)
+    return -1;
+
   if (page_size == 0) page_size = 256;
   addrshift = 0;
   use_ext_addr = 0;
@@ -2357,8 +2517,6 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   commandbuf[8] = m->readback[0];
   commandbuf[9] = m->readback[1];
 
-  last_addr=UINT_MAX;		/* impossible address */
-
   for (; addr < maxaddr; addr += page_size) {
     if ((maxaddr - addr) < page_size)
       block_size = maxaddr - addr;
@@ -2372,11 +2530,18 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     buf[1] = block_size >> 8;
     buf[2] = block_size & 0xff;
 
-    if((last_addr==UINT_MAX)||(last_addr+block_size != addr)){
-      if (stk500v2_loadaddr(pgm, use_ext_addr | (addr >> addrshift)) < 0)
+    /*
+     * Continue where the previous page write left off, also across
+     * calls.  As in stk500v2_paged_load(), the address is loaded again
+     * when crossing a 64 KB boundary in flash.
+     */
+    load_addr = use_ext_addr | (addr >> addrshift);
+    if (PDATA(pgm)->prog_addr_cmd != commandbuf[0] ||
+        PDATA(pgm)->prog_addr != load_addr ||
+        (use_ext_addr && (addr & 0xffff) == 0)) {
+      if (stk500v2_loadaddr(pgm, load_addr) < 0)
         return -1;
     }
-    last_addr=addr;
 
     memcpy(buf+10,m->buf+addr, block_size);
 
@@ -2387,6 +2552,8 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
               progname);
       return -1;
     }
+    PDATA(pgm)->prog_addr_cmd = commandbuf[0];
+    PDATA(pgm)->prog_addr = use_ext_addr | ((addr + block_size) >> addrshift);
   }
 
   return n_bytes;
@@ -3110,7 +3277,7 @@ static int stk500v2_setparm(PROGRAMMER * pgm, unsigned char parm, unsigned char
     fprintf(stderr, "%s: Unable to get parameter 0x%02x\n", progname, parm);
 
   // don't issue a write if the correct value is already set.
-  if (value == current_value && verbose > 2) {
+  if (res == 0 && value == current_value && verbose > 2) {
     fprintf(stderr, "%s: Skipping paramter write; parameter value already set.\n", progname);
     return 0;
   }
@@ -3351,6 +3518,7 @@ static void stk500v2_print_parms1(PROGRAMMER * pgm, const char * p)
     break;
 
   default:
+    stk500v2_getparm(pgm, PARAM_SCK_DURATION, &sck_duration);
     fprintf(stderr, "%sSCK period      : %.1f us\n", p,
 	  sck_duration * 8.0e6 / STK500V2_XTAL + 0.05);
     break;
@@ -3745,6 +3913,7 @@ static int stk600_xprog_program_enable(PROGRAMMER * pgm, AVRPART * p)
     int use_tpi;
 
     use_tpi = (p->flags & AVRPART_HAS_TPI) != 0;
+    PDATA(pgm)->loadaddr_valid = 0;
 
     if (!use_tpi) {
         if (p->nvm_base == 0) {
@@ -4002,14 +4171,192 @@ static int stk600_xprog_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 }
 
 
+/*
+ * XPROG pipelining needs messages without sequence numbers, as the
+ * STK600 exchanges over USB, and a programmer that reads the next
+ * message while its reply to the previous one is still unfetched.  The
+ * AVRISP mkII does not (see stk500v2_command()), and for the STK600 it
+ * is only asked for with -x xprog_pipeline.
+ */
+static int stk600_xprog_pipelined(PROGRAMMER * pgm)
+{
+    return PDATA(pgm)->pgmtype == PGMTYPE_STK600 &&
+        PDATA(pgm)->xprog_pipeline;
+}
+
+/*
+ * Memory type, write mode and extended addressing for writing mem.
+ * Returns 1 if the memory type of flash depends on the address (it is
+ * 0 then), 0 if not, and -1 for a memory XPROG can't write.
+ */
+static int stk600_xprog_write_setup(AVRMEM * mem, unsigned char * memtype,
+                                    unsigned char * writemode,
+                                    unsigned long * use_ext_addr)
+{
+    int dynamic = 0;
+
+    *use_ext_addr = 0;
+
+    /*
+     * Fancy offsets everywhere.
+     * This is probably what AVR079 means when writing about the
+     * "TIF address space".
+     */
+    if (strcmp(mem->desc, "flash") == 0) {
+        *memtype = 0;
+        dynamic = 1;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+        if (mem->size > 64 * 1024)
+            *use_ext_addr = (1UL << 31);
+    } else if (strcmp(mem->desc, "application") == 0 ||
+               strcmp(mem->desc, "apptable") == 0) {
+        *memtype = XPRG_MEM_TYPE_APPL;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+        if (mem->size > 64 * 1024)
+            *use_ext_addr = (1UL << 31);
+    } else if (strcmp(mem->desc, "boot") == 0) {
+        *memtype = XPRG_MEM_TYPE_BOOT;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+        // Do we have to consider the total amount of flash
+        // instead to decide whether to use extended addressing?
+        if (mem->size > 64 * 1024)
+            *use_ext_addr = (1UL << 31);
+    } else if (strcmp(mem->desc, "eeprom") == 0) {
+        *memtype = XPRG_MEM_TYPE_EEPROM;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE) | (1 << XPRG_MEM_WRITE_ERASE);
+    } else if (strcmp(mem->desc, "signature") == 0) {
+        *memtype = XPRG_MEM_TYPE_APPL;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+    } else if (strncmp(mem->desc, "fuse", strlen("fuse")) == 0) {
+        *memtype = XPRG_MEM_TYPE_FUSE;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+    } else if (strncmp(mem->desc, "lock", strlen("lock")) == 0) {
+        *memtype = XPRG_MEM_TYPE_LOCKBITS;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+    } else if (strcmp(mem->desc, "calibration") == 0) {
+        *memtype = XPRG_MEM_TYPE_FACTORY_CALIBRATION;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+    } else if (strcmp(mem->desc, "usersig") == 0) {
+        *memtype = XPRG_MEM_TYPE_USERSIG;
+        *writemode = (1 << XPRG_MEM_WRITE_WRITE);
+    } else {
+        fprintf(stderr,
+                "%s: stk600_xprog_paged_write(): unknown paged memory \"%s\"\n",
+                progname, mem->desc);
+        return -1;
+    }
+
+    return dynamic;
+}
+
+/*
+ * A page erase queued by stk600_xprog_page_erase() for the page at
+ * addr (with the memory offset) is done by writing that page with the
+ * erase bit set; returns the bit, 0 if no erase is queued for it.
+ */
+static unsigned char stk600_xprog_take_erase(PROGRAMMER * pgm,
+                                             unsigned long addr)
+{
+    if (!PDATA(pgm)->xprog_erase || PDATA(pgm)->xprog_erase_addr != addr)
+        return 0;
+
+    PDATA(pgm)->xprog_erase = 0;
+    return 1 << XPRG_MEM_WRITE_ERASE;
+}
+
+/*
+ * Collect the reply to the oldest page write in flight.  If there is
+ * none to read, the replies behind it can't be matched any more and
+ * are dropped.
+ */
+static int stk600_xprog_write_reply(PROGRAMMER * pgm)
+{
+    unsigned char buf[16];
+    int status;
+
+    PDATA(pgm)->xprog_pending--;
+    status = stk500v2_recv(pgm, buf, sizeof(buf));
+    if (status <= 0) {
+        fprintf(stderr,
+                "%s: stk600_xprog_paged_write_complete(): no reply from programmer\n",
+                progname);
+        PDATA(pgm)->xprog_pending = 0;
+        stk500v2_drain(pgm, 0);
+        return -1;
+    }
+    if (stk500v2_command_status(pgm, buf, status) < 0) {
+        fprintf(stderr,
+                "%s: stk600_xprog_paged_write(): XPRG_CMD_WRITE_MEM failed\n",
+                progname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Collect the reply to a pipelined XPRG_CMD_READ_MEM of len bytes into
+ * b, and copy the data to dest.
+ */
+static int stk600_xprog_read_reply(PROGRAMMER * pgm, unsigned char * b,
+                                   unsigned char * dest, unsigned int len)
+{
+    int status;
+
+    status = stk500v2_recv(pgm, b, len + 3);
+    if (status <= 0 || stk500v2_command_status(pgm, b, status) < 0) {
+        fprintf(stderr,
+                "%s: stk600_xprog_paged_load(): XPRG_CMD_READ_MEM failed\n",
+                progname);
+        return -1;
+    }
+    memcpy(dest, b + 3, len);
+
+    return 0;
+}
+
+/*
+ * Collect the replies to the page writes in flight and send a queued
+ * page erase, before any other command goes out.
+ */
+static int stk600_xprog_sync(PROGRAMMER * pgm)
+{
+    unsigned char b[6];
+    unsigned long addr;
+    int rv = 0;
+
+    while (PDATA(pgm)->xprog_pending > 0)
+        if (stk600_xprog_write_reply(pgm) < 0)
+            rv = -1;
+
+    if (PDATA(pgm)->xprog_erase) {
+        PDATA(pgm)->xprog_erase = 0;
+        addr = PDATA(pgm)->xprog_erase_addr;
+        b[0] = XPRG_CMD_ERASE;
+        b[1] = PDATA(pgm)->xprog_erase_type;
+        b[2] = addr >> 24;
+        b[3] = addr >> 16;
+        b[4] = addr >> 8;
+        b[5] = addr;
+        if (stk600_xprog_command(pgm, b, 6, 2) < 0) {
+            fprintf(stderr,
+                    "%s: stk600_xprog_page_erase(): XPRG_CMD_ERASE(%d) failed\n",
+                    progname, b[1]);
+            rv = -1;
+        }
+    }
+
+    return rv;
+}
+
 static int stk600_xprog_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                                    unsigned int page_size,
                                    unsigned int addr, unsigned int n_bytes)
 {
-    unsigned char *b;
-    unsigned int offset;
+    unsigned char *b, cmd[9];
+    unsigned int offset, inflight = 0, prev = 0;
     unsigned char memtype;
-    int n_bytes_orig = n_bytes, dynamic_memtype = 0;
+    int n_bytes_orig = n_bytes, dynamic_memtype = 0, pipelined;
     unsigned long use_ext_addr = 0;
 
     /*
@@ -4018,6 +4365,7 @@ static int stk600_xprog_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
      */
     if (page_size > 256)
 	page_size = 256;	/* not really a page size anymore */
+    pipelined = stk600_xprog_pipelined(pgm);
 
     /*
      * Fancy offsets everywhere.
@@ -4061,7 +4409,8 @@ static int stk600_xprog_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     offset = addr;
     addr += mem->offset;
 
-    if ((b = malloc(page_size + 2)) == NULL) {
+    /* room for the CMD_XPROG in front of a pipelined reply */
+    if ((b = malloc(page_size + 3)) == NULL) {
 	fprintf(stderr,
                 "%s: stk600_xprog_paged_load(): out of memory\n",
                 progname);
@@ -4085,14 +4434,34 @@ static int stk600_xprog_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 	b[5] = addr;
 	b[6] = page_size >> 8;
 	b[7] = page_size;
-	if (stk600_xprog_command(pgm, b, 8, page_size + 2) < 0) {
-	    fprintf(stderr,
-		    "%s: stk600_xprog_paged_load(): XPRG_CMD_READ_MEM failed\n",
-		    progname);
-	    free(b);
-	    return -1;
+	if (pipelined) {
+	    /*
+	     * The next read goes out before the reply to the previous
+	     * one is collected, so the programmer can start on it as
+	     * soon as that reply is off.
+	     */
+	    cmd[0] = CMD_XPROG;
+	    memcpy(cmd + 1, b, 8);
+	    stk500v2_send(pgm, cmd, 9);
+	    PDATA(pgm)->prog_addr_cmd = 0;
+	    if (inflight &&
+		stk600_xprog_read_reply(pgm, b, mem->buf + prev, page_size) < 0) {
+		stk500v2_drain(pgm, 0);
+		free(b);
+		return -1;
+	    }
+	    inflight = 1;
+	    prev = offset;
+	} else {
+	    if (stk600_xprog_command(pgm, b, 8, page_size + 2) < 0) {
+		fprintf(stderr,
+			"%s: stk600_xprog_paged_load(): XPRG_CMD_READ_MEM failed\n",
+			progname);
+		free(b);
+		return -1;
+	    }
+	    memcpy(mem->buf + offset, b + 2, page_size);
 	}
-	memcpy(mem->buf + offset, b + 2, page_size);
 	if (n_bytes < page_size) {
 	    n_bytes = page_size;
 	}
@@ -4100,6 +4469,11 @@ static int stk600_xprog_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 	addr += page_size;
 	n_bytes -= page_size;
     }
+    if (inflight &&
+	stk600_xprog_read_reply(pgm, b, mem->buf + prev, page_size) < 0) {
+	free(b);
+	return -1;
+    }
     free(b);
 
     return n_bytes_orig;
@@ -4115,7 +4489,7 @@ static int stk600_xprog_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     int n_bytes_orig = n_bytes, dynamic_memtype = 0;
     size_t writesize;
     unsigned long use_ext_addr = 0;
-    unsigned char writemode;
+    unsigned char writemode, erase = 0;
 
     /*
      * The XPROG read command supports at most 256 bytes in one
@@ -4128,54 +4502,9 @@ static int stk600_xprog_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 	return -1;
     }
 
-    /*
-     * Fancy offsets everywhere.
-     * This is probably what AVR079 means when writing about the
-     * "TIF address space".
-     */
-    if (strcmp(mem->desc, "flash") == 0) {
-        memtype = 0;
-        dynamic_memtype = 1;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-        if (mem->size > 64 * 1024)
-            use_ext_addr = (1UL << 31);
-    } else if (strcmp(mem->desc, "application") == 0 ||
-               strcmp(mem->desc, "apptable") == 0) {
-        memtype = XPRG_MEM_TYPE_APPL;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-        if (mem->size > 64 * 1024)
-            use_ext_addr = (1UL << 31);
-    } else if (strcmp(mem->desc, "boot") == 0) {
-        memtype = XPRG_MEM_TYPE_BOOT;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-        // Do we have to consider the total amount of flash
-        // instead to decide whether to use extended addressing?
-        if (mem->size > 64 * 1024)
-            use_ext_addr = (1UL << 31);
-    } else if (strcmp(mem->desc, "eeprom") == 0) {
-        memtype = XPRG_MEM_TYPE_EEPROM;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE) | (1 << XPRG_MEM_WRITE_ERASE);
-    } else if (strcmp(mem->desc, "signature") == 0) {
-        memtype = XPRG_MEM_TYPE_APPL;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-    } else if (strncmp(mem->desc, "fuse", strlen("fuse")) == 0) {
-        memtype = XPRG_MEM_TYPE_FUSE;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-    } else if (strncmp(mem->desc, "lock", strlen("lock")) == 0) {
-        memtype = XPRG_MEM_TYPE_LOCKBITS;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-    } else if (strcmp(mem->desc, "calibration") == 0) {
-        memtype = XPRG_MEM_TYPE_FACTORY_CALIBRATION;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-    } else if (strcmp(mem->desc, "usersig") == 0) {
-        memtype = XPRG_MEM_TYPE_USERSIG;
-        writemode = (1 << XPRG_MEM_WRITE_WRITE);
-    } else {
-        fprintf(stderr,
-                "%s: stk600_xprog_paged_write(): unknown paged memory \"%s\"\n",
-                progname, mem->desc);
+    if ((dynamic_memtype = stk600_xprog_write_setup(mem, &memtype, &writemode,
+                                                    &use_ext_addr)) < 0)
         return -1;
-    }
     offset = addr;
     addr += mem->offset;
 
@@ -4186,6 +4515,10 @@ static int stk600_xprog_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
         return -1;
     }
 
+    /* a queued erase of the first page is done by its write */
+    if (page_size <= 256)
+        erase = stk600_xprog_take_erase(pgm, addr);
+
     if (stk500v2_loadaddr(pgm, use_ext_addr) < 0) {
         free(b);
         return -1;
@@ -4258,13 +4591,14 @@ static int stk600_xprog_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
             }
 	    b[0] = XPRG_CMD_WRITE_MEM;
 	    b[1] = memtype;
-	    b[2] = writemode;
+	    b[2] = writemode | erase;
 	    b[3] = addr >> 24;
 	    b[4] = addr >> 16;
 	    b[5] = addr >> 8;
 	    b[6] = addr;
 	    b[7] = page_size >> 8;
 	    b[8] = page_size;
+	    erase = 0;
 	    memcpy(b + 9, mem->buf + offset, writesize);
 	    if (stk600_xprog_command(pgm, b, page_size + 9, 2) < 0) {
 		fprintf(stderr,
@@ -4286,6 +4620,83 @@ static int stk600_xprog_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     return n_bytes_orig;
 }
 
+/*
+ * Send the XPRG_CMD_WRITE_MEM for one page without waiting for its
+ * reply.  The programmer holds one reply while it takes the next page
+ * off the link, so at most one older write is left in flight.  Pages
+ * over 256 bytes, which go out in chunks, and links that number their
+ * messages are written by stk600_xprog_paged_write().
+ */
+static int stk600_xprog_paged_write_submit(PROGRAMMER * pgm, AVRPART * p,
+                                           AVRMEM * mem, unsigned int page_size,
+                                           unsigned int addr,
+                                           unsigned int n_bytes)
+{
+    unsigned char *b;
+    unsigned char memtype, writemode, erase;
+    unsigned long use_ext_addr;
+    int dynamic;
+
+    if (!stk600_xprog_pipelined(pgm) || page_size == 0 || page_size > 256 ||
+        n_bytes > page_size)
+        return stk600_xprog_paged_write(pgm, p, mem, page_size, addr, n_bytes);
+
+    if ((dynamic = stk600_xprog_write_setup(mem, &memtype, &writemode,
+                                            &use_ext_addr)) < 0)
+        return -1;
+    if (dynamic)
+        memtype = stk600_xprog_memtype(pgm, addr);
+    erase = stk600_xprog_take_erase(pgm, addr + mem->offset);
+
+    if (!PDATA(pgm)->loadaddr_valid || PDATA(pgm)->loadaddr != use_ext_addr) {
+        if (stk500v2_loadaddr(pgm, use_ext_addr) < 0)
+            return -1;
+    }
+
+    if ((b = malloc(page_size + 10)) == NULL) {
+	fprintf(stderr,
+                "%s: stk600_xprog_paged_write_submit(): out of memory\n",
+                progname);
+        return -1;
+    }
+    b[0] = CMD_XPROG;
+    b[1] = XPRG_CMD_WRITE_MEM;
+    b[2] = memtype;
+    b[3] = writemode | erase;
+    b[4] = (addr + mem->offset) >> 24;
+    b[5] = (addr + mem->offset) >> 16;
+    b[6] = (addr + mem->offset) >> 8;
+    b[7] = addr + mem->offset;
+    b[8] = page_size >> 8;
+    b[9] = page_size;
+    /* a short last page is padded, as in stk600_xprog_paged_write() */
+    memset(b + 10, 0xff, page_size);
+    memcpy(b + 10, mem->buf + addr, n_bytes);
+    stk500v2_send(pgm, b, page_size + 10);
+    PDATA(pgm)->prog_addr_cmd = 0;
+    free(b);
+
+    PDATA(pgm)->xprog_pending++;
+    while (PDATA(pgm)->xprog_pending > 1)
+        if (stk600_xprog_write_reply(pgm) < 0)
+            return -1;
+
+    return n_bytes;
+}
+
+/*
+ * Wait for the oldest page write still in flight; pages written
+ * synchronously have nothing to wait for.
+ */
+static int stk600_xprog_paged_write_complete(PROGRAMMER * pgm, AVRPART * p,
+                                             AVRMEM * m)
+{
+    if (PDATA(pgm)->xprog_pending == 0)
+        return 0;
+
+    return stk600_xprog_write_reply(pgm);
+}
+
 static int stk600_xprog_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
     unsigned char b[6];
@@ -4341,6 +4752,22 @@ static int stk600_xprog_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       return -1;
     }
     addr += m->offset;
+
+    /*
+     * Flash pages are written with the erase bit of XPRG_CMD_WRITE_MEM
+     * instead, one command less per page.  Should anything but the
+     * write of this page come next, the erase goes out before it.
+     */
+    if (stk600_xprog_pipelined(pgm) && m->page_size <= 256 &&
+        (b[1] == XPRG_ERASE_APP_PAGE || b[1] == XPRG_ERASE_BOOT_PAGE)) {
+        if (PDATA(pgm)->xprog_erase && stk600_xprog_sync(pgm) < 0)
+            return -1;
+        PDATA(pgm)->xprog_erase = 1;
+        PDATA(pgm)->xprog_erase_type = b[1];
+        PDATA(pgm)->xprog_erase_addr = addr;
+        return 0;
+    }
+
     b[0] = XPRG_CMD_ERASE;
     b[2] = addr >> 24;
     b[3] = addr >> 16;
@@ -4355,6 +4782,37 @@ static int stk600_xprog_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     return 0;
 }
 
+/*
+ * The NVM controller's CRC over a whole flash section.  XPRG_CMD_CRC
+ * answers with the status and three bytes of CRC.
+ */
+static int stk600_xprog_mem_checksum(PROGRAMMER * pgm, AVRPART * p,
+                                     AVRMEM * m, unsigned long * sum)
+{
+    unsigned char b[5];
+
+    if (strcmp(m->desc, "application") == 0)
+        b[1] = XPRG_CRC_APP;
+    else if (strcmp(m->desc, "boot") == 0)
+        b[1] = XPRG_CRC_BOOT;
+    else if (strcmp(m->desc, "flash") == 0)
+        b[1] = XPRG_CRC_FLASH;
+    else
+        return -1;
+
+    b[0] = XPRG_CMD_CRC;
+    if (stk600_xprog_command(pgm, b, 2, 5) < 0) {
+        if (verbose >= 2)
+            fprintf(stderr,
+                    "%s: stk600_xprog_mem_checksum(): XPRG_CMD_CRC(%d) failed\n",
+                    progname, b[1]);
+        return -1;
+    }
+    *sum = ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 8) | b[4];
+
+    return 0;
+}
+
 /*
  * Modify pgm's methods for XPROG operation.
  */
@@ -4363,11 +4821,16 @@ static void stk600_setup_xprog(PROGRAMMER * pgm)
     pgm->program_enable = stk600_xprog_program_enable;
     pgm->disable = stk600_xprog_disable;
     pgm->read_byte = stk600_xprog_read_byte;
+    pgm->read_config_bytes = NULL;
     pgm->write_byte = stk600_xprog_write_byte;
     pgm->paged_load = stk600_xprog_paged_load;
     pgm->paged_write = stk600_xprog_paged_write;
     pgm->page_erase = stk600_xprog_page_erase;
+    pgm->page_erase_queued = 1;
+    pgm->paged_write_submit = stk600_xprog_paged_write_submit;
+    pgm->paged_write_complete = stk600_xprog_paged_write_complete;
     pgm->chip_erase = stk600_xprog_chip_erase;
+    pgm->mem_checksum = stk600_xprog_mem_checksum;
 }
 
 
@@ -4379,11 +4842,16 @@ static void stk600_setup_isp(PROGRAMMER * pgm)
     pgm->program_enable = stk500v2_program_enable;
     pgm->disable = stk500v2_disable;
     pgm->read_byte = avr_read_byte_default;
+    pgm->read_config_bytes = stk500v2_read_config_bytes;
     pgm->write_byte = avr_write_byte_default;
     pgm->paged_load = stk500v2_paged_load;
     pgm->paged_write = stk500v2_paged_write;
     pgm->page_erase = stk500v2_page_erase;
+    pgm->page_erase_queued = 0;
+    pgm->paged_write_submit = NULL;
+    pgm->paged_write_complete = NULL;
     pgm->chip_erase = stk500v2_chip_erase;
+    pgm->mem_checksum = NULL;
 }
 
 const char stk500v2_desc[] = "Atmel STK500 Version 2.x firmware";
@@ -4413,6 +4881,7 @@ void stk500v2_initpgm(PROGRAMMER * pgm)
   pgm->paged_write    = stk500v2_paged_write;
   pgm->paged_load     = stk500v2_paged_load;
   pgm->page_erase     = stk500v2_page_erase;
+  pgm->read_config_bytes = stk500v2_read_config_bytes;
   pgm->print_parms    = stk500v2_print_parms;
   pgm->set_vtarget    = stk500v2_set_vtarget;
   pgm->set_varef      = stk500v2_set_varef;
@@ -4521,6 +4990,7 @@ void stk500v2_jtagmkII_initpgm(PROGRAMMER * pgm)
   pgm->paged_write    = stk500v2_paged_write;
   pgm->paged_load     = stk500v2_paged_load;
   pgm->page_erase     = stk500v2_page_erase;
+  pgm->read_config_bytes = stk500v2_read_config_bytes;
   pgm->print_parms    = stk500v2_print_parms;
   pgm->set_sck_period = stk500v2_set_sck_period_mk2;
   pgm->perform_osccal = stk500v2_perform_osccal;
@@ -4556,6 +5026,7 @@ void stk500v2_dragon_isp_initpgm(PROGRAMMER * pgm)
   pgm->paged_write    = stk500v2_paged_write;
   pgm->paged_load     = stk500v2_paged_load;
   pgm->page_erase     = stk500v2_page_erase;
+  pgm->read_config_bytes = stk500v2_read_config_bytes;
   pgm->print_parms    = stk500v2_print_parms;
   pgm->set_sck_period = stk500v2_set_sck_period_mk2;
   pgm->setup          = stk500v2_jtagmkII_setup;
@@ -4633,6 +5104,29 @@ void stk500v2_dragon_hvsp_initpgm(PROGRAMMER * pgm)
   pgm->page_size      = 256;
 }
 
+static int stk600_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+  LNODEID ln;
+  const char *extended_param;
+  int rv = 0;
+
+  for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+    extended_param = ldata(ln);
+
+    if (strcmp(extended_param, "xprog_pipeline") == 0) {
+      PDATA(pgm)->xprog_pipeline = 1;
+      continue;
+    }
+
+    fprintf(stderr,
+            "%s: stk600_parseextparms(): invalid extended parameter '%s'\n",
+            progname, extended_param);
+    rv = -1;
+  }
+
+  return rv;
+}
+
 const char stk600_desc[] = "Atmel STK600";
 
 void stk600_initpgm(PROGRAMMER * pgm)
@@ -4660,12 +5154,14 @@ void stk600_initpgm(PROGRAMMER * pgm)
   pgm->paged_write    = stk500v2_paged_write;
   pgm->paged_load     = stk500v2_paged_load;
   pgm->page_erase     = stk500v2_page_erase;
+  pgm->read_config_bytes = stk500v2_read_config_bytes;
   pgm->print_parms    = stk500v2_print_parms;
   pgm->set_vtarget    = stk600_set_vtarget;
   pgm->set_varef      = stk600_set_varef;
   pgm->set_fosc       = stk600_set_fosc;
   pgm->set_sck_period = stk600_set_sck_period;
   pgm->perform_osccal = stk500v2_perform_osccal;
+  pgm->parseextparams = stk600_parseextparms;
   pgm->setup          = stk500v2_setup;
   pgm->teardown       = stk500v2_teardown;
   pgm->page_size      = 256;
@@ -300,6 +300,40 @@ struct pdata
   unsigned long eeprom_pageaddr;
   unsigned int eeprom_pagesize;
 
+  /*
+   * The flash page cache holds bytes written by stk500isp_write_byte()
+   * that have not been sent yet; see stk500v2_flush_pagecache().
+   */
+  int flash_pagedirty;
+  AVRPART *flash_dirtypart;
+  AVRMEM *flash_dirtymem;
+
+  /*
+   * The firmware advances its address after CMD_PROGRAM_FLASH_ISP and
+   * CMD_PROGRAM_EEPROM_ISP.  prog_addr is where the next of these
+   * commands (prog_addr_cmd) would write without a CMD_LOAD_ADDRESS;
+   * prog_addr_cmd is 0 once any other command has been sent.
+   */
+  unsigned long prog_addr;
+  unsigned char prog_addr_cmd;
+
+  /*
+   * Last CMD_LOAD_ADDRESS, so pipelined XPROG page writes need not
+   * repeat it.
+   */
+  unsigned long loadaddr;
+  int loadaddr_valid;
+
+  /*
+   * XPROG page writes sent whose replies have not been read yet, and a
+   * page erase queued for the next write to xprog_erase_addr.
+   */
+  int xprog_pipeline;            /* -x xprog_pipeline */
+  int xprog_pending;
+  int xprog_erase;
+  unsigned char xprog_erase_type;
+  unsigned long xprog_erase_addr;
+
   unsigned char command_sequence;
 
     enum
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <errno.h>
 
 #if defined(HAVE_LIBREADLINE)
 #if !defined(WIN32NATIVE)
@@ -233,6 +234,121 @@ static int hexdump_buf(FILE * f, int startaddr, unsigned char * buf, int len)
 }
 
 
+/*
+ * Whether the terminal can move whole pages of mem through the paged
+ * load and write functions of the programmer.  TPI parts are
+ * accessed a byte at a time, as in avr_read() and avr_write().
+ */
+static int term_paged(PROGRAMMER * pgm, struct avrpart * p, AVRMEM * mem,
+                      int writing)
+{
+  if (mem->page_size <= 1 || (p->flags & AVRPART_HAS_TPI) != 0)
+    return 0;
+  if (pgm->paged_load == NULL)
+    return 0;
+  return !writing || pgm->paged_write != NULL;
+}
+
+
+/*
+ * Make sure the pages covering [addr, addr+len) of mem are in its
+ * read-back cache, reading those that are not.  Dumping the same
+ * region again is then served from the cache; writing to the device
+ * or erasing it invalidates what changed.  Returns -1 if a page
+ * cannot be read.
+ */
+static int term_load_pages(PROGRAMMER * pgm, struct avrpart * p,
+                           AVRMEM * mem, unsigned long addr, int len)
+{
+  unsigned long pageaddr;
+  int n, rc;
+
+  for (pageaddr = addr - addr % mem->page_size;
+       pageaddr < addr + len;
+       pageaddr += mem->page_size) {
+    n = mem->page_size;
+    if (pageaddr + n > mem->size)
+      n = mem->size - pageaddr;
+    if (avr_mem_cache_covers(mem, NULL, pageaddr, n))
+      continue;
+    avr_mem_unshare(mem, 1);
+    rc = pgm->paged_load(pgm, p, mem, mem->page_size, pageaddr,
+                         mem->page_size);
+    if (rc < 0)
+      return -1;
+    avr_mem_cache_store(mem, pageaddr, mem->buf + pageaddr, n);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Write the bytes buf[s-addr .. e-addr) into the page of mem at
+ * pageaddr, reading the rest of the page first when the bytes do not
+ * cover all of it, and read the page back.  Returns -1 if the page
+ * has to be written a byte at a time instead.
+ */
+static int term_write_page(PROGRAMMER * pgm, struct avrpart * p,
+                           AVRMEM * mem, unsigned long pageaddr,
+                           unsigned long s, unsigned long e,
+                           unsigned long addr, unsigned char * buf,
+                           int * werror)
+{
+  unsigned long i;
+  int n, rc;
+
+  n = mem->page_size;
+  if (pageaddr + n > mem->size)
+    n = mem->size - pageaddr;
+
+  if (s != pageaddr || e != pageaddr + n) {
+    /*
+     * Filling up a flash page would program the bytes that are not
+     * written over again, which only works on an erased page.
+     */
+    if (strcasecmp(mem->desc, "flash") == 0 ||
+        strcasecmp(mem->desc, "application") == 0 ||
+        strcasecmp(mem->desc, "apptable") == 0 ||
+        strcasecmp(mem->desc, "boot") == 0)
+      return -1;
+    if (term_load_pages(pgm, p, mem, pageaddr, n) < 0)
+      return -1;
+    avr_mem_unshare(mem, 1);
+    memcpy(mem->buf + pageaddr, mem->cache + pageaddr, n);
+  }
+  avr_mem_unshare(mem, 1);
+  memcpy(mem->buf + s, buf + (s - addr), e - s);
+
+  avr_mem_cache_invalidate(mem, pageaddr, n);
+  rc = pgm->paged_write(pgm, p, mem, mem->page_size, pageaddr,
+                        mem->page_size);
+  if (rc < 0)
+    return -1;
+
+  rc = pgm->paged_load(pgm, p, mem, mem->page_size, pageaddr,
+                       mem->page_size);
+  if (rc < 0) {
+    fprintf(stderr, "%s (write): error reading back page at 0x%05lx\n",
+            progname, pageaddr);
+    *werror = 1;
+    return 0;
+  }
+  avr_mem_cache_store(mem, pageaddr, mem->buf + pageaddr, n);
+
+  for (i = s; i < e; i++) {
+    if (mem->buf[i] != buf[i - addr]) {
+      fprintf(stderr,
+              "%s (write): error writing 0x%02x at 0x%05lx cell=0x%02x\n",
+              progname, buf[i - addr], i, mem->buf[i]);
+      *werror = 1;
+    }
+  }
+
+  return 0;
+}
+
+
 static int cmd_dump(PROGRAMMER * pgm, struct avrpart * p,
 		    int argc, char * argv[])
 {
@@ -309,7 +425,15 @@ static int cmd_dump(PROGRAMMER * pgm, struct avrpart * p,
     return -1;
   }
 
-  for (i=0; i<len; i++) {
+  if (term_paged(pgm, p, mem, 0) &&
+      term_load_pages(pgm, p, mem, addr, len) == 0)
+    memcpy(buf, mem->cache + addr, len);
+  else for (i=0; i<len; i++) {
+    /* fuses and the like may have been read already */
+    if (avr_mem_cache_covers(mem, NULL, addr+i, 1)) {
+      buf[i] = mem->cache[addr+i];
+      continue;
+    }
     rc = pgm->read_byte(pgm, p, mem, addr+i, &buf[i]);
     if (rc != 0) {
       fprintf(stderr, "error reading %s address 0x%05lx of part %s\n",
@@ -319,6 +443,7 @@ static int cmd_dump(PROGRAMMER * pgm, struct avrpart * p,
                 mem->desc);
       return -1;
     }
+    avr_mem_cache_store(mem, addr+i, &buf[i], 1);
   }
 
   hexdump_buf(stdout, addr, buf, len);
@@ -344,6 +469,7 @@ static int cmd_write(PROGRAMMER * pgm, struct avrpart * p,
   unsigned char b;
   int rc;
   int werror;
+  int paged;
   AVRMEM * mem;
 
   if (argc < 4) {
@@ -404,9 +530,28 @@ static int cmd_write(PROGRAMMER * pgm, struct avrpart * p,
     }
   }
 
+  paged = term_paged(pgm, p, mem, 1);
   pgm->err_led(pgm, OFF);
   for (werror=0, i=0; i<len; i++) {
 
+    if (paged) {
+      unsigned long pageaddr, e;
+
+      pageaddr = (addr + i) - (addr + i) % mem->page_size;
+      e = pageaddr + mem->page_size;
+      if (e > addr + len)
+        e = addr + len;
+      if (term_write_page(pgm, p, mem, pageaddr, addr + i, e,
+                          addr, buf, &werror) == 0) {
+        if (werror)
+          pgm->err_led(pgm, ON);
+        i = e - addr - 1;
+        continue;
+      }
+      /* write the rest a byte at a time */
+      paged = 0;
+    }
+
     rc = avr_write_byte(pgm, p, mem, addr+i, buf[i]);
     if (rc) {
       fprintf(stderr, "%s (write): error writing 0x%02x at 0x%05lx, rc=%d\n",
@@ -446,6 +591,8 @@ static int cmd_send(PROGRAMMER * pgm, struct avrpart * p,
   char * e;
   int i;
   int len;
+  LNODEID ln;
+  AVRMEM * mem;
 
   if (pgm->cmd == NULL) {
     fprintf(stderr,
@@ -489,6 +636,13 @@ static int cmd_send(PROGRAMMER * pgm, struct avrpart * p,
   else
     pgm->cmd(pgm, cmd, res);
 
+  /* a raw command may have changed any memory, the fuses included */
+  for (ln = lfirst(p->mem); ln; ln = lnext(ln)) {
+    mem = ldata(ln);
+    avr_mem_cache_invalidate(mem, 0, mem->size);
+  }
+  avr_config_forget(p);
+
   /*
    * display results
    */
@@ -507,7 +661,7 @@ static int cmd_erase(PROGRAMMER * pgm, struct avrpart * p,
 		     int argc, char * argv[])
 {
   fprintf(stderr, "%s: erasing chip\n", progname);
-  pgm->chip_erase(pgm, p);
+  avr_chip_erase(pgm, p);
   return 0;
 }
 
@@ -871,36 +1025,51 @@ static int tokenize(char * s, char *** argv)
 }
 
 
-static int do_cmd(PROGRAMMER * pgm, struct avrpart * p,
-		  int argc, char * argv[])
+/*
+ * Find the command name is an abbreviation of; returns NULL after
+ * complaining if there is none or more than one.
+ */
+static struct command * find_cmd(char * name)
 {
   int i;
   int hold;
   int len;
 
-  len = strlen(argv[0]);
+  len = strlen(name);
   hold = -1;
   for (i=0; i<NCMDS; i++) {
-    if (strcasecmp(argv[0], cmd[i].name) == 0) {
-      return cmd[i].func(pgm, p, argc, argv);
+    if (strcasecmp(name, cmd[i].name) == 0) {
+      return &cmd[i];
     }
-    else if (strncasecmp(argv[0], cmd[i].name, len)==0) {
+    else if (strncasecmp(name, cmd[i].name, len)==0) {
       if (hold != -1) {
         fprintf(stderr, "%s: command \"%s\" is ambiguous\n",
-                progname, argv[0]);
-        return -1;
+                progname, name);
+        return NULL;
       }
       hold = i;
     }
   }
 
   if (hold != -1)
-    return cmd[hold].func(pgm, p, argc, argv);
+    return &cmd[hold];
 
   fprintf(stderr, "%s: invalid command \"%s\"\n",
-          progname, argv[0]);
+          progname, name);
 
-  return -1;
+  return NULL;
+}
+
+
+static int do_cmd(PROGRAMMER * pgm, struct avrpart * p,
+		  int argc, char * argv[])
+{
+  struct command * c;
+
+  if ((c = find_cmd(argv[0])) == NULL)
+    return -1;
+
+  return c->func(pgm, p, argc, argv);
 }
 
 
@@ -971,3 +1140,212 @@ int terminal_mode(PROGRAMMER * pgm, struct avrpart * p)
 }
 
 
+/*
+ * A command of a batch file.  Adjacent dump or write commands on
+ * consecutive ranges of the same memory are merged into one; start
+ * and len describe the range, and bytes holds the values to write.
+ */
+struct batch_cmd {
+  int              lineno;
+  struct command * cmd;
+  int              argc;
+  char          ** argv;
+  AVRMEM         * mem;
+  unsigned long    start;
+  long             len;
+  char           * bytes;
+};
+
+
+/*
+ * Find out the memory range cmd works on, if it is one that can be
+ * merged with its neighbours.
+ */
+static void batch_range(struct avrpart * p, struct batch_cmd * c)
+{
+  char * e;
+
+  c->mem = NULL;
+  if (c->cmd->func == cmd_dump) {
+    if (c->argc != 4)
+      return;
+    c->len = strtol(c->argv[3], &e, 0);
+    if (*e || e == c->argv[3] || c->len <= 0)
+      return;
+  }
+  else if (c->cmd->func == cmd_write) {
+    if (c->argc < 4)
+      return;
+    c->len = c->argc - 3;
+  }
+  else
+    return;
+
+  c->start = strtoul(c->argv[2], &e, 0);
+  if (*e || e == c->argv[2])
+    return;
+  c->mem = avr_locate_mem(p, c->argv[1]);
+  if (c->mem != NULL && c->start + c->len > c->mem->size)
+    c->mem = NULL;
+}
+
+
+/*
+ * Merge command b into command a if it continues the range of a.
+ */
+static int batch_merge(struct batch_cmd * a, struct batch_cmd * b)
+{
+  char * line;
+  size_t n;
+  int i;
+
+  if (a->mem == NULL || b->mem != a->mem || b->cmd != a->cmd ||
+      b->start != a->start + a->len)
+    return 0;
+
+  if (a->cmd->func == cmd_write) {
+    n = strlen(a->bytes);
+    for (i = 3; i < b->argc; i++)
+      n += strlen(b->argv[i]) + 1;
+    a->bytes = realloc(a->bytes, n + 1);
+    if (a->bytes == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    for (i = 3; i < b->argc; i++) {
+      strcat(a->bytes, " ");
+      strcat(a->bytes, b->argv[i]);
+    }
+  }
+  a->len += b->len;
+
+  n = strlen(a->bytes) + strlen(a->mem->desc) + 64;
+  if ((line = malloc(n)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  if (a->cmd->func == cmd_write)
+    snprintf(line, n, "write %s 0x%lx%s", a->mem->desc, a->start, a->bytes);
+  else
+    snprintf(line, n, "dump %s 0x%lx %ld", a->mem->desc, a->start, a->len);
+  free(a->argv);
+  a->argc = tokenize(line, &a->argv);
+  free(line);
+
+  return 1;
+}
+
+
+/*
+ * Run the terminal commands in file ("-" for stdin) without
+ * interaction.  The whole file is parsed before any command is run,
+ * and adjacent dump and write commands on consecutive addresses of
+ * the same memory are run as one.  Returns -1 if the file contains an
+ * invalid command or a command fails.
+ */
+int terminal_batch(PROGRAMMER * pgm, struct avrpart * p, const char * file)
+{
+  FILE  * f;
+  char    line[1024];
+  char  * q;
+  struct batch_cmd * cmds, * c;
+  int     ncmds, maxcmds;
+  int     lineno;
+  int     i, j;
+  int     rc;
+
+  if (strcmp(file, "-") == 0)
+    f = stdin;
+  else if ((f = fopen(file, "r")) == NULL) {
+    fprintf(stderr, "%s: can't open command file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+
+  cmds = NULL;
+  ncmds = maxcmds = 0;
+  rc = 0;
+  for (lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+    q = line;
+    while (*q && isspace((int)*q))
+      q++;
+
+    /* skip blank lines and comments */
+    if (!*q || (*q == '#'))
+      continue;
+
+    if (ncmds == maxcmds) {
+      maxcmds = maxcmds? 2 * maxcmds: 64;
+      cmds = realloc(cmds, maxcmds * sizeof(struct batch_cmd));
+      if (cmds == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+      }
+    }
+    c = &cmds[ncmds];
+    memset(c, 0, sizeof(*c));
+    c->lineno = lineno;
+    c->argc = tokenize(q, &c->argv);
+    if ((c->cmd = find_cmd(c->argv[0])) == NULL) {
+      fprintf(stderr, "%s: %s:%d: bad command\n", progname, file, lineno);
+      free(c->argv);
+      rc = -1;
+      continue;
+    }
+    if ((c->bytes = strdup("")) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    batch_range(p, c);
+    if (c->cmd->func == cmd_write)
+      for (i = 3; c->mem != NULL && i < c->argc; i++) {
+        c->bytes = realloc(c->bytes, strlen(c->bytes) +
+                           strlen(c->argv[i]) + 2);
+        if (c->bytes == NULL) {
+          fprintf(stderr, "%s: out of memory\n", progname);
+          exit(1);
+        }
+        strcat(c->bytes, " ");
+        strcat(c->bytes, c->argv[i]);
+      }
+
+    if (ncmds > 0 && batch_merge(&cmds[ncmds - 1], c)) {
+      if (verbose >= 2)
+        fprintf(stderr, "%s: %s:%d: merged into line %d\n",
+                progname, file, lineno, cmds[ncmds - 1].lineno);
+      free(c->argv);
+      free(c->bytes);
+      continue;
+    }
+    ncmds++;
+  }
+  if (f != stdin)
+    fclose(f);
+
+  for (i = 0; rc == 0 && i < ncmds; i++) {
+    c = &cmds[i];
+
+    fprintf(stdout, ">>> ");
+    for (j=0; j<c->argc; j++)
+      fprintf(stdout, "%s ", c->argv[j]);
+    fprintf(stdout, "\n");
+
+    rc = c->cmd->func(pgm, p, c->argc, c->argv);
+    if (rc > 0) {
+      /* quit */
+      rc = 0;
+      break;
+    }
+    if (rc < 0)
+      fprintf(stderr, "%s: %s:%d: command failed\n",
+              progname, file, c->lineno);
+  }
+
+  for (i = 0; i < ncmds; i++) {
+    free(cmds[i].argv);
+    free(cmds[i].bytes);
+  }
+  free(cmds);
+
+  return rc;
+}
@@ -29,6 +29,7 @@ extern "C" {
 #endif
 
 int terminal_mode(PROGRAMMER * pgm, struct avrpart * p);
+int terminal_batch(PROGRAMMER * pgm, struct avrpart * p, const char * file);
 char * terminal_get_input(const char *prompt);
 
 #ifdef __cplusplus
@@ -0,0 +1,184 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "serial.h"
+#include "trace.h"
+
+#define TRACE_BUFSIZE (256 * 1024)
+
+static FILE * trace_file;
+static unsigned char * trace_buf;
+static size_t trace_len;
+static unsigned long long trace_last;
+static int trace_failed;
+
+int trace_enabled;
+
+
+unsigned long long trace_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static void trace_put(unsigned char * p, unsigned long long v, int n)
+{
+  while (n-- > 0) {
+    *p++ = v & 0xff;
+    v >>= 8;
+  }
+}
+
+static void trace_flush(void)
+{
+  if (trace_len > 0 && !trace_failed &&
+      fwrite(trace_buf, 1, trace_len, trace_file) != trace_len) {
+    fprintf(stderr, "%s: can't write trace file: %s\n",
+            progname, strerror(errno));
+    trace_failed = 1;
+  }
+  trace_len = 0;
+}
+
+int trace_open(const char * file)
+{
+  unsigned char hdr[TRACE_HDRLEN];
+
+  if ((trace_file = fopen(file, "wb")) == NULL) {
+    fprintf(stderr, "%s: can't create trace file \"%s\": %s\n",
+            progname, file, strerror(errno));
+    return -1;
+  }
+  if ((trace_buf = malloc(TRACE_BUFSIZE)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  trace_last = trace_time();
+  memcpy(hdr, TRACE_MAGIC, 6);
+  hdr[6] = TRACE_VERSION;
+  hdr[7] = 0;
+  trace_put(hdr + 8, trace_last, 8);
+  memcpy(trace_buf, hdr, sizeof(hdr));
+  trace_len = sizeof(hdr);
+
+  trace_enabled = 1;
+  serial_watch = 1;
+  /* the many exit(1) paths should not lose the end of the trace */
+  atexit(trace_close);
+
+  return 0;
+}
+
+void trace_close(void)
+{
+  if (!trace_enabled)
+    return;
+
+  trace_flush();
+  fclose(trace_file);
+  free(trace_buf);
+  trace_buf = NULL;
+  trace_enabled = 0;
+}
+
+static void trace_record(int type, unsigned long long start,
+                         unsigned long long end, size_t len)
+{
+  unsigned char * p;
+  unsigned long long t;
+
+  if (trace_len + TRACE_RECLEN > TRACE_BUFSIZE)
+    trace_flush();
+  p = trace_buf + trace_len;
+  trace_len += TRACE_RECLEN;
+
+  p[0] = type;
+  trace_put(p + 1, len, 2);
+  t = start > trace_last? start - trace_last: 0;
+  trace_put(p + 3, t > 0xffffffffULL? 0xffffffffULL: t, 4);
+  t = end > start? end - start: 0;
+  trace_put(p + 7, t > 0xffffffffULL? 0xffffffffULL: t, 4);
+  trace_last = start;
+}
+
+static void trace_data(const unsigned char * buf, size_t len)
+{
+  size_t n;
+
+  while (len > 0) {
+    if (trace_len == TRACE_BUFSIZE)
+      trace_flush();
+    n = TRACE_BUFSIZE - trace_len;
+    if (n > len)
+      n = len;
+    memcpy(trace_buf + trace_len, buf, n);
+    trace_len += n;
+    buf += n;
+    len -= n;
+  }
+}
+
+void trace_frame(int type, unsigned long long start, unsigned long long end,
+                 const struct serial_iov * iov, int iovcnt)
+{
+  size_t len, off, n;
+  int i;
+
+  if (!trace_enabled)
+    return;
+
+  for (i = 0, len = 0; i < iovcnt; i++)
+    len += iov[i].len;
+  if (len == 0 || type == TRACE_TX_ERROR || type == TRACE_RX_ERROR) {
+    trace_record(type, start, end, 0);
+    return;
+  }
+
+  /* split long frames; the records after the first start with it */
+  for (i = 0, off = 0; len > 0; ) {
+    n = len > TRACE_MAXDATA? TRACE_MAXDATA: len;
+    trace_record(type, start, end, n);
+    len -= n;
+    while (n > 0) {
+      size_t k = iov[i].len - off;
+
+      if (k > n)
+        k = n;
+      trace_data(iov[i].buf + off, k);
+      n -= k;
+      if ((off += k) == iov[i].len) {
+        i++;
+        off = 0;
+      }
+    }
+  }
+}
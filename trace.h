@@ -0,0 +1,82 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef trace_h
+#define trace_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wire-level trace of the serial (and USB framed) transport.  Frames
+ * are collected in a memory buffer and written to the trace file in
+ * large blocks, so tracing hardly changes the timing of a run.  The
+ * avrtrace program decodes the file.
+ *
+ * File format, all numbers little-endian:
+ *
+ *   header   "AVRTRC" TRACE_VERSION 0, then the start of the trace
+ *            in microseconds since the epoch (8 bytes)
+ *   record   type (1 byte), data length (2 bytes), start of the
+ *            transfer in microseconds after the start of the previous
+ *            record (4 bytes), duration in microseconds (4 bytes),
+ *            then the data
+ *
+ * Frames longer than TRACE_MAXDATA bytes are split into several
+ * records.  Times that do not fit are stored as 0xffffffff.
+ */
+#define TRACE_MAGIC     "AVRTRC"
+#define TRACE_VERSION   1
+#define TRACE_HDRLEN    16
+#define TRACE_RECLEN    11
+#define TRACE_MAXDATA   65535
+
+enum {
+  TRACE_TX,                     /* data sent */
+  TRACE_RX,                     /* data received */
+  TRACE_TX_ERROR,               /* send failed, the data were not sent */
+  TRACE_RX_ERROR                /* receive failed or timed out, no data */
+};
+
+extern int trace_enabled;
+
+/* start tracing to file; returns -1 if it cannot be created */
+int trace_open(const char * file);
+
+/* write out what is buffered and stop tracing */
+void trace_close(void);
+
+/*
+ * One transfer of the data in iov, with the times from
+ * trace_time() taken before and after it.
+ */
+struct serial_iov;
+void trace_frame(int type, unsigned long long start, unsigned long long end,
+                 const struct serial_iov * iov, int iovcnt);
+
+/* microseconds since the epoch */
+unsigned long long trace_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
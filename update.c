@@ -19,17 +19,25 @@
 
 /* $Id: update.c 1107 2012-11-20 14:03:50Z joerg_wunsch $ */
 
+#include "ac_cfg.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#if defined(HAVE_PTHREAD_H)
+#  include <pthread.h>
+#endif
 
 #include "avrdude.h"
 #include "avr.h"
 #include "config.h"
 #include "confwin.h"
 #include "fileio.h"
+#include "memsum.h"
+#include "stats.h"
 #include "update.h"
 
 UPDATE * parse_op(char * s)
@@ -62,6 +70,10 @@ UPDATE * parse_op(char * s)
     }
     strcpy(upd->filename, buf);
     upd->format = FMT_AUTO;
+    upd->image = NULL;
+    upd->image_size = 0;
+    upd->is_delta = UPDATE_DELTA_UNKNOWN;
+    upd->delta = NULL;
     return upd;
   }
 
@@ -132,10 +144,13 @@ UPDATE * parse_op(char * s)
       case 'a': upd->format = FMT_AUTO; break;
       case 's': upd->format = FMT_SREC; break;
       case 'i': upd->format = FMT_IHEX; break;
+      case 'I': upd->format = FMT_IHEX_SPARSE; break;
+      case 'S': upd->format = FMT_SREC_SPARSE; break;
       case 'r': upd->format = FMT_RBIN; break;
       case 'e': upd->format = FMT_ELF; break;
       case 'm': upd->format = FMT_IMM; break;
       case 'b': upd->format = FMT_BIN; break;
+      case 'D': upd->format = FMT_DELTA; break;
       case 'd': upd->format = FMT_DEC; break;
       case 'h': upd->format = FMT_HEX; break;
       case 'o': upd->format = FMT_OCT; break;
@@ -156,6 +171,10 @@ UPDATE * parse_op(char * s)
   }
   memcpy(upd->filename, cp, fnlen);
   upd->filename[fnlen] = 0;
+  upd->image = NULL;
+  upd->image_size = 0;
+  upd->is_delta = UPDATE_DELTA_UNKNOWN;
+  upd->delta = NULL;
 
   return upd;
 }
@@ -177,6 +196,10 @@ UPDATE * dup_update(UPDATE * upd)
   else
     u->memtype = NULL;
   u->filename = strdup(upd->filename);
+  u->image = NULL;
+  u->image_size = 0;
+  u->is_delta = UPDATE_DELTA_UNKNOWN;
+  u->delta = NULL;
 
   return u;
 }
@@ -195,6 +218,10 @@ UPDATE * new_update(int op, char * memtype, int filefmt, char * filename)
   u->filename = strdup(filename);
   u->op = op;
   u->format = filefmt;
+  u->image = NULL;
+  u->image_size = 0;
+  u->is_delta = UPDATE_DELTA_UNKNOWN;
+  u->delta = NULL;
 
   return u;
 }
@@ -210,18 +237,973 @@ void free_update(UPDATE * u)
 	    free(u->filename);
 	    u->filename = NULL;
 	}
+	if(u->image != NULL) {
+	    avr_free_mem(u->image);
+	    u->image = NULL;
+	}
+	if(u->delta != NULL) {
+	    free(u->delta->base);
+	    free(u->delta);
+	    u->delta = NULL;
+	}
 	free(u);
     }
 }
 
 
-int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags flags)
+/*
+ * Read the input file of a write or verify operation ahead of time and
+ * keep its contents with the update, so that do_op() does not have to
+ * read it again, e.g. once for every device in gang mode.
+ */
+int update_preload(struct avrpart * p, UPDATE * upd)
 {
-  struct avrpart * v;
   AVRMEM * mem;
-  int size, vsize;
   int rc;
 
+  if (upd->op == DEVICE_READ || upd->image != NULL)
+    return 0;
+
+  mem = avr_locate_mem(p, upd->memtype);
+  if (mem == NULL) {
+    fprintf(stderr, "\"%s\" memory type not defined for part \"%s\"\n",
+            upd->memtype, p->desc);
+    return -1;
+  }
+
+  if (quell_progress < 2) {
+    fprintf(stderr,
+            "%s: reading input file \"%s\"\n",
+            progname,
+            strcmp(upd->filename, "-")==0 ? "<stdin>" : upd->filename);
+  }
+  rc = fileio(FIO_READ, upd->filename, upd->format, p, upd->memtype, -1);
+  if (rc < 0) {
+    fprintf(stderr, "%s: read from file '%s' failed\n",
+            progname, upd->filename);
+    return -1;
+  }
+
+  upd->image = avr_dup_mem(mem);
+  upd->image_size = rc;
+
+  return 0;
+}
+
+/*
+ * Input files read on a thread of their own while the device is being
+ * programmed.  Each file is read into a private copy of the part, with
+ * a buffer of its own for the memory concerned, so the thread never
+ * touches a buffer the programming side can see; do_op() waits for its
+ * file and takes the contents over.
+ */
+struct prefetch {
+  UPDATE * upd;                 /* NULL once handed over */
+  AVRPART * part;               /* copy of the part the file is read into */
+  AVRMEM * mem;                 /* the memory of upd in it */
+  int same;                     /* earlier job reading the same, or -1 */
+  int rc;                       /* what fileio() returned */
+  int done;
+};
+
+static struct prefetch * prefetch_jobs;
+static int prefetch_njobs;
+
+#if defined(HAVE_PTHREAD_H)
+static pthread_t prefetch_thread;
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+static void * update_prefetch_run(void * arg)
+{
+  struct prefetch * j;
+  int i, rc;
+
+  for (i = 0; i < prefetch_njobs; i++) {
+    j = &prefetch_jobs[i];
+    if (j->same < 0)
+      rc = fileio(FIO_READ, j->upd->filename, j->upd->format, j->part,
+                  j->upd->memtype, -1);
+    else
+      rc = prefetch_jobs[j->same].rc;
+    pthread_mutex_lock(&prefetch_mutex);
+    j->rc = rc;
+    j->done = 1;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+  }
+
+  return NULL;
+}
+#endif
+
+static void update_prefetch_free(void)
+{
+  int i;
+
+  for (i = 0; i < prefetch_njobs; i++)
+    if (prefetch_jobs[i].part != NULL)
+      avr_free_part(prefetch_jobs[i].part);
+  free(prefetch_jobs);
+  prefetch_jobs = NULL;
+  prefetch_njobs = 0;
+}
+
+/*
+ * Start reading the input files of updates on a thread of their own,
+ * as far as that is safe; a no-op without threads.
+ */
+void update_prefetch(struct avrpart * p, LISTID updates)
+{
+#if defined(HAVE_PTHREAD_H)
+  struct prefetch * j;
+  LNODEID ln;
+  UPDATE * upd;
+  int i, n;
+
+  if (prefetch_jobs != NULL)
+    return;
+
+  /*
+   * Stop at the first read: its output file could be the input of a
+   * later update.  Standard input, which the run may still prompt on,
+   * is left alone.
+   */
+  n = 0;
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->op == DEVICE_READ)
+      break;
+    n++;
+  }
+  if (n == 0)
+    return;
+  prefetch_jobs = (struct prefetch *)calloc(n, sizeof(struct prefetch));
+  if (prefetch_jobs == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->op == DEVICE_READ)
+      break;
+    if (upd->image != NULL || strcmp(upd->filename, "-") == 0 ||
+        avr_locate_mem(p, upd->memtype) == NULL)
+      continue;
+    j = &prefetch_jobs[prefetch_njobs];
+    j->upd = upd;
+    j->same = -1;
+    for (i = 0; i < prefetch_njobs; i++)
+      if (prefetch_jobs[i].same < 0 &&
+          strcmp(prefetch_jobs[i].upd->filename, upd->filename) == 0 &&
+          strcmp(prefetch_jobs[i].upd->memtype, upd->memtype) == 0 &&
+          prefetch_jobs[i].upd->format == upd->format)
+        j->same = i;
+    if (j->same < 0) {
+      j->part = avr_dup_part(p);
+      j->mem = avr_locate_mem(j->part, upd->memtype);
+      avr_mem_unshare(j->mem, 0);
+      avr_mem_untag(j->mem, 0, j->mem->size);
+    }
+    prefetch_njobs++;
+  }
+
+  if (prefetch_njobs == 0 ||
+      pthread_create(&prefetch_thread, NULL, update_prefetch_run, NULL) != 0)
+    update_prefetch_free();
+#endif
+}
+
+/*
+ * Take over the contents of the input file of upd if it has been read
+ * ahead; returns what fileio() returned, or 0 if it was not.
+ */
+static int update_prefetched(UPDATE * upd)
+{
+  struct prefetch * j = NULL, * src;
+  int i;
+
+  for (i = 0; i < prefetch_njobs; i++)
+    if (prefetch_jobs[i].upd == upd)
+      j = &prefetch_jobs[i];
+  if (j == NULL)
+    return 0;
+
+#if defined(HAVE_PTHREAD_H)
+  pthread_mutex_lock(&prefetch_mutex);
+  while (!j->done)
+    pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+  pthread_mutex_unlock(&prefetch_mutex);
+#endif
+
+  src = j->same < 0? j: &prefetch_jobs[j->same];
+  j->upd = NULL;
+  if (src->rc < 0)
+    return src->rc;
+  upd->image = avr_dup_mem(src->mem);
+  upd->image_size = src->rc;
+
+  return 0;
+}
+
+/* wait for the thread to finish, and drop what was not taken over */
+void update_prefetch_end(void)
+{
+  if (prefetch_jobs == NULL)
+    return;
+#if defined(HAVE_PTHREAD_H)
+  pthread_join(prefetch_thread, NULL);
+#endif
+  update_prefetch_free();
+}
+
+/*
+ * Erase times to assume where the part description gives none, as for
+ * the ATxmega parts.
+ */
+#define PLAN_PAGE_ERASE_DELAY  4500     /* microseconds */
+#define PLAN_CHIP_ERASE_DELAY 45000
+
+/* whether writing memory a can change what memory b holds */
+static int update_mem_overlap(AVRMEM * a, AVRMEM * b)
+{
+  if (a == b)
+    return 1;
+  /* only the ATxmega memories alias, within the address space of offset */
+  return a->offset != 0 && b->offset != 0 &&
+    a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+/*
+ * Whether every page of whole is written by the writes in updates,
+ * counting those of the ATxmega memories that alias it; the images
+ * have been loaded.
+ */
+static int update_covers(struct avrpart * p, LISTID updates, AVRMEM * whole)
+{
+  LNODEID ln;
+  UPDATE * upd;
+  AVRMEM * mem;
+  unsigned char * done;
+  int addr, off, npages, n;
+
+  npages = (whole->size + whole->page_size - 1) / whole->page_size;
+  if ((done = calloc(npages, 1)) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    mem = avr_locate_mem(p, upd->memtype);
+    if (upd->op != DEVICE_WRITE || mem == NULL || mem->page_size == 0 ||
+        upd->image == NULL || !update_mem_overlap(mem, whole))
+      continue;
+    off = mem == whole? 0: (int)(mem->offset - whole->offset);
+    for (addr = avr_mem_next_dirty(upd->image, 0, upd->image_size);
+         addr >= 0;
+         addr = avr_mem_next_dirty(upd->image, addr + mem->page_size,
+                                   upd->image_size))
+      if (off + addr >= 0 && off + addr < whole->size)
+        done[(off + addr) / whole->page_size] = 1;
+  }
+  for (n = 0; n < npages && done[n]; n++)
+    ;
+  free(done);
+
+  return n == npages;
+}
+
+int update_plan_chip_erase(struct avrpart * p, LISTID updates)
+{
+  static const char * cleared[] = {
+    "flash", "application", "apptable", "boot", "eeprom"
+  };
+  static const char * whole[] = { "flash", "eeprom" };
+  LNODEID ln;
+  UPDATE * upd;
+  AVRMEM * mem;
+  long pages_us, chip_us;
+  int i, n;
+
+  pages_us = 0;
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    /* a later input file may be the output of this read */
+    if (upd->op == DEVICE_READ)
+      return 0;
+    if (upd->op != DEVICE_WRITE)
+      continue;
+    mem = avr_locate_mem(p, upd->memtype);
+    if (mem == NULL || mem->page_size == 0)
+      continue;
+    /* a chip erase would leave it alone, it needs its page erases */
+    for (i = 0; i < sizeof(cleared) / sizeof(cleared[0]); i++)
+      if (strcmp(mem->desc, cleared[i]) == 0)
+        break;
+    if (i == sizeof(cleared) / sizeof(cleared[0]))
+      return 0;
+
+    if (update_prefetched(upd) < 0 ||
+        (upd->image == NULL && update_preload(p, upd) < 0))
+      return 0;
+    n = avr_mem_count_dirty(upd->image, upd->image_size);
+    pages_us += (long)n * (mem->max_write_delay > 0?
+                           mem->max_write_delay: PLAN_PAGE_ERASE_DELAY);
+  }
+
+  /*
+   * A chip erase clears all of flash and EEPROM, where page erases
+   * keep what is not written: only when the writes cover both anyway
+   * is it the same.  (EESAVE may keep the EEPROM, but whether it is
+   * set is not known here.)
+   */
+  for (i = 0; i < sizeof(whole) / sizeof(whole[0]); i++) {
+    mem = avr_locate_mem(p, (char *)whole[i]);
+    if (mem != NULL && mem->page_size > 0 && !update_covers(p, updates, mem))
+      return 0;
+  }
+  chip_us = p->chip_erase_delay > 0? p->chip_erase_delay: PLAN_CHIP_ERASE_DELAY;
+  if (verbose > 1)
+    fprintf(stderr, "%s: erase estimate: %ld us by pages, %ld us by chip\n",
+            progname, pages_us, chip_us);
+
+  return chip_us < pages_us;
+}
+
+/* copy the tagged bytes of src below size over those of dst */
+static void update_overlay(AVRMEM * dst, AVRMEM * src, int size)
+{
+  int addr, end;
+
+  avr_mem_unshare(dst, 1);
+  for (addr = avr_mem_tag_find(src, 0, size, 1); addr < size;
+       addr = avr_mem_tag_find(src, end, size, 1)) {
+    end = avr_mem_tag_find(src, addr, size, 0);
+    memcpy(dst->buf + addr, src->buf + addr, end - addr);
+    avr_mem_tag(dst, addr, end - addr);
+  }
+}
+
+static char * update_join_names(char * a, const char * b)
+{
+  char * s;
+
+  s = (char *)malloc(strlen(a) + strlen(b) + 3);
+  if (s == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  sprintf(s, "%s, %s", a, b);
+  free(a);
+
+  return s;
+}
+
+/*
+ * Whether upd writes a delta file, or might, if it cannot be read;
+ * the file is only looked at the first time.
+ */
+int update_is_delta(UPDATE * upd)
+{
+  if (upd->op != DEVICE_WRITE)
+    return 0;
+  if (upd->is_delta == UPDATE_DELTA_UNKNOWN) {
+    if ((upd->delta = calloc(1, sizeof(*upd->delta))) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+    upd->is_delta = fileio_delta_base(upd->filename, upd->format,
+                                      upd->delta);
+    if (upd->is_delta != 1) {
+      free(upd->delta);
+      upd->delta = NULL;
+    }
+  }
+
+  return upd->is_delta != 0;
+}
+
+int update_has_delta(LISTID updates)
+{
+  LNODEID ln;
+
+  for (ln = lfirst(updates); ln; ln = lnext(ln))
+    if (update_is_delta(ldata(ln)))
+      return 1;
+
+  return 0;
+}
+
+int update_merge_writes(struct avrpart * p, LISTID updates)
+{
+  LNODEID ln, ln2, end, next;
+  UPDATE * w, * u, * last, * vfy;
+  AVRMEM * mem, * m;
+  int n;
+
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    w = ldata(ln);
+    if (w->op != DEVICE_WRITE || strcmp(w->filename, "-") == 0 ||
+        (mem = avr_locate_mem(p, w->memtype)) == NULL || update_is_delta(w))
+      continue;
+
+    /*
+     * Find how far the writes of mem can be gathered: up to anything
+     * else that reads, writes or compares it, except a verify against
+     * the file written just before, as -U adds unless -V is given.
+     */
+    last = w;
+    n = 0;
+    for (end = lnext(ln); end; end = lnext(end)) {
+      u = ldata(end);
+      m = avr_locate_mem(p, u->memtype);
+      if (m != NULL && !update_mem_overlap(m, mem))
+        continue;
+      if (m != mem || u->op == DEVICE_READ || strcmp(u->filename, "-") == 0 ||
+          update_is_delta(u))
+        break;
+      if (u->op == DEVICE_VERIFY &&
+          (strcmp(u->filename, last->filename) != 0 ||
+           u->format != last->format))
+        break;
+      if (u->op == DEVICE_WRITE) {
+        last = u;
+        n++;
+      }
+    }
+    if (n == 0)
+      continue;
+
+    /* fold the later files into the image of the first, the last wins */
+    if (update_preload(p, w) < 0)
+      return -1;
+    vfy = NULL;
+    for (ln2 = lnext(ln); ln2 != end; ln2 = next) {
+      next = lnext(ln2);
+      u = ldata(ln2);
+      if (avr_locate_mem(p, u->memtype) != mem)
+        continue;
+      if (u->op == DEVICE_WRITE) {
+        if (update_preload(p, u) < 0)
+          return -1;
+        if (quell_progress < 2)
+          fprintf(stderr, "%s: merging the %s write of \"%s\" "
+                  "into that of \"%s\"\n",
+                  progname, mem->desc, u->filename, w->filename);
+        update_overlay(w->image, u->image, u->image_size);
+        if (u->image_size > w->image_size)
+          w->image_size = u->image_size;
+        w->filename = update_join_names(w->filename, u->filename);
+      } else if (vfy == NULL) {
+        vfy = u;
+        continue;
+      }
+      lrmv_ln(updates, ln2);
+      free_update(u);
+    }
+
+    /* one verify against everything written */
+    if (vfy != NULL) {
+      if (vfy->image != NULL)
+        avr_free_mem(vfy->image);
+      vfy->image = avr_dup_mem(w->image);
+      vfy->image_size = w->image_size;
+      free(vfy->filename);
+      vfy->filename = strdup(w->filename);
+    }
+  }
+
+  return 0;
+}
+
+/* 64-bit FNV-1a of len bytes of buf, from UPDATE_HASH_INIT on */
+#define UPDATE_HASH_INIT 14695981039346656037ULL
+
+static uint64_t update_hash(uint64_t h, const void * buf, size_t len)
+{
+  const unsigned char * b = buf;
+
+  while (len-- > 0) {
+    h ^= *b++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/*
+ * Fingerprints of -H: FNV-1a over the part, and over each write in
+ * turn its memory and every run of bytes it writes, along with where
+ * the run goes.  The fingerprint location itself is left out, so that
+ * an image that has the fingerprint added hashes the same.
+ */
+
+static uint64_t update_fp_hash_num(uint64_t h, unsigned long v)
+{
+  unsigned char b[4];
+  int i;
+
+  for (i = 0; i < 4; i++, v >>= 8)
+    b[i] = v & 0xff;
+  return update_hash(h, b, 4);
+}
+
+static uint64_t update_fp_hash_runs(uint64_t h, AVRMEM * m, int start,
+                                    int size)
+{
+  int addr, end;
+
+  for (addr = avr_mem_tag_find(m, start, size, 1); addr < size;
+       addr = avr_mem_tag_find(m, end, size, 1)) {
+    end = avr_mem_tag_find(m, addr, size, 0);
+    h = update_fp_hash_num(h, addr);
+    h = update_fp_hash_num(h, end - addr);
+    h = update_hash(h, m->buf + addr, end - addr);
+  }
+  return h;
+}
+
+int update_fingerprint(struct avrpart * p, LISTID updates,
+                       const char * memtype, unsigned long addr,
+                       unsigned char * fp)
+{
+  LNODEID ln;
+  UPDATE * upd;
+  AVRMEM * fpmem, * mem;
+  uint64_t h = UPDATE_HASH_INIT;
+  int size, lo, hi, i, n;
+
+  fpmem = avr_locate_mem(p, (char *)memtype);
+  if (fpmem == NULL || addr + UPDATE_FPLEN > (unsigned long)fpmem->size) {
+    fprintf(stderr, "%s: fingerprint location %s:0x%lx is not in part %s\n",
+            progname, memtype, addr, p->desc);
+    return -1;
+  }
+  lo = addr;
+  hi = lo + UPDATE_FPLEN;
+
+  h = update_hash(h, p->id, strlen(p->id) + 1);
+  n = 0;
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    /* do_op() reports unknown memories */
+    if (upd->op != DEVICE_WRITE ||
+        (mem = avr_locate_mem(p, upd->memtype)) == NULL)
+      continue;
+    if (update_prefetched(upd) < 0 ||
+        (upd->image == NULL && update_preload(p, upd) < 0))
+      return -1;
+    size = upd->image_size;
+
+    h = update_hash(h, mem->desc, strlen(mem->desc) + 1);
+    /* an ATxmega memory aliasing that of the fingerprint */
+    if (mem != fpmem && update_mem_overlap(mem, fpmem) &&
+        mem->offset < fpmem->offset + hi &&
+        fpmem->offset + lo < mem->offset + size) {
+      fprintf(stderr, "%s: the %s write of \"%s\" covers the fingerprint "
+              "location\n", progname, mem->desc, upd->filename);
+      return -1;
+    }
+    if (mem == fpmem && size > lo) {
+      h = update_fp_hash_runs(h, upd->image, 0, lo);
+      h = update_fp_hash_runs(h, upd->image, size < hi? size: hi, size);
+    } else
+      h = update_fp_hash_runs(h, upd->image, 0, size);
+    n++;
+  }
+  if (n == 0)
+    return 0;
+
+  for (i = 0; i < UPDATE_FPLEN; i++, h >>= 8)
+    fp[i] = h & 0xff;
+
+  /* data of the writes where the fingerprint goes would be lost */
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->op != DEVICE_WRITE || avr_locate_mem(p, upd->memtype) != fpmem)
+      continue;
+    size = upd->image_size < hi? upd->image_size: hi;
+    for (i = lo; i < size; i++)
+      if (avr_mem_tagged(upd->image, i) && upd->image->buf[i] != fp[i - lo]) {
+        fprintf(stderr, "%s: the %s write of \"%s\" covers the fingerprint "
+                "location\n", progname, fpmem->desc, upd->filename);
+        return -1;
+      }
+  }
+
+  return 1;
+}
+
+int update_fingerprint_add(struct avrpart * p, LISTID updates,
+                           const char * memtype, unsigned long addr,
+                           const unsigned char * fp)
+{
+  LNODEID ln;
+  UPDATE * upd, * last, * lastfp;
+  AVRMEM * fpmem, * img;
+
+  fpmem = avr_locate_mem(p, (char *)memtype);
+  last = lastfp = NULL;
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    if (upd->op != DEVICE_WRITE)
+      continue;
+    last = upd;
+    if (avr_locate_mem(p, upd->memtype) == fpmem)
+      lastfp = upd;
+  }
+
+  if (lastfp != NULL && lastfp == last) {
+    /* update_fingerprint() had the image loaded */
+    img = lastfp->image;
+    avr_mem_unshare(img, 1);
+    memcpy(img->buf + addr, fp, UPDATE_FPLEN);
+    avr_mem_tag(img, addr, UPDATE_FPLEN);
+    if (lastfp->image_size < (int)(addr + UPDATE_FPLEN))
+      lastfp->image_size = addr + UPDATE_FPLEN;
+    return 0;
+  }
+
+  /* anything but EEPROM would need an erase to be written on its own */
+  if (strcasecmp(fpmem->desc, "eeprom") != 0) {
+    fprintf(stderr, "%s: the fingerprint in %s needs the last write "
+            "to be one of %s\n", progname, fpmem->desc, fpmem->desc);
+    return -1;
+  }
+  upd = new_update(DEVICE_WRITE, fpmem->desc, FMT_IMM, "fingerprint");
+  img = avr_dup_mem(fpmem);
+  avr_mem_unshare(img, 1);
+  avr_mem_untag(img, 0, img->size);
+  memcpy(img->buf + addr, fp, UPDATE_FPLEN);
+  avr_mem_tag(img, addr, UPDATE_FPLEN);
+  upd->image = img;
+  upd->image_size = addr + UPDATE_FPLEN;
+  ladd(updates, upd);
+
+  return 0;
+}
+
+/*
+ * Seconds one page (or byte, if mem is not paged) of mem takes in
+ * direction dir: as the reference statistics measured it, else the
+ * bytes of it over the link plus the write delay of the part.  Sets
+ * *measured accordingly.
+ */
+static double estimate_unit(PROGRAMMER * pgm, AVRMEM * mem, int dir,
+                            int * measured)
+{
+  unsigned long pages, bytes;
+  double seconds, byte_s;
+  int unit = mem->page_size > 0? mem->page_size: 1;
+
+  if (stats_ref_mem(mem->desc, dir, &pages, &bytes, &seconds) == 0) {
+    *measured = 1;
+    if (mem->page_size > 0 && pages > 0)
+      return seconds / pages;
+    if (bytes > 0)
+      return seconds / bytes * unit;
+  }
+  *measured = 0;
+
+  /* ten bit times per byte on a serial line, if nothing better */
+  byte_s = stats_ref_byte();
+  if (byte_s == 0 && pgm->baudrate > 0)
+    byte_s = 10.0 / pgm->baudrate;
+  seconds = unit * byte_s;
+  if (dir == STATS_WRITE && mem->max_write_delay > 0)
+    seconds += mem->max_write_delay / 1000000.0;
+
+  return seconds;
+}
+
+int update_estimate(PROGRAMMER * pgm, struct avrpart * p, LISTID updates,
+                    enum updateflags flags, int erase)
+{
+  static const char * opname[] = { "read", "write", "verify" };
+  LNODEID ln;
+  UPDATE * upd;
+  AVRMEM * mem;
+  double t, total, unit_s;
+  int n, i, measured, guessed, page_erase;
+  const char * memname = (p->flags & AVRPART_HAS_PDI)? "application": "flash";
+
+  /* the erase main() would go for */
+  page_erase = 0;
+  if (flags & UF_AUTO_ERASE) {
+    if ((p->flags & AVRPART_HAS_PDI) && pgm->page_erase != NULL) {
+      if (update_plan_chip_erase(p, updates))
+        erase = 1;
+      else
+        page_erase = 1;
+    } else
+      for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+        upd = ldata(ln);
+        mem = avr_locate_mem(p, upd->memtype);
+        if (mem != NULL && upd->op == DEVICE_WRITE &&
+            strcasecmp(mem->desc, memname) == 0)
+          erase = 1;
+      }
+  }
+
+  fprintf(stderr, "%s: estimated programming time:\n", progname);
+  total = 0;
+  guessed = 0;
+  if (erase) {
+    t = (p->chip_erase_delay > 0? p->chip_erase_delay:
+         PLAN_CHIP_ERASE_DELAY) / 1000000.0;
+    fprintf(stderr, "%s%-12s %-6s %7s %-5s %10.3f s\n",
+            progbuf, "chip", "erase", "", "", t);
+    total += t;
+  }
+
+  for (ln = lfirst(updates); ln; ln = lnext(ln)) {
+    upd = ldata(ln);
+    mem = avr_locate_mem(p, upd->memtype);
+    if (mem == NULL) {
+      fprintf(stderr, "\"%s\" memory type not defined for part \"%s\"\n",
+              upd->memtype, p->desc);
+      return -1;
+    }
+
+    /* pages, or bytes, to transfer */
+    if (upd->op == DEVICE_READ)
+      n = mem->page_size > 0?
+        (mem->size + mem->page_size - 1) / mem->page_size: mem->size;
+    else {
+      if (update_prefetched(upd) < 0 ||
+          (upd->image == NULL && update_preload(p, upd) < 0))
+        return -1;
+      if (mem->page_size > 0)
+        n = avr_mem_count_dirty(upd->image, upd->image_size);
+      else
+        for (i = n = 0; i < upd->image_size; i++)
+          n += avr_mem_tagged(upd->image, i);
+    }
+
+    unit_s = estimate_unit(pgm, mem,
+                           upd->op == DEVICE_WRITE? STATS_WRITE: STATS_READ,
+                           &measured);
+    t = n * unit_s;
+    if (upd->op == DEVICE_WRITE && page_erase &&
+        mem->page_size > 0 && strcasecmp(mem->desc, "eeprom") != 0)
+      t += n * (mem->max_write_delay > 0? mem->max_write_delay:
+                PLAN_PAGE_ERASE_DELAY) / 1000000.0;
+    fprintf(stderr, "%s%-12s %-6s %7d %-5s %10.3f s%s\n",
+            progbuf, mem->desc, opname[upd->op], n,
+            mem->page_size > 0? "pages": "bytes", t, measured? "": " *");
+    total += t;
+    if (!measured)
+      guessed = 1;
+  }
+
+  fprintf(stderr, "%s%-12s %-6s %7s %-5s %10.3f s\n",
+          progbuf, "total", "", "", "", total);
+  if (guessed)
+    fprintf(stderr, "%s* not in the statistics, from link speed and "
+            "write delay\n", progbuf);
+
+  return 0;
+}
+
+/* bring the input file contents of upd into mem */
+static int update_load(struct avrpart * p, UPDATE * upd, AVRMEM * mem)
+{
+  if (update_prefetched(upd) < 0)
+    return -1;
+  if (upd->image == NULL)
+    return fileio(FIO_READ, upd->filename, upd->format, p, upd->memtype, -1);
+
+  avr_mem_copy_contents(mem, upd->image);
+
+  return upd->image_size;
+}
+
+/*
+ * Contents of memories whose every page was read back and compared
+ * while it was being written, so that verifying them against the same
+ * data needs no further read.
+ */
+#define FUSED_MAXMEM 8
+
+static struct {
+  AVRMEM * mem;
+  int size;
+  const char * how;             /* "while writing" or "by fingerprint" */
+} fused[FUSED_MAXMEM];
+
+/* forget what a write to mem may have changed, on ATxmega parts the
+ * memories aliasing it too */
+static void fused_drop(AVRMEM * mem)
+{
+  int i;
+
+  for (i = 0; i < FUSED_MAXMEM; i++)
+    if (fused[i].mem != NULL &&
+        (strcmp(fused[i].mem->desc, mem->desc) == 0 ||
+         update_mem_overlap(fused[i].mem, mem))) {
+      avr_free_mem(fused[i].mem);
+      fused[i].mem = NULL;
+    }
+}
+
+static void fused_keep(AVRMEM * mem, int size, const char * how)
+{
+  int i;
+
+  for (i = 0; i < FUSED_MAXMEM; i++)
+    if (fused[i].mem == NULL) {
+      fused[i].mem = mem;
+      fused[i].size = size;
+      fused[i].how = how;
+      return;
+    }
+  avr_free_mem(mem);
+}
+
+/*
+ * How the data of the first size bytes of mem were verified already,
+ * or NULL: every byte verify would compare must be one kept, and the
+ * same.
+ */
+static const char * fused_verified(AVRMEM * mem, int size)
+{
+  AVRMEM * m;
+  int i, addr, end;
+
+  for (i = 0; i < FUSED_MAXMEM; i++) {
+    m = fused[i].mem;
+    if (m == NULL || strcmp(m->desc, mem->desc) != 0 || fused[i].size < size)
+      continue;
+    if (m->buf == mem->buf && fused[i].size == size &&
+        avr_mem_tags_equal(m, mem, size))
+      return fused[i].how;
+    for (addr = avr_mem_tag_find(mem, 0, size, 1); addr < size;
+         addr = avr_mem_tag_find(mem, end, size, 1)) {
+      end = avr_mem_tag_find(mem, addr, size, 0);
+      if (avr_mem_tag_find(m, addr, end, 0) < end ||
+          memcmp(m->buf + addr, mem->buf + addr, end - addr) != 0)
+        return NULL;
+    }
+    return fused[i].how;
+  }
+
+  return NULL;
+}
+
+/*
+ * The write of a delta file loaded into mem: check that the device
+ * holds the base, by a CRC compare with the base in the file where
+ * the programmer can, else by reading it back, and fill the rest of
+ * the pages the delta changes from it, so that only those pages are
+ * written, and in full.  Returns the number of bytes to write, or -1.
+ */
+static int update_delta(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd,
+                        AVRMEM * mem, int size)
+{
+  struct fiodelta * base;
+  AVRMEM * delta, * vmem;
+  unsigned char hash[8];
+  uint64_t h;
+  int rc, i, addr, page, end, psize, n;
+
+  /* the file may not have been there when it was first looked at */
+  if (upd->is_delta < 0)
+    upd->is_delta = UPDATE_DELTA_UNKNOWN;
+  if (!update_is_delta(upd))
+    return size;
+  if ((base = upd->delta) == NULL)
+    return -1;
+  if (base->base_size > (unsigned long)mem->size) {
+    fprintf(stderr, "%s: the base of delta %s is larger than %s\n",
+            progname, upd->filename, mem->desc);
+    return -1;
+  }
+
+  /* keep the delta, mem gets what the device holds */
+  delta = avr_dup_mem(mem);
+
+  /* a CRC the device computes over the base, where the file holds it */
+  rc = -1;
+  if (base->base != NULL && pgm->verify_range != NULL) {
+    avr_mem_unshare(mem, 1);
+    memcpy(mem->buf, base->base, base->base_size);
+    if (quell_progress < 2)
+      fprintf(stderr, "%s: checking the base of delta %s on %s by CRC\n",
+              progname, upd->filename, mem->desc);
+    rc = pgm->verify_range(pgm, p, mem, 0, base->base_size);
+  }
+
+  if (rc < 0) {
+    vmem = avr_dup_mem(mem);
+    avr_mem_untag(vmem, 0, vmem->size);
+    avr_mem_tag(vmem, 0, base->base_size);
+    if (quell_progress < 2)
+      fprintf(stderr, "%s: reading the base of delta %s from %s:\n",
+              progname, upd->filename, mem->desc);
+    report_progress(0, 1, "Reading");
+    rc = avr_read_mem(pgm, p, mem, vmem);
+    report_progress(1, 1, NULL);
+    avr_free_mem(vmem);
+    if (rc < 0) {
+      fprintf(stderr, "%s: failed to read %s back to check the base of "
+              "delta %s\n", progname, mem->desc, upd->filename);
+      if (base->base == NULL && pgm->verify_range != NULL)
+        fprintf(stderr, "%sA delta made with avrdelta -b can be checked "
+                "by CRC instead.\n", progbuf);
+      avr_free_mem(delta);
+      return -1;
+    }
+
+    h = update_hash(UPDATE_HASH_INIT, mem->buf, base->base_size);
+    for (i = 0; i < 8; i++, h >>= 8)
+      hash[i] = h & 0xff;
+    rc = memcmp(hash, base->base_hash, sizeof(hash)) != 0;
+  }
+  if (rc != 0) {
+    fprintf(stderr, "%s: %s does not hold the base of delta %s, "
+            "write the full image\n", progname, mem->desc, upd->filename);
+    avr_free_mem(delta);
+    return -1;
+  }
+
+  /*
+   * The changed bytes over the device contents, in whole pages; for
+   * flash, size ends at the last byte that is not 0xff, which need not
+   * be the last one changed.
+   */
+  avr_mem_untag(mem, 0, mem->size);
+  update_overlay(mem, delta, mem->size);
+  avr_free_mem(delta);
+  psize = mem->page_size > 0? mem->page_size: 1;
+  for (n = 0, end = 0, addr = avr_mem_tag_find(mem, 0, mem->size, 1);
+       addr < mem->size;
+       addr = avr_mem_tag_find(mem, end, mem->size, 1), n++) {
+    page = addr / psize * psize;
+    end = page + psize > mem->size? mem->size: page + psize;
+    avr_mem_tag(mem, page, end - page);
+  }
+  if (quell_progress < 2)
+    fprintf(stderr, "%s: the base matches, delta %s changes %d %s\n",
+            progname, upd->filename, n,
+            mem->page_size > 0? "pages": "bytes");
+
+  return end > size? end: size;
+}
+
+static void update_stream_feed(void * ctx, AVRMEM * mem, unsigned long n)
+{
+  fileio_stream_feed(ctx, n);
+}
+
+int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags flags)
+{
+  struct fiostream * stream;
+  AVRMEM * mem, * vmem;
+  int size, vsize;
+  int rc, sumrc, verified;
+  unsigned long sum;
+  const char * how;
+
   mem = avr_locate_mem(p, upd->memtype);
   if (mem == NULL) {
     fprintf(stderr, "\"%s\" memory type not defined for part \"%s\"\n",
@@ -231,17 +1213,24 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
 
   if (upd->op == DEVICE_READ) {
     /*
-     * read out the specified device memory and write it to a file
+     * read out the specified device memory and write it to a file,
+     * while it is being read if the file format allows
      */
+    stream = fileio_stream_open(upd->filename, upd->format, p, upd->memtype);
     if (quell_progress < 2) {
       fprintf(stderr, "%s: reading %s memory:\n",
             progname, mem->desc);
 	  }
     report_progress(0,1,"Reading");
-    rc = avr_read(pgm, p, upd->memtype, 0);
+    if (stream != NULL)
+      rc = avr_read_stream(pgm, p, upd->memtype, update_stream_feed, stream);
+    else
+      rc = avr_read(pgm, p, upd->memtype, 0);
     if (rc < 0) {
       fprintf(stderr, "%s: failed to read all of %s memory, rc=%d\n",
               progname, mem->desc, rc);
+      if (stream != NULL)
+        fileio_stream_close(stream, -1);
       return -1;
     }
     report_progress(1,1,NULL);
@@ -253,7 +1242,11 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
             progname,
             strcmp(upd->filename, "-")==0 ? "<stdout>" : upd->filename);
     }
-    rc = fileio(FIO_WRITE, upd->filename, upd->format, p, upd->memtype, size);
+    rc = -2;
+    if (stream != NULL)
+      rc = fileio_stream_close(stream, size);
+    if (rc == -2)
+      rc = fileio(FIO_WRITE, upd->filename, upd->format, p, upd->memtype, size);
     if (rc < 0) {
       fprintf(stderr, "%s: write to file '%s' failed\n",
               progname, upd->filename);
@@ -265,13 +1258,13 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
      * write the selected device memory using data from a file; first
      * read the data from the specified file
      */
-    if (quell_progress < 2) {
+    if (quell_progress < 2 && upd->image == NULL) {
       fprintf(stderr,
             "%s: reading input file \"%s\"\n",
             progname,
             strcmp(upd->filename, "-")==0 ? "<stdin>" : upd->filename);
     }
-    rc = fileio(FIO_READ, upd->filename, upd->format, p, upd->memtype, -1);
+    rc = update_load(p, upd, mem);
     if (rc < 0) {
       fprintf(stderr, "%s: read from file '%s' failed\n",
               progname, upd->filename);
@@ -279,6 +1272,19 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
     }
     size = rc;
 
+    if (flags & UF_UNCHANGED) {
+      /* the fingerprint on the device says it holds the data already */
+      fused_drop(mem);
+      fused_keep(avr_dup_mem(mem), size, "by fingerprint");
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: %s already holds \"%s\" by its fingerprint, "
+                "not written\n", progname, mem->desc, upd->filename);
+      return 0;
+    }
+
+    if ((size = update_delta(pgm, p, upd, mem, size)) < 0)
+      return -1;
+
     /*
      * write the buffer contents to the selected memory type
      */
@@ -287,7 +1293,21 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
             progname, mem->desc, size);
 	  }
 
-    if (!(flags & UF_NOWRITE)) {
+    fused_drop(mem);
+    verified = 0;
+    if (!(flags & UF_NOWRITE) && (flags & UF_VERIFY)) {
+      /* the data as loaded, before the programmer gets to use the buffer */
+      vmem = avr_dup_mem(mem);
+      report_progress(0,1,"Writing");
+      rc = avr_write_verify(pgm, p, upd->memtype, size,
+                            (flags & UF_AUTO_ERASE) != 0, &verified);
+      report_progress(1,1,NULL);
+      if (rc >= 0 && verified > 0)
+        fused_keep(vmem, size, "while writing");
+      else
+        avr_free_mem(vmem);
+    }
+    else if (!(flags & UF_NOWRITE)) {
       report_progress(0,1,"Writing");
       rc = avr_write(pgm, p, upd->memtype, size, (flags & UF_AUTO_ERASE) != 0);
       report_progress(1,1,NULL);
@@ -313,6 +1333,13 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
             vsize, mem->desc);
     }
 
+    if (verified < 0) {
+      fprintf(stderr, "%s: verification error; content mismatch\n",
+              progname);
+      pgm->err_led(pgm, ON);
+      return -1;
+    }
+
   }
   else if (upd->op == DEVICE_VERIFY) {
     /*
@@ -329,27 +1356,52 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
             progname, mem->desc, upd->filename);
     }
 
-    rc = fileio(FIO_READ, upd->filename, upd->format, p, upd->memtype, -1);
+    rc = update_load(p, upd, mem);
     if (rc < 0) {
       fprintf(stderr, "%s: read from file '%s' failed\n",
               progname, upd->filename);
       return -1;
     }
-    v = avr_dup_part(p);
     size = rc;
-    if (quell_progress < 2) {
+    if (quell_progress < 2)
       fprintf(stderr, "%s: input file %s contains %d bytes\n",
             progname, upd->filename, size);
+
+    if ((how = fused_verified(mem, size)) != NULL) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: %d bytes of %s verified %s\n",
+                progname, size, mem->desc, how);
+      pgm->vfy_led(pgm, OFF);
+      return 0;
+    }
+
+    /* a checksum known to match saves reading the memory back */
+    if (memsum_ranges(pgm, p, mem, size) == 0)
+      sumrc = 0;
+    else
+      sumrc = memsum_check(pgm, p, mem, &sum);
+    if (sumrc == 0) {
+      if (quell_progress < 2)
+        fprintf(stderr, "%s: %d bytes of %s verified by device checksum\n",
+                progname, size, mem->desc);
+      pgm->vfy_led(pgm, OFF);
+      return 0;
+    }
+
+    /* only this memory's reference data needs to be kept */
+    vmem = avr_dup_mem(mem);
+    if (quell_progress < 2) {
       fprintf(stderr, "%s: reading on-chip %s data:\n",
             progname, mem->desc);
     }
 
     report_progress (0,1,"Reading");
-    rc = avr_read(pgm, p, upd->memtype, v);
+    rc = avr_read_mem(pgm, p, mem, vmem);
     if (rc < 0) {
       fprintf(stderr, "%s: failed to read all of %s memory, rc=%d\n",
               progname, mem->desc, rc);
       pgm->err_led(pgm, ON);
+      avr_free_mem(vmem);
       return -1;
     }
     report_progress (1,1,NULL);
@@ -359,7 +1411,11 @@ int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd, enum updateflags f
     if (quell_progress < 2) {
       fprintf(stderr, "%s: verifying ...\n", progname);
     }
-    rc = avr_verify(p, v, upd->memtype, size);
+    rc = avr_verify_mem(mem, vmem, size);
+    /* vmem still holds the input file contents the checksum is kept for */
+    if (rc >= 0 && sumrc > 0)
+      memsum_remember(p, vmem, sum);
+    avr_free_mem(vmem);
     if (rc < 0) {
       fprintf(stderr, "%s: verification error; content mismatch\n",
               progname);
@@ -32,14 +32,28 @@ enum updateflags {
   UF_NONE = 0,
   UF_NOWRITE = 1,
   UF_AUTO_ERASE = 2,
+  UF_VERIFY = 4,                /* a verify follows, check while writing */
+  UF_UNCHANGED = 8,             /* the fingerprint says the writes are done */
 };
 
+/* bytes of the fingerprint of -H */
+#define UPDATE_FPLEN 8
+
+
+struct fiodelta;
+
+/* is_delta of an UPDATE whose file has not been looked at yet */
+#define UPDATE_DELTA_UNKNOWN (-2)
 
 typedef struct update_t {
   char * memtype;
   int    op;
   char * filename;
   int    format;
+  struct avrmem * image;        /* input file contents, if preloaded */
+  int    image_size;
+  int    is_delta;              /* fileio_delta_base() of a write, once known */
+  struct fiodelta * delta;      /* the base of the delta, if is_delta is 1 */
 } UPDATE;
 
 #ifdef __cplusplus
@@ -53,6 +67,51 @@ extern UPDATE * new_update(int op, char * memtype, int filefmt,
 extern void free_update(UPDATE * upd);
 extern int do_op(PROGRAMMER * pgm, struct avrpart * p, UPDATE * upd,
 		 enum updateflags flags);
+extern int update_preload(struct avrpart * p, UPDATE * upd);
+extern void update_prefetch(struct avrpart * p, LISTID updates);
+extern void update_prefetch_end(void);
+/*
+ * Whether one chip erase takes less time than erasing every page the
+ * write operations in updates program; reads the input files if they
+ * have not been.
+ */
+extern int update_plan_chip_erase(struct avrpart * p, LISTID updates);
+/*
+ * Merge the writes of one memory that nothing in between depends on
+ * into a single write of all their data, followed by at most one
+ * verify; reads the input files concerned.
+ */
+extern int update_merge_writes(struct avrpart * p, LISTID updates);
+/* whether upd, or one of the writes in updates, is of a delta file */
+extern int update_is_delta(UPDATE * upd);
+extern int update_has_delta(LISTID updates);
+/*
+ * Print how long the operations in updates should take, from the
+ * pages they transfer and the reference statistics of stats_read();
+ * erase is set if a chip erase was asked for.
+ */
+extern int update_estimate(PROGRAMMER * pgm, struct avrpart * p,
+                           LISTID updates, enum updateflags flags,
+                           int erase);
+/*
+ * The fingerprint of the write operations in updates, a hash of what
+ * they write, which is kept in the UPDATE_FPLEN bytes of memory
+ * memtype from addr.  Reads the input files concerned.  Returns 1 with
+ * the fingerprint in fp, 0 if there is no write, or -1 if the location
+ * does not exist or is written by one of the writes.
+ */
+extern int update_fingerprint(struct avrpart * p, LISTID updates,
+                              const char * memtype, unsigned long addr,
+                              unsigned char * fp);
+/*
+ * Have fingerprint fp written after all other writes in updates: along
+ * with the last one if that is of memtype, else by a write of its own
+ * added at the end, which only EEPROM takes.  Returns 0, or -1 if it
+ * cannot be written.
+ */
+extern int update_fingerprint_add(struct avrpart * p, LISTID updates,
+                                  const char * memtype, unsigned long addr,
+                                  const unsigned char * fp);
 
 #ifdef __cplusplus
 }
@@ -46,6 +46,7 @@
 #include "avrdude.h"
 #include "serial.h"
 #include "usbdevs.h"
+#include "usbscan.h"
 
 #if defined(WIN32NATIVE)
 /* someone has defined "interface" to "struct" in Cygwin */
@@ -55,8 +56,50 @@
 static char usbbuf[USBDEV_MAX_XFER_3];
 static int buflen = -1, bufptr;
 
+/* receive buffer for whole frames, see usbdev_recv_frame() */
+static char *framebuf;
+static size_t framebuflen;
+
 static int usb_interface;
 
+/*
+ * Find out whether alternate setting alt is a CMSIS-DAP v2 interface:
+ * vendor class, named "CMSIS-DAP", with a bulk OUT and a bulk IN
+ * endpoint (a second bulk IN one is for SWO trace, which is not
+ * used).  If so, return the endpoint addresses in *rep and *wep.
+ */
+static int usbdev_cmsisdap_bulk(usb_dev_handle *udev,
+                                struct usb_interface_descriptor *alt,
+                                int *rep, int *wep)
+{
+  char name[256];
+  int i, ep;
+
+  if (alt->bInterfaceClass != USB_CLASS_VENDOR_SPEC ||
+      alt->iInterface == 0 ||
+      usb_get_string_simple(udev, alt->iInterface, name, sizeof(name)) < 0 ||
+      strstr(name, "CMSIS-DAP") == NULL)
+    return 0;
+
+  *rep = *wep = 0;
+  for (i = 0; i < alt->bNumEndpoints; i++)
+    {
+      if ((alt->endpoint[i].bmAttributes & USB_ENDPOINT_TYPE_MASK) !=
+	  USB_ENDPOINT_TYPE_BULK)
+	continue;
+      ep = alt->endpoint[i].bEndpointAddress;
+      if ((ep & USB_ENDPOINT_DIR_MASK) != 0)
+	{
+	  if (*rep == 0)
+	    *rep = ep;
+	}
+      else if (*wep == 0)
+	*wep = ep;
+    }
+
+  return *rep != 0 && *wep != 0;
+}
+
 /*
  * The "baud" parameter is meaningless for USB devices, so we reuse it
  * to pass the desired USB device ID.
@@ -65,254 +108,272 @@ static int usbdev_open(char * port, union pinfo pinfo, union filedescriptor *fd)
 {
   char string[256];
   char product[256];
-  struct usb_bus *bus;
   struct usb_device *dev;
   usb_dev_handle *udev;
-  char *serno, *cp2;
+  struct usbscan us;
   int i;
-  int iface;
+  int iface, bulkiface, bulkrep, bulkwep;
   size_t x;
 
   /*
    * The syntax for usb devices is defined as:
    *
    * -P usb[:serialnumber]
+   * -P usb:bus:device
    *
    * See if we've got a serial number passed here.  The serial number
-   * might contain colons which we remove below, and we compare it
+   * might contain colons which are dropped, and we compare it
    * right-to-left, so only the least significant nibbles need to be
-   * specified.
+   * specified.  Two fields are taken as bus and device name first,
+   * and as a serial number only if there is no such device.
    */
-  if ((serno = strchr(port, ':')) != NULL)
+  if (usbscan_port(port, USBSCAN_SERNO | USBSCAN_LOCATION, &us) < 0)
+    return -1;
+  if (strlen(us.serno) > 12 && us.dev[0] != 0)
+    us.serno[0] = 0;            /* cannot be a serial number */
+  else if (strlen(us.serno) > 12)
     {
-      /* first, drop all colons there if any */
-      cp2 = ++serno;
-
-      while ((cp2 = strchr(cp2, ':')) != NULL)
-	{
-	  x = strlen(cp2) - 1;
-	  memmove(cp2, cp2 + 1, x);
-	  cp2[x] = '\0';
-	}
-
-      if (strlen(serno) > 12)
-	{
-	  fprintf(stderr,
-		  "%s: usbdev_open(): invalid serial number \"%s\"\n",
-		  progname, serno);
-	  return -1;
-	}
+      fprintf(stderr,
+	      "%s: usbdev_open(): invalid serial number \"%s\"\n",
+	      progname, us.serno);
+      return -1;
     }
 
   if (fd->usb.max_xfer == 0)
     fd->usb.max_xfer = USBDEV_MAX_XFER_MKII;
 
-  usb_init();
-
-  usb_find_busses();
-  usb_find_devices();
-
-  for (bus = usb_get_busses(); bus; bus = bus->next)
+  for (dev = usbscan_first(&us, pinfo.usbinfo.vid, pinfo.usbinfo.pid);
+       dev != NULL; dev = usbscan_next(&us))
     {
-      for (dev = bus->devices; dev; dev = dev->next)
+      udev = usb_open(dev);
+      if (udev)
 	{
-	  if (dev->descriptor.idVendor == pinfo.usbinfo.vid &&
-	      dev->descriptor.idProduct == pinfo.usbinfo.pid)
+	  /* yeah, we found something */
+	  if (usb_get_string_simple(udev,
+				    dev->descriptor.iSerialNumber,
+				    string, sizeof(string)) < 0)
 	    {
-	      udev = usb_open(dev);
-	      if (udev)
-		{
-		  /* yeah, we found something */
-		  if (usb_get_string_simple(udev,
-					    dev->descriptor.iSerialNumber,
-					    string, sizeof(string)) < 0)
-		    {
-		      fprintf(stderr,
-			      "%s: usb_open(): cannot read serial number \"%s\"\n",
-			      progname, usb_strerror());
-		      /*
-		       * On some systems, libusb appears to have
-		       * problems sending control messages.  Catch the
-		       * benign case where the user did not request a
-		       * particular serial number, so we could
-		       * continue anyway.
-		       */
-		      if (serno != NULL)
-			return -1; /* no chance */
-		      else
-			strcpy(string, "[unknown]");
-		    }
+	      fprintf(stderr,
+		      "%s: usb_open(): cannot read serial number \"%s\"\n",
+		      progname, usb_strerror());
+	      /*
+	       * On some systems, libusb appears to have
+	       * problems sending control messages.  Catch the
+	       * benign case where the user did not request a
+	       * particular serial number, so we could
+	       * continue anyway.
+	       */
+	      if (us.serno[0] != 0)
+		return -1; /* no chance */
+	      else
+		strcpy(string, "[unknown]");
+	    }
 
-		  if (usb_get_string_simple(udev,
-					    dev->descriptor.iProduct,
-					    product, sizeof(product)) < 0)
-		    {
-		      fprintf(stderr,
-			      "%s: usb_open(): cannot read product name \"%s\"\n",
-			      progname, usb_strerror());
-		      strcpy(product, "[unnamed product]");
-		    }
-		  /*
-		   * The CMSIS-DAP specification mandates the string
-		   * "CMSIS-DAP" must be present somewhere in the
-		   * product name string for a device compliant to
-		   * that protocol.  Use this for the decisision
-		   * whether we have to search for a HID interface
-		   * below.
-		   */
-		  if(strstr(product, "CMSIS-DAP") != NULL)
-		  {
-		      pinfo.usbinfo.flags |= PINFO_FL_USEHID;
-		      /* The JTAGICE3 running the CMSIS-DAP firmware doesn't
-		       * use a separate endpoint for event reception. */
-		      fd->usb.eep = 0;
-		  }
-
-		  if (verbose)
+	  if (usb_get_string_simple(udev,
+				    dev->descriptor.iProduct,
+				    product, sizeof(product)) < 0)
+	    {
+	      fprintf(stderr,
+		      "%s: usb_open(): cannot read product name \"%s\"\n",
+		      progname, usb_strerror());
+	      strcpy(product, "[unnamed product]");
+	    }
+	  /*
+	   * The CMSIS-DAP specification mandates the string
+	   * "CMSIS-DAP" must be present somewhere in the
+	   * product name string for a device compliant to
+	   * that protocol.  Use this for the decisision
+	   * whether we have to search for a HID interface
+	   * below.
+	   */
+	  if(strstr(product, "CMSIS-DAP") != NULL)
+	  {
+	      pinfo.usbinfo.flags |= PINFO_FL_USEHID;
+	      /* The JTAGICE3 running the CMSIS-DAP firmware doesn't
+	       * use a separate endpoint for event reception. */
+	      fd->usb.eep = 0;
+	  }
+
+	  if (verbose)
+	    fprintf(stderr,
+		    "%s: usbdev_open(): Found %s, serno: %s\n",
+		    progname, product, string);
+	  if (us.serno[0] != 0)
+	    {
+	      /*
+	       * See if the serial number requested by the
+	       * user matches what we found, matching
+	       * right-to-left.
+	       */
+	      x = strlen(string) - strlen(us.serno);
+	      if (strcasecmp(string + x, us.serno) != 0)
+		{
+		  if (verbose > 2)
 		    fprintf(stderr,
-			    "%s: usbdev_open(): Found %s, serno: %s\n",
-			    progname, product, string);
-		  if (serno != NULL)
-		    {
-		      /*
-		       * See if the serial number requested by the
-		       * user matches what we found, matching
-		       * right-to-left.
-		       */
-		      x = strlen(string) - strlen(serno);
-		      if (strcasecmp(string + x, serno) != 0)
-			{
-			  if (verbose > 2)
-			    fprintf(stderr,
-				    "%s: usbdev_open(): serial number doesn't match\n",
-				    progname);
-			  usb_close(udev);
-			      continue;
-			}
-		    }
+			    "%s: usbdev_open(): serial number doesn't match\n",
+			    progname);
+		  usb_close(udev);
+		      continue;
+		}
+	    }
 
-		  if (dev->config == NULL)
-		    {
-		      fprintf(stderr,
-			      "%s: usbdev_open(): USB device has no configuration\n",
-			      progname);
-		      goto trynext;
-		    }
+	  if (dev->config == NULL)
+	    {
+	      fprintf(stderr,
+		      "%s: usbdev_open(): USB device has no configuration\n",
+		      progname);
+	      goto trynext;
+	    }
 
-		  if (usb_set_configuration(udev, dev->config[0].bConfigurationValue))
-		    {
-		      fprintf(stderr,
-			      "%s: usbdev_open(): WARNING: failed to set configuration %d: %s\n",
-			      progname, dev->config[0].bConfigurationValue,
-			      usb_strerror());
-		      /* let's hope it has already been configured */
-		      // goto trynext;
-		    }
+	  if (usb_set_configuration(udev, dev->config[0].bConfigurationValue))
+	    {
+	      fprintf(stderr,
+		      "%s: usbdev_open(): WARNING: failed to set configuration %d: %s\n",
+		      progname, dev->config[0].bConfigurationValue,
+		      usb_strerror());
+	      /* let's hope it has already been configured */
+	      // goto trynext;
+	    }
 
-		  for (iface = 0; iface < dev->config[0].bNumInterfaces; iface++)
-		    {
-		      usb_interface = dev->config[0].interface[iface].altsetting[0].bInterfaceNumber;
+	  /*
+	   * A CMSIS-DAP v2 device offers the same commands on a bulk
+	   * endpoint pair, too.  Bulk packets need neither be padded to
+	   * the report size nor wait for the interrupt polling interval,
+	   * so that interface is preferred to the HID one.
+	   */
+	  bulkiface = -1;
+	  if (pinfo.usbinfo.flags & PINFO_FL_USEHID)
+	    for (iface = 0; iface < dev->config[0].bNumInterfaces; iface++)
+	      if (usbdev_cmsisdap_bulk(udev,
+				       &dev->config[0].interface[iface].altsetting[0],
+				       &bulkrep, &bulkwep))
+		{
+		  bulkiface = iface;
+		  break;
+		}
+
+	  retry:
+	  for (iface = 0; iface < dev->config[0].bNumInterfaces; iface++)
+	    {
+	      if (bulkiface >= 0 && iface != bulkiface)
+		continue;
+	      usb_interface = dev->config[0].interface[iface].altsetting[0].bInterfaceNumber;
 #ifdef LIBUSB_HAS_GET_DRIVER_NP
-		      /*
-		       * Many Linux systems attach the usbhid driver
-		       * by default to any HID-class device.  On
-		       * those, the driver needs to be detached before
-		       * we can claim the interface.
-		       */
-		      (void)usb_detach_kernel_driver_np(udev, usb_interface);
+	      /*
+	       * Many Linux systems attach the usbhid driver
+	       * by default to any HID-class device.  On
+	       * those, the driver needs to be detached before
+	       * we can claim the interface.
+	       */
+	      (void)usb_detach_kernel_driver_np(udev, usb_interface);
 #endif
-		      if (usb_claim_interface(udev, usb_interface))
-			{
-			  fprintf(stderr,
-				  "%s: usbdev_open(): error claiming interface %d: %s\n",
-				  progname, usb_interface, usb_strerror());
-			}
-		      else
-			{
-			  if (pinfo.usbinfo.flags & PINFO_FL_USEHID)
-			    {
-			      /* only consider an interface that is of class HID */
-			      if (dev->config[0].interface[iface].altsetting[0].bInterfaceClass !=
-				  USB_CLASS_HID)
-				continue;
-			      fd->usb.use_interrupt_xfer = 1;
-			    }
-			  break;
-			}
+	      if (usb_claim_interface(udev, usb_interface))
+		{
+		  fprintf(stderr,
+			  "%s: usbdev_open(): error claiming interface %d: %s\n",
+			  progname, usb_interface, usb_strerror());
+		}
+	      else
+		{
+		  if (bulkiface >= 0)
+		    {
+		      if (verbose > 1)
+			fprintf(stderr,
+				"%s: usbdev_open(): using CMSIS-DAP bulk interface %d\n",
+				progname, usb_interface);
+		      fd->usb.rep = bulkrep;
+		      fd->usb.wep = bulkwep;
+		      fd->usb.use_interrupt_xfer = 0;
 		    }
-		  if (iface == dev->config[0].bNumInterfaces)
+		  else if (pinfo.usbinfo.flags & PINFO_FL_USEHID)
 		    {
-		      fprintf(stderr,
-			      "%s: usbdev_open(): no usable interface found\n",
-			      progname);
-		      goto trynext;
+		      /* only consider an interface that is of class HID */
+		      if (dev->config[0].interface[iface].altsetting[0].bInterfaceClass !=
+			  USB_CLASS_HID)
+			continue;
+		      fd->usb.use_interrupt_xfer = 1;
 		    }
+		  break;
+		}
+	    }
+	  if (iface == dev->config[0].bNumInterfaces && bulkiface >= 0)
+	    {
+	      /* could not claim the bulk interface, try HID instead */
+	      bulkiface = -1;
+	      goto retry;
+	    }
+	  if (iface == dev->config[0].bNumInterfaces)
+	    {
+	      fprintf(stderr,
+		      "%s: usbdev_open(): no usable interface found\n",
+		      progname);
+	      goto trynext;
+	    }
 
-		  fd->usb.handle = udev;
-		  if (fd->usb.rep == 0)
+	  fd->usb.handle = udev;
+	  if (fd->usb.rep == 0)
+	    {
+	      /* Try finding out what our read endpoint is. */
+	      for (i = 0; i < dev->config[0].interface[iface].altsetting[0].bNumEndpoints; i++)
+		{
+		  int possible_ep = dev->config[0].interface[iface].altsetting[0].
+		  endpoint[i].bEndpointAddress;
+
+		  if ((possible_ep & USB_ENDPOINT_DIR_MASK) != 0)
 		    {
-		      /* Try finding out what our read endpoint is. */
-		      for (i = 0; i < dev->config[0].interface[iface].altsetting[0].bNumEndpoints; i++)
-			{
-			  int possible_ep = dev->config[0].interface[iface].altsetting[0].
-			  endpoint[i].bEndpointAddress;
-
-			  if ((possible_ep & USB_ENDPOINT_DIR_MASK) != 0)
-			    {
-			      if (verbose > 1)
-				{
-				  fprintf(stderr,
-					  "%s: usbdev_open(): using read endpoint 0x%02x\n",
-					  progname, possible_ep);
-				}
-			      fd->usb.rep = possible_ep;
-			      break;
-			    }
-			}
-		      if (fd->usb.rep == 0)
+		      if (verbose > 1)
 			{
 			  fprintf(stderr,
-				  "%s: usbdev_open(): cannot find a read endpoint, using 0x%02x\n",
-				  progname, USBDEV_BULK_EP_READ_MKII);
-			  fd->usb.rep = USBDEV_BULK_EP_READ_MKII;
+				  "%s: usbdev_open(): using read endpoint 0x%02x\n",
+				  progname, possible_ep);
 			}
+		      fd->usb.rep = possible_ep;
+		      break;
 		    }
-		  for (i = 0; i < dev->config[0].interface[iface].altsetting[0].bNumEndpoints; i++)
-		    {
-		      if ((dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress == fd->usb.rep ||
-			   dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress == fd->usb.wep) &&
-			  dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize < fd->usb.max_xfer)
-			{
-			  if (verbose != 0)
-			    fprintf(stderr,
-				    "%s: max packet size expected %d, but found %d due to EP 0x%02x's wMaxPacketSize\n",
-				    progname,
-				    fd->usb.max_xfer,
-				    dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize,
-				    dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress);
-			  fd->usb.max_xfer = dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize;
-			}
-		    }
-		  if (pinfo.usbinfo.flags & PINFO_FL_USEHID)
-		    {
-		      if (usb_control_msg(udev, 0x21, 0x0a /* SET_IDLE */, 0, 0, NULL, 0, 100) < 0)
-			fprintf(stderr, "%s: usbdev_open(): SET_IDLE failed\n", progname);
-		    }
-		  return 0;
-		  trynext:
-		  usb_close(udev);
 		}
-	      else
-		fprintf(stderr,
-			"%s: usbdev_open(): cannot open device: %s\n",
-			progname, usb_strerror());
+	      if (fd->usb.rep == 0)
+		{
+		  fprintf(stderr,
+			  "%s: usbdev_open(): cannot find a read endpoint, using 0x%02x\n",
+			  progname, USBDEV_BULK_EP_READ_MKII);
+		  fd->usb.rep = USBDEV_BULK_EP_READ_MKII;
+		}
+	    }
+	  for (i = 0; i < dev->config[0].interface[iface].altsetting[0].bNumEndpoints; i++)
+	    {
+	      if ((dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress == fd->usb.rep ||
+		   dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress == fd->usb.wep) &&
+		  dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize < fd->usb.max_xfer)
+		{
+		  if (verbose != 0)
+		    fprintf(stderr,
+			    "%s: max packet size expected %d, but found %d due to EP 0x%02x's wMaxPacketSize\n",
+			    progname,
+			    fd->usb.max_xfer,
+			    dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize,
+			    dev->config[0].interface[iface].altsetting[0].endpoint[i].bEndpointAddress);
+		  fd->usb.max_xfer = dev->config[0].interface[iface].altsetting[0].endpoint[i].wMaxPacketSize;
+		}
+	    }
+	  if (fd->usb.use_interrupt_xfer)
+	    {
+	      if (usb_control_msg(udev, 0x21, 0x0a /* SET_IDLE */, 0, 0, NULL, 0, 100) < 0)
+		fprintf(stderr, "%s: usbdev_open(): SET_IDLE failed\n", progname);
 	    }
+	  usbscan_found(&us, dev);
+	  return 0;
+	  trynext:
+	  usb_close(udev);
 	}
+      else
+	fprintf(stderr,
+		"%s: usbdev_open(): cannot open device: %s\n",
+		progname, usb_strerror());
     }
 
   if ((pinfo.usbinfo.flags & PINFO_FL_SILENT) == 0 || verbose > 0)
       fprintf(stderr, "%s: usbdev_open(): did not find any%s USB device \"%s\" (0x%04x:0x%04x)\n",
-	      progname, serno? " (matching)": "", port,
+	      progname, us.serno[0]? " (matching)": "", port,
 	      (unsigned)pinfo.usbinfo.vid, (unsigned)pinfo.usbinfo.pid);
   return -1;
 }
@@ -361,8 +422,17 @@ static int usbdev_send(union filedescriptor *fd, unsigned char *bp, size_t mlen)
     tx_size = (mlen < fd->usb.max_xfer)? mlen: fd->usb.max_xfer;
     if (fd->usb.use_interrupt_xfer)
       rv = usb_interrupt_write(udev, fd->usb.wep, (char *)bp, tx_size, 10000);
-    else
+    else {
+      /*
+       * A bulk request may span many packets; the host controller
+       * then sends them back to back, without a round trip through
+       * the library for each packet.  Only the final short (or zero
+       * length) packet is left for the next request.
+       */
+      if (mlen >= fd->usb.max_xfer)
+        tx_size = mlen - mlen % fd->usb.max_xfer;
       rv = usb_bulk_write(udev, fd->usb.wep, (char *)bp, tx_size, 10000);
+    }
     if (rv != tx_size)
     {
         fprintf(stderr, "%s: usbdev_send(): wrote %d out of %d bytes, err = %s\n",
@@ -371,7 +441,7 @@ static int usbdev_send(union filedescriptor *fd, unsigned char *bp, size_t mlen)
     }
     bp += tx_size;
     mlen -= tx_size;
-  } while (tx_size == fd->usb.max_xfer);
+  } while (tx_size > 0 && tx_size % fd->usb.max_xfer == 0);
 
   if (verbose > 3)
   {
@@ -395,6 +465,16 @@ static int usbdev_send(union filedescriptor *fd, unsigned char *bp, size_t mlen)
   return 0;
 }
 
+/*
+ * A message has to go out in one piece, as its end is marked by a
+ * short USB packet.
+ */
+static int usbdev_sendv(union filedescriptor *fd,
+                        const struct serial_iov *iov, int iovcnt)
+{
+  return serial_sendv_gather(fd, iov, iovcnt, usbdev_send);
+}
+
 /*
  * As calls to usb_bulk_read() result in exactly one USB request, we
  * have to buffer the read results ourselves, so the single-char read
@@ -485,7 +565,8 @@ static int usbdev_recv(union filedescriptor *fd, unsigned char *buf, size_t nbyt
 static int usbdev_recv_frame(union filedescriptor *fd, unsigned char *buf, size_t nbytes)
 {
   usb_dev_handle *udev = (usb_dev_handle *)fd->usb.handle;
-  int rv, n;
+  int rv, n, rx_size;
+  long left;
   int i;
   unsigned char * p = buf;
 
@@ -511,15 +592,37 @@ static int usbdev_recv_frame(union filedescriptor *fd, unsigned char *buf, size_
       }
   }
 
+  /*
+   * A frame ends with a short packet, so a bulk request for all of
+   * the buffer (rounded up to whole packets) cannot stall, and gets
+   * the entire frame with one request instead of one per packet.
+   */
   n = 0;
+  left = nbytes;
   do
     {
+      if (fd->usb.use_interrupt_xfer || left <= fd->usb.max_xfer)
+	rx_size = fd->usb.max_xfer;
+      else
+	rx_size = (left + fd->usb.max_xfer - 1) / fd->usb.max_xfer *
+	  fd->usb.max_xfer;
+      if (rx_size > framebuflen)
+	{
+	  if ((framebuf = realloc(framebuf, rx_size)) == NULL)
+	    {
+	      fprintf(stderr, "%s: usbdev_recv_frame(): out of memory\n",
+		      progname);
+	      exit(1);
+	    }
+	  framebuflen = rx_size;
+	}
+
       if (fd->usb.use_interrupt_xfer)
-	rv = usb_interrupt_read(udev, fd->usb.rep, usbbuf,
-				fd->usb.max_xfer, 10000);
+	rv = usb_interrupt_read(udev, fd->usb.rep, framebuf,
+				rx_size, 10000);
       else
-	rv = usb_bulk_read(udev, fd->usb.rep, usbbuf,
-			   fd->usb.max_xfer, 10000);
+	rv = usb_bulk_read(udev, fd->usb.rep, framebuf,
+			   rx_size, 10000);
       if (rv < 0)
 	{
 	  if (verbose > 1)
@@ -529,18 +632,18 @@ static int usbdev_recv_frame(union filedescriptor *fd, unsigned char *buf, size_
 	  return -1;
 	}
 
-      if (rv <= nbytes)
+      if (rv <= left)
 	{
-	  memcpy (buf, usbbuf, rv);
+	  memcpy (buf, framebuf, rv);
 	  buf += rv;
 	}
 
       n += rv;
-      nbytes -= rv;
+      left -= rv;
     }
-  while (nbytes > 0 && rv == fd->usb.max_xfer);
+  while (left > 0 && rv == rx_size);
 
-  if (nbytes < 0)
+  if (left < 0)
     return -1;
 
   printout:
@@ -596,6 +699,7 @@ struct serial_device usb_serdev =
   .open = usbdev_open,
   .close = usbdev_close,
   .send = usbdev_send,
+  .sendv = usbdev_sendv,
   .recv = usbdev_recv,
   .drain = usbdev_drain,
   .flags = SERDEV_FL_NONE,
@@ -609,6 +713,7 @@ struct serial_device usb_serdev_frame =
   .open = usbdev_open,
   .close = usbdev_close,
   .send = usbdev_send,
+  .sendv = usbdev_sendv,
   .recv = usbdev_recv_frame,
   .drain = usbdev_drain,
   .flags = SERDEV_FL_NONE,
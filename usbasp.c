@@ -39,6 +39,7 @@
 #include "pgm.h"
 #include "usbasp.h"
 #include "usbdevs.h"
+#include "usbscan.h"
 
 #if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
 
@@ -120,6 +121,8 @@ struct pdata
   int sckfreq_hz;
   unsigned int capabilities;
   int use_tpi;
+  int addr_valid;		/* prog_address of the firmware is known */
+  unsigned int next_address;	/* ... and is this one */
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -136,9 +139,9 @@ static int usbasp_transmit(PROGRAMMER * pgm, unsigned char receive,
 			   unsigned char functionid, const unsigned char *send,
 			   unsigned char *buffer, int buffersize);
 #ifdef USE_LIBUSB_1_0
-static int usbOpenDevice(libusb_device_handle **device, int vendor, char *vendorName, int product, char *productName);
+static int usbOpenDevice(libusb_device_handle **device, struct usbscan *us, int vendor, char *vendorName, int product, char *productName);
 #else
-static int usbOpenDevice(usb_dev_handle **device, int vendor, char *vendorName, int product, char *productName);
+static int usbOpenDevice(usb_dev_handle **device, struct usbscan *us, int vendor, char *vendorName, int product, char *productName);
 #endif
 // interface - prog.
 static int usbasp_open(PROGRAMMER * pgm, char * port);
@@ -270,6 +273,23 @@ static int usbasp_transmit(PROGRAMMER * pgm,
   }
 #endif
 
+  /*
+   * Only the block transfers move the address pointer of a newmode
+   * firmware along, anything else (like CONNECT) may reset it.
+   */
+  switch (functionid) {
+  case USBASP_FUNC_TRANSMIT:
+  case USBASP_FUNC_SETLONGADDRESS:
+  case USBASP_FUNC_READFLASH:
+  case USBASP_FUNC_READEEPROM:
+  case USBASP_FUNC_WRITEFLASH:
+  case USBASP_FUNC_WRITEEEPROM:
+    break;
+  default:
+    PDATA(pgm)->addr_valid = 0;
+    break;
+  }
+
   if (verbose > 3 && receive && nbytes > 0) {
     int i;
     fprintf(stderr, "%s<= ", progbuf);
@@ -289,8 +309,9 @@ static int usbasp_transmit(PROGRAMMER * pgm,
  * shared VID/PID
  */
 #ifdef USE_LIBUSB_1_0
-static int usbOpenDevice(libusb_device_handle **device, int vendor,
-			 char *vendorName, int product, char *productName)
+static int usbOpenDevice(libusb_device_handle **device, struct usbscan *us,
+			 int vendor, char *vendorName, int product,
+			 char *productName)
 {
     libusb_device_handle *handle = NULL;
     int                  errorCode = USB_ERROR_NOTFOUND;
@@ -309,8 +330,12 @@ static int usbOpenDevice(libusb_device_handle **device, int vendor,
     for (j=0; j<dev_list_len; ++j) {
         libusb_device *dev = dev_list[j];
         struct libusb_device_descriptor descriptor;
+        char bus[8], addr[8];
 	libusb_get_device_descriptor(dev, &descriptor);
-	if (descriptor.idVendor == vendor && descriptor.idProduct == product) {
+	snprintf(bus, sizeof(bus), "%d", libusb_get_bus_number(dev));
+	snprintf(addr, sizeof(addr), "%d", libusb_get_device_address(dev));
+	if (descriptor.idVendor == vendor && descriptor.idProduct == product &&
+	    usbscan_at(us, bus, addr)) {
             char    string[256];
 	    /* we need to open the device in order to query strings */
             r = libusb_open(dev, &handle);
@@ -371,82 +396,68 @@ static int usbOpenDevice(libusb_device_handle **device, int vendor,
     return errorCode;
 }
 #else
-static int usbOpenDevice(usb_dev_handle **device, int vendor,
-			 char *vendorName, int product, char *productName)
+static int usbOpenDevice(usb_dev_handle **device, struct usbscan *us,
+			 int vendor, char *vendorName, int product,
+			 char *productName)
 {
-struct usb_bus       *bus;
 struct usb_device    *dev;
 usb_dev_handle       *handle = NULL;
 int                  errorCode = USB_ERROR_NOTFOUND;
-static int           didUsbInit = 0;
 
-    if(!didUsbInit){
-        didUsbInit = 1;
-        usb_init();
-    }
-    usb_find_busses();
-    usb_find_devices();
-    for(bus=usb_get_busses(); bus; bus=bus->next){
-        for(dev=bus->devices; dev; dev=dev->next){
-            if(dev->descriptor.idVendor == vendor &&
-	       dev->descriptor.idProduct == product){
-                char    string[256];
-                int     len;
-		/* we need to open the device in order to query strings */
-                handle = usb_open(dev);
-                if(!handle){
-                    errorCode = USB_ERROR_ACCESS;
-                    fprintf(stderr,
-			    "%s: Warning: cannot open USB device: %s\n",
-			    progname, usb_strerror());
-                    continue;
-                }
-                errorCode = 0;
-                /* now check whether the names match: */
-                /* if vendorName not given ignore it (any vendor matches) */
-                len = usb_get_string_simple(handle, dev->descriptor.iManufacturer,
-					    string, sizeof(string));
-                if(len < 0){
-                    if ((vendorName != NULL) && (vendorName[0] != 0)) {
-                    errorCode = USB_ERROR_IO;
-                    fprintf(stderr,
-			    "%s: Warning: cannot query manufacturer for device: %s\n",
-			    progname, usb_strerror());
-		    }
-                } else {
-		    if (verbose > 1)
-		        fprintf(stderr,
-				"%s: seen device from vendor ->%s<-\n",
-				progname, string);
-                    if((vendorName != NULL) && (vendorName[0] != 0) && (strcmp(string, vendorName) != 0))
-                        errorCode = USB_ERROR_NOTFOUND;
-                }
-                /* if productName not given ignore it (any product matches) */
-                len = usb_get_string_simple(handle, dev->descriptor.iProduct,
-					    string, sizeof(string));
-                if(len < 0){
-                    if ((productName != NULL) && (productName[0] != 0)) {
-                        errorCode = USB_ERROR_IO;
-                        fprintf(stderr,
-			        "%s: Warning: cannot query product for device: %s\n",
-			        progname, usb_strerror());
-		    }
-                } else {
-		    if (verbose > 1)
-			fprintf(stderr,
-				"%s: seen product ->%s<-\n",
-				progname, string);
-                    if((productName != NULL) && (productName[0] != 0) && (strcmp(string, productName) != 0))
-                        errorCode = USB_ERROR_NOTFOUND;
-                }
-                if (errorCode == 0)
-                    break;
-                usb_close(handle);
-                handle = NULL;
-            }
+    for(dev=usbscan_first(us, vendor, product); dev; dev=usbscan_next(us)){
+        char    string[256];
+        int     len;
+	/* we need to open the device in order to query strings */
+        handle = usb_open(dev);
+        if(!handle){
+            errorCode = USB_ERROR_ACCESS;
+            fprintf(stderr,
+		    "%s: Warning: cannot open USB device: %s\n",
+		    progname, usb_strerror());
+            continue;
+        }
+        errorCode = 0;
+        /* now check whether the names match: */
+        /* if vendorName not given ignore it (any vendor matches) */
+        len = usb_get_string_simple(handle, dev->descriptor.iManufacturer,
+				    string, sizeof(string));
+        if(len < 0){
+            if ((vendorName != NULL) && (vendorName[0] != 0)) {
+            errorCode = USB_ERROR_IO;
+            fprintf(stderr,
+		    "%s: Warning: cannot query manufacturer for device: %s\n",
+		    progname, usb_strerror());
+	    }
+        } else {
+	    if (verbose > 1)
+		fprintf(stderr,
+			"%s: seen device from vendor ->%s<-\n",
+			progname, string);
+            if((vendorName != NULL) && (vendorName[0] != 0) && (strcmp(string, vendorName) != 0))
+                errorCode = USB_ERROR_NOTFOUND;
+        }
+        /* if productName not given ignore it (any product matches) */
+        len = usb_get_string_simple(handle, dev->descriptor.iProduct,
+				    string, sizeof(string));
+        if(len < 0){
+            if ((productName != NULL) && (productName[0] != 0)) {
+                errorCode = USB_ERROR_IO;
+                fprintf(stderr,
+			"%s: Warning: cannot query product for device: %s\n",
+			progname, usb_strerror());
+	    }
+        } else {
+	    if (verbose > 1)
+		fprintf(stderr,
+			"%s: seen product ->%s<-\n",
+			progname, string);
+            if((productName != NULL) && (productName[0] != 0) && (strcmp(string, productName) != 0))
+                errorCode = USB_ERROR_NOTFOUND;
         }
-        if(handle)
+        if (errorCode == 0)
             break;
+        usb_close(handle);
+        handle = NULL;
     }
     if(handle != NULL){
         errorCode = 0;
@@ -466,7 +477,10 @@ static int usbasp_open(PROGRAMMER * pgm, char * port)
 
   /* usb_init will be done in usbOpenDevice */
   LNODEID usbpid = lfirst(pgm->usbpid);
+  struct usbscan us;
   int pid, vid;
+  if (usbscan_port(port, USBSCAN_LOCATION, &us) < 0)
+    return -1;
   if (usbpid) {
     pid = *(int *)(ldata(usbpid));
     if (lnext(usbpid))
@@ -477,7 +491,7 @@ static int usbasp_open(PROGRAMMER * pgm, char * port)
     pid = USBASP_SHARED_PID;
   }
   vid = pgm->usbvid? pgm->usbvid: USBASP_SHARED_VID;
-  if (usbOpenDevice(&PDATA(pgm)->usbhandle, vid, pgm->usbvendor, pid, pgm->usbproduct) != 0) {
+  if (usbOpenDevice(&PDATA(pgm)->usbhandle, &us, vid, pgm->usbvendor, pid, pgm->usbproduct) != 0) {
     /* try alternatives */
     if(strcasecmp(ldata(lfirst(pgm->id)), "usbasp") == 0) {
     /* for id usbasp autodetect some variants */
@@ -486,7 +500,7 @@ static int usbasp_open(PROGRAMMER * pgm, char * port)
 	        "%s: warning: Using \"-C usbasp -P nibobee\" is deprecated,"
 	        "use \"-C nibobee\" instead.\n",
 	        progname);
-        if (usbOpenDevice(&PDATA(pgm)->usbhandle, USBASP_NIBOBEE_VID, "www.nicai-systems.com",
+        if (usbOpenDevice(&PDATA(pgm)->usbhandle, &us, USBASP_NIBOBEE_VID, "www.nicai-systems.com",
 		        USBASP_NIBOBEE_PID, "NIBObee") != 0) {
           fprintf(stderr,
 	          "%s: error: could not find USB device "
@@ -497,7 +511,7 @@ static int usbasp_open(PROGRAMMER * pgm, char * port)
         return 0;
       }
       /* check if device with old VID/PID is available */
-      if (usbOpenDevice(&PDATA(pgm)->usbhandle, USBASP_OLD_VID, "www.fischl.de",
+      if (usbOpenDevice(&PDATA(pgm)->usbhandle, &us, USBASP_OLD_VID, "www.fischl.de",
 		             USBASP_OLD_PID, "USBasp") == 0) {
         /* found USBasp with old IDs */
         fprintf(stderr,
@@ -718,12 +732,40 @@ static int usbasp_spi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 
   avr_set_bits(p->op[AVR_OP_CHIP_ERASE], cmd);
   pgm->cmd(pgm, cmd, res);
-  usleep(p->chip_erase_delay);
+  avr_wait_ready(pgm, p, p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   return 0;
 }
 
+/*
+ * Tell a newmode firmware where the next block starts.  The firmware
+ * advances its address with every byte transferred, so when blocks
+ * follow each other (the usual case) there is no need to spend a
+ * control request on it.
+ */
+static void usbasp_spi_set_address(PROGRAMMER * pgm, unsigned int address)
+{
+  unsigned char cmd[4];
+  unsigned char temp[4];
+  IMPORT_PDATA(pgm);
+
+  if (pdata->addr_valid && pdata->next_address == address)
+    return;
+
+  memset(temp, 0, sizeof(temp));
+  cmd[0] = address & 0xFF;
+  cmd[1] = address >> 8;
+  cmd[2] = address >> 16;
+  cmd[3] = address >> 24;
+  if (usbasp_transmit(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp)) < 0) {
+    pdata->addr_valid = 0;
+    return;
+  }
+  pdata->addr_valid = 1;
+  pdata->next_address = address;
+}
+
 static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                  unsigned int page_size,
                                  unsigned int address, unsigned int n_bytes)
@@ -762,13 +804,7 @@ static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     wbytes -= blocksize;
 
     /* set address (new mode) - if firmware on usbasp support newmode, then they use address from this command */
-    unsigned char temp[4];
-    memset(temp, 0, sizeof(temp));
-    cmd[0] = address & 0xFF;
-    cmd[1] = address >> 8;
-    cmd[2] = address >> 16;
-    cmd[3] = address >> 24;
-    usbasp_transmit(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp));
+    usbasp_spi_set_address(pgm, address);
 
     /* send command with address (compatibility mode) - if firmware on
 	  usbasp doesn't support newmode, then they use address from this */
@@ -783,11 +819,13 @@ static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     if (n != blocksize) {
       fprintf(stderr, "%s: error: wrong reading bytes %x\n",
 	      progname, n);
+      PDATA(pgm)->addr_valid = 0;
       return -3;
     }
 
     buffer += blocksize;
     address += blocksize;
+    PDATA(pgm)->next_address = address;
   }
 
   return n_bytes;
@@ -836,13 +874,7 @@ static int usbasp_spi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
     /* set address (new mode) - if firmware on usbasp support newmode, then
       they use address from this command */
-    unsigned char temp[4];
-    memset(temp, 0, sizeof(temp));
-    cmd[0] = address & 0xFF;
-    cmd[1] = address >> 8;
-    cmd[2] = address >> 16;
-    cmd[3] = address >> 24;
-    usbasp_transmit(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp));
+    usbasp_spi_set_address(pgm, address);
 
     /* normal command - firmware what support newmode - use address from previous command,
       firmware what doesn't support newmode - ignore previous command and use address from this command */
@@ -858,12 +890,14 @@ static int usbasp_spi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     if (n != blocksize) {
       fprintf(stderr, "%s: error: wrong count at writing %x\n",
 	      progname, n);
+      PDATA(pgm)->addr_valid = 0;
       return -3;        
     }
 
 
     buffer += blocksize;
     address += blocksize;
+    PDATA(pgm)->next_address = address;
   }
 
   return n_bytes;
@@ -1072,9 +1106,9 @@ static int usbasp_tpi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   /* dummy write */
   usbasp_tpi_send_byte(pgm, TPI_OP_SST_INC);
   usbasp_tpi_send_byte(pgm, 0x00);
-  usbasp_tpi_nvm_waitbusy(pgm);
-  
-  usleep(p->chip_erase_delay);
+  /* NVMBSY says when it is done, the delay is only needed if not */
+  if (usbasp_tpi_nvm_waitbusy(pgm) < 0)
+    usleep(p->chip_erase_delay);
   pgm->initialize(pgm, p);
 
   return 0;
@@ -1101,8 +1135,8 @@ static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   while(readed < n_bytes)
   {
     clen = n_bytes - readed;
-    if(clen > 32)
-      clen = 32;
+    if(clen > USBASP_READBLOCKSIZE)
+      clen = USBASP_READBLOCKSIZE;
 
     /* prepare READBLOCK cmd */
     cmd[0] = pr & 0xFF;
@@ -1142,17 +1176,15 @@ static int usbasp_tpi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   pr = addr + m->offset;
   writed = 0;
 
-  /* Set PR to flash */
-  usbasp_tpi_send_byte(pgm, TPI_OP_SSTPR(0));
-  usbasp_tpi_send_byte(pgm, (pr & 0xFF) | 1 );
-  usbasp_tpi_send_byte(pgm, TPI_OP_SSTPR(1));
-  usbasp_tpi_send_byte(pgm, (pr >> 8) );
-
+  /*
+   * WRITEBLOCK sets PR from cmd[] and waits for NVMBSY after each
+   * word in the firmware, so a page is a single control transfer.
+   */
   while(writed < n_bytes)
   {
     clen = n_bytes - writed;
-    if(clen > 32)
-      clen = 32;
+    if(clen > USBASP_WRITEBLOCKSIZE)
+      clen = USBASP_WRITEBLOCKSIZE;
 
     /* prepare WRITEBLOCK cmd */
     cmd[0] = pr & 0xFF;
@@ -0,0 +1,309 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Finding USB devices by vendor and product ID, location or serial
+ * number, shared by the libusb based programmers.
+ *
+ * Reading a serial number means opening the device and asking it for
+ * a string descriptor, which is what makes looking through many
+ * devices slow.  So devices are filtered by their IDs first, and the
+ * bus and device name a serial number was last found at are kept in
+ * a small cache file, to try that device before all others.  Entries
+ * are only ever a hint: the caller still checks the serial number.
+ */
+
+#include "ac_cfg.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(HAVE_LIBUSB)
+#if defined(HAVE_USB_H)
+#  include <usb.h>
+#elif defined(HAVE_LUSB0_USB_H)
+#  include <lusb0_usb.h>
+#else
+#  error "libusb needs either <usb.h> or <lusb0_usb.h>"
+#endif
+#endif
+
+#include "avrdude.h"
+#include "cachefile.h"
+#include "usbscan.h"
+
+static char usbscan_file[PATH_MAX];
+
+
+int usbscan_port(const char * port, int what, struct usbscan * us)
+{
+  const char * s, * c;
+  char * d;
+  size_t n;
+
+  memset(us, 0, sizeof(*us));
+  if (strncmp(port, "usb", 3) != 0 || port[3] != ':')
+    return 0;
+  s = port + 4;
+
+  c = strchr(s, ':');
+  if ((what & USBSCAN_LOCATION) &&
+      (c == NULL? !(what & USBSCAN_SERNO): strchr(c + 1, ':') == NULL)) {
+    n = c == NULL? strlen(s): (size_t)(c - s);
+    if (n >= sizeof(us->bus) || (c != NULL && strlen(c + 1) >= sizeof(us->dev))) {
+      fprintf(stderr, "%s: invalid USB location in \"%s\"\n", progname, port);
+      return -1;
+    }
+    memcpy(us->bus, s, n);
+    if (c != NULL)
+      strcpy(us->dev, c + 1);
+    if (!(what & USBSCAN_SERNO))
+      return 0;
+  }
+  if (!(what & USBSCAN_SERNO)) {
+    fprintf(stderr, "%s: invalid USB location in \"%s\", use usb:bus:device\n",
+            progname, port);
+    return -1;
+  }
+
+  /* a serial number, with all colons dropped */
+  for (d = us->serno; *s != 0; s++) {
+    if (*s == ':')
+      continue;
+    if (d == us->serno + sizeof(us->serno) - 1) {
+      fprintf(stderr, "%s: invalid serial number in \"%s\"\n", progname, port);
+      return -1;
+    }
+    *d++ = *s;
+  }
+  *d = 0;
+  /* usb:<bus>:<device> needs both; usb:<serial> has no location */
+  if (us->dev[0] == 0)
+    us->bus[0] = 0;
+
+  return 0;
+}
+
+/*
+ * Bus and device names are compared as numbers where both are, so
+ * "usb:1:4" finds bus "001", device "004".
+ */
+static int usbscan_name_eq(const char * a, const char * b)
+{
+  const char * s;
+
+  for (s = a; isdigit((int)*s); s++)
+    ;
+  if (*a != 0 && *s == 0) {
+    for (s = b; isdigit((int)*s); s++)
+      ;
+    if (*b != 0 && *s == 0)
+      return strtol(a, NULL, 10) == strtol(b, NULL, 10);
+  }
+
+  return strcmp(a, b) == 0;
+}
+
+int usbscan_at(const struct usbscan * us, const char * bus, const char * dev)
+{
+  if (us->bus[0] != 0 && !usbscan_name_eq(us->bus, bus))
+    return 0;
+  if (us->dev[0] != 0 && !usbscan_name_eq(us->dev, dev))
+    return 0;
+
+  return 1;
+}
+
+void usbscan_cache(const char * file)
+{
+  snprintf(usbscan_file, sizeof(usbscan_file), "%s", file);
+}
+
+#if defined(HAVE_LIBUSB)
+
+/*
+ * The cache file holds "<vid> <pid> <serial number> <bus> <device>"
+ * lines.
+ */
+static void usbscan_key(const struct usbscan * us, char * key, size_t len)
+{
+  if (snprintf(key, len, "%04x %04x %s", us->vid, us->pid, us->serno) >= len)
+    key[0] = 0;
+}
+
+static int usbscan_lookup(const struct usbscan * us, char * bus, char * dev)
+{
+  char key[USBSCAN_SERNOLEN + 16], value[2 * USBSCAN_NAMELEN + 2],
+    b[USBSCAN_NAMELEN], d[USBSCAN_NAMELEN];
+
+  usbscan_key(us, key, sizeof(key));
+  if (cachefile_lookup(usbscan_file, key, value, sizeof(value)) < 0 ||
+      sscanf(value, "%31s %31s", b, d) != 2)
+    return -1;
+  strcpy(bus, b);
+  strcpy(dev, d);
+
+  return 0;
+}
+
+static void usbscan_remember(const struct usbscan * us, const char * bus,
+                             const char * dev)
+{
+  char key[USBSCAN_SERNOLEN + 16], value[2 * USBSCAN_NAMELEN + 2];
+
+  usbscan_key(us, key, sizeof(key));
+  snprintf(value, sizeof(value), "%s %s", bus, dev);
+  cachefile_remember(usbscan_file, key, value, "USB device cache");
+}
+
+static int usbscan_ids(const struct usbscan * us, struct usb_device * dev)
+{
+  return (us->vid == 0 || dev->descriptor.idVendor == us->vid) &&
+    (us->pid == 0 || dev->descriptor.idProduct == us->pid);
+}
+
+static struct usb_device * usbscan_walk(struct usbscan * us)
+{
+  while (us->ubus != NULL) {
+    us->udev = us->udev == NULL? us->ubus->devices: us->udev->next;
+    if (us->udev == NULL) {
+      us->ubus = us->ubus->next;
+      continue;
+    }
+    if (us->udev != us->first && usbscan_ids(us, us->udev) &&
+        usbscan_at(us, us->ubus->dirname, us->udev->filename))
+      return us->udev;
+  }
+
+  return NULL;
+}
+
+static int usbscan_scanned;
+
+static void usbscan_scan(void)
+{
+  if (!usbscan_scanned)
+    usb_init();
+  usb_find_busses();
+  usb_find_devices();
+  usbscan_scanned = 1;
+}
+
+struct usb_device * usbscan_first(struct usbscan * us, int vid, int pid)
+{
+  char bus[USBSCAN_NAMELEN], dev[USBSCAN_NAMELEN];
+  struct usb_bus * b;
+  struct usb_device * d;
+
+  if (!usbscan_scanned)
+    usbscan_scan();
+
+  us->vid = vid;
+  us->pid = pid;
+  us->first = NULL;
+  us->ubus = usb_get_busses();
+  us->udev = NULL;
+
+  if (us->bus[0] != 0 && us->serno[0] != 0) {
+    /* bus:device, or a serial number if there is no such device */
+    if ((d = usbscan_walk(us)) != NULL) {
+      us->serno[0] = 0;
+      return d;
+    }
+    us->bus[0] = us->dev[0] = 0;
+    us->ubus = usb_get_busses();
+    us->udev = NULL;
+  }
+
+  if (us->serno[0] != 0 && usbscan_lookup(us, bus, dev) == 0)
+    for (b = usb_get_busses(); b != NULL && us->first == NULL; b = b->next)
+      for (d = b->devices; d != NULL; d = d->next)
+        if (usbscan_ids(us, d) && usbscan_name_eq(b->dirname, bus) &&
+            usbscan_name_eq(d->filename, dev)) {
+          if (verbose > 1)
+            fprintf(stderr, "%s: trying USB device %s:%s first\n",
+                    progname, bus, dev);
+          us->first = d;
+          break;
+        }
+  if (us->first != NULL)
+    return us->first;
+
+  return usbscan_walk(us);
+}
+
+struct usb_device * usbscan_next(struct usbscan * us)
+{
+  return usbscan_walk(us);
+}
+
+void usbscan_found(struct usbscan * us, struct usb_device * dev)
+{
+  char bus[USBSCAN_NAMELEN], d[USBSCAN_NAMELEN];
+  const char * s;
+
+  if (usbscan_file[0] == 0 || us->serno[0] == 0)
+    return;
+  for (s = us->serno; *s != 0; s++)
+    if (isspace((int)*s))
+      return;
+
+  if (usbscan_lookup(us, bus, d) == 0 &&
+      strcmp(bus, dev->bus->dirname) == 0 && strcmp(d, dev->filename) == 0)
+    return;
+  usbscan_remember(us, dev->bus->dirname, dev->filename);
+}
+
+int usbscan_present(const char * port, int vid, const int * pids, int npids)
+{
+  struct usbscan us;
+  struct usb_device * d;
+  int i;
+
+  if (usbscan_port(port, USBSCAN_SERNO | USBSCAN_LOCATION, &us) < 0)
+    return -1;
+  /* a serial number cannot be told without opening the device */
+  if (us.dev[0] == 0)
+    us.bus[0] = 0;
+  us.serno[0] = 0;
+
+  usbscan_scan();
+  for (d = usbscan_first(&us, vid, 0); d != NULL; d = usbscan_next(&us)) {
+    if (npids == 0)
+      return 1;
+    for (i = 0; i < npids; i++)
+      if (d->descriptor.idProduct == pids[i])
+        return 1;
+  }
+
+  return 0;
+}
+
+#else  /* !HAVE_LIBUSB */
+
+int usbscan_present(const char * port, int vid, const int * pids, int npids)
+{
+  return -1;
+}
+
+#endif  /* HAVE_LIBUSB */
@@ -0,0 +1,92 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ * Copyright (C) 2026 The AVRDUDE developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef usbscan_h
+#define usbscan_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USBSCAN_NAMELEN  32
+#define USBSCAN_SERNOLEN 64
+
+/* what usbscan_port() accepts after "usb:" */
+#define USBSCAN_SERNO    0x01   /* a serial number */
+#define USBSCAN_LOCATION 0x02   /* bus:device */
+
+/*
+ * The device a -P usb... port asks for, and the state of a walk over
+ * the devices with a given vendor and product ID.
+ */
+struct usbscan {
+  char bus[USBSCAN_NAMELEN];      /* bus and device name, or empty */
+  char dev[USBSCAN_NAMELEN];
+  char serno[USBSCAN_SERNOLEN];   /* serial number, colons removed */
+  int vid, pid;
+  struct usb_bus * ubus;          /* walk state */
+  struct usb_device * udev;
+  struct usb_device * first;      /* device returned ahead of the walk */
+};
+
+/*
+ * Parse port, "usb", "usb:<serial number>" or "usb:<bus>:<device>",
+ * as far as what allows.  With both allowed, <bus>:<device> is tried
+ * as a location first and as a serial number (right-hand part of it,
+ * colons ignored) if there is no such device.  Anything else after
+ * "usb" is an error, reported here.
+ */
+int usbscan_port(const char * port, int what, struct usbscan * us);
+
+/* whether bus and device name the location us asks for */
+int usbscan_at(const struct usbscan * us, const char * bus, const char * dev);
+
+/* file remembering where devices with a given serial number were */
+void usbscan_cache(const char * file);
+
+/*
+ * Whether a device with vendor ID vid (0 for any) and one of the npids
+ * product IDs (any if none) is attached where port says, from a fresh
+ * scan of the busses.  A serial number in port is not checked, as that
+ * would mean opening the device.  Returns -1 without libusb.
+ */
+int usbscan_present(const char * port, int vid, const int * pids, int npids);
+
+#if defined(HAVE_LIBUSB)
+/*
+ * Walk the devices with vendor and product ID vid/pid (0 matches
+ * any), without opening any of them.  The busses are scanned once per
+ * run.  A location restricts the walk to the devices there; with a
+ * serial number, the device last seen with it comes first.  After usbscan_first(), us->serno holds
+ * the serial number the caller still has to check each device for
+ * (empty if any will do).  The walk ends with NULL.
+ */
+struct usb_device * usbscan_first(struct usbscan * us, int vid, int pid);
+struct usb_device * usbscan_next(struct usbscan * us);
+
+/* dev is the one with the serial number asked for; remember it */
+void usbscan_found(struct usbscan * us, struct usb_device * dev);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,6 +38,7 @@
 #include "config.h"
 #include "usbtiny.h"
 #include "usbdevs.h"
+#include "usbscan.h"
 
 #if defined(HAVE_LIBUSB)      // we use LIBUSB to talk to the board
 #if defined(HAVE_USB_H)
@@ -201,29 +202,15 @@ static int usbtiny_avr_op (PROGRAMMER * pgm, AVRPART * p,
 
 static	int	usbtiny_open(PROGRAMMER* pgm, char* name)
 {
-  struct usb_bus      *bus;
-  struct usb_device   *dev = 0;
-  char *bus_name = NULL;
-  char *dev_name = NULL;
+  struct usb_device   *dev;
+  struct usbscan us, all;
   int vid, pid;
 
-  // if no -P was given or '-P usb' was given
-  if(strcmp(name, "usb") == 0)
-    name = NULL;
-  else {
-    // calculate bus and device names from -P option
-    const size_t usb_len = strlen("usb");
-    if(strncmp(name, "usb", usb_len) == 0 && ':' == name[usb_len]) {
-        bus_name = name + usb_len + 1;
-        dev_name = strchr(bus_name, ':');
-        if(NULL != dev_name)
-          *dev_name++ = '\0';
-    }
-  }
-
-  usb_init();                    // initialize the libusb system
-  usb_find_busses();             // have libusb scan all the usb busses available
-  usb_find_devices();            // have libusb scan all the usb devices available
+  // '-P usb' or '-P usb:bus:device'
+  if (usbscan_port(name, USBSCAN_LOCATION, &us) < 0)
+    return -1;
+  // all devices are walked, so -v lists the candidates
+  memset(&all, 0, sizeof(all));
 
   PDATA(pgm)->usb_handle = NULL;
 
@@ -244,34 +231,28 @@ static	int	usbtiny_open(PROGRAMMER* pgm, char* name)
   }
   
 
-  // now we iterate through all the busses and devices
-  for ( bus = usb_busses; bus; bus = bus->next ) {
-    for	( dev = bus->devices; dev; dev = dev->next ) {
-      if (dev->descriptor.idVendor == vid
-	  && dev->descriptor.idProduct == pid ) {   // found match?
+  // now we go through the devices with the right vendor and product ID
+  for (dev = usbscan_first(&all, vid, pid); dev; dev = usbscan_next(&all)) {
     if(verbose)
       fprintf(stderr,
 	      "%s: usbdev_open(): Found USBtinyISP, bus:device: %s:%s\n",
-	      progname, bus->dirname, dev->filename);
+	      progname, dev->bus->dirname, dev->filename);
     // if -P was given, match device by device name and bus name
-    if(name != NULL &&
-      (NULL == dev_name ||
-       strcmp(bus->dirname, bus_name) ||
-       strcmp(dev->filename, dev_name)))
+    if(strcmp(name, "usb") != 0 &&
+       (us.dev[0] == 0 || !usbscan_at(&us, dev->bus->dirname, dev->filename)))
+      continue;
+    PDATA(pgm)->usb_handle = usb_open(dev);           // attempt to connect to device
+
+    // wrong permissions or something?
+    if (!PDATA(pgm)->usb_handle) {
+      fprintf(stderr, "%s: Warning: cannot open USB device: %s\n",
+	      progname, usb_strerror());
       continue;
-	PDATA(pgm)->usb_handle = usb_open(dev);           // attempt to connect to device
-
-	// wrong permissions or something?
-	if (!PDATA(pgm)->usb_handle) {
-	  fprintf(stderr, "%s: Warning: cannot open USB device: %s\n",
-		  progname, usb_strerror());
-	  continue;
-	}
-      }
     }
+    break;
   }
 
-  if(NULL != name && NULL == dev_name) {
+  if(strcmp(name, "usb") != 0 && us.dev[0] == 0) {
     fprintf(stderr, "%s: Error: Invalid -P value: '%s'\n", progname, name);
     fprintf(stderr, "%sUse -P usb:bus:device\n", progbuf);
     return -1;
@@ -296,18 +277,52 @@ static	void usbtiny_close ( PROGRAMMER* pgm )
 }
 
 /* A simple calculator function determines the maximum size of data we can
-   shove through a USB connection without getting errors */
+   shove through a USB connection without getting errors: the largest
+   chunk whose transfer should take no longer than CHUNK_TIME at the given
+   SCK period.  usbtiny_tune_chunk() then corrects this from the time the
+   transfers actually take. */
 static void usbtiny_set_chunk_size (PROGRAMMER * pgm, int period)
 {
   PDATA(pgm)->chunk_size = CHUNK_SIZE;       // start with the maximum (default)
-  while	(PDATA(pgm)->chunk_size > 8 && period > 16) {
+  while	(PDATA(pgm)->chunk_size > CHUNK_MIN &&
+	 PDATA(pgm)->chunk_size * 32 * period > CHUNK_TIME) {
     // Reduce the chunk size for a slow SCK to reduce
     // the maximum time of a single USB transfer.
     PDATA(pgm)->chunk_size >>= 1;
-    period >>= 1;
   }
 }
 
+/* Adjust the chunk size after a full-sized chunk took usec microseconds
+   to transfer: halve it if the transfer had to be retried or took longer
+   than CHUNK_TIME, and double it if twice the chunk would still take less
+   than half of that. */
+static void usbtiny_tune_chunk (PROGRAMMER * pgm, int chunk, long usec,
+				int retried)
+{
+  if (chunk != PDATA(pgm)->chunk_size)
+    return;
+
+  if (retried || usec > CHUNK_TIME) {
+    if (PDATA(pgm)->chunk_size > CHUNK_MIN)
+      PDATA(pgm)->chunk_size >>= 1;
+  } else if (PDATA(pgm)->chunk_size < CHUNK_SIZE && 4 * usec < CHUNK_TIME) {
+    PDATA(pgm)->chunk_size <<= 1;
+  }
+
+  if (verbose > 2 && PDATA(pgm)->chunk_size != chunk)
+    fprintf(stderr, "%s: usbtiny: %d bytes took %ld us, chunk size now %d\n",
+	    progname, chunk, usec, PDATA(pgm)->chunk_size);
+}
+
+static long usbtiny_usec_since (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000000L +
+    (now.tv_usec - start->tv_usec);
+}
+
 /* Given a SCK bit-clock speed (in useconds) we verify its an OK speed and tell the
    USBtiny to update itself to the new frequency */
 static int usbtiny_set_sck_period (PROGRAMMER *pgm, double v)
@@ -455,6 +470,8 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
   unsigned int maxaddr = addr + n_bytes;
   int chunk;
   int function;
+  int retries;
+  struct timeval start;
 
 
   // First determine what we're doing
@@ -466,6 +483,11 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
 
   for (; addr < maxaddr; addr += chunk) {
     chunk = PDATA(pgm)->chunk_size;         // start with the maximum chunk size possible
+    if (chunk > maxaddr - addr)
+      chunk = maxaddr - addr;
+
+    retries = PDATA(pgm)->retries;
+    gettimeofday(&start, NULL);
 
     // Send the chunk of data to the USBtiny with the function we want
     // to perform
@@ -480,6 +502,9 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
                               // usb_in() multiplies this per byte.
       return -1;
     }
+
+    usbtiny_tune_chunk(pgm, chunk, usbtiny_usec_since(&start),
+		       PDATA(pgm)->retries != retries);
   }
 
   check_retries(pgm, "read");
@@ -500,6 +525,7 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   int next;
   int function;     // which SPI command to use
   int delay;        // delay required between SPI commands
+  struct timeval start;
 
   // First determine what we're doing
   if (strcmp( m->desc, "flash" ) == 0) {
@@ -525,6 +551,10 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     // we can only write a page at a time anyways
     if (m->paged && chunk > page_size)
       chunk = page_size;
+    if (chunk > maxaddr - addr)
+      chunk = maxaddr - addr;
+
+    gettimeofday(&start, NULL);
 
     if (usb_out(pgm,
 		function,       // Flash or EEPROM
@@ -539,6 +569,10 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       return -1;
     }
 
+    // only the plain data transfer tells about the chunk size
+    if (delay == 0)
+      usbtiny_tune_chunk(pgm, chunk, usbtiny_usec_since(&start), 0);
+
     next = addr + chunk;       // Calculate what address we're at now
     if (m->paged
 	&& ((next % page_size) == 0 || next == maxaddr) ) {
@@ -53,6 +53,8 @@
 
 // How much data, max, do we want to send in one USB packet?
 #define	CHUNK_SIZE	128	// must be power of 2 less than 256
+#define	CHUNK_MIN	8	// smallest chunk used at slow SCK
+#define	CHUNK_TIME	65536	// usec, longest single transfer aimed for
 
 // The default USB Timeout
 #define	USB_TIMEOUT	500	// msec
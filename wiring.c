@@ -236,5 +236,7 @@ void wiring_initpgm(PROGRAMMER * pgm)
   pgm->setup          = wiring_setup;
   pgm->teardown       = wiring_teardown;
   pgm->parseextparams = wiring_parseextparms;
+  /* CMD_PROGRAM_FLASH_ISP erases the page first */
+  pgm->page_write_erases = 1;
 }
 